@@ -0,0 +1,92 @@
+/*
+ * bench_suite: curve interpolation and evaluation of node hierarchies
+ */
+
+#include <cstdlib>
+#include <vector>
+#include "gfx/curves.hpp"
+#include "gfx/animation.hpp"
+#include "bench.hpp"
+
+#define CURVE_SAMPLES	1000
+
+static const int curve_args[] = {8, 64};
+static const int depth_args[] = {8, 32, 64};
+
+static scalar_t frand(scalar_t low, scalar_t high) {
+	return low + (high - low) * (scalar_t)rand() / (scalar_t)RAND_MAX;
+}
+
+static void make_curve(Curve *curve, int points) {
+	for(int i=0; i<points; i++) {
+		curve->add_control_point(Vector3(i, frand(-1, 1), frand(-1, 1)));
+	}
+}
+
+// samples the curve evenly, like drawing it or moving something along it
+static void sample_curve(BenchState &state, Curve *curve) {
+	make_curve(curve, state.arg);
+
+	Vector3 sum;
+	while(state.keep_running()) {
+		for(int i=0; i<CURVE_SAMPLES; i++) {
+			sum += curve->interpolate((scalar_t)i / (scalar_t)(CURVE_SAMPLES - 1));
+		}
+	}
+	bench_use(&sum);
+	state.items = CURVE_SAMPLES;
+}
+
+static void curve_bspline(BenchState &state) {
+	BSpline curve;
+	sample_curve(state, &curve);
+}
+BENCHMARK_ARGS(curve_bspline, curve_args);
+
+static void curve_catmull_rom(BenchState &state) {
+	CatmullRomSpline curve;
+	sample_curve(state, &curve);
+}
+BENCHMARK_ARGS(curve_catmull_rom, curve_args);
+
+static void curve_bezier(BenchState &state) {
+	BezierSpline curve;
+	sample_curve(state, &curve);
+}
+BENCHMARK_ARGS(curve_bezier, curve_args);
+
+/* A chain of keyframed nodes, evaluated at the leaf: every get_prs() walks
+ * all the way up and interpolates the keys of every node on the way. The
+ * time changes every iteration so that no cached result is ever reused.
+ */
+static void xform_chain(BenchState &state) {
+	std::vector<XFormNode*> nodes(state.arg);
+	for(int i=0; i<state.arg; i++) {
+		nodes[i] = new XFormNode;
+		if(i) {
+			nodes[i]->parent = nodes[i - 1];
+			nodes[i - 1]->children.push_back(nodes[i]);
+		}
+
+		for(int j=0; j<8; j++) {
+			unsigned long time = j * 1000;
+			nodes[i]->set_position(Vector3(frand(-1, 1), frand(-1, 1), frand(-1, 1)), time);
+			nodes[i]->set_rotation(Vector3(frand(0, 1), frand(0, 1), frand(0, 1)), time);
+		}
+	}
+
+	XFormNode *leaf = nodes[state.arg - 1];
+	unsigned long time = 0;
+	Vector3 sum;
+	while(state.keep_running()) {
+		sum += leaf->get_prs(time).position;
+		time = (time + 7) % 7000;
+	}
+	bench_use(&sum);
+	state.items = state.arg;
+
+	for(int i=0; i<state.arg; i++) {
+		delete nodes[i];
+	}
+}
+BENCHMARK_ARGS(xform_chain, depth_args);
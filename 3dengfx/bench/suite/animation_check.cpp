@@ -0,0 +1,260 @@
+/*
+ * bench_suite --check=animation
+ * Compares the array versions of the PRS and quaternion math used for
+ * evaluating animated nodes against the scalar functions, one node at a time.
+ * Along with the timings it reports the largest difference of each result
+ * from the reference: exact_slerp() for fast_slerp() (timed against slerp(),
+ * which keyframe interpolation uses), and the old matrix product for
+ * get_xform_matrix() and the old quaternion sandwich for inherit_prs().
+ *
+ * usage: bench_suite --check=animation [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "gfx/animation.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+/* ---- the old implementations, kept here for reference ---- */
+static Matrix4x4 old_xform_matrix(const PRS &prs) {
+	Matrix4x4 trans_mat, rot_mat, scale_mat, pivot_mat, neg_pivot_mat;
+
+	pivot_mat.set_translation(prs.pivot);
+	neg_pivot_mat.set_translation(-prs.pivot);
+
+	trans_mat.set_translation(prs.position);
+	rot_mat = (Matrix4x4)prs.rotation.get_rotation_matrix();
+	scale_mat.set_scaling(prs.scale);
+
+	return pivot_mat * trans_mat * rot_mat * scale_mat * neg_pivot_mat;
+}
+
+static PRS old_inherit_prs(const PRS &child, const PRS &parent) {
+	PRS prs;
+	prs.pivot = child.pivot;
+
+	prs.rotation = parent.rotation * child.rotation;
+
+	prs.position += child.position;
+	prs.position -= parent.position;
+	prs.position.transform(parent.rotation.conjugate());
+	prs.position += parent.position;
+
+	Vector3 ppos_trans = parent.position.transformed(parent.rotation.conjugate());
+	prs.position += ppos_trans;
+
+	prs.position.x *= parent.scale.x;
+	prs.position.y *= parent.scale.y;
+	prs.position.z *= parent.scale.z;
+
+	prs.scale.x = child.scale.x * parent.scale.x;
+	prs.scale.y = child.scale.y * parent.scale.y;
+	prs.scale.z = child.scale.z * parent.scale.z;
+
+	return prs;
+}
+
+
+static scalar_t frand(scalar_t low, scalar_t high) {
+	return low + (high - low) * (scalar_t)rand() / (scalar_t)RAND_MAX;
+}
+
+static Quaternion rand_quat() {
+	Vector3 axis(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+	axis.normalize();
+	return Quaternion(axis, frand(0, two_pi));
+}
+
+static PRS rand_prs() {
+	PRS prs;
+	prs.position = Vector3(frand(-100, 100), frand(-100, 100), frand(-100, 100));
+	prs.rotation = rand_quat();
+	prs.scale = Vector3(frand(0.5, 2), frand(0.5, 2), frand(0.5, 2));
+	prs.pivot = Vector3(frand(-5, 5), frand(-5, 5), frand(-5, 5));
+	return prs;
+}
+
+/* angle in degrees between the rotations of two quaternions, from the
+ * relative rotation conj(q1) * q2 (acos of the dot product is too
+ * inaccurate for small angles).
+ */
+static scalar_t quat_angle(const Quaternion &q1, const Quaternion &q2) {
+	double dot = (double)q1.s * q2.s + (double)q1.v.x * q2.v.x + (double)q1.v.y * q2.v.y + (double)q1.v.z * q2.v.z;
+	double x = (double)q1.s * q2.v.x - (double)q2.s * q1.v.x - ((double)q1.v.y * q2.v.z - (double)q1.v.z * q2.v.y);
+	double y = (double)q1.s * q2.v.y - (double)q2.s * q1.v.y - ((double)q1.v.z * q2.v.x - (double)q1.v.x * q2.v.z);
+	double z = (double)q1.s * q2.v.z - (double)q2.s * q1.v.z - ((double)q1.v.x * q2.v.y - (double)q1.v.y * q2.v.x);
+	return (scalar_t)(2.0 * atan2(sqrt(x * x + y * y + z * z), fabs(dot)) * 180.0 / pi);
+}
+
+static scalar_t max_diff(const Matrix4x4 &a, const Matrix4x4 &b) {
+	scalar_t diff = 0.0;
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			scalar_t d = fabs(a[i][j] - b[i][j]);
+			if(d > diff) diff = d;
+		}
+	}
+	return diff;
+}
+
+static void print_result(const char *name, unsigned long old_msec, unsigned long new_msec, scalar_t err) {
+	printf("%-22s old: %6lu ms   new: %6lu ms   speedup: %5.2f   max diff: %g\n", name,
+			old_msec, new_msec, new_msec ? (float)old_msec / (float)new_msec : 0.0f, (float)err);
+}
+
+// keeps the compiler from throwing away the results
+static scalar_t sink;
+
+static int check_animation(int argc, char **argv) {
+	int iter = argc > 1 ? atoi(argv[1]) : 200;
+	const int count = 4096;
+	ntimer timer;
+
+	if(iter <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	srand(0);
+	vector<PRS> child(count), parent(count), prs_res(count), old_prs_res(count);
+	vector<Quaternion> q1(count), q2(count), qres(count), old_qres(count);
+	vector<scalar_t> t(count);
+	vector<Matrix4x4> mres(count), old_mres(count);
+
+	for(int i=0; i<count; i++) {
+		child[i] = rand_prs();
+		parent[i] = rand_prs();
+		q1[i] = rand_quat();
+		q2[i] = rand_quat();
+		t[i] = frand(0, 1);
+	}
+
+	printf("%d nodes, %d iterations\n", count, iter);
+
+	unsigned long old_msec, new_msec;
+	scalar_t err;
+
+	// interpolation
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_qres[i] = slerp(q1[i], q2[i], t[i]);
+		}
+		sink += old_qres[j % count].s;
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		fast_slerp(&qres[0], &q1[0], &q2[0], &t[0], count);
+		sink += qres[j % count].s;
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, quat_angle(qres[i], exact_slerp(q1[i], q2[i], t[i])));
+	}
+	print_result("fast_slerp (degrees)", old_msec, new_msec, err);
+
+	// quaternion to matrix
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_mres[i] = Matrix4x4(q1[i].get_rotation_matrix());
+		}
+		sink += old_mres[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		get_rotation_matrices(&mres[0], &q1[0], count);
+		sink += mres[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(mres[i], old_mres[i]));
+	}
+	print_result("rotation matrices", old_msec, new_msec, err);
+
+	// PRS to matrix
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_mres[i] = old_xform_matrix(child[i]);
+		}
+		sink += old_mres[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			mres[i] = child[i].get_xform_matrix();
+		}
+		sink += mres[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(mres[i], old_mres[i]));
+	}
+	print_result("get_xform_matrix", old_msec, new_msec, err);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		get_xform_matrices(&mres[0], &child[0], count);
+		sink += mres[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(mres[i], old_mres[i]));
+	}
+	print_result("get_xform_matrices", old_msec, new_msec, err);
+
+	// hierarchy
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_prs_res[i] = old_inherit_prs(child[i], parent[i]);
+		}
+		sink += old_prs_res[j % count].position.x;
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		inherit_prs(&prs_res[0], &child[0], &parent[0], count);
+		sink += prs_res[j % count].position.x;
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, (prs_res[i].position - old_prs_res[i].position).length());
+		err = max(err, quat_angle(prs_res[i].rotation, old_prs_res[i].rotation));
+	}
+	print_result("inherit_prs", old_msec, new_msec, err);
+
+	return sink == 12345.0 ? 1 : 0;
+}
+BENCH_CHECK(animation, check_animation);
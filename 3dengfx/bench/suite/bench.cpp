@@ -0,0 +1,459 @@
+/*
+ * bench_suite
+ * Runs the registered benchmarks of the engine code which needs no graphics
+ * context: geometry generation and processing, scalar fields, particles,
+ * curves and hierarchies, image filters and decoding, and mesh loading.
+ * With --check it runs the registered checks instead, all of them with their
+ * default arguments, or only the named one with the arguments that follow.
+ *
+ * Every benchmark is scaled up until a run of it takes at least --min-time
+ * seconds, then it is run --repetitions times, each run starting from the
+ * same random seed. The time reported is the median of the repetitions, in
+ * nanoseconds per iteration, and --json writes the results in the layout of
+ * Google Benchmark's JSON output, for the usual comparison scripts.
+ *
+ * usage: bench_suite [--filter=substr] [--json=file] [--min-time=sec]
+ *                    [--repetitions=n] [--list]
+ *        bench_suite --check[=name [args]] [--list]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "3dengfx_config.h"
+#include "3dengfx/3denginefx.hpp"
+#include "common/threads.h"
+#include "bench.hpp"
+
+using namespace std;
+
+#define TMP_DIR			"bench_tmp"
+#define MAX_ITER		1000000000UL
+
+struct BenchEntry {
+	string name;
+	BenchFunc func;
+	int arg;
+	bool has_arg;
+};
+
+struct CheckEntry {
+	string name;
+	CheckFunc func;
+};
+
+struct BenchResult {
+	string name;
+	unsigned long iterations;
+	int repetitions;
+	double min_ns, mean_ns, median_ns;
+	double items_per_sec;
+};
+
+static vector<BenchEntry> *get_benchmarks() {
+	// constructed on first use, the registrations run at static initialization
+	static vector<BenchEntry> benchmarks;
+	return &benchmarks;
+}
+
+int register_bench(const char *name, BenchFunc func, const int *args, int arg_count) {
+	BenchEntry entry;
+	entry.func = func;
+
+	if(!arg_count) {
+		entry.name = name;
+		entry.arg = 0;
+		entry.has_arg = false;
+		get_benchmarks()->push_back(entry);
+		return 0;
+	}
+
+	for(int i=0; i<arg_count; i++) {
+		char buf[32];
+		sprintf(buf, "/%d", args[i]);
+		entry.name = string(name) + buf;
+		entry.arg = args[i];
+		entry.has_arg = true;
+		get_benchmarks()->push_back(entry);
+	}
+	return 0;
+}
+
+static vector<CheckEntry> *get_checks() {
+	static vector<CheckEntry> checks;
+	return &checks;
+}
+
+int register_check(const char *name, CheckFunc func) {
+	CheckEntry entry;
+	entry.name = name;
+	entry.func = func;
+	get_checks()->push_back(entry);
+	return 0;
+}
+
+static unsigned long get_usec() {
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+BenchState::BenchState(int arg, unsigned long iterations) {
+	this->arg = arg;
+	items = 0;
+	iter = 0;
+	max_iter = iterations;
+	start_usec = elapsed_usec = 0;
+	timing = false;
+}
+
+bool BenchState::keep_running() {
+	if(!iter && !timing) {
+		// first call, the setup of the benchmark is done
+		timing = true;
+		start_usec = ::get_usec();
+	}
+
+	if(iter < max_iter) {
+		iter++;
+		return true;
+	}
+
+	if(timing) {
+		elapsed_usec += ::get_usec() - start_usec;
+		timing = false;
+	}
+	return false;
+}
+
+void BenchState::pause_timing() {
+	if(timing) {
+		elapsed_usec += ::get_usec() - start_usec;
+		timing = false;
+	}
+}
+
+void BenchState::resume_timing() {
+	if(!timing) {
+		timing = true;
+		start_usec = ::get_usec();
+	}
+}
+
+unsigned long BenchState::get_iterations() const {
+	return iter;
+}
+
+unsigned long BenchState::get_usec() const {
+	return elapsed_usec;
+}
+
+bool BenchState::finished() const {
+	return iter == max_iter && !timing;
+}
+
+static const void *volatile sink;
+
+void bench_use(const void *ptr) {
+	sink = ptr;
+}
+
+string bench_tmp_file(const char *name) {
+	mkdir(TMP_DIR, 0770);
+	return string(TMP_DIR "/") + name;
+}
+
+// the checks leave whole directories of output in there
+static void remove_tree(const string &path) {
+	DIR *dir = opendir(path.c_str());
+	if(!dir) {
+		remove(path.c_str());
+		return;
+	}
+
+	struct dirent *ent;
+	while((ent = readdir(dir))) {
+		if(strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) {
+			remove_tree(path + "/" + ent->d_name);
+		}
+	}
+	closedir(dir);
+	rmdir(path.c_str());
+}
+
+static void remove_tmp_files() {
+	remove_tree(TMP_DIR);
+}
+
+// runs the benchmark once with the given iteration count, returns the usec taken or -1
+static long run_once(const BenchEntry &bench, unsigned long iterations, unsigned long *items) {
+	srand(BENCH_SEED);
+
+	BenchState state(bench.arg, iterations);
+	bench.func(state);
+
+	if(!state.finished()) {
+		fprintf(stderr, "%s: the benchmark loop stopped after %lu of %lu iterations\n", bench.name.c_str(),
+				state.get_iterations(), iterations);
+		return -1;
+	}
+	if(items) *items = state.items;
+	return state.get_usec();
+}
+
+static bool run_bench(const BenchEntry &bench, double min_time, int repetitions, BenchResult *res) {
+	unsigned long min_usec = (unsigned long)(min_time * 1000000.0);
+
+	// find an iteration count which takes at least min_time
+	unsigned long iterations = 1;
+	for(;;) {
+		long usec = run_once(bench, iterations, 0);
+		if(usec < 0) return false;
+		if((unsigned long)usec >= min_usec || iterations >= MAX_ITER) break;
+
+		double scale = usec > 0 ? 1.4 * min_usec / usec : 10.0;
+		if(scale > 10.0) scale = 10.0;
+		if(scale < 2.0) scale = 2.0;
+		iterations = (unsigned long)(iterations * scale);
+		if(iterations > MAX_ITER) iterations = MAX_ITER;
+	}
+
+	vector<double> times;
+	unsigned long items = 0;
+	for(int i=0; i<repetitions; i++) {
+		long usec = run_once(bench, iterations, &items);
+		if(usec < 0) return false;
+		times.push_back(usec * 1000.0 / iterations);
+	}
+	sort(times.begin(), times.end());
+
+	double sum = 0.0;
+	for(size_t i=0; i<times.size(); i++) {
+		sum += times[i];
+	}
+
+	res->name = bench.name;
+	res->iterations = iterations;
+	res->repetitions = repetitions;
+	res->min_ns = times[0];
+	res->mean_ns = sum / times.size();
+	if(times.size() & 1) {
+		res->median_ns = times[times.size() / 2];
+	} else {
+		res->median_ns = (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2.0;
+	}
+	res->items_per_sec = items && res->median_ns > 0.0 ? items * 1e9 / res->median_ns : 0.0;
+	return true;
+}
+
+static bool write_json(const char *fname, const vector<BenchResult> &results, double min_time, int repetitions) {
+	FILE *fp = fopen(fname, "w");
+	if(!fp) {
+		perror(fname);
+		return false;
+	}
+
+	char date[64];
+	time_t now = time(0);
+	strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+	char host[256] = "unknown";
+	gethostname(host, sizeof host - 1);
+
+	fprintf(fp, "{\n  \"context\": {\n");
+	fprintf(fp, "    \"date\": \"%s\",\n", date);
+	fprintf(fp, "    \"host_name\": \"%s\",\n", host);
+	fprintf(fp, "    \"library\": \"3dengfx\",\n");
+	fprintf(fp, "    \"library_version\": \"%s\",\n", VER_STR);
+	fprintf(fp, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(fp, "    \"worker_threads\": %d,\n", thr_get_num_workers());
+#ifdef USE_PROFILER
+	fprintf(fp, "    \"profiler\": true,\n");
+#else
+	fprintf(fp, "    \"profiler\": false,\n");
+#endif
+	fprintf(fp, "    \"seed\": %d,\n", BENCH_SEED);
+	fprintf(fp, "    \"min_time\": %g,\n", min_time);
+	fprintf(fp, "    \"repetitions\": %d\n", repetitions);
+	fprintf(fp, "  },\n  \"benchmarks\": [");
+
+	for(size_t i=0; i<results.size(); i++) {
+		const BenchResult &r = results[i];
+		fprintf(fp, "%s\n    {\n", i ? "," : "");
+		fprintf(fp, "      \"name\": \"%s\",\n", r.name.c_str());
+		fprintf(fp, "      \"iterations\": %lu,\n", r.iterations);
+		fprintf(fp, "      \"repetitions\": %d,\n", r.repetitions);
+		fprintf(fp, "      \"real_time\": %.3f,\n", r.median_ns);
+		fprintf(fp, "      \"min_time\": %.3f,\n", r.min_ns);
+		fprintf(fp, "      \"mean_time\": %.3f,\n", r.mean_ns);
+		fprintf(fp, "      \"time_unit\": \"ns\"");
+		if(r.items_per_sec > 0.0) {
+			fprintf(fp, ",\n      \"items_per_second\": %.3f", r.items_per_sec);
+		}
+		fprintf(fp, "\n    }");
+	}
+	fprintf(fp, "\n  ]\n}\n");
+
+	bool ok = !ferror(fp);
+	if(fclose(fp) != 0) ok = false;
+	return ok;
+}
+
+/* run_check
+ * every check starts from the same state: the seed, the default thread
+ * pool, and no graphics context, even if the previous one failed halfway.
+ */
+static bool run_check(const CheckEntry &check, const char *prog, const vector<char*> &args) {
+	string name = string(prog) + " --check=" + check.name;
+
+	vector<char*> argv;
+	argv.push_back(&name[0]);
+	argv.insert(argv.end(), args.begin(), args.end());
+	argv.push_back(0);
+
+	printf("==== %s\n", check.name.c_str());
+	fflush(stdout);
+
+	srand(BENCH_SEED);
+	int res = check.func((int)argv.size() - 1, &argv[0]);
+
+	thr_set_num_workers(0);
+	destroy_graphics_context();
+
+	printf("==== %s: %s\n\n", check.name.c_str(), res ? "FAILED" : "passed");
+	fflush(stdout);
+	return res == 0;
+}
+
+static int run_checks(const char *prog, const char *only, const vector<char*> &args, bool list) {
+	const vector<CheckEntry> &checks = *get_checks();
+	vector<string> failed;
+	bool found = false;
+
+	for(size_t i=0; i<checks.size(); i++) {
+		if(only && checks[i].name != only) continue;
+		found = true;
+
+		if(list) {
+			printf("%s\n", checks[i].name.c_str());
+		} else if(!run_check(checks[i], prog, args)) {
+			failed.push_back(checks[i].name);
+		}
+	}
+	remove_tmp_files();
+
+	if(!found) {
+		fprintf(stderr, "no check named %s, see --check --list\n", only);
+		return 1;
+	}
+	if(list) return 0;
+
+	if(failed.empty()) {
+		printf("all checks passed\n");
+		return 0;
+	}
+	printf("%d checks failed:", (int)failed.size());
+	for(size_t i=0; i<failed.size(); i++) {
+		printf(" %s", failed[i].c_str());
+	}
+	putchar('\n');
+	return 1;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [--filter=substr] [--json=file] [--min-time=sec] [--repetitions=n] [--list]\n", prog);
+	fprintf(stderr, "       %s --check[=name [args]] [--list]\n", prog);
+}
+
+int main(int argc, char **argv) {
+	const char *filter = 0, *json_fname = 0;
+	double min_time = 0.2;
+	int repetitions = 3;
+	bool list = false;
+	bool check = false;
+	const char *check_name = 0;
+	vector<char*> check_args;
+
+	for(int i=1; i<argc; i++) {
+		if(!strcmp(argv[i], "--check")) {
+			check = true;
+		} else if(!strncmp(argv[i], "--check=", 8)) {
+			check = true;
+			check_name = argv[i] + 8;
+		} else if(check_name && argv[i][0] != '-') {
+			check_args.push_back(argv[i]);
+		} else if(!strncmp(argv[i], "--filter=", 9)) {
+			filter = argv[i] + 9;
+		} else if(!strncmp(argv[i], "--json=", 7)) {
+			json_fname = argv[i] + 7;
+		} else if(!strncmp(argv[i], "--min-time=", 11)) {
+			min_time = atof(argv[i] + 11);
+		} else if(!strncmp(argv[i], "--repetitions=", 14)) {
+			repetitions = atoi(argv[i] + 14);
+		} else if(!strcmp(argv[i], "--list")) {
+			list = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(min_time <= 0.0 || repetitions < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(check) {
+		return run_checks(argv[0], check_name, check_args, list);
+	}
+
+	const vector<BenchEntry> &benchmarks = *get_benchmarks();
+
+	if(!list) {
+		printf("%-40s %14s %14s %12s %14s\n", "benchmark", "time (ns)", "min (ns)", "iterations", "items/s");
+	}
+
+	vector<BenchResult> results;
+	int failed = 0;
+
+	for(size_t i=0; i<benchmarks.size(); i++) {
+		if(filter && !strstr(benchmarks[i].name.c_str(), filter)) continue;
+
+		if(list) {
+			printf("%s\n", benchmarks[i].name.c_str());
+			continue;
+		}
+
+		BenchResult res;
+		if(!run_bench(benchmarks[i], min_time, repetitions, &res)) {
+			failed++;
+			continue;
+		}
+		results.push_back(res);
+
+		printf("%-40s %14.1f %14.1f %12lu", res.name.c_str(), res.median_ns, res.min_ns, res.iterations);
+		if(res.items_per_sec > 0.0) {
+			printf(" %14.4g", res.items_per_sec);
+		}
+		putchar('\n');
+		fflush(stdout);
+	}
+	remove_tmp_files();
+
+	if(json_fname && !list) {
+		if(!write_json(json_fname, results, min_time, repetitions)) {
+			return 1;
+		}
+		printf("results written to %s\n", json_fname);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * bench_suite harness
+ * A benchmark is a function which does its setup, then runs the measured
+ * code in a while(state.keep_running()) loop, then cleans up. Only the loop
+ * is timed, and it runs as many iterations as the harness asks for, so the
+ * harness can scale them up until the measurement is long enough.
+ *
+ * A check is a whole self-checking program: it takes the arguments given
+ * after --check=name on the command line (none when all the checks run),
+ * prints its own report, and returns 0 if everything it checked was right.
+ */
+
+#ifndef _BENCH_HPP_
+#define _BENCH_HPP_
+
+#include <string>
+
+// every run of a benchmark starts from srand(BENCH_SEED)
+#define BENCH_SEED		0x3def
+
+class BenchState {
+private:
+	unsigned long iter, max_iter;
+	unsigned long start_usec, elapsed_usec;
+	bool timing;
+
+public:
+	int arg;					// the argument the benchmark was registered with, or 0
+	unsigned long items;		// items processed per iteration, for the items/sec rate
+
+	BenchState(int arg, unsigned long iterations);
+
+	bool keep_running();
+
+	// excludes per-iteration setup from the measurement
+	void pause_timing();
+	void resume_timing();
+
+	unsigned long get_iterations() const;
+	unsigned long get_usec() const;
+	bool finished() const;
+};
+
+typedef void (*BenchFunc)(BenchState &state);
+typedef int (*CheckFunc)(int argc, char **argv);
+
+int register_bench(const char *name, BenchFunc func, const int *args, int arg_count);
+int register_check(const char *name, CheckFunc func);
+
+// keeps the compiler from dropping a result which is never used
+void bench_use(const void *ptr);
+
+// path of a scratch file, in a directory which is removed at exit
+std::string bench_tmp_file(const char *name);
+
+#define BENCH_CONCAT_(a, b)		a##b
+#define BENCH_CONCAT(a, b)		BENCH_CONCAT_(a, b)
+
+#define BENCHMARK(func) \
+	static int BENCH_CONCAT(bench_reg_, __LINE__) = register_bench(#func, func, 0, 0)
+
+// runs once for every element of the static int array args
+#define BENCHMARK_ARGS(func, args) \
+	static int BENCH_CONCAT(bench_reg_, __LINE__) = \
+		register_bench(#func, func, args, sizeof args / sizeof *args)
+
+#define BENCH_CHECK(name, func) \
+	static int BENCH_CONCAT(check_reg_, __LINE__) = register_check(#name, func)
+
+#endif	// _BENCH_HPP_
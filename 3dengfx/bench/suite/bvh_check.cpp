@@ -0,0 +1,113 @@
+/*
+ * bench_suite --check=bvh
+ * Builds a scene of a grid of small spheres and swaps the meshes of some of
+ * them for bigger ones with Object::set_mesh(), between updates of the scene
+ * BVH. After every update the bounds the BVH holds for each object must be
+ * the current bounds of the object, and a ray passing by a swapped sphere
+ * (missing the small one, hitting the big one) must pick it. Meshes are
+ * swapped for meshes made the same way, which have gone through the same
+ * changes, and back.
+ *
+ * usage: bench_suite --check=bvh [grid size] [rounds]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "3dengfx/3dengfx.hpp"
+#include "bench.hpp"
+
+using namespace std;
+
+#define SPACING		10.0
+#define SMALL_RAD	1.0
+#define BIG_RAD		3.0
+
+static bool same_box(const AABox &a, const AABox &b) {
+	return (a.vmin - b.vmin).length() < 1e-4 && (a.vmax - b.vmax).length() < 1e-4;
+}
+
+// every object's item in the BVH must have the current bounds of the object
+static int check_bounds(const Scene *scene, const vector<Object*> &objects) {
+	const BVH *bvh = scene->get_bvh();
+	int errors = 0;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		AABox box;
+		Vector3 center;
+		scalar_t rad;
+		objects[i]->get_world_bounds(XFORM_LOCAL_PRS, &box, &center, &rad);
+
+		bool found = false;
+		for(int j=0; j<bvh->get_item_count(); j++) {
+			const BVHItem *item = bvh->get_item(j);
+			if(item->data == objects[i]) {
+				found = same_box(item->box, box);
+				break;
+			}
+		}
+		if(!found) errors++;
+	}
+	return errors;
+}
+
+// a ray along -z, 2 units to the side of the center of the object
+static Object *pick_beside(const Scene *scene, const Object *obj) {
+	Vector3 pos = obj->get_position();
+	Ray ray(Vector3(pos.x + 2.0, pos.y, pos.z + SPACING * 0.5), Vector3(0, 0, -SPACING));
+	return scene->pick(ray);
+}
+
+static int check_bvh(int argc, char **argv) {
+	int grid = argc > 1 ? atoi(argv[1]) : 8;
+	int rounds = argc > 2 ? atoi(argv[2]) : 4;
+
+	if(grid < 1 || rounds < 1) {
+		fprintf(stderr, "usage: %s [grid size] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	TriMesh small_mesh, big_mesh;
+	create_sphere(&small_mesh, SMALL_RAD, 8);
+	create_sphere(&big_mesh, BIG_RAD, 8);
+
+	Scene *scene = new Scene;
+	vector<Object*> objects;
+	for(int i=0; i<grid; i++) {
+		for(int j=0; j<grid; j++) {
+			Object *obj = new Object(small_mesh);
+			obj->set_position(Vector3(i * SPACING, j * SPACING, 0));
+			scene->add_object(obj);
+			objects.push_back(obj);
+		}
+	}
+
+	int bound_errors = 0, pick_errors = 0;
+	for(int r=0; r<rounds; r++) {
+		scene->update_bvh();
+		bound_errors += check_bounds(scene, objects);
+
+		// every few objects big in the even rounds, and small again in the odd ones
+		for(size_t i=r % 3; i<objects.size(); i+=3) {
+			bool big = !(r & 1);
+			TriMesh mesh;
+			create_sphere(&mesh, big ? BIG_RAD : SMALL_RAD, 8);
+			objects[i]->set_mesh(mesh);
+
+			scene->update_bvh();
+			Object *hit = pick_beside(scene, objects[i]);
+			if(big != (hit == objects[i])) pick_errors++;
+		}
+
+		scene->update_bvh();
+		bound_errors += check_bounds(scene, objects);
+	}
+
+	printf("%d objects, %d rounds of mesh swaps\n", (int)objects.size(), rounds);
+	printf("bounds check: %s (%d errors)\n", bound_errors ? "FAILED" : "ok", bound_errors);
+	printf("pick check: %s (%d errors)\n", pick_errors ? "FAILED" : "ok", pick_errors);
+
+	delete scene;
+	return bound_errors || pick_errors ? 1 : 0;
+}
+BENCH_CHECK(bvh, check_bvh);
@@ -0,0 +1,56 @@
+/*
+ * bench_suite: scalar field polygonization and particle systems
+ */
+
+#include <cmath>
+#include "3dengfx/3dengfx.hpp"
+#include "bench.hpp"
+
+static const int field_args[] = {16, 32, 48};
+static const int psys_args[] = {1000, 10000};
+
+static scalar_t blobs(const Vector3 &v, scalar_t t) {
+	Vector3 c1(sin(t) * 0.4, 0, 0), c2(0, cos(t) * 0.4, 0), c3(0, 0, sin(t * 1.3) * 0.4);
+	return 0.04 / ((v - c1).length_sq() + 0.001) + 0.04 / ((v - c2).length_sq() + 0.001) +
+		0.04 / ((v - c3).length_sq() + 0.001);
+}
+
+static void field_triangulate(BenchState &state) {
+	ScalarField field(state.arg, Vector3(-1, -1, -1), Vector3(1, 1, 1));
+	field.set_evaluator(blobs);
+	TriMesh mesh;
+
+	scalar_t t = 0.0;
+	while(state.keep_running()) {
+		field.triangulate(&mesh, 1.0, t, true);
+		t += 0.02;
+	}
+	state.items = state.arg * state.arg * state.arg;
+}
+BENCHMARK_ARGS(field_triangulate, field_args);
+
+/* One update per simulated 20ms, after a couple of simulated seconds, so the
+ * system is measured with a full population of particles being born and
+ * dying every frame.
+ */
+static void psys_update(BenchState &state) {
+	ParticleSystem psys;
+	ParticleSysParams *params = psys.get_params();
+	params->birth_rate = Fuzzy(state.arg);
+	params->lifespan = Fuzzy(1.0, 0.2);
+	params->shoot_dir = FuzzyVec3(Fuzzy(0, 1), Fuzzy(2, 0.5), Fuzzy(0, 1));
+	params->gravity = Vector3(0, -2, 0);
+
+	unsigned long msec = 0;
+	for(int i=0; i<100; i++) {
+		psys::set_global_time(msec += 20);
+		psys.update();
+	}
+
+	while(state.keep_running()) {
+		psys::set_global_time(msec += 20);
+		psys.update();
+	}
+	state.items = state.arg / 50;	// particles born per update
+}
+BENCHMARK_ARGS(psys_update, psys_args);
@@ -0,0 +1,183 @@
+/*
+ * bench_suite --check=framemem
+ * Runs frames of transient work without a graphics context: throwaway
+ * vertex arrays (like the ones drawn by draw_point/draw_line), scratch
+ * arrays filled in parallel by the thread pool (like the bump mapping
+ * tangents), and a particle system update. Every frame is run once with the
+ * transient memory on the heap and once from the frame arenas, and the heap
+ * allocations per frame are counted, after a warm up, along with the
+ * bytes the frame arenas handed out for every subsystem. It also checks that
+ * arrays in the frame arena hold their data, move to the heap when
+ * modified, and that copies of them keep their data past the end of the
+ * frame.
+ *
+ * usage: bench_suite --check=framemem [frames] [quads per frame]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "3dengfx/3dengfx.hpp"
+#include "common/arena.h"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+/* counts every heap allocation of the whole bench_suite, which costs the
+ * other benchmarks no more than the increment.
+ */
+static unsigned long heap_allocs;
+
+void *operator new(size_t size) throw(std::bad_alloc) {
+	heap_allocs++;
+	void *ptr = malloc(size + 1);	// unique pointers for 0 bytes too
+	if(!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size) throw(std::bad_alloc) {
+	return operator new(size);
+}
+
+void operator delete(void *ptr) throw() {
+	free(ptr);
+}
+
+void operator delete[](void *ptr) throw() {
+	free(ptr);
+}
+
+#define SCRATCH_JOBS	8
+#define SCRATCH_COUNT	4096
+
+static bool use_arena;
+static volatile scalar_t sink;
+
+static void scratch_work(int idx, void *cls) {
+	Vector3 *tan;
+	if(use_arena) {
+		tan = (Vector3*)frame_alloc(SCRATCH_COUNT * sizeof *tan, FRAME_MEM_BUMP);
+	} else {
+		tan = new Vector3[SCRATCH_COUNT];
+	}
+
+	for(int i=0; i<SCRATCH_COUNT; i++) {
+		tan[i] = Vector3((scalar_t)i, (scalar_t)idx, 1.0);
+	}
+	((scalar_t*)cls)[idx] = tan[SCRATCH_COUNT - 1].x;
+
+	if(!use_arena) delete [] tan;
+}
+
+static void run_frame(ParticleSystem *psys, int quads, unsigned long msec) {
+	for(int i=0; i<quads; i++) {
+		Vertex quad[] = {
+			Vertex(Vector3(-1, -1, i)), Vertex(Vector3(-1, 1, i)),
+			Vertex(Vector3(1, 1, i)), Vertex(Vector3(1, -1, i))
+		};
+
+		if(use_arena) {
+			VertexArray va(quad, 4, FRAME_MEM_GEOMETRY);
+			sink = va.get_data()[3].pos.z;
+		} else {
+			VertexArray va(quad, 4);
+			sink = va.get_data()[3].pos.z;
+		}
+	}
+
+	scalar_t res[SCRATCH_JOBS];
+	thr_parallel_for(SCRATCH_JOBS, scratch_work, res);
+	sink = res[0];
+
+	psys::set_global_time(msec);
+	psys->update();
+
+	frame_reset();
+}
+
+static int check_framemem(int argc, char **argv) {
+	int frames = argc > 1 ? atoi(argv[1]) : 200;
+	int quads = argc > 2 ? atoi(argv[2]) : 2000;
+	const int warmup = 100;
+
+	if(frames <= 0 || quads < 0) {
+		fprintf(stderr, "usage: %s [frames] [quads per frame]\n", argv[0]);
+		return 1;
+	}
+
+	ParticleSystem psys;
+	ParticleSysParams *params = psys.get_params();
+	params->birth_rate = Fuzzy(2000.0);
+	params->lifespan = Fuzzy(1.0, 0.2);
+
+	frame_mem_set_stats(1);
+
+	ntimer timer;
+	unsigned long msec[2], allocs[2];
+	unsigned long t = 0;
+
+	for(int k=0; k<2; k++) {
+		use_arena = k == 1;
+
+		for(int i=0; i<warmup; i++) {
+			run_frame(&psys, quads, t += 20);
+		}
+
+		unsigned long start_allocs = heap_allocs;
+		timer_reset(&timer);
+		timer_start(&timer);
+		for(int i=0; i<frames; i++) {
+			run_frame(&psys, quads, t += 20);
+		}
+		msec[k] = timer_getmsec(&timer);
+		allocs[k] = heap_allocs - start_allocs;
+	}
+
+	printf("%d frames, %d transient arrays and %d scratch arrays per frame, %d threads\n",
+			frames, quads, SCRATCH_JOBS, thr_get_num_workers());
+	printf("heap:        %8.1f allocations/frame, %7.3f ms/frame\n", (float)allocs[0] / frames, (float)msec[0] / frames);
+	printf("frame arena: %8.1f allocations/frame, %7.3f ms/frame, %lu arena blocks from the heap last frame\n",
+			(float)allocs[1] / frames, (float)msec[1] / frames, frame_mem_heap_allocs());
+
+	printf("\nframe arena bytes per frame:\n");
+	for(int i=0; i<FRAME_MEM_TAG_COUNT; i++) {
+		printf("  %-16s %10lu\n", frame_mem_tag_name((frame_mem_tag)i), frame_mem_bytes((frame_mem_tag)i));
+	}
+
+	// arrays in the frame arena
+	int errors = 0;
+	Vertex quad[] = {Vertex(Vector3(1, 2, 3)), Vertex(Vector3(4, 5, 6))};
+	VertexArray mod, copy;
+	{
+		VertexArray va(quad, 2, FRAME_MEM_GEOMETRY);
+		VertexArray va_copy = va;
+		mod = va;
+
+		if(va.get_count() != 2 || !(va.get_data()[1].pos == Vector3(4, 5, 6))) errors++;
+		if(((unsigned long)va.get_data() & 15) != 0) errors++;
+
+		Vertex *vptr = mod.get_mod_data();
+		vptr[0].pos = Vector3(0, 0, 0);
+		if(mod.get_data() == va.get_data()) errors++;
+		if(!(va.get_data()[0].pos == Vector3(1, 2, 3))) errors++;
+		if(mod.is_shared()) errors++;
+
+		if(va_copy.get_data() == va.get_data() || va_copy.is_shared()) errors++;
+		copy = va_copy;
+	}
+
+	// scribble over the arena, the copies must not notice
+	frame_reset();
+	memset(frame_alloc(4096, FRAME_MEM_GEOMETRY), 0xff, 4096);
+	if(copy.get_count() != 2 || !(copy.get_data()[1].pos == Vector3(4, 5, 6))) errors++;
+	if(!(mod.get_data()[1].pos == Vector3(4, 5, 6))) errors++;
+	frame_reset();
+
+	if(allocs[1] >= allocs[0]) errors++;
+	if(frame_mem_heap_allocs()) errors++;		// steady state
+	printf("\nframe arena check: %s (%d errors)\n", errors ? "FAILED" : "ok", errors);
+
+	return errors ? 1 : 0;
+}
+BENCH_CHECK(framemem, check_framemem);
@@ -0,0 +1,228 @@
+/*
+ * bench_suite --check=framewriter
+ * Writes a sequence of synthetic frames, once the way sequence rendering
+ * used to (render, then encode and write the frame, then the next one),
+ * and once through the FrameWriter, with the encoding done by its threads
+ * while the next frames are "rendered". Rendering is simulated by sleeping,
+ * as a GPU bound renderer leaves the CPU idle. No graphics context needed.
+ * Then it checks that both wrote the same files, including the frames
+ * submitted bottom up.
+ * Then the same frames go to the single file sinks: a Y4M stream, a raw
+ * RGBA stream, and a memory mapped frame store, which are checked too.
+ *
+ * usage: bench_suite --check=framewriter [frames] [render msec] [encoders] [tga|ppm]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "3dengfx/framewriter.hpp"
+#include "gfx/color_bits.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+#define XSZ		640
+#define YSZ		360
+
+static void make_frame(uint32_t *pixels, int frame, bool bottom_up) {
+	for(int i=0; i<YSZ; i++) {
+		int row = bottom_up ? YSZ - 1 - i : i;
+		for(int j=0; j<XSZ; j++) {
+			uint32_t r = (j + frame * 4) & 0xff;
+			uint32_t g = (row * 255) / YSZ;
+			uint32_t b = ((j ^ row) + frame) & 0xff;
+			pixels[i * XSZ + j] = 0xff000000 | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+// the output goes to a directory in the scratch directory of the suite
+static std::string out_dir;
+
+static std::string out_file(const char *name) {
+	return out_dir + "/" + name;
+}
+
+static std::string frame_name(const char *prefix, int frame, const char *sfx) {
+	char buf[256];
+	sprintf(buf, "%s%04d.%s", prefix, frame, sfx);
+	return buf;
+}
+
+// renders frames into the writer, returns the msec it took
+static unsigned long run_writer(FrameWriter *writer, int frames, int render_msec) {
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<frames; i++) {
+		usleep(render_msec * 1000);
+		make_frame(writer->get_buffer(XSZ, YSZ), i, i & 1);	// odd frames bottom up
+		writer->submit(i & 1);
+	}
+	writer->finish();
+	return timer_getmsec(&timer);
+}
+
+static long file_size(const char *fname) {
+	struct stat sbuf;
+	return stat(fname, &sbuf) == -1 ? -1 : (long)sbuf.st_size;
+}
+
+static void frame_rgba(unsigned char *dest, int frame) {
+	static uint32_t pixels[XSZ * YSZ];
+	make_frame(pixels, frame, false);
+	for(int i=0; i<XSZ * YSZ; i++) {
+		*dest++ = (pixels[i] >> RED_SHIFT32) & 0xff;
+		*dest++ = (pixels[i] >> GREEN_SHIFT32) & 0xff;
+		*dest++ = (pixels[i] >> BLUE_SHIFT32) & 0xff;
+		*dest++ = (pixels[i] >> ALPHA_SHIFT32) & 0xff;
+	}
+}
+
+static uint32_t get_le32(const unsigned char *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+// every frame in the file must be the expected RGBA bytes, after skip bytes
+static int check_rgba_frames(const char *fname, long skip, int frames) {
+	static unsigned char expected[XSZ * YSZ * 4], buf[XSZ * YSZ * 4];
+	FILE *fp = fopen(fname, "rb");
+	int errors = 0;
+
+	if(!fp || fseek(fp, skip, SEEK_SET) == -1) {
+		if(fp) fclose(fp);
+		return frames;
+	}
+	for(int i=0; i<frames; i++) {
+		frame_rgba(expected, i);
+		if(fread(buf, 1, sizeof buf, fp) != sizeof buf || memcmp(buf, expected, sizeof buf) != 0) {
+			errors++;
+		}
+	}
+	fclose(fp);
+	return errors;
+}
+
+static bool same_file(const char *fname1, const char *fname2) {
+	FILE *fp1 = fopen(fname1, "rb");
+	FILE *fp2 = fopen(fname2, "rb");
+	bool same = fp1 && fp2;
+
+	while(same) {
+		int c = fgetc(fp1);
+		if(c != fgetc(fp2)) same = false;
+		if(c == EOF) break;
+	}
+
+	if(fp1) fclose(fp1);
+	if(fp2) fclose(fp2);
+	return same;
+}
+
+static int check_framewriter(int argc, char **argv) {
+	int frames = argc > 1 ? atoi(argv[1]) : 60;
+	int render_msec = argc > 2 ? atoi(argv[2]) : 10;
+	int encoders = argc > 3 ? atoi(argv[3]) : 0;
+	const char *fmt_name = argc > 4 ? argv[4] : "tga";
+
+	// the image library can't write png and jpeg yet
+	int fmt = -1;
+	if(strcmp(fmt_name, "tga") == 0) fmt = IMG_FMT_TGA;
+	if(strcmp(fmt_name, "ppm") == 0) fmt = IMG_FMT_PPM;
+
+	if(frames <= 0 || render_msec < 0 || encoders < 0 || fmt == -1) {
+		fprintf(stderr, "usage: %s [frames] [render msec] [encoders] [tga|ppm]\n", argv[0]);
+		return 1;
+	}
+	image_file_format ifmt = (image_file_format)fmt;
+
+	out_dir = bench_tmp_file("fw_out");
+	mkdir(out_dir.c_str(), 0770);
+	static uint32_t pixels[XSZ * YSZ];
+	ntimer timer;
+
+	// synchronous, like screen_capture() after every frame
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<frames; i++) {
+		usleep(render_msec * 1000);
+		make_frame(pixels, i, false);
+		save_image(frame_name(out_file("sync").c_str(), i, fmt_name).c_str(), pixels, XSZ, YSZ, ifmt);
+	}
+	unsigned long sync_msec = timer_getmsec(&timer);
+
+	// frame writer
+	ImageFrameSink img_sink(out_dir.c_str(), "async", ifmt);
+	FrameWriter writer(&img_sink, encoders);
+	unsigned long async_msec = run_writer(&writer, frames, render_msec);
+
+	const FrameWriterStats *stats = writer.get_stats();
+	printf("%d frames of %dx%d %s, %d ms of rendering each\n", frames, XSZ, YSZ, fmt_name, render_msec);
+	printf("synchronous:  %7.2f ms/frame, %6.1f frames/sec\n", (float)sync_msec / frames,
+			sync_msec ? frames * 1000.0 / sync_msec : 0.0);
+	printf("frame writer: %7.2f ms/frame, %6.1f frames/sec, speedup %.2f\n", (float)async_msec / frames,
+			async_msec ? frames * 1000.0 / async_msec : 0.0, async_msec ? (float)sync_msec / async_msec : 0.0);
+	printf("  %.2f ms encoding per frame, %lu stalls waiting for the encoders (%lu ms)\n",
+			(float)stats->encode_msec / frames, stats->stalls, stats->stall_msec);
+
+	/* the frames must match the ones written synchronously byte for byte,
+	 * including the bottom up ones, which are flipped by the writer.
+	 */
+	int errors = stats->failed ? 1 : 0;
+	if(stats->frames != (unsigned long)frames) errors++;
+
+	for(int i=0; i<frames; i++) {
+		std::string sync_name = frame_name(out_file("sync").c_str(), i, fmt_name);
+		if(!same_file(sync_name.c_str(), frame_name(out_file("async").c_str(), i, fmt_name).c_str())) {
+			errors++;
+		}
+	}
+	printf("frame check: %s (%d errors)\n", errors ? "FAILED" : "ok", errors);
+
+	// single file sinks
+	StreamFrameSink y4m_sink(out_file("stream.y4m").c_str(), STREAM_Y4M, 25);
+	StreamFrameSink rgba_sink(out_file("stream.rgba").c_str(), STREAM_RGBA);
+	MappedFrameSink map_sink(out_file("frames.store").c_str(), frames);
+
+	const char *sink_names[] = {"y4m stream", "rgba stream", "mapped store"};
+	FrameSink *sinks[] = {&y4m_sink, &rgba_sink, &map_sink};
+	int sink_errors = 0;
+
+	for(int i=0; i<3; i++) {
+		FrameWriter sw(sinks[i], encoders);
+		unsigned long msec = run_writer(&sw, frames, render_msec);
+		const FrameWriterStats *st = sw.get_stats();
+		printf("%-13s %7.2f ms/frame, %6.1f frames/sec, %.2f ms writing per frame\n", sink_names[i],
+				(float)msec / frames, msec ? frames * 1000.0 / msec : 0.0, (float)st->encode_msec / frames);
+		if(st->failed) sink_errors++;
+	}
+
+	// the y4m frames are lossy, so only the size is checked
+	char hdr[128];
+	sprintf(hdr, "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C420jpeg\n", XSZ, YSZ);
+	if(file_size(out_file("stream.y4m").c_str()) != (long)(strlen(hdr) + frames * (6 + XSZ * YSZ * 3 / 2))) {
+		sink_errors++;
+	}
+
+	sink_errors += check_rgba_frames(out_file("stream.rgba").c_str(), 0, frames);
+	if(file_size(out_file("stream.rgba").c_str()) != (long)frames * XSZ * YSZ * 4) sink_errors++;
+
+	unsigned char store_hdr[FRAME_STORE_HDR_SIZE];
+	FILE *fp = fopen(out_file("frames.store").c_str(), "rb");
+	if(!fp || fread(store_hdr, 1, sizeof store_hdr, fp) != sizeof store_hdr ||
+			memcmp(store_hdr, FRAME_STORE_MAGIC, 8) != 0 || get_le32(store_hdr + 12) != XSZ ||
+			get_le32(store_hdr + 16) != YSZ || get_le32(store_hdr + 20) != (uint32_t)frames ||
+			get_le32(store_hdr + 24) != (uint32_t)frames) {
+		sink_errors++;
+	}
+	if(fp) fclose(fp);
+	sink_errors += check_rgba_frames(out_file("frames.store").c_str(), FRAME_STORE_HDR_SIZE, frames);
+
+	printf("sink check: %s (%d errors)\n", sink_errors ? "FAILED" : "ok", sink_errors);
+
+	return errors || sink_errors ? 1 : 0;
+}
+BENCH_CHECK(framewriter, check_framewriter);
@@ -0,0 +1,188 @@
+/*
+ * bench_suite --check=hashtable
+ * Compares the open addressing HashTable against the old chained hash table
+ * it replaced, using the access patterns of the texture manager:
+ * insertion guarded by a find_first_val() check, lookups by const char*,
+ * and removal by value.
+ *
+ * usage: bench_suite --check=hashtable [number of keys]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <list>
+#include <vector>
+#include "common/hashtable.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+/* ---- the old chained hash table, kept here for reference ---- */
+template <class KeyType, class ValType>
+class ChainedHashTable {
+private:
+	size_t size;
+	vector<list<Pair<KeyType, ValType> > > table;
+
+	unsigned int (*hash_func)(const KeyType &key, unsigned long size);
+	unsigned int hash(const KeyType &key) {return (unsigned int)hash_func(key, (unsigned long)size);}
+
+public:
+	ChainedHashTable(unsigned long size = 101) {
+		this->size = size;
+		table.resize(size);
+	}
+
+	void set_hash_function(unsigned int (*hash_func)(const KeyType&, unsigned long)) {
+		this->hash_func = hash_func;
+	}
+
+	void insert(KeyType key, ValType value) {
+		Pair<KeyType, ValType> newpair;
+		newpair.key = key;
+		newpair.val = value;
+		table[hash(key)].push_back(newpair);
+	}
+
+	void remove(KeyType key) {
+		unsigned int pos = hash(key);
+		typename list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
+		while(iter != table[pos].end()) {
+			if(iter->key == key) {
+				table[pos].erase(iter);
+				return;
+			}
+			iter++;
+		}
+	}
+
+	Pair<KeyType, ValType> *find(KeyType key) {
+		unsigned int pos = hash(key);
+		typename list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
+		while(iter != table[pos].end()) {
+			if(iter->key == key) return &(*iter);
+			iter++;
+		}
+		return 0;
+	}
+
+	Pair<KeyType, ValType> *find_first_val(ValType val) {
+		for(size_t i=0; i<table.size(); i++) {
+			typename list<Pair<KeyType, ValType> >::iterator iter = table[i].begin();
+			while(iter != table[i].end()) {
+				if(iter->val == val) return &(*iter);
+				iter++;
+			}
+		}
+		return 0;
+	}
+};
+
+// the old string hash (Sedgewick), which copied the key to a temporary buffer
+static unsigned int old_string_hash(const string &key, unsigned long size) {
+	int hash = 0, a = 31415, b = 27183;
+	char *str = new char[key.length() + 1];
+	strcpy(str, key.c_str());
+
+	char *sptr = str;
+	while(*sptr) {
+		hash = (a * hash + *sptr++) % size;
+		a = a * b % (size - 1);
+	}
+	delete [] str;
+	return (unsigned int)(hash < 0 ? (hash + size) : hash);
+}
+
+
+struct BenchResult {
+	unsigned long insert_msec, find_msec, remove_msec;
+	unsigned long found;
+};
+
+template <class TableType>
+static void run(TableType *table, const vector<string> &keys, int *values, int lookups, BenchResult *res) {
+	ntimer timer;
+	size_t count = keys.size();
+
+	// insertion, guarded by a duplicate value check like add_texture()
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(size_t i=0; i<count; i++) {
+		if(!table->find_first_val(values + i)) {
+			table->insert(keys[i], values + i);
+		}
+	}
+	res->insert_msec = timer_getmsec(&timer);
+
+	// lookups by const char* like find_texture()
+	res->found = 0;
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<lookups; j++) {
+		for(size_t i=0; i<count; i++) {
+			if(table->find(keys[i].c_str())) res->found++;
+		}
+	}
+	res->find_msec = timer_getmsec(&timer);
+
+	// removal by value like remove_texture()
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(size_t i=0; i<count; i++) {
+		Pair<string, int*> *pair = table->find_first_val(values + i);
+		if(pair) table->remove(string(pair->key));
+	}
+	res->remove_msec = timer_getmsec(&timer);
+}
+
+static void print_result(const char *name, const BenchResult &res) {
+	printf("%-10s insert: %6lu ms   find: %6lu ms   remove: %6lu ms   (%lu found)\n",
+			name, res.insert_msec, res.find_msec, res.remove_msec, res.found);
+}
+
+static int check_hashtable(int argc, char **argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 20000;
+	int lookups = 50;
+
+	if(count <= 0) {
+		fprintf(stderr, "usage: %s [number of keys]\n", argv[0]);
+		return 1;
+	}
+
+	srand(0);
+	vector<string> keys(count);
+	int *values = new int[count];
+	for(int i=0; i<count; i++) {
+		char buf[64];
+		sprintf(buf, "data/textures/tex%05d_%d.png", i, rand() % 1000);
+		keys[i] = buf;
+		values[i] = i;
+	}
+
+	printf("%d keys, %d lookup passes\n", count, lookups);
+
+	BenchResult res;
+
+	ChainedHashTable<string, int*> *old_table = new ChainedHashTable<string, int*>;
+	old_table->set_hash_function(old_string_hash);
+	run(old_table, keys, values, lookups, &res);
+	print_result("chained", res);
+	delete old_table;
+
+	HashTable<string, int*> *new_table = new HashTable<string, int*>;
+	run(new_table, keys, values, lookups, &res);
+	print_result("open", res);
+	delete new_table;
+
+	new_table = new HashTable<string, int*>;
+	new_table->enable_value_index();
+	run(new_table, keys, values, lookups, &res);
+	print_result("open+vidx", res);
+	delete new_table;
+
+	delete [] values;
+	return 0;
+}
+BENCH_CHECK(hashtable, check_hashtable);
@@ -0,0 +1,98 @@
+/*
+ * bench_suite: image decoding and pixel buffer filters
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "gfx/image.h"
+#include "gfx/img_manip.hpp"
+#include "bench.hpp"
+
+static const int size_args[] = {256, 1024};
+
+// smooth gradients with some noise, so that RLE compression has something to do
+static void fill_image(Pixel *pixels, int xsz, int ysz) {
+	for(int i=0; i<ysz; i++) {
+		for(int j=0; j<xsz; j++) {
+			int r = (j * 255 / xsz) & 0xf8;
+			int g = (i * 255 / ysz) & 0xf8;
+			int b = rand() & 0xff;
+			*pixels++ = 0xff000000 | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+static void decode(BenchState &state, image_file_format fmt, const char *fname) {
+	PixelBuffer pb(state.arg, state.arg);
+	fill_image(pb.buffer, pb.width, pb.height);
+
+	std::string path = bench_tmp_file(fname);
+	if(save_image(path.c_str(), pb.buffer, pb.width, pb.height, fmt) == -1) {
+		fprintf(stderr, "failed to write %s\n", path.c_str());
+		return;
+	}
+
+	while(state.keep_running()) {
+		unsigned long xsz, ysz;
+		void *img = load_image(path.c_str(), &xsz, &ysz);
+		if(!img) break;
+		free_image(img);
+	}
+	state.items = pb.width * pb.height;
+	remove(path.c_str());
+}
+
+static void image_decode_tga(BenchState &state) {
+	decode(state, IMG_FMT_TGA, "decode.tga");
+}
+BENCHMARK_ARGS(image_decode_tga, size_args);
+
+static void image_decode_ppm(BenchState &state) {
+	decode(state, IMG_FMT_PPM, "decode.ppm");
+}
+BENCHMARK_ARGS(image_decode_ppm, size_args);
+
+static void image_kernel(BenchState &state) {
+	PixelBuffer pb(state.arg, state.arg);
+	fill_image(pb.buffer, pb.width, pb.height);
+
+	int kernel[] = {
+		1, 2, 1,
+		2, 4, 2,
+		1, 2, 1
+	};
+
+	while(state.keep_running()) {
+		apply_kernel(&pb, kernel, 3);
+	}
+	state.items = pb.width * pb.height;
+}
+BENCHMARK_ARGS(image_kernel, size_args);
+
+static void image_blur(BenchState &state) {
+	PixelBuffer pb(state.arg, state.arg);
+	fill_image(pb.buffer, pb.width, pb.height);
+
+	while(state.keep_running()) {
+		blur(&pb);
+	}
+	state.items = pb.width * pb.height;
+}
+BENCHMARK_ARGS(image_blur, size_args);
+
+// alternately shrinks the image to 3/4 of its size and scales it back up
+static void image_resample(BenchState &state) {
+	PixelBuffer pb(state.arg, state.arg);
+	fill_image(pb.buffer, pb.width, pb.height);
+
+	int small = state.arg * 3 / 4;
+	bool shrink = true;
+	while(state.keep_running()) {
+		int sz = shrink ? small : state.arg;
+		resample_pixel_buffer(&pb, sz, sz);
+		shrink = !shrink;
+	}
+	state.items = state.arg * state.arg;
+}
+BENCHMARK_ARGS(image_resample, size_args);
@@ -0,0 +1,166 @@
+/*
+ * bench_suite --check=instancing
+ * Builds a forest of objects out of a few meshes, once by copying the mesh
+ * into every object with its data duplicated (what Object(const TriMesh&)
+ * used to do), and once with Object::create_instance(), which shares the
+ * mesh data. It reports the time it takes, the geometry memory, and what
+ * reaches a null backend (no graphics context needed) when drawing a frame
+ * of each through the render queue: draws, instance batches and state
+ * changes. It also checks that modifying a shared mesh only affects the
+ * object it was modified through.
+ *
+ * usage: bench_suite --check=instancing [objects] [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <set>
+#include "3dengfx/object.hpp"
+#include "3dengfx/rqueue.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+static scalar_t frand(scalar_t low, scalar_t high) {
+	return low + (high - low) * (scalar_t)rand() / (scalar_t)RAND_MAX;
+}
+
+// geometry bytes of the distinct arrays used by the objects
+static unsigned long geometry_memory(const vector<Object*> &objects) {
+	set<const void*> seen;
+	unsigned long bytes = 0;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		const TriMesh &mesh = ((const Object*)objects[i])->get_mesh();
+		const VertexArray *va = mesh.get_vertex_array();
+		const TriangleArray *ta = mesh.get_triangle_array();
+		const IndexArray *ia = mesh.get_index_array();
+
+		if(seen.insert(va->get_data()).second) bytes += va->get_count() * sizeof(Vertex);
+		if(seen.insert(ta->get_data()).second) bytes += ta->get_count() * sizeof(Triangle);
+		if(seen.insert(ia->get_data()).second) bytes += ia->get_count() * sizeof(Index);
+	}
+	return bytes;
+}
+
+static void place(Object *obj) {
+	scalar_t z = frand(5, 500);
+	obj->set_position(Vector3(frand(-0.3, 0.3) * z, frand(-0.3, 0.3) * z, z));
+	obj->set_rotation(Vector3(0, frand(0, two_pi), 0));
+}
+
+static void draw_frames(vector<Object*> &objects, int iter, const char *name) {
+	NullRenderBackend backend;
+	RenderQueue rqueue(&backend);
+
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<iter; i++) {
+		rqueue.clear();
+		rqueue.add_objects(&objects[0], (int)objects.size());
+		rqueue.sort();
+		rqueue.submit();
+	}
+	unsigned long msec = timer_getmsec(&timer);
+
+	const RenderStats *stats = backend.get_stats();
+	printf("%-8s %8.1f draws, %6.1f batches, %8.1f state changes, %7.3f ms per frame\n", name,
+			(float)stats->draws / iter, (float)stats->batches / iter, (float)stats->total_changes() / iter,
+			(float)msec / iter);
+}
+
+static int check_instancing(int argc, char **argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 10000;
+	int iter = argc > 2 ? atoi(argv[2]) : 20;
+	const int proto_count = 3;
+	const int mat_count = 2;
+
+	if(count <= 0 || iter <= 0) {
+		fprintf(stderr, "usage: %s [objects] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	// camera at the origin looking down +z
+	set_matrix(XFORM_VIEW, Matrix4x4::identity_matrix);
+	set_matrix(XFORM_PROJECTION, create_projection_matrix(quarter_pi, 1.333333f, 1.0f, 1000.0f));
+
+	// the prototypes: trees, rocks and bushes, in two colors each
+	Object *proto[proto_count * mat_count];
+	for(int i=0; i<proto_count; i++) {
+		Object *obj;
+		switch(i) {
+		case 0:
+			obj = new ObjCylinder(0.5, 4.0, true, 16, 4);
+			break;
+		case 1:
+			obj = new ObjSphere(1.0, 4);
+			break;
+		default:
+			obj = new ObjTorus(0.5, 1.0, 4);
+		}
+
+		for(int j=0; j<mat_count; j++) {
+			Object *inst = j ? obj->create_instance() : obj;
+			inst->mat.diffuse_color = Color(0.2 + 0.6 * j, 0.5, 0.2);
+			proto[i * mat_count + j] = inst;
+		}
+	}
+
+	ntimer timer;
+	vector<Object*> copies(count), instances(count);
+
+	// every object with its own copy of the data
+	srand(0);
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<count; i++) {
+		Object *src = proto[rand() % (proto_count * mat_count)];
+		Object *obj = new Object(src->get_mesh());
+		obj->get_mod_vertex_data();		// modifying detaches
+		obj->get_mod_triangle_data();
+		obj->mat = src->mat;
+		place(obj);
+		copies[i] = obj;
+	}
+	unsigned long copy_msec = timer_getmsec(&timer);
+
+	// instances
+	srand(0);
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<count; i++) {
+		Object *obj = proto[rand() % (proto_count * mat_count)]->create_instance();
+		place(obj);
+		instances[i] = obj;
+	}
+	unsigned long inst_msec = timer_getmsec(&timer);
+
+	printf("%d objects from %d meshes\n", count, proto_count);
+	printf("copies:    %6lu ms to create, %8lu KB of geometry\n", copy_msec, geometry_memory(copies) / 1024);
+	printf("instances: %6lu ms to create, %8lu KB of geometry\n\n", inst_msec, geometry_memory(instances) / 1024);
+
+	draw_frames(copies, iter, "copies:");
+	draw_frames(instances, iter, "shared:");
+
+	// copy on write
+	int errors = 0;
+	Object *a = proto[0];
+	Object *b = a->create_instance();
+
+	Vector3 orig = a->get_vertex_data()[0].pos;
+	Vertex *vptr = b->get_mod_vertex_data();
+	vptr[0].pos += Vector3(1, 2, 3);
+
+	if(!(a->get_vertex_data()[0].pos == orig)) errors++;
+	if(!(b->get_vertex_data()[0].pos == orig + Vector3(1, 2, 3))) errors++;
+	if(b->get_mesh().get_vertex_array()->is_shared()) errors++;
+	if(b->get_triangle_data() != a->get_triangle_data()) errors++;	// still shared
+	if(!a->get_mesh().get_vertex_array()->is_shared()) errors++;	// with the rest of the instances
+	printf("\ncopy on write check: %s (%d errors)\n", errors ? "FAILED" : "ok", errors);
+
+	return errors ? 1 : 0;
+}
+BENCH_CHECK(instancing, check_instancing);
@@ -0,0 +1,150 @@
+/*
+ * bench_suite --check=lightmap
+ * Bakes the lightmaps of a small scene, once for each number of worker
+ * threads from 1 up to the given maximum, and reports the time, texels and
+ * rays of each run. It checks that every run produced exactly the same
+ * lightmaps, and that baking again replaces the baked lightmaps but leaves
+ * a lightmap set by the user alone, and renders the baked scene with the
+ * software rasterizer into lightmap_check.tga.
+ *
+ * usage: bench_suite --check=lightmap [texel density] [ao samples] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "3dengfx/3dengfx.hpp"
+#include "3dengfx/lightmap.hpp"
+#include "common/threads.h"
+#include "bench.hpp"
+
+using namespace std;
+
+static Scene *create_scene() {
+	Scene *scene = new Scene;
+
+	TriMesh mesh;
+	create_torus(&mesh, 0.4, 1.5, 32);
+	Object *torus = new Object(mesh);
+	torus->name = "torus";
+	torus->get_material_ptr()->diffuse_color = Color(0.9, 0.9, 0.8);
+	torus->set_rotation(Vector3(half_pi * 0.6, 0, 0));
+	scene->add_object(torus);
+
+	create_sphere(&mesh, 0.8, 24);
+	Object *sphere = new Object(mesh);
+	sphere->name = "sphere";
+	sphere->get_material_ptr()->diffuse_color = Color(1.0, 0.4, 0.2);
+	scene->add_object(sphere);
+
+	create_plane(&mesh, Vector3(0, 1, 0), Vector2(12, 12), 8);
+	Object *floor = new Object(mesh);
+	floor->name = "floor";
+	floor->set_position(Vector3(0, -2, 0));
+	scene->add_object(floor);
+
+	scene->add_light(new PointLight(Vector3(-5, 8, -6), Color(1.0, 0.9, 0.8)));
+	scene->add_light(new DirLight(Vector3(-1, -1, 0.5), Color(0.2, 0.25, 0.35)));
+	scene->set_ambient_light(Color(0.3, 0.3, 0.3));
+	scene->set_background(Color(0.05, 0.05, 0.1));
+
+	TargetCamera *cam = new TargetCamera(Vector3(0, 3, -8), Vector3(0, -0.5, 0));
+	scene->add_camera(cam);
+	scene->set_active_camera(cam);
+	return scene;
+}
+
+// the lightmaps of all the objects, one after the other
+static void get_lightmaps(Scene *scene, vector<Pixel> *pixels) {
+	pixels->clear();
+
+	list<Object*> *olist = scene->get_object_list();
+	for(list<Object*>::iterator iter = olist->begin(); iter != olist->end(); iter++) {
+		Texture *tex = (*iter)->get_material_ptr()->tex[TEXTYPE_LIGHTMAP];
+		if(!tex) continue;
+
+		tex->lock();
+		pixels->insert(pixels->end(), tex->buffer, tex->buffer + tex->width * tex->height);
+		tex->unlock();
+	}
+}
+
+static int check_lightmap(int argc, char **argv) {
+	LightmapParams params;
+	int max_threads = 8;
+
+	if(argc > 1) params.texel_density = atof(argv[1]);
+	if(argc > 2) params.ao_samples = atoi(argv[2]);
+	if(argc > 3) max_threads = atoi(argv[3]);
+	if(params.texel_density <= 0.0 || params.ao_samples < 0 || max_threads < 1) {
+		fprintf(stderr, "usage: %s [texel density] [ao samples] [max threads]\n", argv[0]);
+		return 1;
+	}
+
+	if(!create_soft_context(640, 480)) {
+		return 1;
+	}
+
+	vector<Pixel> first, lmaps;
+	bool identical = true;
+	Scene *scene = 0;
+
+	printf("%g texels per unit, %d ambient occlusion samples\n", params.texel_density, params.ao_samples);
+	printf("%8s %10s %10s %12s %8s\n", "threads", "msec", "texels", "rays", "Mrays/s");
+
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+
+		delete scene;
+		scene = create_scene();
+
+		LightmapStats stats;
+		if(!bake_lightmaps(scene, params, &stats)) {
+			return 1;
+		}
+
+		printf("%8d %10lu %10lu %12lu %8.2f\n", threads, stats.msec, stats.texels, stats.rays,
+				stats.msec ? stats.rays / (stats.msec * 1000.0) : 0.0);
+
+		get_lightmaps(scene, threads == 1 ? &first : &lmaps);
+		if(threads > 1 && lmaps != first) {
+			fprintf(stderr, "the lightmaps baked with %d threads differ from the single threaded ones\n", threads);
+			identical = false;
+		}
+	}
+
+	// bake again, over the baked lightmaps and over one of the user's
+	Object *user_obj = scene->get_object_list()->front();
+	Texture *user_map = new Texture(4, 4);
+	add_texture(user_map, "user_lightmap");
+	user_obj->get_material_ptr()->tex[TEXTYPE_LIGHTMAP] = user_map;
+
+	bool user_kept = true;
+	if(!bake_lightmaps(scene, params)) {
+		return 1;
+	}
+	if(find_texture("user_lightmap") != user_map || user_obj->get_material_ptr()->tex[TEXTYPE_LIGHTMAP] == user_map) {
+		fprintf(stderr, "baking over a lightmap set by the user didn't leave it alone\n");
+		user_kept = false;
+	}
+	get_lightmaps(scene, &lmaps);
+	if(lmaps != first) {
+		fprintf(stderr, "the lightmaps baked again differ from the first ones\n");
+		identical = false;
+	}
+
+	scene->render(0);
+	flip();
+
+	char fname[] = "lightmap_check.tga";
+	screen_capture(fname);
+
+	delete scene;
+	destroy_graphics_context();
+
+	if(!identical || !user_kept) return 1;
+	printf("all lightmaps identical, the baked scene is saved as lightmap_check.tga\n");
+	return 0;
+}
+BENCH_CHECK(lightmap, check_lightmap);
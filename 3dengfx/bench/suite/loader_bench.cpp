@@ -0,0 +1,124 @@
+/*
+ * bench_suite: mesh and scene loading
+ * The files are generated at the start of each benchmark, from the same
+ * meshes every time: an ASCII PLY, and a 3ds scene of a single object.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <lib3ds/file.h>
+#include <lib3ds/mesh.h>
+#include <lib3ds/node.h>
+#include "3dengfx/3dengfx.hpp"
+#include "bench.hpp"
+
+TriMesh *load_mesh_ply(const char *fname);	// defined in ply.cpp
+
+// sphere subdivisions, the 3ds format is limited to 65536 vertices per mesh
+static const int subdiv_args[] = {16, 64};
+
+static bool write_ply(const char *fname, const TriMesh &mesh) {
+	FILE *fp = fopen(fname, "w");
+	if(!fp) return false;
+
+	unsigned long vcount = mesh.get_vertex_array()->get_count();
+	unsigned long tcount = mesh.get_triangle_array()->get_count();
+	const Vertex *varr = mesh.get_vertex_array()->get_data();
+	const Triangle *tarr = mesh.get_triangle_array()->get_data();
+
+	fprintf(fp, "ply\nformat ascii 1.0\n");
+	fprintf(fp, "element vertex %lu\n", vcount);
+	fprintf(fp, "property float x\nproperty float y\nproperty float z\n");
+	fprintf(fp, "element face %lu\n", tcount);
+	fprintf(fp, "property list uchar int vertex_indices\nend_header\n");
+
+	for(unsigned long i=0; i<vcount; i++) {
+		fprintf(fp, "%f %f %f\n", varr[i].pos.x, varr[i].pos.y, -varr[i].pos.z);
+	}
+	for(unsigned long i=0; i<tcount; i++) {
+		fprintf(fp, "3 %lu %lu %lu\n", (unsigned long)tarr[i].vertices[0], (unsigned long)tarr[i].vertices[1],
+				(unsigned long)tarr[i].vertices[2]);
+	}
+
+	bool ok = !ferror(fp);
+	if(fclose(fp) != 0) ok = false;
+	return ok;
+}
+
+static bool write_3ds(const char *fname, const TriMesh &mesh) {
+	unsigned long vcount = mesh.get_vertex_array()->get_count();
+	unsigned long tcount = mesh.get_triangle_array()->get_count();
+	if(vcount > 65535) return false;
+
+	const Vertex *varr = mesh.get_vertex_array()->get_data();
+	const Triangle *tarr = mesh.get_triangle_array()->get_data();
+
+	Lib3dsFile *file = lib3ds_file_new();
+	Lib3dsMesh *m = lib3ds_mesh_new("bench_mesh");
+	lib3ds_mesh_new_point_list(m, vcount);
+	lib3ds_mesh_new_face_list(m, tcount);
+
+	for(unsigned long i=0; i<vcount; i++) {
+		m->pointL[i].pos[0] = varr[i].pos.x;
+		m->pointL[i].pos[1] = varr[i].pos.z;
+		m->pointL[i].pos[2] = varr[i].pos.y;
+	}
+	for(unsigned long i=0; i<tcount; i++) {
+		for(int j=0; j<3; j++) {
+			m->faceL[i].points[j] = tarr[i].vertices[j];
+		}
+		m->faceL[i].smoothing = 1;
+	}
+	lib3ds_file_insert_mesh(file, m);
+
+	// the scene loader takes the object transformation from its node
+	Lib3dsNode *node = lib3ds_node_new_object();
+	strcpy(node->name, m->name);
+	node->parent_id = LIB3DS_NO_PARENT;
+	lib3ds_file_insert_node(file, node);
+
+	bool ok = lib3ds_file_save(file, fname);
+	lib3ds_file_free(file);
+	return ok;
+}
+
+static void load_ply(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+
+	std::string path = bench_tmp_file("load.ply");
+	if(!write_ply(path.c_str(), mesh)) {
+		fprintf(stderr, "failed to write %s\n", path.c_str());
+		return;
+	}
+
+	while(state.keep_running()) {
+		TriMesh *res = load_mesh_ply(path.c_str());
+		if(!res) break;
+		delete res;
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+	remove(path.c_str());
+}
+BENCHMARK_ARGS(load_ply, subdiv_args);
+
+static void load_3ds(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+
+	std::string path = bench_tmp_file("load.3ds");
+	if(!write_3ds(path.c_str(), mesh)) {
+		fprintf(stderr, "failed to write %s\n", path.c_str());
+		return;
+	}
+
+	while(state.keep_running()) {
+		Scene *scene = load_scene(path.c_str());
+		if(!scene) break;
+		delete scene;
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+	remove(path.c_str());
+}
+BENCHMARK_ARGS(load_3ds, subdiv_args);
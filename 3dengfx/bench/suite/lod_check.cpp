@@ -0,0 +1,181 @@
+/*
+ * bench_suite --check=lod
+ * Simplifies a few dense meshes into LOD chains, once for each number of
+ * worker threads from 1 up to the given maximum, reporting the time of each
+ * run and checking that they all produced the same meshes. Then it renders
+ * a field of teapots with the software rasterizer, with and without the
+ * levels of detail, and reports the triangles drawn and the frame times.
+ * The last frame is saved as lod_check.tga, the nearest teapots in it at
+ * full detail and each level of the chain to their right.
+ *
+ * usage: bench_suite --check=lod [detail] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "3dengfx/3dengfx.hpp"
+#include "3dengfx/swrast.hpp"
+#include "gfx/simplify.hpp"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+#define MESH_COUNT	4
+#define LEVELS		4
+
+static const scalar_t ratios[LEVELS] = {0.5, 0.25, 0.1, 0.03};
+static const char *mesh_names[MESH_COUNT] = {"teapot", "torus", "sphere", "landscape"};
+
+static bool same_mesh(const TriMesh &a, const TriMesh &b) {
+	unsigned long vcount = a.get_vertex_array()->get_count();
+	unsigned long tcount = a.get_triangle_array()->get_count();
+	if(vcount != b.get_vertex_array()->get_count() || tcount != b.get_triangle_array()->get_count()) {
+		return false;
+	}
+
+	const Vertex *va = a.get_vertex_array()->get_data(), *vb = b.get_vertex_array()->get_data();
+	for(unsigned long i=0; i<vcount; i++) {
+		if(memcmp(&va[i].pos, &vb[i].pos, sizeof va[i].pos) != 0) return false;
+	}
+	const Triangle *ta = a.get_triangle_array()->get_data(), *tb = b.get_triangle_array()->get_data();
+	for(unsigned long i=0; i<tcount; i++) {
+		if(memcmp(ta[i].vertices, tb[i].vertices, sizeof ta[i].vertices) != 0) return false;
+	}
+	return true;
+}
+
+static unsigned long render_frames(Scene *scene, int frames, unsigned long *tris) {
+	SoftRaster *swr = get_soft_context();
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+
+	swr->reset_stats();
+	for(int i=0; i<frames; i++) {
+		scene->render(i * 40);
+		flip();
+	}
+	*tris = swr->get_stats()->triangles / frames;
+	return timer_getmsec(&timer);
+}
+
+static int check_lod(int argc, char **argv) {
+	int detail = 12, max_threads = 8;
+
+	if(argc > 1) detail = atoi(argv[1]);
+	if(argc > 2) max_threads = atoi(argv[2]);
+	if(detail < 1 || max_threads < 1) {
+		fprintf(stderr, "usage: %s [detail] [max threads]\n", argv[0]);
+		return 1;
+	}
+
+	if(!create_soft_context(800, 400)) {
+		return 1;
+	}
+
+	TriMesh meshes[MESH_COUNT];
+	create_teapot(&meshes[0], 1.0, detail);
+	create_torus(&meshes[1], 0.4, 1.5, detail * 8);
+	create_sphere(&meshes[2], 1.0, detail * 8);
+	create_landscape(&meshes[3], Vector2(10, 10), detail * 12, 1.5, 64, 0.5, 1);
+
+	const TriMesh *mptr[MESH_COUNT];
+	for(int i=0; i<MESH_COUNT; i++) mptr[i] = &meshes[i];
+
+	// simplification, in parallel over the meshes
+	vector<TriMesh> first[MESH_COUNT], lods[MESH_COUNT];
+	bool identical = true;
+
+	printf("%8s %10s\n", "threads", "msec");
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+
+		create_lod_chains(mptr, MESH_COUNT, threads == 1 ? first : lods, ratios, LEVELS);
+		printf("%8d %10lu\n", threads, timer_getmsec(&timer));
+
+		for(int i=0; threads > 1 && i<MESH_COUNT; i++) {
+			for(int j=0; j<LEVELS; j++) {
+				if(!same_mesh(first[i][j], lods[i][j])) identical = false;
+			}
+		}
+	}
+	if(!identical) {
+		fprintf(stderr, "the LOD chains differ between the runs\n");
+	}
+
+	printf("\n%10s %10s", "mesh", "triangles");
+	for(int j=0; j<LEVELS; j++) printf("  %7.0f%%", ratios[j] * 100.0);
+	putchar('\n');
+	for(int i=0; i<MESH_COUNT; i++) {
+		printf("%10s %10lu", mesh_names[i], meshes[i].get_triangle_array()->get_count());
+		for(int j=0; j<LEVELS; j++) {
+			printf("  %8lu", first[i][j].get_triangle_array()->get_count());
+		}
+		putchar('\n');
+	}
+
+	// a field of teapots, the front row shows the whole chain side by side
+	Scene *scene = new Scene;
+	Object *proto = new Object(meshes[0]);
+	proto->get_material_ptr()->diffuse_color = Color(0.8, 0.7, 0.5);
+	proto->get_material_ptr()->specular_color = Color(0.6, 0.6, 0.6);
+	proto->get_material_ptr()->specular_power = 40.0;
+	for(int j=0; j<LEVELS; j++) {
+		proto->add_lod(first[0][j], 0.5 * sqrt(ratios[j]));
+	}
+
+	for(int row=0; row<8; row++) {
+		for(int col=0; col<LEVELS + 1; col++) {
+			Object *obj = row || col ? proto->create_instance() : proto;
+			obj->set_position(Vector3((col - LEVELS / 2.0) * 3.5, -1.0, row * 6.0));
+			if(!row && col) {
+				// force the level in the front row
+				obj->clear_lods();
+				obj->add_lod(first[0][col - 1], 1e6);
+			}
+			scene->add_object(obj);
+		}
+	}
+
+	scene->add_light(new PointLight(Vector3(-10, 20, -20), Color(1.0, 0.95, 0.9)));
+	scene->set_ambient_light(Color(0.15, 0.15, 0.2));
+	scene->set_background(Color(0.05, 0.05, 0.1));
+
+	TargetCamera *cam = new TargetCamera(Vector3(0, 4, -12), Vector3(0, -1, 4));
+	cam->set_aspect(2.0);
+	scene->add_camera(cam);
+	scene->set_active_camera(cam);
+
+	int frames = 10;
+	unsigned long tris_lod, tris_full;
+	unsigned long msec_lod = render_frames(scene, frames, &tris_lod);
+
+	char fname[] = "lod_check.tga";
+	screen_capture(fname);
+
+	list<Object*> *olist = scene->get_object_list();
+	for(list<Object*>::iterator iter = olist->begin(); iter != olist->end(); iter++) {
+		(*iter)->clear_lods();
+	}
+	unsigned long msec_full = render_frames(scene, frames, &tris_full);
+
+	printf("\n%10s %12s %10s\n", "", "triangles", "msec");
+	printf("%10s %12lu %10lu\n", "full", tris_full, msec_full / frames);
+	printf("%10s %12lu %10lu\n", "lod", tris_lod, msec_lod / frames);
+
+	delete scene;
+	destroy_graphics_context();
+
+	if(!identical) return 1;
+	printf("all LOD chains identical, the lod frame is saved as lod_check.tga\n");
+	return 0;
+}
+BENCH_CHECK(lod, check_lod);
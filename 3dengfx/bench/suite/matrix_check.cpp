@@ -0,0 +1,268 @@
+/*
+ * bench_suite --check=matrix
+ * Compares the Matrix4x4 kernels against the implementations they replaced:
+ * the triple loop multiplication, the adjoint()/determinant() inverse, the
+ * element by element transpose, per vector transformed() calls, and the
+ * quaternion to matrix conversion through a Matrix3x3. It also reports the
+ * largest difference between the old and new results.
+ *
+ * usage: bench_suite --check=matrix [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "n3dmath2/n3dmath2.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+/* ---- the old implementations, kept here for reference ---- */
+static Matrix4x4 old_mul(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+	Matrix4x4 res;
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			res[i][j] = m1[i][0] * m2[0][j] + m1[i][1] * m2[1][j] + m1[i][2] * m2[2][j] + m1[i][3] * m2[3][j];
+		}
+	}
+	return res;
+}
+
+static Matrix4x4 old_inverse(const Matrix4x4 &mat) {
+	return mat.adjoint() * (1.0f / mat.determinant());
+}
+
+static Matrix4x4 old_transposed(const Matrix4x4 &mat) {
+	Matrix4x4 res;
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			res[i][j] = mat[j][i];
+		}
+	}
+	return res;
+}
+
+static Matrix4x4 old_quat_matrix(const Quaternion &q) {
+	return Matrix4x4(q.get_rotation_matrix());
+}
+
+
+static scalar_t frand(scalar_t low, scalar_t high) {
+	return low + (high - low) * (scalar_t)rand() / (scalar_t)RAND_MAX;
+}
+
+static Quaternion rand_quat() {
+	Vector3 axis(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+	axis.normalize();
+	return Quaternion(axis, frand(0, two_pi));
+}
+
+static Matrix4x4 rand_xform() {
+	Matrix4x4 mat;
+	mat.set_rotation(rand_quat());
+	mat.scale(Vector4(frand(0.5, 2), frand(0.5, 2), frand(0.5, 2), 1));
+	mat[0][3] = frand(-100, 100);
+	mat[1][3] = frand(-100, 100);
+	mat[2][3] = frand(-100, 100);
+	return mat;
+}
+
+static scalar_t max_diff(const Matrix4x4 &a, const Matrix4x4 &b) {
+	scalar_t diff = 0.0;
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			scalar_t d = fabs(a[i][j] - b[i][j]);
+			if(d > diff) diff = d;
+		}
+	}
+	return diff;
+}
+
+static void print_result(const char *name, unsigned long old_msec, unsigned long new_msec, scalar_t err) {
+	printf("%-18s old: %6lu ms   new: %6lu ms   speedup: %5.2f   max diff: %g\n", name,
+			old_msec, new_msec, new_msec ? (float)old_msec / (float)new_msec : 0.0f, (float)err);
+}
+
+// keeps the compiler from throwing away the results
+static scalar_t sink;
+
+static int check_matrix(int argc, char **argv) {
+	int iter = argc > 1 ? atoi(argv[1]) : 200;
+	const int count = 4096;
+	ntimer timer;
+
+	if(iter <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	srand(0);
+	vector<Matrix4x4> mats(count), res(count), old_res(count);
+	vector<Quaternion> quats(count);
+	vector<Vector3> points(count), out(count), old_out(count);
+	for(int i=0; i<count; i++) {
+		mats[i] = rand_xform();
+		quats[i] = rand_quat();
+		points[i] = Vector3(frand(-10, 10), frand(-10, 10), frand(-10, 10));
+	}
+
+	printf("%d matrices, %d iterations\n", count, iter);
+
+	unsigned long old_msec, new_msec;
+	scalar_t err;
+
+	// multiplication
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_res[i] = old_mul(mats[i], mats[(i + j) % count]);
+		}
+		sink += old_res[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			res[i] = mats[i] * mats[(i + j) % count];
+		}
+		sink += res[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(res[i], old_res[i]));
+	}
+	print_result("multiply", old_msec, new_msec, err);
+
+	// general inverse
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_res[i] = old_inverse(mats[i]);
+		}
+		sink += old_res[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			res[i] = mats[i].inverse();
+		}
+		sink += res[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(res[i], old_res[i]));
+	}
+	print_result("inverse", old_msec, new_msec, err);
+
+	// affine inverse, against the old general inverse
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			res[i] = mats[i].inverse_affine();
+		}
+		sink += res[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(res[i], old_res[i]));
+	}
+	print_result("inverse_affine", old_msec, new_msec, err);
+
+	// transpose
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_res[i] = old_transposed(mats[i]);
+		}
+		sink += old_res[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			res[i] = mats[i].transposed();
+		}
+		sink += res[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(res[i], old_res[i]));
+	}
+	print_result("transpose", old_msec, new_msec, err);
+
+	// quaternion to matrix
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			old_res[i] = old_quat_matrix(quats[i]);
+		}
+		sink += old_res[j % count][0][0];
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		for(int i=0; i<count; i++) {
+			res[i].set_rotation(quats[i]);
+		}
+		sink += res[j % count][0][0];
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, max_diff(res[i], old_res[i]));
+	}
+	print_result("quat to matrix", old_msec, new_msec, err);
+
+	// point array transformation
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		const Matrix4x4 &mat = mats[j % count];
+		for(int i=0; i<count; i++) {
+			old_out[i] = points[i].transformed(mat);
+		}
+		sink += old_out[j % count].x;
+	}
+	old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int j=0; j<iter; j++) {
+		transform_points(&out[0], &points[0], count, mats[j % count]);
+		sink += out[j % count].x;
+	}
+	new_msec = timer_getmsec(&timer);
+
+	err = 0.0;
+	for(int i=0; i<count; i++) {
+		err = max(err, (scalar_t)(out[i] - old_out[i]).length());
+	}
+	print_result("transform points", old_msec, new_msec, err);
+
+	return sink == 12345.0 ? 1 : 0;
+}
+BENCH_CHECK(matrix, check_matrix);
@@ -0,0 +1,122 @@
+/*
+ * bench_suite: geometry generation and TriMesh processing
+ */
+
+#include "3dengfx/3dengfx.hpp"
+#include "bench.hpp"
+
+static const int subdiv_args[] = {8, 32, 64};
+static const int land_args[] = {32, 128};
+
+static void gen_sphere(BenchState &state) {
+	TriMesh mesh;
+	while(state.keep_running()) {
+		create_sphere(&mesh, 1.0, state.arg);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(gen_sphere, subdiv_args);
+
+static void gen_torus(BenchState &state) {
+	TriMesh mesh;
+	while(state.keep_running()) {
+		create_torus(&mesh, 0.3, 1.0, state.arg);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(gen_torus, subdiv_args);
+
+static void gen_cylinder(BenchState &state) {
+	TriMesh mesh;
+	while(state.keep_running()) {
+		create_cylinder(&mesh, 0.5, 2.0, true, state.arg, state.arg / 4 + 1);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(gen_cylinder, subdiv_args);
+
+static void gen_teapot(BenchState &state) {
+	TriMesh mesh;
+	while(state.keep_running()) {
+		create_teapot(&mesh, 1.0, state.arg / 4);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(gen_teapot, subdiv_args);
+
+static void gen_landscape(BenchState &state) {
+	TriMesh mesh;
+	while(state.keep_running()) {
+		create_landscape(&mesh, Vector2(100, 100), state.arg, 10.0, 8, 0.5, BENCH_SEED);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(gen_landscape, land_args);
+
+/* Touching the vertex array invalidates everything derived from it, so
+ * this is the full cost after an edit: index graph, triangle normals, and
+ * the vertex normals.
+ */
+static void mesh_normals(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+
+	while(state.keep_running()) {
+		mesh.get_mod_vertex_array();
+		mesh.calculate_normals();
+	}
+	state.items = mesh.get_vertex_array()->get_count();
+}
+BENCHMARK_ARGS(mesh_normals, subdiv_args);
+
+// the same without the edit, only the vertex normals are recalculated
+static void mesh_normals_cached(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+	mesh.calculate_normals();
+
+	while(state.keep_running()) {
+		mesh.calculate_normals();
+	}
+	state.items = mesh.get_vertex_array()->get_count();
+}
+BENCHMARK_ARGS(mesh_normals_cached, subdiv_args);
+
+static void mesh_normals_by_index(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+
+	while(state.keep_running()) {
+		mesh.get_mod_vertex_array();
+		mesh.calculate_normals_by_index();
+	}
+	state.items = mesh.get_vertex_array()->get_count();
+}
+BENCHMARK_ARGS(mesh_normals_by_index, subdiv_args);
+
+static void mesh_edges(BenchState &state) {
+	TriMesh mesh;
+	create_sphere(&mesh, 1.0, state.arg);
+
+	const GeometryArray<Edge> *edges = 0;
+	while(state.keep_running()) {
+		mesh.get_mod_vertex_array();
+		edges = mesh.get_edge_array();
+	}
+	state.items = edges->get_count();
+}
+BENCHMARK_ARGS(mesh_edges, subdiv_args);
+
+static void mesh_sort(BenchState &state) {
+	TriMesh mesh;
+	create_torus(&mesh, 0.3, 1.0, state.arg);
+
+	// alternate between two viewpoints, so that every sort has work to do
+	Vector3 pt[2] = {Vector3(5, 2, -5), Vector3(-5, -2, 5)};
+	int i = 0;
+	while(state.keep_running()) {
+		mesh.sort_triangles(pt[i++ & 1]);
+	}
+	state.items = mesh.get_triangle_array()->get_count();
+}
+BENCHMARK_ARGS(mesh_sort, subdiv_args);
@@ -0,0 +1,227 @@
+/*
+ * bench_suite --check=meshopt
+ * Optimizes a few meshes for drawing, the way Object::optimize does, and
+ * reports the vertex cache efficiency (ACMR with a 16 entry FIFO cache, and
+ * ATVR, the vertices transformed over the vertices used) before and after,
+ * along with the time it took. The overdraw of each order is measured by
+ * rasterizing the mesh with a depth buffer from 14 directions around it,
+ * as the pixels written over the pixels covered. It checks that each
+ * optimized mesh has the same triangles as the original.
+ *
+ * usage: bench_suite --check=meshopt [detail]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "3dengfx/3dengfx.hpp"
+#include "gfx/meshopt.hpp"
+#include "gfx/simplify.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+#define GRID_SIZE	128
+
+static scalar_t blobs(const Vector3 &v, scalar_t t) {
+	Vector3 c1(0.4, 0, 0), c2(0, 0.4, 0), c3(0, 0, 0.4);
+	return 0.04 / ((v - c1).length_sq() + 0.001) + 0.04 / ((v - c2).length_sq() + 0.001) +
+		0.04 / ((v - c3).length_sq() + 0.001);
+}
+
+static scalar_t acmr(const TriMesh &mesh) {
+	return calc_acmr(mesh.get_index_array()->get_data(), mesh.get_index_array()->get_count(),
+			mesh.get_vertex_array()->get_count());
+}
+
+// pixels written over pixels covered, with back face culling
+static double overdraw(const TriMesh &mesh) {
+	static const Vector3 dirs[] = {
+		Vector3(1, 0, 0), Vector3(-1, 0, 0), Vector3(0, 1, 0), Vector3(0, -1, 0),
+		Vector3(0, 0, 1), Vector3(0, 0, -1), Vector3(1, 1, 1), Vector3(-1, 1, 1),
+		Vector3(1, -1, 1), Vector3(1, 1, -1), Vector3(-1, -1, 1), Vector3(-1, 1, -1),
+		Vector3(1, -1, -1), Vector3(-1, -1, -1)
+	};
+	const Vertex *verts = mesh.get_vertex_array()->get_data();
+	unsigned long vcount = mesh.get_vertex_array()->get_count();
+	const Triangle *tris = mesh.get_triangle_array()->get_data();
+	unsigned long tcount = mesh.get_triangle_array()->get_count();
+
+	VertexStatistics vstats = mesh.get_vertex_stats();
+	scalar_t scale = (GRID_SIZE / 2 - 1) / vstats.max_dist;
+
+	vector<float> zbuf(GRID_SIZE * GRID_SIZE);
+	vector<Vector3> proj(vcount);
+	unsigned long written = 0, covered = 0;
+
+	for(size_t d=0; d<sizeof dirs / sizeof *dirs; d++) {
+		Vector3 dir = dirs[d].normalized();
+		Vector3 up = fabs(dir.y) > 0.9 ? Vector3(1, 0, 0) : Vector3(0, 1, 0);
+		Vector3 right = cross_product(up, dir).normalized();
+		up = cross_product(dir, right);
+
+		for(unsigned long i=0; i<vcount; i++) {
+			Vector3 p = verts[i].pos - vstats.centroid;
+			proj[i] = Vector3(dot_product(p, right) * scale + GRID_SIZE / 2,
+					dot_product(p, up) * scale + GRID_SIZE / 2, dot_product(p, dir));
+		}
+		fill(zbuf.begin(), zbuf.end(), 1e30f);
+
+		for(unsigned long i=0; i<tcount; i++) {
+			const Vector3 &a = proj[tris[i].vertices[0]];
+			const Vector3 &b = proj[tris[i].vertices[1]];
+			const Vector3 &c = proj[tris[i].vertices[2]];
+
+			double area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			if(area >= 0.0) continue;
+
+			int x0 = max(0, (int)floor(min(a.x, min(b.x, c.x))));
+			int x1 = min(GRID_SIZE - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+			int y0 = max(0, (int)floor(min(a.y, min(b.y, c.y))));
+			int y1 = min(GRID_SIZE - 1, (int)ceil(max(a.y, max(b.y, c.y))));
+
+			for(int y=y0; y<=y1; y++) {
+				for(int x=x0; x<=x1; x++) {
+					double px = x + 0.5, py = y + 0.5;
+					double w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+					double w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+					double w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+					if(w0 > 0.0 || w1 > 0.0 || w2 > 0.0) continue;
+
+					float z = (float)((w0 * a.z + w1 * b.z + w2 * c.z) / area);
+					float *zptr = &zbuf[y * GRID_SIZE + x];
+					if(z < *zptr) {
+						if(*zptr == 1e30f) covered++;
+						*zptr = z;
+						written++;
+					}
+				}
+			}
+		}
+	}
+	return covered ? (double)written / (double)covered : 0.0;
+}
+
+// the triangles as sorted lists of their corners, starting from the smallest one
+static void get_tri_set(const TriMesh &mesh, vector<vector<scalar_t> > *set) {
+	const Vertex *verts = mesh.get_vertex_array()->get_data();
+	const Triangle *tris = mesh.get_triangle_array()->get_data();
+	unsigned long tcount = mesh.get_triangle_array()->get_count();
+
+	set->resize(tcount);
+	for(unsigned long i=0; i<tcount; i++) {
+		vector<scalar_t> &t = (*set)[i];
+		t.clear();
+		for(int j=0; j<3; j++) {
+			const Vertex &v = verts[tris[i].vertices[j]];
+			t.push_back(v.pos.x);
+			t.push_back(v.pos.y);
+			t.push_back(v.pos.z);
+			t.push_back(v.normal.x);
+			t.push_back(v.tex[0].u);
+		}
+		// rotate the corner with the smallest position first, keeping the winding
+		int first = 0;
+		for(int j=1; j<3; j++) {
+			if(lexicographical_compare(t.begin() + j * 5, t.begin() + j * 5 + 5,
+						t.begin() + first * 5, t.begin() + first * 5 + 5)) {
+				first = j;
+			}
+		}
+		rotate(t.begin(), t.begin() + first * 5, t.end());
+	}
+	sort(set->begin(), set->end());
+}
+
+static int check_meshopt(int argc, char **argv) {
+	int detail = 12;
+
+	if(argc > 1) detail = atoi(argv[1]);
+	if(detail < 1) {
+		fprintf(stderr, "usage: %s [detail]\n", argv[0]);
+		return 1;
+	}
+
+	vector<TriMesh> meshes;
+	vector<const char*> names;
+	TriMesh mesh;
+
+	create_teapot(&mesh, 1.0, detail);
+	meshes.push_back(mesh);
+	names.push_back("teapot");
+
+	create_sphere(&mesh, 1.0, detail * 8);
+	meshes.push_back(mesh);
+	names.push_back("sphere");
+
+	create_torus(&mesh, 0.4, 1.5, detail * 8);
+	meshes.push_back(mesh);
+	names.push_back("torus");
+
+	create_landscape(&mesh, Vector2(10, 10), detail * 12, 1.5, 64, 0.5, 1);
+	meshes.push_back(mesh);
+	names.push_back("landscape");
+
+	ScalarField field(detail * 4, Vector3(-1, -1, -1), Vector3(1, 1, 1));
+	field.set_evaluator(blobs);
+	field.triangulate(&mesh, 1.0, 0.0, true);
+	meshes.push_back(mesh);
+	names.push_back("isosurface");
+
+	// the teapot in random order, like a scan
+	create_teapot(&mesh, 1.0, detail);
+	Triangle *tris = mesh.get_mod_triangle_array()->get_mod_data();
+	unsigned long tcount = mesh.get_triangle_array()->get_count();
+	srand(1);
+	for(unsigned long i=tcount - 1; i>0; i--) {
+		std::swap(tris[i], tris[rand() % (i + 1)]);
+	}
+	meshes.push_back(mesh);
+	names.push_back("shuffled");
+
+	TriMesh torus;
+	create_torus(&torus, 0.4, 1.5, detail * 8);
+	simplify_mesh(&torus, &mesh, torus.get_triangle_array()->get_count() / 4);
+	meshes.push_back(mesh);
+	names.push_back("simplified");
+
+	bool identical = true;
+
+	printf("%19s | %20s | %13s | %20s |\n", "", "ACMR", "ATVR", "overdraw");
+	printf("%10s %8s | %6s %6s %6s | %6s %6s | %6s %6s %6s | %6s\n", "mesh", "tris",
+			"orig", "vcache", "+odraw", "orig", "vcache", "orig", "vcache", "+odraw", "msec");
+	for(size_t i=0; i<meshes.size(); i++) {
+		TriMesh vcache = meshes[i], odraw = meshes[i];
+		MeshOptStats stats, ostats;
+
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+		vcache.optimize(false, &stats);
+		unsigned long msec = timer_getmsec(&timer);
+
+		odraw.optimize(true, &ostats);
+
+		vector<vector<scalar_t> > set, vset, oset;
+		get_tri_set(meshes[i], &set);
+		get_tri_set(vcache, &vset);
+		get_tri_set(odraw, &oset);
+		if(set != vset || set != oset || acmr(vcache) != stats.acmr_after) {
+			fprintf(stderr, "%s: the optimized mesh differs from the original\n", names[i]);
+			identical = false;
+		}
+
+		printf("%10s %8lu | %6.3f %6.3f %6.3f | %6.3f %6.3f | %6.3f %6.3f %6.3f | %6lu\n", names[i],
+				meshes[i].get_triangle_array()->get_count(), stats.acmr_before, stats.acmr_after,
+				ostats.acmr_after, stats.atvr_before, stats.atvr_after,
+				overdraw(meshes[i]), overdraw(vcache), overdraw(odraw), msec);
+	}
+
+	if(!identical) return 1;
+	printf("all optimized meshes have the same triangles as the originals\n");
+	return 0;
+}
+BENCH_CHECK(meshopt, check_meshopt);
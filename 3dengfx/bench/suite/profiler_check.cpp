@@ -0,0 +1,222 @@
+/*
+ * bench_suite --check=profiler
+ * Measures the cost of a profiler scope (enabled, and disabled at run time),
+ * then runs frames of work without a graphics context: a scalar field
+ * triangulation, a particle system update, and a parallel loop with a scope
+ * in every job, ending every frame like flip() does. The trace and the
+ * binary log are written to prof_out/, and the log is read back and checked
+ * against what the frames recorded.
+ *
+ * The scopes in the engine itself are only there if the library was
+ * configured with --enable-profiler, the ones of the benchmark always are.
+ *
+ * usage: bench_suite --check=profiler [frames] [jobs per frame] [threads]
+ */
+
+#define USE_PROFILER
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sys/stat.h>
+#include "3dengfx/3dengfx.hpp"
+#include "common/profile.h"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+#define SCOPE_ITER	2000000
+#define FIELD_DIM	24
+
+static volatile unsigned long sink;
+
+static void empty_scopes(int count, bool scoped) {
+	for(int i=0; i<count; i++) {
+		if(scoped) {
+			PROF_SCOPE("empty");
+			sink++;
+		} else {
+			sink++;
+		}
+	}
+}
+
+static scalar_t blobs(const Vector3 &v, scalar_t t) {
+	Vector3 c1(sin(t) * 0.3, 0, 0), c2(0, cos(t) * 0.3, 0);
+	return 0.05 / ((v - c1).length_sq() + 0.001) + 0.05 / ((v - c2).length_sq() + 0.001);
+}
+
+static void job(int idx, void *cls) {
+	PROF_SCOPE("worker job");
+	unsigned long sum = 0;
+	for(int i=0; i<20000; i++) {
+		sum += i ^ idx;
+	}
+	sink += sum;
+}
+
+static void run_frame(ScalarField *field, TriMesh *mesh, ParticleSystem *psys, int jobs, unsigned long msec) {
+	PROF_SCOPE("bench frame");
+
+	{
+		PROF_SCOPE("triangulate");
+		field->triangulate(mesh, 1.0, msec / 1000.0, true);
+	}
+
+	psys::set_global_time(msec);
+	psys->update();
+
+	thr_parallel_for(jobs, job, 0);
+
+	PROF_COUNT(PROF_DRAW_CALLS, 3);
+}
+
+static unsigned long get_u32(const unsigned char *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((unsigned long)ptr[3] << 24);
+}
+
+static int check_log(const char *fname, int frames, int jobs) {
+	FILE *fp = fopen(fname, "rb");
+	if(!fp) return 1;
+
+	std::vector<unsigned char> data;
+	int c;
+	while((c = fgetc(fp)) != EOF) {
+		data.push_back(c);
+	}
+	fclose(fp);
+
+	if(data.size() < 36 || memcmp(&data[0], "3DPROF\0\0", 8) != 0) return 1;
+
+	const unsigned char *ptr = &data[8];
+	unsigned long version = get_u32(ptr);
+	unsigned long num_names = get_u32(ptr + 8);
+	unsigned long num_scopes = get_u32(ptr + 12);
+	unsigned long num_frames = get_u32(ptr + 16);
+	unsigned long num_counters = get_u32(ptr + 20);
+	ptr += 24;
+
+	int errors = 0;
+	if(version != 1 || num_frames != (unsigned long)frames || num_counters != PROF_COUNTER_COUNT) errors++;
+
+	std::vector<std::string> names;
+	for(unsigned long i=0; i<num_names; i++) {
+		int len = ptr[0] | (ptr[1] << 8);
+		names.push_back(std::string((const char*)ptr + 2, len));
+		ptr += 2 + len;
+	}
+
+	int frame_scopes = 0, job_scopes = 0, tri_scopes = 0;
+	for(unsigned long i=0; i<num_scopes; i++) {
+		int name = ptr[0] | (ptr[1] << 8);
+		int depth = ptr[3];
+		if(name >= (int)names.size()) return errors + 1;
+
+		if(names[name] == "bench frame") {
+			frame_scopes++;
+			if(depth != 0) errors++;
+		}
+		if(names[name] == "triangulate") {
+			tri_scopes++;
+			if(depth != 1) errors++;
+		}
+		if(names[name] == "worker job") job_scopes++;
+		ptr += 12;
+	}
+	if(frame_scopes != frames || tri_scopes != frames || job_scopes != frames * jobs) errors++;
+
+	for(unsigned long i=0; i<num_frames; i++) {
+		if(get_u32(ptr + 12 + PROF_DRAW_CALLS * 4) != 3) errors++;
+		ptr += 12 + num_counters * 4;
+	}
+	if(ptr != &data[0] + data.size()) errors++;
+
+	printf("log: %lu names, %lu scopes, %lu frames, %lu bytes\n", num_names, num_scopes, num_frames,
+			(unsigned long)data.size());
+	return errors;
+}
+
+static int check_profiler(int argc, char **argv) {
+	int frames = argc > 1 ? atoi(argv[1]) : 100;
+	int jobs = argc > 2 ? atoi(argv[2]) : 16;
+	int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+	// every scope of the run must still be in the ring buffers
+	if(frames <= 0 || jobs <= 0 || threads < 0 || frames * (jobs + 4) > PROF_RING_SIZE) {
+		fprintf(stderr, "usage: %s [frames] [jobs per frame] [threads], up to %d scopes\n", argv[0], PROF_RING_SIZE);
+		return 1;
+	}
+	if(threads) thr_set_num_workers(threads);
+
+	// scope cost
+	ntimer timer;
+	unsigned long msec[3];
+	for(int i=0; i<3; i++) {
+		prof_enable(i != 2);
+		timer_reset(&timer);
+		timer_start(&timer);
+		empty_scopes(SCOPE_ITER, i != 0);
+		msec[i] = timer_getmsec(&timer);
+	}
+	prof_enable(1);
+
+	printf("scope cost over %d iterations:\n", SCOPE_ITER);
+	printf("  enabled:  %6.1f ns/scope\n", (msec[1] - msec[0]) * 1e6 / SCOPE_ITER);
+	printf("  disabled: %6.1f ns/scope\n", (msec[2] - msec[0]) * 1e6 / SCOPE_ITER);
+
+	// frames
+	ScalarField field(FIELD_DIM, Vector3(-1, -1, -1), Vector3(1, 1, 1));
+	field.set_evaluator(blobs);
+	TriMesh mesh;
+
+	ParticleSystem psys;
+	ParticleSysParams *params = psys.get_params();
+	params->birth_rate = Fuzzy(2000.0);
+	params->lifespan = Fuzzy(1.0, 0.2);
+
+	prof_reset();
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<frames; i++) {
+		run_frame(&field, &mesh, &psys, jobs, i * 20);
+		prof_frame();
+		frame_reset();
+	}
+	unsigned long frames_msec = timer_getmsec(&timer);
+
+	const prof_frame_stats *fs = prof_last_frame();
+	printf("%d frames, %.2f ms/frame, %d threads, last frame:\n", frames, (float)frames_msec / frames,
+			thr_get_num_workers());
+	for(int i=0; i<PROF_COUNTER_COUNT; i++) {
+		printf("  %-16s %lu\n", prof_counter_name((prof_counter)i), fs->counters[i]);
+	}
+
+	mkdir("prof_out", 0770);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	int res = prof_write_trace("prof_out/trace.json");
+	unsigned long trace_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	res |= prof_write_log("prof_out/prof.log");
+	unsigned long log_msec = timer_getmsec(&timer);
+
+	struct stat st_trace, st_log;
+	stat("prof_out/trace.json", &st_trace);
+	stat("prof_out/prof.log", &st_log);
+	printf("trace: %lu bytes in %lu ms, log: %lu bytes in %lu ms\n", (unsigned long)st_trace.st_size, trace_msec,
+			(unsigned long)st_log.st_size, log_msec);
+
+	int errors = res ? 1 : 0;
+	if(!fs || fs->frame != (unsigned long)frames - 1 || fs->counters[PROF_DRAW_CALLS] != 3) errors++;
+	errors += check_log("prof_out/prof.log", frames, jobs);
+
+	printf("log check: %s (%d errors)\n", errors ? "FAILED" : "ok", errors);
+	return errors ? 1 : 0;
+}
+BENCH_CHECK(profiler, check_profiler);
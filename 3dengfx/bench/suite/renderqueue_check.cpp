@@ -0,0 +1,251 @@
+/*
+ * bench_suite --check=renderqueue
+ * Runs a scene of objects sharing a few materials and textures through the
+ * render queue with the null backend (no graphics context needed), and
+ * counts the state changes reaching the backend per frame: without the
+ * state filter (every state set by every object), with the filter in object
+ * list order, and with the filter in sorted order. It also times the key
+ * generation and sorting, and checks the sorted order: opaque objects not
+ * writing to the zbuffer first, in list order, then the rest of the opaque
+ * objects, then blended objects back to front, in front of the camera down
+ * +z or -z as the tree is configured (--with-coord).
+ *
+ * Then it times preparing and recording the frame on the calling thread
+ * against doing it on the thread pool (replaying the command lists on the
+ * null backend), and checks that both draw the objects in the same order,
+ * whether one by one or in instance batches.
+ *
+ * usage: bench_suite --check=renderqueue [objects] [iterations] [threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <map>
+#include "3dengfx_config.h"
+#include "3dengfx/object.hpp"
+#include "3dengfx/rqueue.hpp"
+#include "common/timer.h"
+#include "common/threads.h"
+#include "bench.hpp"
+
+using namespace std;
+
+static scalar_t frand(scalar_t low, scalar_t high) {
+	return low + (high - low) * (scalar_t)rand() / (scalar_t)RAND_MAX;
+}
+
+// the camera looks down +z, or -z in a right handed tree
+#ifdef COORD_LHS
+#define FORWARD_Z	1.0
+#else
+#define FORWARD_Z	-1.0
+#endif
+
+static scalar_t view_depth(Object *obj) {
+	const Matrix4x4 &mat = obj->get_world_matrix();
+	return mat[2][3] * FORWARD_Z;	// identity view matrix
+}
+
+static Vector3 get_translation(const Matrix4x4 &mat) {
+	return Vector3(mat[0][3], mat[1][3], mat[2][3]);
+}
+
+// keeps the position of everything drawn, in order
+class DrawOrderBackend : public NullRenderBackend {
+private:
+	Matrix4x4 world;
+
+public:
+	vector<Vector3> order;
+
+	virtual void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
+		if(xform_type == XFORM_WORLD) world = mat;
+	}
+
+	virtual void draw(const VertexArray &varray, const IndexArray &iarray) {
+		order.push_back(get_translation(world));
+	}
+
+	virtual void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+		for(int i=0; i<count; i++) {
+			order.push_back(get_translation(world[i]));
+		}
+	}
+
+	virtual void render_object(Object *obj, unsigned long time) {
+		order.push_back(get_translation(obj->get_world_matrix()));
+	}
+};
+
+static unsigned long render_frame(RenderQueue *rqueue, vector<Object*> &objects) {
+	rqueue->clear();
+	rqueue->add_objects(&objects[0], (int)objects.size());
+	rqueue->sort();
+	return rqueue->submit();
+}
+
+static void print_stats(const char *name, const RenderStats *stats, int frames) {
+	printf("%-24s %8.1f state changes/frame", name, (float)stats->total_changes() / frames);
+	if(stats->total_skipped()) {
+		printf(" (%.1f redundant dropped)", (float)stats->total_skipped() / frames);
+	}
+	putchar('\n');
+}
+
+static int check_renderqueue(int argc, char **argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 2000;
+	int iter = argc > 2 ? atoi(argv[2]) : 100;
+	int threads = argc > 3 ? atoi(argv[3]) : 0;
+	const int mat_count = 8;
+	const int tex_count = 6;
+
+	if(count <= 0 || iter <= 0 || threads < 0) {
+		fprintf(stderr, "usage: %s [objects] [iterations] [threads]\n", argv[0]);
+		return 1;
+	}
+	thr_set_num_workers(threads);
+
+	// camera at the origin looking forward
+	set_matrix(XFORM_VIEW, Matrix4x4::identity_matrix);
+	set_matrix(XFORM_PROJECTION, create_projection_matrix(quarter_pi, 1.333333f, 1.0f, 1000.0f));
+
+	srand(0);
+	vector<Texture*> textures(tex_count);
+	for(int i=0; i<tex_count; i++) {
+		textures[i] = new Texture(-1, -1, TEX_2D);	// no image, no GL texture
+	}
+
+	vector<Material> materials(mat_count);
+	for(int i=0; i<mat_count; i++) {
+		materials[i].diffuse_color = Color(frand(0, 1), frand(0, 1), frand(0, 1));
+		materials[i].specular_power = frand(10, 60);
+		if(i % 4 == 3) materials[i].alpha = 0.5;
+	}
+
+	TriMesh mesh = ObjSphere(1.0, 2).get_mesh();
+	vector<Object*> objects(count);
+	for(int i=0; i<count; i++) {
+		Object *obj = new Object(mesh);
+		Material mat = materials[rand() % mat_count];
+		if(rand() % 4) mat.set_texture(textures[rand() % tex_count], TEXTYPE_DIFFUSE);
+		if(rand() % 8 == 0) mat.set_texture(textures[rand() % tex_count], TEXTYPE_DETAIL);
+		obj->set_material(mat);
+		if(rand() % 10 == 0) obj->set_use_vertex_color(true);
+		if(i % 64 == 0) obj->set_zwrite(false);
+
+		scalar_t z = frand(5, 500);
+		obj->set_position(Vector3(frand(-0.3, 0.3) * z, frand(-0.3, 0.3) * z, z * FORWARD_Z));
+		objects[i] = obj;
+	}
+
+	NullRenderBackend backend;
+	RenderQueue rqueue(&backend);
+	rqueue.set_parallel(false);
+
+	// object list order
+	unsigned long tris = 0;
+	for(int j=0; j<iter; j++) {
+		rqueue.clear();
+		rqueue.add_objects(&objects[0], count);
+		tris += rqueue.submit();
+	}
+	printf("%d objects, %d visible, %lu triangles/frame, %d frames\n", count, rqueue.get_item_count(), tris / iter, iter);
+
+	RenderStats unfiltered = *rqueue.get_stats();
+	for(int i=0; i<RSTATE_COUNT; i++) {
+		unfiltered.changes[i] += unfiltered.skipped[i];
+	}
+	print_stats("no filter:", &unfiltered, iter);
+	print_stats("filter, list order:", backend.get_stats(), iter);
+
+	// sorted
+	backend.reset();
+	rqueue.reset_stats();
+	unsigned long sort_msec = 0;
+	ntimer timer;
+	for(int j=0; j<iter; j++) {
+		rqueue.clear();
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		rqueue.add_objects(&objects[0], count);
+		rqueue.sort();
+		sort_msec += timer_getmsec(&timer);
+
+		rqueue.submit();
+	}
+	print_stats("filter, sorted:", backend.get_stats(), iter);
+
+	printf("\nstate changes per frame by state (sorted):\n");
+	const RenderStats *stats = backend.get_stats();
+	for(int i=0; i<RSTATE_COUNT; i++) {
+		printf("  %-20s %8.1f\n", get_render_state_name((RenderState)i), (float)stats->changes[i] / iter);
+	}
+	printf("\nprepare, key and sort: %.3f ms/frame\n", (float)sort_msec / iter);
+
+	// check the order
+	const RenderItem *items = rqueue.get_items();
+	int n = rqueue.get_item_count();
+	int errors = 0;
+
+	map<const Object*, int> list_pos;
+	for(int i=0; i<count; i++) {
+		list_pos[objects[i]] = i;
+	}
+
+	for(int i=0; i<n; i++) {
+		int pass = (int)(items[i].key >> 62);
+		bool zwrite = items[i].obj->get_render_params().zwrite;
+		if((pass == RQ_PASS_BACKGROUND && zwrite) || (pass == RQ_PASS_OPAQUE && !zwrite)) errors++;
+	}
+	for(int i=1; i<n; i++) {
+		int pass0 = (int)(items[i - 1].key >> 62);
+		int pass1 = (int)(items[i].key >> 62);
+
+		if(items[i].key < items[i - 1].key) errors++;
+		if(pass1 < pass0) errors++;
+		if(pass0 == RQ_PASS_BACKGROUND && pass1 == RQ_PASS_BACKGROUND &&
+				list_pos[items[i].obj] < list_pos[items[i - 1].obj]) {
+			errors++;
+		}
+		if(pass0 == RQ_PASS_BLENDED && pass1 == RQ_PASS_BLENDED &&
+				view_depth(items[i].obj) > view_depth(items[i - 1].obj) + 0.01 * view_depth(items[i - 1].obj)) {
+			errors++;
+		}
+	}
+	printf("order check: %s (%d errors)\n", errors ? "FAILED" : "ok", errors);
+
+	// serial against parallel preparation and recording
+	unsigned long msec[2];
+	for(int k=0; k<2; k++) {
+		rqueue.set_parallel(k == 1);
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		for(int j=0; j<iter; j++) {
+			render_frame(&rqueue, objects);
+		}
+		msec[k] = timer_getmsec(&timer);
+	}
+	printf("\nframe preparation, %d threads: serial %.3f ms, parallel %.3f ms, speedup %.2f\n",
+			thr_get_num_workers(), (float)msec[0] / iter, (float)msec[1] / iter,
+			msec[1] ? (float)msec[0] / (float)msec[1] : 0.0f);
+
+	DrawOrderBackend serial_order, parallel_order;
+
+	rqueue.set_backend(&serial_order);
+	rqueue.set_parallel(false);
+	render_frame(&rqueue, objects);
+
+	rqueue.set_backend(&parallel_order);
+	rqueue.set_parallel(true);
+	render_frame(&rqueue, objects);
+
+	bool same = serial_order.order == parallel_order.order;
+	printf("draw order check: %s (%d objects drawn)\n", same ? "ok" : "FAILED", (int)serial_order.order.size());
+	if(!same) errors++;
+
+	return errors ? 1 : 0;
+}
+BENCH_CHECK(renderqueue, check_renderqueue);
@@ -0,0 +1,206 @@
+/*
+ * bench_suite --check=rtrace
+ * Ray traces a scene of meshes and analytic primitives, with shadows and
+ * reflections, once for each number of worker threads from 1 up to the
+ * given maximum, and checks that all the images are the same. Then it
+ * casts the primary rays of the image again, one at a time and as packets,
+ * to compare the two. The image is saved as rtrace_check.tga.
+ *
+ * usage: bench_suite --check=rtrace [width height] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "3dengfx/3dengfx.hpp"
+#include "gfx/rtrace.hpp"
+#include "gfx/image.h"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+static void create_scene(RayTracer *rt, PixelBuffer *checker) {
+	TriMesh mesh;
+	RTMaterial mat;
+
+	create_torus(&mesh, 0.4, 1.5, 64);
+	mat.diffuse = Color(0.9, 0.9, 0.9);
+	mat.specular = Color(0.8, 0.8, 0.8);
+	mat.texture = checker;
+	Matrix4x4 xform;
+	xform.rotate(Vector3(half_pi * 0.6, 0.4, 0));
+	rt->add_mesh(&mesh, xform, mat);
+
+	create_teapot(&mesh, 0.8, 8);
+	mat = RTMaterial(Color(0.2, 0.5, 1.0));
+	mat.specular = Color(1, 1, 1);
+	mat.specular_power = 60.0;
+	xform = Matrix4x4::identity_matrix;
+	xform.translate(Vector3(2.8, -2, 1));
+	rt->add_mesh(&mesh, xform, mat);
+
+	mat = RTMaterial(Color(1.0, 0.4, 0.2));
+	mat.specular = Color(0.5, 0.5, 0.5);
+	mat.reflectivity = 0.3;
+	Sphere sph(Vector3(0, 0, 0), 0.8);
+	rt->add_surface(&sph, mat);
+
+	mat = RTMaterial(Color(0.3, 0.8, 0.3));
+	rt->add_box(AABox(Vector3(-3.5, -2, 0.5), Vector3(-2.5, -0.5, 1.5)), mat);
+
+	mat = RTMaterial(Color(1, 1, 1));
+	mat.texture = checker;
+	mat.reflectivity = 0.2;
+	Plane floor(Vector3(0, -2, 0), Vector3(0, 1, 0));
+	rt->add_surface(&floor, mat);
+
+	RTLight lt;
+	lt.pos = Vector3(-5, 8, -6);
+	lt.color = Color(1.0, 0.9, 0.8);
+	lt.directional = false;
+	rt->add_light(lt);
+
+	lt.pos = Vector3(1, 1, -0.5);
+	lt.color = Color(0.25, 0.3, 0.45);
+	lt.directional = true;
+	rt->add_light(lt);
+
+	rt->set_ambient_light(Color(0.1, 0.1, 0.1));
+	rt->set_background(Color(0.05, 0.05, 0.1));
+}
+
+// the primary rays of the image, in the order render() traces them
+static void primary_rays(int width, int height, const Matrix4x4 &view, const Matrix4x4 &proj, vector<RTRay> *rays) {
+	Matrix4x4 inv = (proj * view).inverse();
+	Vector3 eye = Vector3(0, 0, 0).transformed(view.inverse());
+
+	for(int y=0; y<height; y++) {
+		for(int x=0; x<width; x++) {
+			Vector3 p((x + 0.5) / width * 2.0 - 1.0, 1.0 - (y + 0.5) / height * 2.0, 1.0);
+			Vector4 pw = Vector4(p.x, p.y, p.z, 1.0).transformed(inv);
+			Vector3 dir = (Vector3(pw.x, pw.y, pw.z) / pw.w - eye).normalized();
+
+			RTRay ray = {{eye.x, eye.y, eye.z}, {dir.x, dir.y, dir.z}, 0.0f, 1e30f};
+			rays->push_back(ray);
+		}
+	}
+}
+
+static int check_rtrace(int argc, char **argv) {
+	int width = 640, height = 480, max_threads = 8;
+
+	if(argc > 2) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if(argc > 3) max_threads = atoi(argv[3]);
+	if(width < 1 || height < 1 || max_threads < 1) {
+		fprintf(stderr, "usage: %s [width height] [max threads]\n", argv[0]);
+		return 1;
+	}
+
+	PixelBuffer checker(256, 256);
+	for(int i=0; i<256; i++) {
+		for(int j=0; j<256; j++) {
+			checker.buffer[i * 256 + j] = ((i / 128) ^ (j / 128)) & 1 ? 0xff3060c0 : 0xffe0e0d0;
+		}
+	}
+
+	RayTracer rt;
+	create_scene(&rt, &checker);
+
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+	rt.build();
+	printf("%d geometries, BVH of %d nodes built in %lu msec\n", rt.get_geom_count(), rt.get_node_count(),
+			timer_getmsec(&timer));
+
+	TargetCamera cam(Vector3(0, 3, -8), Vector3(0, -0.5, 0));
+	cam.set_aspect((scalar_t)width / (scalar_t)height);
+	Matrix4x4 view = cam.get_camera_matrix();
+	Matrix4x4 proj = cam.get_projection_matrix();
+
+	PixelBuffer img(width, height), first(width, height);
+	bool identical = true;
+
+	printf("%dx%d\n%8s %10s %12s %12s %12s %12s\n", width, height, "threads", "msec", "primary", "shadow",
+			"reflection", "Mrays/s");
+
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+		rt.reset_stats();
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		rt.render(&img, view, proj);
+		unsigned long msec = timer_getmsec(&timer);
+
+		const RTStats *st = rt.get_stats();
+		unsigned long rays = st->primary_rays + st->shadow_rays + st->reflection_rays;
+		printf("%8d %10lu %12lu %12lu %12lu %12.2f\n", threads, msec, st->primary_rays, st->shadow_rays,
+				st->reflection_rays, msec ? rays / (msec * 1000.0) : 0.0);
+
+		if(threads == 1) {
+			memcpy(first.buffer, img.buffer, width * height * sizeof(Pixel));
+		} else if(memcmp(first.buffer, img.buffer, width * height * sizeof(Pixel)) != 0) {
+			fprintf(stderr, "the image rendered with %d threads differs from the single threaded one\n", threads);
+			identical = false;
+		}
+	}
+
+	// primary rays alone, single threaded: one at a time against packets
+	thr_set_num_workers(1);
+	vector<RTRay> rays;
+	primary_rays(width, height, view, proj, &rays);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	unsigned long single_hits = 0;
+	for(size_t i=0; i<rays.size(); i++) {
+		RTHit hit;
+		if(rt.intersect(rays[i], &hit)) single_hits++;
+	}
+	unsigned long single_msec = timer_getmsec(&timer);
+
+	// packets of 4 x (RT_PACKET_SIZE / 4) pixel blocks, like render() uses
+	int bh = RT_PACKET_SIZE / 4;
+	timer_reset(&timer);
+	timer_start(&timer);
+	unsigned long packet_hits = 0;
+	for(int by=0; by<height; by+=bh) {
+		for(int bx=0; bx<width; bx+=4) {
+			RTPacket pk;
+			RTPacketHit hit;
+			memset(&pk, 0, sizeof pk);
+			for(int r=0; r<RT_PACKET_SIZE; r++) {
+				int x = bx + (r & 3), y = by + r / 4;
+				if(x < width && y < height) rt_packet_set(&pk, r, rays[y * width + x]);
+			}
+			rt.intersect(pk, &hit);
+			for(int r=0; r<RT_PACKET_SIZE; r++) {
+				if((pk.mask & (1 << r)) && hit.geom[r] != -1) packet_hits++;
+			}
+		}
+	}
+	unsigned long packet_msec = timer_getmsec(&timer);
+
+	printf("primary rays, one at a time: %lu msec, in packets of %d: %lu msec\n", single_msec, RT_PACKET_SIZE,
+			packet_msec);
+	if(single_hits != packet_hits) {
+		fprintf(stderr, "single rays hit %lu times, packets %lu times\n", single_hits, packet_hits);
+		identical = false;
+	}
+
+	if(save_image("rtrace_check.tga", img.buffer, width, height, IMG_FMT_TGA) == -1) {
+		fprintf(stderr, "failed to save rtrace_check.tga\n");
+	}
+
+	if(!identical) return 1;
+	printf("all results identical, the image is saved as rtrace_check.tga\n");
+	return 0;
+}
+BENCH_CHECK(rtrace, check_rtrace);
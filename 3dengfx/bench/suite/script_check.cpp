@@ -0,0 +1,357 @@
+/*
+ * bench_suite --check=script
+ * Writes a demo script of random commands on a number of parts, and plays
+ * it frame by frame the old way, reading the script a line at a time, and
+ * compiled, reporting the time spent on the script per frame. Then it
+ * seeks the compiled script to random times, from random points of a
+ * playthrough, and checks that the parts are named, running, targeted and
+ * cleared as playing the script from the start up to that time leaves
+ * them, and started at their last START_PART.
+ *
+ * usage: bench_suite --check=script [commands] [seeks]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include "dsys/dsys.hpp"
+#include "dsys/part.hpp"
+#include "dsys/cmd.hpp"
+#include "dsys/script.h"
+#include "common/timer.h"
+#include "common/err_msg.h"
+#include "bench.hpp"
+
+using namespace std;
+using namespace dsys;
+
+#define PART_COUNT		16
+#define FRAME_MSEC		16
+
+class TestPart : public Part {
+protected:
+	void draw_part() {}
+
+public:
+	TestPart(const char *name) : Part(name) {}
+
+	unsigned long get_start_time() const {return start_time;}
+};
+
+struct PartSnapshot {
+	string name;
+	bool running;
+	RenderTarget target;
+	bool clear;
+	unsigned long start_time;
+};
+
+static vector<TestPart*> parts;
+static vector<string> orig_names;
+static string script_fname;
+
+static bool write_script(int count) {
+	FILE *fp = fopen(script_fname.c_str(), "w");
+	if(!fp) {
+		perror(script_fname.c_str());
+		return false;
+	}
+
+	vector<string> names = orig_names;
+	vector<int> renames(PART_COUNT, 0);
+	unsigned long time = 0;
+
+	fprintf(fp, "# script check, %d random commands on %d parts\n", count, PART_COUNT);
+	for(int i=0; i<count; i++) {
+		time += rand() % 200;
+		// now and then a command behind its previous, it runs along with it
+		unsigned long t = rand() % 50 ? time : time / 2;
+
+		int p = rand() % PART_COUNT;
+		const char *name = names[p].c_str();
+
+		switch(rand() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			fprintf(fp, "%lu start_part %s\n", t, name);
+			break;
+		case 3:
+		case 4:
+			fprintf(fp, "%lu end_part %s\n", t, name);
+			break;
+		case 5:
+			{
+				char buf[64];
+				sprintf(buf, "%s_%d", orig_names[p].c_str(), ++renames[p]);
+				fprintf(fp, "%lu rename_part %s %s\n", t, name, buf);
+				names[p] = buf;
+			}
+			break;
+		case 6:
+			if(rand() & 1) {
+				fprintf(fp, "%lu set_rtarget %s %s\n", t, name, rand() % 3 ? "fb" : (rand() & 1 ? "t1" : "t2"));
+			} else {
+				fprintf(fp, "%lu set_clear %s %s\n", t, name, rand() & 1 ? "true" : "false");
+			}
+			break;
+		default:
+			fprintf(fp, "%lu fx flash %lu 100\n", t, t);
+			break;
+		}
+
+		if(rand() % 100 == 0) {
+			fprintf(fp, "\n# a comment\n");
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+// back to the names and settings the parts had before the script
+static void reset_parts() {
+	for(int i=0; i<PART_COUNT; i++) {
+		TestPart *part = parts[i];
+		if(get_running(part->get_name()) == part) {
+			stop_part(part);
+		}
+		rename_part(part, orig_names[i].c_str());
+		part->set_target(RT_FB);
+		part->set_clear(false);
+	}
+}
+
+static vector<PartSnapshot> snapshot() {
+	vector<PartSnapshot> snap(PART_COUNT);
+	for(int i=0; i<PART_COUNT; i++) {
+		TestPart *part = parts[i];
+		snap[i].name = part->get_name();
+		snap[i].running = get_running(part->get_name()) == part;
+		snap[i].target = part->get_target();
+		snap[i].clear = part->get_clear();
+		snap[i].start_time = part->get_start_time();
+	}
+	return snap;
+}
+
+static cmd::CompiledScript *compile() {
+	DemoScript *ds = open_script(script_fname.c_str());
+	if(!ds) {
+		fprintf(stderr, "can't open %s\n", script_fname.c_str());
+		return 0;
+	}
+	cmd::CompiledScript *script = new cmd::CompiledScript;
+	script->compile(ds);
+	close_script(ds);
+	return script;
+}
+
+// the frames of a playthrough, up to and including the time
+static void play(cmd::CompiledScript *script, unsigned long from, unsigned long to) {
+	for(unsigned long t=from; t<to; t+=FRAME_MSEC) {
+		script->run(t);
+	}
+	script->run(to);
+}
+
+// the script as it was read before it was compiled, one line at a time
+static int execute_script(DemoScript *ds, unsigned long time) {
+	DemoCommand command;
+	
+	int res = get_next_command(ds, &command, time);
+	if(res == EOF || res == 1) {
+		return res;
+	}
+
+	if(!cmd::command(command.type, command.argv[0], command.argv + 1)) {
+		error("error in demoscript command execution!");
+	}
+	free_command(&command);
+	return 0;
+}
+
+static void bench_playback(unsigned long duration) {
+	ntimer timer;
+	timer_reset(&timer);
+	unsigned long frames = duration / FRAME_MSEC + 1;
+
+	reset_parts();
+	DemoScript *ds = open_script(script_fname.c_str());
+	timer_start(&timer);
+	for(unsigned long t=0; t<=duration; t+=FRAME_MSEC) {
+		while(execute_script(ds, t) == 0);
+	}
+	double old_usec = (double)timer_getmsec(&timer) * 1000.0 / frames;
+	close_script(ds);
+
+	reset_parts();
+	timer_reset(&timer);
+	timer_start(&timer);
+	cmd::CompiledScript *script = compile();
+	unsigned long compile_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(unsigned long t=0; t<=duration; t+=FRAME_MSEC) {
+		script->run(t);
+	}
+	double new_usec = (double)timer_getmsec(&timer) * 1000.0 / frames;
+	delete script;
+
+	printf("%lu frames of %d msec\n", frames, FRAME_MSEC);
+	printf("line by line: %.3f usec per frame\n", old_usec);
+	printf("compiled: %.3f usec per frame, compiled once in %lu msec\n", new_usec, compile_msec);
+}
+
+static bool check_seeks(int seeks, unsigned long duration) {
+	int failed = 0;
+	for(int i=0; i<seeks && failed < 10; i++) {
+		unsigned long to = rand() % (duration + 1000);
+		unsigned long from = rand() % (duration + 1000);
+
+		// played from the start, and a little further
+		reset_parts();
+		cmd::CompiledScript *script = compile();
+		play(script, 0, to);
+		vector<PartSnapshot> played = snapshot();
+		play(script, to, to + 1000);
+		vector<PartSnapshot> played_on = snapshot();
+		delete script;
+
+		// seeking from anywhere in a playthrough
+		reset_parts();
+		script = compile();
+		play(script, 0, from);
+		script->seek(to);
+		vector<PartSnapshot> seeked = snapshot();
+		script->run(to);
+		play(script, to, to + 1000);
+		vector<PartSnapshot> seeked_on = snapshot();
+		delete script;
+
+		for(int j=0; j<PART_COUNT; j++) {
+			const PartSnapshot &a = played[j], &b = seeked[j];
+			const PartSnapshot &c = played_on[j], &d = seeked_on[j];
+
+			bool ok = a.name == b.name && a.running == b.running && a.target == b.target && a.clear == b.clear &&
+				c.name == d.name && c.running == d.running && c.target == d.target && c.clear == d.clear;
+			if(ok && b.running && b.start_time > to) ok = false;
+
+			if(!ok) {
+				fprintf(stderr, "seek from %lu to %lu: part %d is %s %s t%d %s, played it's %s %s t%d %s\n",
+						from, to, j, b.name.c_str(), b.running ? "running" : "stopped", (int)b.target,
+						b.clear ? "clear" : "", a.name.c_str(), a.running ? "running" : "stopped",
+						(int)a.target, a.clear ? "clear" : "");
+				failed++;
+				break;
+			}
+		}
+	}
+
+	printf("%d seeks: %s\n", seeks, failed ? "FAILED" : "ok");
+	return !failed;
+}
+
+// the start times after a seek, against the commands of the script
+static bool check_start_times(unsigned long duration) {
+	reset_parts();
+	cmd::CompiledScript *script = compile();
+	unsigned long to = duration / 2;
+	script->seek(to);
+	vector<PartSnapshot> seeked = snapshot();
+	delete script;
+
+	/* the last start of every part up to the time, from the script with the
+	 * times it runs at, each at least the time of the line before it.
+	 */
+	reset_parts();
+	DemoScript *ds = open_script(script_fname.c_str());
+	vector<unsigned long> last_start(PART_COUNT, ULONG_MAX);
+	unsigned long last_time = 0;
+	DemoCommand dc;
+	while(get_next_command(ds, &dc, ULONG_MAX) != EOF) {
+		unsigned long t = dc.time > last_time ? dc.time : last_time;
+		last_time = t;
+
+		if(t <= to) {
+			if(dc.type == CMD_START_PART || dc.type == CMD_RENAME_PART) {
+				Part *part = get_part(dc.argv[0]);
+				int idx = -1;
+				for(int i=0; i<PART_COUNT; i++) {
+					if(parts[i] == part) idx = i;
+				}
+				if(dc.type == CMD_START_PART) {
+					last_start[idx] = t;
+				} else {
+					rename_part(part, dc.argv[1]);
+				}
+			}
+		}
+		free_command(&dc);
+	}
+	close_script(ds);
+
+	bool ok = true;
+	for(int i=0; i<PART_COUNT; i++) {
+		if(seeked[i].running && seeked[i].start_time != last_start[i]) {
+			fprintf(stderr, "part %d started at %lu, its last start_part is at %lu\n", i,
+					seeked[i].start_time, last_start[i]);
+			ok = false;
+		}
+	}
+	printf("start times after a seek to %lu: %s\n", to, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+static int check_script(int argc, char **argv) {
+	int count = 5000;
+	int seeks = 200;
+
+	if(argc > 1) count = atoi(argv[1]);
+	if(argc > 2) seeks = atoi(argv[2]);
+	if(count < 1 || seeks < 0) {
+		fprintf(stderr, "usage: %s [commands] [seeks]\n", argv[0]);
+		return 1;
+	}
+
+	set_verbosity(0);
+	cmd::register_commands();
+
+	for(int i=0; i<PART_COUNT; i++) {
+		char name[32];
+		sprintf(name, "part%d", i);
+		orig_names.push_back(name);
+		parts.push_back(new TestPart(name));
+		add_part(parts.back());
+	}
+
+	srand(1);
+	script_fname = bench_tmp_file("script_check.dsc");
+
+	bool ok = false;
+	cmd::CompiledScript *script = write_script(count) ? compile() : 0;
+	if(script) {
+		unsigned long duration = script->get_duration();
+		printf("%lu commands on %d parts, %lu msec\n", (unsigned long)script->get_command_count(),
+				PART_COUNT, duration);
+		delete script;
+
+		bench_playback(duration);
+		ok = check_seeks(seeks, duration);
+		ok = check_start_times(duration) && ok;
+	}
+
+	reset_parts();
+	for(int i=0; i<PART_COUNT; i++) {
+		remove_part(parts[i]);
+		delete parts[i];
+	}
+	parts.clear();
+	orig_names.clear();
+	set_verbosity(3);
+	return ok ? 0 : 1;
+}
+BENCH_CHECK(script, check_script);
@@ -0,0 +1,142 @@
+/*
+ * bench_suite --check=swrast
+ * Renders a lit and textured scene headless, with the software rasterizer,
+ * once for each number of worker threads from 1 up to the given maximum.
+ * It reports the frame rate and the rasterizer statistics of each run,
+ * checks that every run produced exactly the same image, and saves the
+ * last frame as swrast_check.tga.
+ *
+ * usage: bench_suite --check=swrast [width height] [frames] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "3dengfx/3dengfx.hpp"
+#include "3dengfx/swrast.hpp"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+static Texture *checker_texture(int size, int squares) {
+	PixelBuffer pbuf(size, size);
+	for(int i=0; i<size; i++) {
+		for(int j=0; j<size; j++) {
+			bool odd = ((i * squares / size) ^ (j * squares / size)) & 1;
+			pbuf.buffer[i * size + j] = odd ? 0xff3060c0 : 0xffe0e0d0;
+		}
+	}
+
+	Texture *tex = new Texture(size, size);
+	tex->set_pixel_data(pbuf);
+	return tex;
+}
+
+static Object *torus;
+
+static Scene *create_scene(Texture *tex) {
+	Scene *scene = new Scene;
+
+	TriMesh mesh;
+	create_torus(&mesh, 0.4, 1.5, 48);
+	torus = new Object(mesh);
+	torus->get_material_ptr()->set_texture(tex, TEXTYPE_DIFFUSE);
+	torus->get_material_ptr()->specular_color = Color(0.8, 0.8, 0.8);
+	torus->get_material_ptr()->specular_power = 40.0;
+	torus->set_rotation(Vector3(half_pi * 0.6, 0, 0));
+	scene->add_object(torus);
+
+	create_sphere(&mesh, 0.8, 32);
+	Object *sphere = new Object(mesh);
+	sphere->get_material_ptr()->diffuse_color = Color(1.0, 0.4, 0.2);
+	scene->add_object(sphere);
+
+	create_plane(&mesh, Vector3(0, 1, 0), Vector2(12, 12), 8);
+	Object *floor = new Object(mesh);
+	floor->get_material_ptr()->set_texture(tex, TEXTYPE_DIFFUSE);
+	floor->set_position(Vector3(0, -2, 0));
+	scene->add_object(floor);
+
+	scene->add_light(new PointLight(Vector3(-5, 8, -6), Color(1.0, 0.9, 0.8)));
+	scene->add_light(new PointLight(Vector3(6, 3, -2), Color(0.3, 0.4, 0.6)));
+	scene->set_ambient_light(Color(0.1, 0.1, 0.1));
+	scene->set_background(Color(0.05, 0.05, 0.1));
+
+	TargetCamera *cam = new TargetCamera(Vector3(0, 3, -8), Vector3(0, -0.5, 0));
+	scene->add_camera(cam);
+	scene->set_active_camera(cam);
+	return scene;
+}
+
+static int check_swrast(int argc, char **argv) {
+	int width = 640, height = 480, frames = 60, max_threads = 8;
+
+	if(argc > 2) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if(argc > 3) frames = atoi(argv[3]);
+	if(argc > 4) max_threads = atoi(argv[4]);
+	if(width < 1 || height < 1 || frames < 1 || max_threads < 1) {
+		fprintf(stderr, "usage: %s [width height] [frames] [max threads]\n", argv[0]);
+		return 1;
+	}
+
+	if(!create_soft_context(width, height)) {
+		return 1;
+	}
+	SoftRaster *swr = get_soft_context();
+
+	Texture *tex = checker_texture(256, 8);
+	Scene *scene = create_scene(tex);
+
+	vector<Pixel> first(width * height), frame(width * height);
+	bool identical = true;
+
+	printf("%dx%d, %d frames\n", width, height, frames);
+	printf("%8s %10s %8s %10s %10s %10s %10s\n", "threads", "msec", "fps", "triangles", "culled", "binned", "tile refs");
+
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+
+		swr->reset_stats();
+		for(int i=0; i<frames; i++) {
+			// the same animation in every run, the objects spin around
+			unsigned long msec = i * 40;
+			torus->set_rotation(Vector3(half_pi * 0.6, msec * 0.001, 0));
+			scene->render(msec);
+			flip();
+		}
+		unsigned long msec = timer_getmsec(&timer);
+		const SwrStats *stats = swr->get_stats();
+
+		printf("%8d %10lu %8.1f %10lu %10lu %10lu %10lu\n", threads, msec,
+				msec ? frames * 1000.0 / msec : 0.0, stats->triangles / frames,
+				stats->culled / frames, stats->binned / frames, stats->tile_refs / frames);
+
+		swr->read_pixels(threads == 1 ? &first[0] : &frame[0]);
+		if(threads > 1 && memcmp(&first[0], &frame[0], width * height * sizeof(Pixel)) != 0) {
+			fprintf(stderr, "the image rendered with %d threads differs from the single threaded one\n", threads);
+			identical = false;
+		}
+	}
+
+	char fname[] = "swrast_check.tga";
+	screen_capture(fname);
+
+	delete scene;
+	delete tex;
+	destroy_graphics_context();
+
+	if(!identical) return 1;
+	printf("all images identical, the last one is saved as swrast_check.tga\n");
+	return 0;
+}
+BENCH_CHECK(swrast, check_swrast);
@@ -0,0 +1,285 @@
+/*
+ * bench_suite --check=terrain
+ * Generates a fault formation heightfield of size x size samples, once for
+ * each number of worker threads from 1 up to the given maximum, reporting
+ * the time of each run and checking that they all produced the same
+ * heights. It compares create_landscape against the per vertex loop it
+ * used to run, for the time and the heights. Then it flies a camera over a
+ * terrain of the heightfield, rendered with the software rasterizer, and
+ * reports the chunks drawn, culled, built and morphed per frame, along with
+ * the triangles against the full resolution mesh and the frame times. At a
+ * few points of the flight it measures the largest gap along the edges of
+ * the chunks. The last frame is saved as terrain_check.tga.
+ *
+ * usage: bench_suite --check=terrain [size] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#include "3dengfx/3dengfx.hpp"
+#include "3dengfx/swrast.hpp"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+
+#define FAULTS		512
+#define FRAMES		30
+
+// create_landscape before it used gen_fault_heightfield
+static void old_landscape(TriMesh *mesh, const Vector2 &size, int mesh_detail, scalar_t max_height, int iter, scalar_t roughness, int seed) {
+	create_plane(mesh, Vector3(0, 1, 0), size, mesh_detail);
+	roughness *= 0.25;
+	srand(seed);
+
+	scalar_t offs = max_height / (scalar_t)iter;
+	unsigned long vcount = mesh->get_vertex_array()->get_count();
+	Vertex *varray = mesh->get_mod_vertex_array()->get_mod_data();
+
+	for(int i=0; i<iter; i++) {
+		Vector2 pt1(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
+		Vector2 pt2(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
+		Vector2 normal(pt2.y - pt1.y, pt1.x - pt2.x);
+
+		for(unsigned long j=0; j<vcount; j++) {
+			Vector3 *vpos = &varray[j].pos;
+			Vector2 vpos2d(vpos->x, vpos->z);
+			scalar_t dist = dist_line(pt1, pt2, vpos2d);
+
+			if(dot_product(normal, vpos2d - pt1) > 0.0) {
+				vpos->y += offs * tanh(dist * size.x * size.y * roughness);
+			}
+		}
+	}
+
+	scalar_t hmin = FLT_MAX, hmax = 0.0;
+	for(unsigned long i=0; i<vcount; i++) {
+		hmax = max(hmax, varray[i].pos.y);
+		hmin = min(hmin, varray[i].pos.y);
+	}
+	for(unsigned long i=0; i<vcount; i++) {
+		varray[i].pos.y = max_height * (varray[i].pos.y - hmin) / (hmax - hmin);
+	}
+	mesh->calculate_normals();
+}
+
+struct ChunkRect {
+	scalar_t x0, z0, x1, z1;
+	int vrow;
+	const Vertex *verts;
+};
+
+// the height of the chunk mesh at a point within it, split like the terrain splits its quads
+static scalar_t chunk_height(const ChunkRect &c, scalar_t x, scalar_t z) {
+	int cells = c.vrow - 1;
+	scalar_t fx = (x - c.x0) / (c.x1 - c.x0) * cells;
+	scalar_t fz = (z - c.z0) / (c.z1 - c.z0) * cells;
+	int i = max(min((int)fx, cells - 1), 0);
+	int j = max(min((int)fz, cells - 1), 0);
+	fx -= i;
+	fz -= j;
+
+	scalar_t h00 = c.verts[j * c.vrow + i].pos.y, h10 = c.verts[j * c.vrow + i + 1].pos.y;
+	scalar_t h01 = c.verts[(j + 1) * c.vrow + i].pos.y, h11 = c.verts[(j + 1) * c.vrow + i + 1].pos.y;
+	if(fx > fz) {
+		return h00 + (h10 - h00) * fx + (h11 - h10) * fz;
+	}
+	return h00 + (h01 - h00) * fz + (h11 - h01) * fx;
+}
+
+// the largest height difference of a chunk edge vertex from the neighbouring chunks
+static scalar_t max_seam_gap(const vector<Object*> &objs, unsigned long *checked) {
+	vector<ChunkRect> rects(objs.size());
+	for(size_t i=0; i<objs.size(); i++) {
+		const VertexArray *va = objs[i]->get_mesh().get_vertex_array();
+		ChunkRect &c = rects[i];
+		c.verts = va->get_data();
+		c.vrow = (int)sqrt((double)va->get_count() + 0.5);
+		c.x0 = c.verts[0].pos.x;
+		c.z0 = c.verts[0].pos.z;
+		c.x1 = c.verts[va->get_count() - 1].pos.x;
+		c.z1 = c.verts[va->get_count() - 1].pos.z;
+	}
+
+	scalar_t gap = 0.0;
+	*checked = 0;
+	for(size_t i=0; i<rects.size(); i++) {
+		const ChunkRect &c = rects[i];
+		scalar_t eps = (c.x1 - c.x0) / (c.vrow - 1) * 0.01;
+
+		for(int k=0; k<c.vrow * c.vrow; k++) {
+			int a = k % c.vrow, b = k / c.vrow;
+			if(a && b && a < c.vrow - 1 && b < c.vrow - 1) continue;
+			const Vector3 &p = c.verts[k].pos;
+
+			for(size_t j=0; j<rects.size(); j++) {
+				const ChunkRect &n = rects[j];
+				if(j == i || p.x < n.x0 - eps || p.x > n.x1 + eps || p.z < n.z0 - eps || p.z > n.z1 + eps) {
+					continue;
+				}
+				gap = max(gap, (scalar_t)fabs(p.y - chunk_height(n, p.x, p.z)));
+				(*checked)++;
+			}
+		}
+	}
+	return gap;
+}
+
+static Vector3 flight_pos(const Terrain *terrain, scalar_t t) {
+	const Vector2 &size = terrain->get_params().size;
+	scalar_t x = (t - 0.5) * size.x * 0.8;
+	scalar_t z = sin(t * two_pi) * size.y * 0.2;
+	return Vector3(x, terrain->get_height(x, z) + size.x * 0.01, z);
+}
+
+static int check_terrain(int argc, char **argv) {
+	int size = 4097, max_threads = 8;
+
+	if(argc > 1) size = atoi(argv[1]);
+	if(argc > 2) max_threads = atoi(argv[2]);
+	if(size < 65 || ((size - 1) & (size - 2)) || max_threads < 1) {
+		fprintf(stderr, "usage: %s [size (a power of two plus one)] [max threads]\n", argv[0]);
+		return 1;
+	}
+
+	if(!create_soft_context(640, 360)) {
+		return 1;
+	}
+
+	// the faults over the unit square, roughness for a band of about 1/100 of it
+	HeightField hf, hf_first;
+	bool identical = true;
+
+	printf("fault formation, %dx%d samples, %d faults\n", size, size, FAULTS);
+	printf("%8s %10s\n", "threads", "msec");
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+
+		gen_fault_heightfield(threads == 1 ? &hf_first : &hf, size, size, Vector2(1, 1), 1.0, FAULTS, 4000.0, 1);
+		printf("%8d %10lu\n", threads, timer_getmsec(&timer));
+
+		if(threads > 1 && memcmp(hf.get_data(), hf_first.get_data(), size * size * sizeof(float)) != 0) {
+			identical = false;
+		}
+	}
+	thr_set_num_workers(0);
+	if(!identical) {
+		fprintf(stderr, "the heightfields differ between the runs\n");
+	}
+
+	// create_landscape against the old loop, on a 256x256 plane
+	TriMesh land, old_land;
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+	old_landscape(&old_land, Vector2(10, 10), 254, 1.5, 256, 0.5, 1);
+	unsigned long old_msec = timer_getmsec(&timer);
+
+	timer_reset(&timer);
+	timer_start(&timer);
+	create_landscape(&land, Vector2(10, 10), 254, 1.5, 256, 0.5, 1);
+	unsigned long new_msec = timer_getmsec(&timer);
+
+	scalar_t max_diff = 0.0, min_dot = 1.0;
+	const Vertex *va = land.get_vertex_array()->get_data(), *vb = old_land.get_vertex_array()->get_data();
+	for(unsigned long i=0; i<land.get_vertex_array()->get_count(); i++) {
+		max_diff = max(max_diff, (scalar_t)fabs(va[i].pos.y - vb[i].pos.y));
+		min_dot = min(min_dot, dot_product(va[i].normal, vb[i].normal.normalized()));
+	}
+	printf("\ncreate_landscape 256x256, 256 faults: %lu msec, the old loop %lu msec\n", new_msec, old_msec);
+	printf("largest height difference %g (of 1.5), least normal agreement %.3f\n", max_diff, min_dot);
+
+	// a terrain of one unit per sample
+	TerrainParams params;
+	params.size = Vector2(size - 1, size - 1);
+	params.chunk_size = 32;
+
+	hf.normalize(size / 16);
+	Terrain *terrain = new Terrain;
+	timer_reset(&timer);
+	timer_start(&timer);
+	terrain->create(&hf, params);
+	printf("\nterrain %dx%d, %d levels, created in %lu msec\n", size, size,
+			terrain->get_stats()->levels, timer_getmsec(&timer));
+
+	terrain->get_material_ptr()->diffuse_color = Color(0.55, 0.6, 0.4);
+	terrain->get_material_ptr()->specular_color = Color(0.0, 0.0, 0.0);
+
+	Scene *scene = new Scene;
+	scene->add_terrain(terrain);
+	scene->add_light(new PointLight(Vector3(-size * 4.0, size * 4.0, -size * 2.0), Color(1.0, 0.95, 0.85)));
+	scene->set_ambient_light(Color(0.2, 0.2, 0.25));
+	scene->set_background(Color(0.5, 0.6, 0.8));
+
+	TargetCamera *cam = new TargetCamera;
+	cam->set_aspect(640.0 / 360.0);
+	cam->set_clipping_planes(1.0, size * 2.0);
+	scene->add_camera(cam);
+	scene->set_active_camera(cam);
+
+	SoftRaster *swr = get_soft_context();
+	swr->reset_stats();
+
+	unsigned long selected = 0, culled = 0, built = 0, morphed = 0, tris = 0;
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int i=0; i<FRAMES; i++) {
+		scalar_t t = (scalar_t)i / (scalar_t)FRAMES;
+		Vector3 pos = flight_pos(terrain, t);
+		Vector3 ahead = flight_pos(terrain, t + 0.02);
+
+		cam->set_position(pos);
+		cam->set_target(Vector3(ahead.x, pos.y - size * 0.005, ahead.z));
+		scene->render(i * 40);
+		flip();
+
+		const TerrainStats *stats = terrain->get_stats();
+		selected += stats->selected;
+		culled += stats->culled;
+		built += stats->built;
+		morphed += stats->morphed;
+		tris += stats->triangles;
+	}
+	unsigned long msec = timer_getmsec(&timer);
+
+	char fname[] = "terrain_check.tga";
+	screen_capture(fname);
+
+	printf("\nflight of %d frames, per frame:\n", FRAMES);
+	printf("%10s %10s %10s %10s %12s %12s %10s\n", "chunks", "culled", "built", "morphed",
+			"triangles", "rasterized", "msec");
+	printf("%10lu %10lu %10lu %10lu %12lu %12lu %10lu\n", selected / FRAMES, culled / FRAMES,
+			built / FRAMES, morphed / FRAMES, tris / FRAMES, swr->get_stats()->triangles / FRAMES, msec / FRAMES);
+	printf("the full resolution mesh has %lu triangles, %lu chunks cached\n",
+			2UL * (size - 1) * (size - 1), (unsigned long)terrain->get_stats()->cached);
+
+	// the chunk edges, selected without culling from a few points of the flight
+	scalar_t gap = 0.0;
+	unsigned long checked = 0;
+	for(int i=0; i<4; i++) {
+		vector<Object*> objs;
+		unsigned long count;
+		terrain->select(flight_pos(terrain, i * 0.25 + 0.1), 0, &objs);
+		gap = max(gap, max_seam_gap(objs, &count));
+		checked += count;
+	}
+	printf("largest gap along %lu chunk edge vertices: %g\n", checked, gap);
+
+	delete scene;
+	destroy_graphics_context();
+
+	if(!identical || gap > 1e-3 * size / 16) return 1;
+	printf("all heightfields identical, the last frame is saved as terrain_check.tga\n");
+	return 0;
+}
+BENCH_CHECK(terrain, check_terrain);
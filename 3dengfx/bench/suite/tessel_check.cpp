@@ -0,0 +1,321 @@
+/*
+ * bench_suite --check=tessel
+ * Tessellates the teapot patches with create_bezier_mesh and with the loop
+ * over BezierSplines it used to run, reporting the times and the largest
+ * differences of the vertices. Then it tessellates them at the given level
+ * once for each number of worker threads up to the given maximum, checking
+ * that all the runs produced the same mesh. It picks the levels for a view
+ * of the teapot at a few distances, reporting the triangles against the
+ * uniform tessellation, and checks the adaptive meshes for cracks: the
+ * length of the open edges after welding the vertices by position must be
+ * the length of the boundary of the teapot, as in the uniform meshes, and
+ * no triangle may face against its vertex normals (at level 1 the patches
+ * are too coarse for that). At last it moves the view in and out over a
+ * number of frames, tessellating through a TessCache and without it, and
+ * reports the patches tessellated per frame and the times.
+ *
+ * usage: bench_suite --check=tessel [level] [max threads]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "3dengfx/3dengfx.hpp"
+#include "gfx/tessel.hpp"
+#include "common/threads.h"
+#include "common/timer.h"
+
+#define GGEN_SOURCE
+#include "3dengfx/teapot.h"
+#include "bench.hpp"
+
+using namespace std;
+
+#define FRAMES		60
+#define PIXEL_ERROR	0.5
+
+// create_bezier_patch before it used PatchSet
+static void old_bezier_patch(TriMesh *mesh, const Vector3 *cp, int subdiv) {
+	BezierSpline u[4], v[4];
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			u[i].add_control_point(cp[i * 4 + j]);
+			v[i].add_control_point(cp[j * 4 + i]);
+		}
+	}
+
+	unsigned long edges = subdiv * 2;
+	unsigned long vrow = edges + 1;
+	unsigned long qcount = edges * edges;
+	Vertex *varray = new Vertex[vrow * vrow];
+	Triangle *tarray = new Triangle[qcount * 2];
+
+	for(unsigned long j=0; j<vrow; j++) {
+		scalar_t tv = (scalar_t)j / (scalar_t)(vrow - 1);
+		BezierSpline uc;
+		for(int k=0; k<4; k++) uc.add_control_point(v[k].interpolate(tv));
+
+		for(unsigned long i=0; i<vrow; i++) {
+			scalar_t tu = (scalar_t)i / (scalar_t)(vrow - 1);
+			BezierSpline vc;
+			for(int k=0; k<4; k++) vc.add_control_point(u[k].interpolate(tu));
+
+			varray[i + j * vrow] = Vertex(uc.interpolate(tu), tu, 1.0 - tv, Color(1.0f));
+			varray[i + j * vrow].normal = cross_product(uc.get_tangent(tu), vc.get_tangent(tv)).normalized();
+		}
+	}
+
+	for(unsigned long i=0; i<qcount; i++) {
+		Index v0 = i + i / edges;
+		Index v1 = v0 + 1, v2 = v0 + vrow, v3 = v1 + vrow;
+		tarray[i * 2] = Triangle(v0, v1, v3);
+		tarray[i * 2 + 1] = Triangle(v0, v3, v2);
+	}
+	mesh->adopt_data(varray, vrow * vrow, tarray, qcount * 2);
+}
+
+static void old_bezier_mesh(TriMesh *mesh, const Vector3 *cp, const unsigned int *patches, int patch_count, int subdiv) {
+	TriMesh tmp_mesh;
+	Vector3 control_pts[16];
+	for(int i=0; i<patch_count; i++) {
+		for(int j=0; j<16; j++) {
+			control_pts[j] = cp[patches[16 * i + j]];
+		}
+		old_bezier_patch(&tmp_mesh, control_pts, subdiv);
+		join_tri_mesh(mesh, mesh, &tmp_mesh);
+	}
+}
+
+// the teapot control points and patches, as create_teapot sets them up
+static void teapot_data(vector<Vector3> *cp, vector<unsigned int> *patches) {
+	patches->resize(teapot_num_patches * 16);
+	for(int p=0; p<teapot_num_patches; p++) {
+		for(int j=0; j<4; j++) {
+			for(int i=0; i<4; i++) {
+				(*patches)[p * 16 + j * 4 + (3 - i)] = teapot_patches[p * 16 + j * 4 + i] - 1;
+			}
+		}
+	}
+
+	cp->resize(teapot_num_vertices);
+	for(int i=0; i<teapot_num_vertices; i++) {
+		(*cp)[i] = Vector3(teapot_vertices[i * 3], teapot_vertices[i * 3 + 2], teapot_vertices[i * 3 + 1]);
+	}
+}
+
+struct PosLess {
+	bool operator ()(const Vector3 &a, const Vector3 &b) const {
+		if(a.x != b.x) return a.x < b.x;
+		if(a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	}
+};
+
+/* welds the vertices by position and returns the length of the edges with
+ * a triangle only on one side. Also counts the triangles facing against
+ * their vertex normals.
+ */
+static scalar_t open_length(const TriMesh *mesh, int *flipped) {
+	const Vertex *va = mesh->get_vertex_array()->get_data();
+	const Triangle *ta = mesh->get_triangle_array()->get_data();
+	unsigned long vcount = mesh->get_vertex_array()->get_count();
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	map<Vector3, Index, PosLess> welded;
+	vector<Index> remap(vcount);
+	for(unsigned long i=0; i<vcount; i++) {
+		map<Vector3, Index, PosLess>::iterator iter = welded.find(va[i].pos);
+		if(iter == welded.end()) {
+			remap[i] = i;
+			welded[va[i].pos] = i;
+		} else {
+			remap[i] = iter->second;
+		}
+	}
+
+	map<pair<Index, Index>, int> edges;
+	*flipped = 0;
+	for(unsigned long i=0; i<tcount; i++) {
+		const Index *v = ta[i].vertices;
+		for(int j=0; j<3; j++) {
+			Index a = remap[v[j]], b = remap[v[(j + 1) % 3]];
+			if(a == b) continue;
+			edges[make_pair(min(a, b), max(a, b))]++;
+		}
+
+		Vector3 n = cross_product(va[v[1]].pos - va[v[0]].pos, va[v[2]].pos - va[v[0]].pos);
+		Vector3 vn = va[v[0]].normal + va[v[1]].normal + va[v[2]].normal;
+		if(n.length() > 1e-6 && dot_product(n, vn) < 0.0) (*flipped)++;
+	}
+
+	scalar_t len = 0.0;
+	for(map<pair<Index, Index>, int>::iterator iter = edges.begin(); iter != edges.end(); iter++) {
+		if(iter->second == 1) {
+			len += (va[iter->first.first].pos - va[iter->first.second].pos).length();
+		}
+	}
+	return len;
+}
+
+static unsigned long tri_count(const TriMesh *mesh) {
+	return mesh->get_triangle_array()->get_count();
+}
+
+static int check_tessel(int argc, char **argv) {
+	int level = 64, max_threads = 8;
+
+	if(argc > 1) level = atoi(argv[1]);
+	if(argc > 2) max_threads = atoi(argv[2]);
+	if(level < 1 || level > TESS_MAX_LEVEL || max_threads < 1) {
+		fprintf(stderr, "usage: %s [level (1 - %d)] [max threads]\n", argv[0], TESS_MAX_LEVEL);
+		return 1;
+	}
+
+	vector<Vector3> cp;
+	vector<unsigned int> patches;
+	teapot_data(&cp, &patches);
+
+	PatchSet pset;
+	pset.set_data(&cp[0], cp.size(), &patches[0], teapot_num_patches);
+	printf("teapot, %d patches, %d edges\n", pset.get_patch_count(), pset.get_edge_count());
+
+	// create_bezier_mesh against the old loop
+	printf("\n%8s %10s %12s %12s %12s %12s\n", "subdiv", "triangles", "msec", "old msec", "max diff", "normal dot");
+	for(int subdiv=2; subdiv<=16; subdiv*=2) {
+		TriMesh mesh, old_mesh;
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+		create_bezier_mesh(&mesh, &cp[0], &patches[0], teapot_num_patches, subdiv);
+		unsigned long msec = timer_getmsec(&timer);
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		old_bezier_mesh(&old_mesh, &cp[0], &patches[0], teapot_num_patches, subdiv);
+		unsigned long old_msec = timer_getmsec(&timer);
+
+		const Vertex *va = mesh.get_vertex_array()->get_data(), *vb = old_mesh.get_vertex_array()->get_data();
+		scalar_t max_diff = 0.0, min_dot = 1.0;
+		bool same_tris = tri_count(&mesh) == tri_count(&old_mesh);
+		for(unsigned long i=0; i<mesh.get_vertex_array()->get_count(); i++) {
+			max_diff = max(max_diff, (va[i].pos - vb[i].pos).length());
+			max_diff = max(max_diff, (scalar_t)fabs(va[i].tex[0].u - vb[i].tex[0].u));
+			max_diff = max(max_diff, (scalar_t)fabs(va[i].tex[0].v - vb[i].tex[0].v));
+			if(vb[i].normal.length_sq() > 0.5) min_dot = min(min_dot, dot_product(va[i].normal, vb[i].normal));
+		}
+		const Triangle *ta = mesh.get_triangle_array()->get_data(), *tb = old_mesh.get_triangle_array()->get_data();
+		for(unsigned long i=0; same_tris && i<tri_count(&mesh); i++) {
+			same_tris = !memcmp(ta[i].vertices, tb[i].vertices, sizeof ta[i].vertices);
+		}
+
+		printf("%8d %10lu %12lu %12lu %12g %12.4f%s\n", subdiv, tri_count(&mesh), msec, old_msec,
+				max_diff, min_dot, same_tris ? "" : "  (different triangles)");
+		if(!same_tris || max_diff > 1e-4) return 1;
+	}
+
+	// thread scaling
+	TriMesh first;
+	bool identical = true;
+	printf("\nuniform level %d\n%8s %10s %10s\n", level, "threads", "triangles", "msec");
+	for(int threads=1; threads<=max_threads; threads*=2) {
+		thr_set_num_workers(threads);
+
+		TriMesh mesh;
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+		tessellate_patches(&pset, uniform_tess_params(level), threads == 1 ? &first : &mesh);
+		printf("%8d %10lu %10lu\n", threads, tri_count(&first), timer_getmsec(&timer));
+
+		if(threads > 1) {
+			unsigned long vcount = first.get_vertex_array()->get_count();
+			if(mesh.get_vertex_array()->get_count() != vcount ||
+					memcmp(mesh.get_vertex_array()->get_data(), first.get_vertex_array()->get_data(), vcount * sizeof(Vertex))) {
+				identical = false;
+			}
+		}
+	}
+	thr_set_num_workers(0);
+	if(!identical) {
+		fprintf(stderr, "the meshes differ between the runs\n");
+		return 1;
+	}
+
+	// the levels for a 640x360 view, 45 degrees vertical field of view
+	TessParams params;
+	params.use_view = true;
+	params.max_error = PIXEL_ERROR;
+	params.pixels_per_unit = 360.0 / (2.0 * tan(quarter_pi / 2.0));
+	params.max_level = level;
+
+	int uni_flipped;
+	scalar_t uni_open = open_length(&first, &uni_flipped);
+	printf("\nadaptive, %g pixels of error\n", PIXEL_ERROR);
+	printf("%10s %10s %10s %12s %10s\n", "distance", "triangles", "uniform", "open length", "flipped");
+	printf("%10s %10s %10lu %12.4f %10d\n", "-", "-", tri_count(&first), uni_open, uni_flipped);
+
+	bool cracks = false, folds = false;
+	for(scalar_t dist=2.0; dist<=256.0; dist*=4.0) {
+		params.view_pos = Vector3(dist * 0.6, dist * 0.5, -dist * 0.8);
+		TriMesh mesh;
+		tessellate_patches(&pset, params, &mesh);
+
+		int flipped;
+		scalar_t open = open_length(&mesh, &flipped);
+		printf("%10g %10lu %10lu %12.4f %10d\n", dist, tri_count(&mesh), tri_count(&first), open, flipped);
+
+		// the boundary gets shorter with fewer segments along it, but no longer
+		if(open > uni_open * 1.001) cracks = true;
+		if(flipped) folds = true;
+	}
+	if(cracks) {
+		fprintf(stderr, "cracks in the adaptive meshes\n");
+		return 1;
+	}
+	if(folds) {
+		fprintf(stderr, "triangles folding against the surface in the adaptive meshes\n");
+		return 1;
+	}
+
+	// a view moving in and out, with the cache and without it
+	TessCache cache;
+	unsigned long cache_msec = 0, plain_msec = 0;
+	for(int i=0; i<FRAMES; i++) {
+		scalar_t t = (scalar_t)i / (scalar_t)FRAMES;
+		scalar_t dist = 3.0 + 30.0 * (0.5 - 0.5 * cos(t * two_pi));
+		params.view_pos = Vector3(sin(t * two_pi) * dist, dist * 0.5, cos(t * two_pi) * dist);
+
+		TriMesh mesh, plain;
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+		cache.begin_frame();
+		cache.request(&pset, params, &mesh);
+		cache.update();
+		cache_msec += timer_getmsec(&timer);
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		tessellate_patches(&pset, params, &plain);
+		plain_msec += timer_getmsec(&timer);
+
+		unsigned long vcount = plain.get_vertex_array()->get_count();
+		if(mesh.get_vertex_array()->get_count() != vcount ||
+				memcmp(mesh.get_vertex_array()->get_data(), plain.get_vertex_array()->get_data(), vcount * sizeof(Vertex))) {
+			fprintf(stderr, "the cached mesh differs in frame %d\n", i);
+			return 1;
+		}
+	}
+
+	printf("\n%d frames moving in and out, per frame:\n", FRAMES);
+	printf("%12s %12s %12s %12s\n", "tessellated", "of patches", "msec", "uncached");
+	printf("%12.2f %12d %12.2f %12.2f\n", (double)cache.get_tessellated_count() / FRAMES, pset.get_patch_count(),
+			(double)cache_msec / FRAMES, (double)plain_msec / FRAMES);
+	printf("%lu patches cached\n", cache.get_count());
+	return 0;
+}
+BENCH_CHECK(tessel, check_tessel);
@@ -0,0 +1,315 @@
+/*
+ * bench_suite --check=text
+ * Checks the glyph atlas without a graphics context. First with made up
+ * glyphs of random sizes, drawn from several sources into a small atlas
+ * over and over: after every string the glyphs in the atlas must not
+ * overlap, and the quads of the string must show its own glyphs. Then with
+ * a truetype font, it lays out a HUD of changing numbers for a number of
+ * frames at a few sizes, reporting the glyphs rasterized and evicted and
+ * the layout time, against the textures get_text would create for the same
+ * strings. It also reports the kerning of a few pairs of the font. The
+ * font part is left out when the tree is built without freetype
+ * (--disable-ft).
+ *
+ * usage: bench_suite --check=text [font file] [frames]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "3dengfx_config.h"
+
+#ifndef FXWT_NO_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif	// FXWT_NO_FREETYPE
+
+#include "fxwt/glyph_atlas.hpp"
+#include "common/timer.h"
+#include "bench.hpp"
+
+using namespace std;
+using namespace fxwt;
+
+#define TEST_ROUNDS		5000
+#define TEST_SOURCES	8
+
+// glyphs of a size picked from the code, filled with a pattern of the source and code
+class TestSource : public GlyphSource {
+private:
+	unsigned int id;
+	int size;
+	vector<unsigned char> buf;
+
+public:
+	TestSource(unsigned int id, int size) : id(id), size(size) {}
+
+	static unsigned char pattern(unsigned int id, unsigned int code, int x, int y) {
+		return (unsigned char)(1 + (id * 31 + code * 7 + x * 3 + y * 5) % 255);
+	}
+
+	unsigned int get_id() const {return id;}
+
+	bool render_glyph(unsigned int code, GlyphBitmap *bmp) {
+		unsigned int h = code * 2654435761U + id;
+		bmp->width = code == ' ' ? 0 : size / 4 + (h >> 8) % size;
+		bmp->height = code == ' ' ? 0 : size / 2 + (h >> 16) % (size / 2 + 1);
+		bmp->pitch = bmp->width + 3;
+		bmp->left = (int)(h % 3) - 1;
+		bmp->top = bmp->height - (int)(h >> 24) % 4;
+		bmp->advance = (bmp->width + 2) * 64;
+
+		buf.assign(bmp->pitch * bmp->height, 0);
+		for(int y=0; y<bmp->height; y++) {
+			for(int x=0; x<bmp->width; x++) {
+				buf[y * bmp->pitch + x] = pattern(id, code, x, y);
+			}
+		}
+		bmp->pixels = buf.empty() ? 0 : &buf[0];
+		return true;
+	}
+
+	int get_kerning(unsigned int left, unsigned int right) {
+		return (left == 'A' && right == 'V') ? -3 * 64 : 0;
+	}
+
+	int get_ascent() const {return size;}
+	int get_line_height() const {return size * 3 / 2;}
+};
+
+// no two glyph slots overlap, and all of them are within the atlas
+static bool check_overlaps(const GlyphAtlas &atlas, const vector<const AtlasGlyph*> &glyphs) {
+	vector<unsigned char> used(atlas.get_width() * atlas.get_height(), 0);
+	for(size_t i=0; i<glyphs.size(); i++) {
+		const AtlasGlyph *g = glyphs[i];
+		if(g->x < 0 || g->y < 0 || g->x + g->width > atlas.get_width() || g->y + g->height > atlas.get_height()) {
+			return false;
+		}
+		for(int y=0; y<g->height; y++) {
+			for(int x=0; x<g->width; x++) {
+				unsigned char *u = &used[(g->y + y) * atlas.get_width() + g->x + x];
+				if(*u) return false;
+				*u = 1;
+			}
+		}
+	}
+	return true;
+}
+
+// the pixels under a quad are the glyph of the code
+static bool check_quad(const GlyphAtlas &atlas, const GlyphQuad &q, unsigned int id, unsigned int code) {
+	int x0 = (int)(q.u0 * atlas.get_width() + 0.5f);
+	int y0 = (int)((1.0f - q.v0) * atlas.get_height() + 0.5f);
+	int w = (int)(q.x1 - q.x0), h = (int)(q.y1 - q.y0);
+
+	const unsigned char *pix = atlas.get_pixels();
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			if(pix[(y0 + y) * atlas.get_width() + x0 + x] != TestSource::pattern(id, code, x, y)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool test_atlas() {
+	GlyphAtlas atlas(256, 256);
+	TestSource *src[TEST_SOURCES];
+	for(int i=0; i<TEST_SOURCES; i++) {
+		src[i] = new TestSource(i, 8 + i * 4);
+	}
+
+	srand(1);
+	bool ok = true;
+	for(int r=0; r<TEST_ROUNDS && ok; r++) {
+		// a string of random characters from a random source
+		char str[24];
+		int len = 1 + rand() % 16;
+		for(int i=0; i<len; i++) {
+			str[i] = (rand() % 8) ? 'A' + rand() % 58 : ' ';
+		}
+		str[len] = 0;
+		unsigned int id = rand() % TEST_SOURCES;
+
+		vector<GlyphQuad> quads;
+		layout_text(&atlas, src[id], str, &quads);
+
+		// every glyph of the string with a bitmap has its quad, in order
+		size_t q = 0;
+		for(int i=0; i<len && ok; i++) {
+			if(str[i] == ' ') continue;
+			if(q >= quads.size() || !check_quad(atlas, quads[q++], id, (unsigned char)str[i])) {
+				fprintf(stderr, "round %d: wrong glyph %c in \"%s\"\n", r, str[i], str);
+				ok = false;
+			}
+		}
+
+		/* every so often, all the glyphs of all the sources. Those fetched here
+		 * are in one batch, so they can't evict each other.
+		 */
+		if(r % 100 == 99) {
+			atlas.begin_batch();
+			vector<const AtlasGlyph*> glyphs;
+			for(int s=0; s<TEST_SOURCES; s++) {
+				for(unsigned int c='A'; c<'A' + 58; c++) {
+					const AtlasGlyph *g = atlas.get_glyph(src[s], c);
+					if(g && g->shelf != -1) glyphs.push_back(g);
+				}
+			}
+			if(ok && !check_overlaps(atlas, glyphs)) {
+				fprintf(stderr, "round %d: overlapping glyphs\n", r);
+				ok = false;
+			}
+		}
+	}
+
+	printf("made up glyphs, %d sources in a 256x256 atlas, %d strings\n", TEST_SOURCES, TEST_ROUNDS);
+	printf("%lu rasterized, %lu evicted, %lu in the atlas in %lu shelves: %s\n", atlas.get_rasterized_count(),
+			atlas.get_evicted_count(), atlas.get_glyph_count(), atlas.get_shelf_count(), ok ? "ok" : "FAILED");
+
+	// kerning, V follows A by the advance of A minus 3 pixels
+	vector<GlyphQuad> av, v;
+	int av_width = layout_text(&atlas, src[0], "AV", &av);
+	layout_text(&atlas, src[0], "V", &v);
+	const AtlasGlyph *ga = atlas.get_glyph(src[0], 'A');
+	bool kerned = av[1].x0 - v[0].x0 == (float)((ga->advance - 3 * 64 + 32) >> 6);
+	printf("\"AV\" is %d pixels wide, kerned by -3: %s\n", av_width, kerned ? "ok" : "FAILED");
+
+	for(int i=0; i<TEST_SOURCES; i++) {
+		delete src[i];
+	}
+	return ok && kerned;
+}
+
+#ifndef FXWT_NO_FREETYPE
+class FontSource : public GlyphSource {
+private:
+	FT_Face face;
+	int size;
+	unsigned int id;
+
+public:
+	FontSource(FT_Face face, int size, unsigned int id) : face(face), size(size), id(id) {}
+
+	unsigned int get_id() const {return id;}
+
+	bool render_glyph(unsigned int code, GlyphBitmap *bmp) {
+		FT_Set_Pixel_Sizes(face, 0, size);
+		if(FT_Load_Char(face, code, FT_LOAD_RENDER) != 0) return false;
+
+		FT_GlyphSlot slot = face->glyph;
+		bmp->width = slot->bitmap.width;
+		bmp->height = slot->bitmap.rows;
+		bmp->pitch = slot->bitmap.pitch;
+		bmp->pixels = slot->bitmap.buffer;
+		bmp->left = slot->bitmap_left;
+		bmp->top = slot->bitmap_top;
+		bmp->advance = slot->advance.x;
+		return true;
+	}
+
+	int get_kerning(unsigned int left, unsigned int right) {
+		if(!FT_HAS_KERNING(face)) return 0;
+
+		FT_Vector delta;
+		FT_Set_Pixel_Sizes(face, 0, size);
+		FT_Get_Kerning(face, FT_Get_Char_Index(face, left), FT_Get_Char_Index(face, right), FT_KERNING_DEFAULT, &delta);
+		return delta.x;
+	}
+
+	int get_ascent() const {return size;}
+	int get_line_height() const {return size * 3 / 2;}
+};
+
+static int next_pow_two(int num) {
+	int val = 1;
+	while(val < num) val <<= 1;
+	return val;
+}
+
+static void test_font(const char *fname, int frames) {
+	FT_Library ft;
+	FT_Face face;
+	if(FT_Init_FreeType(&ft) != 0 || FT_New_Face(ft, fname, 0, &face) != 0) {
+		printf("\ncan't load %s, skipping the font tests\n", fname);
+		return;
+	}
+
+	static const int sizes[] = {16, 32, 64};
+	FontSource *src[3];
+	for(int i=0; i<3; i++) {
+		src[i] = new FontSource(face, sizes[i], i);
+	}
+
+	printf("\n%s (%s), kerning: %s\n", fname, face->family_name, FT_HAS_KERNING(face) ? "yes" : "no");
+	static const char *pairs[] = {"AV", "To", "Ye", "LT", 0};
+	for(int i=0; pairs[i]; i++) {
+		printf("  %s %+.2f px at 64 px\n", pairs[i], src[2]->get_kerning(pairs[i][0], pairs[i][1]) / 64.0);
+	}
+
+	// the HUD, three lines at each size
+	GlyphAtlas atlas(512, 512);
+	vector<GlyphQuad> quads;
+	unsigned long quad_count = 0, old_textures = 0, old_bytes = 0;
+
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+	for(int f=0; f<frames; f++) {
+		char lines[3][128];
+		unsigned long msec = f * 16 + f % 3;
+		sprintf(lines[0], "%02lu:%02lu.%03lu  frame %d", msec / 60000, msec / 1000 % 60, msec % 1000, f);
+		sprintf(lines[1], "fps %.1f", 60.0 + (f % 37) * 0.27);
+		sprintf(lines[2], "pos %.3f %.3f %.3f", f * 0.013, 2.0 - f * 0.0071, f * -0.029);
+
+		for(int s=0; s<3; s++) {
+			for(int l=0; l<3; l++) {
+				quads.clear();
+				int width = layout_text(&atlas, src[s], lines[l], &quads);
+				quad_count += quads.size();
+
+				// get_text would make a power of two texture of every one of them
+				old_textures++;
+				old_bytes += next_pow_two(width) * next_pow_two(src[s]->get_line_height()) * 4;
+			}
+		}
+		atlas.clear_dirty();
+	}
+	unsigned long msec = timer_getmsec(&timer);
+
+	printf("\n%d frames of a HUD, 3 lines at %d, %d and %d pixels\n", frames, sizes[0], sizes[1], sizes[2]);
+	printf("atlas: %lu glyphs rasterized, %lu evicted, %lu quads, %d KB, %.3f msec per frame\n",
+			atlas.get_rasterized_count(), atlas.get_evicted_count(), quad_count,
+			atlas.get_width() * atlas.get_height() * 4 / 1024, (double)msec / frames);
+	printf("get_text: %lu textures, %lu KB, never freed\n", old_textures, old_bytes / 1024);
+
+	for(int i=0; i<3; i++) {
+		delete src[i];
+	}
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+}
+#else
+static void test_font(const char *fname, int frames) {
+	printf("\nbuilt without freetype, skipping the font tests\n");
+}
+#endif	// FXWT_NO_FREETYPE
+
+static int check_text(int argc, char **argv) {
+	const char *font = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf";
+	int frames = 1000;
+
+	if(argc > 1) font = argv[1];
+	if(argc > 2) frames = atoi(argv[2]);
+	if(frames < 1) {
+		fprintf(stderr, "usage: %s [font file] [frames]\n", argv[0]);
+		return 1;
+	}
+
+	bool ok = test_atlas();
+	test_font(font, frames);
+	return ok ? 0 : 1;
+}
+BENCH_CHECK(text, check_text);
@@ -52,6 +52,12 @@
 #define FT_LIBS		""
 #endif	/* freetype */
 
+#if !defined(NO_THREADS) && (defined(unix) || defined(__unix__))
+#define LD_THREADS	"-lpthread"
+#else
+#define LD_THREADS	""
+#endif	/* threads */
+
 void print_cflags(void);
 void print_libs(void);
 void print_libs_no_3dengfx(void);
@@ -123,7 +129,7 @@ void print_libs_no_3dengfx(void) {
 	FILE *p;
 	int c;
 		
-	printf("-lGL %s %s ", LD_JPEG, LD_PNG);
+	printf("-lGL %s %s %s ", LD_JPEG, LD_PNG, LD_THREADS);
 
 	if((p = popen(GFX_LIBS, "r"))) {
 		while((c = fgetc(p)) != -1) {
@@ -33,6 +33,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "sdrman.hpp"
 #include "psys.hpp"
 #include "scfield.hpp"
+#include "terrain.hpp"
 #include "fxwt/fxwt.hpp"
 #include "common/timer.h"
 #include "common/locator.h"
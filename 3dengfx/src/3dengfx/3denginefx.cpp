@@ -41,7 +41,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "gfx/image.h"
 #include "common/config_parser.h"
 #include "common/err_msg.h"
+#include "common/arena.h"
+#include "common/profile.h"
+#include "common/threads.h"
 #include "dsys/dsys.hpp"
+#include "swrast.hpp"
 
 using std::cout;
 using std::cerr;
@@ -133,12 +137,14 @@ static const char *gl_error_string[] = {
 static bool gc_valid;
 static GraphicsInitParameters gparams;
 static Matrix4x4 tex_matrix[8];
+static bool tex_matrix_dirty[8] = {true, true, true, true, true, true, true, true};
 static int coord_index[MAX_TEXTURES];
 static PrimitiveType primitive_type;
 static StencilOp stencil_fail, stencil_pass, stencil_pzfail;
 static int stencil_ref;
 static bool mipmapping = true;
 static TextureDim ttype[8];	// the type of each texture bound to each texunit (1D/2D/3D/CUBE)
+static SoftRaster *swr;		// the software rasterizer, when rendering without GL
 
 namespace engfx_state {
 	SysCaps sys_caps;
@@ -238,17 +244,25 @@ GraphicsInitParameters *load_graphics_context_config(const char *fname) {
 SysCaps get_system_capabilities() {
 	static bool first_call = true;
 	
-	if(!first_call) {
+	if(!first_call || swr) {
 		return sys_caps;
 	}
-	first_call = false;
 	
 	// get extensions & vendor strings
 	const char *tmp_str = (const char*)glGetString(GL_EXTENSIONS);
 	if(!tmp_str) {
-		error("%s: glGetString() failed, possibly no valid GL context", __func__);
-		exit(-1);
+		/* without a context (yet) report no capabilities, and ask again
+		 * next time. Lets geometry be created and rendered to a null
+		 * backend (see rstate.hpp) without a window.
+		 */
+		static bool warned;
+		if(!warned) {
+			warning("%s: glGetString() failed, no valid GL context", __func__);
+			warned = true;
+		}
+		return sys_caps;
 	}
+	first_call = false;
 	char *ext_str = new char[strlen(tmp_str) + 1];
 	strcpy(ext_str, tmp_str);
 	
@@ -278,6 +292,7 @@ SysCaps get_system_capabilities() {
 	sys_caps.bump_dot3 = (bool)strstr(ext_str, "GL_ARB_texture_env_dot3");
 	sys_caps.bump_env = (bool)strstr(ext_str, "GL_ATI_envmap_bumpmap");
 	sys_caps.vertex_buffers = (bool)strstr(ext_str, "GL_ARB_vertex_buffer_object");
+	sys_caps.pixel_buffers = sys_caps.vertex_buffers && strstr(ext_str, "GL_ARB_pixel_buffer_object");
 	sys_caps.depth_texture = (bool)strstr(ext_str, "GL_ARB_depth_texture");
 	sys_caps.shadow_mapping = (bool)strstr(ext_str, "GL_ARB_shadow");
 	sys_caps.point_sprites = (bool)strstr(ext_str, "GL_ARB_point_sprite");
@@ -305,6 +320,7 @@ SysCaps get_system_capabilities() {
 	info("Diffuse bump mapping (dot3): %s", sys_caps.bump_dot3 ? "yes" : "no");
 	info("Specular bump mapping (env-bump): %s", sys_caps.bump_env ? "yes" : "no");
 	info("Video memory vertex/index buffers: %s", sys_caps.vertex_buffers ? "yes" : "no");
+	info("Pixel buffers (asynchronous readback): %s", sys_caps.pixel_buffers ? "yes" : "no");
 	info("Depth texture: %s", sys_caps.depth_texture ? "yes" : "no");
 	info("Shadow mapping: %s", sys_caps.shadow_mapping ? "yes" : "no");
 	info("Programmable vertex processing (asm): %s", sys_caps.prog.asm_vertex ? "yes" : "no");
@@ -429,6 +445,10 @@ bool create_graphics_context(int x, int y, bool fullscreen)
 
 /* OpenGL startup after initialization */
 bool start_gl() {
+	if(!glGetString(GL_EXTENSIONS)) {
+		error("%s: glGetString() failed, possibly no valid GL context", __func__);
+		return false;
+	}
 	SysCaps sys_caps = get_system_capabilities();
 
 	glext::glActiveTexture = (PFNGLACTIVETEXTUREARBPROC)glGetProcAddress("glActiveTextureARB");
@@ -514,6 +534,47 @@ bool start_gl() {
 	return true;
 }
 
+/* create_soft_context
+ * sets up the engine to render with the software rasterizer, into a
+ * frame buffer of the given size. The capabilities reported are what
+ * it supports, so the rest of the engine picks the matching paths.
+ */
+bool create_soft_context(int x, int y) {
+	if(gc_valid) {
+		error("%s: a graphics context already exists", __func__);
+		return false;
+	}
+
+	gparams.x = x;
+	gparams.y = y;
+	gparams.bpp = 32;
+	gparams.depth_bits = 32;
+	gparams.stencil_bits = 8;
+	gparams.fullscreen = false;
+	gparams.dont_care_flags = 0;
+
+	memset(&sys_caps, 0, sizeof sys_caps);
+	sys_caps.multitex = true;
+	sys_caps.tex_combine_ops = true;
+	sys_caps.bump_dot3 = true;
+	sys_caps.max_texture_units = SWR_TEX_UNITS;
+	sys_caps.non_power_of_two_textures = true;
+	sys_caps.max_lights = SWR_MAX_LIGHTS;
+
+	info("software rendering context: %dx%d, %d threads", x, y, thr_get_num_workers());
+
+	swr = new SoftRaster(x, y);
+	gc_valid = true;
+
+	set_default_states();
+	dsys::init();
+	return true;
+}
+
+SoftRaster *get_soft_context() {
+	return swr;
+}
+
 void destroy_graphics_context() {
 	dsys::clean_up();
 	if(!gc_valid) return;
@@ -521,7 +582,12 @@ void destroy_graphics_context() {
 	info("3d engine shutting down...");
 	destroy_textures();
 	destroy_shaders();
-	fxwt::destroy_graphics();
+	if(swr) {
+		delete swr;
+		swr = 0;
+	} else {
+		fxwt::destroy_graphics();
+	}
 }
 
 void set_default_states() {
@@ -532,8 +598,11 @@ void set_default_states() {
 	set_lighting(true);
 	set_auto_normalize(false);
 	
-	glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, 1);
-	glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+	if(!swr) {
+		// the software rasterizer always works this way
+		glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, 1);
+		glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+	}
 	
 	set_matrix(XFORM_WORLD, Matrix4x4());
 	set_matrix(XFORM_VIEW, Matrix4x4());
@@ -544,6 +613,7 @@ void set_default_states() {
 	for(int i=0; i<8; i++) {
 		ttype[i] = TEX_2D;
 	}
+	invalidate_xform_matrices();
 
 	if(sys_caps.point_params) {
 		glext::glPointParameterf(GL_POINT_SIZE_MIN_ARB, 1.0);
@@ -559,37 +629,68 @@ const GraphicsInitParameters *get_graphics_init_parameters() {
 }
 
 void clear(const Color &color) {
+	if(swr) {
+		swr->clear(SWR_COLOR_BUFFER, color, 0, 0);
+		return;
+	}
 	glClearColor(color.r, color.g, color.b, color.a);
 	glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void clear_zbuffer(scalar_t zval) {
+	if(swr) {
+		swr->clear(SWR_DEPTH_BUFFER, Color(0.0), zval, 0);
+		return;
+	}
 	glClearDepth(zval);
 	glClear(GL_DEPTH_BUFFER_BIT);
 }
 
 void clear_stencil(unsigned char sval) {
+	if(swr) {
+		swr->clear(SWR_STENCIL_BUFFER, Color(0.0), 0, sval);
+		return;
+	}
 	glClearStencil(sval);
 	glClear(GL_STENCIL_BUFFER_BIT);
 }
 
 void clear_zbuffer_stencil(scalar_t zval, unsigned char sval) {
+	if(swr) {
+		swr->clear(SWR_DEPTH_BUFFER | SWR_STENCIL_BUFFER, Color(0.0), zval, sval);
+		return;
+	}
 	glClearDepth(zval);
 	glClearStencil(sval);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 }
 
 void flip() {
-	glFlush();
-	glFinish();
-	fxwt::swap_buffers();
+	if(swr) {
+		swr->flush();
+	} else {
+		glFlush();
+		glFinish();
+		fxwt::swap_buffers();
+	}
+
+	PROF_FRAME();
+	frame_reset();
 }
 
+/* load_xform_matrices
+ * texture matrices rarely change between draws, so only the ones
+ * changed through set_matrix() since the last call are reloaded.
+ */
 void load_xform_matrices() {
+	if(swr) return;	// it takes the matrices with every draw
+
 	for(int i=0; i<sys_caps.max_texture_units; i++) {
+		if(!tex_matrix_dirty[i]) continue;
 		select_texture_unit(i);
 		glMatrixMode(GL_TEXTURE);
 		load_matrix_gl(tex_matrix[i]);
+		tex_matrix_dirty[i] = false;
 	}
 	
 	glMatrixMode(GL_PROJECTION);
@@ -600,11 +701,15 @@ void load_xform_matrices() {
 	load_matrix_gl(modelview);
 }
 
-#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+void invalidate_xform_matrices() {
+	for(int i=0; i<8; i++) {
+		tex_matrix_dirty[i] = true;
+	}
+}
 
-void draw(const VertexArray &varray) {
-	load_xform_matrices();
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
+static void bind_vertex_array(const VertexArray &varray) {
 	bool use_vbo = !varray.get_dynamic() && sys_caps.vertex_buffers;
 	
 	glEnableClientState(GL_VERTEX_ARRAY);
@@ -640,9 +745,9 @@ void draw(const VertexArray &varray) {
 			glTexCoordPointer(dim, GL_SCALAR_TYPE, sizeof(Vertex), &varray.get_data()->tex[coord_index[i]]);
 		}
 	}
-	
-	glDrawArrays(primitive_type, 0, varray.get_count());
-	
+}
+
+static void unbind_vertex_array() {
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_COLOR_ARRAY);
 	glDisableClientState(GL_NORMAL_ARRAY);
@@ -653,45 +758,8 @@ void draw(const VertexArray &varray) {
 	}
 }
 
-void draw(const VertexArray &varray, const IndexArray &iarray) {
-	load_xform_matrices();
-	
-	bool use_vbo = !varray.get_dynamic() && sys_caps.vertex_buffers;
+static void draw_elements(const IndexArray &iarray) {
 	bool use_ibo = false;//!iarray.get_dynamic() && sys_caps.vertex_buffers;
-	
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_COLOR_ARRAY);
-	glEnableClientState(GL_NORMAL_ARRAY);
-	
-	if(use_vbo) {
-		Vertex v;
-		glBindBuffer(GL_ARRAY_BUFFER_ARB, varray.get_buffer_object());
-		glVertexPointer(3, GL_SCALAR_TYPE, sizeof(Vertex), (void*)((char*)&v.pos - (char*)&v));
-		glNormalPointer(GL_SCALAR_TYPE, sizeof(Vertex), (void*)((char*)&v.normal - (char*)&v));
-		glColorPointer(4, GL_SCALAR_TYPE, sizeof(Vertex), (void*)((char*)&v.color - (char*)&v));
-
-		for(int i=0; i<MAX_TEXTURES; i++) {
-			select_texture_unit(i);
-			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-			int dim = ttype[i] == TEX_1D ? 1 : (ttype[i] == TEX_3D || ttype[i] == TEX_CUBE ? 3 : 2);
-			glTexCoordPointer(dim, GL_SCALAR_TYPE, sizeof(Vertex), (void*)((char*)&v.tex[coord_index[i]] - (char*)&v));
-		}
-
-		glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
-	} else {
-		glVertexPointer(3, GL_SCALAR_TYPE, sizeof(Vertex), &varray.get_data()->pos);
-		glNormalPointer(GL_SCALAR_TYPE, sizeof(Vertex), &varray.get_data()->normal);
-		glColorPointer(4, GL_SCALAR_TYPE, sizeof(Vertex), &varray.get_data()->color);
-
-		for(int i=0; i<MAX_TEXTURES; i++) {
-			select_texture_unit(i);
-			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-			int dim = ttype[i] == TEX_1D ? 1 : (ttype[i] == TEX_3D || ttype[i] == TEX_CUBE ? 3 : 2);
-			glTexCoordPointer(dim, GL_SCALAR_TYPE, sizeof(Vertex), &varray.get_data()->tex[coord_index[i]]);
-		}
-	}
 
 	if(use_ibo) {
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, iarray.get_buffer_object());
@@ -700,15 +768,65 @@ void draw(const VertexArray &varray, const IndexArray &iarray) {
 	} else {
 		glDrawElements(primitive_type, iarray.get_count(), GL_UNSIGNED_INT, iarray.get_data());
 	}
-	
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_COLOR_ARRAY);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	
-	for(int i=0; i<MAX_TEXTURES; i++) {
-		select_texture_unit(i);
-		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	PROF_COUNT(PROF_DRAW_CALLS, 1);
+}
+
+void draw(const VertexArray &varray) {
+	if(swr) {
+		swr->draw(varray.get_data(), varray.get_count(), 0, 0, primitive_type, view_matrix * world_matrix, proj_matrix);
+		PROF_COUNT(PROF_DRAW_CALLS, 1);
+		return;
+	}
+	load_xform_matrices();
+
+	bind_vertex_array(varray);
+	glDrawArrays(primitive_type, 0, varray.get_count());
+	PROF_COUNT(PROF_DRAW_CALLS, 1);
+	unbind_vertex_array();
+}
+
+void draw(const VertexArray &varray, const IndexArray &iarray) {
+	if(swr) {
+		swr->draw(varray.get_data(), varray.get_count(), iarray.get_data(), iarray.get_count(), primitive_type,
+				view_matrix * world_matrix, proj_matrix);
+		PROF_COUNT(PROF_DRAW_CALLS, 1);
+		return;
 	}
+	load_xform_matrices();
+
+	bind_vertex_array(varray);
+	draw_elements(iarray);
+	unbind_vertex_array();
+}
+
+/* draw_instances
+ * the arrays are set up once, and only the modelview matrix is
+ * reloaded between the instances.
+ */
+void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+	if(count <= 0) return;
+
+	if(swr) {
+		for(int i=0; i<count; i++) {
+			world_matrix = world[i];
+			draw(varray, iarray);
+		}
+		return;
+	}
+
+	world_matrix = world[0];
+	load_xform_matrices();
+
+	bind_vertex_array(varray);
+	for(int i=0; i<count; i++) {
+		if(i > 0) {
+			world_matrix = world[i];
+			Matrix4x4 modelview = view_matrix * world_matrix;
+			load_matrix_gl(modelview);
+		}
+		draw_elements(iarray);
+	}
+	unbind_vertex_array();
 }
 
 
@@ -745,7 +863,7 @@ void draw_line(const Vertex &v1, const Vertex &v2, scalar_t w1, scalar_t w2) {
 
 	set_lighting(false);
 	set_primitive_type(QUAD_LIST);
-	draw(VertexArray(quad, 4));
+	draw(VertexArray(quad, 4, FRAME_MEM_GEOMETRY));
 	set_primitive_type(TRIANGLE_LIST);
 	set_lighting(true);
 }
@@ -775,7 +893,7 @@ void draw_point(const Vertex &pt, scalar_t size) {
 
 	set_lighting(false);
 	set_primitive_type(QUAD_LIST);
-	draw(VertexArray(quad, 4));
+	draw(VertexArray(quad, 4, FRAME_MEM_GEOMETRY));
 	set_primitive_type(TRIANGLE_LIST);
 	set_lighting(true);
 
@@ -783,6 +901,25 @@ void draw_point(const Vertex &pt, scalar_t size) {
 
 
 void draw_scr_quad(const Vector2 &corner1, const Vector2 &corner2, const Color &color, bool reset_xform) {
+	if(swr) {
+		// the same as the glOrtho(0, 1, 1, 0, 0, 1) below
+		Matrix4x4 ortho(2, 0, 0, -1,
+				0, -2, 0, 1,
+				0, 0, -2, -1,
+				0, 0, 0, 1);
+		Vertex quad[] = {
+			Vertex(Vector3(corner1.x, corner1.y, -0.5), 0.0, 1.0, color),
+			Vertex(Vector3(corner2.x, corner1.y, -0.5), 1.0, 1.0, color),
+			Vertex(Vector3(corner2.x, corner2.y, -0.5), 1.0, 0.0, color),
+			Vertex(Vector3(corner1.x, corner2.y, -0.5), 0.0, 0.0, color)
+		};
+
+		swr->set_lighting(false);
+		swr->draw(quad, 4, 0, 0, QUAD_LIST, reset_xform ? Matrix4x4() : view_matrix * world_matrix, ortho);
+		swr->set_lighting(true);
+		return;
+	}
+
 	if(reset_xform) {
 		glMatrixMode(GL_MODELVIEW);
 		glPushMatrix();
@@ -829,6 +966,10 @@ void set_primitive_type(PrimitiveType pt) {
 }
 
 void set_backface_culling(bool enable) {
+	if(swr) {
+		swr->set_backface_culling(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_CULL_FACE);
 	} else {
@@ -837,10 +978,18 @@ void set_backface_culling(bool enable) {
 }
 
 void set_front_face(FaceOrder order) {
+	if(swr) {
+		swr->set_front_face(order);
+		return;
+	}
 	glFrontFace(order);
 }
 
 void set_auto_normalize(bool enable) {
+	if(swr) {
+		swr->set_auto_normalize(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_NORMALIZE);
 	} else {
@@ -849,10 +998,15 @@ void set_auto_normalize(bool enable) {
 }
 
 void set_color_write(bool red, bool green, bool blue, bool alpha) {
+	if(swr) {
+		swr->set_color_write(red, green, blue, alpha);
+		return;
+	}
 	glColorMask(red, green, blue, alpha);
 }
 
 void set_wireframe(bool enable) {
+	if(swr) return;	// not supported
 	//set_primitive_type(enable ? LINE_LIST : TRIANGLE_LIST);
 	glPolygonMode(GL_FRONT_AND_BACK, enable ? GL_LINE : GL_FILL);
 }
@@ -861,6 +1015,10 @@ void set_wireframe(bool enable) {
 ///////////////// blending states ///////////////
 
 void set_alpha_blending(bool enable) {
+	if(swr) {
+		swr->set_alpha_blending(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_BLEND);
 	} else {
@@ -869,12 +1027,20 @@ void set_alpha_blending(bool enable) {
 }
 
 void set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	if(swr) {
+		swr->set_blend_func(src, dest);
+		return;
+	}
 	glBlendFunc(src, dest);
 }
 
 ///////////////// zbuffer states ////////////////
 
 void set_zbuffering(bool enable) {
+	if(swr) {
+		swr->set_zbuffering(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_DEPTH_TEST);
 	} else {
@@ -883,15 +1049,27 @@ void set_zbuffering(bool enable) {
 }
 
 void set_zwrite(bool enable) {
+	if(swr) {
+		swr->set_zwrite(enable);
+		return;
+	}
 	glDepthMask(enable);
 }
 
 void set_zfunc(CmpFunc func) {
+	if(swr) {
+		swr->set_zfunc(func);
+		return;
+	}
 	glDepthFunc(func);
 }
 
 /////////////// stencil states //////////////////
 void set_stencil_buffering(bool enable) {
+	if(swr) {
+		swr->set_stencil_buffering(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_STENCIL_TEST);
 	} else {
@@ -899,29 +1077,42 @@ void set_stencil_buffering(bool enable) {
 	}
 }
 
+static void apply_stencil_op() {
+	if(swr) {
+		swr->set_stencil_op(stencil_fail, stencil_pzfail, stencil_pass);
+	} else {
+		glStencilOp(stencil_fail, stencil_pzfail, stencil_pass);
+	}
+}
+
 void set_stencil_pass_op(StencilOp sop) {
 	stencil_pass = sop;
-	glStencilOp(stencil_fail, stencil_pzfail, stencil_pass);
+	apply_stencil_op();
 }
 
 void set_stencil_fail_op(StencilOp sop) {
 	stencil_fail = sop;
-	glStencilOp(stencil_fail, stencil_pzfail, stencil_pass);
+	apply_stencil_op();
 }
 
 void set_stencil_pass_zfail_op(StencilOp sop) {
 	stencil_pzfail = sop;
-	glStencilOp(stencil_fail, stencil_pzfail, stencil_pass);
+	apply_stencil_op();
 }
 
 void set_stencil_op(StencilOp fail, StencilOp spass_zfail, StencilOp pass) {
 	stencil_fail = fail;
 	stencil_pzfail = spass_zfail;
 	stencil_pass = pass;
-	glStencilOp(stencil_fail, stencil_pzfail, stencil_pass);
+	apply_stencil_op();
 }
 
 void set_stencil_func(CmpFunc func) {
+	if(swr) {
+		swr->set_stencil_reference(stencil_ref);
+		swr->set_stencil_func(func);
+		return;
+	}
 	glStencilFunc(func, stencil_ref, 0xffffffff);
 }
 
@@ -942,6 +1133,10 @@ void set_point_sprites(bool enable) {
 }
 
 void set_texture_filtering(int tex_unit, TextureFilteringType tex_filter) {
+	if(swr) {
+		swr->set_texture_filtering(tex_unit, tex_filter);
+		return;
+	}
 	
 	int min_filter;
 	
@@ -968,19 +1163,28 @@ void set_texture_filtering(int tex_unit, TextureFilteringType tex_filter) {
 }
 
 void set_texture_addressing(int tex_unit, TextureAddressing uaddr, TextureAddressing vaddr) {
+	if(swr) {
+		swr->set_texture_addressing(tex_unit, uaddr, vaddr);
+		return;
+	}
 	glTexParameteri(ttype[tex_unit], GL_TEXTURE_WRAP_S, uaddr);
 	glTexParameteri(ttype[tex_unit], GL_TEXTURE_WRAP_T, vaddr);
 }
 
 void set_texture_border_color(int tex_unit, const Color &color) {
+	if(swr) return;	// clamping to the border is treated as clamping to the edge
 	float col[] = {color.r, color.g, color.b, color.a};
 	glTexParameterfv(ttype[tex_unit], GL_TEXTURE_BORDER_COLOR, col);
 }
 
 void set_texture(int tex_unit, const Texture *tex) {
+	ttype[tex_unit] = tex->get_type();
+	if(swr) {
+		swr->bind_texture(tex_unit, tex->tex_id);
+		return;
+	}
 	select_texture_unit(tex_unit);
 	glBindTexture(tex->get_type(), tex->tex_id);
-	ttype[tex_unit] = tex->get_type();
 }
 
 void set_mip_mapping(bool enable) {
@@ -992,6 +1196,10 @@ void set_material(const Material &mat) {
 }
 
 void use_vertex_colors(bool enable) {
+	if(swr) {
+		swr->use_vertex_colors(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_COLOR_MATERIAL);
 	} else {
@@ -1000,6 +1208,17 @@ void use_vertex_colors(bool enable) {
 }
 
 
+// copies the lower left corner of the frame buffer into the texture (face)
+static void copy_to_texture(Texture *tex, GLenum target, int width, int height) {
+	set_texture(0, tex);
+	if(swr) {
+		int face = tex->get_type() == TEX_CUBE ? target - CUBE_MAP_PX : 0;
+		swr->copy_to_texture(tex->tex_id, face, width, height);
+	} else {
+		glCopyTexSubImage2D(target, 0, 0, 0, 0, 0, width, height);
+	}
+}
+
 void set_render_target(Texture *tex, CubeMapFace cube_map_face) {
 	static std::stack<Texture*> rt_stack;
 	static std::stack<CubeMapFace> face_stack;
@@ -1011,8 +1230,7 @@ void set_render_target(Texture *tex, CubeMapFace cube_map_face) {
 	if(tex == prev) return;
 
 	if(prev) {
-		set_texture(0, prev);
-		glCopyTexSubImage2D(prev->get_type() == TEX_CUBE ? prev_face : GL_TEXTURE_2D, 0, 0, 0, 0, 0, prev->width, prev->height);
+		copy_to_texture(prev, prev->get_type() == TEX_CUBE ? prev_face : GL_TEXTURE_2D, prev->width, prev->height);
 	}
 	
 	if(!tex) {
@@ -1038,14 +1256,13 @@ void copy_texture(Texture *tex, bool full_screen) {
 	int width = full_screen ? get_graphics_init_parameters()->x : tex->width;
 	int height = full_screen ? get_graphics_init_parameters()->y : tex->height;
 
-	set_texture(0, tex);
-	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+	copy_to_texture(tex, GL_TEXTURE_2D, width, height);
 }
 
 // multitexturing interface
 
 void select_texture_unit(int tex_unit) {
-	if(sys_caps.multitex) {
+	if(sys_caps.multitex && !swr) {
 		glext::glActiveTexture(GL_TEXTURE0 + tex_unit);
 		glext::glClientActiveTexture(GL_TEXTURE0 + tex_unit);
 	}
@@ -1053,6 +1270,10 @@ void select_texture_unit(int tex_unit) {
 
 void enable_texture_unit(int tex_unit) {
 	if(!tex_unit || (sys_caps.multitex && tex_unit < sys_caps.max_texture_units)) {
+		if(swr) {
+			swr->enable_texture_unit(tex_unit, true);
+			return;
+		}
 		select_texture_unit(tex_unit);
 		glEnable(ttype[tex_unit]);
 	}
@@ -1060,12 +1281,20 @@ void enable_texture_unit(int tex_unit) {
 
 void disable_texture_unit(int tex_unit) {
 	if(!tex_unit || (sys_caps.multitex && tex_unit < sys_caps.max_texture_units)) {
+		if(swr) {
+			swr->enable_texture_unit(tex_unit, false);
+			return;
+		}
 		select_texture_unit(tex_unit);
 		glDisable(ttype[tex_unit]);
 	}
 }
 
 void set_texture_unit_color(int tex_unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3) {
+	if(swr) {
+		swr->set_texture_unit_color(tex_unit, op, arg1, arg2, arg3);
+		return;
+	}
 	
 	select_texture_unit(tex_unit);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
@@ -1078,6 +1307,10 @@ void set_texture_unit_color(int tex_unit, TextureBlendFunction op, TextureBlendA
 }
 
 void set_texture_unit_alpha(int tex_unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3) {
+	if(swr) {
+		swr->set_texture_unit_alpha(tex_unit, op, arg1, arg2, arg3);
+		return;
+	}
 	
 	select_texture_unit(tex_unit);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
@@ -1091,16 +1324,54 @@ void set_texture_unit_alpha(int tex_unit, TextureBlendFunction op, TextureBlendA
 
 void set_texture_coord_index(int tex_unit, int index) {
 	coord_index[tex_unit] = index;
+	if(swr) swr->set_texture_coord_index(tex_unit, index);
 }
 
 void set_texture_constant(int tex_unit, const Color &col) {
+	if(swr) {
+		swr->set_texture_constant(tex_unit, col);
+		return;
+	}
 	float color[] = {col.r, col.g, col.b, col.a};
 	select_texture_unit(tex_unit);
 	glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, color);
 }
 
 //void set_texture_transform_state(int sttex_unitage, TexTransformState TexXForm);
-//void set_texture_coord_generator(int stage, TexGen tgen);
+
+void set_texture_coord_generator(int tex_unit, TexGen tgen) {
+	if(swr) {
+		swr->set_texture_coord_generator(tex_unit, tgen);
+		return;
+	}
+
+	select_texture_unit(tex_unit);
+	switch(tgen) {
+	case TEXGEN_SPHERE_MAP:
+		glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
+		glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
+		glEnable(GL_TEXTURE_GEN_S);
+		glEnable(GL_TEXTURE_GEN_T);
+		glDisable(GL_TEXTURE_GEN_R);
+		break;
+
+	case TEXGEN_REFLECTION_MAP:
+		glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
+		glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
+		glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
+		glEnable(GL_TEXTURE_GEN_S);
+		glEnable(GL_TEXTURE_GEN_T);
+		glEnable(GL_TEXTURE_GEN_R);
+		break;
+
+	case TEXGEN_NONE:
+	default:
+		glDisable(GL_TEXTURE_GEN_S);
+		glDisable(GL_TEXTURE_GEN_T);
+		glDisable(GL_TEXTURE_GEN_R);
+		break;
+	}
+}
 
 void set_point_sprite_coords(int tex_unit, bool enable) {
 	if(sys_caps.point_params) {
@@ -1131,6 +1402,10 @@ void set_gfx_program(GfxProg *prog) {
 
 // lighting states
 void set_lighting(bool enable) {
+	if(swr) {
+		swr->set_lighting(enable);
+		return;
+	}
 	if(enable) {
 		glEnable(GL_LIGHTING);
 	} else {
@@ -1140,13 +1415,37 @@ void set_lighting(bool enable) {
 
 void set_ambient_light(const Color &ambient_color) {
 	float col[] = {ambient_color.r, ambient_color.g, ambient_color.b, ambient_color.a};
+	if(swr) {
+		swr->set_ambient_light(col);
+		return;
+	}
 	glLightModelfv(GL_LIGHT_MODEL_AMBIENT, col);
 }
 
 void set_shading_mode(ShadeMode mode) {
+	if(swr) {
+		swr->set_shading_mode(mode);
+		return;
+	}
 	glShadeModel(mode);
 }
 
+void enable_light(int n) {
+	if(swr) {
+		swr->enable_light(n, true);
+		return;
+	}
+	glEnable(GL_LIGHT0 + n);
+}
+
+void disable_light(int n) {
+	if(swr) {
+		swr->enable_light(n, false);
+		return;
+	}
+	glDisable(GL_LIGHT0 + n);
+}
+
 void set_bump_light(const Light *light) {
 	bump_light = light;
 }
@@ -1170,6 +1469,8 @@ void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
 		
 	case XFORM_TEXTURE:
 		tex_matrix[num] = mat;
+		tex_matrix_dirty[num] = true;
+		if(swr) swr->set_texture_matrix(num, mat);
 		break;
 	}
 }
@@ -1192,13 +1493,17 @@ Matrix4x4 get_matrix(TransformType xform_type, int num) {
 }
 
 void set_viewport(unsigned int x, unsigned int y, unsigned int xsize, unsigned int ysize) {
+	if(swr) {
+		swr->set_viewport(x, y, xsize, ysize);
+		return;
+	}
 	glViewport(x, y, xsize, ysize);
 }
 
 // normalized set_viewport()
 void set_viewport_norm(float x, float y, float xsize, float ysize)
 {
-	glViewport((int) (x * gparams.x), (int)(y * gparams.y), 
+	set_viewport((int) (x * gparams.x), (int)(y * gparams.y), 
 		(int) (xsize * gparams.x), int (ysize * gparams.y));
 }
 
@@ -1240,7 +1545,11 @@ bool screen_capture(char *fname, enum image_file_format fmt) {
 	int y = gparams.y;
 
 	uint32_t *pixels = new uint32_t[x * y];
-	glReadPixels(0, 0, x, y, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+	if(swr) {
+		swr->read_pixels(pixels);
+	} else {
+		glReadPixels(0, 0, x, y, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+	}
 	
 	if(!fname) {
 		static char fname_buf[50];
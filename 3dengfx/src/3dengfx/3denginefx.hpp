@@ -34,6 +34,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "light.hpp"
 
 class Camera;
+class SoftRaster;
 
 namespace engfx_state {
 	extern SysCaps sys_caps;
@@ -47,6 +48,9 @@ namespace engfx_state {
 bool create_graphics_context(const GraphicsInitParameters &gip);
 bool create_graphics_context(int x, int y, bool fullscreen);
 bool start_gl();
+// renders with the software rasterizer instead, no window or GL context needed (see swrast.hpp)
+bool create_soft_context(int x, int y);
+SoftRaster *get_soft_context();
 void destroy_graphics_context();
 void set_default_states();
 const GraphicsInitParameters *get_graphics_init_parameters();
@@ -59,8 +63,12 @@ void clear_zbuffer_stencil(scalar_t zval, unsigned char sval);
 void flip();
 
 void load_xform_matrices();
+// makes the next load_xform_matrices() reload everything, call after loading GL matrices directly
+void invalidate_xform_matrices();
 void draw(const VertexArray &varray);
 void draw(const VertexArray &varray, const IndexArray &iarray);
+// draws the arrays once for each of the world matrices
+void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count);
 void draw_line(const Vertex &v1, const Vertex &v2, scalar_t w1, scalar_t w2 = -1.0);
 void draw_point(const Vertex &pt, scalar_t size);
 void draw_scr_quad(const Vector2 &corner1, const Vector2 &corner2, const Color &color = Color(1.0), bool reset_xform = true);
@@ -117,7 +125,7 @@ void set_texture_unit_alpha(int tex_unit, TextureBlendFunction op, TextureBlendA
 void set_texture_coord_index(int tex_unit, int index);
 void set_texture_constant(int tex_unit, const Color &col);
 //void set_texture_transform_state(int tex_unit, TexTransformState TexXForm);
-//void set_texture_coord_generator(int stage, TexGen tgen);
+void set_texture_coord_generator(int tex_unit, TexGen tgen);
 void set_point_sprite_coords(int tex_unit, bool enable);
 
 // programmable interface
@@ -129,6 +137,8 @@ void set_lighting(bool enable);
 void set_ambient_light(const Color &ambient_color);
 void set_shading_mode(ShadeMode mode);
 //void set_specular(bool enable);
+void enable_light(int n);
+void disable_light(int n);
 
 void set_bump_light(const Light *light);
 
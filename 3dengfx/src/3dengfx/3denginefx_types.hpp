@@ -164,6 +164,7 @@ struct SysCaps {
 	bool bump_dot3;
 	bool bump_env;
 	bool vertex_buffers;
+	bool pixel_buffers;
 	bool depth_texture;
 	bool shadow_mapping;
 	bool point_sprites;
@@ -174,6 +175,13 @@ struct SysCaps {
 	ProgCaps prog;
 };
 
+// texture coordinate generation
+enum TexGen {
+	TEXGEN_NONE,
+	TEXGEN_SPHERE_MAP,
+	TEXGEN_REFLECTION_MAP
+};
+
 enum TransformType {
 	XFORM_WORLD,
 	XFORM_VIEW,
@@ -27,6 +27,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "texman.hpp"
 #include "3denginefx.hpp"
 #include "common/err_msg.h"
+#include "common/arena.h"
+#include "common/profile.h"
 #include "dsys/fx.hpp"
 
 using std::string;
@@ -62,6 +64,20 @@ Scene::Scene() {
 
 	first_render = true;
 	frame_count = 0;
+
+	svol_cache = new ShadowVolumeCache;
+
+	frustum_cull = true;
+	bvh = new BVH;
+	bvh_dirty = true;
+	bvh_frame = bvh_time = ULONG_MAX;
+	vis_frame = vis_time = ULONG_MAX;
+
+	occ_cull = false;
+	max_occluders = 16;
+	occ_buf = new OcclusionBuffer;
+
+	rqueue = new RenderQueue;
 }
 
 Scene::~Scene() {
@@ -93,9 +109,18 @@ Scene::~Scene() {
 		while(piter != psys.end()) {
 			delete *piter++;
 		}
+
+		std::list<Terrain*>::iterator titer = terrains.begin();
+		while(titer != terrains.end()) {
+			delete *titer++;
+		}
 	}
 
 	delete [] lights;
+	delete svol_cache;
+	delete bvh;
+	delete occ_buf;
+	delete rqueue;
 }
 
 void Scene::set_poly_count(unsigned long pcount) {
@@ -126,6 +151,7 @@ void Scene::add_object(Object *obj) {
 	} else {
 		objects.push_front(obj);
 	}
+	bvh_dirty = true;
 }
 
 void Scene::add_curve(Curve *curve) {
@@ -136,6 +162,10 @@ void Scene::add_particle_sys(ParticleSystem *p) {
 	psys.push_back(p);
 }
 
+void Scene::add_terrain(Terrain *terrain) {
+	terrains.push_back(terrain);
+}
+
 /* adds a cubemapped skycube, by creating a cube with the correct
  * texture coordinates to map into the cubemap texture.
  */
@@ -172,6 +202,7 @@ bool Scene::remove_light(const Light *light) {
 	}
 
 	if(idx < lcount) {
+		svol_cache->invalidate(light);
 		lights[idx] = 0;
 		for(int i=idx; i<lcount-1; i++) {
 			lights[i] = lights[i + 1];
@@ -185,7 +216,9 @@ bool Scene::remove_light(const Light *light) {
 bool Scene::remove_object(const Object *obj) {
 	std::list<Object*>::iterator iter = find(objects.begin(), objects.end(), obj);
 	if(iter != objects.end()) {
+		svol_cache->invalidate(obj);
 		objects.erase(iter);
+		bvh_dirty = true;
 		return true;
 	}
 	return false;
@@ -200,6 +233,17 @@ bool Scene::remove_particle_sys(const ParticleSystem *p) {
 	return false;
 }
 
+bool Scene::remove_terrain(const Terrain *terrain) {
+	std::list<Terrain*>::iterator iter = find(terrains.begin(), terrains.end(), terrain);
+	if(iter != terrains.end()) {
+		terrains.erase(iter);
+		terrain_visible.clear();
+		vis_frame = ULONG_MAX;
+		return true;
+	}
+	return false;
+}
+
 Camera *Scene::get_camera(const char *name) {
 	std::list<Camera *>::iterator iter = cameras.begin();
 	while(iter != cameras.end()) {
@@ -216,6 +260,14 @@ Light *Scene::get_light(const char *name) {
 	return 0;
 }
 
+int Scene::get_light_count() const {
+	return lcount;
+}
+
+const Light *Scene::get_light_at(int idx) const {
+	return idx >= 0 && idx < lcount ? lights[idx] : 0;
+}
+
 Object *Scene::get_object(const char *name) {
 	std::list<Object *>::iterator iter = objects.begin();
 	while(iter != objects.end()) {
@@ -302,6 +354,141 @@ void Scene::set_background(const Color &bg) {
 	bg_color = bg;
 }
 
+void Scene::set_frustum_culling(bool enable) {
+	frustum_cull = enable;
+}
+
+void Scene::set_occlusion_culling(bool enable, int max_occluders) {
+	occ_cull = enable;
+	this->max_occluders = max_occluders;
+	vis_frame = ULONG_MAX;
+}
+
+OcclusionBuffer *Scene::get_occlusion_buffer() {
+	return occ_buf;
+}
+
+const OcclusionStats *Scene::get_occlusion_stats() const {
+	return occ_buf->get_stats();
+}
+
+void Scene::set_render_backend(RenderBackend *backend) {
+	rqueue->set_backend(backend);
+}
+
+const RenderStats *Scene::get_render_stats() const {
+	return rqueue->get_stats();
+}
+
+void Scene::set_parallel_recording(bool enable) {
+	rqueue->set_parallel(enable);
+}
+
+/* update_bvh
+ * The BVH items are the objects, in the order of the object list. The tree
+ * is rebuilt from scratch whenever objects are added or removed, otherwise
+ * only the bounds of objects that moved (or may have moved) are refitted.
+ */
+void Scene::update_bvh(unsigned long msec) const {
+	AABox box;
+	OBox obox;
+	Vector3 center;
+	scalar_t rad;
+
+	if(bvh_dirty || bvh_objects.size() != objects.size()) {
+		bvh->clear();
+		bvh_objects.clear();
+
+		std::list<Object *>::const_iterator iter = objects.begin();
+		while(iter != objects.end()) {
+			Object *obj = *iter++;
+
+			obj->get_world_bounds(msec, &box, &center, &rad, &obox);
+			bvh->add_item(obj, box, center, rad, &obox);
+
+			SceneBVHEntry ent;
+			ent.obj = obj;
+			ent.xform_rev = obj->get_xform_revision();
+			ent.mesh_rev = obj->get_mesh().get_revision();
+			bvh_objects.push_back(ent);
+		}
+		bvh_dirty = false;
+	} else {
+		for(size_t i=0; i<bvh_objects.size(); i++) {
+			SceneBVHEntry *ent = &bvh_objects[i];
+			Object *obj = ent->obj;
+
+			unsigned long xrev = obj->get_xform_revision();
+			unsigned long mrev = obj->get_mesh().get_revision();
+
+			bool moved = xrev != ent->xform_rev || mrev != ent->mesh_rev;
+			if(!moved && (msec == bvh_time || !obj->is_animated())) {
+				continue;
+			}
+
+			obj->get_world_bounds(msec, &box, &center, &rad, &obox);
+			bvh->set_item_bounds((int)i, box, center, rad, &obox);
+			ent->xform_rev = xrev;
+			ent->mesh_rev = mrev;
+		}
+	}
+
+	bvh->update();
+	bvh_frame = frame_count;
+	bvh_time = msec;
+	vis_frame = ULONG_MAX;
+}
+
+const BVH *Scene::get_bvh() const {
+	return bvh;
+}
+
+struct PickData {
+	const std::vector<SceneBVHEntry> *objects;
+	unsigned long msec;
+};
+
+static bool pick_object(int item, const Ray &ray, scalar_t *t, void *cls) {
+	PickData *pd = (PickData*)cls;
+	const Object *obj = (*pd->objects)[item].obj;
+
+	if(obj->get_render_params().hidden) return false;
+
+	// transform the ray to object space, without normalizing the direction
+	// so that the parametric distance is the same in both spaces.
+	Matrix4x4 inv_xform = obj->get_prs(pd->msec).get_xform_matrix().inverse();
+	Ray oray(ray.origin.transformed(inv_xform), ray.dir.transformed(Matrix3x3(inv_xform)));
+
+	const TriMesh &mesh = obj->get_mesh();
+	const Vertex *varray = mesh.get_vertex_array()->get_data();
+	const Triangle *tri = mesh.get_triangle_array()->get_data();
+	int tcount = mesh.get_triangle_array()->get_count();
+
+	bool found = false;
+	for(int i=0; i<tcount; i++) {
+		scalar_t tt;
+		const Index *v = tri[i].vertices;
+		if(find_tri_ray_intersection(varray[v[0]].pos, varray[v[1]].pos, varray[v[2]].pos, oray, &tt) && tt < *t) {
+			*t = tt;
+			found = true;
+		}
+	}
+	return found;
+}
+
+Object *Scene::pick(const Ray &ray, unsigned long msec, scalar_t *t) const {
+	if(bvh_frame != frame_count || bvh_time != msec || bvh_dirty) {
+		update_bvh(msec);
+	}
+
+	PickData pd;
+	pd.objects = &bvh_objects;
+	pd.msec = msec;
+
+	int idx = bvh->intersect(ray, t, pick_object, &pd);
+	return idx == -1 ? 0 : bvh_objects[idx].obj;
+}
+
 void Scene::setup_lights(unsigned long msec) const {
 	int light_index = 0;
 	for(int i=0; i<lcount; i++) {
@@ -309,7 +496,7 @@ void Scene::setup_lights(unsigned long msec) const {
 			lights[i]->set_gl_light(light_index++, msec);
 		}
 	}
-	glDisable(GL_LIGHT0 + light_index);
+	disable_light(light_index);
 }
 
 void Scene::set_shadows(bool enable) {
@@ -317,6 +504,7 @@ void Scene::set_shadows(bool enable) {
 }
 
 void Scene::render(unsigned long msec) const {
+	PROF_SCOPE("Scene::render");
 	static int call_depth = -1;
 	call_depth++;
 	
@@ -324,6 +512,7 @@ void Scene::render(unsigned long msec) const {
 	if(!call_depth) {
 		// ---- this part is guaranteed to be executed once for each frame ----
 		poly_count = 0;		// reset the polygon counter
+		rqueue->reset_stats();
 		
 		::set_ambient_light(ambient_light);
 		
@@ -335,6 +524,8 @@ void Scene::render(unsigned long msec) const {
 								// to support 1st frame only cubemap calculation.
 		frame_count++;	// for statistics.
 
+		if(shadows) svol_cache->begin_frame();
+
 		// --- update particle systems (not render) ---
 		psys::set_global_time(msec);
 		std::list<ParticleSystem*>::const_iterator iter = psys.begin();
@@ -366,7 +557,7 @@ void Scene::render(unsigned long msec) const {
 			if(!lights[i]->casts_shadows()) continue;
 			at_least_one = true;
 
-			glDisable(GL_LIGHT0 + i);
+			disable_light(i);
 			render_objects(msec);	// scene minus this shadow casting light.
 
 			set_zwrite(false);
@@ -399,7 +590,7 @@ void Scene::render(unsigned long msec) const {
 			set_stencil_func(CMP_EQUAL);
 			set_stencil_reference(0);
 
-			glEnable(GL_LIGHT0 + i);
+			enable_light(i);
 
 			render_objects(msec);
 		}
@@ -411,22 +602,159 @@ void Scene::render(unsigned long msec) const {
 	
 	render_particles(msec);
 
+	// nested calls (cube maps) may still be using the frame arena of the outer one
+	if(!call_depth) {
+		PROF_COUNT(PROF_STATE_CHANGES, rqueue->get_stats()->total_changes());
+		frame_reset();
+	}
 	call_depth--;
 }
 
+/* render_objects
+ * the objects left after culling go through the render queue, sorted
+ * to minimize state changes (see rqueue.hpp).
+ */
 void Scene::render_objects(unsigned long msec) const {
-	std::list<Object *>::const_iterator iter = objects.begin();
-	while(iter != objects.end()) {
-		Object *obj = *iter++;
+	PROF_SCOPE("Scene::render_objects");
+	rqueue->clear();
+	rq_objects.clear();
 
-		RenderParams rp = obj->get_render_params();
+	if(!frustum_cull) {
+		rq_objects.insert(rq_objects.end(), objects.begin(), objects.end());
+
+		select_terrain_chunks(0);
+		rq_objects.insert(rq_objects.end(), terrain_visible.begin(), terrain_visible.end());
+
+		if(!rq_objects.empty()) {
+			rqueue->add_objects(&rq_objects[0], (int)rq_objects.size(), msec);
+		}
+		rqueue->sort();
+		poly_count += rqueue->submit(msec);
+		return;
+	}
+
+	// render_objects is called multiple times per frame with shadows
+	if(bvh_frame != frame_count || bvh_time != msec || bvh_dirty) {
+		update_bvh(msec);
+	}
+
+	Matrix4x4 view_proj = engfx_state::proj_matrix * engfx_state::view_matrix;
 
-		if(!rp.hidden) {
-			if(obj->render(msec)) {
-				poly_count += obj->get_mesh_ptr()->get_triangle_array()->get_count();
+	bool same_view = vis_frame == frame_count && vis_time == msec;
+	for(int i=0; i<4 && same_view; i++) {
+		for(int j=0; j<4; j++) {
+			if(view_proj[i][j] != vis_view_proj[i][j]) {
+				same_view = false;
+				break;
 			}
 		}
 	}
+
+	if(!same_view) {
+		FrustumPlane frustum[6];
+		const FrustumPlane *fplanes = frustum;
+		if(engfx_state::view_mat_camera) {
+			fplanes = engfx_state::view_mat_camera->get_frustum();
+		} else {
+			for(int i=0; i<6; i++) {
+				frustum[i] = FrustumPlane(view_proj, i);
+			}
+		}
+
+		bvh_visible.clear();
+		bvh->cull(fplanes, &bvh_visible);
+		select_terrain_chunks(fplanes);
+
+		// in object list order, the render queue sorts them for drawing
+		std::sort(bvh_visible.begin(), bvh_visible.end());
+
+		if(occ_cull) occlusion_cull(msec, view_proj);
+		PROF_COUNT(PROF_CULLED_OBJECTS, bvh_objects.size() - bvh_visible.size());
+
+		vis_frame = frame_count;
+		vis_time = msec;
+		vis_view_proj = view_proj;
+	}
+
+	for(size_t i=0; i<bvh_visible.size(); i++) {
+		rq_objects.push_back(bvh_objects[bvh_visible[i]].obj);
+	}
+	rq_objects.insert(rq_objects.end(), terrain_visible.begin(), terrain_visible.end());
+
+	if(!rq_objects.empty()) {
+		rqueue->add_objects(&rq_objects[0], (int)rq_objects.size(), msec);
+	}
+	rqueue->sort();
+	poly_count += rqueue->submit(msec);
+}
+
+/* select_terrain_chunks
+ * the terrains pick their chunks for the current view, culling them
+ * against the frustum unless it's null.
+ */
+void Scene::select_terrain_chunks(const FrustumPlane *frustum) const {
+	terrain_visible.clear();
+	if(terrains.empty()) return;
+
+	Matrix4x4 inv_view = engfx_state::view_matrix.inverse();
+	Vector3 cam_pos(inv_view[0][3], inv_view[1][3], inv_view[2][3]);
+
+	std::list<Terrain*>::const_iterator iter = terrains.begin();
+	while(iter != terrains.end()) {
+		(*iter++)->select(cam_pos, frustum, &terrain_visible);
+	}
+}
+
+struct OccluderCand {
+	scalar_t size;
+	int idx;
+
+	bool operator <(const OccluderCand &c) const {
+		return size > c.size;
+	}
+};
+
+/* occlusion_cull
+ * rasterizes the occluders which appear largest on screen (by the ratio
+ * of their bounding sphere radius and distance), and then removes any
+ * object whose bounding box is hidden behind them from bvh_visible.
+ */
+void Scene::occlusion_cull(unsigned long msec, const Matrix4x4 &view_proj) const {
+	Matrix4x4 inv_view = engfx_state::view_matrix.inverse();
+	Vector3 cam_pos(inv_view[0][3], inv_view[1][3], inv_view[2][3]);
+
+	std::vector<OccluderCand> cand;
+	for(size_t i=0; i<bvh_visible.size(); i++) {
+		Object *obj = bvh_objects[bvh_visible[i]].obj;
+		RenderParams rp = obj->get_render_params();
+
+		if(rp.occluder && !rp.hidden && obj->get_material_ptr()->alpha > 0.995) {
+			const BVHItem *item = bvh->get_item(bvh_visible[i]);
+			scalar_t dist_sq = (item->center - cam_pos).length_sq();
+
+			OccluderCand c;
+			c.size = SQ(item->radius) / std::max(dist_sq, (scalar_t)small_number);
+			c.idx = bvh_visible[i];
+			cand.push_back(c);
+		}
+	}
+	std::sort(cand.begin(), cand.end());
+
+	occ_buf->begin_frame(view_proj);
+	int count = std::min((int)cand.size(), max_occluders);
+	for(int i=0; i<count; i++) {
+		Object *obj = bvh_objects[cand[i].idx].obj;
+		occ_buf->add_occluder(*obj->get_occluder_mesh(), obj->get_prs(msec).get_xform_matrix());
+	}
+	if(!count) return;
+
+	size_t vis_count = 0;
+	for(size_t i=0; i<bvh_visible.size(); i++) {
+		if(occ_buf->test_box(bvh->get_item(bvh_visible[i])->box)) {
+			bvh_visible[vis_count++] = bvh_visible[i];
+		}
+	}
+	bvh_visible.resize(vis_count);
 }
 
 void Scene::render_particles(unsigned long msec) const {
@@ -436,8 +764,18 @@ void Scene::render_particles(unsigned long msec) const {
 	}
 }
 
-// TODO: optimize this...
+/* render_svol
+ * shadow volumes are cached per object/light pair, and only rebuilt when the
+ * mesh or the light (in the model space of the object) moved. All the stale
+ * volumes of this light are rebuilt in parallel before drawing any of them.
+ */
 void Scene::render_svol(int lidx, unsigned long msec) const {
+	PROF_SCOPE("Scene::render_svol");
+	size_t max_vols = objects.size();
+	CachedShadowVolume **vols = (CachedShadowVolume**)frame_alloc(max_vols * sizeof *vols, FRAME_MEM_SHADOWS);
+	Matrix4x4 *xforms = (Matrix4x4*)frame_alloc(max_vols * sizeof *xforms, FRAME_MEM_SHADOWS);
+	size_t vol_count = 0;
+
 	std::list<Object *>::const_iterator iter = objects.begin();
 	while(iter != objects.end()) {
 		Object *obj = *iter++;
@@ -457,13 +795,21 @@ void Scene::render_svol(int lidx, unsigned long msec) const {
 				lt = lights[lidx]->get_position(msec);
 				lt.transform(inv_xform);
 			}
-			
-			TriMesh *vol = obj->get_mesh_ptr()->get_shadow_volume(lt, is_dir);
-			set_matrix(XFORM_WORLD, xform);
-			draw(*vol->get_vertex_array(), *vol->get_index_array());
-			delete vol;
+
+			vols[vol_count] = svol_cache->request(obj, lights[lidx], &obj->get_mesh(), lt, is_dir);
+			xforms[vol_count++] = xform;
 		}
 	}
+
+	svol_cache->update();
+
+	for(size_t i=0; i<vol_count; i++) {
+		const VertexArray *va = vols[i]->get_vertex_array();
+		if(!va->get_count()) continue;
+
+		set_matrix(XFORM_WORLD, xforms[i]);
+		draw(*va);
+	}
 }
 
 void Scene::render_cube_map(Object *obj, unsigned long msec) const {
@@ -567,34 +913,26 @@ bool Scene::render_all_cube_maps(unsigned long msec) const {
 }
 
 #include "fxwt/text.hpp"
-#if defined(unix) || defined(__unix__)
-#include <unistd.h>
-#include <sys/stat.h>
-#endif	// __unix__
+#include "framewriter.hpp"
 
 void Scene::render_sequence(unsigned long start, unsigned long end, int fps, const char *out_dir) {
-#if defined(unix) || defined(__unix__)
-	// change to the specified directory
-	char curr_dir[PATH_MAX];
-	getcwd(curr_dir, PATH_MAX);
-
-	struct stat sbuf;
-	if(stat(out_dir, &sbuf) == -1) {
-		mkdir(out_dir, 0770);
-	}	
-	
-	chdir(out_dir);
-#endif	// __unix__
+	ImageFrameSink sink(out_dir, "3dengfx_shot", IMG_FMT_TGA);
+	render_sequence(start, end, fps, &sink);
+}
 
+void Scene::render_sequence(unsigned long start, unsigned long end, int fps, FrameSink *sink) {
 	warning("Sequence rendering is experimental; this may make the program unresponsive while it renders, be patient.");
 
 	// render frames until we reach the end time
 	unsigned long time = start;
 	unsigned long dt = 1000 / fps;
 
+	// the frames are encoded and written by other threads while rendering goes on
+	FrameWriter writer(sink);
+
 	while(time < end) {
 		render(time);
-		screen_capture();
+		writer.capture();
 
 		// draw progress bar
 		scalar_t t = (scalar_t)time / (scalar_t)(end - start);
@@ -612,7 +950,6 @@ void Scene::render_sequence(unsigned long start, unsigned long end, int fps, con
 		time += dt;
 	}
 
-#if defined(unix) || defined(__unix__)
-	chdir(curr_dir);
-#endif	// __unix__
+	writer.finish();
+	writer.print_stats();
 }
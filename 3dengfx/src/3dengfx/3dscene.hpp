@@ -21,17 +21,31 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _3DSCENE_HPP_
 
 #include <list>
+#include <vector>
 #include "camera.hpp"
 #include "light.hpp"
 #include "object.hpp"
 #include "psys.hpp"
+#include "terrain.hpp"
+#include "shadows.hpp"
 #include "gfx/curves.hpp"
+#include "gfx/bvh.hpp"
+#include "gfx/occlusion.hpp"
+
+class FrameSink;
+#include "rqueue.hpp"
 
 struct ShadowVolume {
 	TriMesh *shadow_mesh;
 	const Light *light;
 };
 
+// what the scene BVH last saw of each object, to detect movement
+struct SceneBVHEntry {
+	Object *obj;
+	unsigned long xform_rev, mesh_rev;
+};
+
 class Scene {
 private:
 	Light **lights;
@@ -41,8 +55,10 @@ private:
 	TargetCamera *cubic_cam[6];
 	std::list<Object*> objects;
 	std::list<ShadowVolume> static_shadow_volumes;
+	ShadowVolumeCache *svol_cache;
 	std::list<Curve*> curves;
 	std::list<ParticleSystem*> psys;
+	std::list<Terrain*> terrains;
 	
 	bool manage_data;
 	const Camera *active_camera;
@@ -60,8 +76,28 @@ private:
 	mutable unsigned long poly_count;
 	unsigned long scene_poly_count;
 	bool frustum_cull;
+
+	BVH *bvh;
+	mutable std::vector<SceneBVHEntry> bvh_objects;
+	mutable std::vector<int> bvh_visible;
+	mutable bool bvh_dirty;
+	mutable unsigned long bvh_frame, bvh_time;
+
+	// the visible set is kept until the frame, time or view changes
+	mutable unsigned long vis_frame, vis_time;
+	mutable Matrix4x4 vis_view_proj;
+
+	bool occ_cull;
+	int max_occluders;
+	OcclusionBuffer *occ_buf;
+
+	RenderQueue *rqueue;
+	mutable std::vector<Object*> rq_objects;
+	mutable std::vector<Object*> terrain_visible;
 	
 	void place_cube_camera(const Vector3 &pos);
+	void select_terrain_chunks(const FrustumPlane *frustum) const;
+	void occlusion_cull(unsigned long msec, const Matrix4x4 &view_proj) const;
 	bool render_all_cube_maps(unsigned long msec = XFORM_LOCAL_PRS) const;
 		
 public:
@@ -79,15 +115,20 @@ public:
 	void add_static_shadow_volume(TriMesh *mesh, const Light *light);
 	void add_curve(Curve *curve);
 	void add_particle_sys(ParticleSystem *p);
+	// the chunks of the terrain are selected and drawn along with the objects
+	void add_terrain(Terrain *terrain);
 
 	void add_skycube(scalar_t size, Texture *cubemap);
 
 	bool remove_light(const Light *light);
 	bool remove_object(const Object *obj);
 	bool remove_particle_sys(const ParticleSystem *p);
+	bool remove_terrain(const Terrain *terrain);
 
 	Camera *get_camera(const char *name);
 	Light *get_light(const char *name);
+	int get_light_count() const;
+	const Light *get_light_at(int idx) const;
 	Object *get_object(const char *name);
 	Curve *get_curve(const char *name);
 	ParticleSystem *get_particle_sys(const char *name);
@@ -110,6 +151,32 @@ public:
 	void set_background(const Color &bg);
 	void set_frustum_culling(bool enable);
 
+	/* software occlusion culling of the objects left after frustum culling,
+	 * by the max_occluders objects marked as occluders which are largest on
+	 * screen. Only done along with frustum culling.
+	 */
+	void set_occlusion_culling(bool enable, int max_occluders = 16);
+	OcclusionBuffer *get_occlusion_buffer();
+	const OcclusionStats *get_occlusion_stats() const;
+
+	/* objects are drawn through a sorted render queue, by default with
+	 * the GL backend. The statistics are for the last frame.
+	 */
+	void set_render_backend(RenderBackend *backend);
+	const RenderStats *get_render_stats() const;
+
+	/* prepare the objects and record the render commands on the thread pool,
+	 * leaving only the GL calls to the calling thread (on by default).
+	 */
+	void set_parallel_recording(bool enable);
+
+	// brings the object BVH up to date with the object positions at msec
+	void update_bvh(unsigned long msec = XFORM_LOCAL_PRS) const;
+	const BVH *get_bvh() const;
+
+	// returns the nearest object hit by the (world space) ray, or 0
+	Object *pick(const Ray &ray, unsigned long msec = XFORM_LOCAL_PRS, scalar_t *t = 0) const;
+
 	// render states
 	void setup_lights(unsigned long msec = XFORM_LOCAL_PRS) const;
 
@@ -119,7 +186,9 @@ public:
 	void render_svol(int lidx, unsigned long msec = XFORM_LOCAL_PRS) const;
 	void render_cube_map(Object *obj, unsigned long msec = XFORM_LOCAL_PRS) const;
 
+	// numbered TGA files in out_dir, or any sink (see framesink.hpp)
 	void render_sequence(unsigned long start, unsigned long end, int fps = 30, const char *out_dir = "frames");
+	void render_sequence(unsigned long start, unsigned long end, int fps, FrameSink *sink);
 };
 
 #endif	// _3DSCENE_HPP_
@@ -0,0 +1,227 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* recorded render command lists */
+
+#include "3dengfx_config.h"
+
+#include "cmdlist.hpp"
+
+RenderCommand *CommandList::add_command(int type, int unit) {
+	commands.resize(commands.size() + 1);
+	RenderCommand *cmd = &commands.back();
+	cmd->type = type;
+	cmd->unit = unit;
+	return cmd;
+}
+
+void CommandList::clear() {
+	commands.clear();
+	matrices.clear();
+	stages.clear();
+}
+
+int CommandList::get_command_count() const {
+	return (int)commands.size();
+}
+
+const RenderCommand *CommandList::get_commands() const {
+	return commands.empty() ? 0 : &commands[0];
+}
+
+void CommandList::replay(RenderBackend *backend) const {
+	size_t count = commands.size();
+	for(size_t i=0; i<count; i++) {
+		const RenderCommand *cmd = &commands[i];
+
+		switch(cmd->type) {
+		case CMD_ZWRITE:
+			backend->set_zwrite(cmd->val[0] != 0);
+			break;
+
+		case CMD_BLENDING:
+			backend->set_alpha_blending(cmd->val[0] != 0);
+			break;
+
+		case CMD_BLEND_FUNC:
+			backend->set_blend_func((BlendingFactor)cmd->val[0], (BlendingFactor)cmd->val[1]);
+			break;
+
+		case CMD_SHADING:
+			backend->set_shading_mode((ShadeMode)cmd->val[0]);
+			break;
+
+		case CMD_WIREFRAME:
+			backend->set_wireframe(cmd->val[0] != 0);
+			break;
+
+		case CMD_CULLING:
+			backend->set_backface_culling(cmd->val[0] != 0);
+			break;
+
+		case CMD_VERTEX_COLORS:
+			backend->use_vertex_colors(cmd->val[0] != 0);
+			break;
+
+		case CMD_AUTO_NORMALIZE:
+			backend->set_auto_normalize(cmd->val[0] != 0);
+			break;
+
+		case CMD_GFX_PROGRAM:
+			backend->set_gfx_program(cmd->ptr.prog);
+			break;
+
+		case CMD_UPDATE_GFX_PROGRAM:
+			backend->update_gfx_program(cmd->ptr.prog);
+			break;
+
+		case CMD_MATERIAL:
+			backend->set_material(*cmd->ptr.mat);
+			break;
+
+		case CMD_MATRIX:
+			backend->set_matrix((TransformType)cmd->val[0], matrices[cmd->val[1]], cmd->unit);
+			break;
+
+		case CMD_TEXTURE:
+			backend->set_texture(cmd->unit, cmd->ptr.tex);
+			break;
+
+		case CMD_TEXTURE_UNIT:
+			backend->enable_texture_unit(cmd->unit, cmd->val[0] != 0);
+			break;
+
+		case CMD_TEXTURE_STAGE:
+			backend->set_texture_stage(cmd->unit, stages[cmd->val[0]]);
+			break;
+
+		case CMD_TEXTURE_ADDRESSING:
+			backend->set_texture_addressing(cmd->unit, (TextureAddressing)cmd->val[0]);
+			break;
+
+		case CMD_DRAW:
+			backend->draw(*cmd->ptr.varray, *cmd->iarray);
+			break;
+
+		case CMD_DRAW_INSTANCES:
+			backend->draw_instances(*cmd->ptr.varray, *cmd->iarray, &matrices[cmd->val[0]], cmd->val[1]);
+			break;
+
+		case CMD_RENDER_OBJECT:
+			backend->render_object(cmd->ptr.obj, cmd->time);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+void CommandList::set_zwrite(bool enable) {
+	add_command(CMD_ZWRITE)->val[0] = enable;
+}
+
+void CommandList::set_alpha_blending(bool enable) {
+	add_command(CMD_BLENDING)->val[0] = enable;
+}
+
+void CommandList::set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	RenderCommand *cmd = add_command(CMD_BLEND_FUNC);
+	cmd->val[0] = src;
+	cmd->val[1] = dest;
+}
+
+void CommandList::set_shading_mode(ShadeMode mode) {
+	add_command(CMD_SHADING)->val[0] = mode;
+}
+
+void CommandList::set_wireframe(bool enable) {
+	add_command(CMD_WIREFRAME)->val[0] = enable;
+}
+
+void CommandList::set_backface_culling(bool enable) {
+	add_command(CMD_CULLING)->val[0] = enable;
+}
+
+void CommandList::use_vertex_colors(bool enable) {
+	add_command(CMD_VERTEX_COLORS)->val[0] = enable;
+}
+
+void CommandList::set_auto_normalize(bool enable) {
+	add_command(CMD_AUTO_NORMALIZE)->val[0] = enable;
+}
+
+void CommandList::set_gfx_program(GfxProg *prog) {
+	add_command(CMD_GFX_PROGRAM)->ptr.prog = prog;
+}
+
+void CommandList::update_gfx_program(GfxProg *prog) {
+	add_command(CMD_UPDATE_GFX_PROGRAM)->ptr.prog = prog;
+}
+
+void CommandList::set_material(const Material &mat) {
+	add_command(CMD_MATERIAL)->ptr.mat = &mat;
+}
+
+// matrices are copied, they are usually temporaries
+void CommandList::set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
+	RenderCommand *cmd = add_command(CMD_MATRIX, num);
+	cmd->val[0] = xform_type;
+	cmd->val[1] = (int)matrices.size();
+	matrices.push_back(mat);
+}
+
+void CommandList::set_texture(int tex_unit, const Texture *tex) {
+	add_command(CMD_TEXTURE, tex_unit)->ptr.tex = tex;
+}
+
+void CommandList::enable_texture_unit(int tex_unit, bool enable) {
+	add_command(CMD_TEXTURE_UNIT, tex_unit)->val[0] = enable;
+}
+
+void CommandList::set_texture_stage(int tex_unit, const TextureStage &stage) {
+	add_command(CMD_TEXTURE_STAGE, tex_unit)->val[0] = (int)stages.size();
+	stages.push_back(stage);
+}
+
+void CommandList::set_texture_addressing(int tex_unit, TextureAddressing taddr) {
+	add_command(CMD_TEXTURE_ADDRESSING, tex_unit)->val[0] = taddr;
+}
+
+void CommandList::draw(const VertexArray &varray, const IndexArray &iarray) {
+	RenderCommand *cmd = add_command(CMD_DRAW);
+	cmd->ptr.varray = &varray;
+	cmd->iarray = &iarray;
+}
+
+void CommandList::draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+	RenderCommand *cmd = add_command(CMD_DRAW_INSTANCES);
+	cmd->ptr.varray = &varray;
+	cmd->iarray = &iarray;
+	cmd->val[0] = (int)matrices.size();
+	cmd->val[1] = count;
+	matrices.insert(matrices.end(), world, world + count);
+}
+
+void CommandList::render_object(Object *obj, unsigned long time) {
+	RenderCommand *cmd = add_command(CMD_RENDER_OBJECT);
+	cmd->ptr.obj = obj;
+	cmd->time = time;
+}
@@ -0,0 +1,113 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* recorded render command lists
+ *
+ * CommandList is a render backend which stores the calls made to it, to be
+ * replayed later on another backend. Lists can be recorded on any thread,
+ * only replaying them on the GL backend must happen on the GL thread.
+ * Whatever the commands point to (materials, textures, vertex and index
+ * arrays, objects, programs) must stay alive and unchanged until then.
+ */
+
+#ifndef _CMDLIST_HPP_
+#define _CMDLIST_HPP_
+
+#include <vector>
+#include "rstate.hpp"
+
+enum RenderCommandType {
+	CMD_ZWRITE,
+	CMD_BLENDING,
+	CMD_BLEND_FUNC,
+	CMD_SHADING,
+	CMD_WIREFRAME,
+	CMD_CULLING,
+	CMD_VERTEX_COLORS,
+	CMD_AUTO_NORMALIZE,
+	CMD_GFX_PROGRAM,
+	CMD_UPDATE_GFX_PROGRAM,
+	CMD_MATERIAL,
+	CMD_MATRIX,
+	CMD_TEXTURE,
+	CMD_TEXTURE_UNIT,
+	CMD_TEXTURE_STAGE,
+	CMD_TEXTURE_ADDRESSING,
+	CMD_DRAW,
+	CMD_DRAW_INSTANCES,
+	CMD_RENDER_OBJECT
+};
+
+struct RenderCommand {
+	int type;
+	int unit;		// texture unit, or matrix number for texture matrices
+	int val[2];		// state values, or the index (and count) of matrices or texture stage
+	union {
+		GfxProg *prog;
+		const Material *mat;
+		const Texture *tex;
+		const VertexArray *varray;
+		Object *obj;
+	} ptr;
+	const IndexArray *iarray;
+	unsigned long time;
+};
+
+class CommandList : public RenderBackend {
+private:
+	std::vector<RenderCommand> commands;
+	std::vector<Matrix4x4> matrices;
+	std::vector<TextureStage> stages;
+
+	RenderCommand *add_command(int type, int unit = 0);
+
+public:
+	// keeps the allocated memory for the next recording
+	void clear();
+
+	int get_command_count() const;
+	const RenderCommand *get_commands() const;
+
+	void replay(RenderBackend *backend) const;
+
+	virtual void set_zwrite(bool enable);
+	virtual void set_alpha_blending(bool enable);
+	virtual void set_blend_func(BlendingFactor src, BlendingFactor dest);
+	virtual void set_shading_mode(ShadeMode mode);
+	virtual void set_wireframe(bool enable);
+	virtual void set_backface_culling(bool enable);
+	virtual void use_vertex_colors(bool enable);
+	virtual void set_auto_normalize(bool enable);
+	virtual void set_gfx_program(GfxProg *prog);
+	virtual void update_gfx_program(GfxProg *prog);
+	virtual void set_material(const Material &mat);
+	virtual void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num = 0);
+
+	virtual void set_texture(int tex_unit, const Texture *tex);
+	virtual void enable_texture_unit(int tex_unit, bool enable);
+	virtual void set_texture_stage(int tex_unit, const TextureStage &stage);
+	virtual void set_texture_addressing(int tex_unit, TextureAddressing taddr);
+
+	virtual void draw(const VertexArray &varray, const IndexArray &iarray);
+	virtual void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count);
+	virtual void render_object(Object *obj, unsigned long time);
+};
+
+#endif	// _CMDLIST_HPP_
@@ -0,0 +1,348 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* frame sinks, where the FrameWriter puts the frames */
+
+#include "3dengfx_config.h"
+
+#include <cstring>
+#include <cerrno>
+#include "framesink.hpp"
+#include "gfx/color_bits.h"
+#include "common/err_msg.h"
+
+#if defined(unix) || defined(__unix__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif	// unix
+
+// unpacks a pixel as read back from the framebuffer into RGBA bytes
+static inline void unpack_pixel(uint32_t pix, unsigned char *rgba) {
+	rgba[0] = (pix >> RED_SHIFT32) & 0xff;
+	rgba[1] = (pix >> GREEN_SHIFT32) & 0xff;
+	rgba[2] = (pix >> BLUE_SHIFT32) & 0xff;
+	rgba[3] = (pix >> ALPHA_SHIFT32) & 0xff;
+}
+
+static void pixels_to_rgba(unsigned char *dest, const uint32_t *pixels, int count) {
+	for(int i=0; i<count; i++) {
+		unpack_pixel(*pixels++, dest);
+		dest += 4;
+	}
+}
+
+FrameSink::~FrameSink() {}
+
+bool FrameSink::ordered() const {
+	return false;
+}
+
+bool FrameSink::flush() {
+	return true;
+}
+
+
+// ---- numbered image files ----
+
+static const char *suffix[] = {"png", "jpg", "tga", "ppm"};
+
+ImageFrameSink::ImageFrameSink(const char *dir, const char *prefix, image_file_format fmt) {
+	this->dir = dir ? dir : "";
+	this->prefix = prefix;
+	this->fmt = fmt;
+}
+
+bool ImageFrameSink::open(int xsz, int ysz, int first_frame) {
+	if(dir.empty()) return true;
+
+#if defined(unix) || defined(__unix__)
+	struct stat sbuf;
+	if(stat(dir.c_str(), &sbuf) == -1 && mkdir(dir.c_str(), 0770) == -1) {
+		error("ImageFrameSink: failed to create directory %s: %s", dir.c_str(), strerror(errno));
+		return false;
+	}
+#endif	// unix
+	return true;
+}
+
+/* write_frame
+ * save_image() only needs the pixels, the rows are already top down (see
+ * FrameWriter::encode).
+ */
+bool ImageFrameSink::write_frame(const uint32_t *pixels, int xsz, int ysz, int frame) {
+	char fname[64];
+	sprintf(fname, "%04d.%s", frame, suffix[fmt]);
+
+	std::string path = dir.empty() ? prefix + fname : dir + "/" + prefix + fname;
+
+	if(save_image(path.c_str(), (void*)pixels, xsz, ysz, fmt) == -1) {
+		error("ImageFrameSink: failed to write %s", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+// ---- single file/pipe stream ----
+
+StreamFrameSink::StreamFrameSink(const char *fname, StreamFormat fmt, int fps) {
+	this->fname = fname;
+	this->fmt = fmt;
+	this->fps = fps;
+	fp = 0;
+	is_pipe = false;
+	xsz = ysz = 0;
+}
+
+StreamFrameSink::~StreamFrameSink() {
+	if(!fp) return;
+
+	if(fp == stdout) {
+		fflush(fp);
+#if defined(unix) || defined(__unix__)
+	} else if(is_pipe) {
+		pclose(fp);
+#endif	// unix
+	} else {
+		fclose(fp);
+	}
+}
+
+bool StreamFrameSink::open(int xsz, int ysz, int first_frame) {
+	if(fmt == STREAM_Y4M) {
+		xsz &= ~1;
+		ysz &= ~1;
+	}
+	this->xsz = xsz;
+	this->ysz = ysz;
+
+	if(fname == "-") {
+		fp = stdout;
+	} else if(fname[0] == '|') {
+#if defined(unix) || defined(__unix__)
+		fp = popen(fname.c_str() + 1, "w");
+		is_pipe = true;
+#else
+		error("StreamFrameSink: pipes are not supported on this platform");
+		return false;
+#endif	// unix
+	} else {
+		fp = fopen(fname.c_str(), "wb");
+	}
+
+	if(!fp) {
+		error("StreamFrameSink: failed to open %s: %s", fname.c_str(), strerror(errno));
+		return false;
+	}
+
+	if(fmt == STREAM_Y4M) {
+		fprintf(fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", xsz, ysz, fps);
+		buf.resize(6 + xsz * ysz * 3 / 2);
+		memcpy(&buf[0], "FRAME\n", 6);
+	} else {
+		buf.resize(xsz * ysz * 4);
+	}
+	return true;
+}
+
+bool StreamFrameSink::ordered() const {
+	return true;
+}
+
+/* write_frame
+ * The whole frame is converted into one buffer, and written with a single
+ * fwrite. Y4M uses the full range BT.601 (JPEG) conversion, with every
+ * chroma sample taken from the average of a 2x2 block.
+ */
+bool StreamFrameSink::write_frame(const uint32_t *pixels, int xsz, int ysz, int frame) {
+	if(!fp) return false;
+
+	if(fmt == STREAM_RGBA) {
+		if(xsz != this->xsz || ysz != this->ysz) {
+			error("StreamFrameSink: frame %d size changed, dropped", frame);
+			return false;
+		}
+		pixels_to_rgba(&buf[0], pixels, xsz * ysz);
+	} else {
+		if(xsz < this->xsz || ysz < this->ysz) {
+			error("StreamFrameSink: frame %d size changed, dropped", frame);
+			return false;
+		}
+		int pitch = xsz;
+		xsz = this->xsz;
+		ysz = this->ysz;
+
+		unsigned char *yptr = &buf[6];
+		unsigned char *uptr = yptr + xsz * ysz;
+		unsigned char *vptr = uptr + xsz * ysz / 4;
+
+		for(int i=0; i<ysz; i+=2) {
+			const uint32_t *row0 = pixels + i * pitch;
+			const uint32_t *row1 = row0 + pitch;
+
+			for(int j=0; j<xsz; j+=2) {
+				unsigned char px[4][4];
+				unpack_pixel(row0[j], px[0]);
+				unpack_pixel(row0[j + 1], px[1]);
+				unpack_pixel(row1[j], px[2]);
+				unpack_pixel(row1[j + 1], px[3]);
+
+				int rsum = 0, gsum = 0, bsum = 0;
+				for(int k=0; k<4; k++) {
+					int r = px[k][0], g = px[k][1], b = px[k][2];
+					int y = (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+					yptr[(k >> 1) * xsz + j + (k & 1)] = y;
+
+					rsum += r;
+					gsum += g;
+					bsum += b;
+				}
+
+				// the sums are of 4 pixels, hence the extra 2 bits of shift
+				int u = (-11059 * rsum - 21709 * gsum + 32768 * bsum + (128 << 18) + (1 << 17)) >> 18;
+				int v = (32768 * rsum - 27439 * gsum - 5329 * bsum + (128 << 18) + (1 << 17)) >> 18;
+				*uptr++ = u > 255 ? 255 : u;
+				*vptr++ = v > 255 ? 255 : v;
+			}
+			yptr += xsz * 2;
+		}
+	}
+
+	if(fwrite(&buf[0], 1, buf.size(), fp) != buf.size()) {
+		error("StreamFrameSink: failed to write frame %d: %s", frame, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool StreamFrameSink::flush() {
+	return fp && fflush(fp) == 0;
+}
+
+
+// ---- memory mapped frame store ----
+
+static void put_le32(unsigned char *ptr, uint32_t val) {
+	ptr[0] = val & 0xff;
+	ptr[1] = (val >> 8) & 0xff;
+	ptr[2] = (val >> 16) & 0xff;
+	ptr[3] = (val >> 24) & 0xff;
+}
+
+MappedFrameSink::MappedFrameSink(const char *fname, int max_frames) {
+	this->fname = fname;
+	this->max_frames = max_frames;
+	fd = -1;
+	map = 0;
+	map_size = frame_size = 0;
+	xsz = ysz = first_frame = 0;
+	frames_written = 0;
+	lock = thr_mutex_create();
+}
+
+MappedFrameSink::~MappedFrameSink() {
+#if defined(unix) || defined(__unix__)
+	if(map) {
+		flush();
+		munmap(map, map_size);
+	}
+	if(fd != -1) {
+		close(fd);
+	}
+#endif	// unix
+	thr_mutex_destroy(lock);
+}
+
+/* open
+ * the whole file is allocated up front, so writing the frames is nothing
+ * but copying them into the mapping, and the kernel writes the pages back
+ * in large chunks whenever it sees fit.
+ */
+bool MappedFrameSink::open(int xsz, int ysz, int first_frame) {
+#if defined(unix) || defined(__unix__)
+	this->xsz = xsz;
+	this->ysz = ysz;
+	this->first_frame = first_frame;
+	frame_size = xsz * ysz * 4;
+	map_size = FRAME_STORE_HDR_SIZE + frame_size * max_frames;
+
+	if((fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664)) == -1) {
+		error("MappedFrameSink: failed to open %s: %s", fname.c_str(), strerror(errno));
+		return false;
+	}
+	if(ftruncate(fd, map_size) == -1) {
+		error("MappedFrameSink: failed to allocate %lu bytes for %s: %s", (unsigned long)map_size,
+				fname.c_str(), strerror(errno));
+		return false;
+	}
+
+	void *ptr = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ptr == MAP_FAILED) {
+		error("MappedFrameSink: failed to map %s: %s", fname.c_str(), strerror(errno));
+		return false;
+	}
+	map = (unsigned char*)ptr;
+
+	memset(map, 0, FRAME_STORE_HDR_SIZE);
+	memcpy(map, FRAME_STORE_MAGIC, 8);
+	put_le32(map + 8, 1);
+	put_le32(map + 12, xsz);
+	put_le32(map + 16, ysz);
+	put_le32(map + 20, max_frames);
+	put_le32(map + 28, first_frame);
+	return true;
+#else
+	error("MappedFrameSink: memory mapped files are not supported on this platform");
+	return false;
+#endif	// unix
+}
+
+bool MappedFrameSink::write_frame(const uint32_t *pixels, int xsz, int ysz, int frame) {
+	int slot = frame - first_frame;
+
+	if(!map || slot < 0 || slot >= max_frames) {
+		error("MappedFrameSink: no slot for frame %d in %s", frame, fname.c_str());
+		return false;
+	}
+	if(xsz != this->xsz || ysz != this->ysz) {
+		error("MappedFrameSink: frame %d size changed, dropped", frame);
+		return false;
+	}
+
+	pixels_to_rgba(map + FRAME_STORE_HDR_SIZE + slot * frame_size, pixels, xsz * ysz);
+
+	// frames from different encoders, any order, only the count is shared
+	thr_mutex_lock(lock);
+	if(slot + 1 > frames_written) {
+		frames_written = slot + 1;
+	}
+	thr_mutex_unlock(lock);
+	return true;
+}
+
+bool MappedFrameSink::flush() {
+	if(!map) return false;
+
+	put_le32(map + 24, frames_written);
+	return true;
+}
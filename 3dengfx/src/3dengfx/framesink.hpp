@@ -0,0 +1,138 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* frame sinks, where the FrameWriter puts the frames
+ *
+ * - ImageFrameSink writes every frame to a numbered image file in a
+ *   directory (dir/prefix0000.tga ...).
+ * - StreamFrameSink writes all the frames to a single file, or a pipe,
+ *   as a YUV4MPEG2 (4:2:0) or a raw RGBA stream, one large write per frame.
+ * - MappedFrameSink writes raw RGBA frames into a preallocated, memory
+ *   mapped frame store file, every frame in its own slot (see below).
+ *
+ * None of them changes the working directory, relative paths are relative
+ * to it at the time the sink is created.
+ */
+
+#ifndef _FRAMESINK_HPP_
+#define _FRAMESINK_HPP_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common/types.h"
+#include "common/threads.h"
+#include "gfx/image.h"
+
+class FrameSink {
+public:
+	virtual ~FrameSink();
+
+	// called before the first frame, with its size and number
+	virtual bool open(int xsz, int ysz, int first_frame) = 0;
+
+	/* writes a frame (rows from the top), called from the encoder threads
+	 * with frames in any order, unless ordered() is true, in which case
+	 * it's called for one frame at a time, in order.
+	 */
+	virtual bool write_frame(const uint32_t *pixels, int xsz, int ysz, int frame) = 0;
+	virtual bool ordered() const;
+
+	// called when all the frames given so far are written
+	virtual bool flush();
+};
+
+class ImageFrameSink : public FrameSink {
+private:
+	std::string dir, prefix;
+	image_file_format fmt;
+
+public:
+	// the directory is created if it doesn't exist
+	ImageFrameSink(const char *dir, const char *prefix = "frame", image_file_format fmt = IMG_FMT_TGA);
+
+	virtual bool open(int xsz, int ysz, int first_frame);
+	virtual bool write_frame(const uint32_t *pixels, int xsz, int ysz, int frame);
+};
+
+enum StreamFormat {
+	STREAM_Y4M,		// YUV4MPEG2, 4:2:0 (C420jpeg), odd sizes are cropped to even
+	STREAM_RGBA		// headerless, RGBA bytes, frames one after the other
+};
+
+class StreamFrameSink : public FrameSink {
+private:
+	std::string fname;
+	StreamFormat fmt;
+	int fps;
+	FILE *fp;
+	bool is_pipe;
+	int xsz, ysz;
+	std::vector<unsigned char> buf;
+
+public:
+	/* fname "-" is the standard output, and "|command" a pipe to the
+	 * standard input of the command (unix only).
+	 */
+	StreamFrameSink(const char *fname, StreamFormat fmt = STREAM_Y4M, int fps = 25);
+	virtual ~StreamFrameSink();
+
+	virtual bool open(int xsz, int ysz, int first_frame);
+	virtual bool write_frame(const uint32_t *pixels, int xsz, int ysz, int frame);
+	virtual bool ordered() const;
+	virtual bool flush();
+};
+
+/* The frame store is a header followed by max_frames slots of xsz*ysz RGBA
+ * pixels. The header is a FrameStoreHeader, with all fields little endian.
+ */
+#define FRAME_STORE_MAGIC		"3DFSTORE"
+#define FRAME_STORE_HDR_SIZE	64
+
+struct FrameStoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t xsz, ysz;
+	uint32_t frame_count;		// slots in the file
+	uint32_t frames_written;	// highest slot written + 1, updated on flush
+	uint32_t first_frame;		// the frame number of the first slot
+};
+
+class MappedFrameSink : public FrameSink {
+private:
+	std::string fname;
+	int max_frames;
+	int fd;
+	unsigned char *map;
+	size_t map_size, frame_size;
+	int xsz, ysz, first_frame;
+	int frames_written;
+	thr_mutex *lock;
+
+public:
+	MappedFrameSink(const char *fname, int max_frames);
+	virtual ~MappedFrameSink();
+
+	virtual bool open(int xsz, int ysz, int first_frame);
+	virtual bool write_frame(const uint32_t *pixels, int xsz, int ysz, int frame);
+	virtual bool flush();
+};
+
+#endif	// _FRAMESINK_HPP_
@@ -0,0 +1,353 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* asynchronous frame writer for sequence rendering */
+
+#include "3dengfx_config.h"
+
+#include <cstdio>
+#include <cstring>
+#include "opengl.h"
+#include "framewriter.hpp"
+#include "3denginefx.hpp"
+#include "swrast.hpp"
+#include "common/err_msg.h"
+#include "common/profile.h"
+
+void *encoder_main(void *arg) {
+	FrameWriter *fw = (FrameWriter*)arg;
+	ntimer timer;
+
+	PROF_THREAD_NAME("frame encoder");
+
+	thr_mutex_lock(fw->lock);
+	for(;;) {
+		while(fw->queue_head == fw->queue.size() && !fw->quit) {
+			thr_cond_wait(fw->work_cond, fw->lock);
+		}
+		if(fw->queue_head == fw->queue.size()) break;	// quitting, and nothing left
+
+		int idx = fw->queue[fw->queue_head++];
+		if(fw->queue_head == fw->queue.size()) {
+			fw->queue.clear();
+			fw->queue_head = 0;
+		}
+		fw->busy++;
+		thr_mutex_unlock(fw->lock);
+
+		timer_reset(&timer);
+		timer_start(&timer);
+		bool res = fw->encode(&fw->frames[idx]);
+		unsigned long msec = timer_getmsec(&timer);
+
+		thr_mutex_lock(fw->lock);
+		fw->stats.encode_msec += msec;
+		if(!res) fw->stats.failed++;
+		fw->free_frames.push_back(idx);
+		thr_cond_signal(fw->free_cond);
+
+		if(--fw->busy == 0 && fw->queue_head == fw->queue.size()) {
+			thr_cond_broadcast(fw->idle_cond);
+		}
+	}
+	thr_mutex_unlock(fw->lock);
+	return 0;
+}
+
+FrameWriter::FrameWriter(FrameSink *sink, int encoders, int queue_len) {
+	this->sink = sink;
+	sink_open = sink_failed = false;
+	next_frame = 0;
+
+	if(!thr_threads_available()) {
+		encoders = 0;	// encoded right away in submit()
+	} else if(encoders <= 0) {
+		encoders = thr_num_processors();
+	}
+	if(sink->ordered() && encoders > 1) {
+		encoders = 1;	// the queue is FIFO, so one thread keeps the order
+	}
+	if(queue_len <= 0) queue_len = encoders + 1;
+
+	frames.resize(queue_len);
+	for(int i=0; i<queue_len; i++) {
+		frames[i].pixels = 0;
+		frames[i].xsz = frames[i].ysz = 0;
+		free_frames.push_back(i);
+	}
+	queue_head = 0;
+	current = -1;
+	busy = 0;
+
+	memset(&stats, 0, sizeof stats);
+	started = false;
+
+	lock = thr_mutex_create();
+	work_cond = thr_cond_create();
+	free_cond = thr_cond_create();
+	idle_cond = thr_cond_create();
+	quit = false;
+
+	for(int i=0; i<encoders; i++) {
+		thr_thread *thr = thr_create(encoder_main, this);
+		if(!thr) break;
+		this->encoders.push_back(thr);
+	}
+
+	use_pbo = get_system_capabilities().pixel_buffers;
+	pbo[0] = pbo[1] = 0;
+	pbo_pending[0] = pbo_pending[1] = false;
+	pbo_xsz = pbo_ysz = 0;
+	pbo_idx = 0;
+}
+
+FrameWriter::~FrameWriter() {
+	finish();
+
+	thr_mutex_lock(lock);
+	quit = true;
+	thr_cond_broadcast(work_cond);
+	thr_mutex_unlock(lock);
+
+	for(size_t i=0; i<encoders.size(); i++) {
+		thr_join(encoders[i]);
+	}
+
+	for(size_t i=0; i<frames.size(); i++) {
+		delete [] frames[i].pixels;
+	}
+
+	if(pbo[0]) {
+		glext::glDeleteBuffers(2, pbo);
+	}
+
+	thr_cond_destroy(idle_cond);
+	thr_cond_destroy(free_cond);
+	thr_cond_destroy(work_cond);
+	thr_mutex_destroy(lock);
+}
+
+void FrameWriter::set_frame_number(int frame) {
+	next_frame = frame;
+}
+
+int FrameWriter::get_frame_number() const {
+	return next_frame;
+}
+
+/* capture
+ * with PBOs, glReadPixels returns right away, and by the next call the
+ * transfer of the previous frame has long finished, so mapping its buffer
+ * doesn't stall the pipeline.
+ */
+void FrameWriter::capture() {
+	const GraphicsInitParameters *gip = get_graphics_init_parameters();
+	int x = gip->x;
+	int y = gip->y;
+
+	if(!use_pbo) {
+		uint32_t *pixels = get_buffer(x, y);
+		if(SoftRaster *swr = get_soft_context()) {
+			swr->read_pixels(pixels);
+		} else {
+			glReadPixels(0, 0, x, y, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+		}
+		submit(true);
+		return;
+	}
+
+	if(!pbo[0]) {
+		glext::glGenBuffers(2, pbo);
+	}
+	if(x != pbo_xsz || y != pbo_ysz) {
+		finish();	// anything read at the old size
+		for(int i=0; i<2; i++) {
+			glext::glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo[i]);
+			glext::glBufferData(GL_PIXEL_PACK_BUFFER_ARB, x * y * 4, 0, GL_STREAM_READ_ARB);
+		}
+		pbo_xsz = x;
+		pbo_ysz = y;
+	}
+
+	glext::glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo[pbo_idx]);
+	glReadPixels(0, 0, x, y, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	pbo_pending[pbo_idx] = true;
+	glext::glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	pbo_idx ^= 1;
+	if(pbo_pending[pbo_idx]) {
+		read_pbo(pbo_idx);
+	}
+}
+
+void FrameWriter::read_pbo(int idx) {
+	uint32_t *pixels = get_buffer(pbo_xsz, pbo_ysz);
+
+	glext::glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pbo[idx]);
+	void *src = glext::glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+	if(src) {
+		memcpy(pixels, src, pbo_xsz * pbo_ysz * 4);
+		glext::glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+	} else {
+		error("FrameWriter: failed to map the pixel buffer, frame %d will be blank", next_frame);
+		memset(pixels, 0, pbo_xsz * pbo_ysz * 4);
+	}
+	glext::glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	pbo_pending[idx] = false;
+	submit(true);
+}
+
+uint32_t *FrameWriter::get_buffer(int xsz, int ysz) {
+	if(!started) {
+		timer_reset(&wall_timer);
+		timer_start(&wall_timer);
+		started = true;
+	}
+
+	thr_mutex_lock(lock);
+	if(free_frames.empty()) {
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+
+		while(free_frames.empty()) {
+			thr_cond_wait(free_cond, lock);
+		}
+		stats.stalls++;
+		stats.stall_msec += timer_getmsec(&timer);
+	}
+	current = free_frames.back();
+	free_frames.pop_back();
+	thr_mutex_unlock(lock);
+
+	WriterFrame *wf = &frames[current];
+	if(wf->xsz * wf->ysz != xsz * ysz) {
+		delete [] wf->pixels;
+		wf->pixels = new uint32_t[xsz * ysz];
+	}
+	wf->xsz = xsz;
+	wf->ysz = ysz;
+	return wf->pixels;
+}
+
+void FrameWriter::submit(bool bottom_up) {
+	if(current == -1) return;
+
+	WriterFrame *wf = &frames[current];
+	wf->bottom_up = bottom_up;
+	wf->frame = next_frame++;
+	stats.frames++;
+	stats.pixel_bytes += wf->xsz * wf->ysz * 4;
+
+	// the sink is opened here, before any encoder can get to it
+	if(!sink_open) {
+		sink_open = true;
+		if(!sink->open(wf->xsz, wf->ysz, wf->frame)) {
+			error("FrameWriter: failed to open the frame sink, no frames will be written");
+			sink_failed = true;
+		}
+	}
+
+	if(encoders.empty()) {
+		ntimer timer;
+		timer_reset(&timer);
+		timer_start(&timer);
+		if(!encode(wf)) stats.failed++;
+		stats.encode_msec += timer_getmsec(&timer);
+
+		free_frames.push_back(current);
+		current = -1;
+		return;
+	}
+
+	thr_mutex_lock(lock);
+	queue.push_back(current);
+	thr_cond_signal(work_cond);
+	thr_mutex_unlock(lock);
+	current = -1;
+}
+
+/* encode
+ * called from the encoder threads, touches nothing but the frame and the
+ * sink. The rows are flipped here, instead of with IMG_SAVE_INVERT, as the
+ * save flags are shared by everyone calling save_image().
+ */
+bool FrameWriter::encode(WriterFrame *wf) {
+	if(sink_failed) return false;
+	PROF_SCOPE("FrameWriter::encode");
+
+	if(wf->bottom_up) {
+		uint32_t *top = wf->pixels;
+		uint32_t *bot = wf->pixels + (wf->ysz - 1) * wf->xsz;
+
+		while(top < bot) {
+			for(int i=0; i<wf->xsz; i++) {
+				uint32_t tmp = top[i];
+				top[i] = bot[i];
+				bot[i] = tmp;
+			}
+			top += wf->xsz;
+			bot -= wf->xsz;
+		}
+	}
+
+	return sink->write_frame(wf->pixels, wf->xsz, wf->ysz, wf->frame);
+}
+
+void FrameWriter::finish() {
+	for(int i=0; i<2; i++) {
+		int idx = pbo_idx ^ i;		// the older one first
+		if(pbo_pending[idx]) {
+			read_pbo(idx);
+		}
+	}
+
+	thr_mutex_lock(lock);
+	while(queue_head < queue.size() || busy) {
+		thr_cond_wait(idle_cond, lock);
+	}
+	thr_mutex_unlock(lock);
+
+	if(sink_open && !sink_failed && !sink->flush()) {
+		error("FrameWriter: failed to flush the frame sink");
+	}
+
+	if(started) {
+		stats.wall_msec = timer_getmsec(&wall_timer);
+	}
+}
+
+const FrameWriterStats *FrameWriter::get_stats() const {
+	return &stats;
+}
+
+void FrameWriter::print_stats() const {
+	float sec = stats.wall_msec / 1000.0f;
+	float enc_sec = stats.encode_msec / 1000.0f;
+	float mbytes = stats.pixel_bytes / (1024.0f * 1024.0f);
+
+	info("FrameWriter: %lu frames (%lu failed) in %.2f sec, %d encoder threads", stats.frames, stats.failed,
+			sec, (int)encoders.size());
+	info("  %.1f frames/sec, %.1f MB/sec, %.1f msec encoding per frame", sec > 0.0 ? stats.frames / sec : 0.0,
+			sec > 0.0 ? mbytes / sec : 0.0, stats.frames ? stats.encode_msec / (float)stats.frames : 0.0);
+	info("  waited for the encoders %lu times, %.2f sec (%.2f sec of encoding in total)", stats.stalls,
+			stats.stall_msec / 1000.0f, enc_sec);
+}
@@ -0,0 +1,130 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* asynchronous frame writer for sequence rendering
+ *
+ * Frames are read back from the framebuffer into a fixed set of buffers,
+ * and handed to a FrameSink (numbered image files, a video stream, a frame
+ * store, see framesink.hpp) by a set of encoder threads, while the next
+ * frames are being rendered. Sinks which need the frames in order get a
+ * single encoder thread.
+ * When all buffers are waiting to be encoded, capture() waits for one to
+ * become free, so rendering never runs further ahead of the encoders than
+ * the buffers allow.
+ *
+ * With pixel buffer objects the readback itself is asynchronous too: every
+ * capture() starts reading the current frame into one of two PBOs, and
+ * queues the frame read into the other one during the previous call. So a
+ * frame is queued one capture() late, and finish() queues the last one.
+ * Without them, the frame is read into a buffer with glReadPixels.
+ *
+ * Pixels can also be handed to the writer directly (get_buffer/submit),
+ * without any graphics context.
+ */
+
+#ifndef _FRAMEWRITER_HPP_
+#define _FRAMEWRITER_HPP_
+
+#include <vector>
+#include "framesink.hpp"
+#include "common/types.h"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "gfx/image.h"
+
+struct FrameWriterStats {
+	unsigned long frames, failed;
+	unsigned long pixel_bytes;		// uncompressed size of the frames written
+	unsigned long encode_msec;		// summed over all the encoder threads
+	unsigned long wall_msec;		// from the first frame to finish()
+	unsigned long stalls;			// times capture/get_buffer had to wait for a buffer
+	unsigned long stall_msec;
+};
+
+struct WriterFrame {
+	uint32_t *pixels;
+	int xsz, ysz;
+	int frame;
+	bool bottom_up;
+};
+
+class FrameWriter {
+private:
+	FrameSink *sink;
+	bool sink_open, sink_failed;
+	int next_frame;
+
+	std::vector<WriterFrame> frames;
+	std::vector<int> free_frames, queue;	// indices in frames, queue is FIFO
+	size_t queue_head;
+	int current;		// from get_buffer() to submit()
+	int busy;			// frames being encoded
+
+	std::vector<thr_thread*> encoders;
+	thr_mutex *lock;
+	thr_cond *work_cond, *free_cond, *idle_cond;
+	bool quit;
+
+	FrameWriterStats stats;
+	ntimer wall_timer;
+	bool started;
+
+	// asynchronous readback
+	bool use_pbo;
+	unsigned int pbo[2];
+	bool pbo_pending[2];
+	int pbo_xsz, pbo_ysz, pbo_idx;
+
+	void read_pbo(int idx);
+	bool encode(WriterFrame *wf);
+
+	friend void *encoder_main(void *arg);
+
+public:
+	/* encoders 0 means one per processor, queue_len 0 one buffer more than
+	 * the encoders, so that one frame can be captured while they all work.
+	 * The sink is not deleted by the writer, and must outlive it.
+	 */
+	FrameWriter(FrameSink *sink, int encoders = 0, int queue_len = 0);
+	~FrameWriter();
+
+	// the number of the next frame to be queued
+	void set_frame_number(int frame);
+	int get_frame_number() const;
+
+	// reads back the whole framebuffer and queues it (see the top of the file)
+	void capture();
+
+	/* returns a free buffer for a frame of the given size, waiting if all
+	 * of them are queued, to be filled and queued with submit().
+	 */
+	uint32_t *get_buffer(int xsz, int ysz);
+	// bottom_up: the rows start at the bottom, as read from OpenGL
+	void submit(bool bottom_up = false);
+
+	// queues any pending readback, waits until every frame is written, and flushes the sink
+	void finish();
+
+	const FrameWriterStats *get_stats() const;
+	// logs the encoding throughput
+	void print_stats() const;
+};
+
+#endif	// _FRAMEWRITER_HPP_
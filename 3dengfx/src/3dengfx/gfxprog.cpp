@@ -189,3 +189,9 @@ bool GfxProg::set_parameter(const char *pname, const Matrix4x4 &val) {
 void GfxProg::set_update_handler(void (*func)(GfxProg*)) {
 	update_handler = func;
 }
+
+void GfxProg::update() {
+	if(linked && update_handler) {
+		update_handler(this);
+	}
+}
@@ -62,6 +62,8 @@ public:
 	bool set_parameter(const char *pname, const Matrix4x4 &val);
 
 	void set_update_handler(void (*func)(GfxProg*));
+	// calls the update handler, if any, as set_gfx_program() does
+	void update();
 
 	friend void set_gfx_program(GfxProg *prog);
 };
@@ -29,7 +29,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <float.h>
 #include "3dengfx_config.h"
 #include "gfx/curves.hpp"
+#include "gfx/tessel.hpp"
 #include "ggen.hpp"
+#include "terrain.hpp"
 
 #define GGEN_SOURCE
 #include "teapot.h"
@@ -129,11 +131,9 @@ void create_plane(TriMesh *mesh, const Vector3 &normal, const Vector2 &size, int
 		varray[i].normal.transform(rot);
 	}
 
-	mesh->set_data(varray, vcount, tarray, tcount);
+	mesh->adopt_data(varray, vcount, tarray, tcount);
 
 	delete [] quads;
-	delete [] varray;
-	delete [] tarray;
 }
 
 /* CreateCylinder - (JT)
@@ -230,10 +230,7 @@ void create_cylinder(TriMesh *mesh, scalar_t rad, scalar_t len, bool caps, int u
 		}		
 	}
 	
-	mesh->set_data(verts, vcount, triangles, tcount);
-
-	delete [] verts;
-	delete [] triangles;
+	mesh->adopt_data(verts, vcount, triangles, tcount);
 }
 
 /* CreateSphere - (MG)
@@ -301,11 +298,9 @@ void create_sphere(TriMesh *mesh, scalar_t radius, int subdiv) {
 		tarray[i * 2 + 1] = Triangle(quads[i].vertices[0], quads[i].vertices[3], quads[i].vertices[2]);
 	}
 
-	mesh->set_data(varray, vcount, tarray, tcount);
+	mesh->adopt_data(varray, vcount, tarray, tcount);
 
 	delete [] quads;
-	delete [] varray;
-	delete [] tarray;
 }
 
 /* CreateTorus - (MG)
@@ -384,12 +379,10 @@ void create_torus(TriMesh *mesh, scalar_t circle_rad, scalar_t revolv_rad, int s
 		tarray[i * 2 + 1] = Triangle(qarray[i].vertices[0], qarray[i].vertices[3], qarray[i].vertices[2]);
 	}
 
-	mesh->set_data(varray, vcount, tarray, tcount);
+	mesh->adopt_data(varray, vcount, tarray, tcount);
 	
 	// cleanup
-	delete [] varray;
 	delete [] qarray;
-	delete [] tarray;
 	delete [] circle;
 }
 
@@ -464,9 +457,7 @@ void create_revolution(TriMesh *mesh, const Curve &curve, int udiv, int vdiv) {
 		}
 	}
 
-	mesh->set_data(varray, vcount, tarray, tcount);
-	delete [] varray;
-	delete [] tarray;
+	mesh->adopt_data(varray, vcount, tarray, tcount);
 	delete [] slice;
 	delete [] slice_normal;
 }
@@ -532,11 +523,8 @@ void create_extrusion(TriMesh *mesh, const Curve &shape, const Curve &path, int
 		v++;
 	}
 
-	mesh->set_data(verts, vcount, triangles, tcount);
+	mesh->adopt_data(verts, vcount, triangles, tcount);
 	mesh->calculate_normals();
-
-	delete [] verts;
-	delete [] triangles;
 }
 
 /* CreateBezierPatch - (MG)
@@ -545,117 +533,11 @@ void create_extrusion(TriMesh *mesh, const Curve &shape, const Curve &path, int
  */
 void create_bezier_patch(TriMesh *mesh, const Vector3 *cp, int subdiv)
 {
+	static const unsigned int patch[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
-	// make 8 BezierSpline's
-	BezierSpline u[4], v[4];
-
-	u[0].add_control_point(cp[0]);
-	u[0].add_control_point(cp[1]);
-	u[0].add_control_point(cp[2]);	
-	u[0].add_control_point(cp[3]);
-	
-	u[1].add_control_point(cp[4]);
-	u[1].add_control_point(cp[5]);
-	u[1].add_control_point(cp[6]);	
-	u[1].add_control_point(cp[7]);
-	
-	u[2].add_control_point(cp[8]);
-	u[2].add_control_point(cp[9]);
-	u[2].add_control_point(cp[10]);	
-	u[2].add_control_point(cp[11]);
-	
-	u[3].add_control_point(cp[12]);
-	u[3].add_control_point(cp[13]);
-	u[3].add_control_point(cp[14]);	
-	u[3].add_control_point(cp[15]);
-
-	v[0].add_control_point(cp[0]);
-	v[0].add_control_point(cp[4]);
-	v[0].add_control_point(cp[8]);	
-	v[0].add_control_point(cp[12]);
-	
-	v[1].add_control_point(cp[1]);
-	v[1].add_control_point(cp[5]);
-	v[1].add_control_point(cp[9]);	
-	v[1].add_control_point(cp[13]);
-	
-	v[2].add_control_point(cp[2]);
-	v[2].add_control_point(cp[6]);
-	v[2].add_control_point(cp[10]);	
-	v[2].add_control_point(cp[14]);
-
-	v[3].add_control_point(cp[3]);
-	v[3].add_control_point(cp[7]);
-	v[3].add_control_point(cp[11]);	
-	v[3].add_control_point(cp[15]);
-
-	unsigned long edges = subdiv * 2;
-	unsigned long vrow = edges + 1;
-	unsigned long qcount = edges * edges;
-	unsigned long vcount = vrow * vrow;
-	unsigned long tcount = qcount * 2;
-
-	// allocate memory
-	Vertex *varray = new Vertex[vcount];
-	Quad *qarray = new Quad[qcount];
-	Triangle *tarray = new Triangle[tcount];
-
-	// Vertex loop
-	for (unsigned long j=0; j<vrow; j++)
-	{
-		scalar_t tv = (scalar_t)j / (scalar_t)(vrow - 1);
-		BezierSpline uc;
-		uc.add_control_point(v[0].interpolate(tv));
-		uc.add_control_point(v[1].interpolate(tv));
-		uc.add_control_point(v[2].interpolate(tv));
-		uc.add_control_point(v[3].interpolate(tv));
-		
-		for (unsigned long i=0; i<vrow; i++)
-		{
-			scalar_t tu = (scalar_t)i / (scalar_t)(vrow - 1);
-			BezierSpline vc;
-			vc.add_control_point(u[0].interpolate(tu));
-			vc.add_control_point(u[1].interpolate(tu));
-			vc.add_control_point(u[2].interpolate(tu));
-			vc.add_control_point(u[3].interpolate(tu));
-
-			// get the position
-			Vector3 pos = uc.interpolate(tu);
-
-			// get normal
-			Vector3 tan_u,tan_v;
-			tan_u = uc.get_tangent(tu);
-			tan_v = vc.get_tangent(tv);
-			Vector3 normal;
-			normal = cross_product(tan_u, tan_v);
-			normal.normalize();
-
-			// store vertex
-			varray[i + j * vrow] = Vertex(pos, tu, 1.0 - tv, Color(1.0f));
-			varray[i + j * vrow].normal = normal;
-		}
-	} // end vertex loop
-
-	
-	// first seperate the quads and then triangulate
-	for(unsigned long i=0; i<qcount; i++) {
-		qarray[i].vertices[0] = i + i / edges;
-		qarray[i].vertices[1] = qarray[i].vertices[0] + 1;
-		qarray[i].vertices[2] = qarray[i].vertices[0] + vrow;
-		qarray[i].vertices[3] = qarray[i].vertices[1] + vrow;
-	}
-
-	for(unsigned long i=0; i<qcount; i++) {
-		tarray[i * 2] = Triangle(qarray[i].vertices[0], qarray[i].vertices[1], qarray[i].vertices[3]);
-		tarray[i * 2 + 1] = Triangle(qarray[i].vertices[0], qarray[i].vertices[3], qarray[i].vertices[2]);
-	}
-
-	mesh->set_data(varray, vcount, tarray, tcount);
-	
-	// cleanup
-	delete [] varray;
-	delete [] qarray;
-	delete [] tarray;
+	PatchSet pset;
+	pset.set_data(cp, 16, patch, 1);
+	tessellate_patches(&pset, uniform_tess_params(subdiv * 2), mesh);
 }
 
 /* CreateBezierPatch - (MG)
@@ -711,24 +593,18 @@ void create_bezier_patch(TriMesh *mesh, const BezierSpline &u0, const BezierSpli
 /* CreateBezierMesh - (MG)
  * tesselates a whole mesh of bezier patches.
  * usefull when some patches share vertices
- * TODO : Make a bezier patch class , like Triangle
- * and Quad. Store indices
+ * the patches are tessellated in parallel, see tessel.hpp
  */
 void create_bezier_mesh(TriMesh *mesh, const Vector3 *cp, unsigned int *patches, int patch_count, int subdiv)
 {
-	TriMesh tmp_mesh;
-	Vector3 control_pts[16];
-	for(int i=0; i<patch_count; i++)
-	{
-		for(int j=0; j<16; j++)
-		{
-			control_pts[j] = cp[ patches[16 * i + j] ];
-		}
-
-		create_bezier_patch(&tmp_mesh, control_pts, subdiv);
-
-		join_tri_mesh(mesh, mesh, &tmp_mesh);
+	unsigned int cp_count = 0;
+	for(int i=0; i<patch_count * 16; i++) {
+		if(patches[i] >= cp_count) cp_count = patches[i] + 1;
 	}
+
+	PatchSet pset;
+	pset.set_data(cp, cp_count, patches, patch_count);
+	tessellate_patches(&pset, uniform_tess_params(subdiv * 2), mesh);
 }
 
 /* CreateTeapot - (MG)
@@ -786,71 +662,29 @@ void create_teapot(TriMesh *mesh, scalar_t size, int subdiv)
 // fractal stuff ...
 
 /* create_landscape (JT)
- * Creates a fractal landscape... (TODO: add algorithm description or something)
+ * Creates a fractal landscape by fault formation (see gen_fault_heightfield
+ * in terrain.hpp), on a plane of (mesh_detail + 2)^2 vertices.
  */
 void create_landscape(TriMesh *mesh, const Vector2 &size, int mesh_detail, scalar_t max_height, int iter, scalar_t roughness, int seed) {
 	create_plane(mesh, Vector3(0, 1, 0), size, mesh_detail);
-	roughness *= 0.25;
 
-	if(seed == GGEN_RANDOM_SEED) {
-		srand(time(0));
-	} else if(seed != GGEN_NO_RESEED) {
-		srand(seed);
-	}
+	int samples = mesh_detail + 2;
+	HeightField hf;
+	gen_fault_heightfield(&hf, samples, samples, size, max_height, iter, roughness, seed);
 
-	scalar_t offs = max_height / (scalar_t)iter;
+	scalar_t dx = size.x / (scalar_t)(samples - 1);
+	scalar_t dz = size.y / (scalar_t)(samples - 1);
 
 	unsigned long vcount = mesh->get_vertex_array()->get_count();
 	Vertex *varray = mesh->get_mod_vertex_array()->get_mod_data();
 
-	for(int i=0; i<iter; i++) {
-		// pick a partitioning line (2d)
-		Vector2 pt1(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
-		Vector2 pt2(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
-
-		// find its normal
-		Vector2 normal(pt2.y - pt1.y, pt1.x - pt2.x);
-
-		// classify all points wrt. this line and raise them accordingly.
-		for(unsigned long j=0; j<vcount; j++) {
-			Vector3 *vpos = &varray[j].pos;
-			Vector2 vpos2d(vpos->x, vpos->z);
-			
-			scalar_t dist = dist_line(pt1, pt2, vpos2d);
-			
-			/* this was considered but it was producing extremely smooth
-			 * results, which looked unnatural.
-			 */
-			/* 
-			if(dot_product(normal, vpos2d - pt1) < 0.0) {
-				dist = -dist;
-			}
-			scalar_t sigmoid = (tanh(dist * size.x * size.y * roughness) + 1.0) * 0.5;
-			vpos->y += offs * sigmoid;
-			*/
-
-			if(dot_product(normal, vpos2d - pt1) > 0.0) {
-				scalar_t sigmoid = tanh(dist * size.x * size.y * roughness);
-				vpos->y += offs * sigmoid;
-			}
-		}
-	}
-
-	// normalize the landscape in the range [0, max_height)
-	scalar_t hmin = FLT_MAX, hmax = 0.0;
-	Vertex *vptr = varray;
-
+	// the plane vertices fall on the samples, whatever their order
 	for(unsigned long i=0; i<vcount; i++) {
-		if(vptr->pos.y > hmax) hmax = vptr->pos.y;
-		if(vptr->pos.y < hmin) hmin = vptr->pos.y;
-		vptr++;
-	}
+		Vector3 *vpos = &varray[i].pos;
+		int x = (int)floor((vpos->x + size.x / 2.0) / dx + 0.5);
+		int z = (int)floor((vpos->z + size.y / 2.0) / dz + 0.5);
 
-	vptr = varray;
-	for(unsigned long i=0; i<vcount; i++) {
-		vptr->pos.y = max_height * (vptr->pos.y - hmin) / (hmax - hmin);
-		vptr++;
+		vpos->y = hf.get(x, z);
+		varray[i].normal = hf.get_normal(x, z, dx, dz);
 	}
-
-	mesh->calculate_normals();
 }
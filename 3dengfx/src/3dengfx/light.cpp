@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "3denginefx.hpp"
 #include "opengl.h"
 #include "light.hpp"
+#include "swrast.hpp"
 
 Light::Light() {
 	ambient_color = Color(0, 0, 0);
@@ -121,11 +122,8 @@ void PointLight::set_gl_light(int n, unsigned long time) const {
 		pos = (Vector4)get_prs(time).position;
 	}
 	
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
 	Matrix4x4 test = engfx_state::view_matrix;
 	test.translate(pos);
-	load_matrix_gl(test);
 
 	Color amb = ambient_color * intensity;
 	Color dif = diffuse_color * intensity;
@@ -135,6 +133,18 @@ void PointLight::set_gl_light(int n, unsigned long time) const {
 	float gl_amb[] = {amb.r, amb.g, amb.b, ambient_color.a};
 	float gl_dif[] = {dif.r, dif.g, dif.b, diffuse_color.a};
 	float gl_spec[] = {spec.r, spec.g, spec.b, specular_color.a};
+
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->set_light(n, position, test, gl_amb, gl_dif, gl_spec);
+		swr->set_light_attenuation(n, attenuation[0], attenuation[1], attenuation[2]);
+		swr->enable_light(n, true);
+		if(!engfx_state::bump_light) set_bump_light(this);
+		return;
+	}
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	load_matrix_gl(test);
 	
 	glLightfv(light_num, GL_POSITION, position);
 	glLightfv(light_num, GL_AMBIENT, gl_amb);
@@ -162,7 +172,7 @@ DirLight::DirLight(const Vector3 &dir, const Color &col) {
 
 DirLight::~DirLight() {}
 
-Vector3 DirLight::get_direction()
+Vector3 DirLight::get_direction() const
 {
 	return dir;
 }
@@ -172,10 +182,7 @@ void DirLight::set_gl_light(int n, unsigned long time) const {
 	
 	Vector3 ldir = dir.transformed(get_prs(time).rotation);
 	
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
 	Matrix4x4 test = engfx_state::view_matrix;
-	load_matrix_gl(test);
 
 	Color amb = ambient_color * intensity;
 	Color dif = diffuse_color * intensity;
@@ -185,6 +192,17 @@ void DirLight::set_gl_light(int n, unsigned long time) const {
 	float gl_amb[] = {amb.r, amb.g, amb.b, ambient_color.a};
 	float gl_dif[] = {dif.r, dif.g, dif.b, diffuse_color.a};
 	float gl_spec[] = {spec.r, spec.g, spec.b, specular_color.a};
+
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->set_light(n, position, test, gl_amb, gl_dif, gl_spec);
+		swr->enable_light(n, true);
+		if(!engfx_state::bump_light) set_bump_light(this);
+		return;
+	}
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	load_matrix_gl(test);
 	
 	glLightfv(light_num, GL_POSITION, position);
 	glLightfv(light_num, GL_AMBIENT, gl_amb);
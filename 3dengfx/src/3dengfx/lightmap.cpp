@@ -0,0 +1,778 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* lightmap baking for static objects */
+
+#include "3dengfx_config.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <algorithm>
+#include "lightmap.hpp"
+#include "3dscene.hpp"
+#include "object.hpp"
+#include "light.hpp"
+#include "material.hpp"
+#include "textures.hpp"
+#include "texman.hpp"
+#include "gfx/rtrace.hpp"
+#include "gfx/img_manip.hpp"
+#include "gfx/image.h"
+#include "common/threads.h"
+#include "common/timer.h"
+#include "common/err_msg.h"
+#include "common/profile.h"
+
+#define CHUNK_TEXELS	64		// texels per task of the worker threads
+#define MAX_SHRINK		16		// times to lower the density of objects that don't fit
+
+using std::min;
+using std::max;
+
+LightmapParams::LightmapParams() {
+	texel_density = 8.0;
+	max_size = 512;
+	padding = 2;
+	direct = true;
+	ao_samples = 32;
+	ao_distance = 4.0;
+	dilate_passes = 4;
+	disable_shadow_casting = true;
+	save_dir = 0;
+	time = 0;
+}
+
+/* the lightmaps made by the baker, by the name they are managed under, so
+ * that those gone with destroy_textures aren't mistaken for their own.
+ * Only these are replaced and freed by later bakes, lightmaps set by the
+ * user are left alone.
+ */
+static std::map<Texture*, std::string> baked_maps;
+static unsigned long kept_maps;
+
+static bool is_baked_map(Texture *tex) {
+	std::map<Texture*, std::string>::iterator iter = baked_maps.find(tex);
+	if(iter == baked_maps.end()) return false;
+
+	if(find_texture(iter->second.c_str()) != tex) {
+		baked_maps.erase(iter);
+		return false;
+	}
+	return true;
+}
+
+// ------- lightmap coordinates -------
+
+struct Chart {
+	int axis;						// 0 - 5, the major axis of the normals and its sign
+	std::vector<int> tris;
+	scalar_t umin, vmin, umax, vmax;	// projected bounds in world units
+	int x, y, w, h;					// rectangle in the lightmap, with the padding
+};
+
+static bool chart_taller(const Chart *a, const Chart *b) {
+	return a->h > b->h;
+}
+
+static inline int major_axis(const Vector3 &n) {
+	scalar_t ax = fabs(n.x), ay = fabs(n.y), az = fabs(n.z);
+	if(ax >= ay && ax >= az) return n.x >= 0.0 ? 0 : 1;
+	if(ay >= az) return n.y >= 0.0 ? 2 : 3;
+	return n.z >= 0.0 ? 4 : 5;
+}
+
+// the 2 coordinates of the plane perpendicular to the axis
+static inline void project(const Vector3 &p, int axis, scalar_t *u, scalar_t *v) {
+	switch(axis / 2) {
+	case 0:
+		*u = p.z;
+		*v = p.y;
+		break;
+	case 1:
+		*u = p.x;
+		*v = p.z;
+		break;
+	default:
+		*u = p.x;
+		*v = p.y;
+	}
+}
+
+static inline int next_pow2(int x) {
+	int p = 1;
+	while(p < x) p <<= 1;
+	return p;
+}
+
+/* pack - shelf packing of the chart rectangles, tallest first
+ * the charts must be sorted by height.
+ */
+static bool pack(const std::vector<Chart*> &charts, int size) {
+	int x = 0, y = 0, shelf_height = 0;
+
+	for(size_t i=0; i<charts.size(); i++) {
+		Chart *c = charts[i];
+		if(c->w > size) return false;
+
+		if(x + c->w > size) {
+			x = 0;
+			y += shelf_height;
+			shelf_height = 0;
+		}
+		if(y + c->h > size) return false;
+
+		c->x = x;
+		c->y = y;
+		x += c->w;
+		shelf_height = max(shelf_height, c->h);
+	}
+	return true;
+}
+
+int generate_lightmap_coords(TriMesh *mesh, const Matrix4x4 &xform, scalar_t texel_density,
+		int max_size, int padding, int *charts_ret) {
+	PROF_SCOPE("generate_lightmap_coords");
+
+	const Vertex *varr = mesh->get_vertex_array()->get_data();
+	unsigned long vcount = mesh->get_vertex_array()->get_count();
+	const Triangle *tarr = mesh->get_triangle_array()->get_data();
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	if(!vcount || !tcount || texel_density <= 0.0) return 0;
+
+	std::vector<Vector3> wpos(vcount);
+	for(unsigned long i=0; i<vcount; i++) {
+		wpos[i] = varr[i].pos.transformed(xform);
+	}
+
+	// the triangles around each vertex
+	std::vector<int> vtri_start(vcount + 1, 0);
+	std::vector<int> vtri(tcount * 3);
+	for(unsigned long i=0; i<tcount; i++) {
+		for(int j=0; j<3; j++) vtri_start[tarr[i].vertices[j] + 1]++;
+	}
+	for(unsigned long i=0; i<vcount; i++) vtri_start[i + 1] += vtri_start[i];
+	std::vector<int> fill(vtri_start.begin(), vtri_start.end() - 1);
+	for(unsigned long i=0; i<tcount; i++) {
+		for(int j=0; j<3; j++) vtri[fill[tarr[i].vertices[j]]++] = (int)i;
+	}
+
+	std::vector<int> tri_axis(tcount);
+	for(unsigned long i=0; i<tcount; i++) {
+		const Index *vidx = tarr[i].vertices;
+		Vector3 n = cross_product(wpos[vidx[1]] - wpos[vidx[0]], wpos[vidx[2]] - wpos[vidx[0]]);
+		tri_axis[i] = major_axis(n);
+	}
+
+	// flood fill the charts over the shared vertices
+	std::vector<Chart> charts;
+	std::vector<int> tri_chart(tcount, -1);
+	std::vector<int> stack;
+
+	for(unsigned long i=0; i<tcount; i++) {
+		if(tri_chart[i] != -1) continue;
+
+		int cidx = (int)charts.size();
+		charts.push_back(Chart());
+		Chart *c = &charts.back();
+		c->axis = tri_axis[i];
+
+		tri_chart[i] = cidx;
+		stack.push_back((int)i);
+		while(!stack.empty()) {
+			int t = stack.back();
+			stack.pop_back();
+			c->tris.push_back(t);
+
+			for(int j=0; j<3; j++) {
+				Index v = tarr[t].vertices[j];
+				for(int k=vtri_start[v]; k<vtri_start[v + 1]; k++) {
+					int adj = vtri[k];
+					if(tri_chart[adj] == -1 && tri_axis[adj] == c->axis) {
+						tri_chart[adj] = cidx;
+						stack.push_back(adj);
+					}
+				}
+			}
+		}
+
+		c->umin = c->vmin = 1e30;
+		c->umax = c->vmax = -1e30;
+		for(size_t j=0; j<c->tris.size(); j++) {
+			for(int k=0; k<3; k++) {
+				scalar_t u, v;
+				project(wpos[tarr[c->tris[j]].vertices[k]], c->axis, &u, &v);
+				c->umin = min(c->umin, u);
+				c->vmin = min(c->vmin, v);
+				c->umax = max(c->umax, u);
+				c->vmax = max(c->vmax, v);
+			}
+		}
+	}
+
+	std::vector<Chart*> sorted(charts.size());
+	for(size_t i=0; i<charts.size(); i++) sorted[i] = &charts[i];
+
+	// find a size they fit in, lowering the density if even max_size isn't enough
+	int size = 0;
+	for(int shrink=0; !size && shrink<MAX_SHRINK; shrink++) {
+		unsigned long area = 0;
+		for(size_t i=0; i<charts.size(); i++) {
+			Chart *c = &charts[i];
+			c->w = (int)ceil((c->umax - c->umin) * texel_density) + 1 + 2 * padding;
+			c->h = (int)ceil((c->vmax - c->vmin) * texel_density) + 1 + 2 * padding;
+			area += c->w * c->h;
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), chart_taller);
+
+		for(int sz=next_pow2((int)sqrt((double)area)); sz<=max_size; sz*=2) {
+			if(pack(sorted, sz)) {
+				size = sz;
+				break;
+			}
+		}
+		if(!size) texel_density *= 0.85;
+	}
+
+	if(!size) {
+		error("generate_lightmap_coords: %d charts don't fit in %dx%d", (int)charts.size(), max_size, max_size);
+		return 0;
+	}
+
+	// split the vertices on the chart borders, and set their coordinates
+	std::vector<Vertex> new_varr;
+	new_varr.reserve(vcount);
+	std::vector<Triangle> new_tarr(tarr, tarr + tcount);
+	std::map<std::pair<Index, int>, Index> vmap;
+
+	for(unsigned long i=0; i<tcount; i++) {
+		const Chart *c = &charts[tri_chart[i]];
+
+		for(int j=0; j<3; j++) {
+			Index v = tarr[i].vertices[j];
+			std::pair<Index, int> key(v, tri_chart[i]);
+
+			std::map<std::pair<Index, int>, Index>::iterator iter = vmap.find(key);
+			if(iter != vmap.end()) {
+				new_tarr[i].vertices[j] = iter->second;
+				continue;
+			}
+
+			Vertex vert = varr[v];
+			scalar_t u, pv;
+			project(wpos[v], c->axis, &u, &pv);
+			u = c->x + padding + 0.5 + (u - c->umin) * texel_density;
+			pv = c->y + padding + 0.5 + (pv - c->vmin) * texel_density;
+			vert.tex[1] = TexCoord(u / size, pv / size);
+
+			Index nidx = (Index)new_varr.size();
+			new_varr.push_back(vert);
+			vmap[key] = nidx;
+			new_tarr[i].vertices[j] = nidx;
+		}
+	}
+
+	mesh->set_data(&new_varr[0], new_varr.size(), &new_tarr[0], new_tarr.size());
+
+	if(charts_ret) *charts_ret = (int)charts.size();
+	return size;
+}
+
+// ------- baking -------
+
+// a lightmap texel to compute
+struct LmTexel {
+	int x, y;
+	Vector3 pos, normal;
+	Vector3 offset;		// along the face normal, for the rays leaving the surface
+};
+
+struct LmLight {
+	Vector3 pos;		// direction towards the light for directional lights
+	Color color;
+	Vector3 att;
+	bool directional;
+};
+
+struct BakeWork {
+	const RayTracer *rt;
+	const LightmapParams *params;
+	std::vector<LmLight> lights;
+	Color ambient;
+
+	const std::vector<LmTexel> *texels;
+	std::vector<Color> result;
+	std::vector<unsigned long> rays;	// per chunk
+};
+
+// area and barycentric coordinates in lightmap texel space
+static inline scalar_t edge_func(const Vector2 &a, const Vector2 &b, scalar_t x, scalar_t y) {
+	return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+/* raster_texels - finds the texels covered by each triangle
+ * Texels with their center inside a triangle sample it there, and the ones
+ * only touching a triangle sample its nearest point, so that the bilinear
+ * filtering along the chart edges doesn't pick up empty texels.
+ */
+static void raster_texels(const TriMesh *mesh, const Matrix4x4 &xform, int size, std::vector<LmTexel> *texels) {
+	const Vertex *varr = mesh->get_vertex_array()->get_data();
+	const Triangle *tarr = mesh->get_triangle_array()->get_data();
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	Matrix4x4 norm_xform = xform.inverse().transposed();
+
+	// 0: empty, 1: touched, 2: center covered
+	std::vector<unsigned char> coverage(size * size, 0);
+	std::vector<int> texel_idx(size * size, -1);
+
+	for(unsigned long i=0; i<tcount; i++) {
+		const Vertex *v[3];
+		Vector2 uv[3];
+		for(int j=0; j<3; j++) {
+			v[j] = varr + tarr[i].vertices[j];
+			uv[j] = Vector2(v[j]->tex[1].u * size, v[j]->tex[1].v * size);
+		}
+
+		scalar_t area = edge_func(uv[0], uv[1], uv[2].x, uv[2].y);
+		if(fabs(area) < 1e-8) continue;
+
+		Vector3 p[3], n[3];
+		for(int j=0; j<3; j++) {
+			p[j] = v[j]->pos.transformed(xform);
+			n[j] = v[j]->normal.transformed(norm_xform);
+		}
+		Vector3 fnorm = cross_product(p[1] - p[0], p[2] - p[0]).normalized();
+
+		int x0 = max((int)floor(min(uv[0].x, min(uv[1].x, uv[2].x)) - 0.5), 0);
+		int y0 = max((int)floor(min(uv[0].y, min(uv[1].y, uv[2].y)) - 0.5), 0);
+		int x1 = min((int)ceil(max(uv[0].x, max(uv[1].x, uv[2].x)) + 0.5), size - 1);
+		int y1 = min((int)ceil(max(uv[0].y, max(uv[1].y, uv[2].y)) + 0.5), size - 1);
+
+		for(int y=y0; y<=y1; y++) {
+			for(int x=x0; x<=x1; x++) {
+				scalar_t px = x + 0.5, py = y + 0.5;
+
+				// barycentric coordinates and the distance outside each edge, in texels
+				scalar_t w[3];
+				bool inside = true, touching = true;
+				for(int j=0; j<3; j++) {
+					const Vector2 &a = uv[(j + 1) % 3], &b = uv[(j + 2) % 3];
+					w[j] = edge_func(a, b, px, py) / area;
+
+					scalar_t len = (b - a).length();
+					scalar_t dist = w[j] * fabs(area) / len;
+					if(dist < 0.0) inside = false;
+					if(dist < -0.70711) touching = false;	// half the texel diagonal
+				}
+				if(!touching) continue;
+
+				int tidx = y * size + x;
+				int cov = inside ? 2 : 1;
+				if(coverage[tidx] >= cov) continue;
+				coverage[tidx] = cov;
+
+				if(!inside) {
+					// clamp to the triangle
+					for(int j=0; j<3; j++) w[j] = max(w[j], (scalar_t)0.0);
+					scalar_t sum = w[0] + w[1] + w[2];
+					for(int j=0; j<3; j++) w[j] /= sum;
+				}
+
+				LmTexel tex;
+				tex.x = x;
+				tex.y = y;
+				tex.pos = p[0] * w[0] + p[1] * w[1] + p[2] * w[2];
+				tex.normal = (n[0] * w[0] + n[1] * w[1] + n[2] * w[2]).normalized();
+				if(dot_product(tex.normal, fnorm) < 0.0) tex.normal = -tex.normal;
+				tex.offset = fnorm;
+
+				if(texel_idx[tidx] == -1) {
+					texel_idx[tidx] = (int)texels->size();
+					texels->push_back(tex);
+				} else {
+					(*texels)[texel_idx[tidx]] = tex;
+				}
+			}
+		}
+	}
+}
+
+// hash of the texel position, to decorrelate the ambient occlusion samples of neighbours
+static inline unsigned int texel_hash(int x, int y) {
+	unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995;
+	h ^= h >> 15;
+	return h;
+}
+
+static inline scalar_t radical_inverse(unsigned int i) {
+	i = (i << 16) | (i >> 16);
+	i = ((i & 0x55555555) << 1) | ((i & 0xaaaaaaaa) >> 1);
+	i = ((i & 0x33333333) << 2) | ((i & 0xcccccccc) >> 2);
+	i = ((i & 0x0f0f0f0f) << 4) | ((i & 0xf0f0f0f0) >> 4);
+	i = ((i & 0x00ff00ff) << 8) | ((i & 0xff00ff00) >> 8);
+	return (scalar_t)i / 4294967296.0;
+}
+
+static inline int bit_count(unsigned int x) {
+	int count = 0;
+	while(x) {
+		x &= x - 1;
+		count++;
+	}
+	return count;
+}
+
+static inline scalar_t frac(scalar_t x) {
+	return x - floor(x);
+}
+
+static inline void set_ray(RTRay *ray, const Vector3 &org, const Vector3 &dir, scalar_t tmax) {
+	ray->org[0] = org.x;
+	ray->org[1] = org.y;
+	ray->org[2] = org.z;
+	ray->dir[0] = dir.x;
+	ray->dir[1] = dir.y;
+	ray->dir[2] = dir.z;
+	ray->tmin = 0.0f;
+	ray->tmax = tmax;
+}
+
+static inline Vector3 ray_origin(const LmTexel &tex) {
+	scalar_t mag = max(fabs(tex.pos.x), max(fabs(tex.pos.y), fabs(tex.pos.z)));
+	return tex.pos + tex.offset * (1e-3 * (1.0 + mag));
+}
+
+/* ambient_occlusion - the unoccluded fraction of the hemisphere
+ * cosine weighted Hammersley directions, shifted per texel.
+ */
+static scalar_t ambient_occlusion(const BakeWork *work, const LmTexel &tex, unsigned long *rays) {
+	int samples = work->params->ao_samples;
+	unsigned int hash = texel_hash(tex.x, tex.y);
+	scalar_t shift_u = (hash & 0xffff) / 65536.0;
+	scalar_t shift_v = (hash >> 16) / 65536.0;
+
+	// tangent frame around the normal
+	Vector3 n = tex.normal;
+	Vector3 t = fabs(n.x) > 0.9 ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+	Vector3 b = cross_product(n, t).normalized();
+	t = cross_product(b, n);
+
+	Vector3 org = ray_origin(tex);
+	int occluded = 0;
+
+	for(int i=0; i<samples; i+=RT_PACKET_SIZE) {
+		RTPacket pk;
+		memset(&pk, 0, sizeof pk);
+
+		for(int j=0; j<RT_PACKET_SIZE && i + j < samples; j++) {
+			scalar_t u = frac((scalar_t)(i + j) / samples + shift_u);
+			scalar_t v = frac(radical_inverse(i + j) + shift_v);
+
+			scalar_t r = sqrt(u);
+			scalar_t phi = two_pi * v;
+			Vector3 dir = t * (r * cos(phi)) + b * (r * sin(phi)) + n * sqrt(max(1.0 - u, 0.0));
+
+			RTRay ray;
+			set_ray(&ray, org, dir, work->params->ao_distance);
+			rt_packet_set(&pk, j, ray);
+		}
+
+		unsigned int hits = work->rt->occluded(pk);
+		for(int j=0; j<RT_PACKET_SIZE; j++) {
+			if(hits & (1 << j)) occluded++;
+		}
+	}
+
+	*rays += samples;
+	return 1.0 - (scalar_t)occluded / samples;
+}
+
+static void lm_chunk_work(int idx, void *cls) {
+	BakeWork *work = (BakeWork*)cls;
+	const std::vector<LmTexel> &texels = *work->texels;
+	const LightmapParams *params = work->params;
+
+	int first = idx * CHUNK_TEXELS;
+	int last = min(first + CHUNK_TEXELS, (int)texels.size());
+	unsigned long rays = 0;
+
+	for(int i=first; i<last; i++) {
+		Color col = work->ambient;
+		if(params->ao_samples > 0) {
+			col = col * ambient_occlusion(work, texels[i], &rays);
+		}
+		work->result[i] = col;
+	}
+
+	if(params->direct) {
+		for(size_t li=0; li<work->lights.size(); li++) {
+			const LmLight &lt = work->lights[li];
+
+			// shadow rays of RT_PACKET_SIZE texels at a time
+			for(int i=first; i<last; i+=RT_PACKET_SIZE) {
+				RTPacket pk;
+				memset(&pk, 0, sizeof pk);
+				Color col[RT_PACKET_SIZE];
+
+				for(int j=0; j<RT_PACKET_SIZE && i + j < last; j++) {
+					const LmTexel &tex = texels[i + j];
+
+					Vector3 ldir;
+					scalar_t dist, att = 1.0;
+					if(lt.directional) {
+						ldir = lt.pos;
+						dist = 1e30;
+					} else {
+						ldir = lt.pos - tex.pos;
+						dist = ldir.length();
+						ldir /= dist;
+						att = 1.0 / (lt.att.x + lt.att.y * dist + lt.att.z * dist * dist);
+					}
+
+					scalar_t ndotl = dot_product(tex.normal, ldir);
+					if(ndotl <= 0.0) continue;
+					col[j] = lt.color * (ndotl * att);
+
+					RTRay ray;
+					set_ray(&ray, ray_origin(tex), ldir, dist);
+					rt_packet_set(&pk, j, ray);
+				}
+
+				if(!pk.mask) continue;
+				unsigned int lit = pk.mask & ~work->rt->occluded(pk);
+				rays += bit_count(pk.mask);
+
+				for(int j=0; j<RT_PACKET_SIZE; j++) {
+					if(lit & (1 << j)) work->result[i + j] += col[j];
+				}
+			}
+		}
+	}
+
+	work->rays[idx] = rays;
+}
+
+/* bake_object - renders the lightmap of one object
+ * returns the lightmap, with rows from the top down like the rest of the
+ * pixel buffers, or 0 if the object can't have one.
+ */
+static PixelBuffer *bake_object(Object *obj, BakeWork *work, LightmapStats *st) {
+	const LightmapParams *params = work->params;
+	TriMesh *mesh = obj->get_mesh_ptr();
+	Matrix4x4 xform = obj->get_prs(params->time).get_xform_matrix();
+
+	int charts;
+	int size = generate_lightmap_coords(mesh, xform, params->texel_density, params->max_size, params->padding, &charts);
+	if(!size) return 0;
+
+	std::vector<LmTexel> texels;
+	raster_texels(mesh, xform, size, &texels);
+
+	int chunk_count = ((int)texels.size() + CHUNK_TEXELS - 1) / CHUNK_TEXELS;
+	work->texels = &texels;
+	work->result.clear();
+	work->result.resize(texels.size(), Color(0.0f, 0.0f, 0.0f));
+	work->rays.clear();
+	work->rays.resize(chunk_count, 0);
+
+	thr_parallel_for(chunk_count, lm_chunk_work, work);
+
+	// texel row y is t = (y + 0.5) / size, the last row of the image
+	PixelBuffer *pbuf = new PixelBuffer(size, size);
+	memset(pbuf->buffer, 0, size * size * sizeof *pbuf->buffer);
+
+	for(size_t i=0; i<texels.size(); i++) {
+		const Color &col = work->result[i];
+		int r = (int)(min(max(col.r, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+		int g = (int)(min(max(col.g, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+		int b = (int)(min(max(col.b, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+		pbuf->buffer[(size - 1 - texels[i].y) * size + texels[i].x] = 0xff000000 | (r << 16) | (g << 8) | b;
+	}
+
+	if(params->dilate_passes > 0) {
+		dilate(pbuf, params->dilate_passes);
+	}
+
+	for(int i=0; i<size * size; i++) {
+		pbuf->buffer[i] |= 0xff000000;
+	}
+
+	st->charts += charts;
+	st->texels += texels.size();
+	for(int i=0; i<chunk_count; i++) {
+		st->rays += work->rays[i];
+	}
+	return pbuf;
+}
+
+bool bake_lightmaps(Scene *scene, const std::vector<Object*> &objects, const LightmapParams &params, LightmapStats *stats) {
+	PROF_SCOPE("bake_lightmaps");
+
+	ntimer timer;
+	timer_reset(&timer);
+	timer_start(&timer);
+
+	LightmapStats st;
+	memset(&st, 0, sizeof st);
+
+	// everything in the scene casts shadows
+	RayTracer rt;
+	std::list<Object*> *olist = scene->get_object_list();
+	std::list<Object*>::iterator iter = olist->begin();
+	while(iter != olist->end()) {
+		Object *obj = *iter++;
+		rt.add_mesh(obj->get_mesh_ptr(), obj->get_prs(params.time).get_xform_matrix());
+	}
+	rt.build();
+
+	BakeWork work;
+	work.rt = &rt;
+	work.params = &params;
+	work.ambient = scene->get_ambient_light();
+
+	for(int i=0; i<scene->get_light_count(); i++) {
+		const Light *light = scene->get_light_at(i);
+		work.ambient += light->get_color(LIGHTCOL_AMBIENT) * light->get_intensity();
+
+		LmLight lt;
+		lt.color = light->get_color(LIGHTCOL_DIFFUSE) * light->get_intensity();
+		lt.att = light->get_attenuation_vector();
+
+		if(const DirLight *dlight = dynamic_cast<const DirLight*>(light)) {
+			lt.pos = -dlight->get_direction().transformed(light->get_prs(params.time).rotation).normalized();
+			lt.directional = true;
+		} else {
+			lt.pos = light->get_prs(params.time).position;
+			lt.directional = false;
+		}
+		work.lights.push_back(lt);
+	}
+
+	bool res = true;
+	std::set<Texture*> old_maps;
+	for(size_t i=0; i<objects.size(); i++) {
+		Object *obj = objects[i];
+		Material *mat = obj->get_material_ptr();
+
+		// bump mapping needs the second set of texture coordinates
+		if(mat->tex[TEXTYPE_BUMPMAP]) {
+			warning("bake_lightmaps: skipping bump mapped object %s", obj->name.c_str());
+			continue;
+		}
+
+		PixelBuffer *pbuf = bake_object(obj, &work, &st);
+		if(!pbuf) {
+			error("bake_lightmaps: failed to bake %s", obj->name.c_str());
+			res = false;
+			continue;
+		}
+
+		// object names may be empty or shared, the index keeps the lightmaps apart
+		char prefix[32];
+		sprintf(prefix, "lightmap_%d", (int)i);
+		std::string name = obj->name.empty() ? prefix : prefix + ("_" + obj->name);
+		if(params.save_dir) {
+			std::string fname = std::string(params.save_dir) + "/" + name + ".tga";
+			if(save_image(fname.c_str(), pbuf->buffer, pbuf->width, pbuf->height, IMG_FMT_TGA) == -1) {
+				error("bake_lightmaps: failed to save %s", fname.c_str());
+			}
+		}
+
+		// a previous baked lightmap gives up its name to the new one
+		Texture *old_map = mat->tex[TEXTYPE_LIGHTMAP];
+		if(old_map && old_maps.find(old_map) == old_maps.end() && is_baked_map(old_map)) {
+			old_maps.insert(old_map);
+			remove_texture(old_map);
+		}
+
+		Texture *tex = new Texture(pbuf->width, pbuf->height);
+		tex->set_pixel_data(*pbuf);
+		add_texture(tex, name.c_str());
+		if(find_texture(name.c_str()) == tex) {
+			baked_maps[tex] = name;
+		}
+		delete pbuf;
+
+		if(mat->tex[TEXTYPE_LIGHTMAP]) {
+			mat->tex[TEXTYPE_LIGHTMAP] = tex;
+		} else {
+			mat->set_texture(tex, TEXTYPE_LIGHTMAP);
+		}
+
+		// the lightmap has the diffuse and ambient lighting, on top of any emissive color
+		if(mat->diffuse_color.r > 0.0 || mat->diffuse_color.g > 0.0 || mat->diffuse_color.b > 0.0) {
+			mat->emissive_color.r += mat->diffuse_color.r;
+			mat->emissive_color.g += mat->diffuse_color.g;
+			mat->emissive_color.b += mat->diffuse_color.b;
+			mat->diffuse_color = Color(0.0, 0.0, 0.0, mat->diffuse_color.a);
+			mat->ambient_color = Color(0.0, 0.0, 0.0, mat->ambient_color.a);
+		}
+
+		if(params.disable_shadow_casting) {
+			obj->set_shadow_casting(false);
+		}
+		st.objects++;
+	}
+
+	/* the replaced lightmaps go, unless an object left out of this bake (or
+	 * one that failed) still uses them, then they're managed again, under a
+	 * new name.
+	 */
+	std::set<Texture*> in_use;
+	for(iter = olist->begin(); iter != olist->end(); iter++) {
+		in_use.insert((*iter)->get_material_ptr()->tex[TEXTYPE_LIGHTMAP]);
+	}
+	for(size_t i=0; i<objects.size(); i++) {
+		in_use.insert(objects[i]->get_material_ptr()->tex[TEXTYPE_LIGHTMAP]);
+	}
+
+	std::set<Texture*>::iterator tex_iter = old_maps.begin();
+	while(tex_iter != old_maps.end()) {
+		Texture *tex = *tex_iter++;
+		if(in_use.find(tex) != in_use.end()) {
+			char name[32];
+			sprintf(name, "lightmap_kept_%lu", kept_maps++);
+			add_texture(tex, name);
+			baked_maps[tex] = name;
+		} else {
+			baked_maps.erase(tex);
+			delete tex;
+		}
+	}
+
+	st.msec = timer_getmsec(&timer);
+	if(stats) *stats = st;
+
+	info("baked %d lightmaps: %lu texels, %lu rays, %lu msec", st.objects, st.texels, st.rays, st.msec);
+	return res;
+}
+
+bool bake_lightmaps(Scene *scene, const LightmapParams &params, LightmapStats *stats) {
+	std::list<Object*> *olist = scene->get_object_list();
+	std::vector<Object*> objects(olist->begin(), olist->end());
+	return bake_lightmaps(scene, objects, params, stats);
+}
@@ -0,0 +1,90 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* lightmap baking for static objects
+ *
+ * Each baked object gets its own lightmap, laid out in charts: connected
+ * triangles facing the same major axis, projected on that axis and packed
+ * into the map. The lightmap coordinates go into the second texture
+ * coordinate set (Vertex::tex[1]), and vertices on the chart borders are
+ * split.
+ *
+ * Every texel gets the diffuse light from the scene lights with their
+ * shadows, and the ambient light times the ambient occlusion, traced with
+ * the RayTracer (gfx/rtrace.hpp) against all the objects of the scene, on
+ * the worker threads. The empty texels around the charts are filled by
+ * dilate() (gfx/img_manip.hpp), against bleeding from filtering.
+ *
+ * The lightmap ends up as the TEXTYPE_LIGHTMAP texture of the material,
+ * which modulates the rest of the textures. The diffuse color of the
+ * material moves to its emissive color, so that the realtime lights only
+ * add their specular highlights. A lightmap from an earlier bake is freed
+ * once nothing uses it, one set by the user is only replaced in the
+ * material, it stays the user's.
+ */
+
+#ifndef _LIGHTMAP_HPP_
+#define _LIGHTMAP_HPP_
+
+#include <vector>
+#include "gfx/3dgeom.hpp"
+#include "n3dmath2/n3dmath2.hpp"
+
+class Scene;
+class Object;
+
+struct LightmapParams {
+	scalar_t texel_density;		// texels per world unit
+	int max_size;				// objects which don't fit get a lower density
+	int padding;				// empty texels around each chart
+	bool direct;				// light and shadows from the scene lights
+	int ao_samples;				// ambient occlusion rays per texel, 0 for none
+	scalar_t ao_distance;		// occluders further than this don't count
+	int dilate_passes;
+	bool disable_shadow_casting;	// the shadows of the baked objects are in the lightmaps
+	const char *save_dir;		// if set, the lightmaps are saved there, as lightmap_<index>[_<name>].tga
+	unsigned long time;			// for the object and light transformations
+
+	LightmapParams();
+};
+
+struct LightmapStats {
+	int objects;
+	int charts;
+	unsigned long texels;
+	unsigned long rays;
+	unsigned long msec;
+};
+
+/* generates non overlapping lightmap coordinates for the mesh, into tex[1].
+ * The density is in texels per unit after transforming the mesh by xform.
+ * Returns the size of the square lightmap they are for, or 0 on failure,
+ * and the number of charts in *charts if not null.
+ */
+int generate_lightmap_coords(TriMesh *mesh, const Matrix4x4 &xform, scalar_t texel_density,
+		int max_size, int padding, int *charts = 0);
+
+// bakes the lightmaps of the given objects, everything in the scene casts shadows on them
+bool bake_lightmaps(Scene *scene, const std::vector<Object*> &objects,
+		const LightmapParams &params = LightmapParams(), LightmapStats *stats = 0);
+// bakes the lightmaps of all the objects in the scene
+bool bake_lightmaps(Scene *scene, const LightmapParams &params = LightmapParams(), LightmapStats *stats = 0);
+
+#endif	// _LIGHTMAP_HPP_
@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "opengl.h"
 #include "material.hpp"
+#include "3denginefx.hpp"
+#include "swrast.hpp"
 
 Material::Material() {
 	ambient_color = diffuse_color = Color(1.0f, 1.0f, 1.0f);
@@ -88,6 +90,11 @@ void Material::set_glmaterial() const {
 	dif[3] *= alpha;
 	spc[3] *= alpha;
 	ems[3] *= alpha;
+
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->set_material(amb, dif, spc, ems, specular_power);
+		return;
+	}
 	
 	glMaterialfv(GL_FRONT, GL_AMBIENT, amb);
 	glMaterialfv(GL_FRONT, GL_DIFFUSE, dif);
@@ -26,14 +26,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "3dengfx_config.h"
 
+#include <algorithm>
 #include "opengl.h"
 #include "object.hpp"
 #include "3denginefx.hpp"
+#include "rstate.hpp"
 #include "camera.hpp"
 #include "gfxprog.hpp"
 #include "texman.hpp"
 #include "ggen.hpp"
+#include "gfx/simplify.hpp"
 #include "common/err_msg.h"
+#include "common/arena.h"
 
 RenderParams::RenderParams() {
 	billboarded = false;
@@ -54,6 +58,7 @@ RenderParams::RenderParams() {
 	taddr = TEXADDR_WRAP;
 	auto_normalize = false;
 	cast_shadows = true;
+	occluder = false;
 }
 
 
@@ -62,12 +67,21 @@ unsigned long master_render_mode = RMODE_ALL;
 
 Object::Object() {
 	bvol_valid = false;
+	bvol_mesh_rev = 0;
 	bvol = 0;
+	occluder_proxy = 0;
+	cur_lod = -1;
+	mesh_opt = MESHOPT_NONE;
 	set_dynamic(false);
 }
 
 Object::Object(const TriMesh &mesh) {
+	bvol_valid = false;
+	bvol_mesh_rev = 0;
 	bvol = 0;
+	occluder_proxy = 0;
+	cur_lod = -1;
+	mesh_opt = MESHOPT_NONE;
 	set_mesh(mesh);
 	set_dynamic(false);
 }
@@ -76,6 +90,30 @@ Object::~Object() {
 	if(bvol) delete bvol;
 }
 
+/* create_instance
+ * the bounds are copied as well, so that instancing a mesh costs nothing
+ * more than the object itself.
+ */
+Object *Object::create_instance() const {
+	Object *obj = new Object;
+	obj->mesh = mesh;
+	obj->mat = mat;
+	obj->render_params = render_params;
+	obj->occluder_proxy = occluder_proxy;
+	obj->lods = lods;
+	obj->lod_sizes = lod_sizes;
+	obj->mesh_opt = mesh_opt;
+
+	const BoundingSphere *bsph = dynamic_cast<const BoundingSphere*>(bvol);
+	if(bsph && bvol_valid && bvol_mesh_rev == mesh.get_revision()) {
+		obj->bvol = new BoundingSphere(*bsph);
+		obj->bbox = bbox;
+		obj->bvol_valid = true;
+		obj->bvol_mesh_rev = obj->mesh.get_revision();
+	}
+	return obj;
+}
+
 void Object::set_mesh(const TriMesh &mesh) {
 	this->mesh = mesh;
 	update_bounding_volume();
@@ -128,6 +166,31 @@ bool Object::get_dynamic() const {
 	return mesh.get_vertex_array()->get_dynamic();
 }
 
+void Object::optimize(int mode) {
+	mesh_opt = mode;
+
+	optimize_mesh(&mesh);
+	for(size_t i=0; i<lods.size(); i++) {
+		optimize_mesh(&lods[i]);
+	}
+}
+
+/* optimize_mesh
+ * meshes that are already optimized are left alone, so that copies of
+ * another object's mesh keep sharing its data. The bounds don't change.
+ */
+void Object::optimize_mesh(TriMesh *m) {
+	if(mesh_opt == MESHOPT_NONE || m->is_optimized() || !m->get_triangle_array()->get_count()) {
+		return;
+	}
+
+	bool bvol_current = m == &mesh && bvol_valid && bvol_mesh_rev == mesh.get_revision();
+
+	m->optimize(mesh_opt == MESHOPT_OVERDRAW);
+
+	if(bvol_current) bvol_mesh_rev = mesh.get_revision();
+}
+
 void Object::set_material(const Material &mat) {
 	this->mat = mat;
 }
@@ -233,12 +296,147 @@ void Object::set_shadow_casting(bool enable)
 	render_params.cast_shadows = enable;
 }
 
+void Object::set_occluder(bool enable, const TriMesh *proxy) {
+	render_params.occluder = enable;
+	occluder_proxy = proxy;
+}
+
+const TriMesh *Object::get_occluder_mesh() const {
+	return occluder_proxy ? occluder_proxy : &mesh;
+}
+
+void Object::add_lod(const TriMesh &lod, scalar_t max_size) {
+	lods.push_back(lod);
+	lod_sizes.push_back(max_size);
+
+	TriMesh *lmesh = &lods.back();
+	const_cast<VertexArray*>(lmesh->get_vertex_array())->set_dynamic(get_dynamic());
+	const_cast<TriangleArray*>(lmesh->get_triangle_array())->set_dynamic(get_dynamic());
+	optimize_mesh(lmesh);
+}
+
+void Object::create_lods(const scalar_t *ratios, int count, scalar_t full_size) {
+	Object *obj = this;
+	::create_lods(&obj, 1, ratios, count, full_size);
+}
+
+void Object::clear_lods() {
+	lods.clear();
+	lod_sizes.clear();
+	cur_lod = -1;
+}
+
+int Object::get_lod_count() const {
+	return (int)lods.size();
+}
+
+const TriMesh *Object::get_lod(int idx) const {
+	return &lods[idx];
+}
+
+int Object::get_current_lod() const {
+	return cur_lod;
+}
+
+void create_lods(Object **objects, int obj_count, const scalar_t *ratios, int count, scalar_t full_size) {
+	std::vector<const TriMesh*> meshes(obj_count);
+	for(int i=0; i<obj_count; i++) {
+		meshes[i] = &objects[i]->get_mesh();
+	}
+
+	std::vector<std::vector<TriMesh> > chains(obj_count);
+	create_lod_chains(&meshes[0], obj_count, &chains[0], ratios, count);
+
+	for(int i=0; i<obj_count; i++) {
+		objects[i]->clear_lods();
+		for(int j=0; j<count; j++) {
+			objects[i]->add_lod(chains[i][j], full_size * sqrt(ratios[j]));
+		}
+	}
+}
+
+/* select_lod
+ * the size of the bounding sphere on the screen is its radius over the
+ * distance, scaled like the y axis by the projection. The camera being
+ * inside the sphere means full detail.
+ */
+void Object::select_lod() {
+	cur_lod = -1;
+
+	const BoundingSphere *bsph = (const BoundingSphere*)bvol;
+	scalar_t max_sq = 0.0;
+	for(int i=0; i<3; i++) {
+		scalar_t len_sq = SQ(world_mat[0][i]) + SQ(world_mat[1][i]) + SQ(world_mat[2][i]);
+		if(len_sq > max_sq) max_sq = len_sq;
+	}
+	scalar_t rad = bsph->get_radius() * sqrt(max_sq);
+	Vector3 vpos = bsph->get_position().transformed(world_mat).transformed(engfx_state::view_matrix);
+
+	const Matrix4x4 &proj = engfx_state::proj_matrix;
+	scalar_t w = proj[3][0] * vpos.x + proj[3][1] * vpos.y + proj[3][2] * vpos.z + proj[3][3];
+	if(proj[3][3] == 0.0 && fabs(w) <= rad) return;
+
+	scalar_t size = rad * fabs(proj[1][1]) / fabs(w);
+	for(int i=0; i<(int)lods.size() && size < lod_sizes[i]; i++) {
+		cur_lod = i;
+	}
+}
+
+const TriMesh *Object::get_render_mesh() const {
+	return cur_lod >= 0 && cur_lod < (int)lods.size() ? &lods[cur_lod] : &mesh;
+}
+
 void Object::apply_xform(unsigned long time) {
 	world_mat = get_prs(time).get_xform_matrix();
 	mesh.apply_xform(world_mat);
 	reset_xform(time);
 }
 
+/* get_world_bounds
+ * the axis aligned box is the intersection of the transformed object space
+ * box and the box around the transformed oriented box, since both enclose
+ * the object.
+ */
+void Object::get_world_bounds(unsigned long time, AABox *box, Vector3 *center, scalar_t *radius, OBox *obox) const {
+	Matrix4x4 xform = get_prs(time).get_xform_matrix();
+
+	if(!mesh.get_vertex_array()->get_count()) {
+		box->reset();
+		*center = Vector3(0, 0, 0).transformed(xform);
+		*radius = 0.0;
+		if(obox) *obox = OBox();
+		return;
+	}
+
+	if(!bvol_valid || bvol_mesh_rev != mesh.get_revision()) {
+		const_cast<Object*>(this)->update_bounding_volume();
+	}
+	const BoundingSphere *bsph = (const BoundingSphere*)bvol;
+	VertexStatistics vstat = mesh.get_vertex_stats();
+
+	AABox local(Vector3(vstat.xmin, vstat.ymin, vstat.zmin), Vector3(vstat.xmax, vstat.ymax, vstat.zmax));
+	AABox abox = local.transformed(xform);
+
+	OBox wbox = bbox.transformed(xform);
+	AABox obox_abox = wbox.get_aabox();
+	box->vmin.x = std::max(abox.vmin.x, obox_abox.vmin.x);
+	box->vmin.y = std::max(abox.vmin.y, obox_abox.vmin.y);
+	box->vmin.z = std::max(abox.vmin.z, obox_abox.vmin.z);
+	box->vmax.x = std::min(abox.vmax.x, obox_abox.vmax.x);
+	box->vmax.y = std::min(abox.vmax.y, obox_abox.vmax.y);
+	box->vmax.z = std::min(abox.vmax.z, obox_abox.vmax.z);
+	if(obox) *obox = wbox;
+
+	// scale the radius by the largest axis scaling of the transformation
+	scalar_t max_sq = 0.0;
+	for(int i=0; i<3; i++) {
+		scalar_t len_sq = SQ(xform[0][i]) + SQ(xform[1][i]) + SQ(xform[2][i]);
+		if(len_sq > max_sq) max_sq = len_sq;
+	}
+	*center = bsph->get_position().transformed(xform);
+	*radius = bsph->get_radius() * sqrt(max_sq);
+}
+
 void Object::calculate_normals() {
 	mesh.calculate_normals();
 }
@@ -248,9 +446,28 @@ void Object::normalize_normals() {
 }
 
 bool Object::render(unsigned long time) {
+	if(!prepare_render(time)) return false;
+
+	render_prepared(time);
+	return true;
+}
+
+void Object::render_prepared(unsigned long time) {
+	set_matrix(XFORM_WORLD, world_mat);
+	mat.set_glmaterial();
+
+	::set_auto_normalize(render_params.auto_normalize);
+	
+	//render8tex_units();
+	render_hack(time);
+
+	if(render_params.auto_normalize) ::set_auto_normalize(false);
+}
+
+bool Object::prepare_render(unsigned long time) {
 	world_mat = get_prs(time).get_xform_matrix();
 
-	if(!bvol_valid) update_bounding_volume();
+	if(!bvol_valid || bvol_mesh_rev != mesh.get_revision()) update_bounding_volume();
 
 	// set the active world-space transformation for the bounding volume ...
 	bvol->set_transform(world_mat);
@@ -271,21 +488,97 @@ bool Object::render(unsigned long time) {
 
 		if(!bvol->visible(frustum)) return false;
 	}
-	
-	
-	set_matrix(XFORM_WORLD, world_mat);
-	mat.set_glmaterial();
 
-	::set_auto_normalize(render_params.auto_normalize);
-	
-	//render8tex_units();
-	render_hack(time);
+	if(!lods.empty()) {
+		select_lod();
+	} else {
+		cur_lod = -1;
+	}
+	return true;
+}
 
-	if(render_params.auto_normalize) ::set_auto_normalize(false);
+const Matrix4x4 &Object::get_world_matrix() const {
+	return world_mat;
+}
+
+bool Object::is_queueable() const {
+	if(render_params.show_normals || render_params.highlight) return false;
 
+	if(master_render_mode & RMODE_TEXTURES) {
+		if(mat.tex[TEXTYPE_BUMPMAP] || mat.tex[TEXTYPE_ENVMAP]) return false;
+		// render_hack() puts the detail map on unit 1 with the diffuse texture matrix
+		if(mat.tex[TEXTYPE_DETAIL] && !mat.tex[TEXTYPE_DIFFUSE]) return false;
+	}
 	return true;
 }
 
+/* render_queued
+ * sets the same states as render() for the objects is_queueable() accepts,
+ * but leaves them set for the next object instead of undoing them, the
+ * state filter drops what the next object has in common with this one.
+ */
+void Object::render_queued(StateFilter *filter) {
+	filter->set_matrix(XFORM_WORLD, world_mat);
+	// the material follows the vertex colors while they're on, so set it after
+	filter->use_vertex_colors(render_params.use_vertex_color);
+	filter->set_material(mat);
+	filter->set_auto_normalize(render_params.auto_normalize);
+
+	int tex_unit = 0;
+	if(master_render_mode & RMODE_TEXTURES) {
+		if(mat.tex[TEXTYPE_DIFFUSE]) {
+			filter->set_texture(tex_unit, mat.tex[TEXTYPE_DIFFUSE]);
+			filter->enable_texture_unit(tex_unit, true);
+			filter->set_texture_stage(tex_unit, TextureStage(TOP_MODULATE, TARG_TEXTURE, TARG_PREV, TOP_MODULATE, TARG_TEXTURE, TARG_PREV, 0));
+			filter->set_texture_addressing(tex_unit, render_params.taddr);
+			filter->set_matrix(XFORM_TEXTURE, mat.tmat[TEXTYPE_DIFFUSE], tex_unit);
+			tex_unit++;
+		}
+
+		if(mat.tex[TEXTYPE_DETAIL]) {
+			filter->set_texture(tex_unit, mat.tex[TEXTYPE_DETAIL]);
+			filter->enable_texture_unit(tex_unit, true);
+			filter->set_texture_stage(tex_unit, TextureStage(TOP_MODULATE, TARG_PREV, TARG_TEXTURE, TOP_REPLACE, TARG_PREV, TARG_PREV, 1));
+			filter->set_texture_addressing(tex_unit, render_params.taddr);
+			filter->set_matrix(XFORM_TEXTURE, mat.tmat[TEXTYPE_DIFFUSE], tex_unit);
+			tex_unit++;
+		}
+
+		if(mat.tex[TEXTYPE_LIGHTMAP] && tex_unit < engfx_state::sys_caps.max_texture_units) {
+			filter->set_texture(tex_unit, mat.tex[TEXTYPE_LIGHTMAP]);
+			filter->enable_texture_unit(tex_unit, true);
+			filter->set_texture_stage(tex_unit, TextureStage(TOP_MODULATE, TARG_TEXTURE, TARG_PREV, TOP_REPLACE, TARG_PREV, TARG_PREV, 1));
+			filter->set_texture_addressing(tex_unit, TEXADDR_CLAMP);
+			filter->set_matrix(XFORM_TEXTURE, Matrix4x4::identity_matrix, tex_unit);
+			tex_unit++;
+		}
+	}
+	filter->disable_texture_units(tex_unit);
+
+	filter->set_zwrite(render_params.zwrite);
+	filter->set_shading_mode(mat.shading);
+
+	if(master_render_mode & RMODE_BLENDING) {
+		if(render_params.handle_blending) {
+			bool blend = mat.alpha < 1.0 - small_number;
+			filter->set_alpha_blending(blend);
+			if(blend) filter->set_blend_func(BLEND_SRC_ALPHA, BLEND_ONE_MINUS_SRC_ALPHA);
+		} else {
+			filter->set_alpha_blending(render_params.blending);
+			filter->set_blend_func(render_params.src_blend, render_params.dest_blend);
+		}
+	} else {
+		filter->set_alpha_blending(false);
+	}
+
+	filter->set_wireframe(mat.wireframe);
+	filter->set_gfx_program((master_render_mode & RMODE_SHADERS) ? render_params.gfxprog : 0);
+	filter->set_backface_culling(!mat.two_sided);
+
+	const TriMesh *rmesh = get_render_mesh();
+	filter->draw(*rmesh->get_vertex_array(), *rmesh->get_index_array());
+}
+
 void Object::render_hack(unsigned long time) {
 	//::set_material(mat);
 	int tex_unit = 0;
@@ -335,6 +628,18 @@ void Object::render_hack(unsigned long time) {
 			set_matrix(XFORM_TEXTURE, mat.tmat[TEXTYPE_DIFFUSE], 1);
 			tex_unit++;
 		}
+
+		// baked lighting, see lightmap.hpp
+		if(mat.tex[TEXTYPE_LIGHTMAP] && tex_unit < engfx_state::sys_caps.max_texture_units) {
+			set_texture(tex_unit, mat.tex[TEXTYPE_LIGHTMAP]);
+			enable_texture_unit(tex_unit);
+			set_texture_coord_index(tex_unit, 1);
+			set_texture_unit_color(tex_unit, TOP_MODULATE, TARG_TEXTURE, TARG_PREV);
+			set_texture_unit_alpha(tex_unit, TOP_REPLACE, TARG_PREV, TARG_PREV);
+			::set_texture_addressing(tex_unit, TEXADDR_CLAMP, TEXADDR_CLAMP);
+			set_matrix(XFORM_TEXTURE, Matrix4x4::identity_matrix, tex_unit);
+			tex_unit++;
+		}
 	
 		if(mat.tex[TEXTYPE_ENVMAP]) {
 			set_texture(tex_unit, mat.tex[TEXTYPE_ENVMAP]);
@@ -344,12 +649,7 @@ void Object::render_hack(unsigned long time) {
 			set_texture_unit_alpha(tex_unit, TOP_REPLACE, TARG_PREV, TARG_TEXTURE);
 
 			if(mat.tex[TEXTYPE_ENVMAP]->get_type() == TEX_CUBE) {
-				glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
-				glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
-				glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP);
-				glEnable(GL_TEXTURE_GEN_S);
-				glEnable(GL_TEXTURE_GEN_T);
-				glEnable(GL_TEXTURE_GEN_R);
+				set_texture_coord_generator(tex_unit, TEXGEN_REFLECTION_MAP);
 
 				Matrix4x4 inv_view = engfx_state::view_matrix;
 				inv_view[0][3] = inv_view[1][3] = inv_view[2][3] = 0.0;
@@ -360,10 +660,7 @@ void Object::render_hack(unsigned long time) {
 				::set_texture_addressing(tex_unit, TEXADDR_CLAMP, TEXADDR_CLAMP);
 			} else {
 				::set_texture_addressing(tex_unit, render_params.taddr, render_params.taddr);
-				glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
-				glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
-				glEnable(GL_TEXTURE_GEN_S);
-				glEnable(GL_TEXTURE_GEN_T);
+				set_texture_coord_generator(tex_unit, TEXGEN_SPHERE_MAP);
 
 				// TODO: fix this to produce the correct orientation
 				/*glMatrixMode(GL_TEXTURE);
@@ -400,7 +697,8 @@ void Object::render_hack(unsigned long time) {
 	if(mat.two_sided) set_backface_culling(false);
 	if(render_params.use_vertex_color) ::use_vertex_colors(true);
 	
-	draw(*mesh.get_vertex_array(), *mesh.get_index_array());
+	const TriMesh *rmesh = get_render_mesh();
+	draw(*rmesh->get_vertex_array(), *rmesh->get_index_array());
 
 	if(render_params.use_vertex_color) ::use_vertex_colors(false);
 	if(mat.two_sided) set_backface_culling(true);
@@ -418,12 +716,7 @@ void Object::render_hack(unsigned long time) {
 	if(master_render_mode & RMODE_TEXTURES) {
 		for(int i=0; i<tex_unit; i++) {
 			disable_texture_unit(i);
-			glDisable(GL_TEXTURE_GEN_S);
-			glDisable(GL_TEXTURE_GEN_T);
-			glDisable(GL_TEXTURE_GEN_R);
-			glMatrixMode(GL_TEXTURE);
-			glLoadIdentity();
-			glMatrixMode(GL_MODELVIEW);
+			set_texture_coord_generator(i, TEXGEN_NONE);
 			set_matrix(XFORM_TEXTURE, Matrix4x4::identity_matrix, i);
 			::set_texture_addressing(tex_unit, TEXADDR_WRAP, TEXADDR_WRAP);
 			//::set_texture_filtering(tex_unit, BILINEAR_FILTERING);
@@ -520,11 +813,10 @@ void Object::setup_bump_light(unsigned long time) {
 	int tcount = mesh.get_triangle_array()->get_count();
 	const Triangle *tptr = mesh.get_triangle_array()->get_data();
 
-	
-	Vector3 *utan = new Vector3[vcount];
+	Vector3 *utan = (Vector3*)frame_alloc(vcount * sizeof(Vector3), FRAME_MEM_BUMP);
 	memset(utan, 0, vcount * sizeof(Vector3));
 
-	Vector3 *vtan = new Vector3[vcount];
+	Vector3 *vtan = (Vector3*)frame_alloc(vcount * sizeof(Vector3), FRAME_MEM_BUMP);
 	memset(vtan, 0, vcount * sizeof(Vector3));
 
 	for(int i=0; i<tcount; i++) {
@@ -576,24 +868,46 @@ void Object::setup_bump_light(unsigned long time) {
 		vptr->tex[1].w = lvec.x;
 		vptr++;
 	}
-	
-	delete [] utan;
-	delete [] vtan;
 }
 
 
+/* update_bounding_volume
+ * fits a minimal sphere and a PCA box to the vertices. Dynamic objects are
+ * likely to be modified every frame, so they get a quick approximate
+ * sphere and an axis aligned box instead.
+ */
 void Object::update_bounding_volume() {
-	VertexStatistics vstat = mesh.get_vertex_stats();
+	int vcount = mesh.get_vertex_array()->get_count();
+	const Vertex *varray = mesh.get_vertex_array()->get_data();
+
+	std::vector<Vector3> points(vcount);
+	for(int i=0; i<vcount; i++) {
+		points[i] = varray[i].pos;
+	}
+	const Vector3 *pptr = vcount ? &points[0] : 0;
+
+	Vector3 center;
+	scalar_t rad;
+	if(get_dynamic()) {
+		calc_ritter_sphere(pptr, vcount, &center, &rad);
+
+		VertexStatistics vstat = mesh.get_vertex_stats();
+		bbox = OBox(AABox(Vector3(vstat.xmin, vstat.ymin, vstat.zmin), Vector3(vstat.xmax, vstat.ymax, vstat.zmax)));
+	} else {
+		calc_min_sphere(pptr, vcount, &center, &rad);
+		bbox = calc_pca_obox(pptr, vcount);
+	}
+	bvol_mesh_rev = mesh.get_revision();
 
 	if(!bvol) {
-		bvol = new BoundingSphere(vstat.centroid, vstat.max_dist);
+		bvol = new BoundingSphere(center, rad);
 		bvol_valid = true;
 	} else {
 		BoundingSphere *bsph;
 		
 		if((bsph = dynamic_cast<BoundingSphere*>(bvol))) {
-			bsph->set_position(vstat.centroid);
-			bsph->set_radius(vstat.max_dist);
+			bsph->set_position(center);
+			bsph->set_radius(rad);
 			bvol_valid = true;
 		} else {
 			static int dbg;
@@ -607,28 +921,35 @@ void Object::update_bounding_volume() {
 
 ObjCube::ObjCube(scalar_t sz, int subdiv) {
 	create_cube(get_mesh_ptr(), sz, subdiv);
+	set_dynamic(false);
 }
 
 ObjPlane::ObjPlane(const Vector3 &normal, const Vector2 &size, int subdiv) {
 	create_plane(get_mesh_ptr(), normal, size, subdiv);
+	set_dynamic(false);
 }
 
 ObjCylinder::ObjCylinder(scalar_t rad, scalar_t len, bool caps, int udiv, int vdiv) {
 	create_cylinder(get_mesh_ptr(), rad, len, caps, udiv, vdiv);
+	set_dynamic(false);
 }
 
 ObjSphere::ObjSphere(scalar_t radius, int subdiv) {
 	create_sphere(get_mesh_ptr(), radius, subdiv);
+	set_dynamic(false);
 }
 
 ObjTorus::ObjTorus(scalar_t circle_rad, scalar_t revolv_rad, int subdiv) {
 	create_torus(get_mesh_ptr(), circle_rad, revolv_rad, subdiv);
+	set_dynamic(false);
 }
 
 ObjTeapot::ObjTeapot(scalar_t size, int subdiv) {
 	create_teapot(get_mesh_ptr(), size, subdiv);
+	set_dynamic(false);
 }
 
 ObjLandscape::ObjLandscape(const Vector2 &size, int mesh_detail, scalar_t max_height, int iter, scalar_t roughness, int seed) {
 	create_landscape(get_mesh_ptr(), size, mesh_detail, max_height, iter, roughness, seed);
+	set_dynamic(false);
 }
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define _OBJECT_HPP_
 
 #include <string>
+#include <vector>
 #include "gfx/3dgeom.hpp"
 #include "gfx/animation.hpp"
 #include "n3dmath2/n3dmath2.hpp"
@@ -35,6 +36,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "3denginefx.hpp"
 #include "gfx/bvol.hpp"
 
+class StateFilter;
+
 struct RenderParams {
 	bool billboarded;
 	bool zwrite;
@@ -54,6 +57,7 @@ struct RenderParams {
 	TextureAddressing taddr;
 	bool auto_normalize;
 	bool cast_shadows;
+	bool occluder;
 	
 	RenderParams();
 };
@@ -71,14 +75,31 @@ enum {
 // it overrides all render parameters.
 extern unsigned long master_render_mode;
 
+enum {
+	MESHOPT_NONE,
+	MESHOPT_VCACHE,		// reorder for the vertex cache
+	MESHOPT_OVERDRAW	// and for less overdraw
+};
+
 class Object : public XFormNode {
 private:
 	Matrix4x4 world_mat;
 	RenderParams render_params;
 	BoundingVolume *bvol;
+	OBox bbox;		// object space oriented bounding box
 	bool bvol_valid;
+	unsigned long bvol_mesh_rev;
+	const TriMesh *occluder_proxy;
+
+	std::vector<TriMesh> lods;
+	std::vector<scalar_t> lod_sizes;
+	int cur_lod;
+	int mesh_opt;
 	
 	void render_hack(unsigned long time);
+	void optimize_mesh(TriMesh *m);
+	void select_lod();
+	const TriMesh *get_render_mesh() const;
 
 	void draw_normals();
 	void draw_highlight();
@@ -93,7 +114,13 @@ public:
 	Object();
 	Object(const TriMesh &mesh);
 	~Object();
+
+	/* returns a new object sharing the mesh of this one, with the same
+	 * material and render parameters, and an identity transformation.
+	 */
+	Object *create_instance() const;
 	
+	// the mesh is shared with the given one until either is modified
 	void set_mesh(const TriMesh &mesh);
 	TriMesh *get_mesh_ptr();
 	TriMesh &get_mesh();
@@ -109,6 +136,12 @@ public:
 
 	void set_dynamic(bool enable);
 	bool get_dynamic() const;
+
+	/* reorders the mesh and the levels of detail for drawing (see
+	 * TriMesh::optimize), along with any levels of detail added later.
+	 * This renumbers the vertices and triangles.
+	 */
+	void optimize(int mode = MESHOPT_VCACHE);
 	
 	void set_material(const Material &mat);
 	Material *get_material_ptr();
@@ -138,14 +171,63 @@ public:
 	void set_auto_normalize(bool enable);
 	void set_shadow_casting(bool enable);
 
+	/* marks the object as an occluder for software occlusion culling, a
+	 * simplified proxy mesh (not owned by the object) can be given to be
+	 * rasterized instead of the real one.
+	 */
+	void set_occluder(bool enable, const TriMesh *proxy = 0);
+	const TriMesh *get_occluder_mesh() const;
+
+	/* levels of detail, drawn instead of the mesh while the bounding sphere
+	 * covers less than max_size of the viewport height. They must be added
+	 * from the most detailed to the least detailed, and they don't follow
+	 * later changes of the mesh.
+	 */
+	void add_lod(const TriMesh &lod, scalar_t max_size);
+	/* simplifies the mesh into an LOD chain (see gfx/simplify.hpp), level i
+	 * has ratios[i] of the triangles, and is used below full_size * sqrt(ratios[i]).
+	 */
+	void create_lods(const scalar_t *ratios, int count, scalar_t full_size = 0.5);
+	void clear_lods();
+	int get_lod_count() const;
+	const TriMesh *get_lod(int idx) const;
+	// the level picked by the last prepare_render(), or -1 for the mesh itself
+	int get_current_lod() const;
+
 	void apply_xform(unsigned long time = XFORM_LOCAL_PRS);
 
+	// world space bounding boxes and sphere at the given time
+	void get_world_bounds(unsigned long time, AABox *box, Vector3 *center, scalar_t *radius, OBox *obox = 0) const;
+
 	void calculate_normals();
 	void normalize_normals();
 	
 	bool render(unsigned long time = XFORM_LOCAL_PRS);
+
+	/* calculates the world matrix for the given time and returns false if
+	 * the object is outside the view frustum, otherwise it picks the level of
+	 * detail to draw. render() starts with this.
+	 */
+	bool prepare_render(unsigned long time = XFORM_LOCAL_PRS);
+	const Matrix4x4 &get_world_matrix() const;
+
+	/* draws the object with the world matrix and level of detail picked by
+	 * the last prepare_render(), render() ends with this.
+	 */
+	void render_prepared(unsigned long time = XFORM_LOCAL_PRS);
+
+	/* render_queued() draws the object prepared by prepare_render(), setting
+	 * its states through the state filter and leaving them set. Objects that
+	 * are not queueable (bump or environment mapped, showing normals, or
+	 * highlighted) need render() instead.
+	 */
+	bool is_queueable() const;
+	void render_queued(StateFilter *filter);
 };
 
+// Object::create_lods for many objects, simplified in parallel
+void create_lods(Object **objects, int obj_count, const scalar_t *ratios, int count, scalar_t full_size = 0.5);
+
 
 // --- some convinient derived objects for geom. generation ---
 
@@ -5,6 +5,7 @@
 #include <cassert>
 #include "gfx/3dgeom.hpp"
 #include "common/err_msg.h"
+#include "common/profile.h"
 
 #define BUFFER_SIZE		256
 
@@ -92,6 +93,7 @@ bool file_is_ply(FILE *file) {
 }
 
 TriMesh *load_mesh_ply(const char *fname) {
+	PROF_SCOPE("load_mesh_ply");
 	const char *sep = " \t\n";
 	char buf[BUFFER_SIZE];
 
@@ -110,8 +112,9 @@ TriMesh *load_mesh_ply(const char *fname) {
 	}
 	ply->fp = fp;
 
-	vector<Vertex> verts;
-	vector<Triangle> tris;
+	// read straight into geometry arrays, which are then handed to the mesh
+	VertexArray verts;
+	TriangleArray tris;
 
 	Element *elem;
 
@@ -124,8 +127,11 @@ TriMesh *load_mesh_ply(const char *fname) {
 		FAIL("weird vertex format, didn't find 3 floats");
 	}
 
+	verts.resize(elem->count);
+	Vertex *vptr = verts.get_mod_data();
+
 	for(unsigned long i=0; i<elem->count; i++) {
-		Vertex v;
+		Vertex &v = vptr[i];
 		if(ply->fmt == PLY_ASCII) {
 			fgets(buf, BUFFER_SIZE, fp);
 
@@ -144,7 +150,6 @@ TriMesh *load_mesh_ply(const char *fname) {
 			FAIL("sorry binary ply loading not implemented yet");
 		}
 
-		verts.push_back(v);
 	}
 
 	// -- read the face list
@@ -156,6 +161,11 @@ TriMesh *load_mesh_ply(const char *fname) {
 		FAIL("weird face format, didn't find an index list");
 	}
 
+	// room for all quads, trimmed afterwards
+	tris.resize(elem->count * 2);
+	Triangle *tptr = tris.get_mod_data();
+	unsigned long tcount = 0;
+
 	for(unsigned long i=0; i<elem->count; i++) {
 		int count;
 		unsigned long indices[4];
@@ -180,20 +190,21 @@ TriMesh *load_mesh_ply(const char *fname) {
 			FAIL("sorry binary ply loading not implemented yet");
 		}
 
-		Triangle tri(indices[0], indices[1], indices[2]);
-		tris.push_back(tri);
+		tptr[tcount++] = Triangle(indices[0], indices[1], indices[2]);
 
 		if(count == 4) {
-			Triangle tri2(indices[0], indices[2], indices[3]);
-			tris.push_back(tri2);
+			tptr[tcount++] = Triangle(indices[0], indices[2], indices[3]);
 		}
 	}
+	tris.resize(tcount);
 
 	fclose(fp);
 	delete ply;
 
-	// ok now we have the vertex/triangle vectors, let's create the mesh and return it
-	TriMesh *mesh = new TriMesh(&verts[0], verts.size(), &tris[0], tris.size());
+	// ok now we have the vertex/triangle arrays, let's create the mesh and return it
+	TriMesh *mesh = new TriMesh;
+	mesh->get_mod_vertex_array()->swap(verts);
+	mesh->get_mod_triangle_array()->swap(tris);
 	mesh->calculate_normals();
 	return mesh;
 }
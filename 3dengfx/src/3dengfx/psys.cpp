@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "psys.hpp"
 #include "common/config_parser.h"
 #include "common/err_msg.h"
+#include "common/profile.h"
 
 #ifdef SINGLE_PRECISION_MATH
 #define GL_SCALAR_TYPE	GL_FLOAT
@@ -193,6 +194,12 @@ void ParticleSystem::reset() {
 		delete *iter++;
 	}
 	particles.clear();
+
+	iter = dead_particles.begin();
+	while(iter != dead_particles.end()) {
+		delete *iter++;
+	}
+	dead_particles.clear();
 }
 
 void ParticleSystem::set_update_interval(scalar_t timeslice) {
@@ -213,6 +220,7 @@ void ParticleSystem::set_particle_type(ParticleType ptype) {
 
 void ParticleSystem::update(const Vector3 &ext_force) {
 	if(!ready) return;
+	PROF_SCOPE("ParticleSystem::update");
 	
 	curr_time = global_time;
 	int updates_missed = (int)round((global_time - prev_update) / timeslice);
@@ -257,7 +265,13 @@ void ParticleSystem::update(const Vector3 &ext_force) {
 		
 		switch(ptype) {
 		case PTYPE_BILLBOARD:
-			particle = new BillboardParticle;
+			// recycle a dead particle if there is one, everything is set again below
+			if(dead_particles.empty()) {
+				particles.push_back(new BillboardParticle);
+			} else {
+				particles.splice(particles.end(), dead_particles, dead_particles.begin());
+			}
+			particle = particles.back();
 			{
 				curr_rot = fmod(psys_params.glob_rot * t, two_pi);
 				
@@ -301,8 +315,6 @@ void ParticleSystem::update(const Vector3 &ext_force) {
 		particle->birth_time = t;
 		particle->lifespan = psys_params.lifespan();
 
-		particles.push_back(particle);
-
 		pos += dp;
 		t += dt;
 	}
@@ -321,8 +333,7 @@ void ParticleSystem::update(const Vector3 &ext_force) {
 		if(p->alive()) {
 			iter++;
 		} else {
-			delete *iter;
-			iter = particles.erase(iter);
+			dead_particles.splice(dead_particles.end(), particles, iter++);
 		}
 	}
 
@@ -145,6 +145,8 @@ protected:
 	bool ready;
 	bool psprites_unsupported;
 	std::list<Particle*> particles;
+	// dead billboard particles, along with their list nodes, for reuse
+	std::list<Particle*> dead_particles;
 
 	ParticleSysParams psys_params;
 	ParticleType ptype;
@@ -0,0 +1,351 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* sorted render queue */
+
+#include "3dengfx_config.h"
+
+#include <cstring>
+#include <algorithm>
+#include "rqueue.hpp"
+#include "object.hpp"
+#include "common/threads.h"
+
+// objects prepared by each thread pool work item
+#define PREPARE_CHUNK	64
+
+RenderQueue::RenderQueue(RenderBackend *backend) : filter(backend) {
+	this->backend = backend;
+	parallel = true;
+	time = XFORM_LOCAL_PRS;
+}
+
+void RenderQueue::set_backend(RenderBackend *backend) {
+	this->backend = backend;
+	filter.set_backend(backend);
+}
+
+RenderBackend *RenderQueue::get_backend() const {
+	return backend;
+}
+
+void RenderQueue::set_parallel(bool enable) {
+	parallel = enable;
+}
+
+bool RenderQueue::get_parallel() const {
+	return parallel;
+}
+
+void RenderQueue::clear() {
+	items.clear();
+}
+
+/* build_index_arrays - the index arrays of the meshes are built on first
+ * use, and meshes copied from each other share their arrays through a
+ * plain reference count, so they must be built here on the calling thread,
+ * before the objects are prepared or recorded on the thread pool.
+ */
+static void build_index_arrays(const Object *obj) {
+	obj->get_mesh().get_index_array();
+	for(int i=0; i<obj->get_lod_count(); i++) {
+		obj->get_lod(i)->get_index_array();
+	}
+}
+
+void RenderQueue::add(Object *obj) {
+	build_index_arrays(obj);
+
+	RenderItem item;
+	item.key = get_render_key(obj);
+	item.obj = obj;
+	items.push_back(item);
+}
+
+struct PrepareWork {
+	Object *const *objects;
+	int count;
+	unsigned long time;
+	RenderItem *out;		// obj is left 0 for objects not drawn
+};
+
+static void prepare_objects_work(int idx, void *cls) {
+	PrepareWork *work = (PrepareWork*)cls;
+	int start = idx * PREPARE_CHUNK;
+	int end = std::min(start + PREPARE_CHUNK, work->count);
+
+	for(int i=start; i<end; i++) {
+		Object *obj = work->objects[i];
+		RenderItem *item = work->out + i;
+
+		item->obj = 0;
+		if(!obj->get_render_params().hidden && obj->prepare_render(work->time)) {
+			item->key = get_render_key(obj);
+			item->obj = obj;
+		}
+	}
+}
+
+/* add_objects
+ * the objects are prepared into tmp_items by index, so the order doesn't
+ * depend on the threads, and then the ones to be drawn are appended.
+ */
+void RenderQueue::add_objects(Object *const *objects, int count, unsigned long time) {
+	if(count <= 0) return;
+
+	tmp_items.resize(count);
+	for(int i=0; i<count; i++) {
+		build_index_arrays(objects[i]);
+	}
+
+	PrepareWork work;
+	work.objects = objects;
+	work.count = count;
+	work.time = time;
+	work.out = &tmp_items[0];
+
+	int chunks = (count + PREPARE_CHUNK - 1) / PREPARE_CHUNK;
+	if(parallel && count >= 2 * RQ_PARALLEL_MIN && thr_get_num_workers() > 1) {
+		thr_parallel_for(chunks, prepare_objects_work, &work);
+	} else {
+		for(int i=0; i<chunks; i++) {
+			prepare_objects_work(i, &work);
+		}
+	}
+
+	for(int i=0; i<count; i++) {
+		if(tmp_items[i].obj) {
+			items.push_back(tmp_items[i]);
+		}
+	}
+}
+
+void RenderQueue::sort() {
+	if(items.size() < 2) return;
+
+	tmp_items.resize(items.size());
+	sort_render_items(&items[0], &tmp_items[0], (int)items.size());
+}
+
+/* record
+ * the states left by whoever rendered before are not known, so the
+ * filter starts from scratch.
+ */
+void RenderQueue::record(StateFilter *filter, int start, int end) {
+	filter->reset_stats();
+	filter->invalidate();
+
+	for(int i=start; i<end; i++) {
+		Object *obj = items[i].obj;
+
+		if(obj->is_queueable()) {
+			obj->render_queued(filter);
+		} else {
+			filter->render_object(obj, time);
+		}
+	}
+	filter->flush();
+}
+
+void record_slice_work(int idx, void *cls) {
+	RenderQueue *rq = (RenderQueue*)cls;
+	RecordSlice *slice = &rq->slices[idx];
+
+	rq->record(&slice->filter, slice->start, slice->end);
+
+	// the objects leave their states behind, the last slice restores the defaults
+	if(idx == (int)rq->slices.size() - 1) {
+		slice->filter.restore_defaults();
+	}
+}
+
+/* submit
+ * Each slice is recorded with its own state filter, so the first object of
+ * every slice sets all its states again, which is the price for recording
+ * them at the same time.
+ */
+unsigned long RenderQueue::submit(unsigned long time) {
+	unsigned long start_tris = stats.tris;
+	int count = (int)items.size();
+	this->time = time;
+
+	int num_slices = parallel ? std::min(thr_get_num_workers(), count / RQ_PARALLEL_MIN) : 1;
+
+	if(num_slices <= 1) {
+		record(&filter, 0, count);
+		filter.restore_defaults();
+		stats += *filter.get_stats();
+	} else {
+		slices.resize(num_slices);
+		for(int i=0; i<num_slices; i++) {
+			RecordSlice *slice = &slices[i];
+			slice->start = count * i / num_slices;
+			slice->end = count * (i + 1) / num_slices;
+			slice->cmd.clear();
+			slice->filter.set_backend(&slice->cmd);
+		}
+
+		thr_parallel_for(num_slices, record_slice_work, this);
+
+		for(int i=0; i<num_slices; i++) {
+			slices[i].cmd.replay(backend);
+			stats += *slices[i].filter.get_stats();
+		}
+	}
+
+	return stats.tris - start_tris;
+}
+
+int RenderQueue::get_item_count() const {
+	return (int)items.size();
+}
+
+const RenderItem *RenderQueue::get_items() const {
+	return items.empty() ? 0 : &items[0];
+}
+
+void RenderQueue::reset_stats() {
+	stats.reset();
+}
+
+const RenderStats *RenderQueue::get_stats() const {
+	return &stats;
+}
+
+
+// multiplicative hashing of a pointer or value down to the given number of bits
+static inline uint64_t hash_bits(unsigned long val, int bits) {
+	uint32_t h = (uint32_t)(val ^ (val >> 16) ^ (val >> 32 >> 16)) * 2654435761u;
+	return (uint64_t)(h >> (32 - bits));
+}
+
+static uint64_t material_id(const Material &mat, int bits) {
+	float val[MAT_VALUE_COUNT];
+	get_material_values(mat, val);
+
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	const unsigned char *ptr = (const unsigned char*)val;
+	for(size_t i=0; i<sizeof val; i++) {
+		h = (h ^ ptr[i]) * 16777619u;
+	}
+	return (uint64_t)(h >> (32 - bits));
+}
+
+/* get_depth_bits
+ * the bit pattern of a positive float grows with its value, so the top
+ * bits make a depth key without knowing the depth range.
+ */
+static inline uint64_t get_depth_bits(scalar_t z, int bits) {
+	union {
+		float f;
+		uint32_t i;
+	} u;
+	u.f = z > 0.0 ? (float)z : 0.0f;
+	return (uint64_t)(u.i >> (31 - bits));
+}
+
+uint64_t get_render_key(Object *obj) {
+	const Material *mat = obj->get_material_ptr();
+	RenderParams rp = obj->get_render_params();
+
+	bool blended = false;
+	if(master_render_mode & RMODE_BLENDING) {
+		blended = rp.handle_blending ? mat->alpha < 1.0 - small_number : rp.blending;
+	}
+
+	GfxProg *prog = (master_render_mode & RMODE_SHADERS) ? rp.gfxprog : 0;
+	unsigned long tex = 0;
+	if(master_render_mode & RMODE_TEXTURES) {
+		tex = (unsigned long)mat->tex[TEXTYPE_DIFFUSE] ^ ((unsigned long)mat->tex[TEXTYPE_DETAIL] * 31);
+	}
+
+	// objects sharing their mesh share the array data
+	const TriMesh *mesh = &obj->get_mesh();
+	unsigned long mesh_id = (unsigned long)mesh->get_vertex_array()->get_data() ^
+		((unsigned long)mesh->get_triangle_array()->get_data() * 31);
+
+	const Matrix4x4 &world = obj->get_world_matrix();
+	const Matrix4x4 &view = engfx_state::view_matrix;
+
+	// view space depth of the object origin, positive in front of the camera
+	scalar_t z = view[2][0] * world[0][3] + view[2][1] * world[1][3] + view[2][2] * world[2][3] + view[2][3];
+#ifndef COORD_LHS
+	z = -z;		// the camera looks down -z
+#endif
+
+	uint64_t key;
+	if(!blended && !rp.zwrite) {
+		key = (uint64_t)RQ_PASS_BACKGROUND << 62;
+	} else if(blended) {
+		uint64_t depth = ~get_depth_bits(z, 24) & 0xffffff;
+		key = ((uint64_t)RQ_PASS_BLENDED << 62) | (depth << 38) | (hash_bits((unsigned long)prog, 10) << 28) |
+			(hash_bits(tex, 14) << 14) | material_id(*mat, 14);
+	} else {
+		key = ((uint64_t)RQ_PASS_OPAQUE << 62) | (hash_bits((unsigned long)prog, 12) << 50) |
+			(hash_bits(tex, 16) << 34) | (material_id(*mat, 14) << 20) | (hash_bits(mesh_id, 8) << 12) |
+			get_depth_bits(z, 12);
+	}
+	return key;
+}
+
+/* sort_render_items
+ * LSD radix sort, all the digit histograms are gathered in one pass, and
+ * digits which are the same for all the keys (most of them, as long as the
+ * items share states) are skipped.
+ */
+void sort_render_items(RenderItem *items, RenderItem *tmp, int count) {
+	unsigned int hist[8][256];
+	memset(hist, 0, sizeof hist);
+
+	for(int i=0; i<count; i++) {
+		uint64_t key = items[i].key;
+		for(int j=0; j<8; j++) {
+			hist[j][(key >> (j * 8)) & 0xff]++;
+		}
+	}
+
+	RenderItem *src = items, *dest = tmp;
+
+	for(int j=0; j<8; j++) {
+		int shift = j * 8;
+		unsigned int *h = hist[j];
+		if(h[(src[0].key >> shift) & 0xff] == (unsigned int)count) continue;
+
+		unsigned int offs = 0;
+		for(int i=0; i<256; i++) {
+			unsigned int n = h[i];
+			h[i] = offs;
+			offs += n;
+		}
+
+		for(int i=0; i<count; i++) {
+			dest[h[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+
+		RenderItem *swap_tmp = src;
+		src = dest;
+		dest = swap_tmp;
+	}
+
+	if(src != items) {
+		memcpy(items, src, count * sizeof *items);
+	}
+}
@@ -0,0 +1,130 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* sorted render queue
+ *
+ * Visible objects are collected with a 64bit sort key, radix sorted, and
+ * drawn through a StateFilter, so that the states shared by neighbouring
+ * objects are set once. Most significant key bits first:
+ *
+ *  background: pass (2) | 0
+ *  opaque:     pass (2) | program (12) | textures (16) | material (14) | mesh (8) | depth (12)
+ *  blended:    pass (2) | depth (24)   | program (10)  | textures (14) | material (14)
+ *
+ * Opaque objects that don't write to the zbuffer (skyboxes, backgrounds)
+ * rely on being drawn before the rest, in the order they were added, as
+ * they were drawn in object list order before there was a queue. They get
+ * a pass of their own, with nothing else in the key, and the sort is
+ * stable, so they keep that order. Opaque objects are drawn next, grouped
+ * by state and mesh, and front to back within a group, so that instances of
+ * a shared mesh end up next to each other and are drawn as one batch by the
+ * StateFilter. Blended objects
+ * are drawn back to front, grouped by state only where they are at the same
+ * depth.
+ *
+ * With parallel recording on, the objects are prepared (animation, culling,
+ * sort keys) on the thread pool, and the sorted queue is split into slices
+ * which are recorded into command lists by the pool as well. The calling
+ * thread then only replays the lists on the backend, in order. Anything
+ * the meshes build lazily and share between copies (the index arrays) is
+ * built by add and add_objects on the calling thread first.
+ */
+
+#ifndef _RQUEUE_HPP_
+#define _RQUEUE_HPP_
+
+#include <vector>
+#include "common/types.h"
+#include "rstate.hpp"
+#include "cmdlist.hpp"
+
+class Object;
+
+enum {
+	RQ_PASS_BACKGROUND,
+	RQ_PASS_OPAQUE,
+	RQ_PASS_BLENDED
+};
+
+// fewer objects than this per thread are not worth handing to the thread pool
+#define RQ_PARALLEL_MIN		128
+
+struct RenderItem {
+	uint64_t key;
+	Object *obj;
+};
+
+struct RecordSlice {
+	int start, end;
+	CommandList cmd;
+	StateFilter filter;
+};
+
+class RenderQueue {
+private:
+	std::vector<RenderItem> items, tmp_items;
+	RenderBackend *backend;
+	StateFilter filter;
+	RenderStats stats;
+
+	bool parallel;
+	std::vector<RecordSlice> slices;
+	unsigned long time;
+
+	void record(StateFilter *filter, int start, int end);
+
+	friend void record_slice_work(int idx, void *cls);
+
+public:
+	RenderQueue(RenderBackend *backend = get_gl_backend());
+
+	void set_backend(RenderBackend *backend);
+	RenderBackend *get_backend() const;
+
+	// on by default, off means everything is done on the calling thread
+	void set_parallel(bool enable);
+	bool get_parallel() const;
+
+	void clear();
+	// adds an object already passed through Object::prepare_render()
+	void add(Object *obj);
+	/* prepares the objects for the given time, and adds the ones which are
+	 * not hidden and are inside the view frustum, in the given order.
+	 */
+	void add_objects(Object *const *objects, int count, unsigned long time = XFORM_LOCAL_PRS);
+	void sort();
+
+	// draws the items in order, returns the number of triangles drawn
+	unsigned long submit(unsigned long time = XFORM_LOCAL_PRS);
+
+	int get_item_count() const;
+	const RenderItem *get_items() const;
+
+	void reset_stats();
+	const RenderStats *get_stats() const;
+};
+
+// the sort key of an object prepared with Object::prepare_render()
+uint64_t get_render_key(Object *obj);
+
+// sorts by key, radix sort with 8bit digits, tmp must have room for count items
+void sort_render_items(RenderItem *items, RenderItem *tmp, int count);
+
+#endif	// _RQUEUE_HPP_
@@ -0,0 +1,674 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* render backends and redundant render state filtering */
+
+#include "3dengfx_config.h"
+
+#include <cstring>
+#include "rstate.hpp"
+#include "object.hpp"
+
+TextureStage::TextureStage() {
+	color_op = alpha_op = TOP_MODULATE;
+	color_arg1 = alpha_arg1 = TARG_TEXTURE;
+	color_arg2 = alpha_arg2 = TARG_PREV;
+	coord_index = 0;
+}
+
+TextureStage::TextureStage(TextureBlendFunction color_op, TextureBlendArgument color_arg1, TextureBlendArgument color_arg2,
+		TextureBlendFunction alpha_op, TextureBlendArgument alpha_arg1, TextureBlendArgument alpha_arg2, int coord_index) {
+	this->color_op = color_op;
+	this->color_arg1 = color_arg1;
+	this->color_arg2 = color_arg2;
+	this->alpha_op = alpha_op;
+	this->alpha_arg1 = alpha_arg1;
+	this->alpha_arg2 = alpha_arg2;
+	this->coord_index = coord_index;
+}
+
+bool TextureStage::operator ==(const TextureStage &ts) const {
+	return color_op == ts.color_op && color_arg1 == ts.color_arg1 && color_arg2 == ts.color_arg2 &&
+		alpha_op == ts.alpha_op && alpha_arg1 == ts.alpha_arg1 && alpha_arg2 == ts.alpha_arg2 &&
+		coord_index == ts.coord_index;
+}
+
+
+RenderStats::RenderStats() {
+	reset();
+}
+
+void RenderStats::reset() {
+	memset(changes, 0, sizeof changes);
+	memset(skipped, 0, sizeof skipped);
+	draws = 0;
+	batches = 0;
+	tris = 0;
+}
+
+RenderStats &RenderStats::operator +=(const RenderStats &rs) {
+	for(int i=0; i<RSTATE_COUNT; i++) {
+		changes[i] += rs.changes[i];
+		skipped[i] += rs.skipped[i];
+	}
+	draws += rs.draws;
+	batches += rs.batches;
+	tris += rs.tris;
+	return *this;
+}
+
+int RenderStats::total_changes() const {
+	int sum = 0;
+	for(int i=0; i<RSTATE_COUNT; i++) {
+		sum += changes[i];
+	}
+	return sum;
+}
+
+int RenderStats::total_skipped() const {
+	int sum = 0;
+	for(int i=0; i<RSTATE_COUNT; i++) {
+		sum += skipped[i];
+	}
+	return sum;
+}
+
+static const char *rstate_names[] = {
+	"zwrite", "blending", "blend func", "shading", "wireframe", "culling",
+	"vertex colors", "auto normalize", "gfx program", "material", "world matrix", "view matrix",
+	"texture", "texture unit", "texture stage", "texture addressing", "texture matrix"
+};
+
+const char *get_render_state_name(RenderState state) {
+	return state >= 0 && state < RSTATE_COUNT ? rstate_names[state] : "unknown";
+}
+
+RenderBackend::~RenderBackend() {}
+
+void RenderBackend::draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+	for(int i=0; i<count; i++) {
+		set_matrix(XFORM_WORLD, world[i]);
+		draw(varray, iarray);
+	}
+}
+
+
+// ---- GLRenderBackend ----
+
+void GLRenderBackend::set_zwrite(bool enable) {
+	::set_zwrite(enable);
+}
+
+void GLRenderBackend::set_alpha_blending(bool enable) {
+	::set_alpha_blending(enable);
+}
+
+void GLRenderBackend::set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	::set_blend_func(src, dest);
+}
+
+void GLRenderBackend::set_shading_mode(ShadeMode mode) {
+	::set_shading_mode(mode);
+}
+
+void GLRenderBackend::set_wireframe(bool enable) {
+	::set_wireframe(enable);
+}
+
+void GLRenderBackend::set_backface_culling(bool enable) {
+	::set_backface_culling(enable);
+}
+
+void GLRenderBackend::use_vertex_colors(bool enable) {
+	::use_vertex_colors(enable);
+}
+
+void GLRenderBackend::set_auto_normalize(bool enable) {
+	::set_auto_normalize(enable);
+}
+
+void GLRenderBackend::set_gfx_program(GfxProg *prog) {
+	::set_gfx_program(prog);
+}
+
+void GLRenderBackend::update_gfx_program(GfxProg *prog) {
+	if(prog && engfx_state::sys_caps.prog.glslang) {
+		prog->update();
+	}
+}
+
+void GLRenderBackend::set_material(const Material &mat) {
+	mat.set_glmaterial();
+}
+
+void GLRenderBackend::set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
+	::set_matrix(xform_type, mat, num);
+}
+
+void GLRenderBackend::set_texture(int tex_unit, const Texture *tex) {
+	::set_texture(tex_unit, tex);
+}
+
+void GLRenderBackend::enable_texture_unit(int tex_unit, bool enable) {
+	if(enable) {
+		::enable_texture_unit(tex_unit);
+	} else {
+		::disable_texture_unit(tex_unit);
+	}
+}
+
+void GLRenderBackend::set_texture_stage(int tex_unit, const TextureStage &stage) {
+	set_texture_unit_color(tex_unit, stage.color_op, stage.color_arg1, stage.color_arg2);
+	set_texture_unit_alpha(tex_unit, stage.alpha_op, stage.alpha_arg1, stage.alpha_arg2);
+	set_texture_coord_index(tex_unit, stage.coord_index);
+}
+
+void GLRenderBackend::set_texture_addressing(int tex_unit, TextureAddressing taddr) {
+	// texture parameters go to the texture bound to the active unit
+	select_texture_unit(tex_unit);
+	::set_texture_addressing(tex_unit, taddr, taddr);
+}
+
+void GLRenderBackend::draw(const VertexArray &varray, const IndexArray &iarray) {
+	::draw(varray, iarray);
+}
+
+void GLRenderBackend::draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+	::draw_instances(varray, iarray, world, count);
+}
+
+void GLRenderBackend::render_object(Object *obj, unsigned long time) {
+	obj->render_prepared(time);
+}
+
+
+RenderBackend *get_gl_backend() {
+	static GLRenderBackend gl_backend;
+	return &gl_backend;
+}
+
+
+// ---- NullRenderBackend ----
+
+void NullRenderBackend::reset() {
+	stats.reset();
+}
+
+const RenderStats *NullRenderBackend::get_stats() const {
+	return &stats;
+}
+
+void NullRenderBackend::set_zwrite(bool enable) {
+	stats.changes[RSTATE_ZWRITE]++;
+}
+
+void NullRenderBackend::set_alpha_blending(bool enable) {
+	stats.changes[RSTATE_BLENDING]++;
+}
+
+void NullRenderBackend::set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	stats.changes[RSTATE_BLEND_FUNC]++;
+}
+
+void NullRenderBackend::set_shading_mode(ShadeMode mode) {
+	stats.changes[RSTATE_SHADING]++;
+}
+
+void NullRenderBackend::set_wireframe(bool enable) {
+	stats.changes[RSTATE_WIREFRAME]++;
+}
+
+void NullRenderBackend::set_backface_culling(bool enable) {
+	stats.changes[RSTATE_CULLING]++;
+}
+
+void NullRenderBackend::use_vertex_colors(bool enable) {
+	stats.changes[RSTATE_VERTEX_COLORS]++;
+}
+
+void NullRenderBackend::set_auto_normalize(bool enable) {
+	stats.changes[RSTATE_AUTO_NORMALIZE]++;
+}
+
+void NullRenderBackend::set_gfx_program(GfxProg *prog) {
+	stats.changes[RSTATE_GFX_PROGRAM]++;
+}
+
+void NullRenderBackend::update_gfx_program(GfxProg *prog) {}
+
+void NullRenderBackend::set_material(const Material &mat) {
+	stats.changes[RSTATE_MATERIAL]++;
+}
+
+void NullRenderBackend::set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
+	switch(xform_type) {
+	case XFORM_TEXTURE:
+		stats.changes[RSTATE_TEXTURE_MATRIX]++;
+		break;
+	case XFORM_WORLD:
+		stats.changes[RSTATE_WORLD_MATRIX]++;
+		break;
+	default:
+		stats.changes[RSTATE_VIEW_MATRIX]++;
+	}
+}
+
+void NullRenderBackend::set_texture(int tex_unit, const Texture *tex) {
+	stats.changes[RSTATE_TEXTURE]++;
+}
+
+void NullRenderBackend::enable_texture_unit(int tex_unit, bool enable) {
+	stats.changes[RSTATE_TEXTURE_UNIT]++;
+}
+
+void NullRenderBackend::set_texture_stage(int tex_unit, const TextureStage &stage) {
+	stats.changes[RSTATE_TEXTURE_STAGE]++;
+}
+
+void NullRenderBackend::set_texture_addressing(int tex_unit, TextureAddressing taddr) {
+	stats.changes[RSTATE_TEXTURE_ADDRESSING]++;
+}
+
+void NullRenderBackend::draw(const VertexArray &varray, const IndexArray &iarray) {
+	stats.draws++;
+	stats.tris += iarray.get_count() / 3;
+}
+
+void NullRenderBackend::draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count) {
+	stats.changes[RSTATE_WORLD_MATRIX] += count;
+	stats.draws += count;
+	stats.batches++;
+	stats.tris += count * (iarray.get_count() / 3);
+}
+
+void NullRenderBackend::render_object(Object *obj, unsigned long time) {
+	stats.draws++;
+	stats.tris += obj->get_triangle_count();
+}
+
+
+// ---- StateFilter ----
+
+void get_material_values(const Material &mat, float *val) {
+	const Color *col[] = {&mat.ambient_color, &mat.diffuse_color, &mat.specular_color, &mat.emissive_color};
+	for(int i=0; i<4; i++) {
+		*val++ = col[i]->r;
+		*val++ = col[i]->g;
+		*val++ = col[i]->b;
+		*val++ = col[i]->a * mat.alpha;
+	}
+	*val = mat.specular_power;
+}
+
+static bool same_matrix(const Matrix4x4 &m1, const Matrix4x4 &m2) {
+	return !memcmp(&m1, &m2, sizeof m1);
+}
+
+StateFilter::StateFilter(RenderBackend *backend) {
+	this->backend = backend;
+	world = Matrix4x4::identity_matrix;
+	batch_varray = 0;
+	batch_iarray = 0;
+	invalidate();
+}
+
+void StateFilter::set_backend(RenderBackend *backend) {
+	flush();
+	this->backend = backend;
+	invalidate();
+}
+
+RenderBackend *StateFilter::get_backend() const {
+	return backend;
+}
+
+inline bool StateFilter::is_known(RenderState state) const {
+	return (known & (1 << state)) != 0;
+}
+
+inline bool StateFilter::is_known(int tex_unit, RenderState state) const {
+	return (unit_known[tex_unit] & (1 << state)) != 0;
+}
+
+inline void StateFilter::set_known(RenderState state) {
+	known |= 1 << state;
+}
+
+inline void StateFilter::set_known(int tex_unit, RenderState state) {
+	unit_known[tex_unit] |= 1 << state;
+}
+
+inline void StateFilter::forget(RenderState state) {
+	known &= ~(1 << state);
+}
+
+inline void StateFilter::forget(int tex_unit, RenderState state) {
+	unit_known[tex_unit] &= ~(1 << state);
+}
+
+void StateFilter::invalidate() {
+	flush();
+	world_pending = world_sent = false;
+
+	known = 0;
+	for(int i=0; i<MAX_TEXTURES; i++) {
+		unit_known[i] = 0;
+	}
+}
+
+void StateFilter::restore_defaults() {
+	set_zwrite(true);
+	set_alpha_blending(false);
+	set_wireframe(false);
+	set_backface_culling(true);
+	use_vertex_colors(false);
+	set_auto_normalize(false);
+	set_shading_mode(SHADING_GOURAUD);
+	set_gfx_program(0);
+	disable_texture_units(0);
+}
+
+/* flush
+ * a single draw goes out as it came, along with its world matrix unless
+ * that was already sent.
+ */
+void StateFilter::flush() {
+	if(batch_world.empty()) return;
+
+	int count = (int)batch_world.size();
+	if(count == 1) {
+		if(!batch_world_sent) {
+			backend->set_matrix(XFORM_WORLD, batch_world[0]);
+			stats.changes[RSTATE_WORLD_MATRIX]++;
+		}
+		backend->draw(*batch_varray, *batch_iarray);
+	} else {
+		backend->draw_instances(*batch_varray, *batch_iarray, &batch_world[0], count);
+		stats.changes[RSTATE_WORLD_MATRIX] += count;
+		stats.batches++;
+	}
+	batch_world.clear();
+}
+
+// for whatever needs the world matrix before the draw (program update handlers)
+void StateFilter::send_world() {
+	if(world_pending) {
+		backend->set_matrix(XFORM_WORLD, world);
+		world_pending = false;
+		world_sent = true;
+		stats.changes[RSTATE_WORLD_MATRIX]++;
+	}
+}
+
+void StateFilter::reset_stats() {
+	stats.reset();
+}
+
+const RenderStats *StateFilter::get_stats() const {
+	return &stats;
+}
+
+/* the boolean states all work the same way, the macro saves writing
+ * them out one by one.
+ */
+#define FILTER_BOOL_STATE(func, state, var) \
+	void StateFilter::func(bool enable) { \
+		if(is_known(state) && var == enable) { \
+			stats.skipped[state]++; \
+			return; \
+		} \
+		flush(); \
+		backend->func(enable); \
+		var = enable; \
+		set_known(state); \
+		stats.changes[state]++; \
+	}
+
+FILTER_BOOL_STATE(set_zwrite, RSTATE_ZWRITE, zwrite)
+FILTER_BOOL_STATE(set_alpha_blending, RSTATE_BLENDING, blending)
+FILTER_BOOL_STATE(set_wireframe, RSTATE_WIREFRAME, wireframe)
+FILTER_BOOL_STATE(set_backface_culling, RSTATE_CULLING, culling)
+FILTER_BOOL_STATE(set_auto_normalize, RSTATE_AUTO_NORMALIZE, normalize)
+
+void StateFilter::use_vertex_colors(bool enable) {
+	if(is_known(RSTATE_VERTEX_COLORS) && vcolors == enable) {
+		stats.skipped[RSTATE_VERTEX_COLORS]++;
+	} else {
+		flush();
+		backend->use_vertex_colors(enable);
+		vcolors = enable;
+		set_known(RSTATE_VERTEX_COLORS);
+		stats.changes[RSTATE_VERTEX_COLORS]++;
+	}
+
+	// while color material is on, the material colors follow the vertex colors
+	if(enable) forget(RSTATE_MATERIAL);
+}
+
+void StateFilter::set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	if(is_known(RSTATE_BLEND_FUNC) && src_blend == src && dest_blend == dest) {
+		stats.skipped[RSTATE_BLEND_FUNC]++;
+		return;
+	}
+	flush();
+	backend->set_blend_func(src, dest);
+	src_blend = src;
+	dest_blend = dest;
+	set_known(RSTATE_BLEND_FUNC);
+	stats.changes[RSTATE_BLEND_FUNC]++;
+}
+
+void StateFilter::set_shading_mode(ShadeMode mode) {
+	if(is_known(RSTATE_SHADING) && shading == mode) {
+		stats.skipped[RSTATE_SHADING]++;
+		return;
+	}
+	flush();
+	backend->set_shading_mode(mode);
+	shading = mode;
+	set_known(RSTATE_SHADING);
+	stats.changes[RSTATE_SHADING]++;
+}
+
+/* set_gfx_program
+ * the program binding is skipped if it's already bound, but its update
+ * handler is called for every object like set_gfx_program() always did,
+ * since it may depend on the object being drawn (and its world matrix,
+ * which is why objects with programs are not batched).
+ */
+void StateFilter::set_gfx_program(GfxProg *prog) {
+	if(is_known(RSTATE_GFX_PROGRAM) && this->prog == prog) {
+		if(prog) {
+			flush();
+			send_world();
+			backend->update_gfx_program(prog);
+		}
+		stats.skipped[RSTATE_GFX_PROGRAM]++;
+		return;
+	}
+	flush();
+	send_world();
+	backend->set_gfx_program(prog);
+	this->prog = prog;
+	set_known(RSTATE_GFX_PROGRAM);
+	stats.changes[RSTATE_GFX_PROGRAM]++;
+}
+
+void StateFilter::set_material(const Material &mat) {
+	float val[MAT_VALUE_COUNT];
+	get_material_values(mat, val);
+
+	if(is_known(RSTATE_MATERIAL) && !memcmp(val, mat_values, sizeof val)) {
+		stats.skipped[RSTATE_MATERIAL]++;
+		return;
+	}
+	flush();
+	backend->set_material(mat);
+	memcpy(mat_values, val, sizeof val);
+	set_known(RSTATE_MATERIAL);
+	stats.changes[RSTATE_MATERIAL]++;
+}
+
+/* set_matrix
+ * matrices are just stored by the engine until the next draw, but an
+ * unchanged texture matrix saves reloading it (see load_xform_matrices()).
+ * The world matrix is held back until the draw, so that it can go with a
+ * batch, and is counted when flush() sends it. One replaced before any draw
+ * used it counts as dropped. The view and projection matrices are always
+ * passed through.
+ */
+void StateFilter::set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num) {
+	if(xform_type == XFORM_TEXTURE) {
+		if(is_known(num, RSTATE_TEXTURE_MATRIX) && same_matrix(tex_matrix[num], mat)) {
+			stats.skipped[RSTATE_TEXTURE_MATRIX]++;
+			return;
+		}
+		tex_matrix[num] = mat;
+		set_known(num, RSTATE_TEXTURE_MATRIX);
+		stats.changes[RSTATE_TEXTURE_MATRIX]++;
+	} else {
+		if(xform_type == XFORM_WORLD) {
+			if(world_pending) {
+				stats.skipped[RSTATE_WORLD_MATRIX]++;
+			}
+			world = mat;
+			world_pending = true;
+			world_sent = false;
+			return;
+		}
+		stats.changes[RSTATE_VIEW_MATRIX]++;
+	}
+	flush();
+	backend->set_matrix(xform_type, mat, num);
+}
+
+void StateFilter::set_texture(int tex_unit, const Texture *tex) {
+	if(is_known(tex_unit, RSTATE_TEXTURE) && this->tex[tex_unit] == tex) {
+		stats.skipped[RSTATE_TEXTURE]++;
+		return;
+	}
+
+	/* units are enabled by the type of the texture bound to them, so an
+	 * enabled unit must be disabled before binding a texture of another type.
+	 */
+	if(is_known(tex_unit, RSTATE_TEXTURE_UNIT) && unit_enabled[tex_unit]) {
+		if(!is_known(tex_unit, RSTATE_TEXTURE) || this->tex[tex_unit]->get_type() != tex->get_type()) {
+			enable_texture_unit(tex_unit, false);
+		}
+	}
+
+	flush();
+	backend->set_texture(tex_unit, tex);
+	this->tex[tex_unit] = tex;
+	set_known(tex_unit, RSTATE_TEXTURE);
+	forget(tex_unit, RSTATE_TEXTURE_ADDRESSING);	// that belongs to the texture
+	stats.changes[RSTATE_TEXTURE]++;
+}
+
+void StateFilter::enable_texture_unit(int tex_unit, bool enable) {
+	if(is_known(tex_unit, RSTATE_TEXTURE_UNIT) && unit_enabled[tex_unit] == enable) {
+		stats.skipped[RSTATE_TEXTURE_UNIT]++;
+		return;
+	}
+	flush();
+	backend->enable_texture_unit(tex_unit, enable);
+	unit_enabled[tex_unit] = enable;
+	set_known(tex_unit, RSTATE_TEXTURE_UNIT);
+	stats.changes[RSTATE_TEXTURE_UNIT]++;
+}
+
+void StateFilter::set_texture_stage(int tex_unit, const TextureStage &stage) {
+	if(is_known(tex_unit, RSTATE_TEXTURE_STAGE) && this->stage[tex_unit] == stage) {
+		stats.skipped[RSTATE_TEXTURE_STAGE]++;
+		return;
+	}
+	flush();
+	backend->set_texture_stage(tex_unit, stage);
+	this->stage[tex_unit] = stage;
+	set_known(tex_unit, RSTATE_TEXTURE_STAGE);
+	stats.changes[RSTATE_TEXTURE_STAGE]++;
+}
+
+void StateFilter::set_texture_addressing(int tex_unit, TextureAddressing taddr) {
+	if(is_known(tex_unit, RSTATE_TEXTURE_ADDRESSING) && this->taddr[tex_unit] == taddr) {
+		stats.skipped[RSTATE_TEXTURE_ADDRESSING]++;
+		return;
+	}
+	flush();
+	backend->set_texture_addressing(tex_unit, taddr);
+	this->taddr[tex_unit] = taddr;
+	set_known(tex_unit, RSTATE_TEXTURE_ADDRESSING);
+	stats.changes[RSTATE_TEXTURE_ADDRESSING]++;
+
+	// the same texture may be bound to other units as well
+	for(int i=0; i<MAX_TEXTURES; i++) {
+		if(i != tex_unit && is_known(i, RSTATE_TEXTURE) && tex[i] == tex[tex_unit]) {
+			forget(i, RSTATE_TEXTURE_ADDRESSING);
+		}
+	}
+}
+
+void StateFilter::disable_texture_units(int first_unit) {
+	for(int i=first_unit; i<MAX_TEXTURES; i++) {
+		enable_texture_unit(i, false);
+		set_matrix(XFORM_TEXTURE, Matrix4x4::identity_matrix, i);
+	}
+}
+
+/* draw
+ * draws of the same array data (separate arrays of objects sharing a mesh)
+ * with no other state changes in between are collected in a batch, until
+ * something else reaches the backend or flush() is called.
+ */
+void StateFilter::draw(const VertexArray &varray, const IndexArray &iarray) {
+	stats.draws++;
+	stats.tris += iarray.get_count() / 3;
+
+	if(!world_pending && !world_sent && batch_world.empty()) {
+		// no new world matrix since the last draw, the one in effect will do
+		backend->draw(varray, iarray);
+		return;
+	}
+
+	bool same = !batch_world.empty() && varray.get_data() == batch_varray->get_data() &&
+		iarray.get_data() == batch_iarray->get_data() && varray.get_dynamic() == batch_varray->get_dynamic();
+
+	if(!same) {
+		flush();
+		batch_varray = &varray;
+		batch_iarray = &iarray;
+		batch_world_sent = world_sent;
+	}
+	batch_world.push_back(world);
+	world_pending = world_sent = false;
+}
+
+/* render_object
+ * objects drawing themselves expect the default states, and leave
+ * behind whatever they like, so nothing is known afterwards.
+ */
+void StateFilter::render_object(Object *obj, unsigned long time) {
+	flush();
+	restore_defaults();
+	backend->render_object(obj, time);
+	invalidate();
+	stats.draws++;
+	stats.tris += obj->get_triangle_count();
+}
@@ -0,0 +1,275 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* render backends and redundant render state filtering
+ *
+ * RenderBackend is what the render queue issues its state changes and draw
+ * calls through. GLRenderBackend passes them on to the 3denginefx functions,
+ * NullRenderBackend just counts them, so the queue can be run without a
+ * graphics context.
+ *
+ * StateFilter sits in front of a backend and keeps a shadow copy of every
+ * state set through it, dropping the calls which would not change anything.
+ * It also holds back draws of the same arrays with nothing but the world
+ * matrix changing in between (instances of a shared mesh), and passes them
+ * on as one draw_instances() call.
+ */
+
+#ifndef _RSTATE_HPP_
+#define _RSTATE_HPP_
+
+#include <vector>
+#include "3denginefx.hpp"
+#include "gfxprog.hpp"
+
+class Object;
+
+enum RenderState {
+	RSTATE_ZWRITE,
+	RSTATE_BLENDING,
+	RSTATE_BLEND_FUNC,
+	RSTATE_SHADING,
+	RSTATE_WIREFRAME,
+	RSTATE_CULLING,
+	RSTATE_VERTEX_COLORS,
+	RSTATE_AUTO_NORMALIZE,
+	RSTATE_GFX_PROGRAM,
+	RSTATE_MATERIAL,
+	RSTATE_WORLD_MATRIX,
+	RSTATE_VIEW_MATRIX,		// view and projection
+	// per texture unit
+	RSTATE_TEXTURE,
+	RSTATE_TEXTURE_UNIT,
+	RSTATE_TEXTURE_STAGE,
+	RSTATE_TEXTURE_ADDRESSING,
+	RSTATE_TEXTURE_MATRIX,
+
+	RSTATE_COUNT
+};
+
+// texture combiner setup and texture coordinate set of a texture unit
+struct TextureStage {
+	TextureBlendFunction color_op, alpha_op;
+	TextureBlendArgument color_arg1, color_arg2;
+	TextureBlendArgument alpha_arg1, alpha_arg2;
+	int coord_index;
+
+	TextureStage();
+	TextureStage(TextureBlendFunction color_op, TextureBlendArgument color_arg1, TextureBlendArgument color_arg2,
+			TextureBlendFunction alpha_op, TextureBlendArgument alpha_arg1, TextureBlendArgument alpha_arg2, int coord_index);
+
+	bool operator ==(const TextureStage &ts) const;
+};
+
+struct RenderStats {
+	int changes[RSTATE_COUNT];	// state changes passed to the backend
+	int skipped[RSTATE_COUNT];	// redundant state changes dropped
+	int draws;
+	int batches;		// draw_instances() calls, included in draws
+	unsigned long tris;
+
+	RenderStats();
+	void reset();
+
+	RenderStats &operator +=(const RenderStats &rs);
+
+	int total_changes() const;
+	int total_skipped() const;
+};
+
+const char *get_render_state_name(RenderState state);
+
+class RenderBackend {
+public:
+	virtual ~RenderBackend();
+
+	virtual void set_zwrite(bool enable) = 0;
+	virtual void set_alpha_blending(bool enable) = 0;
+	virtual void set_blend_func(BlendingFactor src, BlendingFactor dest) = 0;
+	virtual void set_shading_mode(ShadeMode mode) = 0;
+	virtual void set_wireframe(bool enable) = 0;
+	virtual void set_backface_culling(bool enable) = 0;
+	virtual void use_vertex_colors(bool enable) = 0;
+	virtual void set_auto_normalize(bool enable) = 0;
+	virtual void set_gfx_program(GfxProg *prog) = 0;
+	// called instead of set_gfx_program() when the program is already bound
+	virtual void update_gfx_program(GfxProg *prog) = 0;
+	virtual void set_material(const Material &mat) = 0;
+	virtual void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num = 0) = 0;
+
+	virtual void set_texture(int tex_unit, const Texture *tex) = 0;
+	virtual void enable_texture_unit(int tex_unit, bool enable) = 0;
+	virtual void set_texture_stage(int tex_unit, const TextureStage &stage) = 0;
+	virtual void set_texture_addressing(int tex_unit, TextureAddressing taddr) = 0;
+
+	virtual void draw(const VertexArray &varray, const IndexArray &iarray) = 0;
+	// draws the arrays with each world matrix, the default sets them one by one
+	virtual void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count);
+	/* lets an object prepared for the frame set up its own states and draw
+	 * itself (Object::render_prepared())
+	 */
+	virtual void render_object(Object *obj, unsigned long time) = 0;
+};
+
+class GLRenderBackend : public RenderBackend {
+public:
+	virtual void set_zwrite(bool enable);
+	virtual void set_alpha_blending(bool enable);
+	virtual void set_blend_func(BlendingFactor src, BlendingFactor dest);
+	virtual void set_shading_mode(ShadeMode mode);
+	virtual void set_wireframe(bool enable);
+	virtual void set_backface_culling(bool enable);
+	virtual void use_vertex_colors(bool enable);
+	virtual void set_auto_normalize(bool enable);
+	virtual void set_gfx_program(GfxProg *prog);
+	virtual void update_gfx_program(GfxProg *prog);
+	virtual void set_material(const Material &mat);
+	virtual void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num = 0);
+
+	virtual void set_texture(int tex_unit, const Texture *tex);
+	virtual void enable_texture_unit(int tex_unit, bool enable);
+	virtual void set_texture_stage(int tex_unit, const TextureStage &stage);
+	virtual void set_texture_addressing(int tex_unit, TextureAddressing taddr);
+
+	virtual void draw(const VertexArray &varray, const IndexArray &iarray);
+	virtual void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count);
+	virtual void render_object(Object *obj, unsigned long time);
+};
+
+// issues nothing, only counts what it gets (everything counts as a change)
+class NullRenderBackend : public RenderBackend {
+private:
+	RenderStats stats;
+
+public:
+	void reset();
+	const RenderStats *get_stats() const;
+
+	virtual void set_zwrite(bool enable);
+	virtual void set_alpha_blending(bool enable);
+	virtual void set_blend_func(BlendingFactor src, BlendingFactor dest);
+	virtual void set_shading_mode(ShadeMode mode);
+	virtual void set_wireframe(bool enable);
+	virtual void set_backface_culling(bool enable);
+	virtual void use_vertex_colors(bool enable);
+	virtual void set_auto_normalize(bool enable);
+	virtual void set_gfx_program(GfxProg *prog);
+	virtual void update_gfx_program(GfxProg *prog);
+	virtual void set_material(const Material &mat);
+	virtual void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num = 0);
+
+	virtual void set_texture(int tex_unit, const Texture *tex);
+	virtual void enable_texture_unit(int tex_unit, bool enable);
+	virtual void set_texture_stage(int tex_unit, const TextureStage &stage);
+	virtual void set_texture_addressing(int tex_unit, TextureAddressing taddr);
+
+	virtual void draw(const VertexArray &varray, const IndexArray &iarray);
+	virtual void draw_instances(const VertexArray &varray, const IndexArray &iarray, const Matrix4x4 *world, int count);
+	virtual void render_object(Object *obj, unsigned long time);
+};
+
+// the backend used when none is given
+RenderBackend *get_gl_backend();
+
+#define MAT_VALUE_COUNT		17
+
+/* the values Material::set_glmaterial() sends to GL, which is what decides
+ * whether two materials look the same.
+ */
+void get_material_values(const Material &mat, float *val);
+
+class StateFilter {
+private:
+	RenderBackend *backend;
+	RenderStats stats;
+
+	// bit (1 << RenderState) is set for each state known to be in effect
+	unsigned int known;
+	unsigned int unit_known[MAX_TEXTURES];
+
+	bool zwrite, blending, wireframe, culling, vcolors, normalize;
+	BlendingFactor src_blend, dest_blend;
+	ShadeMode shading;
+	GfxProg *prog;
+	float mat_values[MAT_VALUE_COUNT];
+
+	const Texture *tex[MAX_TEXTURES];
+	bool unit_enabled[MAX_TEXTURES];
+	TextureStage stage[MAX_TEXTURES];
+	TextureAddressing taddr[MAX_TEXTURES];
+	Matrix4x4 tex_matrix[MAX_TEXTURES];
+
+	// world matrix not passed on yet, and the draws held back for batching
+	Matrix4x4 world;
+	bool world_pending, world_sent;
+	const VertexArray *batch_varray;
+	const IndexArray *batch_iarray;
+	std::vector<Matrix4x4> batch_world;
+	bool batch_world_sent;
+
+	void send_world();
+
+	bool is_known(RenderState state) const;
+	bool is_known(int tex_unit, RenderState state) const;
+	void set_known(RenderState state);
+	void set_known(int tex_unit, RenderState state);
+	void forget(RenderState state);
+	void forget(int tex_unit, RenderState state);
+
+public:
+	StateFilter(RenderBackend *backend = get_gl_backend());
+
+	void set_backend(RenderBackend *backend);
+	RenderBackend *get_backend() const;
+
+	// forget all the shadowed states, for when someone else touched them
+	void invalidate();
+	// brings back the states render_hack() leaves behind (see object.cpp)
+	void restore_defaults();
+	// passes on the draws held back for batching
+	void flush();
+
+	void reset_stats();
+	const RenderStats *get_stats() const;
+
+	void set_zwrite(bool enable);
+	void set_alpha_blending(bool enable);
+	void set_blend_func(BlendingFactor src, BlendingFactor dest);
+	void set_shading_mode(ShadeMode mode);
+	void set_wireframe(bool enable);
+	void set_backface_culling(bool enable);
+	void use_vertex_colors(bool enable);
+	void set_auto_normalize(bool enable);
+	void set_gfx_program(GfxProg *prog);
+	void set_material(const Material &mat);
+	void set_matrix(TransformType xform_type, const Matrix4x4 &mat, int num = 0);
+
+	void set_texture(int tex_unit, const Texture *tex);
+	void enable_texture_unit(int tex_unit, bool enable);
+	void set_texture_stage(int tex_unit, const TextureStage &stage);
+	void set_texture_addressing(int tex_unit, TextureAddressing taddr);
+	// disables all the texture units from first_unit on
+	void disable_texture_units(int first_unit);
+
+	void draw(const VertexArray &varray, const IndexArray &iarray);
+	void render_object(Object *obj, unsigned long time);
+};
+
+#endif	// _RSTATE_HPP_
@@ -44,6 +44,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "texman.hpp"
 #include "gfx/curves.hpp"
 #include "common/err_msg.h"
+#include "common/profile.h"
 
 #define CONV_VEC3(v)		Vector3((v)[0], (v)[2], (v)[1])
 #define CONV_QUAT(q)		Quaternion((q)[3], Vector3((q)[0], (q)[2], (q)[1]))
@@ -76,6 +77,7 @@ static std::vector<int> *get_frames(Lib3dsCameraData *cam);
 #endif	/* __unix__ */
 
 static char data_path[TPATH_SIZE];
+static int mesh_opt = MESHOPT_NONE;
 
 void set_scene_data_path(const char *path) {
 	if(!path || !*path) {
@@ -92,8 +94,13 @@ void set_scene_data_path(const char *path) {
 	}
 }
 
+void set_scene_mesh_optimization(int mode) {
+	mesh_opt = mode;
+}
+
 
 Scene *load_scene(const char *fname) {
+	PROF_SCOPE("load_scene");
 
 	Lib3dsFile *file;
 	if(!(file = lib3ds_file_load(fname))) {
@@ -124,6 +131,7 @@ Scene *load_scene(const char *fname) {
 }
 
 TriMesh *load_mesh(const char *fname, const char *name) {
+	PROF_SCOPE("load_mesh");
 	TriMesh *mesh = 0;
 	
 	Lib3dsFile *file = lib3ds_file_load(fname);
@@ -199,11 +207,13 @@ static bool load_objects(Lib3dsFile *file, Scene *scene) {
 				tptr++;
 			}
 
-			// set the geometry data to the object
-			obj->get_mesh_ptr()->set_data(varray, m->points, tarray, m->faces);
+			// hand the geometry data over to the object
+			obj->get_mesh_ptr()->adopt_data(varray, m->points, tarray, m->faces);
 			obj->get_mesh_ptr()->calculate_normals();
-		
-			delete [] tarray;
+			if(mesh_opt != MESHOPT_NONE) {
+				obj->optimize(mesh_opt);
+			}
+			varray = 0;
 
 			// load the material
 			load_material(file, m->faceL[0].material, obj->get_material_ptr());
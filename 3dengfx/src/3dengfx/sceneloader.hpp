@@ -31,6 +31,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "material.hpp"
 
 void set_scene_data_path(const char *path);
+// how the loaded meshes are reordered for drawing, MESHOPT_NONE by default (see Object::optimize)
+void set_scene_mesh_optimization(int mode);
 
 Scene *load_scene(const char *fname);
 TriMesh *load_mesh(const char *fname, const char *name = 0);
@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "mcube_tables.h"
 #include "scfield.hpp"
 #include "3dengfx/3denginefx.hpp"
+#include "common/profile.h"
 
 // don't change this
 #define EDGE_NOT_ASSOCIATED		0xFFFFFFFF
@@ -594,6 +595,8 @@ void ScalarField::set_normal_evaluator(Vector3 (*get_normal) (const Vector3 &vec
 // last but not least
 void ScalarField::triangulate(TriMesh *mesh, scalar_t isolevel, scalar_t t, bool calc_normals)
 {
+	PROF_SCOPE("ScalarField::triangulate");
+
 	// Reset mesh and edges table
 	clear();
 
@@ -612,9 +615,15 @@ void ScalarField::triangulate(TriMesh *mesh, scalar_t isolevel, scalar_t t, bool
 		}
 	}
 
-	// Generate TriMesh
-	Vertex *varray = new Vertex[verts.size()];
-	Triangle *tarray = new Triangle[tris.size()];
+	/* Generate TriMesh, straight into its arrays, which keep their memory
+	 * when triangulating again into the same mesh.
+	 */
+	VertexArray *va = mesh->get_mod_vertex_array();
+	TriangleArray *ta = mesh->get_mod_triangle_array();
+	va->resize(verts.size());
+	ta->resize(tris.size());
+	Vertex *varray = va->get_mod_data();
+	Triangle *tarray = ta->get_mod_data();
 
 	for (unsigned int i=0; i<verts.size(); i++)
 	{
@@ -643,11 +652,6 @@ void ScalarField::triangulate(TriMesh *mesh, scalar_t isolevel, scalar_t t, bool
 			need_normals = false;
 		}
 	}
-	
-	mesh->set_data(varray, verts.size(), tarray, tris.size());
-
-	delete [] varray;
-	delete [] tarray;
 
 	// as a final resort, if we could not calculate normals any other way
 	// use the regular mesh normal calculation function.
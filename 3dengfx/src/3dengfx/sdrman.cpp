@@ -30,7 +30,6 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "3denginefx.hpp"
 #include "sdrman.hpp"
 #include "common/hashtable.hpp"
-#include "common/string_hash.hpp"
 #include "common/err_msg.h"
 #include "opengl.h"
 
@@ -45,7 +44,6 @@ static void delete_object(GLhandleARB obj) {
 static void init_sdr_man() {
 	if(shaders) return;
 	shaders = new HashTable<string, Shader>;
-	shaders->set_hash_function(string_hash);
 	shaders->set_data_destructor(delete_object);
 }
 
@@ -118,6 +116,11 @@ Shader add_shader_string(const char *code, int sdr_type, const char *name) {
 			info("%s compiled successfully", name);
 		}
 
+		// keep the first shader of a name, as the tree did before the keys were unique
+		if(name && shaders->find(name)) {
+			warning("a shader named %s is already loaded, adding this one unnamed", name);
+			name = 0;
+		}
 		shaders->insert(name ? name : tmpnam(0), sdr);
 	} else {
 		if(info_len) {
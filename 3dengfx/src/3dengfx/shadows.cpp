@@ -19,34 +19,13 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include <vector>
+#include <algorithm>
 #include "shadows.hpp"
+#include "common/threads.h"
 
 std::vector<Edge> *create_silhouette(const TriMesh *mesh, const Vector3 &pt) {
-	const GeometryArray<Edge> *mesh_edges = mesh->get_edge_array();
-	unsigned long ecount = mesh_edges->get_count();
-	const Edge *eptr = mesh_edges->get_data();
-
-	const Vertex *varray = mesh->get_vertex_array()->get_data();
-	const Triangle *tarray = mesh->get_triangle_array()->get_data();
-
 	std::vector<Edge> *edges = new std::vector<Edge>;
-
-	for(unsigned long i=0; i<ecount; i++) {
-		const Triangle *t1 = tarray + eptr->adjfaces[0];
-		const Triangle *t2 = tarray + eptr->adjfaces[1];
-		// XXX: assumption that the light direction for one of a triangle's vertices
-		// can be used as the light direction for the whole triangle.
-		Vector3 ldir1 = (pt - varray[t1->vertices[0]].pos).normalized();
-		Vector3 ldir2 = (pt - varray[t2->vertices[0]].pos).normalized();
-		scalar_t t1dot = dot_product(t1->normal, ldir1);
-		scalar_t t2dot = dot_product(t2->normal, ldir2);
-		
-		if((t1dot > 0 && t2dot < 0) || (t1dot < 0 && t2dot > 0)) {
-			edges->push_back(*eptr);
-		}
-		eptr++;
-	}
-
+	mesh->get_silhouette(pt, false, edges);
 	return edges;
 }
 
@@ -58,3 +37,189 @@ TriMesh *create_shadow_volume(const TriMesh *mesh, const Vector3 &pt) {
 	
 }
 */
+
+// same as the shadow volumes created by TriMesh::get_shadow_volume()
+static const scalar_t extrude_dist = 100000;
+
+CachedShadowVolume::CachedShadowVolume(const void *owner, const void *light) : varray(false) {
+	this->owner = owner;
+	this->light = light;
+	mesh = 0;
+	mesh_rev = 0;
+	is_dir = false;
+	valid = stale = false;
+	last_used = 0;
+}
+
+/* rebuild
+ * called from the worker threads, must not touch anything but this volume
+ * (the mesh is only read, and prepare_adjacency() was called on it earlier).
+ * The silhouette is only walked again if the set of triangles facing away
+ * from the light changed, otherwise only the extrusion is redone.
+ */
+void CachedShadowVolume::rebuild() {
+	mesh->get_facing(lt, is_dir, &new_facing);
+	if(!valid || new_facing != facing) {
+		facing.swap(new_facing);
+		mesh->get_silhouette(facing, &silhouette);
+	}
+
+	unsigned long ecount = silhouette.size();
+	varray.resize(ecount * 6);
+	if(!ecount) return;
+
+	const Vertex *mverts = mesh->get_vertex_array()->get_data();
+	Vertex *vptr = varray.get_mod_data();
+
+	for(unsigned long i=0; i<ecount; i++) {
+		Vector3 p1 = mverts[silhouette[i].vertices[0]].pos;
+		Vector3 p2 = mverts[silhouette[i].vertices[1]].pos;
+		Vector3 ep1 = extrude(p1, extrude_dist, lt, is_dir);
+		Vector3 ep2 = extrude(p2, extrude_dist, lt, is_dir);
+
+		(vptr++)->pos = p1;
+		(vptr++)->pos = ep1;
+		(vptr++)->pos = ep2;
+		(vptr++)->pos = p1;
+		(vptr++)->pos = ep2;
+		(vptr++)->pos = p2;
+	}
+}
+
+const VertexArray *CachedShadowVolume::get_vertex_array() const {
+	return &varray;
+}
+
+const std::vector<Edge> *CachedShadowVolume::get_silhouette() const {
+	return &silhouette;
+}
+
+
+bool ShadowVolumeKey::operator ==(const ShadowVolumeKey &k) const {
+	return owner == k.owner && light == k.light;
+}
+
+ShadowVolumeCache::ShadowVolumeCache() {
+	frame = 0;
+	max_age = 30;
+	rebuilds = 0;
+}
+
+ShadowVolumeCache::~ShadowVolumeCache() {
+	clear();
+}
+
+void ShadowVolumeCache::begin_frame() {
+	frame++;
+
+	unsigned long i = 0;
+	while(i < entries.size()) {
+		CachedShadowVolume *svol = entries[i];
+		if(frame - svol->last_used > max_age) {
+			ShadowVolumeKey key = {svol->owner, svol->light};
+			volumes.remove(key);
+			delete svol;
+
+			entries[i] = entries.back();
+			entries.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+void ShadowVolumeCache::set_max_age(unsigned long frames) {
+	max_age = frames;
+}
+
+/* request
+ * returns the volume of the given caster/light pair, lt is the light
+ * position (or direction) in the model space of the mesh. If anything
+ * changed since the last time it was built, the volume is queued for
+ * rebuilding, and its contents are undefined until update() is called.
+ */
+CachedShadowVolume *ShadowVolumeCache::request(const void *owner, const void *light, TriMesh *mesh, const Vector3 &lt, bool is_dir) {
+	ShadowVolumeKey key = {owner, light};
+	CachedShadowVolume *svol;
+
+	Pair<ShadowVolumeKey, CachedShadowVolume*> *res = volumes.find(key);
+	if(res) {
+		svol = res->val;
+	} else {
+		svol = new CachedShadowVolume(owner, light);
+		volumes.insert(key, svol);
+		entries.push_back(svol);
+	}
+
+	svol->last_used = frame;
+	if(svol->stale) return svol;	// already queued
+
+	if(svol->mesh != mesh || svol->mesh_rev != mesh->get_revision()) {
+		svol->valid = false;
+	} else if(svol->valid && svol->is_dir == is_dir && svol->lt == lt) {
+		return svol;
+	}
+
+	// the lazily computed adjacency info can't be updated from the workers
+	mesh->prepare_adjacency();
+
+	svol->mesh = mesh;
+	svol->mesh_rev = mesh->get_revision();
+	svol->lt = lt;
+	svol->is_dir = is_dir;
+	svol->stale = true;
+	pending.push_back(svol);
+	return svol;
+}
+
+void ShadowVolumeCache::rebuild_volume(int idx, void *cls) {
+	((CachedShadowVolume**)cls)[idx]->rebuild();
+}
+
+void ShadowVolumeCache::update() {
+	if(pending.empty()) return;
+
+	thr_parallel_for((int)pending.size(), rebuild_volume, &pending[0]);
+
+	for(size_t i=0; i<pending.size(); i++) {
+		pending[i]->valid = true;
+		pending[i]->stale = false;
+	}
+	rebuilds += pending.size();
+	pending.clear();
+}
+
+void ShadowVolumeCache::invalidate(const void *owner_or_light) {
+	unsigned long i = 0;
+	while(i < entries.size()) {
+		CachedShadowVolume *svol = entries[i];
+		if(svol->owner == owner_or_light || svol->light == owner_or_light) {
+			ShadowVolumeKey key = {svol->owner, svol->light};
+			volumes.remove(key);
+			pending.erase(std::remove(pending.begin(), pending.end(), svol), pending.end());
+			delete svol;
+
+			entries[i] = entries.back();
+			entries.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+void ShadowVolumeCache::clear() {
+	for(size_t i=0; i<entries.size(); i++) {
+		delete entries[i];
+	}
+	entries.clear();
+	pending.clear();
+	volumes.clear();
+}
+
+unsigned long ShadowVolumeCache::get_count() const {
+	return entries.size();
+}
+
+unsigned long ShadowVolumeCache::get_rebuild_count() const {
+	return rebuilds;
+}
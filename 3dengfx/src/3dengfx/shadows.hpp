@@ -24,9 +24,90 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <vector>
 #include "gfx/3dgeom.hpp"
 #include "n3dmath2/n3dmath2.hpp"
+#include "common/hashtable.hpp"
 
 std::vector<Edge> *create_silhouette(const TriMesh *mesh, const Vector3 &pt);
 void destroy_silhouette(std::vector<Edge> *edges);
 //TriMesh *create_shadow_volume(const TriMesh *mesh, const Vector3 &pt);
 
+/* A shadow volume kept around between frames, extruded from the silhouette
+ * of a mesh as seen from a light (both in model space). The volume is a plain
+ * triangle list, to be drawn with the transformation of the caster.
+ */
+class CachedShadowVolume {
+private:
+	const void *owner, *light;
+	const TriMesh *mesh;
+	unsigned long mesh_rev;
+	Vector3 lt;
+	bool is_dir;
+	bool valid, stale;
+	unsigned long last_used;
+
+	std::vector<uint32_t> facing, new_facing;
+	std::vector<Edge> silhouette;
+	VertexArray varray;
+
+	void rebuild();
+
+	friend class ShadowVolumeCache;
+
+public:
+	CachedShadowVolume(const void *owner, const void *light);
+
+	const VertexArray *get_vertex_array() const;
+	const std::vector<Edge> *get_silhouette() const;
+};
+
+struct ShadowVolumeKey {
+	const void *owner, *light;
+
+	bool operator ==(const ShadowVolumeKey &k) const;
+};
+
+template <>
+struct HashTraits<ShadowVolumeKey> {
+	static uint32_t hash(const ShadowVolumeKey &key) {
+		return int_hash(HashTraits<const void*>::hash(key.owner) ^ HashTraits<const void*>::hash(key.light));
+	}
+};
+
+/* Keeps one CachedShadowVolume per (caster, light) pair. Every frame call
+ * request() for each caster; volumes whose mesh and model space light are
+ * unchanged are reused as they are, the rest are queued and rebuilt in
+ * parallel by update(), which must be called before drawing any of them.
+ */
+class ShadowVolumeCache {
+private:
+	HashTable<ShadowVolumeKey, CachedShadowVolume*> volumes;
+	std::vector<CachedShadowVolume*> entries;
+	std::vector<CachedShadowVolume*> pending;
+	unsigned long frame;
+	unsigned long max_age;
+	unsigned long rebuilds;
+
+	static void rebuild_volume(int idx, void *cls);
+
+	ShadowVolumeCache(const ShadowVolumeCache &svc);
+	ShadowVolumeCache &operator =(const ShadowVolumeCache &svc);
+
+public:
+	ShadowVolumeCache();
+	~ShadowVolumeCache();
+
+	// advances the frame counter and drops volumes unused for max_age frames
+	void begin_frame();
+	void set_max_age(unsigned long frames);
+
+	CachedShadowVolume *request(const void *owner, const void *light, TriMesh *mesh, const Vector3 &lt, bool is_dir);
+	void update();
+
+	// forget every volume of the given caster or light
+	void invalidate(const void *owner_or_light);
+	void clear();
+
+	unsigned long get_count() const;
+	unsigned long get_rebuild_count() const;	// volumes rebuilt so far
+};
+
 #endif	// SHADOWS_HPP_
@@ -0,0 +1,1574 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* software rasterizer, for rendering without a graphics context */
+
+#include "3dengfx_config.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "swrast.hpp"
+#include "common/threads.h"
+#include "common/err_msg.h"
+#include "common/profile.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
+#define VERTEX_CHUNK	1024
+#define SETUP_CHUNK		1024
+// rasterize early when this many triangles are waiting, to bound the memory
+#define MAX_PENDING		(1 << 18)
+
+static float byte_to_float[256];
+
+static inline float clamp01(float x) {
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+static inline void unpack(Pixel p, float *c) {
+	c[0] = byte_to_float[(p >> 16) & 0xff];
+	c[1] = byte_to_float[(p >> 8) & 0xff];
+	c[2] = byte_to_float[p & 0xff];
+	c[3] = byte_to_float[p >> 24];
+}
+
+static inline Pixel pack(const float *c) {
+	Pixel r = (Pixel)(clamp01(c[0]) * 255.0f + 0.5f);
+	Pixel g = (Pixel)(clamp01(c[1]) * 255.0f + 0.5f);
+	Pixel b = (Pixel)(clamp01(c[2]) * 255.0f + 0.5f);
+	Pixel a = (Pixel)(clamp01(c[3]) * 255.0f + 0.5f);
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// converts between 0xAARRGGBB and RGBA byte order
+static inline Pixel swap_rb(Pixel p) {
+	return (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+static void to_float(const Matrix4x4 &mat, float *res) {
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			*res++ = (float)mat[i][j];
+		}
+	}
+}
+
+static inline void xform4(const float *m, const float *v, float *res) {
+	for(int i=0; i<4; i++) {
+		res[i] = m[0] * v[0] + m[1] * v[1] + m[2] * v[2] + m[3] * v[3];
+		m += 4;
+	}
+}
+
+static inline void set4(float *dest, float a, float b, float c, float d) {
+	dest[0] = a;
+	dest[1] = b;
+	dest[2] = c;
+	dest[3] = d;
+}
+
+static inline void normalize3(float *v) {
+	float len = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if(len > 0.0f) {
+		float s = 1.0f / len;
+		v[0] *= s;
+		v[1] *= s;
+		v[2] *= s;
+	}
+}
+
+static void run_parallel(int count, thr_work_func func, void *cls) {
+	if(count > 1 && thr_get_num_workers() > 1) {
+		thr_parallel_for(count, func, cls);
+	} else {
+		for(int i=0; i<count; i++) {
+			func(i, cls);
+		}
+	}
+}
+
+static void init_texunit(SwrTexUnit *unit) {
+	unit->enabled = false;
+	unit->tex = 0;
+	unit->color_op = unit->alpha_op = TOP_MODULATE;
+	unit->color_arg[0] = unit->alpha_arg[0] = TARG_TEXTURE;
+	unit->color_arg[1] = unit->alpha_arg[1] = TARG_PREV;
+	unit->color_arg[2] = unit->alpha_arg[2] = TARG_CONSTANT;
+	set4(unit->constant, 0, 0, 0, 0);
+	unit->coord_index = 0;
+	unit->texgen = TEXGEN_NONE;
+	for(int i=0; i<16; i++) {
+		unit->matrix[i] = i % 5 ? 0.0f : 1.0f;
+	}
+	unit->identity = true;
+}
+
+SoftRaster::SoftRaster(int width, int height) : color(width, height) {
+	for(int i=0; i<256; i++) {
+		byte_to_float[i] = (float)i / 255.0f;
+	}
+
+	this->width = width;
+	this->height = height;
+	depth.resize(width * height, 1.0f);
+	stencil.resize(width * height, 0);
+	memset(color.buffer, 0, width * height * sizeof(Pixel));
+
+	xtiles = (width + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+	ytiles = (height + SWR_TILE_SIZE - 1) / SWR_TILE_SIZE;
+	bins.resize(xtiles * ytiles);
+
+	// the OpenGL initial state
+	vp_x = vp_y = 0;
+	vp_width = width;
+	vp_height = height;
+	culling = normalize = false;
+	front_face = (FaceOrder)GL_CCW;
+	lighting = vertex_colors = false;
+	shading = SHADING_GOURAUD;
+	set4(ambient_light, 0.2f, 0.2f, 0.2f, 1.0f);
+
+	set4(mat_ambient, 0.2f, 0.2f, 0.2f, 1.0f);
+	set4(mat_diffuse, 0.8f, 0.8f, 0.8f, 1.0f);
+	set4(mat_specular, 0.0f, 0.0f, 0.0f, 1.0f);
+	set4(mat_emission, 0.0f, 0.0f, 0.0f, 1.0f);
+	mat_power = 0.0f;
+
+	for(int i=0; i<SWR_MAX_LIGHTS; i++) {
+		SwrLight *lt = lights + i;
+		float c = i ? 0.0f : 1.0f;
+		lt->enabled = false;
+		set4(lt->pos, 0.0f, 0.0f, 1.0f, 0.0f);
+		set4(lt->ambient, 0.0f, 0.0f, 0.0f, 1.0f);
+		set4(lt->diffuse, c, c, c, 1.0f);
+		set4(lt->specular, c, c, c, 1.0f);
+		lt->att[0] = 1.0f;
+		lt->att[1] = lt->att[2] = 0.0f;
+	}
+
+	for(int i=0; i<SWR_TEX_UNITS; i++) {
+		init_texunit(units + i);
+	}
+
+	memset(&pstate, 0, sizeof pstate);
+	pstate.blend = false;
+	pstate.src_blend = BLEND_ONE;
+	pstate.dst_blend = BLEND_ZERO;
+	pstate.ztest = false;
+	pstate.zwrite = true;
+	pstate.zfunc = CMP_LESS;
+	pstate.stest = false;
+	pstate.sfunc = CMP_ALWAYS;
+	pstate.sref = 0;
+	pstate.sfail = pstate.szfail = pstate.spass = SOP_KEEP;
+	pstate.color_mask = 0xffffffff;
+	pstate_dirty = true;
+
+	reset_stats();
+}
+
+SoftRaster::~SoftRaster() {
+	for(size_t i=0; i<textures.size(); i++) {
+		delete textures[i];
+	}
+}
+
+int SoftRaster::get_width() const {
+	return width;
+}
+
+int SoftRaster::get_height() const {
+	return height;
+}
+
+///////////// frame buffer /////////////
+
+void SoftRaster::clear(unsigned int buffers, const Color &col, float z, unsigned char s) {
+	flush();
+
+	int count = width * height;
+
+	if((buffers & SWR_COLOR_BUFFER) && pstate.color_mask) {
+		float c[] = {(float)col.r, (float)col.g, (float)col.b, (float)col.a};
+		Pixel p = pack(c);
+		Pixel mask = pstate.color_mask;
+		Pixel *ptr = color.buffer;
+
+		if(mask == 0xffffffff) {
+			std::fill(ptr, ptr + count, p);
+		} else {
+			for(int i=0; i<count; i++) {
+				ptr[i] = (p & mask) | (ptr[i] & ~mask);
+			}
+		}
+	}
+
+	// like glClear, the depth write mask applies
+	if((buffers & SWR_DEPTH_BUFFER) && pstate.zwrite) {
+		std::fill(depth.begin(), depth.end(), clamp01(z));
+	}
+
+	if(buffers & SWR_STENCIL_BUFFER) {
+		std::fill(stencil.begin(), stencil.end(), s);
+	}
+}
+
+void swr_tile_work(int idx, void *cls) {
+	SoftRaster *swr = (SoftRaster*)cls;
+	swr->raster_tile(swr->active_tiles[idx]);
+}
+
+/* flush
+ * rasterizes everything drawn since the last flush, one job per tile.
+ */
+void SoftRaster::flush() {
+	if(tris.empty()) return;
+
+	PROF_SCOPE("SoftRaster::flush");
+
+	active_tiles.clear();
+	for(int i=0; i<(int)bins.size(); i++) {
+		if(!bins[i].empty()) {
+			active_tiles.push_back(i);
+		}
+	}
+
+	run_parallel((int)active_tiles.size(), swr_tile_work, this);
+
+	for(size_t i=0; i<active_tiles.size(); i++) {
+		bins[active_tiles[i]].clear();
+	}
+	tris.clear();
+	states.clear();
+	pstate_dirty = true;
+	stats.flushes++;
+}
+
+const PixelBuffer *SoftRaster::get_frame_buffer() {
+	flush();
+	return &color;
+}
+
+void SoftRaster::read_pixels(Pixel *dest) {
+	flush();
+	memcpy(dest, color.buffer, width * height * sizeof(Pixel));
+}
+
+///////////// states /////////////
+
+void SoftRaster::set_viewport(int x, int y, int xsz, int ysz) {
+	vp_x = x;
+	vp_y = y;
+	vp_width = xsz;
+	vp_height = ysz;
+}
+
+void SoftRaster::set_backface_culling(bool enable) {
+	culling = enable;
+}
+
+void SoftRaster::set_front_face(FaceOrder order) {
+	front_face = order;
+}
+
+void SoftRaster::set_auto_normalize(bool enable) {
+	normalize = enable;
+}
+
+void SoftRaster::set_color_write(bool red, bool green, bool blue, bool alpha) {
+	pstate.color_mask = (red ? 0x00ff0000 : 0) | (green ? 0x0000ff00 : 0) |
+		(blue ? 0x000000ff : 0) | (alpha ? 0xff000000 : 0);
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_alpha_blending(bool enable) {
+	pstate.blend = enable;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_blend_func(BlendingFactor src, BlendingFactor dest) {
+	pstate.src_blend = src;
+	pstate.dst_blend = dest;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_zbuffering(bool enable) {
+	pstate.ztest = enable;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_zwrite(bool enable) {
+	pstate.zwrite = enable;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_zfunc(CmpFunc func) {
+	pstate.zfunc = func;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_stencil_buffering(bool enable) {
+	pstate.stest = enable;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_stencil_op(StencilOp fail, StencilOp spass_zfail, StencilOp pass) {
+	pstate.sfail = fail;
+	pstate.szfail = spass_zfail;
+	pstate.spass = pass;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_stencil_func(CmpFunc func) {
+	pstate.sfunc = func;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_stencil_reference(unsigned int ref) {
+	pstate.sref = (unsigned char)ref;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_shading_mode(ShadeMode mode) {
+	shading = mode;
+}
+
+///////////// lighting /////////////
+
+void SoftRaster::set_lighting(bool enable) {
+	lighting = enable;
+	if(pstate.specular != enable) {
+		pstate.specular = enable;
+		pstate_dirty = true;
+	}
+}
+
+void SoftRaster::use_vertex_colors(bool enable) {
+	vertex_colors = enable;
+}
+
+void SoftRaster::set_ambient_light(const float *col) {
+	memcpy(ambient_light, col, 4 * sizeof(float));
+}
+
+void SoftRaster::set_material(const float *amb, const float *dif, const float *spec, const float *emis, float power) {
+	memcpy(mat_ambient, amb, 4 * sizeof(float));
+	memcpy(mat_diffuse, dif, 4 * sizeof(float));
+	memcpy(mat_specular, spec, 4 * sizeof(float));
+	memcpy(mat_emission, emis, 4 * sizeof(float));
+	mat_power = power < 0.0f ? 0.0f : (power > 128.0f ? 128.0f : power);
+}
+
+void SoftRaster::set_light(int idx, const float *pos, const Matrix4x4 &mv, const float *amb, const float *dif, const float *spec) {
+	if(idx < 0 || idx >= SWR_MAX_LIGHTS) return;
+	SwrLight *lt = lights + idx;
+
+	float m[16];
+	to_float(mv, m);
+	xform4(m, pos, lt->pos);
+	if(lt->pos[3] != 0.0f) {
+		for(int i=0; i<3; i++) {
+			lt->pos[i] /= lt->pos[3];
+		}
+		lt->pos[3] = 1.0f;
+	} else {
+		normalize3(lt->pos);
+	}
+
+	memcpy(lt->ambient, amb, 4 * sizeof(float));
+	memcpy(lt->diffuse, dif, 4 * sizeof(float));
+	memcpy(lt->specular, spec, 4 * sizeof(float));
+}
+
+void SoftRaster::set_light_attenuation(int idx, float constant, float linear, float quadratic) {
+	if(idx < 0 || idx >= SWR_MAX_LIGHTS) return;
+	lights[idx].att[0] = constant;
+	lights[idx].att[1] = linear;
+	lights[idx].att[2] = quadratic;
+}
+
+void SoftRaster::enable_light(int idx, bool enable) {
+	if(idx < 0 || idx >= SWR_MAX_LIGHTS) return;
+	lights[idx].enabled = enable;
+}
+
+///////////// texture units /////////////
+
+void SoftRaster::enable_texture_unit(int unit, bool enable) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].enabled = enable;
+	pstate_dirty = true;
+}
+
+void SoftRaster::bind_texture(int unit, unsigned int tex) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].tex = tex;
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_texture_unit_color(int unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].color_op = op;
+	units[unit].color_arg[0] = arg1;
+	units[unit].color_arg[1] = arg2;
+	if(arg3 != TARG_NONE) {
+		units[unit].color_arg[2] = arg3;
+	}
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_texture_unit_alpha(int unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].alpha_op = op;
+	units[unit].alpha_arg[0] = arg1;
+	units[unit].alpha_arg[1] = arg2;
+	if(arg3 != TARG_NONE) {
+		units[unit].alpha_arg[2] = arg3;
+	}
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_texture_constant(int unit, const Color &col) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	set4(units[unit].constant, col.r, col.g, col.b, col.a);
+	pstate_dirty = true;
+}
+
+void SoftRaster::set_texture_coord_index(int unit, int index) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].coord_index = index;
+}
+
+void SoftRaster::set_texture_coord_generator(int unit, TexGen tgen) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	units[unit].texgen = tgen;
+}
+
+void SoftRaster::set_texture_matrix(int unit, const Matrix4x4 &mat) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	float *m = units[unit].matrix;
+	to_float(mat, m);
+
+	units[unit].identity = true;
+	for(int i=0; i<16; i++) {
+		if(m[i] != (i % 5 ? 0.0f : 1.0f)) {
+			units[unit].identity = false;
+			break;
+		}
+	}
+}
+
+void SoftRaster::set_texture_filtering(int unit, TextureFilteringType filter) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	SwrTexture *tex = get_texture(units[unit].tex);
+	if(tex) {
+		tex->nearest = filter == POINT_SAMPLING;
+		pstate_dirty = true;
+	}
+}
+
+void SoftRaster::set_texture_addressing(int unit, TextureAddressing uaddr, TextureAddressing vaddr) {
+	if(unit < 0 || unit >= SWR_TEX_UNITS) return;
+	SwrTexture *tex = get_texture(units[unit].tex);
+	if(tex) {
+		tex->uaddr = uaddr;
+		tex->vaddr = vaddr;
+		pstate_dirty = true;
+	}
+}
+
+///////////// texture objects /////////////
+
+SwrTexture *SoftRaster::get_texture(unsigned int tex) const {
+	if(!tex || tex > textures.size()) return 0;
+	return textures[tex - 1];
+}
+
+unsigned int SoftRaster::create_texture(TextureDim type) {
+	SwrTexture *tex = new SwrTexture;
+	tex->type = type;
+	tex->width = tex->height = 0;
+	tex->uaddr = tex->vaddr = type == TEX_CUBE ? TEXADDR_CLAMP : TEXADDR_WRAP;
+	tex->nearest = false;
+
+	for(size_t i=0; i<textures.size(); i++) {
+		if(!textures[i]) {
+			textures[i] = tex;
+			return i + 1;
+		}
+	}
+	textures.push_back(tex);
+	return textures.size();
+}
+
+void SoftRaster::delete_texture(unsigned int tex) {
+	if(!get_texture(tex)) return;
+	flush();	// the triangles waiting might use it
+
+	delete textures[tex - 1];
+	textures[tex - 1] = 0;
+
+	for(int i=0; i<SWR_TEX_UNITS; i++) {
+		if(units[i].tex == tex) units[i].tex = 0;
+	}
+	pstate_dirty = true;
+}
+
+void SoftRaster::tex_image(unsigned int tex, int face, int xsz, int ysz, const Pixel *pixels, bool bgra) {
+	SwrTexture *t = get_texture(tex);
+	if(!t || face < 0 || face >= 6) return;
+	flush();
+
+	if(t->type == TEX_1D) ysz = 1;
+	if(t->width != xsz || t->height != ysz) {
+		t->width = xsz;
+		t->height = ysz;
+		for(int i=0; i<6; i++) {
+			if(!t->faces[i].empty()) {
+				t->faces[i].resize(xsz * ysz, 0);
+			}
+		}
+	}
+
+	std::vector<Pixel> &img = t->faces[face];
+	img.resize(xsz * ysz);
+	for(int i=0; i<xsz * ysz; i++) {
+		img[i] = bgra ? pixels[i] : swap_rb(pixels[i]);
+	}
+}
+
+void SoftRaster::tex_sub_image(unsigned int tex, int face, int x, int y, int xsz, int ysz, const Pixel *pixels, bool bgra) {
+	SwrTexture *t = get_texture(tex);
+	if(!t || face < 0 || face >= 6) return;
+	if(x < 0 || y < 0 || x + xsz > t->width || y + ysz > t->height) return;
+
+	std::vector<Pixel> &img = t->faces[face];
+	if((int)img.size() != t->width * t->height) return;
+	flush();
+
+	for(int i=0; i<ysz; i++) {
+		Pixel *dptr = &img[(y + i) * t->width + x];
+		for(int j=0; j<xsz; j++) {
+			Pixel pixel = *pixels++;
+			*dptr++ = bgra ? pixel : swap_rb(pixel);
+		}
+	}
+}
+
+void SoftRaster::get_tex_image(unsigned int tex, int face, Pixel *pixels) {
+	SwrTexture *t = get_texture(tex);
+	if(!t || face < 0 || face >= 6) return;
+
+	const std::vector<Pixel> &img = t->faces[face];
+	for(size_t i=0; i<img.size(); i++) {
+		pixels[i] = swap_rb(img[i]);
+	}
+}
+
+void SoftRaster::copy_to_texture(unsigned int tex, int face, int xsz, int ysz) {
+	SwrTexture *t = get_texture(tex);
+	if(!t || face < 0 || face >= 6) return;
+	flush();
+
+	std::vector<Pixel> &img = t->faces[face];
+	if((int)img.size() != t->width * t->height) {
+		img.resize(t->width * t->height, 0);
+	}
+
+	xsz = std::min(std::min(xsz, t->width), width);
+	ysz = std::min(std::min(ysz, t->height), height);
+
+	for(int i=0; i<ysz; i++) {
+		memcpy(&img[i * t->width], color.buffer + i * width, xsz * sizeof(Pixel));
+	}
+}
+
+///////////// vertex processing /////////////
+
+struct VertexWork {
+	const SoftRaster *swr;
+	const Vertex *varr;
+	int count;
+	float mv[16], proj[16];
+	float nmat[9];
+	int tex_dim[SWR_TEX_UNITS];		// 0 for the units not used
+	SwrVertex *out;
+};
+
+/* swr_vertex_work
+ * transforms and lights a slice of the vertex array, the OpenGL way: local
+ * viewer, separate specular color, and the vertex color standing in for
+ * the ambient and diffuse material colors when use_vertex_colors is on.
+ */
+void swr_vertex_work(int idx, void *cls) {
+	VertexWork *work = (VertexWork*)cls;
+	const SoftRaster *swr = work->swr;
+	int start = idx * VERTEX_CHUNK;
+	int end = std::min(start + VERTEX_CHUNK, work->count);
+
+	for(int i=start; i<end; i++) {
+		const Vertex *vert = work->varr + i;
+		float *res = work->out[i].v;
+
+		float pos[] = {(float)vert->pos.x, (float)vert->pos.y, (float)vert->pos.z, 1.0f};
+		float epos[4];
+		xform4(work->mv, pos, epos);
+		xform4(work->proj, epos, res + SWR_VX_POS);
+
+		const float *nm = work->nmat;
+		float n[3];
+		for(int j=0; j<3; j++) {
+			n[j] = nm[j * 3] * vert->normal.x + nm[j * 3 + 1] * vert->normal.y + nm[j * 3 + 2] * vert->normal.z;
+		}
+		if(swr->normalize) normalize3(n);
+
+		float vcol[] = {(float)vert->color.r, (float)vert->color.g, (float)vert->color.b, (float)vert->color.a};
+		float *col = res + SWR_VX_COLOR;
+		float *spec = res + SWR_VX_SPEC;
+		spec[0] = spec[1] = spec[2] = 0.0f;
+
+		if(swr->lighting) {
+			const float *amb = swr->vertex_colors ? vcol : swr->mat_ambient;
+			const float *dif = swr->vertex_colors ? vcol : swr->mat_diffuse;
+			const float *mspec = swr->mat_specular;
+
+			for(int j=0; j<3; j++) {
+				col[j] = swr->mat_emission[j] + amb[j] * swr->ambient_light[j];
+			}
+			col[3] = dif[3];
+
+			float v[] = {-epos[0], -epos[1], -epos[2]};
+			normalize3(v);
+
+			for(int k=0; k<SWR_MAX_LIGHTS; k++) {
+				const SwrLight *lt = swr->lights + k;
+				if(!lt->enabled) continue;
+
+				float l[3], att = 1.0f;
+				if(lt->pos[3] == 0.0f) {
+					l[0] = lt->pos[0];
+					l[1] = lt->pos[1];
+					l[2] = lt->pos[2];
+				} else {
+					l[0] = lt->pos[0] - epos[0];
+					l[1] = lt->pos[1] - epos[1];
+					l[2] = lt->pos[2] - epos[2];
+					float dist = sqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+					float d = lt->att[0] + lt->att[1] * dist + lt->att[2] * dist * dist;
+					att = d > 0.0f ? 1.0f / d : 1.0f;
+					normalize3(l);
+				}
+
+				float ndotl = n[0] * l[0] + n[1] * l[1] + n[2] * l[2];
+				float diff = ndotl > 0.0f ? ndotl : 0.0f;
+				for(int j=0; j<3; j++) {
+					col[j] += att * (amb[j] * lt->ambient[j] + diff * dif[j] * lt->diffuse[j]);
+				}
+
+				if(ndotl > 0.0f) {
+					float h[] = {l[0] + v[0], l[1] + v[1], l[2] + v[2]};
+					normalize3(h);
+					float ndoth = n[0] * h[0] + n[1] * h[1] + n[2] * h[2];
+					if(ndoth > 0.0f) {
+						float sp = att * pow(ndoth, swr->mat_power);
+						for(int j=0; j<3; j++) {
+							spec[j] += sp * mspec[j] * lt->specular[j];
+						}
+					}
+				}
+			}
+
+			for(int j=0; j<3; j++) {
+				spec[j] = clamp01(spec[j]);
+			}
+		} else {
+			memcpy(col, vcol, 4 * sizeof(float));
+		}
+		for(int j=0; j<4; j++) {
+			col[j] = clamp01(col[j]);
+		}
+
+		for(int u=0; u<SWR_TEX_UNITS; u++) {
+			int dim = work->tex_dim[u];
+			if(!dim) continue;
+
+			const SwrTexUnit *unit = swr->units + u;
+			const TexCoord &tc = vert->tex[unit->coord_index];
+			float st[] = {(float)tc.u, dim > 1 ? (float)tc.v : 0.0f, dim > 2 ? (float)tc.w : 0.0f, 1.0f};
+
+			if(unit->texgen != TEXGEN_NONE) {
+				float e[] = {epos[0], epos[1], epos[2]};
+				normalize3(e);
+				float ndote = n[0] * e[0] + n[1] * e[1] + n[2] * e[2];
+				float r[3];
+				for(int j=0; j<3; j++) {
+					r[j] = e[j] - 2.0f * n[j] * ndote;
+				}
+
+				if(unit->texgen == TEXGEN_SPHERE_MAP) {
+					float m = 2.0f * sqrt(r[0] * r[0] + r[1] * r[1] + (r[2] + 1.0f) * (r[2] + 1.0f));
+					st[0] = m > 0.0f ? r[0] / m + 0.5f : 0.5f;
+					st[1] = m > 0.0f ? r[1] / m + 0.5f : 0.5f;
+				} else {
+					st[0] = r[0];
+					st[1] = r[1];
+					st[2] = r[2];
+				}
+			}
+
+			float *dest = res + SWR_VX_TEX + u * 4;
+			if(unit->identity) {
+				memcpy(dest, st, 4 * sizeof(float));
+			} else {
+				xform4(unit->matrix, st, dest);
+			}
+		}
+	}
+}
+
+///////////// primitive assembly and triangle setup /////////////
+
+static int prim_tri_count(PrimitiveType prim, int count) {
+	switch(prim) {
+	case TRIANGLE_LIST:
+		return count / 3;
+	case TRIANGLE_STRIP:
+	case TRIANGLE_FAN:
+		return count > 2 ? count - 2 : 0;
+	case QUAD_LIST:
+		return (count / 4) * 2;
+	case QUAD_STRIP:
+		return count > 3 ? ((count - 2) / 2) * 2 : 0;
+	default:
+		return 0;	// lines and points are not supported
+	}
+}
+
+// the vertices of triangle n in the order OpenGL draws them, the last is the provoking vertex
+static void prim_tri(PrimitiveType prim, int n, int *idx) {
+	int q = n / 2, base;
+
+	switch(prim) {
+	case TRIANGLE_LIST:
+		idx[0] = n * 3;
+		idx[1] = n * 3 + 1;
+		idx[2] = n * 3 + 2;
+		break;
+
+	case TRIANGLE_STRIP:
+		idx[0] = n & 1 ? n + 1 : n;
+		idx[1] = n & 1 ? n : n + 1;
+		idx[2] = n + 2;
+		break;
+
+	case TRIANGLE_FAN:
+		idx[0] = 0;
+		idx[1] = n + 1;
+		idx[2] = n + 2;
+		break;
+
+	case QUAD_LIST:
+		base = q * 4;
+		idx[0] = base;
+		idx[1] = n & 1 ? base + 2 : base + 1;
+		idx[2] = n & 1 ? base + 3 : base + 2;
+		idx[3] = base + 3;
+		return;
+
+	case QUAD_STRIP:
+		base = q * 2;
+		idx[0] = base;
+		idx[1] = n & 1 ? base + 3 : base + 1;
+		idx[2] = n & 1 ? base + 2 : base + 3;
+		idx[3] = base + 3;
+		return;
+
+	default:
+		idx[0] = idx[1] = idx[2] = 0;
+		break;
+	}
+	idx[3] = idx[2];
+}
+
+static inline unsigned int outcode(const float *p) {
+	unsigned int code = 0;
+	if(p[0] < -p[3]) code |= 1;
+	if(p[0] > p[3]) code |= 2;
+	if(p[1] < -p[3]) code |= 4;
+	if(p[1] > p[3]) code |= 8;
+	if(p[2] < -p[3]) code |= 16;
+	if(p[2] > p[3]) code |= 32;
+	return code;
+}
+
+static inline float clip_dist(const float *p, int plane) {
+	switch(plane) {
+	case 0: return p[3] + p[0];
+	case 1: return p[3] - p[0];
+	case 2: return p[3] + p[1];
+	case 3: return p[3] - p[1];
+	case 4: return p[3] + p[2];
+	default: return p[3] - p[2];
+	}
+}
+
+/* clip_polygon
+ * Sutherland-Hodgman against the planes in the outcode mask. New vertices
+ * are always interpolated from the inside vertex of an edge, so that the
+ * triangles sharing the edge get exactly the same vertex.
+ */
+static int clip_polygon(SwrVertex *poly, SwrVertex *tmp, int count, unsigned int mask) {
+	SwrVertex *src = poly, *dest = tmp;
+
+	for(int plane=0; plane<6; plane++) {
+		if(!(mask & (1 << plane))) continue;
+
+		int out_count = 0;
+		for(int i=0; i<count; i++) {
+			const SwrVertex *a = src + i;
+			const SwrVertex *b = src + (i + 1) % count;
+			float da = clip_dist(a->v, plane);
+			float db = clip_dist(b->v, plane);
+
+			if(da >= 0.0f) {
+				dest[out_count++] = *a;
+			}
+			if((da >= 0.0f) != (db >= 0.0f)) {
+				const SwrVertex *in = da >= 0.0f ? a : b;
+				const SwrVertex *out = da >= 0.0f ? b : a;
+				float din = da >= 0.0f ? da : db;
+				float dout = da >= 0.0f ? db : da;
+				float t = din / (din - dout);
+
+				SwrVertex *v = dest + out_count++;
+				for(int j=0; j<SWR_VX_SIZE; j++) {
+					v->v[j] = in->v[j] + (out->v[j] - in->v[j]) * t;
+				}
+			}
+		}
+
+		count = out_count;
+		std::swap(src, dest);
+		if(count < 3) return 0;
+	}
+
+	if(src != poly) {
+		memcpy(poly, src, count * sizeof *poly);
+	}
+	return count;
+}
+
+static void setup_edge(SwrEdge *edge, float x0, float y0, float x1, float y1) {
+	// the same edge of the neighbour triangle is computed from the same endpoint
+	bool fwd = x0 < x1 || (x0 == x1 && y0 < y1);
+	float px = fwd ? x0 : x1, py = fwd ? y0 : y1;
+	float qx = fwd ? x1 : x0, qy = fwd ? y1 : y0;
+
+	edge->a = py - qy;
+	edge->b = qx - px;
+	edge->x = px;
+	edge->y = py;
+	edge->sign = fwd ? 1.0f : -1.0f;
+
+	// top-left rule, with y going up and counter-clockwise triangles
+	float a = edge->a * edge->sign, b = edge->b * edge->sign;
+	edge->incl = a > 0.0f || (a == 0.0f && b < 0.0f);
+}
+
+struct SetupWork {
+	SoftRaster *swr;
+	const SwrVertex *verts;
+	const Index *iarr;
+	int vcount;
+	int tri_count;
+	PrimitiveType prim;
+	int state;
+	const SwrPixelState *pstate;
+	bool flat;
+	bool cull, front_ccw;
+	int bx0, by0, bx1, by1;		// viewport clipped to the frame buffer
+	float vp[4];
+};
+
+static void setup_tri(const SetupWork *work, const SwrVertex **vp, SwrSetupChunk *chunk) {
+	float x[3], y[3], z[3], iw[3];
+	const SwrVertex *v[3] = {vp[0], vp[1], vp[2]};
+
+	for(int i=0; i<3; i++) {
+		const float *p = v[i]->v;
+		iw[i] = 1.0f / p[3];
+		x[i] = (p[0] * iw[i] * 0.5f + 0.5f) * work->vp[2] + work->vp[0];
+		y[i] = (p[1] * iw[i] * 0.5f + 0.5f) * work->vp[3] + work->vp[1];
+		z[i] = clamp01(p[2] * iw[i] * 0.5f + 0.5f);
+	}
+
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if(!(area > 0.0f || area < 0.0f)) {
+		chunk->culled++;	// degenerate, or not a number
+		return;
+	}
+	bool ccw = area > 0.0f;
+	if(work->cull && ccw != work->front_ccw) {
+		chunk->culled++;
+		return;
+	}
+	if(!ccw) {
+		std::swap(v[1], v[2]);
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(z[1], z[2]);
+		std::swap(iw[1], iw[2]);
+		area = -area;
+	}
+
+	// pixels with their centers inside the bounds
+	float xmin = std::min(x[0], std::min(x[1], x[2]));
+	float xmax = std::max(x[0], std::max(x[1], x[2]));
+	float ymin = std::min(y[0], std::min(y[1], y[2]));
+	float ymax = std::max(y[0], std::max(y[1], y[2]));
+
+	SwrTri tri;
+	tri.x0 = std::max((int)ceil(xmin - 0.5f), work->bx0);
+	tri.x1 = std::min((int)floor(xmax - 0.5f) + 1, work->bx1);
+	tri.y0 = std::max((int)ceil(ymin - 0.5f), work->by0);
+	tri.y1 = std::min((int)floor(ymax - 0.5f) + 1, work->by1);
+	if(tri.x0 >= tri.x1 || tri.y0 >= tri.y1) {
+		chunk->culled++;
+		return;
+	}
+
+	tri.state = work->state;
+	tri.ox = x[0];
+	tri.oy = y[0];
+	setup_edge(tri.edge, x[1], y[1], x[2], y[2]);
+	setup_edge(tri.edge + 1, x[2], y[2], x[0], y[0]);
+	setup_edge(tri.edge + 2, x[0], y[0], x[1], y[1]);
+
+	float dx1 = x[1] - x[0], dy1 = y[1] - y[0];
+	float dx2 = x[2] - x[0], dy2 = y[2] - y[0];
+	float inv_area = 1.0f / area;
+
+#define SET_PLANE(k, f0, f1, f2) \
+	do { \
+		float d1 = (f1) - (f0), d2 = (f2) - (f0); \
+		tri.plane[k][0] = (f0); \
+		tri.plane[k][1] = (d1 * dy2 - d2 * dy1) * inv_area; \
+		tri.plane[k][2] = (d2 * dx1 - d1 * dx2) * inv_area; \
+	} while(0)
+
+	SET_PLANE(SWR_ATTR_Z, z[0], z[1], z[2]);
+	SET_PLANE(SWR_ATTR_IW, iw[0], iw[1], iw[2]);
+
+	// everything else is interpolated as a / w, for perspective correction
+	const SwrPixelState *st = work->pstate;
+	int last = SWR_VX_SPEC - SWR_VX_COLOR + (st->specular ? 3 : 0);
+	for(int i=0; i<last; i++) {
+		int k = SWR_VX_COLOR + i;
+		SET_PLANE(SWR_ATTR_COLOR + i, v[0]->v[k] * iw[0], v[1]->v[k] * iw[1], v[2]->v[k] * iw[2]);
+	}
+	for(int u=0; u<SWR_TEX_UNITS; u++) {
+		if(!st->tex[u]) continue;
+		for(int i=0; i<4; i++) {
+			int k = SWR_VX_TEX + u * 4 + i;
+			SET_PLANE(SWR_ATTR_COLOR + k - SWR_VX_COLOR, v[0]->v[k] * iw[0], v[1]->v[k] * iw[1], v[2]->v[k] * iw[2]);
+		}
+	}
+#undef SET_PLANE
+
+	chunk->tris.push_back(tri);
+}
+
+void swr_setup_work(int idx, void *cls) {
+	SetupWork *work = (SetupWork*)cls;
+	SwrSetupChunk *chunk = &work->swr->chunks[idx];
+	chunk->tris.clear();
+	chunk->culled = chunk->clipped = 0;
+
+	int start = idx * SETUP_CHUNK;
+	int end = std::min(start + SETUP_CHUNK, work->tri_count);
+
+	SwrVertex poly[16], tmp[16];
+
+	for(int i=start; i<end; i++) {
+		int vidx[4];
+		prim_tri(work->prim, i, vidx);
+
+		const SwrVertex *v[3];
+		bool valid = true;
+		for(int j=0; j<4; j++) {
+			if(work->iarr) vidx[j] = work->iarr[vidx[j]];
+			if(vidx[j] < 0 || vidx[j] >= work->vcount) valid = false;
+		}
+		if(!valid) {
+			chunk->culled++;
+			continue;
+		}
+		for(int j=0; j<3; j++) {
+			v[j] = work->verts + vidx[j];
+		}
+
+		unsigned int c0 = outcode(v[0]->v), c1 = outcode(v[1]->v), c2 = outcode(v[2]->v);
+		if(c0 & c1 & c2) {
+			chunk->culled++;
+			continue;
+		}
+
+		if(!(c0 | c1 | c2) && !work->flat) {
+			setup_tri(work, v, chunk);
+			continue;
+		}
+
+		for(int j=0; j<3; j++) {
+			poly[j] = *v[j];
+		}
+		if(work->flat) {
+			const SwrVertex *pv = work->verts + vidx[3];
+			for(int j=0; j<3; j++) {
+				memcpy(poly[j].v + SWR_VX_COLOR, pv->v + SWR_VX_COLOR, 7 * sizeof(float));
+			}
+		}
+
+		int count = 3;
+		if(c0 | c1 | c2) {
+			chunk->clipped++;
+			count = clip_polygon(poly, tmp, 3, c0 | c1 | c2);
+		}
+
+		for(int j=2; j<count; j++) {
+			const SwrVertex *fan[] = {poly, poly + j - 1, poly + j};
+			setup_tri(work, fan, chunk);
+		}
+	}
+}
+
+void SoftRaster::update_pixel_state() {
+	if(!pstate_dirty && !states.empty()) return;
+
+	for(int i=0; i<SWR_TEX_UNITS; i++) {
+		const SwrTexture *tex = get_texture(units[i].tex);
+		bool usable = units[i].enabled && tex && tex->width > 0 && tex->height > 0 &&
+			tex->type != TEX_3D && !tex->faces[0].empty();
+
+		pstate.tex[i] = usable ? tex : 0;
+		pstate.unit[i] = units[i];
+		if(usable) {
+			pstate.uaddr[i] = tex->uaddr;
+			pstate.vaddr[i] = tex->vaddr;
+			pstate.nearest[i] = tex->nearest;
+		}
+	}
+	pstate.specular = lighting;
+
+	states.push_back(pstate);
+	pstate_dirty = false;
+}
+
+/* bin
+ * adds the triangle to the bins of the tiles its bounds overlap, skipping
+ * those which are completely outside one of its edges.
+ */
+void SoftRaster::bin(const SwrTri &tri) {
+	int index = (int)tris.size();
+	tris.push_back(tri);
+
+	int tx0 = tri.x0 / SWR_TILE_SIZE;
+	int ty0 = tri.y0 / SWR_TILE_SIZE;
+	int tx1 = (tri.x1 - 1) / SWR_TILE_SIZE;
+	int ty1 = (tri.y1 - 1) / SWR_TILE_SIZE;
+	bool single = tx0 == tx1 && ty0 == ty1;
+
+	for(int i=ty0; i<=ty1; i++) {
+		for(int j=tx0; j<=tx1; j++) {
+			if(!single) {
+				float x0 = (float)(j * SWR_TILE_SIZE), x1 = x0 + SWR_TILE_SIZE;
+				float y0 = (float)(i * SWR_TILE_SIZE), y1 = y0 + SWR_TILE_SIZE;
+
+				bool outside = false;
+				for(int k=0; k<3 && !outside; k++) {
+					const SwrEdge *e = tri.edge + k;
+					float a = e->a * e->sign, b = e->b * e->sign;
+					float px = a > 0.0f ? x1 : x0;
+					float py = b > 0.0f ? y1 : y0;
+					outside = a * (px - e->x) + b * (py - e->y) < 0.0f;
+				}
+				if(outside) continue;
+			}
+
+			bins[i * xtiles + j].push_back(index);
+			stats.tile_refs++;
+		}
+	}
+}
+
+void SoftRaster::draw(const Vertex *varr, int vcount, const Index *iarr, int icount, PrimitiveType prim,
+		const Matrix4x4 &modelview, const Matrix4x4 &proj) {
+	int count = iarr ? icount : vcount;
+	int tri_count = prim_tri_count(prim, count);
+	stats.draws++;
+	if(!tri_count || vcount <= 0) return;
+
+	update_pixel_state();
+	const SwrPixelState *st = &states.back();
+
+	// transform and light the vertices
+	VertexWork vwork;
+	vwork.swr = this;
+	vwork.varr = varr;
+	vwork.count = vcount;
+	to_float(modelview, vwork.mv);
+	to_float(proj, vwork.proj);
+
+	Matrix4x4 nmat = modelview.inverse().transposed();
+	for(int i=0; i<3; i++) {
+		for(int j=0; j<3; j++) {
+			vwork.nmat[i * 3 + j] = (float)nmat[i][j];
+		}
+	}
+
+	for(int i=0; i<SWR_TEX_UNITS; i++) {
+		const SwrTexture *tex = st->tex[i];
+		if(!tex) {
+			vwork.tex_dim[i] = 0;
+		} else {
+			vwork.tex_dim[i] = tex->type == TEX_1D ? 1 : (tex->type == TEX_CUBE ? 3 : 2);
+		}
+	}
+
+	xverts.resize(vcount);
+	vwork.out = &xverts[0];
+	run_parallel((vcount + VERTEX_CHUNK - 1) / VERTEX_CHUNK, swr_vertex_work, &vwork);
+
+	// assemble, clip, and set up the triangles
+	SetupWork swork;
+	swork.swr = this;
+	swork.verts = &xverts[0];
+	swork.iarr = iarr;
+	swork.vcount = vcount;
+	swork.tri_count = tri_count;
+	swork.prim = prim;
+	swork.state = (int)states.size() - 1;
+	swork.pstate = st;
+	swork.flat = shading == SHADING_FLAT;
+	swork.cull = culling;
+	swork.front_ccw = front_face == (FaceOrder)GL_CCW;
+	swork.bx0 = std::max(vp_x, 0);
+	swork.by0 = std::max(vp_y, 0);
+	swork.bx1 = std::min(vp_x + vp_width, width);
+	swork.by1 = std::min(vp_y + vp_height, height);
+	swork.vp[0] = (float)vp_x;
+	swork.vp[1] = (float)vp_y;
+	swork.vp[2] = (float)vp_width;
+	swork.vp[3] = (float)vp_height;
+
+	int num_chunks = (tri_count + SETUP_CHUNK - 1) / SETUP_CHUNK;
+	if((int)chunks.size() < num_chunks) {
+		chunks.resize(num_chunks);
+	}
+	run_parallel(num_chunks, swr_setup_work, &swork);
+
+	// binning is serial, to keep the submission order in every tile
+	stats.triangles += tri_count;
+	for(int i=0; i<num_chunks; i++) {
+		const SwrSetupChunk &chunk = chunks[i];
+		stats.culled += chunk.culled;
+		stats.clipped += chunk.clipped;
+		stats.binned += chunk.tris.size();
+
+		for(size_t j=0; j<chunk.tris.size(); j++) {
+			bin(chunk.tris[j]);
+		}
+	}
+
+	if(tris.size() >= MAX_PENDING) {
+		flush();
+	}
+}
+
+///////////// pixel processing /////////////
+
+static inline bool compare(CmpFunc func, float a, float b) {
+	switch(func) {
+	case CMP_NEVER: return false;
+	case CMP_LESS: return a < b;
+	case CMP_EQUAL: return a == b;
+	case CMP_LEQUAL: return a <= b;
+	case CMP_GREATER: return a > b;
+	case CMP_NOTEQUAL: return a != b;
+	case CMP_GEQUAL: return a >= b;
+	default: return true;
+	}
+}
+
+static inline unsigned char stencil_op(StencilOp op, unsigned char val, unsigned char ref) {
+	switch(op) {
+	case SOP_ZERO: return 0;
+	case SOP_REPLACE: return ref;
+	case SOP_INCSAT: return val < 255 ? val + 1 : 255;
+	case SOP_DECSAT: return val > 0 ? val - 1 : 0;
+	case SOP_INVERT: return ~val;
+	default: return val;
+	}
+}
+
+static inline float wrap_coord(float s, TextureAddressing mode) {
+	return mode == TEXADDR_WRAP ? s - floor(s) : clamp01(s);
+}
+
+static inline int wrap_index(int i, int size, TextureAddressing mode) {
+	if(mode == TEXADDR_WRAP) {
+		return i < 0 ? i + size : (i >= size ? i - size : i);
+	}
+	return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+static void sample_image(const Pixel *img, int xsz, int ysz, float s, float t, TextureAddressing uaddr,
+		TextureAddressing vaddr, bool nearest, float *res) {
+	s = wrap_coord(s, uaddr);
+	t = wrap_coord(t, vaddr);
+
+	if(nearest) {
+		int x = std::min((int)(s * xsz), xsz - 1);
+		int y = std::min((int)(t * ysz), ysz - 1);
+		unpack(img[y * xsz + x], res);
+		return;
+	}
+
+	float u = s * xsz - 0.5f, v = t * ysz - 0.5f;
+	float fu = floor(u), fv = floor(v);
+	int x0 = (int)fu, y0 = (int)fv;
+	float du = u - fu, dv = v - fv;
+
+	int x1 = wrap_index(x0 + 1, xsz, uaddr);
+	int y1 = wrap_index(y0 + 1, ysz, vaddr);
+	x0 = wrap_index(x0, xsz, uaddr);
+	y0 = wrap_index(y0, ysz, vaddr);
+
+	float c00[4], c01[4], c10[4], c11[4];
+	unpack(img[y0 * xsz + x0], c00);
+	unpack(img[y0 * xsz + x1], c01);
+	unpack(img[y1 * xsz + x0], c10);
+	unpack(img[y1 * xsz + x1], c11);
+
+	for(int i=0; i<4; i++) {
+		float top = c00[i] + (c01[i] - c00[i]) * du;
+		float bottom = c10[i] + (c11[i] - c10[i]) * du;
+		res[i] = top + (bottom - top) * dv;
+	}
+}
+
+static void sample(const SwrPixelState *st, int unit, const float *str, float *res) {
+	const SwrTexture *tex = st->tex[unit];
+
+	if(tex->type != TEX_CUBE) {
+		sample_image(&tex->faces[0][0], tex->width, tex->height, str[0], str[1],
+				st->uaddr[unit], st->vaddr[unit], st->nearest[unit], res);
+		return;
+	}
+
+	// pick the face by the major axis, as in the OpenGL spec
+	float rx = str[0], ry = str[1], rz = str[2];
+	float ax = fabs(rx), ay = fabs(ry), az = fabs(rz);
+	int face;
+	float sc, tc, ma;
+
+	if(ax >= ay && ax >= az) {
+		face = rx >= 0.0f ? 0 : 1;
+		sc = rx >= 0.0f ? -rz : rz;
+		tc = -ry;
+		ma = ax;
+	} else if(ay >= az) {
+		face = ry >= 0.0f ? 2 : 3;
+		sc = rx;
+		tc = ry >= 0.0f ? rz : -rz;
+		ma = ay;
+	} else {
+		face = rz >= 0.0f ? 4 : 5;
+		sc = rz >= 0.0f ? rx : -rx;
+		tc = -ry;
+		ma = az;
+	}
+
+	const std::vector<Pixel> &img = tex->faces[face];
+	if(img.empty() || ma <= 0.0f) {
+		set4(res, 0, 0, 0, 1);
+		return;
+	}
+
+	float s = (sc / ma + 1.0f) * 0.5f;
+	float t = (tc / ma + 1.0f) * 0.5f;
+	sample_image(&img[0], tex->width, tex->height, s, t, TEXADDR_CLAMP, TEXADDR_CLAMP, st->nearest[unit], res);
+}
+
+static inline const float *combine_arg(TextureBlendArgument arg, const float *tex, const float *prim,
+		const float *prev, const float *constant) {
+	switch(arg) {
+	case TARG_TEXTURE: return tex;
+	case TARG_CONSTANT: return constant;
+	case TARG_COLOR: return prim;
+	default: return prev;
+	}
+}
+
+static inline float combine_op(TextureBlendFunction op, float a0, float a1, float a2) {
+	switch(op) {
+	case TOP_REPLACE: return a0;
+	case TOP_ADD: return a0 + a1;
+	case TOP_ADDSIGNED: return a0 + a1 - 0.5f;
+	case TOP_SUBTRACT: return a0 - a1;
+	case TOP_LERP: return a0 * a2 + a1 * (1.0f - a2);
+	case TOP_MODULATE:
+	default:
+		return a0 * a1;
+	}
+}
+
+// the GL_COMBINE texture environment of one unit
+static void combine(const SwrTexUnit *unit, const float *tex, const float *prim, float *frag) {
+	float prev[4];
+	memcpy(prev, frag, sizeof prev);
+
+	const float *a0 = combine_arg(unit->color_arg[0], tex, prim, prev, unit->constant);
+	const float *a1 = combine_arg(unit->color_arg[1], tex, prim, prev, unit->constant);
+	const float *a2 = combine_arg(unit->color_arg[2], tex, prim, prev, unit->constant);
+
+	if(unit->color_op == TOP_DOT3 || unit->color_op == TOP_DOT3_RGBA) {
+		float d = 4.0f * ((a0[0] - 0.5f) * (a1[0] - 0.5f) + (a0[1] - 0.5f) * (a1[1] - 0.5f) +
+				(a0[2] - 0.5f) * (a1[2] - 0.5f));
+		d = clamp01(d);
+		frag[0] = frag[1] = frag[2] = d;
+		if(unit->color_op == TOP_DOT3_RGBA) {
+			frag[3] = d;
+			return;
+		}
+	} else {
+		for(int i=0; i<3; i++) {
+			frag[i] = clamp01(combine_op(unit->color_op, a0[i], a1[i], a2[i]));
+		}
+	}
+
+	a0 = combine_arg(unit->alpha_arg[0], tex, prim, prev, unit->constant);
+	a1 = combine_arg(unit->alpha_arg[1], tex, prim, prev, unit->constant);
+	a2 = combine_arg(unit->alpha_arg[2], tex, prim, prev, unit->constant);
+	frag[3] = clamp01(combine_op(unit->alpha_op, a0[3], a1[3], a2[3]));
+}
+
+static inline void blend_factor(BlendingFactor factor, const float *src, const float *dst, float *res) {
+	switch((int)factor) {
+	case GL_ZERO:
+		set4(res, 0, 0, 0, 0);
+		break;
+	case GL_SRC_COLOR:
+		set4(res, src[0], src[1], src[2], src[3]);
+		break;
+	case GL_ONE_MINUS_SRC_COLOR:
+		set4(res, 1.0f - src[0], 1.0f - src[1], 1.0f - src[2], 1.0f - src[3]);
+		break;
+	case GL_SRC_ALPHA:
+		set4(res, src[3], src[3], src[3], src[3]);
+		break;
+	case GL_ONE_MINUS_SRC_ALPHA:
+		set4(res, 1.0f - src[3], 1.0f - src[3], 1.0f - src[3], 1.0f - src[3]);
+		break;
+	case GL_DST_COLOR:
+		set4(res, dst[0], dst[1], dst[2], dst[3]);
+		break;
+	case GL_ONE_MINUS_DST_COLOR:
+		set4(res, 1.0f - dst[0], 1.0f - dst[1], 1.0f - dst[2], 1.0f - dst[3]);
+		break;
+	case GL_DST_ALPHA:
+		set4(res, dst[3], dst[3], dst[3], dst[3]);
+		break;
+	case GL_ONE_MINUS_DST_ALPHA:
+		set4(res, 1.0f - dst[3], 1.0f - dst[3], 1.0f - dst[3], 1.0f - dst[3]);
+		break;
+	case GL_ONE:
+	default:
+		set4(res, 1, 1, 1, 1);
+		break;
+	}
+}
+
+// the fragment operations and shading of one covered pixel
+static inline void shade_pixel(const SwrTri &tri, const SwrPixelState *st, Pixel *cptr, float *zptr,
+		unsigned char *sptr, float fx, float fy, float z) {
+	if(st->stest) {
+		if(!compare(st->sfunc, st->sref, *sptr)) {
+			*sptr = stencil_op(st->sfail, *sptr, st->sref);
+			return;
+		}
+	}
+	if(st->ztest) {
+		if(!compare(st->zfunc, z, *zptr)) {
+			if(st->stest) *sptr = stencil_op(st->szfail, *sptr, st->sref);
+			return;
+		}
+		if(st->zwrite) *zptr = z;
+	}
+	if(st->stest) *sptr = stencil_op(st->spass, *sptr, st->sref);
+
+	if(!st->color_mask) return;
+
+#define PLANE(k)	(tri.plane[k][0] + tri.plane[k][1] * fx + tri.plane[k][2] * fy)
+
+	float w = 1.0f / PLANE(SWR_ATTR_IW);
+	float prim[4], frag[4];
+	for(int i=0; i<4; i++) {
+		prim[i] = frag[i] = clamp01(PLANE(SWR_ATTR_COLOR + i) * w);
+	}
+
+	for(int u=0; u<SWR_TEX_UNITS; u++) {
+		if(!st->tex[u]) continue;
+
+		int k = SWR_ATTR_COLOR + SWR_VX_TEX - SWR_VX_COLOR + u * 4;
+		float q = PLANE(k + 3);
+		float iq = q != 0.0f ? 1.0f / q : 0.0f;
+		float str[] = {PLANE(k) * iq, PLANE(k + 1) * iq, PLANE(k + 2) * iq};
+
+		float texel[4];
+		sample(st, u, str, texel);
+		combine(st->unit + u, texel, prim, frag);
+	}
+
+	if(st->specular) {
+		int k = SWR_ATTR_COLOR + SWR_VX_SPEC - SWR_VX_COLOR;
+		for(int i=0; i<3; i++) {
+			frag[i] = clamp01(frag[i] + PLANE(k + i) * w);
+		}
+	}
+#undef PLANE
+
+	Pixel dst_pixel = *cptr;
+	if(st->blend) {
+		float dst[4], sf[4], df[4];
+		unpack(dst_pixel, dst);
+		blend_factor(st->src_blend, frag, dst, sf);
+		blend_factor(st->dst_blend, frag, dst, df);
+		for(int i=0; i<4; i++) {
+			frag[i] = frag[i] * sf[i] + dst[i] * df[i];
+		}
+	}
+
+	Pixel p = pack(frag);
+	*cptr = (p & st->color_mask) | (dst_pixel & ~st->color_mask);
+}
+
+/* raster_tile
+ * Draws the triangles binned to a tile, in order. Coverage and depth are
+ * computed for 4 pixels at a time; the edge functions are evaluated directly
+ * at every pixel center rather than stepped, so that two triangles sharing
+ * an edge get exactly opposite values there, and the top-left rule gives
+ * each pixel on it to one of them.
+ */
+void SoftRaster::raster_tile(int tile) {
+	int tx0 = (tile % xtiles) * SWR_TILE_SIZE;
+	int ty0 = (tile / xtiles) * SWR_TILE_SIZE;
+	int tx1 = std::min(tx0 + SWR_TILE_SIZE, width);
+	int ty1 = std::min(ty0 + SWR_TILE_SIZE, height);
+
+	const std::vector<int> &bin = bins[tile];
+
+	for(size_t n=0; n<bin.size(); n++) {
+		const SwrTri &tri = tris[bin[n]];
+		const SwrPixelState *st = &states[tri.state];
+
+		int x0 = std::max(tri.x0, tx0), x1 = std::min(tri.x1, tx1);
+		int y0 = std::max(tri.y0, ty0), y1 = std::min(tri.y1, ty1);
+		if(x0 >= x1 || y0 >= y1) continue;
+
+#ifdef USE_SSE
+		__m128 zero = _mm_setzero_ps();
+		__m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		__m128 ea[3], ex[3], es[3];
+		for(int k=0; k<3; k++) {
+			ea[k] = _mm_set1_ps(tri.edge[k].a);
+			ex[k] = _mm_set1_ps(tri.edge[k].x);
+			es[k] = _mm_set1_ps(tri.edge[k].sign);
+		}
+		__m128 za = _mm_set1_ps(tri.plane[SWR_ATTR_Z][1]);
+		__m128 zox = _mm_set1_ps(tri.ox);
+#endif
+
+		for(int y=y0; y<y1; y++) {
+			float py = (float)y + 0.5f;
+			float fy = py - tri.oy;
+			float eby[3];
+			for(int k=0; k<3; k++) {
+				eby[k] = tri.edge[k].b * (py - tri.edge[k].y);
+			}
+			float zrow = tri.plane[SWR_ATTR_Z][0] + tri.plane[SWR_ATTR_Z][2] * fy;
+
+			int offs = y * width;
+			Pixel *crow = color.buffer + offs;
+			float *zrow_ptr = &depth[offs];
+			unsigned char *srow = &stencil[offs];
+
+			for(int x=x0; x<x1; x+=4) {
+				unsigned int mask = x1 - x >= 4 ? 0xf : (1 << (x1 - x)) - 1;
+				float z[4];
+
+#ifdef USE_SSE
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+				for(int k=0; k<3 && mask; k++) {
+					__m128 e = _mm_add_ps(_mm_mul_ps(ea[k], _mm_sub_ps(px, ex[k])), _mm_set1_ps(eby[k]));
+					e = _mm_mul_ps(e, es[k]);
+					__m128 in = tri.edge[k].incl ? _mm_cmpge_ps(e, zero) : _mm_cmpgt_ps(e, zero);
+					mask &= _mm_movemask_ps(in);
+				}
+				if(!mask) continue;
+				_mm_storeu_ps(z, _mm_add_ps(_mm_set1_ps(zrow), _mm_mul_ps(za, _mm_sub_ps(px, zox))));
+#else
+				for(int i=0; i<4; i++) {
+					if(!(mask & (1 << i))) continue;
+					float px = (float)(x + i) + 0.5f;
+					for(int k=0; k<3; k++) {
+						const SwrEdge *edge = tri.edge + k;
+						float e = (edge->a * (px - edge->x) + eby[k]) * edge->sign;
+						if(!(edge->incl ? e >= 0.0f : e > 0.0f)) {
+							mask &= ~(1 << i);
+							break;
+						}
+					}
+					z[i] = zrow + tri.plane[SWR_ATTR_Z][1] * (px - tri.ox);
+				}
+				if(!mask) continue;
+#endif
+
+				for(int i=0; i<4; i++) {
+					if(!(mask & (1 << i))) continue;
+					int xi = x + i;
+					float fx = (float)xi + 0.5f - tri.ox;
+					shade_pixel(tri, st, crow + xi, zrow_ptr + xi, srow + xi, fx, fy, z[i]);
+				}
+			}
+		}
+	}
+}
+
+const SwrStats *SoftRaster::get_stats() const {
+	return &stats;
+}
+
+void SoftRaster::reset_stats() {
+	memset(&stats, 0, sizeof stats);
+}
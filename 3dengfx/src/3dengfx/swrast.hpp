@@ -0,0 +1,275 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* software rasterizer, for rendering without a graphics context
+ *
+ * SoftRaster implements the part of the fixed function OpenGL pipeline the
+ * engine uses. After create_soft_context() (see 3denginefx.hpp) the
+ * 3denginefx state functions and draw calls end up here instead of OpenGL:
+ * triangle lists, strips, fans and quads, per vertex lighting with up to 8
+ * point and directional lights, flat and gouraud shading, 2 texture units
+ * with the combiner operations, 1D, 2D and cube map textures with point or
+ * bilinear sampling, sphere and reflection map texture coordinates, texture
+ * matrices, blending, color write masks, and the depth and stencil tests.
+ * Lines, points, wireframe, mipmaps and shader programs are ignored.
+ *
+ * Draw calls only transform and set up their triangles, and sort them into
+ * screen tiles. The tiles are rasterized in parallel when the frame buffer
+ * is needed (flip, clear, readback, render to texture), each one drawing
+ * its triangles in submission order, so the output is the same with any
+ * number of threads. Coverage and depth are evaluated for 4 pixels at a
+ * time with SSE, when available.
+ *
+ * The buffers follow the OpenGL conventions: pixel (0, 0) is the lower left
+ * corner, and texture images are stored the way glTexImage2D receives them.
+ */
+
+#ifndef _SWRAST_HPP_
+#define _SWRAST_HPP_
+
+#include <vector>
+#include "3denginefx_types.hpp"
+#include "gfx/3dgeom.hpp"
+#include "gfx/pbuffer.hpp"
+
+#define SWR_MAX_LIGHTS		8
+#define SWR_TEX_UNITS		2
+#define SWR_TILE_SIZE		64
+
+// buffers for SoftRaster::clear()
+enum {
+	SWR_COLOR_BUFFER	= 1,
+	SWR_DEPTH_BUFFER	= 2,
+	SWR_STENCIL_BUFFER	= 4
+};
+
+// per vertex attributes, transformed and lit
+enum {
+	SWR_VX_POS		= 0,	// clip space x, y, z, w
+	SWR_VX_COLOR	= 4,	// primary color r, g, b, a
+	SWR_VX_SPEC		= 8,	// secondary (specular) color r, g, b
+	SWR_VX_TEX		= 11,	// s, t, r, q of each texture unit
+	SWR_VX_SIZE		= SWR_VX_TEX + 4 * SWR_TEX_UNITS
+};
+
+// interpolated attributes, after the window space depth and 1/w
+enum {
+	SWR_ATTR_Z		= 0,
+	SWR_ATTR_IW		= 1,
+	SWR_ATTR_COLOR	= 2,
+	SWR_ATTR_COUNT	= SWR_ATTR_COLOR + SWR_VX_SIZE - SWR_VX_COLOR
+};
+
+struct SwrVertex {
+	float v[SWR_VX_SIZE];
+};
+
+struct SwrLight {
+	bool enabled;
+	float pos[4];		// eye space, w = 0 for directional lights
+	float ambient[4], diffuse[4], specular[4];
+	float att[3];
+};
+
+struct SwrTexture {
+	TextureDim type;
+	int width, height;
+	std::vector<Pixel> faces[6];	// 0xAARRGGBB, row 0 is t = 0
+	TextureAddressing uaddr, vaddr;
+	bool nearest;
+};
+
+struct SwrTexUnit {
+	bool enabled;
+	unsigned int tex;
+	TextureBlendFunction color_op, alpha_op;
+	TextureBlendArgument color_arg[3], alpha_arg[3];
+	float constant[4];
+	int coord_index;
+	TexGen texgen;
+	float matrix[16];
+	bool identity;
+};
+
+// what the pixel pipeline needs, shared by all the triangles drawn with it
+struct SwrPixelState {
+	const SwrTexture *tex[SWR_TEX_UNITS];	// 0 for disabled units
+	SwrTexUnit unit[SWR_TEX_UNITS];
+	TextureAddressing uaddr[SWR_TEX_UNITS], vaddr[SWR_TEX_UNITS];
+	bool nearest[SWR_TEX_UNITS];
+	bool specular;
+	bool blend;
+	BlendingFactor src_blend, dst_blend;
+	bool ztest, zwrite;
+	CmpFunc zfunc;
+	bool stest;
+	CmpFunc sfunc;
+	unsigned char sref;
+	StencilOp sfail, szfail, spass;
+	Pixel color_mask;
+};
+
+struct SwrEdge {
+	float a, b, x, y;	// a * (px - x) + b * (py - y), shared with the neighbour
+	float sign;			// +1 or -1, to get the edge function of this triangle
+	bool incl;			// pixel centers exactly on the edge belong to this triangle
+};
+
+struct SwrTri {
+	int state;
+	int x0, y0, x1, y1;		// pixel bounds, max exclusive
+	float ox, oy;			// where the attribute planes are relative to
+	SwrEdge edge[3];
+	float plane[SWR_ATTR_COUNT][3];	// c + a * (px - ox) + b * (py - oy)
+};
+
+// the triangles set up from one slice of a draw call
+struct SwrSetupChunk {
+	std::vector<SwrTri> tris;
+	unsigned long culled, clipped;
+};
+
+struct SwrStats {
+	unsigned long draws;
+	unsigned long triangles;	// assembled from the draws
+	unsigned long culled;		// back facing, off screen or empty
+	unsigned long clipped;		// crossing a clip plane
+	unsigned long binned;		// set up for rasterization
+	unsigned long tile_refs;	// triangle references in the tile bins
+	unsigned long flushes;
+};
+
+class SoftRaster {
+private:
+	int width, height;
+	PixelBuffer color;
+	std::vector<float> depth;
+	std::vector<unsigned char> stencil;
+
+	// state
+	int vp_x, vp_y, vp_width, vp_height;
+	bool culling, normalize;
+	FaceOrder front_face;
+	bool lighting, vertex_colors;
+	ShadeMode shading;
+	float ambient_light[4];
+	float mat_ambient[4], mat_diffuse[4], mat_specular[4], mat_emission[4], mat_power;
+	SwrLight lights[SWR_MAX_LIGHTS];
+	SwrTexUnit units[SWR_TEX_UNITS];
+	SwrPixelState pstate;
+	bool pstate_dirty;
+
+	std::vector<SwrTexture*> textures;	// indexed by texture id - 1
+
+	// deferred work of the frame
+	std::vector<SwrPixelState> states;
+	std::vector<SwrTri> tris;
+	std::vector<std::vector<int> > bins;
+	int xtiles, ytiles;
+
+	// per draw temporaries
+	std::vector<SwrVertex> xverts;
+	std::vector<SwrSetupChunk> chunks;
+	std::vector<int> active_tiles;
+
+	SwrStats stats;
+
+	SwrTexture *get_texture(unsigned int tex) const;
+	void update_pixel_state();
+	void bin(const SwrTri &tri);
+	void raster_tile(int tile);
+
+	friend void swr_vertex_work(int idx, void *cls);
+	friend void swr_setup_work(int idx, void *cls);
+	friend void swr_tile_work(int idx, void *cls);
+
+public:
+	SoftRaster(int width, int height);
+	~SoftRaster();
+
+	int get_width() const;
+	int get_height() const;
+
+	// frame buffer, rows from the bottom up
+	void clear(unsigned int buffers, const Color &col, float z, unsigned char s);
+	void flush();
+	const PixelBuffer *get_frame_buffer();
+	void read_pixels(Pixel *dest);
+
+	// geometry and raster states
+	void set_viewport(int x, int y, int xsz, int ysz);
+	void set_backface_culling(bool enable);
+	void set_front_face(FaceOrder order);
+	void set_auto_normalize(bool enable);
+	void set_color_write(bool red, bool green, bool blue, bool alpha);
+	void set_alpha_blending(bool enable);
+	void set_blend_func(BlendingFactor src, BlendingFactor dest);
+	void set_zbuffering(bool enable);
+	void set_zwrite(bool enable);
+	void set_zfunc(CmpFunc func);
+	void set_stencil_buffering(bool enable);
+	void set_stencil_op(StencilOp fail, StencilOp spass_zfail, StencilOp pass);
+	void set_stencil_func(CmpFunc func);
+	void set_stencil_reference(unsigned int ref);
+	void set_shading_mode(ShadeMode mode);
+
+	// lighting
+	void set_lighting(bool enable);
+	void use_vertex_colors(bool enable);
+	void set_ambient_light(const float *col);
+	void set_material(const float *amb, const float *dif, const float *spec, const float *emis, float power);
+	// pos is transformed by mv like glLightfv(GL_POSITION) does
+	void set_light(int idx, const float *pos, const Matrix4x4 &mv, const float *amb, const float *dif, const float *spec);
+	void set_light_attenuation(int idx, float constant, float linear, float quadratic);
+	void enable_light(int idx, bool enable);
+
+	// texture units
+	void enable_texture_unit(int unit, bool enable);
+	void bind_texture(int unit, unsigned int tex);
+	void set_texture_unit_color(int unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3);
+	void set_texture_unit_alpha(int unit, TextureBlendFunction op, TextureBlendArgument arg1, TextureBlendArgument arg2, TextureBlendArgument arg3);
+	void set_texture_constant(int unit, const Color &col);
+	void set_texture_coord_index(int unit, int index);
+	void set_texture_coord_generator(int unit, TexGen tgen);
+	void set_texture_matrix(int unit, const Matrix4x4 &mat);
+	// these apply to the texture bound to the unit, as in OpenGL
+	void set_texture_filtering(int unit, TextureFilteringType filter);
+	void set_texture_addressing(int unit, TextureAddressing uaddr, TextureAddressing vaddr);
+
+	// texture objects, ids start from 1
+	unsigned int create_texture(TextureDim type);
+	void delete_texture(unsigned int tex);
+	// bgra: pixels are 0xAARRGGBB as with GL_BGRA, or else bytes in RGBA order
+	void tex_image(unsigned int tex, int face, int xsz, int ysz, const Pixel *pixels, bool bgra);
+	// like glTexSubImage2D, replaces a rectangle of an image set by tex_image()
+	void tex_sub_image(unsigned int tex, int face, int x, int y, int xsz, int ysz, const Pixel *pixels, bool bgra);
+	// returns bytes in RGBA order, like glGetTexImage(..., GL_RGBA, ...)
+	void get_tex_image(unsigned int tex, int face, Pixel *pixels);
+	// like glCopyTexSubImage2D, from the lower left corner of the frame buffer
+	void copy_to_texture(unsigned int tex, int face, int xsz, int ysz);
+
+	void draw(const Vertex *varr, int vcount, const Index *iarr, int icount, PrimitiveType prim,
+			const Matrix4x4 &modelview, const Matrix4x4 &proj);
+
+	const SwrStats *get_stats() const;
+	void reset_stats();
+};
+
+#endif	// _SWRAST_HPP_
@@ -0,0 +1,846 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* heightfield terrain with continuous level of detail */
+
+#include "3dengfx_config.h"
+
+#include <cmath>
+#include <cfloat>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "terrain.hpp"
+#include "object.hpp"
+#include "gfx/meshopt.hpp"
+#include "gfx/image.h"
+#include "gfx/color_bits.h"
+#include "common/threads.h"
+#include "common/err_msg.h"
+#include "common/profile.h"
+
+#define FAULT_ROWS		16		// heightfield rows per task of the worker threads
+/* tanh is 1 in single precision from about 9, the heights past that distance
+ * from a fault line are all raised by the same amount.
+ */
+#define FAULT_SATURATION	9.5
+
+using std::min;
+using std::max;
+
+HeightField::HeightField(int xsz, int ysz) {
+	this->xsz = this->ysz = 0;
+	resize(xsz, ysz);
+}
+
+void HeightField::resize(int xsz, int ysz) {
+	this->xsz = xsz;
+	this->ysz = ysz;
+	heights.clear();
+	heights.resize(xsz * ysz, 0.0f);
+}
+
+void HeightField::swap(HeightField &hf) {
+	std::swap(xsz, hf.xsz);
+	std::swap(ysz, hf.ysz);
+	heights.swap(hf.heights);
+}
+
+void HeightField::get_range(float *hmin, float *hmax) const {
+	float lo = FLT_MAX, hi = -FLT_MAX;
+	for(size_t i=0; i<heights.size(); i++) {
+		if(heights[i] < lo) lo = heights[i];
+		if(heights[i] > hi) hi = heights[i];
+	}
+	*hmin = lo;
+	*hmax = hi;
+}
+
+void HeightField::normalize(scalar_t max_height) {
+	float hmin, hmax;
+	get_range(&hmin, &hmax);
+	if(heights.empty()) return;
+
+	float scale = hmax > hmin ? max_height / (hmax - hmin) : 0.0f;
+	for(size_t i=0; i<heights.size(); i++) {
+		heights[i] = (heights[i] - hmin) * scale;
+	}
+}
+
+Vector3 HeightField::get_normal(int x, int y, scalar_t xscale, scalar_t yscale, int step) const {
+	scalar_t dhdx = (get(x + step, y) - get(x - step, y)) / (2.0 * step * xscale);
+	scalar_t dhdz = (get(x, y + step) - get(x, y - step)) / (2.0 * step * yscale);
+	return Vector3(-dhdx, 1.0, -dhdz).normalized();
+}
+
+// a fault line, as a linear function of the position, positive on the raised side
+struct FaultLine {
+	double nx, nz, d;
+};
+
+struct FaultWork {
+	HeightField *hf;
+	const FaultLine *lines;
+	int count;
+	double offs;
+	double x0, z0, dx, dz;
+};
+
+/* add_fault_row
+ * raises a row of heights by one fault, given the argument of tanh at the
+ * first sample and its change per sample. Only the samples within the
+ * smooth band of the fault are evaluated, the rest of the raised side goes
+ * through the difference array.
+ */
+static void add_fault_row(float *row, double *diff, int xsz, double arg0, double darg, double offs) {
+	if(darg == 0.0) {
+		if(arg0 > 0.0) {
+			double h = arg0 >= FAULT_SATURATION ? offs : offs * tanh(arg0);
+			diff[0] += h;
+			diff[xsz] -= h;
+		}
+		return;
+	}
+
+	// the band (0, FAULT_SATURATION) lies between these two sample positions
+	double t0 = -arg0 / darg;
+	double t1 = (FAULT_SATURATION - arg0) / darg;
+	double lo = floor(min(t0, t1)), hi = ceil(max(t0, t1));
+
+	int first = (int)max(min(lo, (double)xsz), 0.0);
+	int last = (int)min(max(hi, -1.0), (double)(xsz - 1));
+	for(int i=first; i<=last; i++) {
+		double arg = arg0 + i * darg;
+		if(arg > 0.0) {
+			row[i] += arg >= FAULT_SATURATION ? offs : offs * tanh(arg);
+		}
+	}
+
+	if(darg > 0.0) {
+		if(hi + 1.0 < (double)xsz) {
+			diff[(int)max(hi + 1.0, 0.0)] += offs;
+			diff[xsz] -= offs;
+		}
+	} else {
+		if(lo > 0.0) {
+			diff[0] += offs;
+			diff[(int)min(lo, (double)xsz)] -= offs;
+		}
+	}
+}
+
+static void fault_rows_work(int idx, void *cls) {
+	FaultWork *w = (FaultWork*)cls;
+	int xsz = w->hf->get_xsize();
+	int ysz = w->hf->get_ysize();
+	int y0 = idx * FAULT_ROWS;
+	int y1 = min(y0 + FAULT_ROWS, ysz);
+
+	std::vector<double> diff(xsz + 1);
+
+	for(int y=y0; y<y1; y++) {
+		float *row = w->hf->get_data() + y * xsz;
+		std::fill(diff.begin(), diff.end(), 0.0);
+
+		double z = w->z0 + y * w->dz;
+		for(int i=0; i<w->count; i++) {
+			const FaultLine &l = w->lines[i];
+			add_fault_row(row, &diff[0], xsz, l.nx * w->x0 + l.nz * z + l.d, l.nx * w->dx, w->offs);
+		}
+
+		double acc = 0.0;
+		for(int i=0; i<xsz; i++) {
+			acc += diff[i];
+			row[i] += acc;
+		}
+	}
+}
+
+/* gen_fault_heightfield
+ * the lines are picked serially, in the same order as create_landscape
+ * always did, so a seed gives the same landscape. Each row is then raised
+ * by all the lines on its own, so the rows can be split across threads.
+ */
+void gen_fault_heightfield(HeightField *hf, int xsz, int ysz, const Vector2 &size, scalar_t max_height,
+		int iter, scalar_t roughness, int seed) {
+	PROF_SCOPE("gen_fault_heightfield");
+	hf->resize(xsz, ysz);
+	if(xsz < 2 || ysz < 2 || iter < 1) return;
+
+	roughness *= 0.25;
+
+	if(seed == GGEN_RANDOM_SEED) {
+		srand(time(0));
+	} else if(seed != GGEN_NO_RESEED) {
+		srand(seed);
+	}
+
+	// tanh of the distance from the line, scaled by the roughness
+	double k = size.x * size.y * roughness;
+
+	std::vector<FaultLine> lines;
+	lines.reserve(iter);
+	for(int i=0; i<iter; i++) {
+		Vector2 pt1(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
+		Vector2 pt2(frand(size.x) - size.x / 2.0, frand(size.y) - size.y / 2.0);
+
+		double nx = pt2.y - pt1.y, nz = pt1.x - pt2.x;
+		double len = sqrt(nx * nx + nz * nz);
+		if(len == 0.0) continue;
+
+		FaultLine l;
+		l.nx = nx * k / len;
+		l.nz = nz * k / len;
+		l.d = -(l.nx * pt1.x + l.nz * pt1.y);
+		lines.push_back(l);
+	}
+
+	FaultWork work;
+	work.hf = hf;
+	work.lines = lines.empty() ? 0 : &lines[0];
+	work.count = (int)lines.size();
+	work.offs = max_height / (scalar_t)iter;
+	work.x0 = -size.x / 2.0;
+	work.z0 = -size.y / 2.0;
+	work.dx = size.x / (double)(xsz - 1);
+	work.dz = size.y / (double)(ysz - 1);
+
+	thr_parallel_for((ysz + FAULT_ROWS - 1) / FAULT_ROWS, fault_rows_work, &work);
+
+	hf->normalize(max_height);
+}
+
+bool load_heightfield(HeightField *hf, const char *fname, scalar_t max_height) {
+	unsigned long xsz, ysz;
+	uint32_t *pixels = (uint32_t*)load_image(fname, &xsz, &ysz);
+	if(!pixels) {
+		error("load_heightfield: failed to load %s", fname);
+		return false;
+	}
+
+	hf->resize(xsz, ysz);
+	float *hptr = hf->get_data();
+	for(unsigned long i=0; i<xsz * ysz; i++) {
+		uint32_t p = pixels[i];
+		int r = (p >> RED_SHIFT32) & RED_MASK32;
+		int g = (p >> GREEN_SHIFT32) & GREEN_MASK32;
+		int b = (p >> BLUE_SHIFT32) & BLUE_MASK32;
+		*hptr++ = (float)(r + g + b) / 765.0f;
+	}
+	free_image(pixels);
+
+	hf->normalize(max_height);
+	return true;
+}
+
+
+TerrainParams::TerrainParams() {
+	size = Vector2(100.0, 100.0);
+	chunk_size = 32;
+	lod_distance = 6.0;
+	morph_start = 0.8;
+	max_chunks = 512;
+}
+
+
+enum {MORPH_NONE, MORPH_PARTIAL, MORPH_FULL};
+
+struct TerrainChunk {
+	int level, x, z;
+	AABox box;
+	Object *obj;
+	Vertex *verts;			// built by the workers, until the object takes them
+	Vertex *vdata;			// of the object, while morphing
+
+	// the heights and normals at this level and at the parent level
+	std::vector<float> fine_y, delta_y;
+	std::vector<Vector3> fine_n, coarse_n;
+	int morph_state;
+	unsigned long last_used;
+};
+
+struct ChunkWork {
+	const HeightField *hf;
+	TerrainChunk **chunks;
+	int chunk_size;
+	scalar_t x0, z0, dx, dz;
+	Vector3 cam_pos;
+	const scalar_t *range;	// per level
+	scalar_t morph_start;
+};
+
+static inline uint32_t chunk_key(int level, int x, int z) {
+	return ((uint32_t)level << 26) | ((uint32_t)z << 13) | (uint32_t)x;
+}
+
+static scalar_t box_dist(const Vector3 &p, const AABox &box) {
+	Vector3 d;
+	d.x = max(max(box.vmin.x - p.x, p.x - box.vmax.x), (scalar_t)0.0);
+	d.y = max(max(box.vmin.y - p.y, p.y - box.vmax.y), (scalar_t)0.0);
+	d.z = max(max(box.vmin.z - p.z, p.z - box.vmax.z), (scalar_t)0.0);
+	return d.length();
+}
+
+static scalar_t box_far_dist(const Vector3 &p, const AABox &box) {
+	Vector3 d;
+	d.x = max(fabs(box.vmin.x - p.x), fabs(box.vmax.x - p.x));
+	d.y = max(fabs(box.vmin.y - p.y), fabs(box.vmax.y - p.y));
+	d.z = max(fabs(box.vmin.z - p.z), fabs(box.vmax.z - p.z));
+	return d.length();
+}
+
+/* build_chunk_work
+ * samples the heightfield every 2^level samples over the area of the chunk
+ * (clamped at the edges). The parent level has only the even vertices, the
+ * odd ones fall on the middle of its triangle edges, which are split along
+ * the same diagonal as ours.
+ */
+static void build_chunk_work(int idx, void *cls) {
+	ChunkWork *w = (ChunkWork*)cls;
+	TerrainChunk *chunk = w->chunks[idx];
+	const HeightField *hf = w->hf;
+
+	int cs = w->chunk_size, vrow = cs + 1, vcount = vrow * vrow;
+	int step = 1 << chunk->level;
+	int i0 = chunk->x * cs * step, j0 = chunk->z * cs * step;
+	int xmax = hf->get_xsize() - 1, ymax = hf->get_ysize() - 1;
+
+	chunk->verts = new Vertex[vcount];
+	chunk->fine_y.resize(vcount);
+	chunk->delta_y.resize(vcount);
+	chunk->fine_n.resize(vcount);
+	chunk->coarse_n.resize(vcount);
+
+	for(int b=0; b<vrow; b++) {
+		int j = min(j0 + b * step, ymax);
+		for(int a=0; a<vrow; a++) {
+			int i = min(i0 + a * step, xmax);
+			int k = b * vrow + a;
+
+			Vector3 pos(w->x0 + i * w->dx, hf->get(i, j), w->z0 + j * w->dz);
+			Vertex *v = chunk->verts + k;
+			*v = Vertex(pos, (scalar_t)i / (scalar_t)xmax, (scalar_t)j / (scalar_t)ymax);
+			v->normal = hf->get_normal(i, j, w->dx, w->dz, step);
+
+			chunk->fine_y[k] = pos.y;
+			chunk->fine_n[k] = v->normal;
+			if(!(a & 1) && !(b & 1)) {
+				chunk->coarse_n[k] = hf->get_normal(i, j, w->dx, w->dz, step * 2);
+			}
+		}
+	}
+
+	const float *y = &chunk->fine_y[0];
+	std::vector<Vector3> &cn = chunk->coarse_n;
+	for(int b=0; b<vrow; b++) {
+		for(int a=0; a<vrow; a++) {
+			int k = b * vrow + a;
+			int k0, k1;		// the ends of the parent edge
+
+			if(a & 1) {
+				k0 = (b & 1) ? k - vrow - 1 : k - 1;
+				k1 = (b & 1) ? k + vrow + 1 : k + 1;
+			} else if(b & 1) {
+				k0 = k - vrow;
+				k1 = k + vrow;
+			} else {
+				chunk->delta_y[k] = 0.0f;
+				continue;
+			}
+
+			chunk->delta_y[k] = (y[k0] + y[k1]) * 0.5f - y[k];
+			cn[k] = (cn[k0] + cn[k1]).normalized();
+		}
+	}
+}
+
+/* morph_chunk_work
+ * each vertex is morphed by its distance from the camera, from morph_start
+ * of the range of the level to the end of it. The distance is taken from
+ * the unmorphed position, the same on both sides of a chunk edge.
+ */
+static void morph_chunk_work(int idx, void *cls) {
+	ChunkWork *w = (ChunkWork*)cls;
+	TerrainChunk *chunk = w->chunks[idx];
+
+	scalar_t range = w->range[chunk->level];
+	scalar_t start = range * w->morph_start;
+	scalar_t inv_len = 1.0 / max(range - start, (scalar_t)small_number);
+
+	int vcount = (int)chunk->fine_y.size();
+	Vertex *v = chunk->vdata;
+
+	for(int k=0; k<vcount; k++) {
+		scalar_t m;
+		if(chunk->morph_state == MORPH_NONE) {
+			m = 0.0;
+		} else if(chunk->morph_state == MORPH_FULL) {
+			m = 1.0;
+		} else {
+			Vector3 fine(v->pos.x, chunk->fine_y[k], v->pos.z);
+			m = ((fine - w->cam_pos).length() - start) * inv_len;
+			m = max(min(m, (scalar_t)1.0), (scalar_t)0.0);
+		}
+
+		v->pos.y = chunk->fine_y[k] + chunk->delta_y[k] * m;
+		if(m > 0.0) {
+			const Vector3 &fn = chunk->fine_n[k];
+			v->normal = (fn + (chunk->coarse_n[k] - fn) * m).normalized();
+		} else {
+			v->normal = chunk->fine_n[k];
+		}
+		v++;
+	}
+}
+
+struct BoundsWork {
+	const HeightField *hf;
+	int chunk_size, side;
+	float *hmin, *hmax;
+};
+
+// the height range of a row of leaf nodes, from all the samples
+static void leaf_bounds_work(int idx, void *cls) {
+	BoundsWork *w = (BoundsWork*)cls;
+	int xsz = w->hf->get_xsize(), ysz = w->hf->get_ysize();
+	int j0 = idx * w->chunk_size;
+	int j1 = min(j0 + w->chunk_size, ysz - 1);
+
+	for(int x=0; x<w->side; x++) {
+		float lo = FLT_MAX, hi = -FLT_MAX;
+
+		int i0 = x * w->chunk_size;
+		int i1 = min(i0 + w->chunk_size, xsz - 1);
+		if(i0 < xsz - 1 && j0 < ysz - 1) {
+			for(int j=j0; j<=j1; j++) {
+				const float *row = w->hf->get_data() + j * xsz;
+				for(int i=i0; i<=i1; i++) {
+					if(row[i] < lo) lo = row[i];
+					if(row[i] > hi) hi = row[i];
+				}
+			}
+		}
+		w->hmin[idx * w->side + x] = lo;
+		w->hmax[idx * w->side + x] = hi;
+	}
+}
+
+
+Terrain::Terrain() : chunks(1021) {
+	levels = root_nodes = 0;
+	dx = dz = 0.0;
+	frame = 0;
+	memset(&stats, 0, sizeof stats);
+}
+
+Terrain::~Terrain() {
+	clear();
+}
+
+void Terrain::create(HeightField *hf, const TerrainParams &params) {
+	clear();
+
+	int cs = params.chunk_size;
+	if(hf->get_xsize() < 2 || hf->get_ysize() < 2 || cs < 2 || (cs & (cs - 1))) {
+		error("Terrain::create: invalid heightfield (%dx%d) or chunk size (%d)",
+				hf->get_xsize(), hf->get_ysize(), cs);
+		return;
+	}
+
+	this->hf.swap(*hf);
+	*hf = HeightField();
+	this->params = params;
+
+	int xsz = this->hf.get_xsize(), ysz = this->hf.get_ysize();
+	dx = params.size.x / (scalar_t)(xsz - 1);
+	dz = params.size.y / (scalar_t)(ysz - 1);
+
+	// the leaves on a side of the root, rounded up to a power of two
+	int leaves = max((xsz - 2) / cs + 1, (ysz - 2) / cs + 1);
+	root_nodes = 1;
+	levels = 1;
+	while(root_nodes < leaves) {
+		root_nodes <<= 1;
+		levels++;
+	}
+
+	build_bounds();
+	build_template();
+	stats.levels = levels;
+}
+
+void Terrain::clear() {
+	for(size_t i=0; i<chunk_list.size(); i++) {
+		delete chunk_list[i]->obj;
+		delete [] chunk_list[i]->verts;
+		delete chunk_list[i];
+	}
+	chunk_list.clear();
+	chunks.clear();
+	selection.clear();
+	build_list.clear();
+	morph_list.clear();
+
+	node_min.clear();
+	node_max.clear();
+	levels = root_nodes = 0;
+	memset(&stats, 0, sizeof stats);
+}
+
+void Terrain::build_bounds() {
+	PROF_SCOPE("Terrain::build_bounds");
+	node_min.resize(levels);
+	node_max.resize(levels);
+
+	int side = root_nodes;
+	node_min[0].resize(side * side);
+	node_max[0].resize(side * side);
+
+	BoundsWork work;
+	work.hf = &hf;
+	work.chunk_size = params.chunk_size;
+	work.side = side;
+	work.hmin = &node_min[0][0];
+	work.hmax = &node_max[0][0];
+	thr_parallel_for(side, leaf_bounds_work, &work);
+
+	for(int l=1; l<levels; l++) {
+		int cside = side;
+		side >>= 1;
+		node_min[l].resize(side * side);
+		node_max[l].resize(side * side);
+
+		for(int z=0; z<side; z++) {
+			for(int x=0; x<side; x++) {
+				const float *cmin = &node_min[l - 1][z * 2 * cside + x * 2];
+				const float *cmax = &node_max[l - 1][z * 2 * cside + x * 2];
+				node_min[l][z * side + x] = min(min(cmin[0], cmin[1]), min(cmin[cside], cmin[cside + 1]));
+				node_max[l][z * side + x] = max(max(cmax[0], cmax[1]), max(cmax[cside], cmax[cside + 1]));
+			}
+		}
+	}
+}
+
+/* build_template
+ * the triangles shared by all the chunks, each quad split along the
+ * diagonal from its first vertex, in vertex cache order.
+ */
+void Terrain::build_template() {
+	int cs = params.chunk_size, vrow = cs + 1;
+	unsigned long vcount = vrow * vrow;
+	unsigned long tcount = cs * cs * 2;
+
+	Vertex *varray = new Vertex[vcount];
+	Triangle *tarray = new Triangle[tcount];
+
+	Triangle *tptr = tarray;
+	for(int b=0; b<cs; b++) {
+		for(int a=0; a<cs; a++) {
+			Index v00 = b * vrow + a;
+			Index v10 = v00 + 1;
+			Index v01 = v00 + vrow;
+			Index v11 = v01 + 1;
+
+			*tptr++ = Triangle(v00, v11, v10);
+			*tptr++ = Triangle(v00, v01, v11);
+		}
+	}
+
+	std::vector<Index> indices(tcount * 3);
+	for(unsigned long i=0; i<tcount; i++) {
+		for(int j=0; j<3; j++) {
+			indices[i * 3 + j] = tarray[i].vertices[j];
+		}
+	}
+	std::vector<uint32_t> order(tcount);
+	optimize_vertex_cache(&order[0], &indices[0], tcount, vcount);
+
+	for(unsigned long i=0; i<tcount; i++) {
+		const Index *tri = &indices[order[i] * 3];
+		tarray[i] = Triangle(tri[0], tri[1], tri[2]);
+	}
+
+	chunk_template.adopt_data(varray, vcount, tarray, tcount);
+	chunk_template.get_index_array();
+}
+
+AABox Terrain::get_node_box(int level, int x, int z) const {
+	int span = params.chunk_size << level;
+	int i0 = x * span, j0 = z * span;
+	int i1 = min(i0 + span, hf.get_xsize() - 1);
+	int j1 = min(j0 + span, hf.get_ysize() - 1);
+
+	int side = root_nodes >> level;
+	float ymin = node_min[level][z * side + x];
+	float ymax = node_max[level][z * side + x];
+
+	scalar_t x0 = -params.size.x / 2.0, z0 = -params.size.y / 2.0;
+	return AABox(Vector3(x0 + i0 * dx, ymin, z0 + j0 * dz), Vector3(x0 + i1 * dx, ymax, z0 + j1 * dz));
+}
+
+scalar_t Terrain::get_range(int level) const {
+	return params.lod_distance * (scalar_t)(params.chunk_size << level) * max(dx, dz);
+}
+
+/* select_node
+ * a node is drawn if it is a leaf, or if the camera is out of the range
+ * of its children, otherwise they are selected in its place.
+ */
+void Terrain::select_node(int level, int x, int z, const FrustumPlane *frustum, unsigned int plane_mask) {
+	AABox box = get_node_box(level, x, z);
+
+	if(frustum && plane_mask) {
+		if(frustum_test(box, frustum, &plane_mask) == FRUSTUM_OUTSIDE) {
+			stats.culled++;
+			return;
+		}
+	}
+
+	if(level > 0 && box_dist(cam_pos, box) <= get_range(level - 1)) {
+		int side = root_nodes >> (level - 1);
+		for(int i=0; i<4; i++) {
+			int cx = x * 2 + (i & 1);
+			int cz = z * 2 + (i >> 1);
+			if(node_min[level - 1][cz * side + cx] <= node_max[level - 1][cz * side + cx]) {
+				select_node(level - 1, cx, cz, frustum, plane_mask);
+			}
+		}
+		return;
+	}
+
+	TerrainChunk *chunk = get_chunk(level, x, z);
+	chunk->box = box;
+	selection.push_back(chunk);
+}
+
+TerrainChunk *Terrain::get_chunk(int level, int x, int z) {
+	TerrainChunk *chunk;
+
+	Pair<uint32_t, TerrainChunk*> *res = chunks.find(chunk_key(level, x, z));
+	if(res) {
+		chunk = res->val;
+	} else {
+		chunk = new TerrainChunk;
+		chunk->level = level;
+		chunk->x = x;
+		chunk->z = z;
+		chunk->obj = 0;
+		chunk->verts = chunk->vdata = 0;
+		chunk->morph_state = MORPH_NONE;
+
+		chunks.insert(chunk_key(level, x, z), chunk);
+		chunk_list.push_back(chunk);
+		build_list.push_back(chunk);
+	}
+	chunk->last_used = frame;
+	return chunk;
+}
+
+// gives the built vertices to the object of the chunk, on the main thread
+void Terrain::finish_chunk(TerrainChunk *chunk) {
+	Object *obj = new Object;
+	TriMesh *mesh = obj->get_mesh_ptr();
+	*mesh = chunk_template;
+	mesh->get_mod_vertex_array()->adopt_data(chunk->verts, chunk_template.get_vertex_array()->get_count());
+	obj->set_dynamic(true);
+	obj->set_material(mat);
+
+	chunk->verts = 0;
+	chunk->obj = obj;
+	chunk->morph_state = MORPH_NONE;
+}
+
+static bool chunk_older(const TerrainChunk *a, const TerrainChunk *b) {
+	return a->last_used < b->last_used;
+}
+
+// drops the least recently drawn chunks over max_chunks
+void Terrain::evict_chunks() {
+	if((int)chunk_list.size() <= params.max_chunks) return;
+
+	std::vector<TerrainChunk*> unused;
+	for(size_t i=0; i<chunk_list.size(); i++) {
+		if(chunk_list[i]->last_used != frame) {
+			unused.push_back(chunk_list[i]);
+		}
+	}
+	std::sort(unused.begin(), unused.end(), chunk_older);
+
+	size_t count = min(chunk_list.size() - params.max_chunks, unused.size());
+	for(size_t i=0; i<count; i++) {
+		TerrainChunk *chunk = unused[i];
+		chunks.remove(chunk_key(chunk->level, chunk->x, chunk->z));
+		delete chunk->obj;
+		chunk->obj = 0;
+	}
+
+	size_t kept = 0;
+	for(size_t i=0; i<chunk_list.size(); i++) {
+		if(chunk_list[i]->obj) {
+			chunk_list[kept++] = chunk_list[i];
+		} else {
+			delete chunk_list[i];
+		}
+	}
+	chunk_list.resize(kept);
+}
+
+const HeightField *Terrain::get_heightfield() const {
+	return &hf;
+}
+
+const TerrainParams &Terrain::get_params() const {
+	return params;
+}
+
+void Terrain::set_material(const Material &mat) {
+	this->mat = mat;
+	for(size_t i=0; i<chunk_list.size(); i++) {
+		chunk_list[i]->obj->set_material(mat);
+	}
+}
+
+Material *Terrain::get_material_ptr() {
+	return &mat;
+}
+
+/* get_height
+ * interpolates the heights over the triangle of the full resolution
+ * surface under the point.
+ */
+scalar_t Terrain::get_height(scalar_t x, scalar_t z) const {
+	if(!levels) return 0.0;
+
+	scalar_t fx = (x + params.size.x / 2.0) / dx;
+	scalar_t fz = (z + params.size.y / 2.0) / dz;
+	fx = max(min(fx, (scalar_t)(hf.get_xsize() - 1)), (scalar_t)0.0);
+	fz = max(min(fz, (scalar_t)(hf.get_ysize() - 1)), (scalar_t)0.0);
+
+	int i = min((int)fx, hf.get_xsize() - 2);
+	int j = min((int)fz, hf.get_ysize() - 2);
+	fx -= i;
+	fz -= j;
+
+	scalar_t h00 = hf.get(i, j), h10 = hf.get(i + 1, j);
+	scalar_t h01 = hf.get(i, j + 1), h11 = hf.get(i + 1, j + 1);
+
+	if(fx > fz) {
+		return h00 + (h10 - h00) * fx + (h11 - h10) * fz;
+	}
+	return h00 + (h01 - h00) * fz + (h11 - h01) * fx;
+}
+
+Vector3 Terrain::get_normal(scalar_t x, scalar_t z) const {
+	if(!levels) return Vector3(0, 1, 0);
+
+	int i = (int)floor((x + params.size.x / 2.0) / dx + 0.5);
+	int j = (int)floor((z + params.size.y / 2.0) / dz + 0.5);
+	return hf.get_normal(i, j, dx, dz);
+}
+
+AABox Terrain::get_bounds() const {
+	if(!levels) return AABox();
+	return get_node_box(levels - 1, 0, 0);
+}
+
+/* select
+ * the missing chunks are built and the chunks in their morphing range are
+ * morphed on the worker threads. A chunk entirely before or after its
+ * morphing range is written only when it crosses over.
+ */
+void Terrain::select(const Vector3 &cam_pos, const FrustumPlane *frustum, std::vector<Object*> *objects) {
+	PROF_SCOPE("Terrain::select");
+	frame++;
+	selection.clear();
+	build_list.clear();
+	morph_list.clear();
+	stats.selected = stats.culled = stats.built = stats.morphed = 0;
+	stats.triangles = 0;
+	if(!levels) return;
+
+	this->cam_pos = cam_pos;
+	select_node(levels - 1, 0, 0, frustum, frustum ? FRUSTUM_ALL_PLANES : 0);
+
+	std::vector<scalar_t> range(levels);
+	for(int i=0; i<levels; i++) {
+		range[i] = get_range(i);
+	}
+
+	ChunkWork work;
+	work.hf = &hf;
+	work.chunk_size = params.chunk_size;
+	work.x0 = -params.size.x / 2.0;
+	work.z0 = -params.size.y / 2.0;
+	work.dx = dx;
+	work.dz = dz;
+	work.cam_pos = cam_pos;
+	work.range = &range[0];
+	work.morph_start = params.morph_start;
+
+	if(!build_list.empty()) {
+		work.chunks = &build_list[0];
+		thr_parallel_for((int)build_list.size(), build_chunk_work, &work);
+
+		for(size_t i=0; i<build_list.size(); i++) {
+			finish_chunk(build_list[i]);
+		}
+	}
+
+	for(size_t i=0; i<selection.size(); i++) {
+		TerrainChunk *chunk = selection[i];
+
+		// the root level has no parent to morph into
+		int state = MORPH_NONE;
+		if(chunk->level < levels - 1) {
+			scalar_t r = range[chunk->level];
+			if(box_dist(cam_pos, chunk->box) >= r) {
+				state = MORPH_FULL;
+			} else if(box_far_dist(cam_pos, chunk->box) > r * params.morph_start) {
+				state = MORPH_PARTIAL;
+			}
+		}
+
+		if(state != chunk->morph_state || state == MORPH_PARTIAL) {
+			chunk->morph_state = state;
+			// without bumping the mesh revision, the morphed surface is within the bounds
+			chunk->vdata = const_cast<VertexArray*>(chunk->obj->get_mesh().get_vertex_array())->get_mod_data();
+			morph_list.push_back(chunk);
+		}
+		objects->push_back(chunk->obj);
+	}
+
+	if(!morph_list.empty()) {
+		work.chunks = &morph_list[0];
+		thr_parallel_for((int)morph_list.size(), morph_chunk_work, &work);
+	}
+
+	stats.selected = (int)selection.size();
+	stats.built = (int)build_list.size();
+	stats.morphed = (int)morph_list.size();
+	stats.triangles = (unsigned long)selection.size() * params.chunk_size * params.chunk_size * 2;
+
+	evict_chunks();
+	stats.cached = (int)chunk_list.size();
+}
+
+const TerrainStats *Terrain::get_stats() const {
+	return &stats;
+}
@@ -0,0 +1,179 @@
+/*
+This file is part of the 3dengfx, realtime visualization system.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+3dengfx is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+3dengfx is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with 3dengfx; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* heightfield terrain with continuous level of detail
+ *
+ * The terrain is a quadtree over a heightfield. Every node is drawn as a
+ * chunk of the same grid (chunk_size quads on a side), the leaves at the
+ * full resolution of the heightfield and every level up at half the
+ * resolution of the one below. A node is split while the camera is within
+ * lod_distance times its size, so the detail follows the distance, and the
+ * nodes outside the view frustum are culled with their whole subtree.
+ *
+ * Towards the far end of its range (the last 1 - morph_start of it) each
+ * vertex of a chunk morphs into the surface of the parent level, by its own
+ * distance from the camera (geomorphing). Chunks switch levels only when
+ * they are fully morphed, so there is no popping, and the edges between
+ * chunks of different levels line up without any stitching.
+ *
+ * The chunk meshes are built on the worker threads as they are needed, and
+ * kept in a cache of max_chunks, dropping the least recently drawn ones.
+ * Their normals come from the heights around each vertex, at the spacing
+ * of its level. The chunks are Objects, drawn by the scene through the
+ * render queue with the material of the terrain (see Scene::add_terrain).
+ */
+
+#ifndef _TERRAIN_HPP_
+#define _TERRAIN_HPP_
+
+#include <vector>
+#include "gfx/3dgeom.hpp"
+#include "gfx/bvol.hpp"
+#include "material.hpp"
+#include "ggen.hpp"
+#include "common/hashtable.hpp"
+
+class Object;
+
+class HeightField {
+private:
+	int xsz, ysz;
+	std::vector<float> heights;
+
+public:
+	HeightField(int xsz = 0, int ysz = 0);
+
+	void resize(int xsz, int ysz);
+	void swap(HeightField &hf);
+
+	inline int get_xsize() const {return xsz;}
+	inline int get_ysize() const {return ysz;}
+	inline float *get_data() {return &heights[0];}
+	inline const float *get_data() const {return &heights[0];}
+
+	// out of range coordinates are clamped to the edges
+	inline float get(int x, int y) const {
+		x = x < 0 ? 0 : (x >= xsz ? xsz - 1 : x);
+		y = y < 0 ? 0 : (y >= ysz ? ysz - 1 : y);
+		return heights[y * xsz + x];
+	}
+	inline void set(int x, int y, float h) {heights[y * xsz + x] = h;}
+
+	void get_range(float *hmin, float *hmax) const;
+	// scales the heights to the range [0, max_height]
+	void normalize(scalar_t max_height);
+
+	/* the normal from the differences of the heights step samples around,
+	 * for samples xscale by yscale apart (yscale along the z axis).
+	 */
+	Vector3 get_normal(int x, int y, scalar_t xscale, scalar_t yscale, int step = 1) const;
+};
+
+/* fault formation, the algorithm of create_landscape (ggen.hpp): iter random
+ * lines across a size.x by size.y area, each raising the ground on one side
+ * of it, smoothly by roughness. Then the heights are normalized to
+ * [0, max_height]. The rows are generated in parallel, with the same result
+ * for any number of threads.
+ */
+void gen_fault_heightfield(HeightField *hf, int xsz, int ysz, const Vector2 &size, scalar_t max_height,
+		int iter, scalar_t roughness = 0.5, int seed = GGEN_NO_RESEED);
+
+// the brightness of an image as the heights, scaled to [0, max_height]
+bool load_heightfield(HeightField *hf, const char *fname, scalar_t max_height);
+
+struct TerrainParams {
+	Vector2 size;			// of the terrain in x and z, centered at the origin
+	int chunk_size;			// quads on a side of every chunk, a power of two
+	scalar_t lod_distance;	// split nodes closer than this many times their size
+	scalar_t morph_start;	// fraction of the range where morphing starts
+	int max_chunks;			// meshes kept in the chunk cache
+
+	TerrainParams();
+};
+
+struct TerrainStats {
+	int levels;
+	int selected;			// nodes drawn
+	int culled;				// nodes outside the frustum
+	int built;				// chunk meshes built this frame
+	int morphed;			// chunks with their vertices morphed this frame
+	int cached;
+	unsigned long triangles;
+};
+
+struct TerrainChunk;
+
+class Terrain {
+private:
+	HeightField hf;
+	TerrainParams params;
+	Material mat;
+
+	int levels, root_nodes;
+	scalar_t dx, dz;
+	std::vector<std::vector<float> > node_min, node_max;	// per level
+
+	TriMesh chunk_template;		// the shared triangles of all the chunks
+	HashTable<uint32_t, TerrainChunk*> chunks;
+	std::vector<TerrainChunk*> chunk_list;
+	unsigned long frame;
+
+	std::vector<TerrainChunk*> selection, build_list, morph_list;
+	Vector3 cam_pos;
+	TerrainStats stats;
+
+	void build_bounds();
+	void build_template();
+	AABox get_node_box(int level, int x, int z) const;
+	scalar_t get_range(int level) const;
+	void select_node(int level, int x, int z, const FrustumPlane *frustum, unsigned int plane_mask);
+	TerrainChunk *get_chunk(int level, int x, int z);
+	void finish_chunk(TerrainChunk *chunk);
+	void evict_chunks();
+
+public:
+	Terrain();
+	~Terrain();
+
+	// takes over the heights, leaving hf empty
+	void create(HeightField *hf, const TerrainParams &params = TerrainParams());
+	void clear();
+
+	const HeightField *get_heightfield() const;
+	const TerrainParams &get_params() const;
+
+	void set_material(const Material &mat);
+	Material *get_material_ptr();
+
+	// the height of the full resolution surface, for placing things on it
+	scalar_t get_height(scalar_t x, scalar_t z) const;
+	Vector3 get_normal(scalar_t x, scalar_t z) const;
+	AABox get_bounds() const;
+
+	/* picks the chunks to draw for a camera at cam_pos, builds and morphs them,
+	 * and appends their objects to the list. With a null frustum nothing is
+	 * culled.
+	 */
+	void select(const Vector3 &cam_pos, const FrustumPlane *frustum, std::vector<Object*> *objects);
+
+	const TerrainStats *get_stats() const;
+};
+
+#endif	// _TERRAIN_HPP_
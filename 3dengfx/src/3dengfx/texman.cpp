@@ -30,8 +30,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "gfx/image.h"
 #include "gfx/color.hpp"
 #include "n3dmath2/n3dmath2.hpp"
-#include "common/string_hash.hpp"
 #include "common/err_msg.h"
+#include "common/profile.h"
 
 using std::string;
 
@@ -47,7 +47,7 @@ static void delete_texture(Texture *tex) {
 static void init_tex_man() {
 	if(textures) return;
 	textures = new HashTable<string, Texture*>;
-	textures->set_hash_function(string_hash);
+	textures->enable_value_index();	// constant time add/remove checks by texture
 	textures->set_data_destructor(delete_texture);
 }
 
@@ -59,6 +59,12 @@ void add_texture(Texture *texture, const char *fname) {
 		error("trying to insert the same texture (%s) twice! ignoring.\n", fname ? fname : "unnamed");
 		return;
 	}
+
+	// a second texture under a taken name would replace the first, which would never be freed
+	if(fname && textures->find(fname)) {
+		warning("a texture named %s is already managed, adding this one unnamed", fname);
+		fname = 0;
+	}
 	
 	if(!fname) {	// enter a randomly named texture
 		textures->insert(tmpnam(0), texture);
@@ -67,8 +73,12 @@ void add_texture(Texture *texture, const char *fname) {
 	}
 }
 
-// TODO: implement this one, after making HashTable remove by value
+/* removes the texture from the texture manager, without deleting it.
+ * After this call, the caller is responsible for freeing the texture.
+ */
 void remove_texture(Texture *texture) {
+	if(!textures || !texture) return;
+	textures->remove_value(texture);
 }
 
 Texture *find_texture(const char *fname) {
@@ -92,6 +102,8 @@ Texture *get_texture(const char *fname) {
 	Texture *tex;
 	if((tex = find_texture(fname))) return tex;
 
+	PROF_SCOPE("get_texture (load)");
+
 	// first check to see if it's a custom file (cubemap).
 	if(is_cubemap(fname)) {
 		tex = load_cubemap(fname);
@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <string.h>
 #include "opengl.h"
 #include "textures.hpp"
+#include "3denginefx.hpp"
+#include "swrast.hpp"
 
 static void invert_image(Pixel *img, int x, int y) {
 	Pixel *s2 = img + (y - 1) * x;
@@ -83,9 +85,20 @@ Texture::Texture(int x, TextureDim type) {
 		
 Texture::~Texture() {
 	// TODO: check if it's destroyed between a lock/unlock and free image data
+	if(SoftRaster *swr = get_soft_context()) {
+		for(size_t i=0; i<frame_tex_id.size(); i++) {
+			swr->delete_texture(frame_tex_id[i]);
+		}
+	}
 }
 
 void Texture::add_frame() {
+	if(SoftRaster *swr = get_soft_context()) {
+		tex_id = swr->create_texture(type);
+		frame_tex_id.push_back(tex_id);
+		return;
+	}
+
 	glGenTextures(1, &tex_id);
 	glBindTexture(type, tex_id);
 	
@@ -131,6 +144,12 @@ unsigned int Texture::get_active_frame() const {
 
 void Texture::lock(CubeMapFace cube_map_face) {
 	buffer = new Pixel[width * height];
+
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->get_tex_image(tex_id, type == TEX_CUBE ? cube_map_face - CUBE_MAP_PX : 0, buffer);
+		invert_image(buffer, width, height);
+		return;
+	}
 	
 	glBindTexture(type, tex_id);
 	
@@ -144,10 +163,17 @@ void Texture::lock(CubeMapFace cube_map_face) {
 }
 
 void Texture::unlock(CubeMapFace cube_map_face) {
-	glBindTexture(type, tex_id);
-
 	invert_image(buffer, width, height);
 
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->tex_image(tex_id, type == TEX_CUBE ? cube_map_face - CUBE_MAP_PX : 0, width, height, buffer, false);
+		delete [] buffer;
+		buffer = 0;
+		return;
+	}
+
+	glBindTexture(type, tex_id);
+
 	switch(type) {
 	case TEX_1D:
 		glTexImage1D(type, 0, 4, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
@@ -177,13 +203,26 @@ void Texture::set_pixel_data(const PixelBuffer &pbuf, CubeMapFace cube_map_face)
 		
 	width = pbuf.width;
 	height = pbuf.height;
-	
-	glBindTexture(type, tex_id);
 
 	buffer = new Pixel[width * height];
 	memcpy(buffer, pbuf.buffer, width * height * sizeof(Pixel));
 	invert_image(buffer, width, height);
 
+	if(SoftRaster *swr = get_soft_context()) {
+		// in the same layout and channel order OpenGL gets them below
+		if(type == TEX_CUBE) {
+			invert_image(buffer, width, height);
+			swr->tex_image(tex_id, cube_map_face - CUBE_MAP_PX, width, height, buffer, false);
+		} else {
+			swr->tex_image(tex_id, 0, width, height, buffer, type == TEX_2D);
+		}
+		delete [] buffer;
+		buffer = 0;
+		return;
+	}
+
+	glBindTexture(type, tex_id);
+
 	switch(type) {
 	case TEX_1D:
 		glTexImage1D(type, 0, 4, width, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
@@ -206,6 +245,37 @@ void Texture::set_pixel_data(const PixelBuffer &pbuf, CubeMapFace cube_map_face)
 	buffer = 0;
 }
 
+/* set_pixel_rows
+ * The rest of a 2D texture keeps what was set before, anything else (or a
+ * different size) is set whole.
+ */
+void Texture::set_pixel_rows(const PixelBuffer &pbuf, int start, int end) {
+	if(!frame_tex_id.size() || type != TEX_2D || pbuf.width != width || pbuf.height != height) {
+		set_pixel_data(pbuf);
+		return;
+	}
+
+	if(start < 0) start = 0;
+	if(end > (int)height) end = height;
+	if(start >= end) return;
+
+	// inverted like set_pixel_data() does with the whole image
+	int rows = end - start;
+	Pixel *rbuf = new Pixel[width * rows];
+	for(int i=0; i<rows; i++) {
+		memcpy(rbuf + i * width, pbuf.buffer + (end - 1 - i) * width, width * sizeof(Pixel));
+	}
+
+	if(SoftRaster *swr = get_soft_context()) {
+		swr->tex_sub_image(tex_id, 0, 0, height - end, width, rows, rbuf, true);
+	} else {
+		glBindTexture(type, tex_id);
+		glTexSubImage2D(type, 0, 0, height - end, width, rows, GL_BGRA, GL_UNSIGNED_BYTE, rbuf);
+	}
+
+	delete [] rbuf;
+}
+
 TextureDim Texture::get_type() const {
 	return type;
 }
@@ -60,6 +60,8 @@ public:
 	void unlock(CubeMapFace cube_map_face = CUBE_MAP_PX);	// update system data & invalidate pointer
 	
 	void set_pixel_data(const PixelBuffer &pbuf, CubeMapFace cube_map_face = CUBE_MAP_PX);
+	// like set_pixel_data() but uploads only the rows start to end (exclusive) of pbuf
+	void set_pixel_rows(const PixelBuffer &pbuf, int start, int end);
 
 	TextureDim get_type() const;
 };
@@ -0,0 +1,272 @@
+/*
+Copyright 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small linear (bump) allocator, and the per-frame arenas built on
+it, for scratch memory which only has to live until the end of the frame.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "threads.h"
+#include "profile.h"
+
+#define ALIGN(x)			(((x) + 15) & ~(size_t)15)
+#define DEF_BLOCK_SIZE		(64 * 1024)
+
+/* worker ids past this share one locked arena */
+#define FRAME_MAX_THREADS	64
+
+struct block {
+	struct block *next;
+	size_t size, used;
+};
+
+#define BLOCK_HDR_SIZE		ALIGN(sizeof(struct block))
+
+struct arena {
+	struct block *blocks;	/* the one in use first */
+	size_t block_size;
+	size_t used;
+	unsigned long heap_allocs;
+
+	/* frame arena instrumentation */
+	unsigned long tag_bytes[FRAME_MEM_TAG_COUNT];
+};
+
+static struct block *new_block(arena *a, size_t size) {
+	struct block *blk;
+
+	if(!(blk = malloc(BLOCK_HDR_SIZE + size))) {
+		fprintf(stderr, "arena: failed to allocate %lu bytes\n", (unsigned long)size);
+		abort();
+	}
+	blk->size = size;
+	blk->used = 0;
+	blk->next = a->blocks;
+	a->blocks = blk;
+	a->heap_allocs++;
+	return blk;
+}
+
+arena *arena_create(size_t block_size) {
+	arena *a;
+
+	if(!(a = malloc(sizeof *a))) {
+		return 0;
+	}
+	memset(a, 0, sizeof *a);
+	a->block_size = block_size ? ALIGN(block_size) : DEF_BLOCK_SIZE;
+	return a;
+}
+
+void arena_destroy(arena *a) {
+	struct block *blk;
+
+	if(!a) return;
+
+	while(a->blocks) {
+		blk = a->blocks;
+		a->blocks = blk->next;
+		free(blk);
+	}
+	free(a);
+}
+
+void *arena_alloc(arena *a, size_t size) {
+	struct block *blk = a->blocks;
+	void *ptr;
+
+	size = ALIGN(size ? size : 1);
+
+	if(!blk || blk->size - blk->used < size) {
+		size_t bsize = a->block_size;
+		if(blk && blk->size > bsize) bsize = blk->size;	/* don't shrink */
+		while(bsize < size) bsize *= 2;
+		blk = new_block(a, bsize);
+	}
+
+	ptr = (char*)blk + BLOCK_HDR_SIZE + blk->used;
+	blk->used += size;
+	a->used += size;
+	return ptr;
+}
+
+/* arena_reset
+ * if the last round needed more than one block, they are merged into one
+ * big enough for everything, so that the next round fits in it.
+ */
+void arena_reset(arena *a) {
+	struct block *blk;
+	size_t total = 0;
+
+	if(a->blocks && a->blocks->next) {
+		while(a->blocks) {
+			blk = a->blocks;
+			a->blocks = blk->next;
+			total += blk->size;
+			free(blk);
+		}
+		new_block(a, total);
+	} else if(a->blocks) {
+		a->blocks->used = 0;
+	}
+	a->used = 0;
+}
+
+size_t arena_used(const arena *a) {
+	return a->used;
+}
+
+unsigned long arena_heap_allocs(const arena *a) {
+	return a->heap_allocs;
+}
+
+
+/* --- frame arenas --- */
+
+static arena *frame_arenas[FRAME_MAX_THREADS];
+
+/* worker ids past FRAME_MAX_THREADS share this one */
+static arena *shared_arena;
+static thr_mutex *shared_lock;
+
+static int stats_enabled;
+static unsigned long last_bytes[FRAME_MEM_TAG_COUNT];
+static unsigned long last_heap_allocs, heap_allocs_at_reset;
+
+static const char *tag_names[] = {
+	"misc",
+	"geometry",
+	"shadows",
+	"bump mapping"
+};
+
+static void init_shared(void) {
+	if(!shared_arena) {
+		shared_arena = arena_create(0);
+		shared_lock = thr_mutex_create();
+	}
+}
+
+/* frame_alloc
+ * worker i only ever touches frame_arenas[i], and the shared arena is set
+ * up by the main thread, on its first allocation or reset, before any
+ * parallel loop gets here.
+ */
+void *frame_alloc(size_t size, enum frame_mem_tag tag) {
+	int id = thr_worker_id();
+	arena *a;
+	void *ptr;
+
+	if(!id) init_shared();
+
+	PROF_COUNT(PROF_ALLOCS, 1);
+
+	if(id < FRAME_MAX_THREADS) {
+		if(!(a = frame_arenas[id])) {
+			if(!(a = frame_arenas[id] = arena_create(0))) {
+				fprintf(stderr, "frame_alloc: failed to create the frame arena\n");
+				abort();
+			}
+		}
+		if(stats_enabled) a->tag_bytes[tag] += size;
+		return arena_alloc(a, size);
+	}
+
+	thr_mutex_lock(shared_lock);
+	if(stats_enabled) shared_arena->tag_bytes[tag] += size;
+	ptr = arena_alloc(shared_arena, size);
+	thr_mutex_unlock(shared_lock);
+	return ptr;
+}
+
+static unsigned long total_heap_allocs(void) {
+	int i;
+	unsigned long count = shared_arena ? arena_heap_allocs(shared_arena) : 0;
+
+	for(i=0; i<FRAME_MAX_THREADS; i++) {
+		if(frame_arenas[i]) {
+			count += arena_heap_allocs(frame_arenas[i]);
+		}
+	}
+	return count;
+}
+
+static void reset_frame_arena(arena *a) {
+	int i;
+
+	for(i=0; i<FRAME_MEM_TAG_COUNT; i++) {
+		last_bytes[i] += a->tag_bytes[i];
+		a->tag_bytes[i] = 0;
+	}
+	arena_reset(a);
+}
+
+void frame_reset(void) {
+	int i;
+	unsigned long heap_allocs;
+
+	init_shared();
+
+	memset(last_bytes, 0, sizeof last_bytes);
+
+	heap_allocs = total_heap_allocs();
+	last_heap_allocs = heap_allocs - heap_allocs_at_reset;
+
+	for(i=0; i<FRAME_MAX_THREADS; i++) {
+		if(frame_arenas[i]) {
+			reset_frame_arena(frame_arenas[i]);
+		}
+	}
+	reset_frame_arena(shared_arena);
+
+	/* merging blocks in the reset counts towards the next frame */
+	heap_allocs_at_reset = heap_allocs;
+}
+
+void frame_mem_set_stats(int enable) {
+	stats_enabled = enable;
+}
+
+unsigned long frame_mem_bytes(enum frame_mem_tag tag) {
+	return last_bytes[tag];
+}
+
+unsigned long frame_mem_heap_allocs(void) {
+	return last_heap_allocs;
+}
+
+const char *frame_mem_tag_name(enum frame_mem_tag tag) {
+	return tag_names[tag];
+}
+
+void frame_mem_cleanup(void) {
+	int i;
+
+	for(i=0; i<FRAME_MAX_THREADS; i++) {
+		arena_destroy(frame_arenas[i]);
+		frame_arenas[i] = 0;
+	}
+	arena_destroy(shared_arena);
+	shared_arena = 0;
+	if(shared_lock) {
+		thr_mutex_destroy(shared_lock);
+		shared_lock = 0;
+	}
+}
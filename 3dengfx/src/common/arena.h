@@ -0,0 +1,93 @@
+/*
+Copyright 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small linear (bump) allocator, and the per-frame arenas built on
+it, for scratch memory which only has to live until the end of the frame.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdlib.h>
+
+/* An arena hands out memory by bumping a pointer through large blocks, and
+ * frees it all at once with arena_reset. When a reset finds that more than
+ * one block was needed, they are replaced by a single block big enough for
+ * all of it, so an arena used for the same work over and over stops
+ * touching the heap after the first couple of rounds.
+ */
+typedef struct arena arena;
+
+/* the frame arena subsystems, for the instrumentation */
+enum frame_mem_tag {
+	FRAME_MEM_MISC,
+	FRAME_MEM_GEOMETRY,		/* transient geometry arrays */
+	FRAME_MEM_SHADOWS,
+	FRAME_MEM_BUMP,			/* bump mapping tangents */
+
+	FRAME_MEM_TAG_COUNT
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* block_size 0 picks a default */
+arena *arena_create(size_t block_size);
+void arena_destroy(arena *a);
+
+/* returns memory aligned to 16 bytes, never fails (aborts if out of memory) */
+void *arena_alloc(arena *a, size_t size);
+void arena_reset(arena *a);
+
+/* bytes handed out since the last reset */
+size_t arena_used(const arena *a);
+/* blocks taken from the heap, ever */
+unsigned long arena_heap_allocs(const arena *a);
+
+/* --- frame arenas ---
+ * Every thread of the pool (see threads.h) gets its own frame arena, so
+ * frame_alloc needs no locking when called from parallel loops. Anything
+ * allocated with it is freed by the next frame_reset, which is called at
+ * the end of Scene::render and by flip(), so it must not be kept around.
+ * Threads outside the pool count as the main thread, and must not allocate
+ * while it does.
+ */
+void *frame_alloc(size_t size, enum frame_mem_tag tag);
+
+/* frees everything allocated from the frame arenas, must not be called
+ * while a parallel loop is running.
+ */
+void frame_reset(void);
+
+/* the instrumentation mode keeps the number of bytes allocated by every
+ * subsystem during a frame, which can be queried after the next reset.
+ */
+void frame_mem_set_stats(int enable);
+unsigned long frame_mem_bytes(enum frame_mem_tag tag);
+/* blocks taken from the heap by the frame arenas during the last frame */
+unsigned long frame_mem_heap_allocs(void);
+const char *frame_mem_tag_name(enum frame_mem_tag tag);
+
+/* frees the frame arenas, they will be recreated on demand */
+void frame_mem_cleanup(void);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _ARENA_H_ */
@@ -1,7 +1,7 @@
 /*
 Copyright (c) 2004, 2005 John Tsiombikas <nuclear@siggraph.org>
 
-This is a hash table implementation with chaining collision resolution.
+This is a hash table implementation with open addressing (robin hood hashing).
 
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
@@ -18,48 +18,418 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
-/* Hash table with chaining.
- * 
+/* Hash table with open addressing.
+ *
  * Author: John Tsiombikas 2004
+ *
+ * Collisions are resolved with robin hood hashing, and the table grows
+ * automatically. Slots are kept in two parallel arrays: a small metadata array (full hash
+ * and probe distance) which is all that's touched while probing, and the
+ * key/value pairs themselves. Deletion uses backward shifting, so there are
+ * no tombstones and lookups never degrade after many removals.
+ *
+ * NOTE: insert() and remove() may move entries around, so any Pair pointer
+ * returned by find() is only valid until the next modification of the table.
+ *
+ * NOTE: keys are unique. Inserting an existing key replaces its value, where
+ * the old chained table kept both and find() returned the first one. Tables
+ * owning their values should check with find() before inserting.
  */
 
-// TODO: create a decent hash table and get rid of this mess.
-
 #ifndef _HASHTABLE_HPP_
 #define _HASHTABLE_HPP_
 
-#include <iostream>
-#include <list>
-#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "common/types.h"
+#include "common/string_hash.hpp"
 
-template <class KeyT, class ValT> 
+template <class KeyT, class ValT>
 struct Pair {
-	KeyT key; 
+	KeyT key;
 	ValT val;
 };
 
+/* --- hash traits ---
+ * HashTraits<T>::hash() must return a full 32bit hash of the key, the table
+ * takes care of reducing it to a slot index. Specializations may provide
+ * extra overloads of hash() for compatible lookup types, which allows finding
+ * keys without constructing a temporary KeyType (see the std::string case).
+ * The default hashes the bytes of the key, which is only right for keys
+ * without padding; struct keys get a specialization hashing their fields.
+ */
+inline uint32_t int_hash(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+template <class T>
+struct HashTraits {
+	static uint32_t hash(const T &key) {
+		return mem_hash(&key, sizeof key);
+	}
+};
+
+template <class T>
+struct HashTraits<T*> {
+	static uint32_t hash(const T *key) {
+		size_t addr = (size_t)key;
+		return int_hash((uint32_t)addr ^ (uint32_t)((addr >> 16) >> 16));
+	}
+};
+
+template <>
+struct HashTraits<std::string> {
+	static uint32_t hash(const std::string &key) {
+		return string_hash(key.data(), key.length());
+	}
+	static uint32_t hash(const char *key) {
+		return string_hash(key);
+	}
+};
+
+template <>
+struct HashTraits<int> {
+	static uint32_t hash(int key) {return int_hash((uint32_t)key);}
+};
+
+template <>
+struct HashTraits<unsigned int> {
+	static uint32_t hash(unsigned int key) {return int_hash((uint32_t)key);}
+};
+
+
+/* --- OpenHashTable ---
+ * The bare open addressing table, used by HashTable both for the primary
+ * key -> value mapping and for the optional value -> key index.
+ */
+struct HashSlot {
+	uint32_t hash;
+	uint32_t dist;		// probe distance + 1, 0 means the slot is empty
+};
+
+template <class KeyType, class ValType>
+class OpenHashTable {
+private:
+	Pair<KeyType, ValType> *pairs;
+	HashSlot *slots;
+	unsigned long capacity, mask;
+	unsigned long count, max_count;
+
+	void alloc(unsigned long cap);
+	void grow();
+	void place(uint32_t hash, Pair<KeyType, ValType> &pair);
+
+public:
+	OpenHashTable(unsigned long size_hint = 16);
+	~OpenHashTable();
+
+	template <class LookupType>
+	long find_slot(uint32_t hash, const LookupType &key) const {
+		unsigned long idx = hash & mask;
+		uint32_t dist = 1;
+
+		for(;;) {
+			const HashSlot *slot = slots + idx;
+			if(slot->dist < dist) return -1;	// empty, or we'd have displaced it
+			if(slot->hash == hash && pairs[idx].key == key) return (long)idx;
+			idx = (idx + 1) & mask;
+			dist++;
+		}
+	}
+
+	Pair<KeyType, ValType> *insert(uint32_t hash, const KeyType &key, const ValType &val);
+	void remove_slot(unsigned long idx);
+	void clear();
+
+	inline unsigned long get_count() const {return count;}
+	inline unsigned long get_capacity() const {return capacity;}
+	inline bool slot_used(unsigned long idx) const {return slots[idx].dist != 0;}
+	inline Pair<KeyType, ValType> *get_pair(unsigned long idx) {return pairs + idx;}
+	inline const Pair<KeyType, ValType> *get_pair(unsigned long idx) const {return pairs + idx;}
+};
+
+template <class KeyType, class ValType>
+OpenHashTable<KeyType, ValType>::OpenHashTable(unsigned long size_hint) {
+	unsigned long cap = 8;
+	while(cap - cap / 8 < size_hint) cap <<= 1;
+	alloc(cap);
+}
+
+template <class KeyType, class ValType>
+OpenHashTable<KeyType, ValType>::~OpenHashTable() {
+	delete [] pairs;
+	delete [] slots;
+}
+
+template <class KeyType, class ValType>
+void OpenHashTable<KeyType, ValType>::alloc(unsigned long cap) {
+	capacity = cap;
+	mask = cap - 1;
+	max_count = cap - cap / 8;		// max load factor 7/8
+	count = 0;
+
+	pairs = new Pair<KeyType, ValType>[cap];
+	slots = new HashSlot[cap];
+	memset(slots, 0, cap * sizeof *slots);
+}
+
+template <class KeyType, class ValType>
+void OpenHashTable<KeyType, ValType>::grow() {
+	Pair<KeyType, ValType> *old_pairs = pairs;
+	HashSlot *old_slots = slots;
+	unsigned long old_cap = capacity;
+
+	alloc(capacity * 2);
+
+	// the full hashes are kept in the metadata, so nothing is rehashed
+	for(unsigned long i=0; i<old_cap; i++) {
+		if(old_slots[i].dist) {
+			place(old_slots[i].hash, old_pairs[i]);
+		}
+	}
+
+	delete [] old_pairs;
+	delete [] old_slots;
+}
+
+/* robin hood insertion: walk the probe sequence and swap the carried entry
+ * with any resident that is closer to its home slot than we are.
+ * The contents of pair are consumed (swapped into the table).
+ */
+template <class KeyType, class ValType>
+void OpenHashTable<KeyType, ValType>::place(uint32_t hash, Pair<KeyType, ValType> &pair) {
+	unsigned long idx = hash & mask;
+	uint32_t dist = 1;
+
+	for(;;) {
+		HashSlot *slot = slots + idx;
+
+		if(!slot->dist) {
+			slot->hash = hash;
+			slot->dist = dist;
+			std::swap(pairs[idx].key, pair.key);
+			std::swap(pairs[idx].val, pair.val);
+			count++;
+			return;
+		}
+
+		if(slot->dist < dist) {
+			std::swap(slot->hash, hash);
+			std::swap(slot->dist, dist);
+			std::swap(pairs[idx].key, pair.key);
+			std::swap(pairs[idx].val, pair.val);
+		}
+
+		idx = (idx + 1) & mask;
+		dist++;
+	}
+}
+
+template <class KeyType, class ValType>
+Pair<KeyType, ValType> *OpenHashTable<KeyType, ValType>::insert(uint32_t hash, const KeyType &key, const ValType &val) {
+	if(count + 1 > max_count) grow();
+
+	Pair<KeyType, ValType> pair;
+	pair.key = key;
+	pair.val = val;
+	place(hash, pair);
+
+	return pairs + find_slot(hash, key);
+}
+
+// backward shift deletion
+template <class KeyType, class ValType>
+void OpenHashTable<KeyType, ValType>::remove_slot(unsigned long idx) {
+	unsigned long next = (idx + 1) & mask;
+
+	while(slots[next].dist > 1) {
+		slots[idx].hash = slots[next].hash;
+		slots[idx].dist = slots[next].dist - 1;
+		std::swap(pairs[idx].key, pairs[next].key);
+		std::swap(pairs[idx].val, pairs[next].val);
+
+		idx = next;
+		next = (next + 1) & mask;
+	}
+
+	slots[idx].dist = 0;
+	pairs[idx] = Pair<KeyType, ValType>();		// release whatever the key/value hold
+	count--;
+}
+
+template <class KeyType, class ValType>
+void OpenHashTable<KeyType, ValType>::clear() {
+	for(unsigned long i=0; i<capacity; i++) {
+		if(slots[i].dist) {
+			slots[i].dist = 0;
+			pairs[i] = Pair<KeyType, ValType>();
+		}
+	}
+	count = 0;
+}
+
+
+/* --- value index ---
+ * Maps values back to the (first inserted) key holding them, so that
+ * searching or removing by value doesn't have to scan the whole table.
+ * It's only instantiated if enable_value_index() is called, thus the value
+ * type doesn't need to be hashable or comparable otherwise.
+ */
+template <class KeyType>
+struct HashValueRef {
+	KeyType key;
+	unsigned long count;	// number of keys mapping to this value
+};
+
+template <class KeyType, class ValType>
+class HashValueIndex {
+public:
+	virtual ~HashValueIndex() {}
+
+	virtual void add(const KeyType &key, const ValType &val) = 0;
+	virtual void remove(const KeyType &key, const ValType &val, const OpenHashTable<KeyType, ValType> &primary) = 0;
+	virtual const KeyType *find(const ValType &val) const = 0;
+	virtual void clear() = 0;
+};
+
+template <class KeyType, class ValType>
+class HashValueIndexImpl : public HashValueIndex<KeyType, ValType> {
+private:
+	OpenHashTable<ValType, HashValueRef<KeyType> > table;
+
+public:
+	HashValueIndexImpl(const OpenHashTable<KeyType, ValType> &primary);
+
+	virtual void add(const KeyType &key, const ValType &val);
+	virtual void remove(const KeyType &key, const ValType &val, const OpenHashTable<KeyType, ValType> &primary);
+	virtual const KeyType *find(const ValType &val) const;
+	virtual void clear();
+};
+
+template <class KeyType, class ValType>
+HashValueIndexImpl<KeyType, ValType>::HashValueIndexImpl(const OpenHashTable<KeyType, ValType> &primary)
+	: table(primary.get_count()) {
+	for(unsigned long i=0; i<primary.get_capacity(); i++) {
+		if(primary.slot_used(i)) {
+			add(primary.get_pair(i)->key, primary.get_pair(i)->val);
+		}
+	}
+}
+
+template <class KeyType, class ValType>
+void HashValueIndexImpl<KeyType, ValType>::add(const KeyType &key, const ValType &val) {
+	uint32_t hash = HashTraits<ValType>::hash(val);
+	long idx = table.find_slot(hash, val);
+
+	if(idx != -1) {
+		table.get_pair(idx)->val.count++;
+	} else {
+		HashValueRef<KeyType> ref;
+		ref.key = key;
+		ref.count = 1;
+		table.insert(hash, val, ref);
+	}
+}
+
+/* called after the key has been removed from the primary table. If the
+ * removed key was the one we point to, and there are other keys with the
+ * same value, we need to find another one (the only case that scans).
+ */
+template <class KeyType, class ValType>
+void HashValueIndexImpl<KeyType, ValType>::remove(const KeyType &key, const ValType &val, const OpenHashTable<KeyType, ValType> &primary) {
+	long idx = table.find_slot(HashTraits<ValType>::hash(val), val);
+	if(idx == -1) return;
+
+	HashValueRef<KeyType> *ref = &table.get_pair(idx)->val;
+	if(--ref->count == 0) {
+		table.remove_slot(idx);
+		return;
+	}
+
+	if(ref->key == key) {
+		for(unsigned long i=0; i<primary.get_capacity(); i++) {
+			if(primary.slot_used(i) && primary.get_pair(i)->val == val) {
+				ref->key = primary.get_pair(i)->key;
+				break;
+			}
+		}
+	}
+}
+
+template <class KeyType, class ValType>
+const KeyType *HashValueIndexImpl<KeyType, ValType>::find(const ValType &val) const {
+	long idx = table.find_slot(HashTraits<ValType>::hash(val), val);
+	return idx == -1 ? 0 : &table.get_pair(idx)->val.key;
+}
+
+template <class KeyType, class ValType>
+void HashValueIndexImpl<KeyType, ValType>::clear() {
+	table.clear();
+}
+
+
+/* --- HashTable ---
+ * the hash table used throughout the engine.
+ */
 template <class KeyType, class ValType>
 class HashTable {
 private:
-	size_t size;
-	std::vector<std::list<Pair<KeyType, ValType> > > table;
+	OpenHashTable<KeyType, ValType> table;
+	HashValueIndex<KeyType, ValType> *vindex;
 
 	unsigned int (*hash_func)(const KeyType &key, unsigned long size);
-	unsigned int hash(const KeyType &key) {return (unsigned int)hash_func(key, (unsigned long)size);}
+
+	inline uint32_t hash(const KeyType &key) const;
+	template <class LookupType>
+	inline uint32_t hash_lookup(const LookupType &key) const;
 
 	void (*data_destructor)(ValType);
+
+	HashTable(const HashTable &ht);				// non-copyable
+	HashTable &operator =(const HashTable &ht);
+
 public:
 
 	HashTable(unsigned long size = 101);
 	~HashTable();
 
+	/* Sets a custom hash function, the function is called with ~0 as the size,
+	 * and should return a full range hash value. By default HashTraits are used.
+	 */
 	void set_hash_function(unsigned int (*hash_func)(const KeyType&, unsigned long));
 
-	void insert(KeyType key, ValType value);
-	void remove(KeyType key);
+	/* Enables a secondary value -> key index, making find_first_val() and
+	 * remove_value() constant time. ValType must be hashable (see HashTraits)
+	 * and comparable with ==.
+	 */
+	void enable_value_index(bool enable = true);
+
+	// inserts the pair, replacing (not freeing) the value if the key already exists
+	void insert(const KeyType &key, const ValType &value);
+	void remove(const KeyType &key);
+	bool remove_value(const ValType &val);
+	void clear();
+
+	Pair<KeyType, ValType> *find(const KeyType &key);
+
+	/* heterogeneous lookup, e.g. find a std::string key with a const char*,
+	 * without constructing a temporary KeyType.
+	 */
+	template <class LookupType>
+	Pair<KeyType, ValType> *find(const LookupType &key) {
+		long idx = table.find_slot(hash_lookup(key), key);
+		return idx == -1 ? 0 : table.get_pair(idx);
+	}
 
-	Pair<KeyType, ValType> *find(KeyType key);
-	Pair<KeyType, ValType> *find_first_val(ValType val);
+	Pair<KeyType, ValType> *find_first_val(const ValType &val);
+
+	unsigned long get_count() const;
 
 	void set_data_destructor(void (*destructor)(ValType));
 };
@@ -67,86 +437,133 @@ public:
 
 // hash table member functions
 template <class KeyType, class ValType>
-HashTable<KeyType, ValType>::HashTable(unsigned long size) {
-	this->size = size;
-	table.resize(size);
+HashTable<KeyType, ValType>::HashTable(unsigned long size) : table(size) {
+	vindex = 0;
+	hash_func = 0;
 	data_destructor = 0;
 }
 
 template <class KeyType, class ValType>
 HashTable<KeyType, ValType>::~HashTable() {
-	for(unsigned long i=0; i<size; i++) {
-		if(data_destructor) {
-			typename std::list<Pair<KeyType, ValType> >::iterator iter = table[i].begin();
-			while(iter != table[i].end()) {
-				data_destructor((iter++)->val);
+	if(data_destructor) {
+		for(unsigned long i=0; i<table.get_capacity(); i++) {
+			if(table.slot_used(i)) {
+				data_destructor(table.get_pair(i)->val);
 			}
 		}
-			
-		table[i].clear();
 	}
+	delete vindex;
+}
+
+template <class KeyType, class ValType>
+inline uint32_t HashTable<KeyType, ValType>::hash(const KeyType &key) const {
+	return hash_func ? (uint32_t)hash_func(key, ~0UL) : HashTraits<KeyType>::hash(key);
+}
+
+template <class KeyType, class ValType>
+template <class LookupType>
+inline uint32_t HashTable<KeyType, ValType>::hash_lookup(const LookupType &key) const {
+	return hash_func ? (uint32_t)hash_func(KeyType(key), ~0UL) : HashTraits<KeyType>::hash(key);
 }
 
 template <class KeyType, class ValType>
 void HashTable<KeyType, ValType>::set_hash_function(unsigned int (*hash_func)(const KeyType&, unsigned long)) {
+	if(table.get_count()) return;	// can't change the hash function of a populated table
 	this->hash_func = hash_func;
 }
 
 template <class KeyType, class ValType>
-void HashTable<KeyType, ValType>::insert(KeyType key, ValType value) {
-	Pair<KeyType, ValType> newpair;
-	newpair.key = key;
-	newpair.val = value;
-
-	table[hash(key)].push_back(newpair);
+void HashTable<KeyType, ValType>::enable_value_index(bool enable) {
+	if(enable && !vindex) {
+		vindex = new HashValueIndexImpl<KeyType, ValType>(table);
+	}
+	if(!enable) {
+		delete vindex;
+		vindex = 0;
+	}
 }
 
 template <class KeyType, class ValType>
-void HashTable<KeyType, ValType>::remove(KeyType key) {
+void HashTable<KeyType, ValType>::insert(const KeyType &key, const ValType &value) {
+	uint32_t h = hash(key);
+	long idx = table.find_slot(h, key);
+
+	if(idx != -1) {
+		Pair<KeyType, ValType> *pair = table.get_pair(idx);
+		if(vindex) {
+			ValType old_val = pair->val;
+			pair->val = value;
+			vindex->remove(key, old_val, table);
+			vindex->add(key, value);
+		} else {
+			pair->val = value;
+		}
+		return;
+	}
 
-	unsigned int pos = hash(key);
+	table.insert(h, key, value);
+	if(vindex) vindex->add(key, value);
+}
 
-	typename std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
-	
-	while(iter != table[pos].end()) {
-		if(iter->key == key) {
-			table[pos].erase(iter);
-			return;
-		}
-		iter++;
+template <class KeyType, class ValType>
+void HashTable<KeyType, ValType>::remove(const KeyType &key) {
+	long idx = table.find_slot(hash(key), key);
+	if(idx == -1) return;
+
+	if(vindex) {
+		ValType val = table.get_pair(idx)->val;
+		table.remove_slot(idx);
+		vindex->remove(key, val, table);
+	} else {
+		table.remove_slot(idx);
 	}
 }
 
+/* removes the first key found mapping to val, returns false if
+ * there wasn't any.
+ */
 template <class KeyType, class ValType>
-Pair<KeyType, ValType> *HashTable<KeyType, ValType>::find(KeyType key) {
+bool HashTable<KeyType, ValType>::remove_value(const ValType &val) {
+	Pair<KeyType, ValType> *pair = find_first_val(val);
+	if(!pair) return false;
 
-	unsigned int pos = hash(key);
+	KeyType key = pair->key;
+	remove(key);
+	return true;
+}
 
-	typename std::list<Pair<KeyType, ValType> >::iterator iter = table[pos].begin();
-	while(iter != table[pos].end()) {
-		if(iter->key == key) {
-			return &(*iter);
-		}
-		iter++;
-	}
+template <class KeyType, class ValType>
+void HashTable<KeyType, ValType>::clear() {
+	table.clear();
+	if(vindex) vindex->clear();
+}
 
-	return 0;
+template <class KeyType, class ValType>
+Pair<KeyType, ValType> *HashTable<KeyType, ValType>::find(const KeyType &key) {
+	long idx = table.find_slot(hash(key), key);
+	return idx == -1 ? 0 : table.get_pair(idx);
 }
 
 template <class KeyType, class ValType>
-Pair<KeyType, ValType> *HashTable<KeyType, ValType>::find_first_val(ValType val) {
-	for(size_t i=0; i<table.size(); i++) {
-		typename std::list<Pair<KeyType, ValType> >::iterator iter = table[i].begin();
-		while(iter != table[i].end()) {
-			if(iter->val == val) {
-				return &(*iter);
-			}
-			iter++;
+Pair<KeyType, ValType> *HashTable<KeyType, ValType>::find_first_val(const ValType &val) {
+	if(vindex) {
+		const KeyType *key = vindex->find(val);
+		return key ? find(*key) : 0;
+	}
+
+	for(unsigned long i=0; i<table.get_capacity(); i++) {
+		if(table.slot_used(i) && table.get_pair(i)->val == val) {
+			return table.get_pair(i);
 		}
 	}
 	return 0;
 }
 
+template <class KeyType, class ValType>
+unsigned long HashTable<KeyType, ValType>::get_count() const {
+	return table.get_count();
+}
+
 template <class KeyType, class ValType>
 void HashTable<KeyType, ValType>::set_data_destructor(void (*destructor)(ValType)) {
 	data_destructor = destructor;
@@ -0,0 +1,501 @@
+/*
+Copyright 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small hierarchical CPU profiler, recording timed scopes and
+per-frame counters from any number of threads, for the Chrome trace viewer
+or a compact binary log.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#define _XOPEN_SOURCE	500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "3dengfx_config.h"
+#include "profile.h"
+#include "byteorder.h"
+
+#if !defined(NO_THREADS) && (defined(__unix__) || defined(unix))
+#define USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(unix)
+#include <sys/time.h>
+#else
+#include <windows.h>
+#endif	/* unix */
+
+#define RING_MASK		(PROF_RING_SIZE - 1)
+#define MAX_NAME_LEN	48
+#define LOG_VERSION		1
+
+/* the scope must be in the ring before the head moves past it */
+#ifdef __GNUC__
+#define WRITE_BARRIER()	__sync_synchronize()
+#else
+#define WRITE_BARRIER()
+#endif
+
+struct scope {
+	const char *name;
+	unsigned long start, dur;
+	int depth;
+};
+
+struct prof_thread {
+	int id;
+	char name[MAX_NAME_LEN];
+	int named, dead;
+
+	/* written by the owner thread only, ring[head & RING_MASK] is next */
+	struct scope *ring;
+	volatile unsigned long head;
+
+	const char *stack_name[PROF_MAX_DEPTH];
+	unsigned long stack_start[PROF_MAX_DEPTH];
+	int depth;
+
+	/* running totals, the frame counters are the difference from the
+	 * totals seen by the previous prof_frame, so nothing is ever reset
+	 * under the feet of the thread counting.
+	 */
+	volatile unsigned long counters[PROF_COUNTER_COUNT];
+	unsigned long counters_seen[PROF_COUNTER_COUNT];
+
+	struct prof_thread *next;
+};
+
+static struct prof_thread *threads;		/* newest first */
+static int num_threads;
+static int enabled = 1;
+
+#ifdef USE_PTHREADS
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+#define LOCK()		pthread_mutex_lock(&threads_lock)
+#define UNLOCK()	pthread_mutex_unlock(&threads_lock)
+#else
+static struct prof_thread *the_thread;
+
+#define LOCK()
+#define UNLOCK()
+#endif	/* USE_PTHREADS */
+
+static prof_frame_stats frames[PROF_FRAME_HISTORY];
+static unsigned long frame_count, first_frame;	/* frames ended ever, and at the last reset */
+static unsigned long frame_start;
+static int frame_thread = -1;
+
+static unsigned long reset_usec;
+
+static const char *counter_names[] = {
+	"draw calls",
+	"state changes",
+	"culled objects",
+	"allocations"
+};
+
+#if defined(__unix__) || defined(unix)
+static struct timeval first_tv;
+#else
+static LARGE_INTEGER first_count, count_freq;
+#endif	/* unix */
+static int time_started;
+
+static void start_time(void) {
+#if defined(__unix__) || defined(unix)
+	gettimeofday(&first_tv, 0);
+#else
+	QueryPerformanceFrequency(&count_freq);
+	QueryPerformanceCounter(&first_count);
+#endif	/* unix */
+	time_started = 1;
+}
+
+unsigned long prof_usec(void) {
+#if defined(__unix__) || defined(unix)
+	struct timeval tv;
+
+	if(!time_started) start_time();
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec - first_tv.tv_sec) * 1000000 + (tv.tv_usec - first_tv.tv_usec);
+#else
+	LARGE_INTEGER count;
+
+	if(!time_started) start_time();
+	QueryPerformanceCounter(&count);
+	return (unsigned long)((double)(count.QuadPart - first_count.QuadPart) * 1000000.0 / (double)count_freq.QuadPart);
+#endif	/* unix */
+}
+
+/* called with the lock held, the buffers of threads which have exited are
+ * reused, so that the threads of each FrameWriter don't pile up new ones.
+ */
+static struct prof_thread *new_thread(void) {
+	struct prof_thread *pt;
+
+	if(!time_started) start_time();
+
+	for(pt = threads; pt; pt = pt->next) {
+		if(pt->dead) break;
+	}
+
+	if(!pt) {
+		if(!(pt = malloc(sizeof *pt)) || !(pt->ring = malloc(PROF_RING_SIZE * sizeof *pt->ring))) {
+			fprintf(stderr, "profiler: failed to allocate the buffers of a thread\n");
+			abort();
+		}
+		memset(pt->counters_seen, 0, sizeof pt->counters_seen);
+		memset((void*)pt->counters, 0, sizeof pt->counters);
+		pt->head = 0;
+		pt->id = num_threads++;
+		pt->next = threads;
+		threads = pt;
+	}
+
+	sprintf(pt->name, "thread %d", pt->id);
+	pt->named = pt->dead = 0;
+	pt->depth = 0;
+	return pt;
+}
+
+#ifdef USE_PTHREADS
+static void thread_exit(void *data) {
+	struct prof_thread *pt = data;
+
+	LOCK();
+	pt->dead = 1;
+	UNLOCK();
+}
+
+static void make_key(void) {
+	pthread_key_create(&thread_key, thread_exit);
+}
+#endif	/* USE_PTHREADS */
+
+static struct prof_thread *get_thread(void) {
+	struct prof_thread *pt;
+
+#ifdef USE_PTHREADS
+	pthread_once(&key_once, make_key);
+	if((pt = pthread_getspecific(thread_key))) {
+		return pt;
+	}
+
+	LOCK();
+	pt = new_thread();
+	UNLOCK();
+	pthread_setspecific(thread_key, pt);
+#else
+	if(!the_thread) the_thread = new_thread();
+	pt = the_thread;
+#endif	/* USE_PTHREADS */
+	return pt;
+}
+
+void prof_enable(int enable) {
+	enabled = enable;
+}
+
+int prof_enabled(void) {
+	return enabled;
+}
+
+void prof_begin(const char *name) {
+	struct prof_thread *pt;
+
+	if(!enabled) return;
+
+	pt = get_thread();
+	if(pt->depth < PROF_MAX_DEPTH) {
+		pt->stack_name[pt->depth] = name;
+		pt->stack_start[pt->depth] = prof_usec();
+	}
+	pt->depth++;	/* deeper scopes are counted, but not recorded */
+}
+
+void prof_end(void) {
+	struct prof_thread *pt = get_thread();
+	struct scope *s;
+
+	/* the profiler may have been enabled in the middle of the scope */
+	if(pt->depth <= 0) return;
+
+	if(--pt->depth >= PROF_MAX_DEPTH || !enabled) return;
+
+	s = pt->ring + (pt->head & RING_MASK);
+	s->name = pt->stack_name[pt->depth];
+	s->start = pt->stack_start[pt->depth];
+	s->dur = prof_usec() - s->start;
+	s->depth = pt->depth;
+
+	WRITE_BARRIER();
+	pt->head++;
+}
+
+void prof_count(enum prof_counter ctr, unsigned long n) {
+	get_thread()->counters[ctr] += n;
+}
+
+void prof_set_thread_name(const char *name) {
+	struct prof_thread *pt = get_thread();
+
+	strncpy(pt->name, name, MAX_NAME_LEN - 1);
+	pt->name[MAX_NAME_LEN - 1] = 0;
+	pt->named = 1;
+}
+
+/* prof_frame
+ * the counters of the other threads are read without synchronization, a
+ * count which comes in while they are summed goes to the next frame.
+ */
+void prof_frame(void) {
+	struct prof_thread *pt = get_thread();
+	prof_frame_stats *fs;
+	unsigned long now = prof_usec();
+	int i;
+
+	if(!pt->named) {
+		prof_set_thread_name("main");
+	}
+	frame_thread = pt->id;
+
+	fs = frames + frame_count % PROF_FRAME_HISTORY;
+	fs->frame = frame_count;
+	fs->start_usec = frame_start;
+	fs->dur_usec = now - frame_start;
+	memset(fs->counters, 0, sizeof fs->counters);
+
+	LOCK();
+	for(pt = threads; pt; pt = pt->next) {
+		for(i=0; i<PROF_COUNTER_COUNT; i++) {
+			unsigned long total = pt->counters[i];
+			fs->counters[i] += total - pt->counters_seen[i];
+			pt->counters_seen[i] = total;
+		}
+	}
+	UNLOCK();
+
+	frame_count++;
+	frame_start = now;
+}
+
+const prof_frame_stats *prof_last_frame(void) {
+	if(frame_count == first_frame) return 0;
+	return frames + (frame_count - 1) % PROF_FRAME_HISTORY;
+}
+
+const char *prof_counter_name(enum prof_counter ctr) {
+	return counter_names[ctr];
+}
+
+void prof_reset(void) {
+	reset_usec = prof_usec();
+	first_frame = frame_count;
+}
+
+
+/* --- export --- */
+
+/* the index of the oldest scope of a thread still in its ring */
+static unsigned long ring_start(unsigned long head) {
+	return head > PROF_RING_SIZE ? head - PROF_RING_SIZE : 0;
+}
+
+static unsigned long frames_start(void) {
+	unsigned long start = frame_count > PROF_FRAME_HISTORY ? frame_count - PROF_FRAME_HISTORY : 0;
+	return start > first_frame ? start : first_frame;
+}
+
+static void write_json_str(FILE *fp, const char *str) {
+	fputc('"', fp);
+	while(*str) {
+		if(*str == '"' || *str == '\\') {
+			fputc('\\', fp);
+		}
+		if((unsigned char)*str >= 32) {
+			fputc(*str, fp);
+		}
+		str++;
+	}
+	fputc('"', fp);
+}
+
+int prof_write_trace(const char *fname) {
+	FILE *fp;
+	struct prof_thread *pt;
+	unsigned long i, head;
+	int j;
+
+	if(!(fp = fopen(fname, "w"))) {
+		return -1;
+	}
+
+	fputs("{\"traceEvents\":[\n", fp);
+	fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"3dengfx\"}}", fp);
+
+	LOCK();
+	for(pt = threads; pt; pt = pt->next) {
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", pt->id);
+		write_json_str(fp, pt->name);
+		fputs("}}", fp);
+
+		head = pt->head;
+		for(i=ring_start(head); i<head; i++) {
+			const struct scope *s = pt->ring + (i & RING_MASK);
+			if(s->start < reset_usec) continue;
+
+			fputs(",\n{\"name\":", fp);
+			write_json_str(fp, s->name);
+			fprintf(fp, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lu,\"dur\":%lu}",
+					pt->id, s->start, s->dur);
+		}
+	}
+	UNLOCK();
+
+	/* the frames on the thread which ended them, and the counters as
+	 * counter tracks, set at the start of every frame.
+	 */
+	for(i=frames_start(); i<frame_count; i++) {
+		const prof_frame_stats *fs = frames + i % PROF_FRAME_HISTORY;
+
+		fprintf(fp, ",\n{\"name\":\"frame %lu\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%lu,\"dur\":%lu}", fs->frame, frame_thread, fs->start_usec, fs->dur_usec);
+
+		fprintf(fp, ",\n{\"name\":\"frame counters\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%lu,\"args\":{",
+				frame_thread, fs->start_usec);
+		for(j=0; j<PROF_COUNTER_COUNT; j++) {
+			fprintf(fp, "%s\"%s\":%lu", j ? "," : "", counter_names[j], fs->counters[j]);
+		}
+		fputs("}}", fp);
+	}
+
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+
+	if(fclose(fp) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* the names are the pointers given to prof_begin, so duplicates are found
+ * by pointer, and there are only as many of them as scopes in the code.
+ */
+struct name_table {
+	const char **names;
+	int count, size;
+};
+
+static int name_index(struct name_table *tab, const char *name) {
+	int i;
+
+	for(i=tab->count-1; i>=0; i--) {
+		if(tab->names[i] == name) return i;
+	}
+
+	if(tab->count >= tab->size) {
+		int new_size = tab->size ? tab->size * 2 : 64;
+		const char **tmp = realloc(tab->names, new_size * sizeof *tmp);
+		if(!tmp) return -1;
+		tab->names = tmp;
+		tab->size = new_size;
+	}
+	tab->names[tab->count] = name;
+	return tab->count++;
+}
+
+int prof_write_log(const char *fname) {
+	FILE *fp;
+	struct prof_thread *pt;
+	struct name_table tab = {0, 0, 0};
+	unsigned long i, head, scope_count = 0, fstart = frames_start();
+	int j, res = 0;
+
+	if(!(fp = fopen(fname, "wb"))) {
+		return -1;
+	}
+
+	LOCK();
+
+	/* first pass, for the counts of the header and the names */
+	for(pt = threads; pt; pt = pt->next) {
+		head = pt->head;
+		for(i=ring_start(head); i<head; i++) {
+			const struct scope *s = pt->ring + (i & RING_MASK);
+			if(s->start < reset_usec) continue;
+
+			if(name_index(&tab, s->name) == -1 || tab.count > 0xffff) {
+				res = -1;
+				break;
+			}
+			scope_count++;
+		}
+	}
+
+	if(res != -1) {
+		fwrite("3DPROF\0\0", 1, 8, fp);
+		write_int32_le(fp, LOG_VERSION);
+		write_int32_le(fp, num_threads);
+		write_int32_le(fp, tab.count);
+		write_int32_le(fp, (int32_t)scope_count);
+		write_int32_le(fp, (int32_t)(frame_count - fstart));
+		write_int32_le(fp, PROF_COUNTER_COUNT);
+
+		for(j=0; j<tab.count; j++) {
+			int len = (int)strlen(tab.names[j]);
+			if(len > 0xffff) len = 0xffff;
+			write_int16_le(fp, (int16_t)len);
+			fwrite(tab.names[j], 1, len, fp);
+		}
+
+		for(pt = threads; pt; pt = pt->next) {
+			head = pt->head;
+			for(i=ring_start(head); i<head; i++) {
+				const struct scope *s = pt->ring + (i & RING_MASK);
+				if(s->start < reset_usec) continue;
+
+				write_int16_le(fp, (int16_t)name_index(&tab, s->name));
+				write_int8(fp, (int8_t)pt->id);
+				write_int8(fp, (int8_t)s->depth);
+				write_int32_le(fp, (int32_t)s->start);
+				write_int32_le(fp, (int32_t)s->dur);
+			}
+		}
+	}
+	UNLOCK();
+
+	if(res != -1) {
+		for(i=fstart; i<frame_count; i++) {
+			const prof_frame_stats *fs = frames + i % PROF_FRAME_HISTORY;
+
+			write_int32_le(fp, (int32_t)fs->frame);
+			write_int32_le(fp, (int32_t)fs->start_usec);
+			write_int32_le(fp, (int32_t)fs->dur_usec);
+			for(j=0; j<PROF_COUNTER_COUNT; j++) {
+				write_int32_le(fp, (int32_t)fs->counters[j]);
+			}
+		}
+	}
+
+	free(tab.names);
+	if(ferror(fp)) res = -1;
+	if(fclose(fp) != 0) res = -1;
+	return res;
+}
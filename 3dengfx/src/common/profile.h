@@ -0,0 +1,146 @@
+/*
+Copyright 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small hierarchical CPU profiler, recording timed scopes and
+per-frame counters from any number of threads, for the Chrome trace viewer
+or a compact binary log.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "3dengfx_config.h"
+
+/* The instrumentation goes through the PROF_* macros, which expand to
+ * nothing unless USE_PROFILER is defined (configure --enable-profiler), so
+ * a build without the profiler carries no trace of it. The functions are
+ * always there, for programs which want to record their own scopes.
+ *
+ * Every thread records into its own ring buffer of the most recent
+ * PROF_RING_SIZE scopes, without any locking, so the oldest scopes are
+ * overwritten in a long run: the exported trace is always the last few
+ * seconds or so before the export. Scope names must be string literals, or
+ * otherwise live until the profiler data is exported.
+ *
+ * prof_frame() marks the end of a frame (called by flip()), and keeps the
+ * counters of the frame in a history of the last PROF_FRAME_HISTORY ones.
+ * The exports read the ring buffers of all the threads, so they must be
+ * called while no other thread is recording, e.g. between two frames.
+ */
+
+#define PROF_RING_SIZE		8192	/* scopes, per thread, a power of two */
+#define PROF_MAX_DEPTH		32
+#define PROF_FRAME_HISTORY	1024
+
+enum prof_counter {
+	PROF_DRAW_CALLS,		/* glDrawElements/glDrawArrays calls */
+	PROF_STATE_CHANGES,		/* state changes which reached the backend (see rstate.hpp) */
+	PROF_CULLED_OBJECTS,	/* objects dropped by frustum or occlusion culling */
+	PROF_ALLOCS,			/* frame arena allocations and geometry array buffers */
+
+	PROF_COUNTER_COUNT
+};
+
+typedef struct prof_frame_stats {
+	unsigned long frame;
+	unsigned long start_usec, dur_usec;
+	unsigned long counters[PROF_COUNTER_COUNT];
+} prof_frame_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* enabled by default, disabling stops the recording (not the counters) */
+void prof_enable(int enable);
+int prof_enabled(void);
+
+void prof_begin(const char *name);
+void prof_end(void);
+
+/* adds to a counter of the current frame, from any thread */
+void prof_count(enum prof_counter ctr, unsigned long n);
+
+/* names the calling thread in the exported trace */
+void prof_set_thread_name(const char *name);
+
+/* ends the current frame, must be called from a single thread */
+void prof_frame(void);
+
+/* the last frame ended, or 0 if there is none yet */
+const prof_frame_stats *prof_last_frame(void);
+const char *prof_counter_name(enum prof_counter ctr);
+
+/* microseconds since the profiler was first used */
+unsigned long prof_usec(void);
+
+/* Chrome trace event JSON (chrome://tracing, or any viewer which reads it),
+ * returns -1 on failure.
+ */
+int prof_write_trace(const char *fname);
+
+/* The binary log, all fields little endian:
+ *   header: "3DPROF\0\0", version, thread count, name count, scope count,
+ *           frame count, counter count (7 x u32 after the magic)
+ *   names:  u16 length and the bytes of each name
+ *   scopes: u16 name index, u8 thread, u8 depth, u32 start usec, u32 usec
+ *   frames: u32 frame, u32 start usec, u32 usec, u32 for every counter
+ * returns -1 on failure.
+ */
+int prof_write_log(const char *fname);
+
+/* drops everything recorded so far */
+void prof_reset(void);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#ifdef __cplusplus
+/* ends the scope when it goes out of scope, see PROF_SCOPE */
+class ProfScope {
+public:
+	ProfScope(const char *name) { prof_begin(name); }
+	~ProfScope() { prof_end(); }
+};
+#endif	/* __cplusplus */
+
+#ifdef USE_PROFILER
+
+#define PROF_CONCAT_(a, b)		a##b
+#define PROF_CONCAT(a, b)		PROF_CONCAT_(a, b)
+
+#define PROF_BEGIN(name)		prof_begin(name)
+#define PROF_END()				prof_end()
+#define PROF_COUNT(ctr, n)		prof_count(ctr, n)
+#define PROF_FRAME()			prof_frame()
+#define PROF_THREAD_NAME(name)	prof_set_thread_name(name)
+/* C++ only, times the rest of the enclosing block */
+#define PROF_SCOPE(name)		ProfScope PROF_CONCAT(prof_scope_, __LINE__)(name)
+
+#else
+
+#define PROF_BEGIN(name)
+#define PROF_END()
+#define PROF_COUNT(ctr, n)
+#define PROF_FRAME()
+#define PROF_THREAD_NAME(name)
+#define PROF_SCOPE(name)
+
+#endif	/* USE_PROFILER */
+
+#endif	/* _PROFILE_H_ */
@@ -2,27 +2,46 @@
 
 #include <string>
 #include <string.h>
+#include "string_hash.hpp"
 
 /*
- * Hashing algorithm for strings from:
- * Sedgewick's "Algorithms in C++, third edition" 
- * parts 1-4, Chapter 14 (hashing) p.593
- * 
- * Modified to work on C++ string class objects by John Tsiombikas
+ * FNV-1a hash, by Glenn Fowler, Landon Curt Noll and Phong Vo.
+ * Fast, decent distribution, and doesn't need any temporaries.
  */
-unsigned int string_hash(const std::string &key, unsigned long size) {
-	int hash = 0, a = 31415, b = 27183;
-	char *str = new char[key.length() + 1];
-	strcpy(str, key.c_str());
+#define FNV_OFFSET_BASIS	2166136261U
+#define FNV_PRIME			16777619U
 
-	char *sptr = str;
+unsigned int string_hash(const char *str) {
+	unsigned int hash = FNV_OFFSET_BASIS;
 	
-	while(*sptr) {
-		hash = (a * hash + *sptr++) % size;
-		a = a * b % (size - 1);
+	while(*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= FNV_PRIME;
 	}
-	
-	delete [] str;
-	
-	return (unsigned int)(hash < 0 ? (hash + size) : hash);
+	return hash;
+}
+
+unsigned int string_hash(const char *str, size_t len) {
+	return mem_hash(str, len);
+}
+
+unsigned int mem_hash(const void *data, size_t size) {
+	unsigned int hash = FNV_OFFSET_BASIS;
+	const unsigned char *ptr = (const unsigned char*)data;
+
+	while(size--) {
+		hash ^= *ptr++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/* hash a C++ string object, reduced to the range [0, size).
+ * Originally Sedgewick's algorithm from "Algorithms in C++, third edition"
+ * parts 1-4, Chapter 14 (hashing) p.593, modified by John Tsiombikas;
+ * now uses FNV-1a, which doesn't need to copy the string around.
+ */
+unsigned int string_hash(const std::string &key, unsigned long size) {
+	unsigned int hash = mem_hash(key.data(), key.length());
+	return size ? (unsigned int)(hash % size) : hash;
 }
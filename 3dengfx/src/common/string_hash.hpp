@@ -2,7 +2,13 @@
 #define _STRING_HASH_HPP_
 
 #include <string>
+#include <cstddef>
 
 unsigned int string_hash(const std::string &key, unsigned long size);
 
+// full range 32bit hashes (FNV-1a), same result for the same sequence of bytes
+unsigned int string_hash(const char *str);
+unsigned int string_hash(const char *str, size_t len);
+unsigned int mem_hash(const void *data, size_t size);
+
 #endif	// _STRING_HASH_HPP_
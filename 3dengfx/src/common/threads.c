@@ -0,0 +1,412 @@
+/*
+Copyright 2004 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small portable threading library, providing a lazily created
+worker pool for data-parallel loops, along with thin wrappers over the
+native threads, mutexes and condition variables.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#define _XOPEN_SOURCE	500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "3dengfx_config.h"
+#include "threads.h"
+#include "profile.h"
+
+#if !defined(NO_THREADS) && (defined(__unix__) || defined(unix))
+#define USE_PTHREADS
+#endif
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+
+struct thr_mutex {
+	pthread_mutex_t mutex;
+};
+
+struct thr_cond {
+	pthread_cond_t cond;
+};
+
+struct thr_thread {
+	pthread_t thread;
+};
+
+/* --- worker pool --- */
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t id_key;
+
+static pthread_t *workers;
+static int num_workers;		/* pool threads, not counting the caller */
+static int req_workers;		/* as set by thr_set_num_workers, 0 = auto */
+static int pool_busy, pool_quit;
+
+/* the job currently being executed */
+static thr_work_func job_func;
+static void *job_cls;
+static int job_count, job_next, job_chunk;
+static int job_active;			/* pool threads still working on the job */
+static unsigned long job_gen;	/* bumped for every new job */
+static unsigned long pool_gen;	/* job_gen at the time the pool was started */
+
+static void make_key(void) {
+	pthread_key_create(&id_key, 0);
+}
+
+static void run_job(void) {
+	int i, end;
+
+	for(;;) {
+		pthread_mutex_lock(&pool_lock);
+		i = job_next;
+		job_next += job_chunk;
+		pthread_mutex_unlock(&pool_lock);
+
+		if(i >= job_count) break;
+
+		end = i + job_chunk > job_count ? job_count : i + job_chunk;
+		for(; i<end; i++) {
+			job_func(i, job_cls);
+		}
+	}
+}
+
+static void *worker_main(void *arg) {
+	unsigned long my_gen;
+
+	pthread_setspecific(id_key, arg);
+
+#ifdef USE_PROFILER
+	{
+		char name[32];
+		sprintf(name, "worker %d", (int)(size_t)arg);
+		prof_set_thread_name(name);
+	}
+#endif
+
+	pthread_mutex_lock(&pool_lock);
+	my_gen = pool_gen;
+	for(;;) {
+		while(job_gen == my_gen && !pool_quit) {
+			pthread_cond_wait(&work_cond, &pool_lock);
+		}
+		if(pool_quit) break;
+		my_gen = job_gen;
+
+		pthread_mutex_unlock(&pool_lock);
+		run_job();
+		pthread_mutex_lock(&pool_lock);
+
+		if(--job_active == 0) {
+			pthread_cond_signal(&done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return 0;
+}
+
+/* called with pool_lock held */
+static void start_pool(void) {
+	int i, num = req_workers ? req_workers : thr_num_processors();
+
+	pthread_once(&key_once, make_key);
+
+	if(num <= 1) return;
+
+	if(!(workers = malloc((num - 1) * sizeof *workers))) {
+		return;
+	}
+
+	pool_quit = 0;
+	pool_gen = job_gen;
+	for(i=0; i<num-1; i++) {
+		if(pthread_create(workers + i, 0, worker_main, (void*)(size_t)(i + 1)) != 0) {
+			break;
+		}
+	}
+	num_workers = i;
+
+	if(!num_workers) {
+		free(workers);
+		workers = 0;
+	}
+}
+
+int thr_threads_available(void) {
+	return 1;
+}
+
+int thr_num_processors(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+	long num = sysconf(_SC_NPROCESSORS_ONLN);
+	return num > 0 ? (int)num : 1;
+#else
+	return 1;
+#endif
+}
+
+void thr_set_num_workers(int num) {
+	thr_shutdown();
+	req_workers = num > 0 ? num : 0;
+}
+
+int thr_get_num_workers(void) {
+	if(req_workers) return req_workers;
+	return workers ? num_workers + 1 : thr_num_processors();
+}
+
+int thr_worker_id(void) {
+	pthread_once(&key_once, make_key);
+	return (int)(size_t)pthread_getspecific(id_key);
+}
+
+void thr_parallel_for(int count, thr_work_func func, void *cls) {
+	int i, nthr;
+
+	if(count <= 0) return;
+
+	pthread_mutex_lock(&pool_lock);
+	if(!workers && count > 1) {
+		start_pool();
+	}
+
+	if(!workers || pool_busy || count == 1) {
+		pthread_mutex_unlock(&pool_lock);
+		for(i=0; i<count; i++) {
+			func(i, cls);
+		}
+		return;
+	}
+
+	nthr = num_workers + 1;
+
+	pool_busy = 1;
+	job_func = func;
+	job_cls = cls;
+	job_count = count;
+	job_next = 0;
+	job_chunk = count / (nthr * 4);
+	if(job_chunk < 1) job_chunk = 1;
+	job_active = num_workers;
+	job_gen++;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_lock);
+
+	run_job();
+
+	pthread_mutex_lock(&pool_lock);
+	while(job_active) {
+		pthread_cond_wait(&done_cond, &pool_lock);
+	}
+	pool_busy = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void thr_shutdown(void) {
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	if(!workers) {
+		pthread_mutex_unlock(&pool_lock);
+		return;
+	}
+	pool_quit = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_lock);
+
+	for(i=0; i<num_workers; i++) {
+		pthread_join(workers[i], 0);
+	}
+	free(workers);
+	workers = 0;
+	num_workers = 0;
+}
+
+/* --- primitives --- */
+
+thr_mutex *thr_mutex_create(void) {
+	thr_mutex *m = malloc(sizeof *m);
+	if(m) pthread_mutex_init(&m->mutex, 0);
+	return m;
+}
+
+void thr_mutex_destroy(thr_mutex *m) {
+	if(m) {
+		pthread_mutex_destroy(&m->mutex);
+		free(m);
+	}
+}
+
+void thr_mutex_lock(thr_mutex *m) {
+	pthread_mutex_lock(&m->mutex);
+}
+
+void thr_mutex_unlock(thr_mutex *m) {
+	pthread_mutex_unlock(&m->mutex);
+}
+
+thr_cond *thr_cond_create(void) {
+	thr_cond *c = malloc(sizeof *c);
+	if(c) pthread_cond_init(&c->cond, 0);
+	return c;
+}
+
+void thr_cond_destroy(thr_cond *c) {
+	if(c) {
+		pthread_cond_destroy(&c->cond);
+		free(c);
+	}
+}
+
+void thr_cond_wait(thr_cond *c, thr_mutex *m) {
+	pthread_cond_wait(&c->cond, &m->mutex);
+}
+
+void thr_cond_signal(thr_cond *c) {
+	pthread_cond_signal(&c->cond);
+}
+
+void thr_cond_broadcast(thr_cond *c) {
+	pthread_cond_broadcast(&c->cond);
+}
+
+thr_thread *thr_create(thr_thread_func func, void *arg) {
+	thr_thread *thr = malloc(sizeof *thr);
+	if(!thr) return 0;
+
+	if(pthread_create(&thr->thread, 0, func, arg) != 0) {
+		free(thr);
+		return 0;
+	}
+	return thr;
+}
+
+void *thr_join(thr_thread *thr) {
+	void *res = 0;
+	if(thr) {
+		pthread_join(thr->thread, &res);
+		free(thr);
+	}
+	return res;
+}
+
+unsigned long thr_atomic_inc(volatile unsigned long *val) {
+#ifdef __GNUC__
+	return __sync_add_and_fetch(val, 1);
+#else
+	static pthread_mutex_t inc_lock = PTHREAD_MUTEX_INITIALIZER;
+	unsigned long res;
+
+	pthread_mutex_lock(&inc_lock);
+	res = ++*val;
+	pthread_mutex_unlock(&inc_lock);
+	return res;
+#endif
+}
+
+#else	/* serial fallback */
+
+struct thr_mutex {
+	int dummy;
+};
+
+struct thr_cond {
+	int dummy;
+};
+
+struct thr_thread {
+	void *result;
+};
+
+int thr_threads_available(void) {
+	return 0;
+}
+
+int thr_num_processors(void) {
+	return 1;
+}
+
+void thr_set_num_workers(int num) {}
+
+int thr_get_num_workers(void) {
+	return 1;
+}
+
+int thr_worker_id(void) {
+	return 0;
+}
+
+void thr_parallel_for(int count, thr_work_func func, void *cls) {
+	int i;
+	for(i=0; i<count; i++) {
+		func(i, cls);
+	}
+}
+
+void thr_shutdown(void) {}
+
+thr_mutex *thr_mutex_create(void) {
+	return malloc(sizeof(thr_mutex));
+}
+
+void thr_mutex_destroy(thr_mutex *m) {
+	free(m);
+}
+
+void thr_mutex_lock(thr_mutex *m) {}
+void thr_mutex_unlock(thr_mutex *m) {}
+
+thr_cond *thr_cond_create(void) {
+	return malloc(sizeof(thr_cond));
+}
+
+void thr_cond_destroy(thr_cond *c) {
+	free(c);
+}
+
+/* there is nobody else to signal us, so waiting would hang forever */
+void thr_cond_wait(thr_cond *c, thr_mutex *m) {}
+void thr_cond_signal(thr_cond *c) {}
+void thr_cond_broadcast(thr_cond *c) {}
+
+thr_thread *thr_create(thr_thread_func func, void *arg) {
+	thr_thread *thr = malloc(sizeof *thr);
+	if(thr) thr->result = func(arg);
+	return thr;
+}
+
+void *thr_join(thr_thread *thr) {
+	void *res = 0;
+	if(thr) {
+		res = thr->result;
+		free(thr);
+	}
+	return res;
+}
+
+unsigned long thr_atomic_inc(volatile unsigned long *val) {
+	return ++*val;
+}
+
+#endif	/* USE_PTHREADS */
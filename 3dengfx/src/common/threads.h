@@ -0,0 +1,89 @@
+/*
+Copyright 2004 John Tsiombikas <nuclear@siggraph.org>
+
+This is a small portable threading library, providing a lazily created
+worker pool for data-parallel loops, along with thin wrappers over the
+native threads, mutexes and condition variables.
+
+This library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _THREADS_H_
+#define _THREADS_H_
+
+/* If NO_THREADS is defined (configure --disable-threads), or the platform
+ * has no pthreads, everything degenerates gracefully to serial execution:
+ * thr_parallel_for runs the loop on the calling thread, thr_create runs the
+ * thread function to completion before returning, and locks are no-ops.
+ */
+
+typedef struct thr_mutex thr_mutex;
+typedef struct thr_cond thr_cond;
+typedef struct thr_thread thr_thread;
+
+typedef void (*thr_work_func)(int idx, void *cls);
+typedef void *(*thr_thread_func)(void *arg);
+
+#ifdef __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+/* 0 if everything runs serially (see above) */
+int thr_threads_available(void);
+
+/* number of processors online (at least 1) */
+int thr_num_processors(void);
+
+/* set the number of threads taking part in thr_parallel_for, including the
+ * calling thread; 0 (the default) means one per processor. This tears down
+ * any existing pool, so don't call it while a parallel loop is running.
+ */
+void thr_set_num_workers(int num);
+int thr_get_num_workers(void);
+
+/* 0 for any thread outside the pool, 1 .. num_workers-1 for pool workers */
+int thr_worker_id(void);
+
+/* calls func(i, cls) for every i in [0, count), spread across the pool.
+ * Returns when all iterations are done. Nested calls, or calls made while
+ * the pool is busy with another loop, run serially on the calling thread.
+ */
+void thr_parallel_for(int count, thr_work_func func, void *cls);
+
+/* joins and destroys the worker pool, it will be recreated on demand */
+void thr_shutdown(void);
+
+thr_mutex *thr_mutex_create(void);
+void thr_mutex_destroy(thr_mutex *m);
+void thr_mutex_lock(thr_mutex *m);
+void thr_mutex_unlock(thr_mutex *m);
+
+thr_cond *thr_cond_create(void);
+void thr_cond_destroy(thr_cond *c);
+void thr_cond_wait(thr_cond *c, thr_mutex *m);
+void thr_cond_signal(thr_cond *c);
+void thr_cond_broadcast(thr_cond *c);
+
+thr_thread *thr_create(thr_thread_func func, void *arg);
+void *thr_join(thr_thread *thr);
+
+/* increments *val atomically and returns the new value */
+unsigned long thr_atomic_inc(volatile unsigned long *val);
+
+#ifdef __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* _THREADS_H_ */
@@ -24,6 +24,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <map>
 #include "cmd.hpp"
 #include "script.h"
 #include "dsys.hpp"
@@ -34,20 +39,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 using namespace dsys;
 using namespace cmd;
 
-// command handler prototypes
-static bool start_part(const char *pname, const char **args);
-static bool end_part(const char *pname, const char **args);
-static bool rename_part(const char *pname, const char **args);
-static bool set_render_target(const char *pname, const char **args);
-static bool set_clear(const char *pname, const char **args);
-static bool end(const char *unused, const char **args);
-static bool effect(const char *fxname, const char **args);
+// command compiler prototypes, they parse the arguments into the command
+static bool part_command(Command *c, const char **args);
+static bool rename_part(Command *c, const char **args);
+static bool set_render_target(Command *c, const char **args);
+static bool set_clear(Command *c, const char **args);
+static bool end(Command *c, const char **args);
+static bool effect(Command *c, const char **args);
 
-static bool (*ftbl[64])(const char*, const char**);
+static bool (*ftbl[64])(Command*, const char**);
 
 void cmd::register_commands() {
-	ftbl[CMD_START_PART] = start_part;
-	ftbl[CMD_END_PART] = end_part;
+	ftbl[CMD_START_PART] = part_command;
+	ftbl[CMD_END_PART] = part_command;
 	ftbl[CMD_RENAME_PART] = rename_part;
 	ftbl[CMD_SET_RTARGET] = set_render_target;
 	ftbl[CMD_SET_CLEAR] = set_clear;
@@ -55,94 +59,337 @@ void cmd::register_commands() {
 	ftbl[CMD_FX] = effect;
 }
 
-bool cmd::command(CommandType cmd_id, const char *pname, const char **args) {
-	assert(ftbl[cmd_id]);
+static bool compile_command(Command *c, const char *pname, const char **args) {
+	assert(ftbl[c->type]);
 
-	return ftbl[cmd_id](pname, args);
+	c->part = 0;
+	c->name = pname ? pname : "";
+	c->target = (int)RT_FB;
+	c->clear = false;
+	c->fx = 0;
+	return ftbl[c->type](c, args);
 }
 
-static bool start_part(const char *pname, const char **args) {
-	Part *part = get_part(pname);
-	if(part) {
-		info("start_part(%s)", pname);
-		start_part(part);
-		return true;
-	}
-	return false;
+static bool uses_part(CommandType type) {
+	return type != CMD_END && type != CMD_FX;
 }
 
-static bool end_part(const char *pname, const char **args) {
-	Part *part = get_part(pname);
-	if(part) {
+static void execute_command(const Command &c) {
+	const char *pname = c.name.c_str();
+
+	switch(c.type) {
+	case CMD_START_PART:
+		info("start_part(%s)", pname);
+		start_part(c.part);
+		break;
+
+	case CMD_END_PART:
 		info("end_part(%s)", pname);
-		stop_part(part);
-		return true;
+		stop_part(c.part);
+		break;
+
+	case CMD_RENAME_PART:
+		info("rename_part(%s, %s)", pname, c.new_name.c_str());
+		dsys::rename_part(c.part, c.new_name.c_str());
+		break;
+
+	case CMD_SET_RTARGET:
+		info("set_rtarg(%s, %d)", pname, c.target);
+		c.part->set_target((RenderTarget)c.target);
+		break;
+
+	case CMD_SET_CLEAR:
+		info("set_clear(%s, %s)", pname, c.clear ? "true" : "false");
+		c.part->set_clear(c.clear);
+		break;
+
+	case CMD_END:
+		info("end");
+		end_demo();
+		break;
+
+	case CMD_FX:
+		info("fx(%s)", pname);
+		add_image_fx(c.fx);
+		break;
+
+	default:
+		break;
 	}
-	return false;
 }
 
-static bool rename_part(const char *pname, const char **args) {
-	Part *part = get_part(pname);
-	if(part && args[0]) {
-		info("rename_part(%s, %s)", pname, args[0]);
-		remove_part(part);
-		part->set_name(args[0]);
-		add_part(part);
-		return true;
+bool cmd::command(CommandType cmd_id, const char *pname, const char **args) {
+	Command c;
+	c.time = get_demo_time();
+	c.type = cmd_id;
+	c.line = 0;
+
+	if(!compile_command(&c, pname, args)) {
+		return false;
+	}
+	if(uses_part(cmd_id) && !(c.part = get_part(pname))) {
+		delete c.fx;
+		return false;
 	}
-	return false;
+
+	// an effect is left to the effect list, as it's not part of a script
+	execute_command(c);
+	return true;
 }
 
-static bool set_render_target(const char *pname, const char **args) {
-	Part *part = get_part(pname);
-	if(part && args[0]) {
-		int tnum;
 
-		// check for valid render target specifier (fb, t0, t1, t2, t3)
-		if(!strcmp(args[0], "fb")) {
-			tnum = (int)RT_FB;
-		} else {
-			if(args[0][0] != 't' || !isdigit(args[0][1]) || args[0][2] ||
-				(tnum = atoi(args[0]+1)) < 0 || tnum > 3) {
-				return false;
+CompiledScript::CompiledScript() {
+	next = 0;
+}
+
+CompiledScript::~CompiledScript() {
+	clear();
+}
+
+/* compile
+ * reads the whole script. A command waits for the ones before it in the
+ * script, so one with an earlier time than its previous runs along with it,
+ * as it did when the script was read line by line. The names of the parts
+ * are followed through the renames, in the order of the script.
+ */
+bool CompiledScript::compile(DemoScript *ds) {
+	clear();
+
+	std::map<std::string, Part*> renamed;	// the new names so far, 0 for the old ones
+	unsigned long last_time = 0;
+
+	DemoCommand dc;
+	while(get_next_command(ds, &dc, ULONG_MAX) != EOF) {
+		Command c;
+		c.time = dc.time > last_time ? dc.time : last_time;
+		c.type = dc.type;
+		c.line = ds->line;
+
+		// without arguments argv holds only the terminating null
+		const char **args = dc.argc ? dc.argv + 1 : dc.argv;
+		bool ok = compile_command(&c, dc.argv[0], args);
+
+		if(ok && uses_part(c.type)) {
+			std::map<std::string, Part*>::iterator iter = renamed.find(c.name);
+			c.part = iter != renamed.end() ? iter->second : get_part(c.name.c_str());
+
+			if(!c.part) {
+				error("demoscript line %ld: unknown part %s", c.line, c.name.c_str());
+				ok = false;
+			} else if(c.type == CMD_RENAME_PART) {
+				renamed[c.name] = 0;
+				renamed[c.new_name] = c.part;
 			}
 		}
+		free_command(&dc);
 
-		info("set_rtarg(%s, %s)", pname, args[0]);
-		part->set_target((RenderTarget)tnum);
-		return true;
+		if(!ok) {
+			error("demoscript line %ld: invalid command, ignoring", c.line);
+			continue;
+		}
+
+		if(c.part && find_part_state(c.part) == -1) {
+			PartState ps;
+			ps.part = c.part;
+			ps.name = c.part->get_name();
+			ps.target = (int)c.part->get_target();
+			ps.clear = c.part->get_clear();
+			ps.running = get_running(ps.name.c_str()) == c.part;
+			ps.start_time = 0;
+			parts.push_back(ps);
+		}
+
+		commands.push_back(c);
+		last_time = c.time;
 	}
-	return false;
+
+	fx_added.assign(commands.size(), false);
+	next = 0;
+	return true;
 }
 
-static bool set_clear(const char *pname, const char **args) {
-	Part *part = get_part(pname);
-	if(part && args[0]) {
-		bool enable;
-		if(!strcmp(args[0], "true")) {
-			enable = true;
-		} else if(!strcmp(args[0], "false")) {
-			enable = false;
-		} else {
-			return false;
+void CompiledScript::clear() {
+	for(size_t i=0; i<commands.size(); i++) {
+		if(fx_added[i]) {
+			remove_image_fx(commands[i].fx);
 		}
+		delete commands[i].fx;
+	}
+	commands.clear();
+	parts.clear();
+	fx_added.clear();
+	next = 0;
+}
 
-		info("set_clear(%s, %s)", pname, enable ? "true" : "false");
-		part->set_clear(enable);
-		return true;
+int CompiledScript::find_part_state(Part *part) const {
+	for(size_t i=0; i<parts.size(); i++) {
+		if(parts[i].part == part) return (int)i;
 	}
-	return false;
+	return -1;
 }
 
-static bool end(const char *unused, const char **args) {
-	if(unused && *unused) return false;
+void CompiledScript::execute(size_t idx) {
+	execute_command(commands[idx]);
+	if(commands[idx].type == CMD_FX) {
+		fx_added[idx] = true;
+	}
+}
+
+/* run
+ * END isn't executed here, it ends the script like its end does, and the
+ * caller ends the demo.
+ */
+int CompiledScript::run(unsigned long time) {
+	while(next < commands.size() && commands[next].time <= time) {
+		if(commands[next].type == CMD_END) {
+			return EOF;
+		}
+		execute(next++);
+	}
+	return next < commands.size() ? 0 : EOF;
+}
+
+/* seek
+ * plays the commands before the time on a copy of the state the parts had
+ * when the script was compiled, then changes only what differs. Parts
+ * running at the time have their start time from their last START_PART, as
+ * if they had been running all along.
+ */
+void CompiledScript::seek(unsigned long time) {
+	size_t end = 0;
+	while(end < commands.size() && commands[end].time <= time && commands[end].type != CMD_END) {
+		end++;
+	}
+
+	std::vector<PartState> state = parts;
+	for(size_t i=0; i<end; i++) {
+		const Command &c = commands[i];
+		if(!c.part) continue;
+
+		PartState &ps = state[find_part_state(c.part)];
+		switch(c.type) {
+		case CMD_START_PART:
+			ps.running = true;
+			ps.start_time = c.time;
+			break;
 
-	info("end");
-	end_demo();
+		case CMD_END_PART:
+			ps.running = false;
+			break;
+
+		case CMD_RENAME_PART:
+			ps.name = c.new_name;
+			break;
+
+		case CMD_SET_RTARGET:
+			ps.target = c.target;
+			break;
+
+		case CMD_SET_CLEAR:
+			ps.clear = c.clear;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	for(size_t i=0; i<state.size(); i++) {
+		const PartState &ps = state[i];
+		Part *part = ps.part;
+		bool running = get_running(part->get_name()) == part;
+		if(running && !ps.running) {
+			stop_part(part);
+			running = false;
+		}
+
+		if(strcmp(part->get_name(), ps.name.c_str()) != 0) {
+			dsys::rename_part(part, ps.name.c_str());
+		}
+		part->set_target((RenderTarget)ps.target);
+		part->set_clear(ps.clear);
+
+		if(ps.running) {
+			if(!running) start_part(part);
+			part->set_start_time(ps.start_time);
+		}
+	}
+
+	// the effects keep the order of the script
+	for(size_t i=0; i<commands.size(); i++) {
+		if(fx_added[i]) {
+			remove_image_fx(commands[i].fx);
+			fx_added[i] = false;
+		}
+	}
+	for(size_t i=0; i<end; i++) {
+		if(commands[i].type == CMD_FX) {
+			add_image_fx(commands[i].fx);
+			fx_added[i] = true;
+		}
+	}
+
+	next = end;
+}
+
+unsigned long CompiledScript::get_duration() const {
+	return commands.empty() ? 0 : commands.back().time;
+}
+
+size_t CompiledScript::get_command_count() const {
+	return commands.size();
+}
+
+
+static bool part_command(Command *c, const char **args) {
+	return !c->name.empty();
+}
+
+static bool rename_part(Command *c, const char **args) {
+	if(c->name.empty() || !args[0]) return false;
+
+	c->new_name = args[0];
+	return true;
+}
+
+static bool set_render_target(Command *c, const char **args) {
+	if(c->name.empty() || !args[0]) return false;
+
+	int tnum;
+
+	// check for valid render target specifier (fb, t0, t1, t2, t3)
+	if(!strcmp(args[0], "fb")) {
+		tnum = (int)RT_FB;
+	} else {
+		if(args[0][0] != 't' || !isdigit(args[0][1]) || args[0][2] ||
+			(tnum = atoi(args[0]+1)) < 0 || tnum > 3) {
+			return false;
+		}
+	}
+
+	c->target = tnum;
+	return true;
+}
+
+static bool set_clear(Command *c, const char **args) {
+	if(c->name.empty() || !args[0]) return false;
+
+	if(!strcmp(args[0], "true")) {
+		c->clear = true;
+	} else if(!strcmp(args[0], "false")) {
+		c->clear = false;
+	} else {
+		return false;
+	}
 	return true;
 }
 
-static bool effect(const char *fxname, const char **args) {
+static bool end(Command *c, const char **args) {
+	return c->name.empty();
+}
+
+static bool effect(Command *c, const char **args) {
+	const char *fxname = c->name.c_str();
 	ImageFx *fx;
 	
 	if(!strcmp(fxname, "neg")) {
@@ -164,8 +411,6 @@ static bool effect(const char *fxname, const char **args) {
 		return false;
 	}
 
-	info("fx(%s)", fxname);
-	add_image_fx(fx);
-
+	c->fx = fx;
 	return true;
 }
@@ -19,6 +19,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 /* demosystem script controlled commands
+ *
+ * The script is compiled once into a list of commands sorted by time, with
+ * the parts looked up and the arguments parsed. Playing it is a matter of
+ * running the commands up to the current time, and seeking works out the
+ * state of every part at the new time from the commands before it.
  *
  * Author: John Tsiombikas 2005
  */
@@ -26,9 +31,71 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #ifndef _CMD_HPP_
 #define _CMD_HPP_
 
+#include <string>
+#include <vector>
 #include "script.h"
 
+namespace dsys {
+	class Part;
+	class ImageFx;
+}
+
 namespace cmd {
+	struct Command {
+		unsigned long time;
+		CommandType type;
+		long line;				// in the script, for the messages
+		dsys::Part *part;		// 0 for END and FX
+		std::string name;		// of the part, or the effect for FX
+		std::string new_name;	// RENAME_PART
+		int target;				// SET_RTARGET
+		bool clear;				// SET_CLEAR
+		dsys::ImageFx *fx;		// FX, parsed and owned by the script
+	};
+
+	class CompiledScript {
+	private:
+		// what the script changes on a part, at compile time and while seeking
+		struct PartState {
+			dsys::Part *part;
+			std::string name;
+			int target;
+			bool clear, running;
+			unsigned long start_time;
+		};
+
+		std::vector<Command> commands;
+		std::vector<PartState> parts;
+		size_t next;
+		std::vector<bool> fx_added;
+
+		int find_part_state(dsys::Part *part) const;
+		void execute(size_t idx);
+
+		CompiledScript(const CompiledScript &cs);
+		CompiledScript &operator =(const CompiledScript &cs);
+
+	public:
+		CompiledScript();
+		~CompiledScript();
+
+		bool compile(DemoScript *ds);
+		void clear();
+
+		/* runs the commands up to the time, returns EOF after the last
+		 * command of the script and 0 otherwise.
+		 */
+		int run(unsigned long time);
+
+		/* takes the parts and the effects of the script to the state they
+		 * would have had playing up to the time. Stops at an END before it.
+		 */
+		void seek(unsigned long time);
+
+		unsigned long get_duration() const;
+		size_t get_command_count() const;
+	};
+
 	void register_commands();
 
 	bool command(CommandType cmd_id, const char *pname, const char **args);
@@ -31,20 +31,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "cmd.hpp"
 #include "script.h"
 #include "3dengfx/3dengfx.hpp"
+#include "3dengfx/framewriter.hpp"
 #include "n3dmath2/n3dmath2.hpp"
 #include "common/timer.h"
 #include "common/err_msg.h"
-
-#if defined(__unix__) || defined(unix)
-#include <unistd.h>
-#include <sys/stat.h>
-#endif	// unix
+#include "common/profile.h"
 
 using namespace dsys;
 using namespace std;
 
-static int execute_script(DemoScript *ds, unsigned long time);
-
 Texture *dsys::tex[4];
 unsigned int dsys::rtex_size_x, dsys::rtex_size_y;
 Matrix4x4 dsys::tex_mat[4];
@@ -56,11 +51,13 @@ static PartTree running;
 static ntimer timer;
 
 static char script_fname[256];
-static DemoScript *ds;
+static cmd::CompiledScript *script;
 
 static bool demo_running = false;
 static bool seq_render = false;
 static unsigned long seq_time, seq_dt;
+static FrameWriter *seq_writer;
+static FrameSink *seq_own_sink;		// created by render_demo, deleted by end_demo
 
 static int best_tex_size(int n) {
 	int i;
@@ -159,7 +156,7 @@ void dsys::start_part(Part *part) {
 
 void dsys::stop_part(Part *part) {
 	part->stop();
-	PartTree::iterator iter = parts.find(part->get_name());
+	PartTree::iterator iter = running.find(part->get_name());
 	if(iter != running.end()) {
 		running.erase(iter);
 	} else {
@@ -167,6 +164,22 @@ void dsys::stop_part(Part *part) {
 	}
 }
 
+void dsys::rename_part(Part *part, const char *name) {
+	PartTree::iterator iter = running.find(part->get_name());
+	bool is_running = iter != running.end() && iter->second == part;
+	if(is_running) {
+		running.erase(iter);
+	}
+
+	remove_part(part);
+	part->set_name(name);
+	add_part(part);
+
+	if(is_running) {
+		running[name] = part;
+	}
+}
+
 Part *dsys::get_part(const char *pname) {
 	PartTree::iterator iter = parts.find(pname);
 	return iter != parts.end() ? iter->second : 0;
@@ -178,74 +191,104 @@ Part *dsys::get_running(const char *pname) {
 }
 
 
-bool dsys::start_demo() {
+static bool compile_script() {
+	DemoScript *ds;
 	if(!(ds = open_script(script_fname))) {
 		return false;
 	}
+
+	script = new cmd::CompiledScript;
+	script->compile(ds);
+	close_script(ds);
+
+	info("demoscript %s: %lu commands, %lu msec", script_fname,
+			(unsigned long)script->get_command_count(), script->get_duration());
+	return true;
+}
+
+bool dsys::start_demo() {
+	if(!compile_script()) {
+		return false;
+	}
 	demo_running = true;
 	timer_reset(&timer);
 	timer_start(&timer);
 	return true;
 }
 
-static char curr_dir[PATH_MAX];
-
 bool dsys::render_demo(int fps, const char *out_dir) {
-	if(!(ds = open_script(script_fname))) {
+	FrameSink *sink = new ImageFrameSink(out_dir, "3dengfx_shot", IMG_FMT_TGA);
+	if(!render_demo(fps, sink)) {
+		delete sink;
+		return false;
+	}
+	seq_own_sink = sink;
+	return true;
+}
+
+bool dsys::render_demo(int fps, FrameSink *sink) {
+	if(!compile_script()) {
 		return false;
 	}
-	
-#if defined(__unix__) || defined(unix)
-	// change to the specified directory
-	getcwd(curr_dir, PATH_MAX);
-
-	struct stat sbuf;
-	if(stat(out_dir, &sbuf) == -1) {
-		mkdir(out_dir, 0770);
-	}	
-	
-	chdir(out_dir);
-#endif	// __unix__
 
 	demo_running = true;
 	seq_render = true;
 	seq_time = 0;
 	seq_dt = 1000 / fps;
+	seq_writer = new FrameWriter(sink);
 
 	return true;
 }
 
 void dsys::end_demo() {
-#if defined(__unix__) || defined(unix)
-	if(seq_render) {
-		chdir(curr_dir);
+	if(seq_writer) {
+		seq_writer->finish();
+		seq_writer->print_stats();
+		delete seq_writer;
+		seq_writer = 0;
 	}
-#endif	// unix
+	delete seq_own_sink;
+	seq_own_sink = 0;
 	
 	if(demo_running) {
-		close_script(ds);
+		delete script;
+		script = 0;
 		demo_running = false;
 	}
 }
 
+void dsys::seek_demo(unsigned long time) {
+	if(!demo_running) return;
+
+	if(seq_render) {
+		seq_time = time;
+	} else {
+		unsigned long now = timer_getmsec(&timer);
+		if(time > now) {
+			timer_fwd(&timer, time - now);
+		} else {
+			timer_back(&timer, now - time);
+		}
+	}
+	script->seek(time);
+}
+
 
 static void update_node(const pair<string, Part*> &p) {
 	p.second->update_graphics();
 }
 
 int dsys::update_graphics() {
+	PROF_SCOPE("dsys::update_graphics");
 	if(!demo_running) {
 		return 1;
 	}
 
 	unsigned long time = get_demo_time();
 
-	int res;
-	while((res = execute_script(ds, time)) != 1) {
-		if(res == EOF) {
-			end_demo();
-			return -1;
-		}
+	if(script->run(time) == EOF) {
+		end_demo();
+		return -1;
 	}
 
 	// update graphics
@@ -258,27 +301,10 @@ int dsys::update_graphics() {
 	apply_image_fx(time);
 
 	if(seq_render) {
-		screen_capture();
+		seq_writer->capture();
 		seq_time += seq_dt;
 	}
 		
 	flip();
 	return 0;
 }
-
-static int execute_script(DemoScript *ds, unsigned long time) {
-	DemoCommand command;
-	
-	int res = get_next_command(ds, &command, time);
-	if(res == EOF || res == 1) {
-		return res;
-	}
-
-	if(!cmd::command(command.type, command.argv[0], command.argv + 1)) {
-		error("error in demoscript command execution!");
-	}
-	free_command(&command);
-
-	return demo_running ? 0 : -1;
-}
-
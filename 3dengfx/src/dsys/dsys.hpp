@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "3dengfx/textures.hpp"
 
+class FrameSink;
+
 namespace dsys {
 
 	class Part;
@@ -47,14 +49,21 @@ namespace dsys {
 	void remove_part(Part *part);
 	void start_part(Part *part);
 	void stop_part(Part *part);
+	// renames the part, running or not
+	void rename_part(Part *part, const char *name);
 
 	Part *get_part(const char *pname);
 	Part *get_running(const char *pname);
 	
 	bool start_demo();
+	// numbered TGA files in out_dir, or any sink (see 3dengfx/framesink.hpp)
 	bool render_demo(int fps = 25, const char *out_dir = "frames");
+	bool render_demo(int fps, FrameSink *sink);
 	void end_demo();
 	int update_graphics();
+
+	// moves the demo and the parts of the script to the time, in msec
+	void seek_demo(unsigned long time);
 }
 
 #endif	// _DSYS_HPP_
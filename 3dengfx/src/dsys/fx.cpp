@@ -149,6 +149,7 @@ void dsys::overlay(Texture *tex, const Vector2 &corner1, const Vector2 &corner2,
 			if(tex == dsys::tex[i]) {
 				glMatrixMode(GL_TEXTURE);
 				load_matrix_gl(dsys::tex_mat[i]);
+				invalidate_xform_matrices();
 				break;
 			}
 		}
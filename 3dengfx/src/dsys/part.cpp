@@ -65,13 +65,14 @@ void Part::post_draw() {
 
 	// reset states
 	for(int i=0; i<8; i++) {
-		glDisable(GL_LIGHT0 + i);
+		disable_light(i);
 	}
 
 	set_ambient_light(0.0f);
 }
 
 void Part::set_name(const char *name) {
+	delete [] this->name;
 	this->name = new char[strlen(name)+1];
 	strcpy(this->name, name);
 }
@@ -84,6 +85,10 @@ void Part::set_clear(bool enable) {
 	clear_fb = enable;
 }
 
+bool Part::get_clear() const {
+	return clear_fb;
+}
+
 void Part::start() {
 	//timer_start(&timer);
 	start_time = dsys::get_demo_time();
@@ -93,10 +98,18 @@ void Part::stop() {
 	//timer_stop(&timer);
 }
 
+void Part::set_start_time(unsigned long time) {
+	start_time = time;
+}
+
 void Part::set_target(RenderTarget targ) {
 	target = targ;
 }
 
+RenderTarget Part::get_target() const {
+	return target;
+}
+
 void Part::update_graphics() {
 	pre_draw();
 	draw_part();
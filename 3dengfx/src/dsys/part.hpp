@@ -47,11 +47,16 @@ namespace dsys {
 		void set_name(const char *name);
 		const char *get_name() const;
 		virtual void set_clear(bool enable);
+		bool get_clear() const;
 
 		virtual void start();
 		virtual void stop();
 
+		// when the part was started, moved by seeking the demo
+		void set_start_time(unsigned long time);
+
 		virtual void set_target(RenderTarget targ);
+		RenderTarget get_target() const;
 
 		virtual void update_graphics();
 
@@ -0,0 +1,372 @@
+/*
+This file is part of fxwt, the window system toolkit of 3dengfx.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Glyph atlas and text layout. */
+
+#include <cstring>
+#include <algorithm>
+#include "glyph_atlas.hpp"
+
+using std::min;
+using std::max;
+using namespace fxwt;
+
+// empty pixels right and below every glyph, so that filtering doesn't pick up its neighbours
+#define GLYPH_PAD		1
+
+GlyphSource::~GlyphSource() {}
+
+GlyphAtlas::GlyphAtlas(int width, int height) {
+	this->width = width;
+	this->height = height;
+	pixels.resize(width * height, 0);
+	batch = 1;
+	rasterized = evicted = 0;
+	dirty_start = dirty_end = 0;
+}
+
+GlyphAtlas::~GlyphAtlas() {
+	clear();
+}
+
+void GlyphAtlas::begin_batch() {
+	batch++;
+}
+
+const AtlasGlyph *GlyphAtlas::get_glyph(GlyphSource *src, unsigned int code) {
+	GlyphKey key = {src->get_id(), code};
+
+	Pair<GlyphKey, AtlasGlyph*> *res = glyphs.find(key);
+	if(res) {
+		res->val->last_used = batch;
+		return res->val;
+	}
+
+	GlyphBitmap bmp;
+	if(!src->render_glyph(code, &bmp)) {
+		return 0;
+	}
+
+	AtlasGlyph *glyph = new AtlasGlyph;
+	glyph->key = key;
+	glyph->width = bmp.width;
+	glyph->height = bmp.height;
+	glyph->left = bmp.left;
+	glyph->top = bmp.top;
+	glyph->advance = bmp.advance;
+	glyph->last_used = batch;
+	glyph->x = glyph->y = glyph->slot_width = 0;
+	glyph->shelf = -1;
+
+	if(bmp.width > 0 && bmp.height > 0) {
+		int w = bmp.width + GLYPH_PAD, h = bmp.height + GLYPH_PAD;
+		if(w > width || h > height || !alloc_slot(w, h, glyph)) {
+			delete glyph;
+			return 0;
+		}
+
+		// the slot may be bigger than the glyph, so the rest is cleared
+		const AtlasShelf &shelf = shelves[glyph->shelf];
+		for(int i=0; i<shelf.height; i++) {
+			unsigned char *dest = &pixels[(shelf.y + i) * width + glyph->x];
+			if(i < bmp.height) {
+				memcpy(dest, bmp.pixels + i * bmp.pitch, bmp.width);
+				memset(dest + bmp.width, 0, glyph->slot_width - bmp.width);
+			} else {
+				memset(dest, 0, glyph->slot_width);
+			}
+		}
+
+		if(dirty_start == dirty_end) {
+			dirty_start = shelf.y;
+			dirty_end = shelf.y + shelf.height;
+		} else {
+			dirty_start = min(dirty_start, shelf.y);
+			dirty_end = max(dirty_end, shelf.y + shelf.height);
+		}
+	}
+
+	glyphs.insert(key, glyph);
+	glyph_list.push_back(glyph);
+	rasterized++;
+	return glyph;
+}
+
+void GlyphAtlas::place(int shelf, int x, int slot_width, AtlasGlyph *glyph) {
+	glyph->shelf = shelf;
+	glyph->x = x;
+	glyph->y = shelves[shelf].y;
+	glyph->slot_width = slot_width;
+}
+
+/* alloc_slot
+ * the space left in a shelf close to the height of the glyph, then a new
+ * shelf, then the space left in any shelf tall enough. Only then the old
+ * glyphs are evicted.
+ */
+bool GlyphAtlas::alloc_slot(int w, int h, AtlasGlyph *glyph) {
+	int best = -1;
+	for(size_t i=0; i<shelves.size(); i++) {
+		const AtlasShelf &s = shelves[i];
+		if(s.height < h || width - s.used < w) continue;
+
+		if(best == -1 || s.height < shelves[best].height) {
+			best = i;
+		}
+	}
+
+	int top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+	if(best == -1 || shelves[best].height > h + h / 4 + 2) {
+		if(top + h <= height) {
+			AtlasShelf s = {top, h, 0};
+			shelves.push_back(s);
+			best = shelves.size() - 1;
+		}
+	}
+
+	if(best != -1) {
+		place(best, shelves[best].used, w, glyph);
+		shelves[best].used += w;
+		return true;
+	}
+
+	return evict_slots(w, h, glyph) || evict_shelves(w, h, glyph);
+}
+
+static bool glyph_x_less(const AtlasGlyph *a, const AtlasGlyph *b) {
+	return a->x < b->x;
+}
+
+/* evict_slots
+ * the slots of a shelf follow each other from the left, so any run of them
+ * not used in this batch, along with the free space after the last one,
+ * can take the new glyph. The run of the oldest glyphs wide enough goes.
+ */
+bool GlyphAtlas::evict_slots(int w, int h, AtlasGlyph *glyph) {
+	std::vector<std::vector<AtlasGlyph*> > shelf_glyphs(shelves.size());
+	for(size_t i=0; i<glyph_list.size(); i++) {
+		AtlasGlyph *g = glyph_list[i];
+		if(g->shelf != -1 && shelves[g->shelf].height >= h) {
+			shelf_glyphs[g->shelf].push_back(g);
+		}
+	}
+
+	int best_shelf = -1, best_first = 0, best_count = 0;
+	unsigned long oldest = 0;
+	for(size_t i=0; i<shelves.size(); i++) {
+		std::vector<AtlasGlyph*> &list = shelf_glyphs[i];
+		std::sort(list.begin(), list.end(), glyph_x_less);
+
+		int count = (int)list.size();
+		for(int j=0; j<count; j++) {
+			int run_width = 0;
+			unsigned long used = 0;
+			for(int k=j; k<count; k++) {
+				if(list[k]->last_used == batch) break;
+				run_width += list[k]->slot_width;
+				used = max(used, list[k]->last_used);
+
+				// the last slot of the shelf also gets the space after it
+				int space = k == count - 1 ? width - shelves[i].used : 0;
+				if(run_width + space >= w) {
+					if(best_shelf == -1 || used < oldest) {
+						best_shelf = i;
+						best_first = j;
+						best_count = k - j + 1;
+						oldest = used;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	if(best_shelf == -1) return false;
+
+	std::vector<AtlasGlyph*> &list = shelf_glyphs[best_shelf];
+	int x = list[best_first]->x;
+	int slot_width = 0;
+	for(int i=best_first; i<best_first + best_count; i++) {
+		slot_width += list[i]->slot_width;
+		remove_glyph(std::find(glyph_list.begin(), glyph_list.end(), list[i]) - glyph_list.begin());
+	}
+
+	if(best_first + best_count == (int)list.size()) {
+		// the end of the shelf, the rest is free again
+		slot_width = w;
+		shelves[best_shelf].used = x + w;
+	}
+	place(best_shelf, x, slot_width, glyph);
+	return true;
+}
+
+/* evict_shelves
+ * empties the run of neighbouring shelves, tall enough together, whose most
+ * recently used glyph is the oldest, and makes it a single shelf.
+ */
+bool GlyphAtlas::evict_shelves(int w, int h, AtlasGlyph *glyph) {
+	int shelf_count = shelves.size();
+	std::vector<unsigned long> shelf_used(shelf_count, 0);
+	for(size_t i=0; i<glyph_list.size(); i++) {
+		const AtlasGlyph *g = glyph_list[i];
+		if(g->shelf != -1) {
+			shelf_used[g->shelf] = max(shelf_used[g->shelf], g->last_used);
+		}
+	}
+
+	int first = -1, count = 0;
+	unsigned long oldest = 0;
+	for(int i=0; i<shelf_count; i++) {
+		int height_sum = 0;
+		unsigned long used = 0;
+		for(int j=i; j<shelf_count && height_sum < h; j++) {
+			if(shelf_used[j] == batch) break;
+			height_sum += shelves[j].height;
+			used = max(used, shelf_used[j]);
+
+			if(height_sum >= h && (first == -1 || used < oldest)) {
+				first = i;
+				count = j - i + 1;
+				oldest = used;
+			}
+		}
+	}
+
+	if(first == -1) return false;
+
+	// remove the glyphs and renumber the shelves after the run
+	size_t i = 0;
+	while(i < glyph_list.size()) {
+		AtlasGlyph *g = glyph_list[i];
+		if(g->shelf >= first && g->shelf < first + count) {
+			remove_glyph(i);
+		} else {
+			if(g->shelf >= first + count) g->shelf -= count - 1;
+			i++;
+		}
+	}
+
+	AtlasShelf &s = shelves[first];
+	for(int j=1; j<count; j++) {
+		s.height += shelves[first + j].height;
+	}
+	s.used = 0;
+	shelves.erase(shelves.begin() + first + 1, shelves.begin() + first + count);
+
+	place(first, 0, w, glyph);
+	s.used = w;
+	return true;
+}
+
+void GlyphAtlas::remove_glyph(int idx) {
+	AtlasGlyph *g = glyph_list[idx];
+	glyphs.remove(g->key);
+	delete g;
+
+	glyph_list[idx] = glyph_list.back();
+	glyph_list.pop_back();
+	evicted++;
+}
+
+void GlyphAtlas::clear() {
+	for(size_t i=0; i<glyph_list.size(); i++) {
+		delete glyph_list[i];
+	}
+	glyph_list.clear();
+	glyphs.clear();
+	shelves.clear();
+}
+
+bool GlyphAtlas::get_dirty_rows(int *start, int *end) const {
+	*start = dirty_start;
+	*end = dirty_end;
+	return dirty_start != dirty_end;
+}
+
+void GlyphAtlas::clear_dirty() {
+	dirty_start = dirty_end = 0;
+}
+
+unsigned long GlyphAtlas::get_glyph_count() const {
+	return glyph_list.size();
+}
+
+unsigned long GlyphAtlas::get_shelf_count() const {
+	return shelves.size();
+}
+
+unsigned long GlyphAtlas::get_rasterized_count() const {
+	return rasterized;
+}
+
+unsigned long GlyphAtlas::get_evicted_count() const {
+	return evicted;
+}
+
+int fxwt::layout_text(GlyphAtlas *atlas, GlyphSource *src, const char *str, std::vector<GlyphQuad> *quads) {
+	atlas->begin_batch();
+
+	float du = 1.0f / (float)atlas->get_width();
+	float dv = 1.0f / (float)atlas->get_height();
+	int ascent = src->get_ascent();
+	int line_height = src->get_line_height();
+
+	int pen = 0, line = 0, max_width = 0;
+	unsigned int prev = 0;
+	while(*str) {
+		unsigned int code = (unsigned char)*str++;
+
+		if(code == '\n') {
+			max_width = max(max_width, (pen + 32) >> 6);
+			pen = 0;
+			line++;
+			prev = 0;
+			continue;
+		}
+
+		if(prev) pen += src->get_kerning(prev, code);
+
+		const AtlasGlyph *g = atlas->get_glyph(src, code);
+		if(!g) {
+			prev = 0;
+			continue;
+		}
+
+		if(g->shelf != -1) {
+			GlyphQuad q;
+			q.x0 = (float)(((pen + 32) >> 6) + g->left);
+			q.y0 = (float)(line * line_height + ascent - g->top);
+			q.x1 = q.x0 + g->width;
+			q.y1 = q.y0 + g->height;
+
+			// the textures are stored bottom up, so the top row of the atlas is at v = 1
+			q.u0 = g->x * du;
+			q.u1 = (g->x + g->width) * du;
+			q.v0 = 1.0f - g->y * dv;
+			q.v1 = 1.0f - (g->y + g->height) * dv;
+			quads->push_back(q);
+		}
+
+		pen += g->advance;
+		prev = code;
+	}
+
+	return max(max_width, (pen + 32) >> 6);
+}
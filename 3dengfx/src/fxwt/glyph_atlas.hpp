@@ -0,0 +1,157 @@
+/*
+This file is part of fxwt, the window system toolkit of 3dengfx.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Glyph atlas and text layout.
+ *
+ * The glyphs of every font and size are rasterized once, into one alpha
+ * image shared by all the text. They are packed in shelves, rows of glyphs
+ * of about the same height. When the atlas is full, the least recently used
+ * glyphs make room for the new ones: a few neighbouring glyphs of a shelf
+ * if their slots are wide enough, otherwise whole shelves, merged into one
+ * if a single one isn't tall enough. The glyphs fetched since the last begin_batch() are
+ * never evicted, so the glyphs of a string stay in place until it's drawn.
+ *
+ * Nothing here needs a graphics context. The glyphs come from a
+ * GlyphSource, which only rasterizes them. text.cpp implements one with
+ * freetype, uploads the changed rows of the atlas into a texture and
+ * draws the quads of layout_text().
+ */
+
+#ifndef _GLYPH_ATLAS_HPP_
+#define _GLYPH_ATLAS_HPP_
+
+#include <vector>
+#include "common/hashtable.hpp"
+
+namespace fxwt {
+
+	struct GlyphBitmap {
+		int width, height, pitch;
+		const unsigned char *pixels;
+		int left, top;		// from the pen to the top left of the bitmap, y up
+		int advance;		// in 1/64 pixels
+	};
+
+	class GlyphSource {
+	public:
+		virtual ~GlyphSource();
+
+		// different for every source drawing from the same atlas
+		virtual unsigned int get_id() const = 0;
+
+		// the bitmap stays valid until the next call
+		virtual bool render_glyph(unsigned int code, GlyphBitmap *bmp) = 0;
+		// the adjustment of the advance between two characters, in 1/64 pixels
+		virtual int get_kerning(unsigned int left, unsigned int right) = 0;
+
+		virtual int get_ascent() const = 0;
+		virtual int get_line_height() const = 0;
+	};
+
+	struct GlyphKey {
+		unsigned int source, code;
+
+		inline bool operator ==(const GlyphKey &k) const {return source == k.source && code == k.code;}
+	};
+}
+
+template <>
+struct HashTraits<fxwt::GlyphKey> {
+	static uint32_t hash(const fxwt::GlyphKey &key) {
+		return int_hash(int_hash(key.source) ^ key.code);
+	}
+};
+
+namespace fxwt {
+
+	struct AtlasGlyph {
+		GlyphKey key;
+		int x, y;				// of the bitmap in the atlas, from the top left
+		int width, height;
+		int slot_width;			// taken in its shelf, at least width
+		int shelf;				// -1 for glyphs without a bitmap (spaces)
+		int left, top, advance;
+		unsigned long last_used;
+	};
+
+	struct AtlasShelf {
+		int y, height;
+		int used;				// width taken from the left
+	};
+
+	struct GlyphQuad {
+		float x0, y0, x1, y1;	// pixels from the top left of the text, y down
+		float u0, v0, u1, v1;	// in the atlas texture, v up
+	};
+
+	class GlyphAtlas {
+	private:
+		int width, height;
+		std::vector<unsigned char> pixels;
+		std::vector<AtlasShelf> shelves;
+
+		HashTable<GlyphKey, AtlasGlyph*> glyphs;
+		std::vector<AtlasGlyph*> glyph_list;
+		unsigned long batch;
+
+		int dirty_start, dirty_end;
+		unsigned long rasterized, evicted;
+
+		bool alloc_slot(int w, int h, AtlasGlyph *glyph);
+		bool evict_slots(int w, int h, AtlasGlyph *glyph);
+		bool evict_shelves(int w, int h, AtlasGlyph *glyph);
+		void remove_glyph(int idx);
+		void place(int shelf, int x, int slot_width, AtlasGlyph *glyph);
+
+		GlyphAtlas(const GlyphAtlas &atlas);
+		GlyphAtlas &operator =(const GlyphAtlas &atlas);
+
+	public:
+		GlyphAtlas(int width = 512, int height = 512);
+		~GlyphAtlas();
+
+		void begin_batch();
+
+		// rasterizes the glyph if it's not in the atlas, returns 0 if it doesn't fit
+		const AtlasGlyph *get_glyph(GlyphSource *src, unsigned int code);
+		void clear();
+
+		inline int get_width() const {return width;}
+		inline int get_height() const {return height;}
+		inline const unsigned char *get_pixels() const {return &pixels[0];}
+
+		// the rows changed since the last clear_dirty(), false if none
+		bool get_dirty_rows(int *start, int *end) const;
+		void clear_dirty();
+
+		unsigned long get_glyph_count() const;
+		unsigned long get_shelf_count() const;
+		unsigned long get_rasterized_count() const;
+		unsigned long get_evicted_count() const;
+	};
+
+	/* lays out the string, lines separated by '\n', as one quad per glyph
+	 * with a bitmap. Starts a new batch of the atlas, and returns the width
+	 * of the widest line in pixels.
+	 */
+	int layout_text(GlyphAtlas *atlas, GlyphSource *src, const char *str, std::vector<GlyphQuad> *quads);
+}
+
+#endif	/* _GLYPH_ATLAS_HPP_ */
@@ -37,23 +37,48 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "common/hashtable.hpp"
 #include "dsys/demosys.hpp"
 #include "common/err_msg.h"
-#include "common/string_hash.hpp"
 #include "gfx/img_manip.hpp"
+#include "glyph_atlas.hpp"
+#include "3dengfx/3denginefx.hpp"
 
 using namespace std;
 using namespace fxwt;
 
+#define ATLAS_SIZE		512
+
 struct Text {
 	Texture *texture;
 	scalar_t aspect;
 };
 
+// the glyphs of a face at one size
+class FtGlyphSource : public GlyphSource {
+private:
+	FT_Face face;
+	int size;
+	unsigned int id;
+
+public:
+	FtGlyphSource(FT_Face face, int size, unsigned int id);
+
+	inline FT_Face get_face() const {return face;}
+	inline int get_size() const {return size;}
+
+	virtual unsigned int get_id() const;
+	virtual bool render_glyph(unsigned int code, GlyphBitmap *bmp);
+	virtual int get_kerning(unsigned int left, unsigned int right);
+	virtual int get_ascent() const;
+	virtual int get_line_height() const;
+};
+
 static const char *find_font_file(const char *font);
 static string gen_key_str(const char *text);
 static void draw_free_type_bitmap(FT_Bitmap *ftbm, PixelBuffer *pbuf, int x, int y);
 static PixelBuffer *create_text_image(const char *str, FT_Face face, int font_size);
 static int next_pow_two(int num);
 static Texture *pixel_buf_to_texture(const PixelBuffer &pbuf);
+static FtGlyphSource *get_glyph_source();
+static void update_atlas_texture();
 
 static FT_LibraryRec_ *ft;
 static vector<FT_FaceRec_*> face_list;
@@ -63,6 +88,12 @@ static int font_size = 64;
 static scalar_t latest_fetched_aspect = 1;
 static TextRenderMode render_mode = TEXT_TRANSPARENT;
 
+static GlyphAtlas *atlas;
+static vector<FtGlyphSource*> glyph_sources;
+static Texture *atlas_tex;
+static PixelBuffer *atlas_img;
+static TextRenderMode atlas_mode;
+
 /* This list MUST correspond to the enum Font at text.hpp
  * so take care to keep them in sync.
  */
@@ -103,8 +134,6 @@ bool fxwt::text_init() {
 	
 	set_verbosity(2);
 
-	text_table.set_hash_function(string_hash);
-
 	if(FT_Init_FreeType(&ft) != 0) return false;
 	
 	static const char *fonts[] = {
@@ -137,6 +166,17 @@ bool fxwt::text_init() {
 void fxwt::text_close() {
 	// TODO: free the textures
 	
+	for(size_t i=0; i<glyph_sources.size(); i++) {
+		delete glyph_sources[i];
+	}
+	glyph_sources.clear();
+	delete atlas;
+	delete atlas_img;
+	delete atlas_tex;
+	atlas = 0;
+	atlas_img = 0;
+	atlas_tex = 0;
+
 	for(size_t i=0; i<face_list.size(); i++) {
 		FT_Done_Face(face_list[i]);
 	}
@@ -178,8 +218,10 @@ const char *fxwt::get_font_name(Font fnt) {
 }
 
 Texture *fxwt::get_text(const char *text_str) {
+	string key = gen_key_str(text_str);
+
 	Pair<string, Text> *res;
-	if((res = text_table.find(gen_key_str(text_str)))) {
+	if((res = text_table.find(key))) {
 		latest_fetched_aspect = res->val.aspect;
 		return res->val.texture;
 	}
@@ -190,18 +232,81 @@ Texture *fxwt::get_text(const char *text_str) {
 	delete text_img;
 
 	Text text = {tex, aspect};
-	text_table.insert(gen_key_str(text_str), text);
+	text_table.insert(key, text);
 	
 	latest_fetched_aspect = aspect;
 	return tex;
 }
 
 
+/* print_text
+ * lays the string out from the glyph atlas, and draws it as a single batch
+ * of quads. The size is the height of a line, at font_size * 1.5 pixels,
+ * as with the texture of get_text.
+ */
 void fxwt::print_text(const char *text_str, const Vector2 &pos, scalar_t size, const Color &col) {
-	Texture *tex = get_text(text_str);
-	Vector2 sz_vec(size * latest_fetched_aspect, size);
-	
-	dsys::overlay(tex, pos, pos + sz_vec, col);
+	static vector<GlyphQuad> quads;
+	static vector<Vertex> verts;
+
+	FtGlyphSource *src = get_glyph_source();
+	if(!src) return;
+
+	quads.clear();
+	layout_text(atlas, src, text_str, &quads);
+	if(quads.empty()) return;
+
+	update_atlas_texture();
+
+	scalar_t scale = size / (scalar_t)src->get_line_height();
+	verts.resize(quads.size() * 4);
+	for(size_t i=0; i<quads.size(); i++) {
+		const GlyphQuad &q = quads[i];
+		scalar_t x0 = pos.x + q.x0 * scale, y0 = pos.y + q.y0 * scale;
+		scalar_t x1 = pos.x + q.x1 * scale, y1 = pos.y + q.y1 * scale;
+
+		verts[i * 4] = Vertex(Vector3(x0, y0, -0.5), q.u0, q.v0, col);
+		verts[i * 4 + 1] = Vertex(Vector3(x1, y0, -0.5), q.u1, q.v0, col);
+		verts[i * 4 + 2] = Vertex(Vector3(x1, y1, -0.5), q.u1, q.v1, col);
+		verts[i * 4 + 3] = Vertex(Vector3(x0, y1, -0.5), q.u0, q.v1, col);
+	}
+
+	Matrix4x4 world = get_matrix(XFORM_WORLD);
+	Matrix4x4 view = get_matrix(XFORM_VIEW);
+	Matrix4x4 proj = get_matrix(XFORM_PROJECTION);
+
+	// glOrtho(0, 1, 1, 0, 0, 1), like dsys::overlay
+	set_matrix(XFORM_WORLD, Matrix4x4());
+	set_matrix(XFORM_VIEW, Matrix4x4());
+	set_matrix(XFORM_PROJECTION, Matrix4x4(2, 0, 0, -1, 0, -2, 0, 1, 0, 0, -2, -1, 0, 0, 0, 1));
+
+	set_lighting(false);
+	set_zbuffering(false);
+	set_backface_culling(false);
+	set_alpha_blending(true);
+	set_blend_func(BLEND_SRC_ALPHA, BLEND_ONE_MINUS_SRC_ALPHA);
+
+	enable_texture_unit(0);
+	disable_texture_unit(1);
+	set_texture_unit_color(0, TOP_MODULATE, TARG_TEXTURE, TARG_COLOR);
+	set_texture_unit_alpha(0, TOP_MODULATE, TARG_TEXTURE, TARG_COLOR);
+	set_texture_coord_index(0, 0);
+	set_texture(0, atlas_tex);
+	set_texture_addressing(0, TEXADDR_CLAMP, TEXADDR_CLAMP);
+
+	set_primitive_type(QUAD_LIST);
+	draw(VertexArray(&verts[0], verts.size(), FRAME_MEM_GEOMETRY));
+	set_primitive_type(TRIANGLE_LIST);
+
+	set_texture_addressing(0, TEXADDR_WRAP, TEXADDR_WRAP);
+	disable_texture_unit(0);
+	set_alpha_blending(false);
+	set_backface_culling(true);
+	set_zbuffering(true);
+	set_lighting(true);
+
+	set_matrix(XFORM_WORLD, world);
+	set_matrix(XFORM_VIEW, view);
+	set_matrix(XFORM_PROJECTION, proj);
 }
 
 static const char *find_font_file(const char *font) {
@@ -323,6 +428,110 @@ static PixelBuffer *create_text_image(const char *str, FT_Face face, int font_si
 	return pbuf;
 }
 
+FtGlyphSource::FtGlyphSource(FT_Face face, int size, unsigned int id) {
+	this->face = face;
+	this->size = size;
+	this->id = id;
+}
+
+unsigned int FtGlyphSource::get_id() const {
+	return id;
+}
+
+bool FtGlyphSource::render_glyph(unsigned int code, GlyphBitmap *bmp) {
+	FT_Set_Pixel_Sizes(face, 0, size);
+	if(FT_Load_Char(face, code, FT_LOAD_RENDER) != 0) {
+		return false;
+	}
+
+	FT_GlyphSlot slot = face->glyph;
+	bmp->width = slot->bitmap.width;
+	bmp->height = slot->bitmap.rows;
+	bmp->pitch = slot->bitmap.pitch;
+	bmp->pixels = slot->bitmap.buffer;
+	bmp->left = slot->bitmap_left;
+	bmp->top = slot->bitmap_top;
+	bmp->advance = slot->advance.x;
+	return true;
+}
+
+int FtGlyphSource::get_kerning(unsigned int left, unsigned int right) {
+	if(!FT_HAS_KERNING(face)) return 0;
+
+	FT_Vector delta;
+	FT_Set_Pixel_Sizes(face, 0, size);
+	if(FT_Get_Kerning(face, FT_Get_Char_Index(face, left), FT_Get_Char_Index(face, right),
+				FT_KERNING_DEFAULT, &delta) != 0) {
+		return 0;
+	}
+	return delta.x;
+}
+
+// the baseline of the first line and the line height, as create_text_image places them
+int FtGlyphSource::get_ascent() const {
+	return size;
+}
+
+int FtGlyphSource::get_line_height() const {
+	return (int)(size * 1.5);
+}
+
+// the source of the current font and size, and the atlas the first time
+static FtGlyphSource *get_glyph_source() {
+	if(!font) return 0;
+
+	if(!atlas) {
+		atlas = new GlyphAtlas(ATLAS_SIZE, ATLAS_SIZE);
+	}
+
+	for(size_t i=0; i<glyph_sources.size(); i++) {
+		if(glyph_sources[i]->get_face() == font && glyph_sources[i]->get_size() == font_size) {
+			return glyph_sources[i];
+		}
+	}
+
+	FtGlyphSource *src = new FtGlyphSource(font, font_size, glyph_sources.size());
+	glyph_sources.push_back(src);
+	return src;
+}
+
+/* update_atlas_texture
+ * converts the rows of the atlas changed since the last update (or all of
+ * them with a different render mode) and uploads just those rows.
+ */
+static void update_atlas_texture() {
+	int start, end;
+	if(!atlas_img) {
+		atlas_img = new PixelBuffer(atlas->get_width(), atlas->get_height());
+		start = 0;
+		end = atlas->get_height();
+	} else if(atlas_mode != render_mode) {
+		start = 0;
+		end = atlas->get_height();
+	} else if(!atlas->get_dirty_rows(&start, &end)) {
+		return;
+	}
+	atlas_mode = render_mode;
+
+	const unsigned char *sptr = atlas->get_pixels() + start * atlas->get_width();
+	Pixel *dptr = atlas_img->buffer + start * atlas_img->width;
+	for(int i=start * atlas->get_width(); i<end * atlas->get_width(); i++) {
+		Pixel pixel = *sptr++;
+
+		if(render_mode == TEXT_TRANSPARENT) {
+			*dptr++ = 0x00ffffff | (pixel << 24);
+		} else {
+			*dptr++ = 0xff000000 | (pixel << 8) | (pixel << 16) | pixel;
+		}
+	}
+	atlas->clear_dirty();
+
+	if(!atlas_tex) {
+		atlas_tex = new Texture(atlas->get_width(), atlas->get_height());
+	}
+	atlas_tex->set_pixel_rows(*atlas_img, start, end);
+}
+
 static int next_pow_two(int num) {
 	int val = 1;
 	while(val < num) val <<= 1;
@@ -73,6 +73,10 @@ namespace fxwt {
 
 	const char *get_font_name(Font fnt);
 
+	/* a texture of the whole string, kept until the program exits, so
+	 * it's best left for strings that don't change. print_text draws from
+	 * a glyph atlas shared by all the text instead (see glyph_atlas.hpp).
+	 */
 	Texture *get_text(const char *text_str);
 
 	void print_text(const char *text_str, const Vector2 &pos, scalar_t size, const Color &col = Color(1,1,1));
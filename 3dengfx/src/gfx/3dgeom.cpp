@@ -29,10 +29,13 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <cfloat>
 #include <algorithm>
 #include "3dgeom.hpp"
 #include "common/psort.hpp"
+#include "common/threads.h"
+#include "meshopt.hpp"
 
 #ifdef USING_3DENGFX
 #include "3dengfx/3denginefx.hpp"
@@ -165,23 +168,30 @@ void Quad::calculate_normal(const Vertex *vbuffer, bool normalize) {
 ///////////////////////////////////////////
 
 GeometryArray<Index>::GeometryArray(bool dynamic) {
-	data = 0;
-	count = 0;
-	buffer_object = INVALID_VBO;
-	vbo_in_sync = false;
-
+	buf = new GeometryBuffer<Index>;
 	set_dynamic(dynamic);
 }
 
 GeometryArray<Index>::GeometryArray(const Index *data, unsigned long count, bool dynamic) {
-	this->data = 0;
-	this->count = 0;
-	buffer_object = INVALID_VBO;
+	buf = new GeometryBuffer<Index>;
 	set_dynamic(dynamic);
 
 	set_data(data, count);
 }
 
+GeometryArray<Index>::GeometryArray(const Index *data, unsigned long count, frame_mem_tag tag) {
+	size_t hdr_size = (sizeof(GeometryBuffer<Index>) + 15) & ~(size_t)15;
+	char *mem = (char*)frame_alloc(hdr_size + count * sizeof(Index), tag);
+
+	buf = new(mem) GeometryBuffer<Index>;
+	buf->data = (Index*)(mem + hdr_size);
+	memcpy(buf->data, data, count * sizeof(Index));
+	buf->count = buf->capacity = count;
+	buf->ref_count = 2;		// the frame arena's reference, see 3dgeom.inl
+	buf->in_arena = true;
+	dynamic = true;
+}
+
 void tri_to_index_array(GeometryArray<Index> *ia, const GeometryArray<Triangle> &ta) {
 	ia->dynamic = ta.get_dynamic();
 
@@ -195,51 +205,73 @@ void tri_to_index_array(GeometryArray<Index> *ia, const GeometryArray<Triangle>
 		}
 	}
 
-	ia->set_data(tmp_data, tcount * 3);
-	delete [] tmp_data;
+	ia->adopt_data(tmp_data, tcount * 3);
 }
 
 GeometryArray<Index>::GeometryArray(const GeometryArray<Triangle> &tarray) {
+	buf = new GeometryBuffer<Index>;
 	tri_to_index_array(this, tarray);
 }
 
 GeometryArray<Index>::GeometryArray(const GeometryArray<Index> &ga) {
-	data = 0;
-	count = 0;
-	buffer_object = INVALID_VBO;
+	buf = ga.buf;
+	buf->ref_count++;
 	dynamic = ga.dynamic;
 
-	set_data(ga.data, ga.count);
+	if(buf->in_arena) detach();
 }
 
 GeometryArray<Index>::~GeometryArray() {
-	if(data) {
-		delete [] data;
+	release();
+}
+
+GeometryArray<Index> &GeometryArray<Index>::operator =(const GeometryArray<Index> &ga) {
+	if(buf != ga.buf) {
+		ga.buf->ref_count++;
+		release();
+		buf = ga.buf;
 	}
+	dynamic = ga.dynamic;
+
+	if(buf->in_arena) detach();
+	return *this;
+}
+
+void GeometryArray<Index>::release() {
+	if(--buf->ref_count > 0) return;
+
+	delete [] buf->data;
 #ifdef USING_3DENGFX
-	if(buffer_object != INVALID_VBO) {
-		glDeleteBuffers(1, &buffer_object);
+	if(buf->buffer_object != INVALID_VBO) {
+		glDeleteBuffers(1, &buf->buffer_object);
 	}
 #endif	// USING_3DENGFX
+	delete buf;
 }
 
-GeometryArray<Index> &GeometryArray<Index>::operator =(const GeometryArray<Index> &ga) {
-	dynamic = ga.dynamic;
-	if(data) delete [] data;
+void GeometryArray<Index>::detach() {
+	if(buf->ref_count == 1) return;
 
-	set_data(ga.data, ga.count);
+	GeometryBuffer<Index> *new_buf = new GeometryBuffer<Index>;
+	if(buf->count) {
+		new_buf->data = new Index[buf->count];
+		memcpy(new_buf->data, buf->data, buf->count * sizeof(Index));
+		PROF_COUNT(PROF_ALLOCS, 1);
+	}
+	new_buf->count = new_buf->capacity = buf->count;
 
-	return *this;
+	buf->ref_count--;
+	buf = new_buf;
 }
 
 void GeometryArray<Index>::sync_buffer_object() {
 #ifdef USING_3DENGFX
 	if(dynamic) return;
 
-	if(buffer_object == INVALID_VBO) {
-		glGenBuffers(1, &buffer_object);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, buffer_object);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, count * sizeof(Index), data, GL_STATIC_DRAW_ARB);
+	if(buf->buffer_object == INVALID_VBO) {
+		glGenBuffers(1, &buf->buffer_object);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, buf->buffer_object);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, buf->count * sizeof(Index), buf->data, GL_STATIC_DRAW_ARB);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
 	} else {
 
@@ -247,42 +279,103 @@ void GeometryArray<Index>::sync_buffer_object() {
 		while((glerr = glGetError()) != GL_NO_ERROR) {
 			std::cerr << get_glerror_string(glerr) << " ";
 		}
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, buffer_object);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, buf->buffer_object);
 		
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, count * sizeof(Index), data, GL_STATIC_DRAW_ARB);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, buf->count * sizeof(Index), buf->data, GL_STATIC_DRAW_ARB);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
 	}
 #endif	// USING_3DENGFX
-	vbo_in_sync = true;
+	buf->vbo_in_sync = true;
 
 }
 
 void GeometryArray<Index>::set_data(const Index *data, unsigned long count) {
 	if(!data) return;
-	if(!this->data || count != this->count) {
-		if(this->data) {
-			delete [] this->data;
-		}
-		this->data = new Index[count];
+
+	// shared data is about to be overwritten, no point in copying it
+	if(buf->ref_count > 1) {
+		buf->ref_count--;
+		buf = new GeometryBuffer<Index>;
+	}
+
+	if(!buf->data || count > buf->capacity) {
+		delete [] buf->data;
+		buf->data = new Index[count];
+		buf->capacity = count;
+		PROF_COUNT(PROF_ALLOCS, 1);
 	}
 
-	memcpy(this->data, data, count * sizeof(Index));
+	memcpy(buf->data, data, count * sizeof(Index));
+	buf->count = count;
+	buf->vbo_in_sync = false;
 
 #ifdef USING_3DENGFX
 	if(!dynamic) {
-		if(buffer_object != INVALID_VBO && count != this->count) {
-			glDeleteBuffers(1, &buffer_object);
-		}
 		sync_buffer_object();
-		vbo_in_sync = true;
 	}
 #endif	// USING_3DENGFX
+}
+
+void GeometryArray<Index>::adopt_data(Index *data, unsigned long count) {
+	if(buf->ref_count > 1) {
+		buf->ref_count--;
+		buf = new GeometryBuffer<Index>;
+	}
+
+	if(buf->data != data) {
+		delete [] buf->data;
+	}
+	buf->data = data;
+	buf->count = buf->capacity = count;
+	buf->vbo_in_sync = false;
+
+#ifdef USING_3DENGFX
+	if(!dynamic) {
+		sync_buffer_object();
+	}
+#endif	// USING_3DENGFX
+}
+
+void GeometryArray<Index>::swap(GeometryArray<Index> &ga) {
+	GeometryBuffer<Index> *tmp_buf = buf;
+	buf = ga.buf;
+	ga.buf = tmp_buf;
+
+	bool tmp_dynamic = dynamic;
+	dynamic = ga.dynamic;
+	ga.dynamic = tmp_dynamic;
+}
+
+void GeometryArray<Index>::reserve(unsigned long count) {
+	detach();
+	if(buf->data && count <= buf->capacity) return;
 
-	this->count = count;
+	Index *tmp = new Index[count];
+	if(buf->data) {
+		memcpy(tmp, buf->data, buf->count * sizeof(Index));
+		delete [] buf->data;
+	}
+	buf->data = tmp;
+	buf->capacity = count;
+}
+
+void GeometryArray<Index>::resize(unsigned long count) {
+	detach();
+	if(count > buf->capacity) {
+		reserve(count > buf->capacity * 2 ? count : buf->capacity * 2);
+	}
+	buf->count = count;
+	buf->vbo_in_sync = false;
 }
 
 
 ///////////// Triangle Mesh Implementation /////////////
+static volatile unsigned long last_revision;
+
+unsigned long TriMesh::new_revision() {
+	return thr_atomic_inc(&last_revision);
+}
+
 TriMesh::TriMesh() {
 	indices_valid = false;
 	vertex_stats_valid = false;
@@ -290,6 +383,8 @@ TriMesh::TriMesh() {
 	index_graph_valid = false;
 	triangle_normals_valid = false;
 	triangle_normals_normalized = false;
+	optimized = false;
+	revision = new_revision();
 }
 
 TriMesh::TriMesh(const Vertex *vdata, unsigned long vcount, const Triangle *tdata, unsigned long tcount) {
@@ -299,9 +394,53 @@ TriMesh::TriMesh(const Vertex *vdata, unsigned long vcount, const Triangle *tdat
 	index_graph_valid = false;
 	triangle_normals_valid = false;
 	triangle_normals_normalized = false;
+	optimized = false;
+	revision = new_revision();
 	set_data(vdata, vcount, tdata, tcount);
 }
 
+/* TriMesh copy constructor
+ * the index array is built before it's shared, so that the copies don't
+ * each build their own later on (possibly while drawing from the thread
+ * pool, see RenderQueue). Same for operator =.
+ */
+TriMesh::TriMesh(const TriMesh &mesh) : varray(mesh.varray), tarray(mesh.tarray),
+		iarray(*mesh.get_index_array()), index_graph(mesh.index_graph), earray(mesh.earray) {
+	vstats = mesh.vstats;
+	vertex_stats_valid = mesh.vertex_stats_valid;
+	indices_valid = true;
+	edges_valid = mesh.edges_valid;
+	index_graph_valid = mesh.index_graph_valid;
+	triangle_normals_valid = mesh.triangle_normals_valid;
+	triangle_normals_normalized = mesh.triangle_normals_normalized;
+	optimized = mesh.optimized;
+	revision = new_revision();
+}
+
+TriMesh &TriMesh::operator =(const TriMesh &mesh) {
+	if(this == &mesh) return *this;
+
+	mesh.get_index_array();
+
+	varray = mesh.varray;
+	tarray = mesh.tarray;
+	iarray = mesh.iarray;
+	index_graph = mesh.index_graph;
+	earray = mesh.earray;
+
+	vstats = mesh.vstats;
+	vertex_stats_valid = mesh.vertex_stats_valid;
+	indices_valid = mesh.indices_valid;
+	edges_valid = mesh.edges_valid;
+	index_graph_valid = mesh.index_graph_valid;
+	triangle_normals_valid = mesh.triangle_normals_valid;
+	triangle_normals_normalized = mesh.triangle_normals_normalized;
+	optimized = mesh.optimized;
+	revision = new_revision();
+
+	return *this;
+}
+
 void TriMesh::calculate_edges() {
 
 	if (!index_graph_valid)
@@ -317,6 +456,14 @@ void TriMesh::calculate_edges() {
 	// Triangle loop
 	for (unsigned int i=0; i<tcount; i++)
 	{
+		// skip triangles collapsed by welding (e.g. at the poles of a sphere),
+		// they have no area and would only make the adjacency non-manifold
+		Index w0 = igraph[tris[i].vertices[0]];
+		Index w1 = igraph[tris[i].vertices[1]];
+		Index w2 = igraph[tris[i].vertices[2]];
+		if (w0 == w1 || w1 == w2 || w2 == w0)
+			continue;
+
 		unsigned int a, b, temp;
 		for (unsigned int j=0; j<3; j++)
 		{
@@ -368,12 +515,11 @@ void TriMesh::calculate_edges() {
 		}
 	}
 
-	earray.set_data(edges, num_edges);
+	earray.adopt_data(edges, num_edges);
 	edges_valid = true;
 
 	// cleanup
 	delete [] edge_table;
-	delete [] edges;
 }
 
 void TriMesh::calculate_triangle_normals(bool normalize)
@@ -387,10 +533,11 @@ void TriMesh::calculate_triangle_normals(bool normalize)
 	triangle_normals_normalized = normalize;
 }
 
-const IndexArray *TriMesh::get_index_array() {
+const IndexArray *TriMesh::get_index_array() const {
 	if(!indices_valid) {
-		tri_to_index_array(&iarray, tarray);
-		indices_valid = true;
+		TriMesh *non_const_this = const_cast<TriMesh*>(this);
+		tri_to_index_array(&non_const_this->iarray, tarray);
+		non_const_this->indices_valid = true;
 	}
 	return &iarray;
 }
@@ -407,6 +554,39 @@ void TriMesh::set_data(const Vertex *vdata, unsigned long vcount, const Triangle
 	get_mod_triangle_array()->set_data(tdata, tcount);	// also invalidates indices and edges
 }
 
+void TriMesh::adopt_data(Vertex *vdata, unsigned long vcount, Triangle *tdata, unsigned long tcount) {
+	get_mod_vertex_array()->adopt_data(vdata, vcount);
+	get_mod_triangle_array()->adopt_data(tdata, tcount);
+}
+
+template <class T>
+static inline void swap_values(T &a, T &b) {
+	T tmp = a;
+	a = b;
+	b = tmp;
+}
+
+void TriMesh::swap(TriMesh &mesh) {
+	varray.swap(mesh.varray);
+	tarray.swap(mesh.tarray);
+	iarray.swap(mesh.iarray);
+	index_graph.swap(mesh.index_graph);
+	earray.swap(mesh.earray);
+
+	swap_values(vstats, mesh.vstats);
+	swap_values(vertex_stats_valid, mesh.vertex_stats_valid);
+	swap_values(indices_valid, mesh.indices_valid);
+	swap_values(edges_valid, mesh.edges_valid);
+	swap_values(index_graph_valid, mesh.index_graph_valid);
+	swap_values(triangle_normals_valid, mesh.triangle_normals_valid);
+	swap_values(triangle_normals_normalized, mesh.triangle_normals_normalized);
+	swap_values(optimized, mesh.optimized);
+
+	// both have changed as far as anyone holding on to a revision is concerned
+	revision = new_revision();
+	mesh.revision = new_revision();
+}
+
 void TriMesh::calculate_normals_by_index() {
 	// precalculate which triangles index each vertex
 	std::vector<unsigned int> *tri_indices;
@@ -496,7 +676,7 @@ void TriMesh::normalize_normals() {
  * inverts the order of vertices (cw/ccw) as well as the normals
  */
 void TriMesh::invert_winding() {
-	Triangle *tptr = tarray.get_mod_data();
+	Triangle *tptr = get_mod_triangle_array()->get_mod_data();
 	int tcount = tarray.get_count();
 
 	for(int i=0; i<tcount; i++) {
@@ -551,7 +731,7 @@ void TriMesh::calculate_tangents() {
 }
 
 void TriMesh::apply_xform(const Matrix4x4 &xform) {
-	Vertex *vptr = varray.get_mod_data();
+	Vertex *vptr = get_mod_vertex_array()->get_mod_data();
 	unsigned long count = varray.get_count();
 
 	for(unsigned long i=0; i<count; i++) {
@@ -603,6 +783,70 @@ void TriMesh::sort_triangles(Vector3 point, bool hilo)
 	delete [] tri_distances;
 }
 
+/* TriMesh::optimize
+ * the triangles keep their normals and the vertices keep their positions,
+ * only the vertex and index arrays that depend on the order are rebuilt.
+ */
+void TriMesh::optimize(bool overdraw, MeshOptStats *stats) {
+	unsigned long vcount = varray.get_count();
+	unsigned long tcount = tarray.get_count();
+	if(!tcount) return;
+
+	const Index *indices = get_index_array()->get_data();
+	scalar_t acmr = calc_acmr(indices, tcount * 3, vcount);
+
+	vector<uint32_t> order(tcount);
+	optimize_vertex_cache(&order[0], indices, tcount, vcount);
+	if(overdraw) {
+		optimize_overdraw(&order[0], indices, tcount, varray.get_data(), vcount);
+	}
+
+	const Triangle *src_tris = tarray.get_data();
+	Triangle *tris = new Triangle[tcount];
+	for(unsigned long i=0; i<tcount; i++) {
+		tris[i] = src_tris[order[i]];
+	}
+
+	vector<uint32_t> remap(vcount);
+	Index *sorted = new Index[tcount * 3];
+	for(unsigned long i=0; i<tcount; i++) {
+		memcpy(sorted + i * 3, tris[i].vertices, sizeof tris[i].vertices);
+	}
+	unsigned long used = optimize_vertex_fetch(&remap[0], sorted, tcount * 3, vcount);
+
+	const Vertex *src_verts = varray.get_data();
+	Vertex *verts = new Vertex[vcount];
+	for(unsigned long i=0; i<vcount; i++) {
+		verts[remap[i]] = src_verts[i];
+	}
+	for(unsigned long i=0; i<tcount * 3; i++) {
+		sorted[i] = remap[sorted[i]];
+	}
+	for(unsigned long i=0; i<tcount; i++) {
+		memcpy(tris[i].vertices, sorted + i * 3, sizeof tris[i].vertices);
+	}
+
+	bool stats_valid = vertex_stats_valid;
+	bool tnorm_valid = triangle_normals_valid, tnorm_normalized = triangle_normals_normalized;
+
+	adopt_data(verts, vcount, tris, tcount);
+	iarray.adopt_data(sorted, tcount * 3);
+	iarray.set_dynamic(tarray.get_dynamic());
+	indices_valid = true;
+
+	vertex_stats_valid = stats_valid;
+	triangle_normals_valid = tnorm_valid;
+	triangle_normals_normalized = tnorm_normalized;
+	optimized = true;
+
+	if(stats) {
+		stats->acmr_before = acmr;
+		stats->acmr_after = calc_acmr(iarray.get_data(), tcount * 3, vcount);
+		stats->atvr_before = used ? acmr * tcount / used : 0.0;
+		stats->atvr_after = used ? stats->acmr_after * tcount / used : 0.0;
+	}
+}
+
 VertexStatistics TriMesh::get_vertex_stats() const {
 	if(!vertex_stats_valid) {
 		vstats.xmin = vstats.ymin = vstats.zmin = FLT_MAX;
@@ -646,85 +890,112 @@ VertexStatistics TriMesh::get_vertex_stats() const {
 	return vstats;
 }
 
-/* get_contour_edges - (MG, JT)
- * returns the contour edges relative to the given point of view or direction
- * The edges are in clockwise order, so they can be used to create a shadow volume
- * mesh by extruding them...
+/* prepare_adjacency
+ * makes sure the welded edge list and the triangle normals are up to date,
+ * which is all get_facing/get_silhouette need. Call it before extracting
+ * silhouettes of the same mesh from multiple threads.
+ */
+void TriMesh::prepare_adjacency() {
+	if(!edges_valid) {
+		calculate_edges();
+	}
+	if(!triangle_normals_valid) {
+		calculate_triangle_normals(false);
+	}
+}
+
+/* get_facing
+ * fills a bitset with one bit per triangle, set for the triangles facing
+ * away from the given point of view (or along the given direction).
  * NOTE: pov_or_dir should be given in model space
  */
-std::vector<Edge> *TriMesh::get_contour_edges(const Vector3 &pov_or_dir, bool dir)
+void TriMesh::get_facing(const Vector3 &pov_or_dir, bool dir, std::vector<uint32_t> *facing) const
 {
-	static std::vector<Edge> cont_edges;
-	
-	// calculate triangle normals
 	if(!triangle_normals_valid) {
-		calculate_triangle_normals(false);
+		const_cast<TriMesh*>(this)->calculate_triangle_normals(false);
 	}
-	
-	const Vertex *va = get_vertex_array()->get_data();
-	unsigned long vc = get_vertex_array()->get_count();
-	const Triangle *ta = get_triangle_array()->get_data();
-	unsigned long tc = get_triangle_array()->get_count();
-	
-	vector<Edge> *vert_edge = new vector<Edge>[vc];
-	
-	Vector3 direction = pov_or_dir;
+
+	const Vertex *va = varray.get_data();
+	const Triangle *ta = tarray.get_data();
+	unsigned long tc = tarray.get_count();
+
+	facing->assign((tc + 31) / 32, 0);
+	uint32_t *bits = tc ? &(*facing)[0] : 0;
+
 	for(unsigned long i=0; i<tc; i++) {
-		if(!dir) {
-			direction = va[ta[i].vertices[0]].pos - pov_or_dir;
-		}
-		
+		Vector3 direction = dir ? pov_or_dir : va[ta[i].vertices[0]].pos - pov_or_dir;
 		if(dot_product(ta[i].normal, direction) > 0) {
-			for(int j=0; j<3; j++) {
-				int v0idx = j;
-				int v1idx = (j + 1) % 3;
-
-				Index v0 = ta[i].vertices[v0idx];
-				Index v1 = ta[i].vertices[v1idx];
-				
-				Edge edge(v1, v0);
-				std::vector<Edge>::iterator iter = vert_edge[v0].begin();
-				
-				bool found = false;
-				for(unsigned int k=0; k<vert_edge[v0].size(); k++, iter++) {
-					if(vert_edge[v0][k].vertices[1] == v1) {
-						vert_edge[v0].erase(iter);
-						found = true;
-						break;
-					}
-				}
+			bits[i >> 5] |= (uint32_t)1 << (i & 31);
+		}
+	}
+}
 
-				if(!found) {
-					iter = vert_edge[v1].begin();
-					for(unsigned int k=0; k<vert_edge[v1].size(); k++, iter++) {
-						if(vert_edge[v1][k].vertices[0] == v0) {
-							vert_edge[v1].erase(iter);
-							found = true;
-							break;
-						}
-					}
-				}
+/* get_silhouette
+ * walks the edge adjacency and returns the edges separating facing triangles
+ * (as computed by get_facing) from the rest, ordered so that they can be
+ * extruded into a shadow volume with consistent winding. Open edges count as
+ * bordering a non-facing triangle.
+ */
+void TriMesh::get_silhouette(const std::vector<uint32_t> &facing, std::vector<Edge> *edges) const
+{
+	if(!edges_valid) {
+		const_cast<TriMesh*>(this)->calculate_edges();
+	}
 
-				if(!found) vert_edge[v0].push_back(edge);
-				
+	const Triangle *ta = tarray.get_data();
+	const Edge *ea = earray.get_data();
+	unsigned long ec = earray.get_count();
+	const Index *igraph = index_graph.get_data();
+	const uint32_t *bits = facing.empty() ? 0 : &facing[0];
+
+	edges->clear();
+	for(unsigned long i=0; i<ec; i++) {
+		Index a = ea[i].vertices[0];
+		Index b = ea[i].vertices[1];
+		Index f0 = ea[i].adjfaces[0];
+		Index f1 = ea[i].adjfaces[1];
+
+		bool facing0 = f0 != NO_ADJFACE && (bits[f0 >> 5] & ((uint32_t)1 << (f0 & 31)));
+		bool facing1 = f1 != NO_ADJFACE && (bits[f1 >> 5] & ((uint32_t)1 << (f1 & 31)));
+		if(facing0 == facing1) continue;
+
+		// orient the edge opposite to the way the facing triangle traverses it
+		const Triangle &tri = ta[facing0 ? f0 : f1];
+		bool forward = false;
+		for(int j=0; j<3; j++) {
+			if(igraph[tri.vertices[j]] == a && igraph[tri.vertices[(j + 1) % 3]] == b) {
+				forward = true;
+				break;
 			}
-			
 		}
-	}
 
-	cont_edges.clear();
-	for(unsigned int i=0; i<vc; i++) {
-		for(unsigned int j=0; j<vert_edge[i].size(); j++) {
-			cont_edges.push_back(vert_edge[i][j]);
-		}
+		edges->push_back(forward ? Edge(b, a) : Edge(a, b));
 	}
+}
 
-	delete [] vert_edge;
+void TriMesh::get_silhouette(const Vector3 &pov_or_dir, bool dir, std::vector<Edge> *edges) const
+{
+	std::vector<uint32_t> facing;
+	get_facing(pov_or_dir, dir, &facing);
+	get_silhouette(facing, edges);
+}
 
+/* get_contour_edges - (MG, JT)
+ * returns the contour edges relative to the given point of view or direction
+ * The edges are in clockwise order, so they can be used to create a shadow volume
+ * mesh by extruding them...
+ * NOTE: pov_or_dir should be given in model space
+ * NOTE: the returned vector is overwritten by the next call, use get_silhouette
+ * if you need to keep it around.
+ */
+std::vector<Edge> *TriMesh::get_contour_edges(const Vector3 &pov_or_dir, bool dir)
+{
+	static std::vector<Edge> cont_edges;
+	get_silhouette(pov_or_dir, dir, &cont_edges);
 	return &cont_edges;
 }
 
-/* get_uncapped_shadow_volume() - (MG)
+/* get_shadow_volume - (MG)
  * specify pov_or_dir in model space
  * delete the returned mesh after using it
  */
@@ -734,10 +1005,11 @@ TriMesh *TriMesh::get_shadow_volume(const Vector3 &pov_or_dir, bool dir)
 	TriMesh *ret = new TriMesh;
 	
 	const Vertex *va = get_vertex_array()->get_data();
-	std::vector<Edge> *contour_edges = get_contour_edges(pov_or_dir, dir);
+	std::vector<Edge> contour_edges;
+	get_silhouette(pov_or_dir, dir, &contour_edges);
 
 	// calculate number of vertices and indices for the mesh
-	unsigned long num_quads = contour_edges->size();
+	unsigned long num_quads = contour_edges.size();
 	unsigned long num_verts = num_quads * 4;
 	unsigned long num_tris = num_quads * 2;
 
@@ -750,7 +1022,7 @@ TriMesh *TriMesh::get_shadow_volume(const Vector3 &pov_or_dir, bool dir)
 	{
 		for (unsigned long j=0; j<2; j++)
 		{
-			verts[2 * i + j].pos = va[(*contour_edges)[i].vertices[j]].pos;
+			verts[2 * i + j].pos = va[contour_edges[i].vertices[j]].pos;
 		}
 	}
 
@@ -772,12 +1044,7 @@ TriMesh *TriMesh::get_shadow_volume(const Vector3 &pov_or_dir, bool dir)
 		tris[2*i + 1] = Triangle(p1, ep2, p2);
 	}
 	
-	ret->set_data(verts, num_verts, tris, num_tris);
-	
-	// cleanup
-	delete [] verts;
-	delete [] tris;
-
+	ret->adopt_data(verts, num_verts, tris, num_tris);
 	return ret;
 }
 
@@ -855,11 +1122,10 @@ void TriMesh::calculate_index_graph()
 			igraph[vo[parts[i] + j].order] = min_index;
 	}
 
-	index_graph.set_data(igraph, varray.get_count());
+	index_graph.adopt_data(igraph, varray.get_count());
 	index_graph_valid = true;
 	
 	delete [] vo;
-	delete [] igraph;
 }
 
 /* join_tri_mesh - (MG)
@@ -868,28 +1134,41 @@ void TriMesh::calculate_index_graph()
  */
 void join_tri_mesh(TriMesh *ret, const TriMesh *m1, const TriMesh *m2)
 {
-	const Vertex *varr1 = m1->get_vertex_array()->get_data();
 	const Vertex *varr2 = m2->get_vertex_array()->get_data();
-	
+	const Triangle *tarr2 = m2->get_triangle_array()->get_data();
+
 	unsigned long vcount1 = m1->get_vertex_array()->get_count();
 	unsigned long vcount2 = m2->get_vertex_array()->get_count();
 
-	const Triangle *tarr1 = m1->get_triangle_array()->get_data();
-	const Triangle *tarr2 = m2->get_triangle_array()->get_data();
-
 	unsigned long tcount1 = m1->get_triangle_array()->get_count();
 	unsigned long tcount2 = m2->get_triangle_array()->get_count();
 
-	// allocate memory
-	int vcount = vcount1 + vcount2;
-	int tcount = tcount1 + tcount2;
-	Vertex *varray = new Vertex[vcount];
-	Triangle *tarray = new Triangle[tcount];
+	unsigned long vcount = vcount1 + vcount2;
+	unsigned long tcount = tcount1 + tcount2;
+	Vertex *varray;
+	Triangle *tarray;
+
+	/* appending to m1 grows its arrays in place, geometrically, so that
+	 * joining many pieces one at a time doesn't copy everything every time.
+	 */
+	bool append = ret == m1 && ret != m2;
+
+	if(append) {
+		VertexArray *va = ret->get_mod_vertex_array();
+		TriangleArray *ta = ret->get_mod_triangle_array();
+		va->resize(vcount);
+		ta->resize(tcount);
+		varray = va->get_mod_data();
+		tarray = ta->get_mod_data();
+	} else {
+		varray = new Vertex[vcount];
+		tarray = new Triangle[tcount];
+		memcpy(varray, m1->get_vertex_array()->get_data(), vcount1 * sizeof(Vertex));
+		memcpy(tarray, m1->get_triangle_array()->get_data(), tcount1 * sizeof(Triangle));
+	}
 
 	// copy memory
-	memcpy(varray, varr1, vcount1 * sizeof(Vertex));
 	memcpy(varray + vcount1, varr2, vcount2 * sizeof(Vertex));
-	memcpy(tarray, tarr1, tcount1 * sizeof(Triangle));
 	memcpy(tarray + tcount1, tarr2, tcount2 * sizeof(Triangle));
 
 	// Fix indices
@@ -901,11 +1180,9 @@ void join_tri_mesh(TriMesh *ret, const TriMesh *m1, const TriMesh *m2)
 		}
 	}
 	
-	ret->set_data(varray, vcount, tarray, tcount);
-	
-	// cleanup
-	delete [] varray;
-	delete [] tarray;
+	if(!append) {
+		ret->adopt_data(varray, vcount, tarray, tcount);
+	}
 }
 
 /* Nicer join_tri_mesh - (JT)
@@ -34,6 +34,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "n3dmath2/n3dmath2.hpp"
 #include "color.hpp"
+#include "common/arena.h"
+#include "common/profile.h"
 
 #include <iostream>
 #include <vector>
@@ -104,35 +106,76 @@ public:
 
 
 //////////////// Geometry Arrays //////////////
+
+/* The data of a geometry array, along with its buffer object, is shared by
+ * all the copies of the array, and copied only when one of them is about to
+ * modify it (get_mod_data, set_data, reserve, resize). So copying meshes is
+ * cheap, and many objects can draw one mesh from one VBO.
+ * The copies are counted without locking: arrays sharing data must be
+ * copied, modified and destroyed on one thread, reading them from other
+ * threads meanwhile is fine.
+ *
+ * Transient arrays can keep their data in the frame arena (common/arena.h),
+ * these are always dynamic, must not be kept past the end of the frame,
+ * and are copied to the heap if modified. Copies of them get their own copy
+ * of the data on the heap, so that they can outlive the frame.
+ */
 template <class DataType>
-class GeometryArray {
-private:
+struct GeometryBuffer {
 	DataType *data;
-	unsigned long count;
-	bool dynamic;
+	unsigned long count, capacity;
 	unsigned int buffer_object;		// for OGL VBOs
 	bool vbo_in_sync;
+	int ref_count;
+	bool in_arena;
+
+	GeometryBuffer();
+};
+
+template <class DataType>
+class GeometryArray {
+private:
+	GeometryBuffer<DataType> *buf;
+	bool dynamic;
 
 	void sync_buffer_object();
+	void release();
+	void detach();
 
 public:
 	GeometryArray(bool dynamic = true);
 	GeometryArray(const DataType *data, unsigned long count, bool dynamic = true);
+	// transient array with a copy of the data in the frame arena
+	GeometryArray(const DataType *data, unsigned long count, frame_mem_tag tag);
 	GeometryArray(const GeometryArray &ga);
 	~GeometryArray();
 
 	GeometryArray &operator =(const GeometryArray &ga);
 
 	inline void set_data(const DataType *data, unsigned long count);
+	// takes over data allocated with new [], instead of copying it
+	void adopt_data(DataType *data, unsigned long count);
 	inline const DataType *get_data() const;
 	inline DataType *get_mod_data();
 
+	// exchanges the contents of the two arrays, nothing is copied
+	void swap(GeometryArray &ga);
+
 	inline unsigned long get_count() const;
 
+	// preallocate storage, so that set_data/resize up to that count won't reallocate
+	void reserve(unsigned long count);
+	// change the element count, keeping the existing contents
+	void resize(unsigned long count);
+	inline unsigned long get_capacity() const;
+
 	inline void set_dynamic(bool enable);
 	inline bool get_dynamic() const;
 	
 	inline unsigned int get_buffer_object() const;
+
+	// true if the data is shared with other copies of the array
+	inline bool is_shared() const;
 };
 
 
@@ -140,17 +183,17 @@ public:
 template <>
 class GeometryArray<Index> {
 private:
-	Index *data;
-	unsigned long count;
+	GeometryBuffer<Index> *buf;
 	bool dynamic;
-	unsigned int buffer_object;
-	bool vbo_in_sync;
 
 	void sync_buffer_object();
+	void release();
+	void detach();
 
 public:
 	GeometryArray(bool dynamic = true);
 	GeometryArray(const Index *data, unsigned long count, bool dynamic = true);
+	GeometryArray(const Index *data, unsigned long count, frame_mem_tag tag);
 	GeometryArray(const GeometryArray<Triangle> &tarray);	// conversion from triangle data
 	GeometryArray(const GeometryArray &ga);
 	~GeometryArray();
@@ -158,15 +201,24 @@ public:
 	GeometryArray &operator =(const GeometryArray &ga);
 
 	void set_data(const Index *data, unsigned long count);
+	void adopt_data(Index *data, unsigned long count);
 	inline const Index *get_data() const;
 	inline Index *get_mod_data();
 
+	void swap(GeometryArray &ga);
+
 	inline unsigned long get_count() const;
 
+	void reserve(unsigned long count);
+	void resize(unsigned long count);
+	inline unsigned long get_capacity() const;
+
 	inline void set_dynamic(bool enable);
 	inline bool get_dynamic() const;
 
 	inline unsigned int get_buffer_object() const;
+
+	inline bool is_shared() const;
 	
 	friend void tri_to_index_array(GeometryArray<Index> *ia, const GeometryArray<Triangle> &ta);
 };
@@ -176,6 +228,8 @@ typedef GeometryArray<Triangle> TriangleArray;
 typedef GeometryArray<Index> IndexArray;
 
 ////////////// triangle mesh class ////////////
+struct MeshOptStats;	// see meshopt.hpp
+
 struct VertexStatistics {
 	Vector3 centroid;
 	scalar_t min_dist;
@@ -201,6 +255,12 @@ private:
 	bool index_graph_valid;
 	bool triangle_normals_valid;
 	bool triangle_normals_normalized;
+	bool optimized;
+
+	unsigned long revision;
+
+	// unique across all the meshes, so an assigned mesh never looks unchanged
+	static unsigned long new_revision();
 	
 	void calculate_edges();
 	void calculate_index_graph();
@@ -209,6 +269,10 @@ private:
 public:
 	TriMesh();
 	TriMesh(const Vertex *vdata, unsigned long vcount, const Triangle *tdata, unsigned long tcount);
+	// copies share the geometry arrays until modified (see GeometryArray)
+	TriMesh(const TriMesh &mesh);
+
+	TriMesh &operator =(const TriMesh &mesh);
 	
 	inline const VertexArray *get_vertex_array() const;
 	inline VertexArray *get_mod_vertex_array();
@@ -216,10 +280,19 @@ public:
 	inline const TriangleArray *get_triangle_array() const;
 	inline TriangleArray *get_mod_triangle_array();
 	
-	const IndexArray *get_index_array();
+	const IndexArray *get_index_array() const;
 	const GeometryArray<Edge> *get_edge_array() const;
+
+	// changes every time the vertex or triangle data may have changed, no two
+	// meshes (copies included) ever have the same revision
+	inline unsigned long get_revision() const;
 	
 	void set_data(const Vertex *vdata, unsigned long vcount, const Triangle *tdata, unsigned long tcount);	
+	// takes over the arrays (allocated with new []) instead of copying them
+	void adopt_data(Vertex *vdata, unsigned long vcount, Triangle *tdata, unsigned long tcount);
+
+	// exchanges the contents of the two meshes, nothing is copied
+	void swap(TriMesh &mesh);
 
 	void calculate_normals_by_index();
 	void calculate_normals();
@@ -233,10 +306,21 @@ public:
 	void operator +=(const TriMesh *m2);
 
 	void sort_triangles(Vector3 point, bool hilo=true);
+
+	/* reorders the triangles for the vertex cache, and optionally for less
+	 * overdraw, then the vertices in the order they are used (see meshopt.hpp).
+	 */
+	void optimize(bool overdraw = false, MeshOptStats *stats = 0);
+	// true if nothing has changed the mesh since optimize()
+	inline bool is_optimized() const;
 	
 	VertexStatistics get_vertex_stats() const;
 
 	// shadow volumes
+	void prepare_adjacency();
+	void get_facing(const Vector3 &pov_or_dir, bool dir, std::vector<uint32_t> *facing) const;
+	void get_silhouette(const std::vector<uint32_t> &facing, std::vector<Edge> *edges) const;
+	void get_silhouette(const Vector3 &pov_or_dir, bool dir, std::vector<Edge> *edges) const;
 	std::vector<Edge> *get_contour_edges(const Vector3 &pov_or_dir, bool dir = false);
 	//TriMesh *get_uncapped_shadow_volume(const Vector3 &pov_or_dir, bool dir = false);
 	TriMesh *get_shadow_volume(const Vector3 &pov_or_dir, bool dir = false);
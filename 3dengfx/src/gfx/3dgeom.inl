@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include <iostream>
 #include <cstring>
+#include <new>
 
 #ifdef USING_3DENGFX
 #include "3dengfx/3denginefx_types.hpp"
@@ -38,116 +39,236 @@ SysCaps get_system_capabilities();
 #define INVALID_VBO		0
 
 template <class DataType>
-GeometryArray<DataType>::GeometryArray(bool dynamic) {
+GeometryBuffer<DataType>::GeometryBuffer() {
 	data = 0;
-	count = 0;
+	count = capacity = 0;
 	buffer_object = INVALID_VBO;
 	vbo_in_sync = false;
+	ref_count = 1;
+	in_arena = false;
+}
 
+template <class DataType>
+GeometryArray<DataType>::GeometryArray(bool dynamic) {
+	buf = new GeometryBuffer<DataType>;
 	set_dynamic(dynamic);
 }
 
 template <class DataType>
 GeometryArray<DataType>::GeometryArray(const DataType *data, unsigned long count, bool dynamic) {
-	this->data = 0;
-	this->count = 0;
-	buffer_object = INVALID_VBO;
+	buf = new GeometryBuffer<DataType>;
 	set_dynamic(dynamic);
 
 	set_data(data, count);
 }
 
+/* GeometryArray
+ * the buffer goes in the frame arena along with the data, and starts with
+ * an extra reference held by the arena, so that it's never freed, and any
+ * modification or copy of the array makes a copy of it on the heap.
+ */
+template <class DataType>
+GeometryArray<DataType>::GeometryArray(const DataType *data, unsigned long count, frame_mem_tag tag) {
+	size_t hdr_size = (sizeof(GeometryBuffer<DataType>) + 15) & ~(size_t)15;
+	char *mem = (char*)frame_alloc(hdr_size + count * sizeof(DataType), tag);
+
+	buf = new(mem) GeometryBuffer<DataType>;
+	buf->data = (DataType*)(mem + hdr_size);
+	memcpy(buf->data, data, count * sizeof(DataType));
+	buf->count = buf->capacity = count;
+	buf->ref_count = 2;
+	buf->in_arena = true;
+	dynamic = true;
+}
+
 template <class DataType>
 GeometryArray<DataType>::GeometryArray(const GeometryArray<DataType> &ga) {
-	data = 0;
-	count = 0;
+	buf = ga.buf;
+	buf->ref_count++;
 	dynamic = ga.dynamic;
-	buffer_object = INVALID_VBO;
 
-	set_data(ga.data, ga.count);
+	if(buf->in_arena) detach();
 }
 
 template <class DataType>
 GeometryArray<DataType>::~GeometryArray() {
-	if(data) delete [] data;
-#ifdef USING_3DENGFX
-	if(buffer_object != INVALID_VBO) {
-		glext::glDeleteBuffers(1, &buffer_object);
-	}
-#endif	// USING_3DENGFX
+	release();
 }
 
 template <class DataType>
 GeometryArray<DataType> &GeometryArray<DataType>::operator =(const GeometryArray<DataType> &ga) {
+	if(buf != ga.buf) {
+		ga.buf->ref_count++;
+		release();
+		buf = ga.buf;
+	}
 	dynamic = ga.dynamic;
-	if(data) delete [] data;
 
-	set_data(ga.data, ga.count);
-	
+	if(buf->in_arena) detach();
 	return *this;
 }
 
+template <class DataType>
+void GeometryArray<DataType>::release() {
+	if(--buf->ref_count > 0) return;
+
+	delete [] buf->data;
+#ifdef USING_3DENGFX
+	if(buf->buffer_object != INVALID_VBO) {
+		glext::glDeleteBuffers(1, &buf->buffer_object);
+	}
+#endif	// USING_3DENGFX
+	delete buf;
+}
+
+/* detach
+ * gives this array its own copy of the data, if it's shared, before
+ * it gets modified.
+ */
+template <class DataType>
+void GeometryArray<DataType>::detach() {
+	if(buf->ref_count == 1) return;
+
+	GeometryBuffer<DataType> *new_buf = new GeometryBuffer<DataType>;
+	if(buf->count) {
+		new_buf->data = new DataType[buf->count];
+		memcpy(new_buf->data, buf->data, buf->count * sizeof(DataType));
+		PROF_COUNT(PROF_ALLOCS, 1);
+	}
+	new_buf->count = new_buf->capacity = buf->count;
+
+	buf->ref_count--;
+	buf = new_buf;
+}
+
 template <class DataType>
 void GeometryArray<DataType>::sync_buffer_object() {
 #ifdef USING_3DENGFX
 	if(dynamic) return;
 
-	if(buffer_object == INVALID_VBO) {
-		glext::glGenBuffers(1, &buffer_object);
-		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, buffer_object);
-		glext::glBufferData(GL_ARRAY_BUFFER_ARB, count * sizeof(DataType), data, GL_STATIC_DRAW_ARB);
+	if(buf->buffer_object == INVALID_VBO) {
+		glext::glGenBuffers(1, &buf->buffer_object);
+		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, buf->buffer_object);
+		glext::glBufferData(GL_ARRAY_BUFFER_ARB, buf->count * sizeof(DataType), buf->data, GL_STATIC_DRAW_ARB);
 		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
 	} else {
 
 		while(glGetError() != GL_NO_ERROR);
-		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, buffer_object);
+		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, buf->buffer_object);
 
-		glext::glBufferData(GL_ARRAY_BUFFER_ARB, count * sizeof(DataType), data, GL_STATIC_DRAW_ARB);
+		glext::glBufferData(GL_ARRAY_BUFFER_ARB, buf->count * sizeof(DataType), buf->data, GL_STATIC_DRAW_ARB);
 		glext::glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
 	}
 #endif	// USING_3DENGFX
-	vbo_in_sync = true;
+	buf->vbo_in_sync = true;
 }
 
 
 template <class DataType>
 inline void GeometryArray<DataType>::set_data(const DataType *data, unsigned long count) {
 	if(!data) return;
-	if(!this->data || count != this->count) {
-		if(this->data) {
-			delete [] this->data;
-		}
-		this->data = new DataType[count];
+
+	// shared data is about to be overwritten, no point in copying it
+	if(buf->ref_count > 1) {
+		buf->ref_count--;
+		buf = new GeometryBuffer<DataType>;
+	}
+
+	if(!buf->data || count > buf->capacity) {
+		delete [] buf->data;
+		buf->data = new DataType[count];
+		buf->capacity = count;
+		PROF_COUNT(PROF_ALLOCS, 1);
 	}
 	
-	memcpy(this->data, data, count * sizeof(DataType));
-	this->count = count;
+	memcpy(buf->data, data, count * sizeof(DataType));
+	buf->count = count;
+	buf->vbo_in_sync = false;
 
 #ifdef USING_3DENGFX
 	if(!dynamic) {
-		if(buffer_object != INVALID_VBO && count != this->count) {
-			glext::glDeleteBuffers(1, &buffer_object);
-		}
 		sync_buffer_object();
-		vbo_in_sync = true;
 	}
 #endif	// USING_3DENGFX
 }
 
+template <class DataType>
+void GeometryArray<DataType>::adopt_data(DataType *data, unsigned long count) {
+	if(buf->ref_count > 1) {
+		buf->ref_count--;
+		buf = new GeometryBuffer<DataType>;
+	}
+
+	if(buf->data != data) {
+		delete [] buf->data;
+	}
+	buf->data = data;
+	buf->count = buf->capacity = count;
+	buf->vbo_in_sync = false;
+
+#ifdef USING_3DENGFX
+	if(!dynamic) {
+		sync_buffer_object();
+	}
+#endif	// USING_3DENGFX
+}
+
+template <class DataType>
+void GeometryArray<DataType>::swap(GeometryArray<DataType> &ga) {
+	GeometryBuffer<DataType> *tmp_buf = buf;
+	buf = ga.buf;
+	ga.buf = tmp_buf;
+
+	bool tmp_dynamic = dynamic;
+	dynamic = ga.dynamic;
+	ga.dynamic = tmp_dynamic;
+}
+
 template <class DataType>
 inline const DataType *GeometryArray<DataType>::get_data() const {
-	return data;
+	return buf->data;
 }
 
 template <class DataType>
 inline DataType *GeometryArray<DataType>::get_mod_data() {
-	vbo_in_sync = false;
-	return data;
+	detach();
+	buf->vbo_in_sync = false;
+	return buf->data;
 }
 
 template <class DataType>
 inline unsigned long GeometryArray<DataType>::get_count() const {
-	return count;
+	return buf->count;
+}
+
+template <class DataType>
+void GeometryArray<DataType>::reserve(unsigned long count) {
+	detach();
+	if(buf->data && count <= buf->capacity) return;
+
+	DataType *tmp = new DataType[count];
+	if(buf->data) {
+		memcpy(tmp, buf->data, buf->count * sizeof(DataType));
+		delete [] buf->data;
+	}
+	buf->data = tmp;
+	buf->capacity = count;
+}
+
+template <class DataType>
+void GeometryArray<DataType>::resize(unsigned long count) {
+	detach();
+	if(count > buf->capacity) {
+		// grow geometrically so that repeated resizes stay cheap
+		reserve(count > buf->capacity * 2 ? count : buf->capacity * 2);
+	}
+	buf->count = count;
+	buf->vbo_in_sync = false;
+}
+
+template <class DataType>
+inline unsigned long GeometryArray<DataType>::get_capacity() const {
+	return buf->capacity;
 }
 
 template <class DataType>
@@ -171,26 +292,36 @@ inline bool GeometryArray<DataType>::get_dynamic() const {
 
 template <class DataType>
 inline unsigned int GeometryArray<DataType>::get_buffer_object() const {
-	if(!dynamic && !vbo_in_sync) {
+	if(!dynamic && !buf->vbo_in_sync) {
 		const_cast<GeometryArray<DataType>*>(this)->sync_buffer_object();
 	}
 		
-	return buffer_object;
+	return buf->buffer_object;
+}
+
+template <class DataType>
+inline bool GeometryArray<DataType>::is_shared() const {
+	return buf->ref_count > 1;
 }
 
 // inline functions of <index> specialization of GeometryArray
 
 inline const Index *GeometryArray<Index>::get_data() const {
-	return data;
+	return buf->data;
 }
 
 inline Index *GeometryArray<Index>::get_mod_data() {
-	vbo_in_sync = false;
-	return data;
+	detach();
+	buf->vbo_in_sync = false;
+	return buf->data;
 }
 
 inline unsigned long GeometryArray<Index>::get_count() const {
-	return count;
+	return buf->count;
+}
+
+inline unsigned long GeometryArray<Index>::get_capacity() const {
+	return buf->capacity;
 }
 
 inline void GeometryArray<Index>::set_dynamic(bool enable) {
@@ -211,11 +342,15 @@ inline bool GeometryArray<Index>::get_dynamic() const {
 }
 
 inline unsigned int GeometryArray<Index>::get_buffer_object() const {
-	if(!dynamic && !vbo_in_sync) {
+	if(!dynamic && !buf->vbo_in_sync) {
 		const_cast<GeometryArray<Index>*>(this)->sync_buffer_object();
 	}
 
-	return buffer_object;
+	return buf->buffer_object;
+}
+
+inline bool GeometryArray<Index>::is_shared() const {
+	return buf->ref_count > 1;
 }
 
 
@@ -225,6 +360,8 @@ inline const VertexArray *TriMesh::get_vertex_array() const {
 }
 
 inline VertexArray *TriMesh::get_mod_vertex_array() {
+	revision = new_revision();
+	optimized = false;
 	vertex_stats_valid = false;
 	edges_valid = false;
 	index_graph_valid = false;
@@ -237,9 +374,21 @@ inline const TriangleArray *TriMesh::get_triangle_array() const {
 }
 
 inline TriangleArray *TriMesh::get_mod_triangle_array() {
+	revision = new_revision();
+	optimized = false;
 	indices_valid = false;
+	// let go of shared indices now, rather than when they are rebuilt
+	if(iarray.is_shared()) iarray = IndexArray();
 	edges_valid = false;
 	index_graph_valid = false;
 	triangle_normals_valid = triangle_normals_normalized = false;
 	return &tarray;
 }
+
+inline unsigned long TriMesh::get_revision() const {
+	return revision;
+}
+
+inline bool TriMesh::is_optimized() const {
+	return optimized;
+}
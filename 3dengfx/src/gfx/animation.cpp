@@ -30,6 +30,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <algorithm>
 #include "animation.hpp"
 
+#if defined(__SSE__) && defined(SINGLE_PRECISION_MATH)
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
 using std::vector;
 
 
@@ -46,17 +51,91 @@ PRS::PRS(const Vector3 &pos, const Quaternion &rot, const Vector3 &scale, const
 	this->pivot = pivot;
 }
 
+/* get_xform_matrix
+ * builds pivot * translation * rotation * scale * -pivot directly:
+ * the 3x3 part is the rotation with its columns scaled, and the
+ * translation is position + pivot - (rotation * scale) * pivot.
+ */
 Matrix4x4 PRS::get_xform_matrix() const {
-	Matrix4x4 trans_mat, rot_mat, scale_mat, pivot_mat, neg_pivot_mat;
+	Matrix4x4 xform;
+	xform.set_rotation(rotation);
+
+	Vector3 trans = position + pivot;
+	for(int i=0; i<3; i++) {
+		xform[i][0] *= scale.x;
+		xform[i][1] *= scale.y;
+		xform[i][2] *= scale.z;
+		xform[i][3] = trans[i] - (xform[i][0] * pivot.x + xform[i][1] * pivot.y + xform[i][2] * pivot.z);
+	}
+	return xform;
+}
+
+void get_xform_matrices(Matrix4x4 *dest, const PRS *prs, int count) {
+	int i = 0;
+
+#ifdef USE_SSE
+	__m128 one = _mm_set1_ps(1.0f);
+
+	for(; i<count-3; i+=4) {
+		const PRS *p = prs + i;
+
+		__m128 s = _mm_loadu_ps(&p[0].rotation.s);
+		__m128 x = _mm_loadu_ps(&p[1].rotation.s);
+		__m128 y = _mm_loadu_ps(&p[2].rotation.s);
+		__m128 z = _mm_loadu_ps(&p[3].rotation.s);
+		_MM_TRANSPOSE4_PS(s, x, y, z);
+
+		__m128 x2 = _mm_add_ps(x, x);
+		__m128 y2 = _mm_add_ps(y, y);
+		__m128 z2 = _mm_add_ps(z, z);
+
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), yz = _mm_mul_ps(y, z2), zx = _mm_mul_ps(z, x2);
+		__m128 sx = _mm_mul_ps(s, x2), sy = _mm_mul_ps(s, y2), sz = _mm_mul_ps(s, z2);
+
+		__m128 scx = _mm_setr_ps(p[0].scale.x, p[1].scale.x, p[2].scale.x, p[3].scale.x);
+		__m128 scy = _mm_setr_ps(p[0].scale.y, p[1].scale.y, p[2].scale.y, p[3].scale.y);
+		__m128 scz = _mm_setr_ps(p[0].scale.z, p[1].scale.z, p[2].scale.z, p[3].scale.z);
+		__m128 pvx = _mm_setr_ps(p[0].pivot.x, p[1].pivot.x, p[2].pivot.x, p[3].pivot.x);
+		__m128 pvy = _mm_setr_ps(p[0].pivot.y, p[1].pivot.y, p[2].pivot.y, p[3].pivot.y);
+		__m128 pvz = _mm_setr_ps(p[0].pivot.z, p[1].pivot.z, p[2].pivot.z, p[3].pivot.z);
+
+		// rows of the rotation matrices (as in Matrix4x4::set_rotation), scaled
+		__m128 r[3][4];
+		r[0][0] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, yy), zz), scx);
+		r[0][1] = _mm_mul_ps(_mm_add_ps(xy, sz), scy);
+		r[0][2] = _mm_mul_ps(_mm_sub_ps(zx, sy), scz);
+		r[1][0] = _mm_mul_ps(_mm_sub_ps(xy, sz), scx);
+		r[1][1] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx), zz), scy);
+		r[1][2] = _mm_mul_ps(_mm_add_ps(yz, sx), scz);
+		r[2][0] = _mm_mul_ps(_mm_add_ps(zx, sy), scx);
+		r[2][1] = _mm_mul_ps(_mm_sub_ps(yz, sx), scy);
+		r[2][2] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx), yy), scz);
+
+		r[0][3] = _mm_add_ps(_mm_setr_ps(p[0].position.x, p[1].position.x, p[2].position.x, p[3].position.x), pvx);
+		r[1][3] = _mm_add_ps(_mm_setr_ps(p[0].position.y, p[1].position.y, p[2].position.y, p[3].position.y), pvy);
+		r[2][3] = _mm_add_ps(_mm_setr_ps(p[0].position.z, p[1].position.z, p[2].position.z, p[3].position.z), pvz);
+
+		for(int j=0; j<3; j++) {
+			__m128 rp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[j][0], pvx), _mm_mul_ps(r[j][1], pvy)), _mm_mul_ps(r[j][2], pvz));
+			r[j][3] = _mm_sub_ps(r[j][3], rp);
+			_MM_TRANSPOSE4_PS(r[j][0], r[j][1], r[j][2], r[j][3]);
+		}
 
-	pivot_mat.set_translation(pivot);
-	neg_pivot_mat.set_translation(-pivot);
-	
-	trans_mat.set_translation(position);
-	rot_mat = (Matrix4x4)rotation.get_rotation_matrix();
-	scale_mat.set_scaling(scale);
-	
-	return pivot_mat * trans_mat * rot_mat * scale_mat * neg_pivot_mat;
+		__m128 last_row = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+		for(int j=0; j<4; j++) {
+			Matrix4x4 &mat = dest[i + j];
+			_mm_storeu_ps(mat[0], r[0][j]);
+			_mm_storeu_ps(mat[1], r[1][j]);
+			_mm_storeu_ps(mat[2], r[2][j]);
+			_mm_storeu_ps(mat[3], last_row);
+		}
+	}
+#endif	// USE_SSE
+
+	for(; i<count; i++) {
+		dest[i] = prs[i].get_xform_matrix();
+	}
 }
 
 PRS combine_prs(const PRS &prs1, const PRS &prs2) {
@@ -72,20 +151,34 @@ PRS combine_prs(const PRS &prs1, const PRS &prs2) {
 	return prs;
 }
 
+void combine_prs(PRS *dest, const PRS *prs1, const PRS *prs2, int count) {
+	for(int i=0; i<count; i++) {
+		dest[i] = combine_prs(prs1[i], prs2[i]);
+	}
+}
+
+/* rotates v by the conjugate of q, same as v.transformed(q.conjugate())
+ * without the two quaternion products and the inverse.
+ */
+static inline Vector3 rotate_conj(const Vector3 &v, const Quaternion &q) {
+	Vector3 u = -q.v;
+	Vector3 uv = cross_product(u, v);
+	Vector3 uuv = cross_product(u, uv);
+	scalar_t scale = 2.0 / q.length_sq();
+	return v + (uv * q.s + uuv) * scale;
+}
+
+/* inherit_prs
+ * the position is ((c - p)R + p + pR) * s with R the conjugate parent
+ * rotation, which is just (cR + p) * s.
+ */
 PRS inherit_prs(const PRS &child, const PRS &parent) {
 	PRS prs;
 	prs.pivot = child.pivot;
 	
 	prs.rotation = parent.rotation * child.rotation;
 
-	prs.position += child.position;
-	prs.position -= parent.position;
-	prs.position.transform(parent.rotation.conjugate());
-	prs.position += parent.position;
-
-	Vector3 ppos_trans = parent.position.transformed(parent.rotation.conjugate());
-	prs.position += ppos_trans;
-	
+	prs.position = rotate_conj(child.position, parent.rotation) + parent.position;
 	prs.position.x *= parent.scale.x;
 	prs.position.y *= parent.scale.y;
 	prs.position.z *= parent.scale.z;
@@ -97,6 +190,12 @@ PRS inherit_prs(const PRS &child, const PRS &parent) {
 	return prs;
 }
 
+void inherit_prs(PRS *dest, const PRS *child, const PRS *parent, int count) {
+	for(int i=0; i<count; i++) {
+		dest[i] = inherit_prs(child[i], parent[i]);
+	}
+}
+
 std::ostream &operator <<(std::ostream &out, const PRS &prs) {
 	out << "p: " << prs.position << " r: " << prs.rotation << " s: " << prs.scale;
 	return out;
@@ -117,6 +216,7 @@ XFormNode::XFormNode() {
 	key_time_mode = TIME_CLAMP;
 	parent = 0;
 	cache.valid = false;
+	xform_rev = 0;
 }
 
 XFormNode::~XFormNode() {
@@ -165,6 +265,7 @@ void XFormNode::add_controller(MotionController ctrl, ControllerType ctrl_type)
 	}
 	use_ctrl = true;
 	cache.valid = false;
+	xform_rev++;
 }
 
 vector<MotionController> *XFormNode::get_controllers(ControllerType ctrl_type) {
@@ -183,6 +284,7 @@ vector<MotionController> *XFormNode::get_controllers(ControllerType ctrl_type) {
 		break;
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::add_keyframe(const Keyframe &key) {
@@ -201,10 +303,12 @@ void XFormNode::add_keyframe(const Keyframe &key) {
 		key_count++;
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 Keyframe *XFormNode::get_keyframe(unsigned long time) {
 	cache.valid = false;
+	xform_rev++;
 	Keyframe *keyframe = get_nearest_key(time);
 	return (keyframe->time == time) ? keyframe : 0;
 }
@@ -215,16 +319,19 @@ void XFormNode::delete_keyframe(unsigned long time) {
 		keys.erase(iter);
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 std::vector<Keyframe> *XFormNode::get_keyframes() {
 	cache.valid = false;
+	xform_rev++;
 	return &keys;
 }
 
 void XFormNode::set_timeline_mode(TimelineMode time_mode) {
 	key_time_mode = time_mode;
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::set_position(const Vector3 &pos, unsigned long time) {
@@ -237,6 +344,7 @@ void XFormNode::set_position(const Vector3 &pos, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::set_rotation(const Quaternion &rot, unsigned long time) {
@@ -249,6 +357,7 @@ void XFormNode::set_rotation(const Quaternion &rot, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::set_rotation(const Vector3 &euler, unsigned long time) {
@@ -267,6 +376,7 @@ void XFormNode::set_rotation(const Vector3 &euler, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::set_scaling(const Vector3 &scale, unsigned long time) {
@@ -279,11 +389,13 @@ void XFormNode::set_scaling(const Vector3 &scale, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::set_pivot(const Vector3 &pivot) {
 	local_prs.pivot = pivot;
 	cache.valid = false;
+	xform_rev++;
 }
 
 
@@ -314,6 +426,7 @@ void XFormNode::translate(const Vector3 &trans, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::rotate(const Quaternion &rot, unsigned long time) {
@@ -326,6 +439,7 @@ void XFormNode::rotate(const Quaternion &rot, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::rotate(const Vector3 &euler, unsigned long time) {
@@ -344,6 +458,7 @@ void XFormNode::rotate(const Vector3 &euler, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::rotate(const Matrix3x3 &rmat, unsigned long time) {
@@ -357,6 +472,7 @@ void XFormNode::rotate(const Matrix3x3 &rmat, unsigned long time) {
 
 	rotate(q, time);
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::scale(const Vector3 &scale, unsigned long time) {
@@ -373,22 +489,26 @@ void XFormNode::scale(const Vector3 &scale, unsigned long time) {
 		}
 	}
 	cache.valid = false;
+	xform_rev++;
 }
 
 
 void XFormNode::reset_position(unsigned long time) {
 	set_position(Vector3(0, 0, 0), time);
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::reset_rotation(unsigned long time) {
 	set_rotation(Quaternion(), time);
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::reset_scaling(unsigned long time) {
 	set_scaling(Vector3(1, 1, 1), time);
 	cache.valid = false;
+	xform_rev++;
 }
 
 void XFormNode::reset_xform(unsigned long time) {
@@ -400,12 +520,22 @@ void XFormNode::reset_xform(unsigned long time) {
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
 
+unsigned long XFormNode::get_xform_revision() const {
+	return parent ? xform_rev + parent->get_xform_revision() : xform_rev;
+}
+
+bool XFormNode::is_animated() const {
+	if(key_count || use_ctrl) return true;
+	return parent ? parent->is_animated() : false;
+}
+
 PRS XFormNode::get_prs(unsigned long time) const {
 	if(cache.valid && time == cache.time) {
 		return cache.prs;
 	}
-	//cache.valid = true;
-	cache.time = time;
+	/* the cache is never filled in, which also keeps get_prs() safe to call
+	 * from several threads at once (see RenderQueue::add_objects()).
+	 */
 
 	PRS parent_prs;
 	if(parent) {
@@ -413,8 +543,7 @@ PRS XFormNode::get_prs(unsigned long time) const {
 	}
 	
 	if(time == XFORM_LOCAL_PRS) {
-		cache.prs = combine_prs(local_prs, parent_prs);
-		return cache.prs;
+		return combine_prs(local_prs, parent_prs);
 	}
 	
 	PRS prs = local_prs;
@@ -474,6 +603,5 @@ PRS XFormNode::get_prs(unsigned long time) const {
 		prs = combine_prs(prs, ctrl_prs);
 	}
 	
-	cache.prs = inherit_prs(prs, parent_prs);
-	return cache.prs;
+	return inherit_prs(prs, parent_prs);
 }
@@ -56,6 +56,13 @@ PRS combine_prs(const PRS &prs1, const PRS &prs2);
 PRS inherit_prs(const PRS &child, const PRS &parent);
 std::ostream &operator <<(std::ostream &out, const PRS &prs);
 
+/* array versions of the above, for evaluating many nodes at once.
+ * dest may be the same as any of the inputs.
+ */
+void get_xform_matrices(Matrix4x4 *dest, const PRS *prs, int count);
+void combine_prs(PRS *dest, const PRS *prs1, const PRS *prs2, int count);
+void inherit_prs(PRS *dest, const PRS *child, const PRS *parent, int count);
+
 class Keyframe {
 public:
 	PRS prs;
@@ -91,6 +98,8 @@ protected:
 	
 	bool use_ctrl;
 
+	unsigned long xform_rev;	// bumped on every change to the transformation
+
 	inline Keyframe *get_nearest_key(unsigned long time);
 	inline const Keyframe *get_nearest_key(unsigned long time) const;
 	Keyframe *get_nearest_key(int start, int end, unsigned long time);
@@ -138,6 +147,13 @@ public:
 	virtual void reset_xform(unsigned long time = XFORM_LOCAL_PRS);
 	
 	virtual PRS get_prs(unsigned long time = XFORM_LOCAL_PRS) const;
+
+	/* changes whenever the transformation of this node or any of its parents
+	 * is modified (not when it changes with time through keys/controllers).
+	 */
+	unsigned long get_xform_revision() const;
+	// true if the transformation is a function of time
+	bool is_animated() const;
 };
 
 #include "animation.inl"
@@ -0,0 +1,469 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Bounding volume hierarchy over a set of items (e.g. scene objects), each
+ * one bounded by boxes and a sphere in the same (world) space.
+ */
+
+#include <float.h>
+#include <algorithm>
+#include "bvh.hpp"
+
+#define SAH_BINS		12
+#define MAX_LEAF_ITEMS	16	// split anything bigger, regardless of the SAH
+
+static inline scalar_t vcomp(const Vector3 &v, int axis) {
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+struct BinPred {
+	const std::vector<Vector3> *centers;
+	int axis, split;
+	scalar_t cmin, scale;
+
+	bool operator ()(int item) const {
+		int bin = (int)((vcomp((*centers)[item], axis) - cmin) * scale);
+		if(bin >= SAH_BINS) bin = SAH_BINS - 1;
+		return bin < split;
+	}
+};
+
+struct AxisLess {
+	const std::vector<Vector3> *centers;
+	int axis;
+
+	bool operator ()(int a, int b) const {
+		return vcomp((*centers)[a], axis) < vcomp((*centers)[b], axis);
+	}
+};
+
+BVH::BVH() {
+	max_leaf_items = 4;
+	rebuild_ratio = 1.5;
+	build_cost = 0.0;
+	need_build = false;
+	build_count = refit_count = 0;
+}
+
+void BVH::clear() {
+	nodes.clear();
+	items.clear();
+	order.clear();
+	item_leaf.clear();
+	item_slot.clear();
+	culler.clear();
+	dirty_leaves.clear();
+	leaf_dirty.clear();
+	build_cost = 0.0;
+	need_build = false;
+}
+
+int BVH::add_item(void *data, const AABox &box, const Vector3 &center, scalar_t radius, const OBox *obox) {
+	BVHItem item;
+	item.box = box;
+	item.obox = obox ? *obox : OBox(box);
+	item.center = center;
+	item.radius = radius;
+	item.data = data;
+	items.push_back(item);
+
+	need_build = true;
+	return (int)items.size() - 1;
+}
+
+void BVH::set_item_bounds(int idx, const AABox &box, const Vector3 &center, scalar_t radius, const OBox *obox) {
+	BVHItem *item = &items[idx];
+	item->box = box;
+	item->obox = obox ? *obox : OBox(box);
+	item->center = center;
+	item->radius = radius;
+
+	if(need_build) return;
+
+	culler.set_bounds(item_slot[idx], center, radius, item->obox);
+
+	int leaf = item_leaf[idx];
+	if(!leaf_dirty[leaf]) {
+		leaf_dirty[leaf] = true;
+		dirty_leaves.push_back(leaf);
+	}
+}
+
+int BVH::get_item_count() const {
+	return (int)items.size();
+}
+
+const BVHItem *BVH::get_item(int idx) const {
+	return &items[idx];
+}
+
+void BVH::set_max_leaf_items(int count) {
+	max_leaf_items = count < 1 ? 1 : (count > MAX_LEAF_ITEMS ? MAX_LEAF_ITEMS : count);
+	need_build = true;
+}
+
+void BVH::set_rebuild_ratio(scalar_t ratio) {
+	rebuild_ratio = ratio;
+}
+
+/* build
+ * top-down construction, splitting each node at the best of a few
+ * candidate planes (binned along all 3 axes) as rated by the surface
+ * area heuristic.
+ */
+void BVH::build() {
+	int count = (int)items.size();
+
+	nodes.clear();
+	dirty_leaves.clear();
+	need_build = false;
+	build_count++;
+
+	order.resize(count);
+	item_leaf.resize(count);
+	item_slot.resize(count);
+	culler.resize(count);
+	if(!count) {
+		leaf_dirty.clear();
+		build_cost = 0.0;
+		return;
+	}
+
+	std::vector<Vector3> centers(count);
+	for(int i=0; i<count; i++) {
+		order[i] = i;
+		centers[i] = items[i].box.get_center();
+	}
+
+	nodes.reserve(count * 2);
+	BVHNode root;
+	root.parent = -1;
+	root.first = 0;
+	root.count = 0;
+	nodes.push_back(root);
+
+	build_node(0, 0, count, centers);
+
+	for(int i=0; i<count; i++) {
+		const BVHItem *item = &items[order[i]];
+		culler.set_bounds(i, item->center, item->radius, item->obox);
+		item_slot[order[i]] = i;
+	}
+
+	leaf_dirty.assign(nodes.size(), false);
+	build_cost = calc_cost();
+}
+
+void BVH::build_node(int node, int first, int count, std::vector<Vector3> &centers) {
+	AABox box, cbox;
+	for(int i=0; i<count; i++) {
+		int item = order[first + i];
+		box.add_box(items[item].box);
+		cbox.add_point(centers[item]);
+	}
+	nodes[node].box = box;
+
+	int best_axis = -1, best_split = 0;
+	scalar_t area = box.get_surface_area();
+	scalar_t best_cost = FLT_MAX;
+
+	if(count > max_leaf_items) {
+		for(int axis=0; axis<3; axis++) {
+			scalar_t cmin = vcomp(cbox.vmin, axis);
+			scalar_t extent = vcomp(cbox.vmax, axis) - cmin;
+			if(extent < xsmall_number) continue;
+
+			AABox bin_box[SAH_BINS];
+			int bin_count[SAH_BINS] = {0};
+			scalar_t scale = SAH_BINS / extent;
+
+			for(int i=0; i<count; i++) {
+				int item = order[first + i];
+				int bin = (int)((vcomp(centers[item], axis) - cmin) * scale);
+				if(bin >= SAH_BINS) bin = SAH_BINS - 1;
+				bin_box[bin].add_box(items[item].box);
+				bin_count[bin]++;
+			}
+
+			// sweep from the right to get the cost of every right side
+			scalar_t right_cost[SAH_BINS];
+			AABox acc;
+			int acc_count = 0;
+			for(int i=SAH_BINS-1; i>0; i--) {
+				acc.add_box(bin_box[i]);
+				acc_count += bin_count[i];
+				right_cost[i] = acc.get_surface_area() * acc_count;
+			}
+
+			acc.reset();
+			acc_count = 0;
+			for(int i=1; i<SAH_BINS; i++) {
+				acc.add_box(bin_box[i - 1]);
+				acc_count += bin_count[i - 1];
+				if(!acc_count || acc_count == count) continue;
+
+				scalar_t cost = acc.get_surface_area() * acc_count + right_cost[i];
+				if(cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = i;
+				}
+			}
+		}
+	}
+
+	// traversal and item tests are rated equally, so splitting pays off if
+	// area + cost(left) + cost(right) < area * count
+	bool split = best_axis != -1 && (best_cost + area < area * count || count > MAX_LEAF_ITEMS);
+
+	if(!split) {
+		nodes[node].first = first;
+		nodes[node].count = count;
+		for(int i=0; i<count; i++) {
+			item_leaf[order[first + i]] = node;
+		}
+		return;
+	}
+
+	BinPred pred;
+	pred.centers = &centers;
+	pred.axis = best_axis;
+	pred.split = best_split;
+	pred.cmin = vcomp(cbox.vmin, best_axis);
+	pred.scale = SAH_BINS / (vcomp(cbox.vmax, best_axis) - pred.cmin);
+
+	int *beg = &order[0] + first;
+	int left_count = (int)(std::partition(beg, beg + count, pred) - beg);
+
+	if(!left_count || left_count == count) {
+		// numerically degenerate split, fall back to the median
+		AxisLess less;
+		less.centers = &centers;
+		less.axis = best_axis;
+		left_count = count / 2;
+		std::nth_element(beg, beg + left_count, beg + count, less);
+	}
+
+	int child = (int)nodes.size();
+	BVHNode cnode;
+	cnode.parent = node;
+	cnode.first = cnode.count = 0;
+	nodes.push_back(cnode);
+	nodes.push_back(cnode);
+
+	nodes[node].first = child;
+	nodes[node].count = 0;
+
+	build_node(child, first, left_count, centers);
+	build_node(child + 1, first + left_count, count - left_count, centers);
+}
+
+scalar_t BVH::calc_cost() const {
+	if(nodes.empty()) return 0.0;
+
+	scalar_t root_area = nodes[0].box.get_surface_area();
+	if(root_area < xsmall_number) return 0.0;
+
+	scalar_t cost = 0.0;
+	for(size_t i=0; i<nodes.size(); i++) {
+		scalar_t area = nodes[i].box.get_surface_area();
+		cost += nodes[i].count ? area * nodes[i].count : area;
+	}
+	return cost / root_area;
+}
+
+/* refit
+ * recalculates the boxes of the leaves containing moved items,
+ * and of all their ancestors.
+ */
+void BVH::refit() {
+	if(need_build || dirty_leaves.empty()) return;
+
+	for(size_t i=0; i<dirty_leaves.size(); i++) {
+		int node = dirty_leaves[i];
+		leaf_dirty[node] = false;
+
+		BVHNode *leaf = &nodes[node];
+		leaf->box.reset();
+		for(int j=0; j<leaf->count; j++) {
+			leaf->box.add_box(items[order[leaf->first + j]].box);
+		}
+
+		node = leaf->parent;
+		while(node != -1) {
+			BVHNode *n = &nodes[node];
+			n->box = nodes[n->first].box;
+			n->box.add_box(nodes[n->first + 1].box);
+			node = n->parent;
+		}
+	}
+	dirty_leaves.clear();
+	refit_count++;
+}
+
+void BVH::update() {
+	if(need_build) {
+		build();
+		return;
+	}
+
+	if(!dirty_leaves.empty()) {
+		refit();
+
+		if(calc_cost() > build_cost * rebuild_ratio) {
+			build();
+		}
+	}
+}
+
+struct CullEntry {
+	int node;
+	unsigned int mask;
+};
+
+void BVH::cull(const FrustumPlane *frustum, std::vector<int> *visible) const {
+	if(nodes.empty()) return;
+
+	std::vector<CullEntry> stack;
+	stack.reserve(64);
+
+	CullEntry ent;
+	ent.node = 0;
+	ent.mask = FRUSTUM_ALL_PLANES;
+	stack.push_back(ent);
+
+	while(!stack.empty()) {
+		ent = stack.back();
+		stack.pop_back();
+
+		const BVHNode *node = &nodes[ent.node];
+		if(ent.mask && frustum_test(node->box, frustum, &ent.mask) == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+
+		if(!node->count) {
+			CullEntry child;
+			child.mask = ent.mask;
+			child.node = node->first + 1;
+			stack.push_back(child);
+			child.node = node->first;
+			stack.push_back(child);
+			continue;
+		}
+
+		// the culler slots are in leaf order, map them back to item indices
+		size_t start = visible->size();
+		culler.cull(frustum, node->first, node->count, visible, ent.mask);
+		for(size_t i=start; i<visible->size(); i++) {
+			(*visible)[i] = order[(*visible)[i]];
+		}
+	}
+}
+
+struct RayEntry {
+	int node;
+	scalar_t tnear;
+};
+
+int BVH::intersect(const Ray &ray, scalar_t *t, BVHRayFunc func, void *cls) const {
+	if(nodes.empty()) return -1;
+
+	scalar_t tnear;
+	if(!nodes[0].box.ray_hit(ray, &tnear)) return -1;
+
+	int hit = -1;
+	scalar_t best = FLT_MAX;
+
+	std::vector<RayEntry> stack;
+	stack.reserve(64);
+
+	RayEntry ent;
+	ent.node = 0;
+	ent.tnear = tnear;
+	stack.push_back(ent);
+
+	while(!stack.empty()) {
+		ent = stack.back();
+		stack.pop_back();
+
+		if(ent.tnear >= best) continue;
+		const BVHNode *node = &nodes[ent.node];
+
+		if(!node->count) {
+			RayEntry c0, c1;
+			bool hit0 = nodes[node->first].box.ray_hit(ray, &c0.tnear);
+			bool hit1 = nodes[node->first + 1].box.ray_hit(ray, &c1.tnear);
+			c0.node = node->first;
+			c1.node = node->first + 1;
+
+			// push the nearest child last, so that it's visited first
+			if(hit0 && hit1) {
+				if(c0.tnear < c1.tnear) {
+					stack.push_back(c1);
+					stack.push_back(c0);
+				} else {
+					stack.push_back(c0);
+					stack.push_back(c1);
+				}
+			} else if(hit0) {
+				stack.push_back(c0);
+			} else if(hit1) {
+				stack.push_back(c1);
+			}
+			continue;
+		}
+
+		for(int i=0; i<node->count; i++) {
+			int idx = order[node->first + i];
+			scalar_t titem;
+			if(!items[idx].box.ray_hit(ray, &titem) || titem >= best) {
+				continue;
+			}
+
+			if(func) {
+				titem = best;
+				if(!func(idx, ray, &titem, cls) || titem >= best) {
+					continue;
+				}
+			}
+			best = titem;
+			hit = idx;
+		}
+	}
+
+	if(hit != -1 && t) *t = best;
+	return hit;
+}
+
+int BVH::get_node_count() const {
+	return (int)nodes.size();
+}
+
+scalar_t BVH::get_cost() const {
+	return calc_cost();
+}
+
+unsigned long BVH::get_build_count() const {
+	return build_count;
+}
+
+unsigned long BVH::get_refit_count() const {
+	return refit_count;
+}
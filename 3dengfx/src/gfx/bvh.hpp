@@ -0,0 +1,107 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Bounding volume hierarchy over a set of items (e.g. scene objects), each
+ * one bounded by boxes and a sphere in the same (world) space.
+ */
+
+#ifndef _BVH_HPP_
+#define _BVH_HPP_
+
+#include <vector>
+#include "n3dmath2/n3dmath2.hpp"
+#include "gfx/bvol.hpp"
+#include "gfx/cull.hpp"
+
+/* called by BVH::intersect for every item whose box is hit by the ray closer
+ * than the current nearest hit. Should return true and set *t if the item
+ * itself is hit closer than *t.
+ */
+typedef bool (*BVHRayFunc)(int item, const Ray &ray, scalar_t *t, void *cls);
+
+struct BVHNode {
+	AABox box;
+	int parent;
+	int first;		// first child (the second is first + 1), or first item for leaves
+	int count;		// number of items for leaves, 0 for inner nodes
+};
+
+struct BVHItem {
+	AABox box;
+	OBox obox;
+	Vector3 center;
+	scalar_t radius;
+	void *data;
+};
+
+class BVH {
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<BVHItem> items;
+	std::vector<int> order;			// item indices, leaves reference ranges of this
+	std::vector<int> item_leaf;		// leaf node containing each item
+	std::vector<int> dirty_leaves;
+	std::vector<bool> leaf_dirty;
+	std::vector<int> item_slot;		// position of each item in order
+	// item bounds in leaf order, for testing the items of a leaf in batches
+	mutable FrustumCuller culler;
+
+	int max_leaf_items;
+	scalar_t rebuild_ratio;
+	scalar_t build_cost;
+	bool need_build;
+	unsigned long build_count, refit_count;
+
+	void build_node(int node, int first, int count, std::vector<Vector3> &centers);
+	scalar_t calc_cost() const;
+
+public:
+	BVH();
+
+	void clear();
+
+	// the oriented box is optional, the axis aligned box is used if not given
+	int add_item(void *data, const AABox &box, const Vector3 &center, scalar_t radius, const OBox *obox = 0);
+	void set_item_bounds(int idx, const AABox &box, const Vector3 &center, scalar_t radius, const OBox *obox = 0);
+	int get_item_count() const;
+	const BVHItem *get_item(int idx) const;
+
+	void set_max_leaf_items(int count);
+	// rebuild when the refitted tree gets this much worse than a fresh one
+	void set_rebuild_ratio(scalar_t ratio);
+
+	void build();
+	void refit();
+	// builds the tree if items were added, otherwise refits any moved items,
+	// and rebuilds if the tree quality degraded too much.
+	void update();
+
+	// appends the indices of all items at least partially inside the frustum
+	void cull(const FrustumPlane *frustum, std::vector<int> *visible) const;
+	// returns the nearest item hit by the ray (and its distance in *t), or -1
+	int intersect(const Ray &ray, scalar_t *t = 0, BVHRayFunc func = 0, void *cls = 0) const;
+
+	int get_node_count() const;
+	scalar_t get_cost() const;		// SAH cost of the tree as it stands
+	unsigned long get_build_count() const;
+	unsigned long get_refit_count() const;
+};
+
+#endif	// _BVH_HPP_
@@ -23,8 +23,20 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  * Author: John Tsiombikas 2005
  */
 
+#include <float.h>
+#include <list>
 #include "bvol.hpp"
 
+// largest scaling factor of the axes of an affine transformation
+static scalar_t max_axis_scale(const Matrix4x4 &xform) {
+	scalar_t max_sq = 0.0;
+	for(int i=0; i<3; i++) {
+		scalar_t len_sq = SQ(xform[0][i]) + SQ(xform[1][i]) + SQ(xform[2][i]);
+		if(len_sq > max_sq) max_sq = len_sq;
+	}
+	return sqrt(max_sq);
+}
+
 BoundingVolume::BoundingVolume() {
 	parent = 0;
 }
@@ -44,6 +56,7 @@ bool BoundingSphere::ray_hit(const Ray &ray) const {
 	Sphere sph = *this;
 	Vector3 new_pos = sph.get_position();
 	sph.set_position(new_pos.transformed(transform));
+	sph.set_radius(radius * max_axis_scale(transform));
 	
 	if(!sph.check_intersection(ray)) return false;
 	if(!children.size()) return true;
@@ -57,13 +70,13 @@ bool BoundingSphere::ray_hit(const Ray &ray) const {
 
 bool BoundingSphere::visible(const FrustumPlane *frustum) const {
 	Vector3 new_pos = pos.transformed(transform);
+	scalar_t rad = radius * max_axis_scale(transform);
 	
 	for(int i=0; i<6; i++) {
 		Vector3 normal(frustum[i].a, frustum[i].b, frustum[i].c);
 		scalar_t dist = dot_product(new_pos, normal) + frustum[i].d;
 
-		if(fabs(dist) < radius) break;
-		if(dist < -radius) return false;
+		if(dist < -rad) return false;
 	}
 
 	// the sphere is at least partially inside the frustum, check any children
@@ -74,3 +87,513 @@ bool BoundingSphere::visible(const FrustumPlane *frustum) const {
 	}
 	return false;
 }
+
+AABox::AABox() {
+	reset();
+}
+
+AABox::AABox(const Vector3 &vmin, const Vector3 &vmax) {
+	this->vmin = vmin;
+	this->vmax = vmax;
+}
+
+void AABox::reset() {
+	vmin = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	vmax = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+bool AABox::is_empty() const {
+	return vmin.x > vmax.x || vmin.y > vmax.y || vmin.z > vmax.z;
+}
+
+void AABox::add_point(const Vector3 &pt) {
+	if(pt.x < vmin.x) vmin.x = pt.x;
+	if(pt.y < vmin.y) vmin.y = pt.y;
+	if(pt.z < vmin.z) vmin.z = pt.z;
+	if(pt.x > vmax.x) vmax.x = pt.x;
+	if(pt.y > vmax.y) vmax.y = pt.y;
+	if(pt.z > vmax.z) vmax.z = pt.z;
+}
+
+void AABox::add_box(const AABox &box) {
+	if(box.vmin.x < vmin.x) vmin.x = box.vmin.x;
+	if(box.vmin.y < vmin.y) vmin.y = box.vmin.y;
+	if(box.vmin.z < vmin.z) vmin.z = box.vmin.z;
+	if(box.vmax.x > vmax.x) vmax.x = box.vmax.x;
+	if(box.vmax.y > vmax.y) vmax.y = box.vmax.y;
+	if(box.vmax.z > vmax.z) vmax.z = box.vmax.z;
+}
+
+Vector3 AABox::get_center() const {
+	return (vmin + vmax) * 0.5;
+}
+
+Vector3 AABox::get_size() const {
+	return vmax - vmin;
+}
+
+scalar_t AABox::get_surface_area() const {
+	if(is_empty()) return 0.0;
+	Vector3 sz = vmax - vmin;
+	return 2.0 * (sz.x * sz.y + sz.y * sz.z + sz.z * sz.x);
+}
+
+/* transformed
+ * Arvo's method, transforms the center and accumulates the absolute
+ * values of the matrix for the extents, instead of all 8 corners.
+ */
+AABox AABox::transformed(const Matrix4x4 &xform) const {
+	if(is_empty()) return *this;
+
+	Vector3 c = get_center();
+	Vector3 ext = (vmax - vmin) * 0.5;
+	
+	Vector3 nc = c.transformed(xform);
+	Vector3 next;
+	next.x = fabs(xform[0][0]) * ext.x + fabs(xform[0][1]) * ext.y + fabs(xform[0][2]) * ext.z;
+	next.y = fabs(xform[1][0]) * ext.x + fabs(xform[1][1]) * ext.y + fabs(xform[1][2]) * ext.z;
+	next.z = fabs(xform[2][0]) * ext.x + fabs(xform[2][1]) * ext.y + fabs(xform[2][2]) * ext.z;
+
+	return AABox(nc - next, nc + next);
+}
+
+bool AABox::ray_hit(const Ray &ray, scalar_t *tnear, scalar_t *tfar) const {
+	scalar_t t0 = 0.0, t1 = FLT_MAX;
+
+	for(int i=0; i<3; i++) {
+		scalar_t orig = i == 0 ? ray.origin.x : (i == 1 ? ray.origin.y : ray.origin.z);
+		scalar_t dir = i == 0 ? ray.dir.x : (i == 1 ? ray.dir.y : ray.dir.z);
+		scalar_t bmin = i == 0 ? vmin.x : (i == 1 ? vmin.y : vmin.z);
+		scalar_t bmax = i == 0 ? vmax.x : (i == 1 ? vmax.y : vmax.z);
+
+		if(fabs(dir) < xsmall_number) {
+			if(orig < bmin || orig > bmax) return false;
+			continue;
+		}
+
+		scalar_t inv_dir = 1.0 / dir;
+		scalar_t tn = (bmin - orig) * inv_dir;
+		scalar_t tf = (bmax - orig) * inv_dir;
+		if(tn > tf) {
+			scalar_t tmp = tn;
+			tn = tf;
+			tf = tmp;
+		}
+
+		if(tn > t0) t0 = tn;
+		if(tf < t1) t1 = tf;
+		if(t0 > t1) return false;
+	}
+
+	if(tnear) *tnear = t0;
+	if(tfar) *tfar = t1;
+	return true;
+}
+
+OBox::OBox() {
+	axis[0] = Vector3(1, 0, 0);
+	axis[1] = Vector3(0, 1, 0);
+	axis[2] = Vector3(0, 0, 1);
+}
+
+OBox::OBox(const AABox &box) {
+	axis[0] = Vector3(1, 0, 0);
+	axis[1] = Vector3(0, 1, 0);
+	axis[2] = Vector3(0, 0, 1);
+
+	if(!box.is_empty()) {
+		center = box.get_center();
+		extent = box.get_size() * 0.5;
+	}
+}
+
+scalar_t OBox::get_volume() const {
+	return 8.0 * extent.x * extent.y * extent.z;
+}
+
+AABox OBox::get_aabox() const {
+	Vector3 u = axis[0] * extent.x;
+	Vector3 v = axis[1] * extent.y;
+	Vector3 w = axis[2] * extent.z;
+
+	Vector3 ext;
+	ext.x = fabs(u.x) + fabs(v.x) + fabs(w.x);
+	ext.y = fabs(u.y) + fabs(v.y) + fabs(w.y);
+	ext.z = fabs(u.z) + fabs(v.z) + fabs(w.z);
+	return AABox(center - ext, center + ext);
+}
+
+OBox OBox::transformed(const Matrix4x4 &xform) const {
+	OBox res;
+	Matrix3x3 rot = Matrix3x3(xform);
+
+	res.center = center.transformed(xform);
+	for(int i=0; i<3; i++) {
+		scalar_t ext = i == 0 ? extent.x : (i == 1 ? extent.y : extent.z);
+		Vector3 v = axis[i].transformed(rot) * ext;
+
+		scalar_t len = v.length();
+		if(len > xsmall_number) {
+			res.axis[i] = v / len;
+		} else {
+			res.axis[i] = axis[i];
+			len = 0.0;
+		}
+
+		if(i == 0) res.extent.x = len;
+		else if(i == 1) res.extent.y = len;
+		else res.extent.z = len;
+	}
+	return res;
+}
+
+/* calc_ritter_sphere
+ * Ritter's approximate bounding sphere: start with the sphere spanning two
+ * far apart points and grow it to include any points left outside.
+ */
+void calc_ritter_sphere(const Vector3 *points, int count, Vector3 *center, scalar_t *radius) {
+	if(count <= 0) {
+		*center = Vector3(0, 0, 0);
+		*radius = 0.0;
+		return;
+	}
+
+	// find the point farthest from an arbitrary one, and the farthest from that
+	int a = 0, b = 0;
+	scalar_t max_sq = -1.0;
+	for(int i=0; i<count; i++) {
+		scalar_t dsq = (points[i] - points[0]).length_sq();
+		if(dsq > max_sq) {
+			max_sq = dsq;
+			a = i;
+		}
+	}
+	max_sq = -1.0;
+	for(int i=0; i<count; i++) {
+		scalar_t dsq = (points[i] - points[a]).length_sq();
+		if(dsq > max_sq) {
+			max_sq = dsq;
+			b = i;
+		}
+	}
+
+	Vector3 c = (points[a] + points[b]) * 0.5;
+	scalar_t rad = sqrt(max_sq) * 0.5;
+
+	for(int i=0; i<count; i++) {
+		Vector3 dir = points[i] - c;
+		scalar_t dsq = dir.length_sq();
+		if(dsq > rad * rad) {
+			scalar_t dist = sqrt(dsq);
+			scalar_t new_rad = (rad + dist) * 0.5;
+			c += dir * ((new_rad - rad) / dist);
+			rad = new_rad;
+		}
+	}
+
+	*center = c;
+	*radius = rad;
+}
+
+struct MinSphere {
+	Vector3 center;
+	scalar_t rad_sq;
+};
+
+// the smallest sphere with all the support points on its surface
+static void support_sphere(const Vector3 *sup, int count, MinSphere *ms) {
+	switch(count) {
+	case 0:
+		ms->center = Vector3(0, 0, 0);
+		ms->rad_sq = -1.0;
+		return;
+
+	case 1:
+		ms->center = sup[0];
+		ms->rad_sq = 0.0;
+		return;
+
+	case 2:
+		ms->center = (sup[0] + sup[1]) * 0.5;
+		ms->rad_sq = (sup[1] - sup[0]).length_sq() * 0.25;
+		return;
+
+	case 3:
+		{
+			Vector3 a = sup[1] - sup[0];
+			Vector3 b = sup[2] - sup[0];
+			Vector3 axb = cross_product(a, b);
+			scalar_t denom = 2.0 * axb.length_sq();
+
+			if(denom > xsmall_number) {
+				Vector3 offs = (cross_product(axb, a) * b.length_sq() + cross_product(b, axb) * a.length_sq()) / denom;
+				ms->center = sup[0] + offs;
+				ms->rad_sq = offs.length_sq();
+			} else {
+				// collinear, the sphere of the two farthest points will do
+				support_sphere(sup, 2, ms);
+				if((sup[2] - ms->center).length_sq() > ms->rad_sq) {
+					Vector3 pair[] = {sup[0], sup[2]};
+					support_sphere(pair, 2, ms);
+					if((sup[1] - ms->center).length_sq() > ms->rad_sq) {
+						support_sphere(sup + 1, 2, ms);
+					}
+				}
+			}
+		}
+		return;
+
+	case 4:
+		{
+			Vector3 a = sup[1] - sup[0];
+			Vector3 b = sup[2] - sup[0];
+			Vector3 c = sup[3] - sup[0];
+			scalar_t det = 2.0 * dot_product(a, cross_product(b, c));
+
+			if(fabs(det) > xsmall_number) {
+				Vector3 offs = (cross_product(b, c) * a.length_sq() + cross_product(c, a) * b.length_sq() +
+						cross_product(a, b) * c.length_sq()) / det;
+				ms->center = sup[0] + offs;
+				ms->rad_sq = offs.length_sq();
+			} else {
+				// coplanar, calc_min_sphere fixes up the radius if this misses the 4th point
+				support_sphere(sup, 3, ms);
+			}
+		}
+		return;
+	}
+}
+
+static void min_sphere_mtf(std::list<Vector3> &pts, std::list<Vector3>::iterator end,
+		Vector3 *sup, int sup_count, MinSphere *ms) {
+	support_sphere(sup, sup_count, ms);
+	if(sup_count == 4) return;
+
+	std::list<Vector3>::iterator iter = pts.begin();
+	while(iter != end) {
+		std::list<Vector3>::iterator next = iter;
+		++next;
+
+		if((*iter - ms->center).length_sq() > ms->rad_sq * (1.0 + small_number) + xsmall_number) {
+			sup[sup_count] = *iter;
+			min_sphere_mtf(pts, iter, sup, sup_count + 1, ms);
+			pts.splice(pts.begin(), pts, iter);
+		}
+		iter = next;
+	}
+}
+
+/* calc_min_sphere
+ * Welzl's algorithm in its iterative move-to-front form. The points are
+ * shuffled first since meshes tend to come in spatially coherent order,
+ * which is the worst case for it.
+ */
+void calc_min_sphere(const Vector3 *points, int count, Vector3 *center, scalar_t *radius) {
+	if(count <= 0) {
+		*center = Vector3(0, 0, 0);
+		*radius = 0.0;
+		return;
+	}
+
+	std::vector<Vector3> shuffled(points, points + count);
+	unsigned int seed = 0x9e3779b9;
+	for(int i=count-1; i>0; i--) {
+		seed = seed * 1103515245 + 12345;
+		std::swap(shuffled[i], shuffled[(seed >> 8) % (i + 1)]);
+	}
+	std::list<Vector3> pts(shuffled.begin(), shuffled.end());
+
+	Vector3 sup[4];
+	MinSphere ms;
+	min_sphere_mtf(pts, pts.end(), sup, 0, &ms);
+
+	// make sure that numerical trouble didn't leave any points outside
+	scalar_t max_sq = 0.0;
+	for(int i=0; i<count; i++) {
+		scalar_t dsq = (points[i] - ms.center).length_sq();
+		if(dsq > max_sq) max_sq = dsq;
+	}
+
+	*center = ms.center;
+	*radius = sqrt(max_sq);
+
+	// should never happen, but the approximation is a safe bet
+	Vector3 rc;
+	scalar_t rrad;
+	calc_ritter_sphere(points, count, &rc, &rrad);
+	if(rrad < *radius) {
+		*center = rc;
+		*radius = rrad;
+	}
+}
+
+/* eigenvectors of a symmetric 3x3 matrix with cyclic Jacobi rotations,
+ * returned in the columns of evec.
+ */
+static void sym_eigenvectors(scalar_t a[3][3], scalar_t evec[3][3]) {
+	for(int i=0; i<3; i++) {
+		for(int j=0; j<3; j++) {
+			evec[i][j] = i == j ? 1.0 : 0.0;
+		}
+	}
+
+	for(int iter=0; iter<32; iter++) {
+		scalar_t off = SQ(a[0][1]) + SQ(a[0][2]) + SQ(a[1][2]);
+		if(off < 1e-12) break;
+
+		for(int p=0; p<2; p++) {
+			for(int q=p+1; q<3; q++) {
+				if(fabs(a[p][q]) < 1e-12) continue;
+
+				// rotation angle zeroing a[p][q]
+				scalar_t theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+				scalar_t t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				scalar_t c = 1.0 / sqrt(t * t + 1.0);
+				scalar_t s = t * c;
+
+				for(int k=0; k<3; k++) {
+					scalar_t akp = a[k][p], akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for(int k=0; k<3; k++) {
+					scalar_t apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for(int k=0; k<3; k++) {
+					scalar_t vkp = evec[k][p], vkq = evec[k][q];
+					evec[k][p] = c * vkp - s * vkq;
+					evec[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+/* calc_pca_obox
+ * The axes are the eigenvectors of the covariance matrix of the points.
+ */
+OBox calc_pca_obox(const Vector3 *points, int count) {
+	AABox aabb;
+	for(int i=0; i<count; i++) {
+		aabb.add_point(points[i]);
+	}
+	OBox aligned(aabb);
+	if(count < 3) return aligned;
+
+	Vector3 mean;
+	for(int i=0; i<count; i++) {
+		mean += points[i];
+	}
+	mean /= (scalar_t)count;
+
+	scalar_t cov[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+	for(int i=0; i<count; i++) {
+		Vector3 d = points[i] - mean;
+		cov[0][0] += d.x * d.x;
+		cov[0][1] += d.x * d.y;
+		cov[0][2] += d.x * d.z;
+		cov[1][1] += d.y * d.y;
+		cov[1][2] += d.y * d.z;
+		cov[2][2] += d.z * d.z;
+	}
+	cov[1][0] = cov[0][1];
+	cov[2][0] = cov[0][2];
+	cov[2][1] = cov[1][2];
+
+	scalar_t evec[3][3];
+	sym_eigenvectors(cov, evec);
+
+	OBox box;
+	for(int i=0; i<3; i++) {
+		box.axis[i] = Vector3(evec[0][i], evec[1][i], evec[2][i]).normalized();
+	}
+
+	Vector3 pmin(FLT_MAX, FLT_MAX, FLT_MAX), pmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(int i=0; i<count; i++) {
+		Vector3 d = points[i] - mean;
+		Vector3 p(dot_product(d, box.axis[0]), dot_product(d, box.axis[1]), dot_product(d, box.axis[2]));
+
+		if(p.x < pmin.x) pmin.x = p.x;
+		if(p.y < pmin.y) pmin.y = p.y;
+		if(p.z < pmin.z) pmin.z = p.z;
+		if(p.x > pmax.x) pmax.x = p.x;
+		if(p.y > pmax.y) pmax.y = p.y;
+		if(p.z > pmax.z) pmax.z = p.z;
+	}
+
+	Vector3 mid = (pmin + pmax) * 0.5;
+	box.center = mean + box.axis[0] * mid.x + box.axis[1] * mid.y + box.axis[2] * mid.z;
+	box.extent = (pmax - pmin) * 0.5;
+
+	return box.get_volume() < aligned.get_volume() ? box : aligned;
+}
+
+int frustum_test(const AABox &box, const FrustumPlane *frustum, unsigned int *plane_mask) {
+	int res = FRUSTUM_INSIDE;
+	Vector3 c = box.get_center();
+	Vector3 ext = (box.vmax - box.vmin) * 0.5;
+
+	for(int i=0; i<6; i++) {
+		unsigned int bit = 1 << i;
+		if(!(*plane_mask & bit)) continue;
+
+		const FrustumPlane *p = frustum + i;
+		scalar_t dist = p->a * c.x + p->b * c.y + p->c * c.z + p->d;
+		scalar_t rad = fabs(p->a) * ext.x + fabs(p->b) * ext.y + fabs(p->c) * ext.z;
+
+		if(dist < -rad) return FRUSTUM_OUTSIDE;
+		if(dist < rad) {
+			res = FRUSTUM_INTERSECT;
+		} else {
+			*plane_mask &= ~bit;
+		}
+	}
+	return res;
+}
+
+int frustum_test(const Vector3 &center, scalar_t radius, const FrustumPlane *frustum, unsigned int *plane_mask) {
+	int res = FRUSTUM_INSIDE;
+
+	for(int i=0; i<6; i++) {
+		unsigned int bit = 1 << i;
+		if(!(*plane_mask & bit)) continue;
+
+		const FrustumPlane *p = frustum + i;
+		scalar_t dist = p->a * center.x + p->b * center.y + p->c * center.z + p->d;
+
+		if(dist < -radius) return FRUSTUM_OUTSIDE;
+		if(dist < radius) {
+			res = FRUSTUM_INTERSECT;
+		} else {
+			*plane_mask &= ~bit;
+		}
+	}
+	return res;
+}
+
+int frustum_test(const OBox &box, const FrustumPlane *frustum, unsigned int *plane_mask) {
+	int res = FRUSTUM_INSIDE;
+	Vector3 u = box.axis[0] * box.extent.x;
+	Vector3 v = box.axis[1] * box.extent.y;
+	Vector3 w = box.axis[2] * box.extent.z;
+
+	for(int i=0; i<6; i++) {
+		unsigned int bit = 1 << i;
+		if(!(*plane_mask & bit)) continue;
+
+		const FrustumPlane *p = frustum + i;
+		Vector3 n(p->a, p->b, p->c);
+		scalar_t dist = dot_product(n, box.center) + p->d;
+		scalar_t rad = fabs(dot_product(n, u)) + fabs(dot_product(n, v)) + fabs(dot_product(n, w));
+
+		if(dist < -rad) return FRUSTUM_OUTSIDE;
+		if(dist < rad) {
+			res = FRUSTUM_INTERSECT;
+		} else {
+			*plane_mask &= ~bit;
+		}
+	}
+	return res;
+}
@@ -54,4 +54,71 @@ public:
 	virtual bool visible(const FrustumPlane *frustum) const;
 };
 
+/* axis aligned box, a plain value type (no hierarchy, no transform),
+ * used by the spatial hierarchies. A default constructed box is empty.
+ */
+class AABox {
+public:
+	Vector3 vmin, vmax;
+
+	AABox();
+	AABox(const Vector3 &vmin, const Vector3 &vmax);
+
+	void reset();
+	bool is_empty() const;
+
+	void add_point(const Vector3 &pt);
+	void add_box(const AABox &box);
+
+	Vector3 get_center() const;
+	Vector3 get_size() const;
+	scalar_t get_surface_area() const;
+
+	// the box enclosing this box after the given affine transformation
+	AABox transformed(const Matrix4x4 &xform) const;
+
+	// slab test, on success returns the parametric range in tnear/tfar
+	bool ray_hit(const Ray &ray, scalar_t *tnear = 0, scalar_t *tfar = 0) const;
+};
+
+/* oriented box, the axes are unit length and orthogonal for boxes made by
+ * calc_pca_obox, but a transformed box with shear in the transformation
+ * is really a parallelepiped; none of the tests below depend on that.
+ */
+class OBox {
+public:
+	Vector3 center;
+	Vector3 axis[3];
+	Vector3 extent;		// half the size along each axis
+
+	OBox();
+	OBox(const AABox &box);
+
+	scalar_t get_volume() const;
+	AABox get_aabox() const;
+
+	OBox transformed(const Matrix4x4 &xform) const;
+};
+
+/* tight bounding volumes for point sets, meant to be calculated once when
+ * the geometry is loaded. calc_min_sphere finds the minimal sphere (Welzl's
+ * algorithm, with move-to-front), calc_ritter_sphere a fast approximation.
+ * calc_pca_obox fits a box along the principal axes of the points, or
+ * returns the axis aligned box if that happens to be smaller.
+ */
+void calc_ritter_sphere(const Vector3 *points, int count, Vector3 *center, scalar_t *radius);
+void calc_min_sphere(const Vector3 *points, int count, Vector3 *center, scalar_t *radius);
+OBox calc_pca_obox(const Vector3 *points, int count);
+
+enum {FRUSTUM_OUTSIDE, FRUSTUM_INTERSECT, FRUSTUM_INSIDE};
+#define FRUSTUM_ALL_PLANES	0x3f
+
+/* tests against the frustum planes selected by the bits of *plane_mask,
+ * clearing the bits of the planes the volume is completely inside of, so
+ * that they can be skipped when testing anything contained in it.
+ */
+int frustum_test(const AABox &box, const FrustumPlane *frustum, unsigned int *plane_mask);
+int frustum_test(const Vector3 &center, scalar_t radius, const FrustumPlane *frustum, unsigned int *plane_mask);
+int frustum_test(const OBox &box, const FrustumPlane *frustum, unsigned int *plane_mask);
+
 #endif	// _BVOL_HPP_
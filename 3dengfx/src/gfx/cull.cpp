@@ -0,0 +1,228 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Batch frustum culling of world space bounding spheres and oriented boxes. */
+
+#include "3dengfx_config.h"
+#include "cull.hpp"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
+// pad the streams so that a batch starting at any valid index can be loaded
+#define PAD		4
+
+FrustumCuller::FrustumCuller() {
+	count = 0;
+}
+
+void FrustumCuller::clear() {
+	resize(0);
+}
+
+void FrustumCuller::resize(int count) {
+	this->count = count;
+	for(int i=0; i<CULL_NUM_STREAMS; i++) {
+		streams[i].resize(count + PAD, 0.0f);
+	}
+	hint.resize(count + PAD, 0);
+}
+
+int FrustumCuller::get_count() const {
+	return count;
+}
+
+void FrustumCuller::set_bounds(int idx, const Vector3 &center, scalar_t radius, const OBox &box) {
+	Vector3 u = box.axis[0] * box.extent.x;
+	Vector3 v = box.axis[1] * box.extent.y;
+	Vector3 w = box.axis[2] * box.extent.z;
+
+	streams[CULL_SPH_X][idx] = center.x;
+	streams[CULL_SPH_Y][idx] = center.y;
+	streams[CULL_SPH_Z][idx] = center.z;
+	streams[CULL_SPH_RAD][idx] = radius;
+	streams[CULL_BOX_X][idx] = box.center.x;
+	streams[CULL_BOX_Y][idx] = box.center.y;
+	streams[CULL_BOX_Z][idx] = box.center.z;
+	streams[CULL_BOX_UX][idx] = u.x;
+	streams[CULL_BOX_UY][idx] = u.y;
+	streams[CULL_BOX_UZ][idx] = u.z;
+	streams[CULL_BOX_VX][idx] = v.x;
+	streams[CULL_BOX_VY][idx] = v.y;
+	streams[CULL_BOX_VZ][idx] = v.z;
+	streams[CULL_BOX_WX][idx] = w.x;
+	streams[CULL_BOX_WY][idx] = w.y;
+	streams[CULL_BOX_WZ][idx] = w.z;
+}
+
+#ifdef USE_SSE
+
+/* returns a 4 bit mask of the volumes completely outside of the planes
+ * given in a, b, c, d (one plane per lane, or the same for all).
+ */
+static inline unsigned int outside4(__m128 a, __m128 b, __m128 c, __m128 d, const float **s) {
+	__m128 zero = _mm_setzero_ps();
+	__m128 sign = _mm_set1_ps(-0.0f);
+
+	__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(s[CULL_SPH_X])),
+				_mm_mul_ps(b, _mm_loadu_ps(s[CULL_SPH_Y]))),
+			_mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(s[CULL_SPH_Z])), d));
+	__m128 sph_out = _mm_cmplt_ps(_mm_add_ps(dist, _mm_loadu_ps(s[CULL_SPH_RAD])), zero);
+
+	dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(s[CULL_BOX_X])),
+				_mm_mul_ps(b, _mm_loadu_ps(s[CULL_BOX_Y]))),
+			_mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(s[CULL_BOX_Z])), d));
+
+	// projected radius of the box: |n.u| + |n.v| + |n.w|
+	__m128 pu = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(s[CULL_BOX_UX])),
+				_mm_mul_ps(b, _mm_loadu_ps(s[CULL_BOX_UY]))), _mm_mul_ps(c, _mm_loadu_ps(s[CULL_BOX_UZ])));
+	__m128 pv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(s[CULL_BOX_VX])),
+				_mm_mul_ps(b, _mm_loadu_ps(s[CULL_BOX_VY]))), _mm_mul_ps(c, _mm_loadu_ps(s[CULL_BOX_VZ])));
+	__m128 pw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(s[CULL_BOX_WX])),
+				_mm_mul_ps(b, _mm_loadu_ps(s[CULL_BOX_WY]))), _mm_mul_ps(c, _mm_loadu_ps(s[CULL_BOX_WZ])));
+	__m128 rad = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, pu), _mm_andnot_ps(sign, pv)), _mm_andnot_ps(sign, pw));
+	__m128 box_out = _mm_cmplt_ps(_mm_add_ps(dist, rad), zero);
+
+	return _mm_movemask_ps(_mm_or_ps(sph_out, box_out));
+}
+
+#else	// scalar fallback
+
+static inline unsigned int outside1(const FrustumPlane *p, const float **s, int i) {
+	float dist = p->a * s[CULL_SPH_X][i] + p->b * s[CULL_SPH_Y][i] + p->c * s[CULL_SPH_Z][i] + p->d;
+	if(dist < -s[CULL_SPH_RAD][i]) return 1;
+
+	dist = p->a * s[CULL_BOX_X][i] + p->b * s[CULL_BOX_Y][i] + p->c * s[CULL_BOX_Z][i] + p->d;
+	float rad = fabs(p->a * s[CULL_BOX_UX][i] + p->b * s[CULL_BOX_UY][i] + p->c * s[CULL_BOX_UZ][i]) +
+		fabs(p->a * s[CULL_BOX_VX][i] + p->b * s[CULL_BOX_VY][i] + p->c * s[CULL_BOX_VZ][i]) +
+		fabs(p->a * s[CULL_BOX_WX][i] + p->b * s[CULL_BOX_WY][i] + p->c * s[CULL_BOX_WZ][i]);
+	return dist < -rad ? 1 : 0;
+}
+
+#endif	// USE_SSE
+
+/* test4
+ * Tests the 4 volumes starting at first (those with their bit set in
+ * active), and returns the mask of the visible ones. Each volume is first
+ * tested against the plane that rejected it last time, which most of the
+ * time rejects it again for objects that stay out of view.
+ */
+unsigned int FrustumCuller::test4(const FrustumPlane *frustum, int first, unsigned int active, unsigned int plane_mask) {
+	const float *s[CULL_NUM_STREAMS];
+	for(int i=0; i<CULL_NUM_STREAMS; i++) {
+		s[i] = &streams[i][0] + first;
+	}
+	unsigned char *h = &hint[first];
+
+	unsigned int out = 0;
+
+	// coherency test, against the plane that rejected each volume last time
+	int hp[4];
+	for(int i=0; i<4; i++) {
+		hp[i] = (plane_mask & (1 << h[i])) ? h[i] : -1;
+	}
+
+#ifdef USE_SSE
+	if(hp[0] >= 0 || hp[1] >= 0 || hp[2] >= 0 || hp[3] >= 0) {
+		unsigned int hint_valid = 0;
+		float pa[4], pb[4], pc[4], pd[4];
+		for(int i=0; i<4; i++) {
+			if(hp[i] >= 0) {
+				const FrustumPlane *p = frustum + hp[i];
+				pa[i] = p->a; pb[i] = p->b; pc[i] = p->c; pd[i] = p->d;
+				hint_valid |= 1 << i;
+			} else {
+				pa[i] = pb[i] = pc[i] = pd[i] = 0.0f;
+			}
+		}
+
+		out = outside4(_mm_loadu_ps(pa), _mm_loadu_ps(pb), _mm_loadu_ps(pc), _mm_loadu_ps(pd), s) & hint_valid & active;
+		if(out == active) return 0;
+	}
+
+	for(int i=0; i<6; i++) {
+		if(!(plane_mask & (1 << i))) continue;
+
+		const FrustumPlane *p = frustum + i;
+		unsigned int pout = outside4(_mm_set1_ps(p->a), _mm_set1_ps(p->b), _mm_set1_ps(p->c), _mm_set1_ps(p->d), s) & active;
+
+		unsigned int newly = pout & ~out;
+		if(newly) {
+			for(int j=0; j<4; j++) {
+				if(newly & (1 << j)) h[j] = i;
+			}
+			out |= newly;
+			if(out == active) break;
+		}
+	}
+#else
+	for(int j=0; j<4; j++) {
+		if(!(active & (1 << j))) continue;
+
+		if(hp[j] >= 0 && outside1(frustum + hp[j], s, j)) {
+			out |= 1 << j;
+			continue;
+		}
+
+		for(int i=0; i<6; i++) {
+			if(i == hp[j] || !(plane_mask & (1 << i))) continue;
+
+			if(outside1(frustum + i, s, j)) {
+				h[j] = i;
+				out |= 1 << j;
+				break;
+			}
+		}
+	}
+#endif	// USE_SSE
+
+	return active & ~out;
+}
+
+int FrustumCuller::cull(const FrustumPlane *frustum, int first, int count, std::vector<int> *visible, unsigned int plane_mask) {
+	int vis_count = 0;
+
+	if(!plane_mask) {
+		for(int i=0; i<count; i++) {
+			visible->push_back(first + i);
+		}
+		return count;
+	}
+
+	for(int i=0; i<count; i+=4) {
+		int left = count - i;
+		unsigned int active = left >= 4 ? 0xf : (1 << left) - 1;
+
+		unsigned int vis = test4(frustum, first + i, active, plane_mask);
+		for(int j=0; vis; j++, vis >>= 1) {
+			if(vis & 1) {
+				visible->push_back(first + i + j);
+				vis_count++;
+			}
+		}
+	}
+	return vis_count;
+}
+
+int FrustumCuller::cull(const FrustumPlane *frustum, std::vector<int> *visible) {
+	return cull(frustum, 0, count, visible);
+}
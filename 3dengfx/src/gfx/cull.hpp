@@ -0,0 +1,70 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Batch frustum culling of world space bounding spheres and oriented boxes.
+ * The bounds are kept in structure of arrays form, and tested 4 at a time
+ * with SSE where available.
+ */
+
+#ifndef _CULL_HPP_
+#define _CULL_HPP_
+
+#include <vector>
+#include "n3dmath2/n3dmath2.hpp"
+#include "gfx/bvol.hpp"
+
+enum {
+	CULL_SPH_X, CULL_SPH_Y, CULL_SPH_Z, CULL_SPH_RAD,
+	CULL_BOX_X, CULL_BOX_Y, CULL_BOX_Z,
+	CULL_BOX_UX, CULL_BOX_UY, CULL_BOX_UZ,	// box axes, scaled by the extents
+	CULL_BOX_VX, CULL_BOX_VY, CULL_BOX_VZ,
+	CULL_BOX_WX, CULL_BOX_WY, CULL_BOX_WZ,
+
+	CULL_NUM_STREAMS
+};
+
+class FrustumCuller {
+private:
+	std::vector<float> streams[CULL_NUM_STREAMS];
+	// the plane that rejected each volume the last time, tested first
+	std::vector<unsigned char> hint;
+	int count;
+
+	unsigned int test4(const FrustumPlane *frustum, int first, unsigned int active, unsigned int plane_mask);
+
+public:
+	FrustumCuller();
+
+	void clear();
+	void resize(int count);
+	int get_count() const;
+
+	void set_bounds(int idx, const Vector3 &center, scalar_t radius, const OBox &box);
+
+	/* append the indices of all the volumes in [first, first + count) that are
+	 * not completely outside any of the planes selected by plane_mask.
+	 * Returns the number of indices appended.
+	 */
+	int cull(const FrustumPlane *frustum, int first, int count, std::vector<int> *visible,
+			unsigned int plane_mask = FRUSTUM_ALL_PLANES);
+	int cull(const FrustumPlane *frustum, std::vector<int> *visible);
+};
+
+#endif	// _CULL_HPP_
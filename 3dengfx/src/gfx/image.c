@@ -97,6 +97,7 @@ void free_image(void *img) {
 
 int save_image(const char *fname, void *pixels, unsigned long xsz, unsigned long ysz, enum image_file_format fmt) {
 	FILE *fp;
+	int res = -1;
 
 	if(!(fp = fopen(fname, "wb"))) {
 		fprintf(stderr, "Image saving error: could not open file %s for writing\n", fname);
@@ -106,25 +107,25 @@ int save_image(const char *fname, void *pixels, unsigned long xsz, unsigned long
 	switch(fmt) {
 	case IMG_FMT_PNG:
 #ifdef IMGLIB_USE_PNG
-		save_png(fp, pixels, xsz, ysz);
+		res = save_png(fp, pixels, xsz, ysz);
 		break;
 #endif	/* IMGLIB_USE_PNG */
 
 	case IMG_FMT_JPEG:
 #ifdef IMGLIB_USE_JPEG
-		save_jpeg(fp, pixels, xsz, ysz);
+		res = save_jpeg(fp, pixels, xsz, ysz);
 #endif	/* IMGLIB_USE_JPEG */
 		break;
 		
 	case IMG_FMT_TGA:
 #ifdef IMGLIB_USE_TGA
-		save_tga(fp, pixels, xsz, ysz);
+		res = save_tga(fp, pixels, xsz, ysz);
 #endif	/* IMGLIB_USE_TGA */
 		break;
 
 	case IMG_FMT_PPM:
 #ifdef IMGLIB_USE_PPM
-		save_ppm(fp, pixels, xsz, ysz);
+		res = save_ppm(fp, pixels, xsz, ysz);
 #endif	/* IMGLIB_USE_PPM */
 		break;
 
@@ -133,9 +134,11 @@ int save_image(const char *fname, void *pixels, unsigned long xsz, unsigned long
 		break;
 	}
 
-	fclose(fp);
-	
-	return 0;
+	/* the file is closed here, not by the format specific functions */
+	if(fclose(fp) == EOF) {
+		res = -1;
+	}
+	return res;
 }
 
 
@@ -107,24 +107,33 @@ void *load_ppm(FILE *fp, unsigned long *xsz, unsigned long *ysz) {
 }
 
 int save_ppm(FILE *fp, void *pixels, unsigned long xsz, unsigned long ysz) {
-	int i, sz = xsz * ysz;
+	int i, j;
 	uint32_t *ptr = pixels;
+	unsigned char *row, *dest;
 	
 	fprintf(fp, "P6\n%lu %lu\n255\n# 3dengfx PPM file writer\n", xsz, ysz);
 
-	for(i=0; i<sz; i++) {
-		int r = (*ptr & RED_MASK32) >> RED_SHIFT32;
-		int g = (*ptr & GREEN_MASK32) >> GREEN_SHIFT32;
-		int b = (*ptr++ & BLUE_MASK32) >> BLUE_SHIFT32;
+	/* a row at a time */
+	if(!(row = malloc(xsz * 3))) {
+		return -1;
+	}
+
+	for(i=0; i<ysz; i++) {
+		dest = row;
+		for(j=0; j<xsz; j++) {
+			*dest++ = (*ptr & RED_MASK32) >> RED_SHIFT32;
+			*dest++ = (*ptr & GREEN_MASK32) >> GREEN_SHIFT32;
+			*dest++ = (*ptr++ & BLUE_MASK32) >> BLUE_SHIFT32;
+		}
 
-		if(fputc(r, fp) == EOF || fputc(g, fp) == EOF || fputc(b, fp) == EOF) {
+		if(fwrite(row, 3, xsz, fp) != xsz) {
 			fputs("save_ppm: failed to write to file", stderr);
-			fclose(fp);
+			free(row);
 			return -1;
 		}
 	}
+	free(row);
 
-	fclose(fp);
 	return 0;
 }
 
@@ -151,10 +151,10 @@ void *load_tga(FILE *fp, unsigned long *xsz, unsigned long *ysz) {
 int save_tga(FILE *fp, void *pixels, unsigned long xsz, unsigned long ysz) {
 	struct tga_header hdr;
 	struct tga_footer ftr;
-	unsigned long pix_count = xsz * ysz;
 	uint32_t *pptr = pixels;
 	unsigned long save_flags;
-	int i;
+	unsigned char *row, *dest;
+	int i, j, pix_size;
 
 	save_flags = get_image_save_flags();
 
@@ -194,18 +194,31 @@ int save_tga(FILE *fp, void *pixels, unsigned long xsz, unsigned long ysz) {
 	fwrite(&hdr.img_bpp, 1, 1, fp);
 	fwrite(&hdr.img_desc, 1, 1, fp);
 
-	/* write the pixels */
-	for(i=0; i<pix_count; i++) {
-		fputc((*pptr >> BLUE_SHIFT32) & 0xff, fp);
-		fputc((*pptr >> GREEN_SHIFT32) & 0xff, fp);
-		fputc((*pptr >> RED_SHIFT32) & 0xff, fp);
-		
-		if(save_flags & IMG_SAVE_ALPHA) {
-			fputc((*pptr >> ALPHA_SHIFT32) & 0xff, fp);
+	/* write the pixels, a row at a time */
+	pix_size = (save_flags & IMG_SAVE_ALPHA) ? 4 : 3;
+	if(!(row = malloc(xsz * pix_size))) {
+		return -1;
+	}
+
+	for(i=0; i<ysz; i++) {
+		dest = row;
+		for(j=0; j<xsz; j++) {
+			*dest++ = (*pptr >> BLUE_SHIFT32) & 0xff;
+			*dest++ = (*pptr >> GREEN_SHIFT32) & 0xff;
+			*dest++ = (*pptr >> RED_SHIFT32) & 0xff;
+
+			if(save_flags & IMG_SAVE_ALPHA) {
+				*dest++ = (*pptr >> ALPHA_SHIFT32) & 0xff;
+			}
+			pptr++;
+		}
+
+		if(fwrite(row, pix_size, xsz, fp) != xsz) {
+			free(row);
+			return -1;
 		}
-		
-		pptr++;
 	}
+	free(row);
 
 	/* write the footer */
 	write_int32_le(fp, ftr.ext_off);
@@ -213,7 +226,6 @@ int save_tga(FILE *fp, void *pixels, unsigned long xsz, unsigned long ysz) {
 	fputs(ftr.sig, fp);
 	fputc(0, fp);
 
-	fclose(fp);
 	return 0;
 }
 
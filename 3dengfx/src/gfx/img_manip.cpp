@@ -577,3 +577,54 @@ bool blur(PixelBuffer *pb, ImgSamplingMode sampling)
 
 	return true;
 }
+
+bool dilate(PixelBuffer *pb, int passes)
+{
+	if(!pb) return false;
+	if(pb->width <= 0 || pb->height <= 0) return false;
+
+	int w = pb->width, h = pb->height;
+	Pixel *temp = (Pixel*)malloc(w * h * sizeof(Pixel));
+
+	for(int p=0; p<passes; p++)
+	{
+		memcpy(temp, pb->buffer, w * h * sizeof(Pixel));
+		bool changed = false;
+
+		for(int j=0; j<h; j++)
+		{
+			for(int i=0; i<w; i++)
+			{
+				if((temp[j * w + i] >> ALPHA_SHIFT32) & ALPHA_MASK32) continue;
+
+				unsigned long r = 0, g = 0, b = 0;
+				int count = 0;
+				for(int y=j-1; y<=j+1; y++)
+				{
+					if(y < 0 || y >= h) continue;
+					for(int x=i-1; x<=i+1; x++)
+					{
+						if(x < 0 || x >= w) continue;
+						Pixel pix = temp[y * w + x];
+						if(!((pix >> ALPHA_SHIFT32) & ALPHA_MASK32)) continue;
+
+						r += (pix >> RED_SHIFT32) & RED_MASK32;
+						g += (pix >> GREEN_SHIFT32) & GREEN_MASK32;
+						b += (pix >> BLUE_SHIFT32) & BLUE_MASK32;
+						count++;
+					}
+				}
+
+				if(count)
+				{
+					pb->buffer[j * w + i] = PACK_COLOR32(255, r / count, g / count, b / count);
+					changed = true;
+				}
+			}
+		}
+		if(!changed) break;
+	}
+
+	free(temp);
+	return true;
+}
@@ -42,4 +42,10 @@ int* load_kernel(const char* filename, int *dim);
 bool sobel_edge(PixelBuffer *pb, ImgSamplingMode sampling = SAMPLE_CLAMP);
 bool blur(PixelBuffer *pb, ImgSamplingMode sampling = SAMPLE_CLAMP);
 
+/* grows the opaque (alpha > 0) areas of the image into the transparent
+ * pixels around them, one pixel per pass, with the average of the opaque
+ * neighbours. Used to pad the charts of texture atlases against bleeding.
+ */
+bool dilate(PixelBuffer *pb, int passes = 1);
+
 #endif	// _IMG_MANIP_HPP_
@@ -0,0 +1,264 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* triangle and vertex reordering for drawing */
+
+#include <vector>
+#include <algorithm>
+#include "meshopt.hpp"
+
+#define NO_VERTEX	0xffffffff
+
+/* The FIFO cache is simulated with time stamps, a vertex is in the cache
+ * while less than cache_size vertices have been added after it. Adding
+ * cache_size + 1 to the time flushes it.
+ */
+static inline int cache_vertex(Index v, unsigned long *stamp, unsigned long *time, int cache_size) {
+	if(*time - stamp[v] > (unsigned long)cache_size) {
+		stamp[v] = (*time)++;
+		return 1;
+	}
+	return 0;
+}
+
+static inline int cache_triangle(const Index *tri, unsigned long *stamp, unsigned long *time, int cache_size) {
+	int misses = cache_vertex(tri[0], stamp, time, cache_size);
+	misses += cache_vertex(tri[1], stamp, time, cache_size);
+	return misses + cache_vertex(tri[2], stamp, time, cache_size);
+}
+
+scalar_t calc_acmr(const Index *indices, unsigned long icount, unsigned long vcount, int cache_size) {
+	if(icount < 3) return 0.0;
+
+	std::vector<unsigned long> stamp(vcount, 0);
+	unsigned long time = cache_size + 1;
+	unsigned long misses = 0;
+
+	for(unsigned long i=0; i<icount; i++) {
+		misses += cache_vertex(indices[i], &stamp[0], &time, cache_size);
+	}
+	return (scalar_t)misses / (scalar_t)(icount / 3);
+}
+
+/* optimize_vertex_cache
+ * tipsify: draws all the triangles around a fanning vertex, then moves on
+ * to the one of their vertices that is oldest in the cache but will still
+ * be there after its own triangles are drawn. With no such vertex it goes
+ * back through the vertices used recently (the dead end stack), and then on
+ * to the next vertex in index order with triangles left.
+ */
+void optimize_vertex_cache(uint32_t *order, const Index *indices, unsigned long tcount,
+		unsigned long vcount, int cache_size) {
+	unsigned long icount = tcount * 3;
+	if(!tcount) return;
+
+	// the triangles around each vertex, and how many of them are left
+	std::vector<uint32_t> live(vcount, 0), offs(vcount + 1, 0), adj(icount);
+	for(unsigned long i=0; i<icount; i++) {
+		live[indices[i]]++;
+	}
+	for(unsigned long i=0; i<vcount; i++) {
+		offs[i + 1] = offs[i] + live[i];
+	}
+	std::vector<uint32_t> fill(offs.begin(), offs.end() - 1);
+	for(unsigned long i=0; i<icount; i++) {
+		adj[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<unsigned long> stamp(vcount, 0);
+	unsigned long time = cache_size + 1;
+	std::vector<char> emitted(tcount, 0);
+	std::vector<uint32_t> dead_end, cand;
+	dead_end.reserve(icount);
+
+	unsigned long out = 0, cursor = 0;
+	uint32_t fan = indices[0];
+
+	while(fan != NO_VERTEX) {
+		cand.clear();
+		for(uint32_t i=offs[fan]; i<offs[fan + 1]; i++) {
+			uint32_t t = adj[i];
+			if(emitted[t]) continue;
+
+			const Index *tri = indices + t * 3;
+			for(int j=0; j<3; j++) {
+				dead_end.push_back(tri[j]);
+				cand.push_back(tri[j]);
+				live[tri[j]]--;
+				cache_vertex(tri[j], &stamp[0], &time, cache_size);
+			}
+			emitted[t] = 1;
+			order[out++] = t;
+		}
+
+		fan = NO_VERTEX;
+		long best = -1;
+		for(size_t i=0; i<cand.size(); i++) {
+			uint32_t v = cand[i];
+			if(!live[v]) continue;
+
+			long prio = 0;
+			unsigned long age = time - stamp[v];
+			if(age + 2 * live[v] <= (unsigned long)cache_size) {
+				prio = age;
+			}
+			if(prio > best) {
+				best = prio;
+				fan = v;
+			}
+		}
+
+		while(fan == NO_VERTEX && !dead_end.empty()) {
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if(live[v]) fan = v;
+		}
+
+		while(fan == NO_VERTEX && cursor < vcount) {
+			if(live[cursor]) {
+				fan = cursor;
+			} else {
+				cursor++;
+			}
+		}
+	}
+}
+
+struct Cluster {
+	scalar_t sort_key;
+	unsigned long start, end;
+};
+
+// the outward facing clusters first, ties in the original order
+static bool cluster_before(const Cluster &a, const Cluster &b) {
+	if(a.sort_key != b.sort_key) return a.sort_key > b.sort_key;
+	return a.start < b.start;
+}
+
+/* optimize_overdraw
+ * A cluster starts wherever all three vertices of a triangle miss the
+ * cache, since there is nothing to lose there. These are split further
+ * as soon as the ACMR from the start of the cluster drops within the
+ * threshold of the ACMR of the whole cluster. The clusters are sorted by
+ * how far out along its normal each lies, from the center of the mesh.
+ */
+void optimize_overdraw(uint32_t *order, const Index *indices, unsigned long tcount,
+		const Vertex *verts, unsigned long vcount, int cache_size, scalar_t threshold) {
+	if(!tcount) return;
+
+	std::vector<unsigned long> stamp(vcount, 0);
+	unsigned long time = cache_size + 1;
+
+	std::vector<unsigned long> hard;
+	for(unsigned long i=0; i<tcount; i++) {
+		if(cache_triangle(indices + order[i] * 3, &stamp[0], &time, cache_size) == 3) {
+			hard.push_back(i);
+		}
+	}
+	hard.push_back(tcount);
+
+	std::vector<Cluster> clusters;
+	for(size_t c=0; c<hard.size() - 1; c++) {
+		unsigned long start = hard[c], end = hard[c + 1];
+
+		time += cache_size + 1;
+		unsigned long misses = 0;
+		for(unsigned long i=start; i<end; i++) {
+			misses += cache_triangle(indices + order[i] * 3, &stamp[0], &time, cache_size);
+		}
+		scalar_t limit = threshold * (scalar_t)misses / (scalar_t)(end - start);
+
+		time += cache_size + 1;
+		unsigned long run_misses = 0, run_tris = 0;
+		Cluster cl;
+		cl.start = start;
+		for(unsigned long i=start; i<end; i++) {
+			run_misses += cache_triangle(indices + order[i] * 3, &stamp[0], &time, cache_size);
+			run_tris++;
+
+			if(i + 1 < end && (scalar_t)run_misses <= limit * (scalar_t)run_tris) {
+				cl.end = i + 1;
+				clusters.push_back(cl);
+				cl.start = i + 1;
+
+				time += cache_size + 1;
+				run_misses = run_tris = 0;
+			}
+		}
+		cl.end = end;
+		clusters.push_back(cl);
+	}
+
+	Vector3 center;
+	for(unsigned long i=0; i<vcount; i++) {
+		center += verts[i].pos;
+	}
+	if(vcount) center /= (scalar_t)vcount;
+
+	for(size_t c=0; c<clusters.size(); c++) {
+		Vector3 cent, normal;
+		scalar_t area = 0.0;
+
+		for(unsigned long i=clusters[c].start; i<clusters[c].end; i++) {
+			const Index *tri = indices + order[i] * 3;
+			const Vector3 &p0 = verts[tri[0]].pos, &p1 = verts[tri[1]].pos, &p2 = verts[tri[2]].pos;
+
+			Vector3 n = cross_product(p1 - p0, p2 - p0);
+			scalar_t a = n.length();
+			cent += (p0 + p1 + p2) * (a / 3.0);
+			normal += n;
+			area += a;
+		}
+
+		scalar_t nlen = normal.length();
+		if(area > 0.0 && nlen > 0.0) {
+			clusters[c].sort_key = dot_product(cent / area - center, normal / nlen);
+		} else {
+			clusters[c].sort_key = 0.0;
+		}
+	}
+
+	std::sort(clusters.begin(), clusters.end(), cluster_before);
+
+	std::vector<uint32_t> src(order, order + tcount);
+	unsigned long out = 0;
+	for(size_t c=0; c<clusters.size(); c++) {
+		for(unsigned long i=clusters[c].start; i<clusters[c].end; i++) {
+			order[out++] = src[i];
+		}
+	}
+}
+
+unsigned long optimize_vertex_fetch(uint32_t *remap, const Index *indices, unsigned long icount, unsigned long vcount) {
+	std::fill(remap, remap + vcount, (uint32_t)NO_VERTEX);
+
+	uint32_t next = 0;
+	for(unsigned long i=0; i<icount; i++) {
+		if(remap[indices[i]] == NO_VERTEX) {
+			remap[indices[i]] = next++;
+		}
+	}
+
+	unsigned long used = next;
+	for(unsigned long i=0; i<vcount; i++) {
+		if(remap[i] == NO_VERTEX) remap[i] = next++;
+	}
+	return used;
+}
@@ -0,0 +1,69 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* triangle and vertex reordering for drawing
+ *
+ * The triangles are reordered for the post transform vertex cache with
+ * tipsify (Sander, Nehab and Barczak 2007), which fans around vertices that
+ * are still in the cache. The clusters of that order can then be sorted to
+ * draw the outward facing ones first, for less overdraw, without giving up
+ * much of the cache efficiency. Last the vertices are renumbered in the
+ * order they are first used, so that fetching them walks the vertex buffer.
+ * TriMesh::optimize() does all of it on a mesh.
+ */
+
+#ifndef _MESHOPT_HPP_
+#define _MESHOPT_HPP_
+
+#include "gfx/3dgeom.hpp"
+
+#define VCACHE_SIZE		16
+
+struct MeshOptStats {
+	scalar_t acmr_before, acmr_after;	// vertices transformed per triangle
+	scalar_t atvr_before, atvr_after;	// vertices transformed per vertex used
+};
+
+/* average cache miss ratio of drawing the indices through a FIFO cache of
+ * cache_size vertices, 0.5 is the best possible for a large regular mesh,
+ * 3 the worst.
+ */
+scalar_t calc_acmr(const Index *indices, unsigned long icount, unsigned long vcount, int cache_size = VCACHE_SIZE);
+
+/* finds a drawing order of the tcount triangles of indices, order[i] is the
+ * triangle to draw i-th.
+ */
+void optimize_vertex_cache(uint32_t *order, const Index *indices, unsigned long tcount,
+		unsigned long vcount, int cache_size = VCACHE_SIZE);
+
+/* splits the triangle order into clusters, wherever that keeps the ACMR
+ * within threshold of what it was, and draws the clusters facing away from
+ * the center of the mesh first.
+ */
+void optimize_overdraw(uint32_t *order, const Index *indices, unsigned long tcount,
+		const Vertex *verts, unsigned long vcount, int cache_size = VCACHE_SIZE, scalar_t threshold = 1.05);
+
+/* numbers the vertices in the order they are first used by the indices,
+ * remap[i] is the new index of vertex i. Unused vertices go at the end,
+ * the number of used ones is returned.
+ */
+unsigned long optimize_vertex_fetch(uint32_t *remap, const Index *indices, unsigned long icount, unsigned long vcount);
+
+#endif	// _MESHOPT_HPP_
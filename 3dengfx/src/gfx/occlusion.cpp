@@ -0,0 +1,443 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Software occlusion culling with a masked, tiled depth buffer. */
+
+#include "3dengfx_config.h"
+
+#include <float.h>
+#include <string.h>
+#include "occlusion.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+#define FULL_MASK	0xffffffff
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+// distance from the near clipping plane in clip space (see create_projection_matrix)
+static inline scalar_t near_dist(const Vector4 &v) {
+#ifdef COORD_LHS
+	return v.z;
+#else
+	return v.z + v.w;
+#endif
+}
+
+static inline Vector4 to_clip(const Matrix4x4 &m, const Vector3 &v) {
+	return Vector4(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3],
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3],
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3],
+			m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3]);
+}
+
+// bits first .. last inclusive, either may be out of the [0, 31] range
+static inline uint32_t span_mask(int first, int last) {
+	if(first < 0) first = 0;
+	if(last > 31) last = 31;
+	if(first > last) return 0;
+
+	uint32_t hi = last == 31 ? FULL_MASK : ((uint32_t)1 << (last + 1)) - 1;
+	return hi & ~(((uint32_t)1 << first) - 1);
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height) {
+	set_size(width, height);
+	memset(&stats, 0, sizeof stats);
+}
+
+void OcclusionBuffer::set_size(int width, int height) {
+	xtiles = (width + OCC_TILE_WIDTH - 1) / OCC_TILE_WIDTH;
+	ytiles = (height + OCC_TILE_HEIGHT - 1) / OCC_TILE_HEIGHT;
+	if(xtiles < 1) xtiles = 1;
+	if(ytiles < 1) ytiles = 1;
+
+	this->width = xtiles * OCC_TILE_WIDTH;
+	this->height = ytiles * OCC_TILE_HEIGHT;
+	tiles.resize(xtiles * ytiles);
+}
+
+int OcclusionBuffer::get_width() const {
+	return width;
+}
+
+int OcclusionBuffer::get_height() const {
+	return height;
+}
+
+void OcclusionBuffer::begin_frame(const Matrix4x4 &view_proj) {
+	this->view_proj = view_proj;
+
+	for(size_t i=0; i<tiles.size(); i++) {
+		memset(tiles[i].mask, 0, sizeof tiles[i].mask);
+		tiles[i].zref = 0.0f;			// infinitely far
+		tiles[i].zwork = FLT_MAX;		// empty working layer
+	}
+	memset(&stats, 0, sizeof stats);
+}
+
+void OcclusionBuffer::add_occluder(const TriMesh &mesh, const Matrix4x4 &world) {
+	const Vertex *varray = mesh.get_vertex_array()->get_data();
+	int vcount = mesh.get_vertex_array()->get_count();
+	const Triangle *tarray = mesh.get_triangle_array()->get_data();
+	int tcount = mesh.get_triangle_array()->get_count();
+
+	Matrix4x4 mvp = view_proj * world;
+
+	clip_verts.resize(vcount);
+	for(int i=0; i<vcount; i++) {
+		clip_verts[i] = to_clip(mvp, varray[i].pos);
+	}
+
+	for(int i=0; i<tcount; i++) {
+		const Index *idx = tarray[i].vertices;
+		draw_clipped(clip_verts[idx[0]], clip_verts[idx[1]], clip_verts[idx[2]]);
+	}
+
+	stats.occluders++;
+	stats.occluder_tris += tcount;
+}
+
+void OcclusionBuffer::add_occluder(const Vector3 *verts, int vcount, const Index *indices, int icount, const Matrix4x4 &world) {
+	Matrix4x4 mvp = view_proj * world;
+
+	clip_verts.resize(vcount);
+	for(int i=0; i<vcount; i++) {
+		clip_verts[i] = to_clip(mvp, verts[i]);
+	}
+
+	for(int i=0; i<icount - 2; i+=3) {
+		draw_clipped(clip_verts[indices[i]], clip_verts[indices[i + 1]], clip_verts[indices[i + 2]]);
+	}
+
+	stats.occluders++;
+	stats.occluder_tris += icount / 3;
+}
+
+/* draw_clipped
+ * clips against the near plane only, the rasterizer clamps to the screen.
+ * Parts of occluders in front of the near plane don't hide anything since
+ * they are clipped away when drawing too.
+ */
+void OcclusionBuffer::draw_clipped(const Vector4 &v0, const Vector4 &v1, const Vector4 &v2) {
+	const Vector4 *in[] = {&v0, &v1, &v2};
+	scalar_t dist[3];
+	int inside = 0;
+
+	for(int i=0; i<3; i++) {
+		dist[i] = near_dist(*in[i]);
+		if(dist[i] >= 0.0) inside++;
+	}
+
+	if(!inside) return;
+	if(inside == 3) {
+		Vector4 tri[] = {v0, v1, v2};
+		draw_triangle(tri);
+		return;
+	}
+
+	// Sutherland-Hodgman with a single plane, makes a triangle or a quad
+	Vector4 poly[4];
+	int pcount = 0;
+	for(int i=0; i<3; i++) {
+		int next = (i + 1) % 3;
+
+		if(dist[i] >= 0.0) {
+			poly[pcount++] = *in[i];
+		}
+		if((dist[i] >= 0.0) != (dist[next] >= 0.0)) {
+			scalar_t t = dist[i] / (dist[i] - dist[next]);
+			poly[pcount++] = *in[i] + (*in[next] - *in[i]) * t;
+		}
+	}
+
+	draw_triangle(poly);
+	if(pcount == 4) {
+		Vector4 tri[] = {poly[0], poly[2], poly[3]};
+		draw_triangle(tri);
+	}
+}
+
+/* calculates the coverage masks of the 8 rows of a tile, for the triangle
+ * given by its 3 edge functions a * x + b * y + c >= 0.
+ */
+static void tile_coverage(const float *ea, const float *eb, const float *ec, float x0, float y0, uint32_t *mask) {
+	int first[OCC_TILE_HEIGHT], last[OCC_TILE_HEIGHT];
+
+#ifdef USE_SSE2
+	const __m128 big = _mm_set1_ps(1e8f);
+	const __m128 half = _mm_set1_ps(0.5f);
+
+	for(int r=0; r<OCC_TILE_HEIGHT; r+=4) {
+		// row centers
+		__m128 ry = _mm_add_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(y0 + r + 0.5f));
+		__m128 xl = _mm_set1_ps(-1e8f);
+		__m128 xr = big;
+
+		for(int i=0; i<3; i++) {
+			__m128 eval = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(eb[i]), ry), _mm_set1_ps(ec[i]));
+
+			if(ea[i] > 0.0f) {
+				// x >= -(b * y + c) / a
+				__m128 x = _mm_mul_ps(eval, _mm_set1_ps(-1.0f / ea[i]));
+				xl = _mm_max_ps(xl, x);
+			} else if(ea[i] < 0.0f) {
+				__m128 x = _mm_mul_ps(eval, _mm_set1_ps(-1.0f / ea[i]));
+				xr = _mm_min_ps(xr, x);
+			} else {
+				// horizontal edge, the whole row is either in or out
+				__m128 out = _mm_cmplt_ps(eval, _mm_setzero_ps());
+				xl = _mm_or_ps(_mm_and_ps(out, big), _mm_andnot_ps(out, xl));
+			}
+		}
+
+		/* pixel i of the row is covered if xl <= x0 + i + 0.5 <= xr. Clamp to the
+		 * tile before converting, and offset to get floor out of truncation.
+		 */
+		const __m128 offs = _mm_set1_ps(64.0f);
+		__m128 fl = _mm_sub_ps(xl, _mm_add_ps(_mm_set1_ps(x0), half));
+		__m128 fr = _mm_sub_ps(xr, _mm_add_ps(_mm_set1_ps(x0), half));
+		fl = _mm_min_ps(_mm_max_ps(fl, _mm_setzero_ps()), _mm_set1_ps(32.0f));
+		fr = _mm_min_ps(_mm_max_ps(fr, _mm_set1_ps(-1.0f)), _mm_set1_ps(31.0f));
+
+		// ceil(fl) = 64 - floor(64 - fl), floor(fr) = floor(fr + 64) - 64
+		__m128i ifirst = _mm_sub_epi32(_mm_set1_epi32(64), _mm_cvttps_epi32(_mm_sub_ps(offs, fl)));
+		__m128i ilast = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(fr, offs)), _mm_set1_epi32(64));
+		_mm_storeu_si128((__m128i*)(first + r), ifirst);
+		_mm_storeu_si128((__m128i*)(last + r), ilast);
+	}
+#else
+	for(int r=0; r<OCC_TILE_HEIGHT; r++) {
+		float y = y0 + r + 0.5f;
+		float xl = -1e8f, xr = 1e8f;
+
+		for(int i=0; i<3; i++) {
+			float eval = eb[i] * y + ec[i];
+			if(ea[i] > 0.0f) {
+				float x = -eval / ea[i];
+				if(x > xl) xl = x;
+			} else if(ea[i] < 0.0f) {
+				float x = -eval / ea[i];
+				if(x < xr) xr = x;
+			} else if(eval < 0.0f) {
+				xl = 1e8f;
+			}
+		}
+
+		float fl = xl - (x0 + 0.5f);
+		float fr = xr - (x0 + 0.5f);
+		first[r] = fl < 0.0f ? 0 : (fl > 32.0f ? 32 : (int)ceil(fl));
+		last[r] = fr < -1.0f ? -1 : (fr > 31.0f ? 31 : (int)floor(fr));
+	}
+#endif	// USE_SSE2
+
+	for(int r=0; r<OCC_TILE_HEIGHT; r++) {
+		mask[r] = span_mask(first[r], last[r]);
+	}
+}
+
+/* draw_triangle
+ * Rasterizes a triangle with all its vertices in front of the near plane.
+ * Per tile the coverage of 32 pixels is a single word, and the triangle
+ * contributes its farthest depth over the tile to the working layer.
+ */
+void OcclusionBuffer::draw_triangle(const Vector4 *v) {
+	float sx[3], sy[3], sz[3];
+	for(int i=0; i<3; i++) {
+		float inv_w = 1.0f / v[i].w;
+		sx[i] = (v[i].x * inv_w * 0.5f + 0.5f) * width;
+		sy[i] = (v[i].y * inv_w * 0.5f + 0.5f) * height;
+		sz[i] = inv_w;
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+	if(fabs(area) < 1e-6) return;
+
+	// both windings are rasterized, make it counter-clockwise
+	if(area < 0.0f) {
+		float tmp;
+		tmp = sx[1]; sx[1] = sx[2]; sx[2] = tmp;
+		tmp = sy[1]; sy[1] = sy[2]; sy[2] = tmp;
+		tmp = sz[1]; sz[1] = sz[2]; sz[2] = tmp;
+		area = -area;
+	}
+
+	float fxmin = MIN(sx[0], MIN(sx[1], sx[2]));
+	float fxmax = MAX(sx[0], MAX(sx[1], sx[2]));
+	float fymin = MIN(sy[0], MIN(sy[1], sy[2]));
+	float fymax = MAX(sy[0], MAX(sy[1], sy[2]));
+	if(fxmax < 0.0f || fymax < 0.0f || fxmin >= width || fymin >= height) return;
+
+	int xmin = fxmin < 0.0f ? 0 : (int)fxmin;
+	int ymin = fymin < 0.0f ? 0 : (int)fymin;
+	int xmax = fxmax >= width ? width - 1 : (int)fxmax;
+	int ymax = fymax >= height ? height - 1 : (int)fymax;
+
+	stats.raster_tris++;
+
+	// edge functions, positive inside
+	float ea[3], eb[3], ec[3];
+	for(int i=0; i<3; i++) {
+		int j = (i + 1) % 3;
+		ea[i] = sy[i] - sy[j];
+		eb[i] = sx[j] - sx[i];
+		ec[i] = sx[i] * sy[j] - sx[j] * sy[i];
+	}
+
+	// depth plane z = za * x + zb * y + zc
+	float za = ((sz[1] - sz[0]) * (sy[2] - sy[0]) - (sz[2] - sz[0]) * (sy[1] - sy[0])) / area;
+	float zb = ((sx[1] - sx[0]) * (sz[2] - sz[0]) - (sx[2] - sx[0]) * (sz[1] - sz[0])) / area;
+	float zc = sz[0] - za * sx[0] - zb * sy[0];
+	float tri_zmin = MIN(sz[0], MIN(sz[1], sz[2]));
+
+	int tx0 = xmin / OCC_TILE_WIDTH, tx1 = xmax / OCC_TILE_WIDTH;
+	int ty0 = ymin / OCC_TILE_HEIGHT, ty1 = ymax / OCC_TILE_HEIGHT;
+
+	for(int ty=ty0; ty<=ty1; ty++) {
+		float y0 = (float)(ty * OCC_TILE_HEIGHT);
+		OcclusionTile *tile = &tiles[ty * xtiles + tx0];
+
+		for(int tx=tx0; tx<=tx1; tx++, tile++) {
+			float x0 = (float)(tx * OCC_TILE_WIDTH);
+
+			// farthest depth of the triangle in the tile (minimum 1/w)
+			float ztri = zc + za * (za > 0.0f ? x0 : x0 + OCC_TILE_WIDTH) + zb * (zb > 0.0f ? y0 : y0 + OCC_TILE_HEIGHT);
+			if(ztri < tri_zmin) ztri = tri_zmin;
+
+			// can't improve on what we already know about this tile
+			if(ztri <= tile->zref) continue;
+
+			uint32_t cov[OCC_TILE_HEIGHT], any = 0;
+			tile_coverage(ea, eb, ec, x0, y0, cov);
+			for(int r=0; r<OCC_TILE_HEIGHT; r++) {
+				any |= cov[r];
+			}
+			if(!any) continue;
+
+			/* discard the working layer if the triangle is much nearer than it,
+			 * compared to how far it is in front of the reference layer.
+			 */
+			float dist_tw = ztri - tile->zwork;
+			float dist_wr = tile->zwork - tile->zref;
+			if(dist_tw > dist_wr) {
+				tile->zwork = FLT_MAX;
+				memset(tile->mask, 0, sizeof tile->mask);
+			}
+
+			if(ztri < tile->zwork) tile->zwork = ztri;
+
+			uint32_t full = FULL_MASK;
+			for(int r=0; r<OCC_TILE_HEIGHT; r++) {
+				tile->mask[r] |= cov[r];
+				full &= tile->mask[r];
+			}
+
+			// the working layer covers the tile, it becomes the reference
+			if(full == FULL_MASK) {
+				if(tile->zwork > tile->zref) tile->zref = tile->zwork;
+				tile->zwork = FLT_MAX;
+				memset(tile->mask, 0, sizeof tile->mask);
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::test_box(const AABox &box) {
+	stats.tested++;
+
+	float fxmin = FLT_MAX, fymin = FLT_MAX, fxmax = -FLT_MAX, fymax = -FLT_MAX;
+	float zmax = 0.0f;
+
+	for(int i=0; i<8; i++) {
+		Vector3 corner(i & 1 ? box.vmax.x : box.vmin.x, i & 2 ? box.vmax.y : box.vmin.y, i & 4 ? box.vmax.z : box.vmin.z);
+		Vector4 v = to_clip(view_proj, corner);
+
+		// crossing the near plane, don't bother
+		if(near_dist(v) < 0.0) return true;
+
+		float inv_w = 1.0f / v.w;
+		float x = (v.x * inv_w * 0.5f + 0.5f) * width;
+		float y = (v.y * inv_w * 0.5f + 0.5f) * height;
+
+		if(x < fxmin) fxmin = x;
+		if(x > fxmax) fxmax = x;
+		if(y < fymin) fymin = y;
+		if(y > fymax) fymax = y;
+		if(inv_w > zmax) zmax = inv_w;
+	}
+
+	if(fxmax < 0.0f || fymax < 0.0f || fxmin >= width || fymin >= height) {
+		stats.culled++;
+		return false;
+	}
+
+	// all the pixels the box touches
+	int xmin = fxmin < 0.0f ? 0 : (int)fxmin;
+	int ymin = fymin < 0.0f ? 0 : (int)fymin;
+	int xmax = fxmax >= width ? width - 1 : (int)fxmax;
+	int ymax = fymax >= height ? height - 1 : (int)fymax;
+
+	int tx0 = xmin / OCC_TILE_WIDTH, tx1 = xmax / OCC_TILE_WIDTH;
+	int ty0 = ymin / OCC_TILE_HEIGHT, ty1 = ymax / OCC_TILE_HEIGHT;
+
+	for(int ty=ty0; ty<=ty1; ty++) {
+		int r0 = MAX(ymin - ty * OCC_TILE_HEIGHT, 0);
+		int r1 = MIN(ymax - ty * OCC_TILE_HEIGHT, OCC_TILE_HEIGHT - 1);
+		const OcclusionTile *tile = &tiles[ty * xtiles + tx0];
+
+		for(int tx=tx0; tx<=tx1; tx++, tile++) {
+			// nearer than the farthest occluder anywhere in the tile, no need to look closer
+			if(zmax >= tile->zref && zmax >= tile->zwork) {
+				return true;
+			}
+
+			uint32_t cols = span_mask(xmin - tx * OCC_TILE_WIDTH, xmax - tx * OCC_TILE_WIDTH);
+			uint32_t in_ref = 0, in_work = 0;
+			for(int r=r0; r<=r1; r++) {
+				in_ref |= cols & ~tile->mask[r];
+				in_work |= cols & tile->mask[r];
+			}
+
+			if(in_ref && zmax >= tile->zref) return true;
+			if(in_work && zmax >= MAX(tile->zref, tile->zwork)) return true;
+		}
+	}
+
+	stats.culled++;
+	return false;
+}
+
+float OcclusionBuffer::get_depth(int x, int y) const {
+	if(x < 0 || y < 0 || x >= width || y >= height) return 0.0f;
+
+	const OcclusionTile *tile = &tiles[(y / OCC_TILE_HEIGHT) * xtiles + x / OCC_TILE_WIDTH];
+	if(tile->mask[y % OCC_TILE_HEIGHT] & ((uint32_t)1 << (x % OCC_TILE_WIDTH))) {
+		return MAX(tile->zref, tile->zwork);
+	}
+	return tile->zref;
+}
+
+const OcclusionStats *OcclusionBuffer::get_stats() const {
+	return &stats;
+}
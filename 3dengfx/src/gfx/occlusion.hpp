@@ -0,0 +1,96 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Software occlusion culling, rasterizing occluders into a low resolution
+ * masked depth buffer on the CPU, in the spirit of "Masked Software Occlusion
+ * Culling" (Hasselgren, Andersson, Akenine-Moller 2016).
+ *
+ * The buffer is split into 32x8 pixel tiles. Instead of per pixel depths,
+ * each tile keeps a coverage bitmask (one 32bit word per row) and two
+ * conservative depths: the farthest depth of the whole tile (reference
+ * layer) and the farthest depth of the pixels in the mask (working layer).
+ * Depths are 1/w, so they interpolate linearly in screen space, and larger
+ * values are nearer. Nothing here touches the graphics API.
+ */
+
+#ifndef _OCCLUSION_HPP_
+#define _OCCLUSION_HPP_
+
+#include <vector>
+#include "common/types.h"
+#include "n3dmath2/n3dmath2.hpp"
+#include "gfx/3dgeom.hpp"
+#include "gfx/bvol.hpp"
+
+#define OCC_TILE_WIDTH		32
+#define OCC_TILE_HEIGHT		8
+
+struct OcclusionTile {
+	uint32_t mask[OCC_TILE_HEIGHT];
+	float zref, zwork;
+};
+
+struct OcclusionStats {
+	int occluders;
+	int occluder_tris;		// triangles submitted
+	int raster_tris;		// triangles left after clipping
+	int tested;
+	int culled;
+};
+
+class OcclusionBuffer {
+private:
+	int width, height;
+	int xtiles, ytiles;
+	std::vector<OcclusionTile> tiles;
+	Matrix4x4 view_proj;
+	OcclusionStats stats;
+
+	std::vector<Vector4> clip_verts;
+
+	void draw_clipped(const Vector4 &v0, const Vector4 &v1, const Vector4 &v2);
+	void draw_triangle(const Vector4 *v);
+
+public:
+	// the size is rounded up to a multiple of the tile size
+	OcclusionBuffer(int width = 256, int height = 128);
+
+	void set_size(int width, int height);
+	int get_width() const;
+	int get_height() const;
+
+	// clears the buffer, and sets the view and projection used from now on
+	void begin_frame(const Matrix4x4 &view_proj);
+
+	void add_occluder(const TriMesh &mesh, const Matrix4x4 &world);
+	void add_occluder(const Vector3 *verts, int vcount, const Index *indices, int icount, const Matrix4x4 &world);
+
+	/* returns false if the world space box is certainly hidden behind the
+	 * occluders (or off-screen), true if it may be visible.
+	 */
+	bool test_box(const AABox &box);
+
+	// conservative depth (1/w) at a pixel, 0 if nothing is known to cover it
+	float get_depth(int x, int y) const;
+
+	const OcclusionStats *get_stats() const;
+};
+
+#endif	// _OCCLUSION_HPP_
@@ -0,0 +1,1019 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* CPU ray tracer */
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "rtrace.hpp"
+#include "common/threads.h"
+#include "common/profile.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
+#define GROUPS			(RT_PACKET_SIZE / 4)
+#define BLOCK_HEIGHT	(RT_PACKET_SIZE / 4)	// packets of primary rays cover 4 x BLOCK_HEIGHT pixels
+#define MAX_LEAF_TRIS	8
+#define SAH_BINS		16
+#define STACK_SIZE		64
+#define NO_HIT_T		1e30f
+
+using std::min;
+using std::max;
+
+static inline int bit_count(unsigned int x) {
+	int count = 0;
+	while(x) {
+		x &= x - 1;
+		count++;
+	}
+	return count;
+}
+
+static inline float inv_dir(float d) {
+	return d == 0.0f ? 1e30f : 1.0f / d;
+}
+
+// the 3x3 part of the matrix, for directions and normals
+static inline Vector3 xform_dir(const Matrix4x4 &m, const Vector3 &v) {
+	return Vector3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+}
+
+static inline void set3(float *dest, const Vector3 &v) {
+	dest[0] = v.x;
+	dest[1] = v.y;
+	dest[2] = v.z;
+}
+
+// offset for the rays leaving a surface, so that they don't hit it again
+static inline scalar_t ray_offset(const Vector3 &pos) {
+	scalar_t mag = max(fabs(pos.x), max(fabs(pos.y), fabs(pos.z)));
+	return 1e-4 * (1.0 + mag);
+}
+
+RTMaterial::RTMaterial(const Color &diffuse) {
+	this->diffuse = diffuse;
+	specular = Color(0.0f, 0.0f, 0.0f);
+	specular_power = 40.0;
+	reflectivity = 0.0;
+	texture = 0;
+}
+
+RTRay rt_ray(const Ray &ray, float tmax) {
+	RTRay res;
+	set3(res.org, ray.origin);
+	set3(res.dir, ray.dir);
+	res.tmin = 0.0f;
+	res.tmax = tmax;
+	return res;
+}
+
+void rt_packet_set(RTPacket *pk, int idx, const RTRay &ray) {
+	pk->ox[idx] = ray.org[0];
+	pk->oy[idx] = ray.org[1];
+	pk->oz[idx] = ray.org[2];
+	pk->dx[idx] = ray.dir[0];
+	pk->dy[idx] = ray.dir[1];
+	pk->dz[idx] = ray.dir[2];
+	pk->tmin[idx] = ray.tmin;
+	pk->tmax[idx] = ray.tmax;
+	pk->mask |= 1 << idx;
+}
+
+static inline void clear_packet(RTPacket *pk) {
+	memset(pk, 0, sizeof *pk);
+}
+
+RayTracer::RayTracer() {
+	ambient = Color(0.0f, 0.0f, 0.0f);
+	background = Color(0.0f, 0.0f, 0.0f);
+	max_depth = 3;
+	need_build = false;
+	reset_stats();
+}
+
+RayTracer::~RayTracer() {}
+
+void RayTracer::clear() {
+	geoms.clear();
+	tris.clear();
+	shade_tris.clear();
+	prims.clear();
+	nodes.clear();
+	lights.clear();
+	need_build = false;
+}
+
+int RayTracer::add_mesh(const TriMesh *mesh, const Matrix4x4 &xform, const RTMaterial &mat) {
+	const Vertex *varr = mesh->get_vertex_array()->get_data();
+	const Triangle *tarr = mesh->get_triangle_array()->get_data();
+	unsigned long vcount = mesh->get_vertex_array()->get_count();
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	int id = (int)geoms.size();
+	RTGeom geom;
+	geom.type = RT_MESH;
+	geom.mat = mat;
+	geom.first = (int)shade_tris.size();
+	geoms.push_back(geom);
+
+	Matrix4x4 norm_mat = xform.inverse().transposed();
+
+	std::vector<Vector3> pos(vcount), norm(vcount);
+	for(unsigned long i=0; i<vcount; i++) {
+		pos[i] = varr[i].pos.transformed(xform);
+		norm[i] = xform_dir(norm_mat, varr[i].normal);
+		if(norm[i].length_sq() > 0.0) norm[i].normalize();
+	}
+
+	for(unsigned long i=0; i<tcount; i++) {
+		const Index *vidx = tarr[i].vertices;
+		RTShadeTri st;
+		RTTriangle tri;
+
+		if(vidx[0] >= vcount || vidx[1] >= vcount || vidx[2] >= vcount) {
+			// keep the numbering of the triangles, but never hit this one
+			memset(&tri, 0, sizeof tri);
+		} else {
+			const Vector3 &v0 = pos[vidx[0]];
+			set3(tri.v0, v0);
+			set3(tri.e1, pos[vidx[1]] - v0);
+			set3(tri.e2, pos[vidx[2]] - v0);
+
+			st.face_normal = cross_product(pos[vidx[1]] - v0, pos[vidx[2]] - v0);
+			if(st.face_normal.length_sq() > 0.0) st.face_normal.normalize();
+			for(int j=0; j<3; j++) {
+				st.normal[j] = norm[vidx[j]];
+				st.tc[j] = varr[vidx[j]].tex[0];
+			}
+		}
+		tri.geom = id;
+		tri.prim = (int)i;
+
+		tris.push_back(tri);
+		shade_tris.push_back(st);
+	}
+
+	need_build = true;
+	return id;
+}
+
+int RayTracer::add_surface(const Surface *surf, const RTMaterial &mat) {
+	RTPrimitive prim;
+	RTGeom geom;
+
+	if(const Sphere *sph = dynamic_cast<const Sphere*>(surf)) {
+		geom.type = RT_SPHERE;
+		set3(prim.a, sph->get_position());
+		prim.b[0] = sph->get_radius();
+		prim.b[1] = prim.b[2] = 0.0f;
+	} else if(const Plane *plane = dynamic_cast<const Plane*>(surf)) {
+		geom.type = RT_PLANE;
+		Vector3 n = plane->get_normal().normalized();
+		set3(prim.a, n);
+		prim.b[0] = -dot_product(n, plane->get_position());
+		prim.b[1] = prim.b[2] = 0.0f;
+	} else {
+		return -1;
+	}
+
+	int id = (int)geoms.size();
+	geom.mat = mat;
+	geom.first = (int)prims.size();
+	geoms.push_back(geom);
+
+	prim.geom = id;
+	prims.push_back(prim);
+	return id;
+}
+
+int RayTracer::add_box(const AABox &box, const RTMaterial &mat) {
+	int id = (int)geoms.size();
+	RTGeom geom;
+	geom.type = RT_BOX;
+	geom.mat = mat;
+	geom.first = (int)prims.size();
+	geoms.push_back(geom);
+
+	RTPrimitive prim;
+	set3(prim.a, box.vmin);
+	set3(prim.b, box.vmax);
+	prim.geom = id;
+	prims.push_back(prim);
+	return id;
+}
+
+int RayTracer::get_geom_count() const {
+	return (int)geoms.size();
+}
+
+RTMaterial *RayTracer::get_material(int geom) {
+	return geom >= 0 && geom < (int)geoms.size() ? &geoms[geom].mat : 0;
+}
+
+void RayTracer::add_light(const RTLight &light) {
+	lights.push_back(light);
+}
+
+void RayTracer::set_ambient_light(const Color &col) {
+	ambient = col;
+}
+
+void RayTracer::set_background(const Color &col) {
+	background = col;
+}
+
+void RayTracer::set_max_depth(int depth) {
+	max_depth = depth;
+}
+
+///////////// BVH construction /////////////
+
+static inline void tri_bounds(const RTTriangle &tri, float *bmin, float *bmax) {
+	for(int i=0; i<3; i++) {
+		float v1 = tri.v0[i] + tri.e1[i];
+		float v2 = tri.v0[i] + tri.e2[i];
+		bmin[i] = min(tri.v0[i], min(v1, v2));
+		bmax[i] = max(tri.v0[i], max(v1, v2));
+	}
+}
+
+static inline float half_area(const float *bmin, const float *bmax) {
+	float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static inline void grow(float *bmin, float *bmax, const float *pmin, const float *pmax) {
+	for(int i=0; i<3; i++) {
+		bmin[i] = min(bmin[i], pmin[i]);
+		bmax[i] = max(bmax[i], pmax[i]);
+	}
+}
+
+void RayTracer::build() {
+	PROF_SCOPE("RayTracer::build");
+	nodes.clear();
+	need_build = false;
+	if(tris.empty()) return;
+
+	std::vector<Vector3> centers(tris.size());
+	for(size_t i=0; i<tris.size(); i++) {
+		const RTTriangle &t = tris[i];
+		centers[i] = Vector3(t.v0[0] + (t.e1[0] + t.e2[0]) / 3.0f,
+				t.v0[1] + (t.e1[1] + t.e2[1]) / 3.0f, t.v0[2] + (t.e1[2] + t.e2[2]) / 3.0f);
+	}
+
+	nodes.reserve(tris.size() / 2 + 1);
+	nodes.push_back(RTNode());
+	build_node(0, 0, (int)tris.size(), centers);
+}
+
+/* binned SAH split along the longest axis of the triangle centers,
+ * the triangles and their centers are partitioned in place.
+ */
+void RayTracer::build_node(int node, int first, int count, std::vector<Vector3> &centers) {
+	float bmin[3] = {NO_HIT_T, NO_HIT_T, NO_HIT_T}, bmax[3] = {-NO_HIT_T, -NO_HIT_T, -NO_HIT_T};
+	Vector3 cmin = centers[first], cmax = centers[first];
+
+	for(int i=first; i<first+count; i++) {
+		float tmin[3], tmax[3];
+		tri_bounds(tris[i], tmin, tmax);
+		grow(bmin, bmax, tmin, tmax);
+
+		const Vector3 &c = centers[i];
+		cmin = Vector3(min(cmin.x, c.x), min(cmin.y, c.y), min(cmin.z, c.z));
+		cmax = Vector3(max(cmax.x, c.x), max(cmax.y, c.y), max(cmax.z, c.z));
+	}
+
+	// a little slack, so that the float box tests can't miss the edges
+	for(int i=0; i<3; i++) {
+		float pad = (bmax[i] - bmin[i]) * 1e-5f + 1e-6f;
+		nodes[node].bmin[i] = bmin[i] - pad;
+		nodes[node].bmax[i] = bmax[i] + pad;
+	}
+	nodes[node].first = first;
+	nodes[node].count = (unsigned short)count;
+	nodes[node].axis = 0;
+
+	if(count <= 2) return;
+
+	Vector3 ext = cmax - cmin;
+	int axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+	scalar_t amin = cmin[axis], aext = ext[axis];
+
+	int split = first + count / 2;
+	bool median = false;
+
+	if(aext <= 0.0) {
+		// all the centers coincide, only the leaf size matters
+		if(count <= MAX_LEAF_TRIS) return;
+	} else {
+		int bin_count[SAH_BINS] = {0};
+		float bin_min[SAH_BINS][3], bin_max[SAH_BINS][3];
+		for(int i=0; i<SAH_BINS; i++) {
+			bin_min[i][0] = bin_min[i][1] = bin_min[i][2] = NO_HIT_T;
+			bin_max[i][0] = bin_max[i][1] = bin_max[i][2] = -NO_HIT_T;
+		}
+
+		scalar_t scale = SAH_BINS * 0.9999 / aext;
+		for(int i=first; i<first+count; i++) {
+			int b = std::min((int)((centers[i][axis] - amin) * scale), SAH_BINS - 1);
+			float tmin[3], tmax[3];
+			tri_bounds(tris[i], tmin, tmax);
+			grow(bin_min[b], bin_max[b], tmin, tmax);
+			bin_count[b]++;
+		}
+
+		// areas of the right side of every split, then sweep from the left
+		float right_area[SAH_BINS];
+		int right_count[SAH_BINS];
+		float rmin[3] = {NO_HIT_T, NO_HIT_T, NO_HIT_T}, rmax[3] = {-NO_HIT_T, -NO_HIT_T, -NO_HIT_T};
+		int rc = 0;
+		for(int i=SAH_BINS-1; i>0; i--) {
+			grow(rmin, rmax, bin_min[i], bin_max[i]);
+			rc += bin_count[i];
+			right_area[i] = rc ? half_area(rmin, rmax) : 0.0f;
+			right_count[i] = rc;
+		}
+
+		float lmin[3] = {NO_HIT_T, NO_HIT_T, NO_HIT_T}, lmax[3] = {-NO_HIT_T, -NO_HIT_T, -NO_HIT_T};
+		int lc = 0, best_bin = -1;
+		float best_cost = NO_HIT_T;
+		for(int i=1; i<SAH_BINS; i++) {
+			grow(lmin, lmax, bin_min[i - 1], bin_max[i - 1]);
+			lc += bin_count[i - 1];
+			if(!lc || !right_count[i]) continue;
+
+			float cost = half_area(lmin, lmax) * lc + right_area[i] * right_count[i];
+			if(cost < best_cost) {
+				best_cost = cost;
+				best_bin = i;
+			}
+		}
+
+		// intersection and traversal costs taken as equal
+		float area = half_area(bmin, bmax);
+		if(best_bin == -1 || area * count <= best_cost + area) {
+			if(count <= MAX_LEAF_TRIS) return;
+		}
+
+		if(best_bin == -1) {
+			median = true;
+		} else {
+			int i = first, j = first + count - 1;
+			while(i <= j) {
+				int b = std::min((int)((centers[i][axis] - amin) * scale), SAH_BINS - 1);
+				if(b < best_bin) {
+					i++;
+				} else {
+					std::swap(tris[i], tris[j]);
+					std::swap(centers[i], centers[j]);
+					j--;
+				}
+			}
+			split = i;
+		}
+	}
+
+	if(median) {
+		// no split plane separates the centers, halve them in order instead
+		std::vector<std::pair<scalar_t, int> > order(count);
+		for(int i=0; i<count; i++) {
+			order[i] = std::make_pair(centers[first + i][axis], first + i);
+		}
+		std::sort(order.begin(), order.end());
+
+		std::vector<RTTriangle> tmp_tris(count);
+		std::vector<Vector3> tmp_centers(count);
+		for(int i=0; i<count; i++) {
+			tmp_tris[i] = tris[order[i].second];
+			tmp_centers[i] = centers[order[i].second];
+		}
+		std::copy(tmp_tris.begin(), tmp_tris.end(), tris.begin() + first);
+		std::copy(tmp_centers.begin(), tmp_centers.end(), centers.begin() + first);
+	}
+
+	int child = (int)nodes.size();
+	nodes.push_back(RTNode());
+	nodes.push_back(RTNode());
+	nodes[node].first = child;
+	nodes[node].count = 0;
+	nodes[node].axis = (unsigned short)axis;
+
+	build_node(child, first, split - first, centers);
+	build_node(child + 1, split, first + count - split, centers);
+}
+
+int RayTracer::get_node_count() const {
+	return (int)nodes.size();
+}
+
+///////////// packet traversal /////////////
+
+struct PacketDirs {
+	float ix[RT_PACKET_SIZE], iy[RT_PACKET_SIZE], iz[RT_PACKET_SIZE];
+};
+
+// the rays of the packet (in mask) hitting the node box before their current tmax
+static inline unsigned int box_test(const RTNode &node, const RTPacket *pk, const PacketDirs *id, unsigned int mask) {
+	unsigned int res = 0;
+
+	for(int g=0; g<GROUPS; g++) {
+		unsigned int gmask = (mask >> (g * 4)) & 0xf;
+		if(!gmask) continue;
+		int off = g * 4;
+
+#ifdef USE_SSE
+		__m128 ix = _mm_loadu_ps(id->ix + off), iy = _mm_loadu_ps(id->iy + off), iz = _mm_loadu_ps(id->iz + off);
+		__m128 ox = _mm_loadu_ps(pk->ox + off), oy = _mm_loadu_ps(pk->oy + off), oz = _mm_loadu_ps(pk->oz + off);
+
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[0]), ox), ix);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[0]), ox), ix);
+		__m128 tnear = _mm_max_ps(_mm_min_ps(t0, t1), _mm_loadu_ps(pk->tmin + off));
+		__m128 tfar = _mm_min_ps(_mm_max_ps(t0, t1), _mm_loadu_ps(pk->tmax + off));
+
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[1]), oy), iy);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[1]), oy), iy);
+		tnear = _mm_max_ps(tnear, _mm_min_ps(t0, t1));
+		tfar = _mm_min_ps(tfar, _mm_max_ps(t0, t1));
+
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmin[2]), oz), iz);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bmax[2]), oz), iz);
+		tnear = _mm_max_ps(tnear, _mm_min_ps(t0, t1));
+		tfar = _mm_min_ps(tfar, _mm_max_ps(t0, t1));
+
+		res |= ((unsigned int)_mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) & gmask) << off;
+#else
+		for(int i=0; i<4; i++) {
+			if(!(gmask & (1 << i))) continue;
+			int r = off + i;
+			const float *o[3] = {pk->ox + r, pk->oy + r, pk->oz + r};
+			float inv[3] = {id->ix[r], id->iy[r], id->iz[r]};
+			float tnear = pk->tmin[r], tfar = pk->tmax[r];
+
+			for(int j=0; j<3; j++) {
+				float t0 = (node.bmin[j] - *o[j]) * inv[j];
+				float t1 = (node.bmax[j] - *o[j]) * inv[j];
+				tnear = max(tnear, min(t0, t1));
+				tfar = min(tfar, max(t0, t1));
+			}
+			if(tnear <= tfar) res |= 1 << r;
+		}
+#endif
+	}
+	return res;
+}
+
+// Moller - Trumbore, returns the rays hitting the triangle in (tmin, tmax)
+static inline unsigned int tri_test(const RTTriangle &tri, const RTPacket *pk, unsigned int mask,
+		float *t_out, float *u_out, float *v_out) {
+	unsigned int res = 0;
+
+	for(int g=0; g<GROUPS; g++) {
+		unsigned int gmask = (mask >> (g * 4)) & 0xf;
+		if(!gmask) continue;
+		int off = g * 4;
+
+#ifdef USE_SSE
+		__m128 dx = _mm_loadu_ps(pk->dx + off), dy = _mm_loadu_ps(pk->dy + off), dz = _mm_loadu_ps(pk->dz + off);
+		__m128 e1x = _mm_set1_ps(tri.e1[0]), e1y = _mm_set1_ps(tri.e1[1]), e1z = _mm_set1_ps(tri.e1[2]);
+		__m128 e2x = _mm_set1_ps(tri.e2[0]), e2y = _mm_set1_ps(tri.e2[1]), e2z = _mm_set1_ps(tri.e2[2]);
+
+		// p = d x e2
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+		__m128 tx = _mm_sub_ps(_mm_loadu_ps(pk->ox + off), _mm_set1_ps(tri.v0[0]));
+		__m128 ty = _mm_sub_ps(_mm_loadu_ps(pk->oy + off), _mm_set1_ps(tri.v0[1]));
+		__m128 tz = _mm_sub_ps(_mm_loadu_ps(pk->oz + off), _mm_set1_ps(tri.v0[2]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+		// q = t x e1
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, _mm_loadu_ps(pk->tmin + off)));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_loadu_ps(pk->tmax + off)));
+		hit = _mm_and_ps(hit, _mm_cmpneq_ps(det, zero));
+
+		unsigned int gres = (unsigned int)_mm_movemask_ps(hit) & gmask;
+		if(gres) {
+			_mm_storeu_ps(t_out + off, t);
+			_mm_storeu_ps(u_out + off, u);
+			_mm_storeu_ps(v_out + off, v);
+			res |= gres << off;
+		}
+#else
+		for(int i=0; i<4; i++) {
+			if(!(gmask & (1 << i))) continue;
+			int r = off + i;
+			float d[3] = {pk->dx[r], pk->dy[r], pk->dz[r]};
+
+			float p[3] = {d[1] * tri.e2[2] - d[2] * tri.e2[1], d[2] * tri.e2[0] - d[0] * tri.e2[2],
+				d[0] * tri.e2[1] - d[1] * tri.e2[0]};
+			float det = tri.e1[0] * p[0] + tri.e1[1] * p[1] + tri.e1[2] * p[2];
+			if(det == 0.0f) continue;
+			float inv_det = 1.0f / det;
+
+			float tv[3] = {pk->ox[r] - tri.v0[0], pk->oy[r] - tri.v0[1], pk->oz[r] - tri.v0[2]};
+			float u = (tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2]) * inv_det;
+			if(u < 0.0f) continue;
+
+			float q[3] = {tv[1] * tri.e1[2] - tv[2] * tri.e1[1], tv[2] * tri.e1[0] - tv[0] * tri.e1[2],
+				tv[0] * tri.e1[1] - tv[1] * tri.e1[0]};
+			float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+			if(v < 0.0f || u + v > 1.0f) continue;
+
+			float t = (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]) * inv_det;
+			if(t <= pk->tmin[r] || t >= pk->tmax[r]) continue;
+
+			t_out[r] = t;
+			u_out[r] = u;
+			v_out[r] = v;
+			res |= 1 << r;
+		}
+#endif
+	}
+	return res;
+}
+
+/* the analytic primitives are few, so they are tested one ray at a time
+ * instead of going into the BVH.
+ */
+void RayTracer::trace_prims(RTPacket *pk, RTPacketHit *hit, bool any) const {
+	for(size_t p=0; p<prims.size(); p++) {
+		const RTPrimitive &prim = prims[p];
+		RTGeomType type = geoms[prim.geom].type;
+
+		for(int r=0; r<RT_PACKET_SIZE; r++) {
+			if(!(pk->mask & (1 << r))) continue;
+
+			float o[3] = {pk->ox[r], pk->oy[r], pk->oz[r]};
+			float d[3] = {pk->dx[r], pk->dy[r], pk->dz[r]};
+			float t = -1.0f;
+
+			if(type == RT_SPHERE) {
+				float oc[3] = {o[0] - prim.a[0], o[1] - prim.a[1], o[2] - prim.a[2]};
+				float a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				float b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+				float c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - prim.b[0] * prim.b[0];
+				float disc = b * b - a * c;
+				if(disc < 0.0f || a == 0.0f) continue;
+
+				float sq = sqrt(disc);
+				t = (-b - sq) / a;
+				if(t <= pk->tmin[r]) t = (-b + sq) / a;
+
+			} else if(type == RT_PLANE) {
+				float denom = prim.a[0] * d[0] + prim.a[1] * d[1] + prim.a[2] * d[2];
+				if(denom == 0.0f) continue;
+				t = -(prim.a[0] * o[0] + prim.a[1] * o[1] + prim.a[2] * o[2] + prim.b[0]) / denom;
+
+			} else {
+				float tnear = -NO_HIT_T, tfar = NO_HIT_T;
+				for(int j=0; j<3; j++) {
+					float inv = inv_dir(d[j]);
+					float t0 = (prim.a[j] - o[j]) * inv;
+					float t1 = (prim.b[j] - o[j]) * inv;
+					tnear = max(tnear, min(t0, t1));
+					tfar = min(tfar, max(t0, t1));
+				}
+				if(tnear > tfar) continue;
+				t = tnear > pk->tmin[r] ? tnear : tfar;
+			}
+
+			if(t <= pk->tmin[r] || t >= pk->tmax[r]) continue;
+
+			if(any) {
+				pk->mask &= ~(1 << r);
+			} else {
+				pk->tmax[r] = hit->t[r] = t;
+				hit->u[r] = hit->v[r] = 0.0f;
+				hit->prim[r] = -1;
+				hit->geom[r] = prim.geom;
+			}
+		}
+	}
+}
+
+/* Traverses the BVH with the whole packet, visiting every node hit by any
+ * of its rays, nearest child first by the direction of the first ray. For
+ * nearest hits tmax shrinks to the closest hit so far, for any hits the
+ * occluded rays are dropped from the mask as soon as they are found.
+ */
+void RayTracer::trace(RTPacket *pk, RTPacketHit *hit, bool any) const {
+	if(!prims.empty()) {
+		trace_prims(pk, hit, any);
+	}
+	if(nodes.empty() || !pk->mask) return;
+
+	PacketDirs id;
+	int lead = -1;
+	for(int r=0; r<RT_PACKET_SIZE; r++) {
+		id.ix[r] = inv_dir(pk->dx[r]);
+		id.iy[r] = inv_dir(pk->dy[r]);
+		id.iz[r] = inv_dir(pk->dz[r]);
+		if(lead == -1 && (pk->mask & (1 << r))) lead = r;
+	}
+	float lead_dir[3] = {pk->dx[lead], pk->dy[lead], pk->dz[lead]};
+
+	float t[RT_PACKET_SIZE], u[RT_PACKET_SIZE], v[RT_PACKET_SIZE];
+	int stack[STACK_SIZE];
+	int sp = 0;
+	int node = 0;
+
+	for(;;) {
+		const RTNode &n = nodes[node];
+
+		if(box_test(n, pk, &id, pk->mask)) {
+			if(!n.count) {
+				int first = n.first;
+				if(lead_dir[n.axis] < 0.0f) {
+					stack[sp++] = first;
+					node = first + 1;
+				} else {
+					stack[sp++] = first + 1;
+					node = first;
+				}
+				continue;
+			}
+
+			for(int i=n.first; i<n.first + n.count; i++) {
+				unsigned int res = tri_test(tris[i], pk, pk->mask, t, u, v);
+				if(!res) continue;
+
+				if(any) {
+					pk->mask &= ~res;
+					if(!pk->mask) return;
+					continue;
+				}
+
+				for(int r=0; r<RT_PACKET_SIZE; r++) {
+					if(!(res & (1 << r))) continue;
+					pk->tmax[r] = hit->t[r] = t[r];
+					hit->u[r] = u[r];
+					hit->v[r] = v[r];
+					hit->prim[r] = tris[i].prim;
+					hit->geom[r] = tris[i].geom;
+				}
+			}
+		}
+
+		if(!sp) break;
+		node = stack[--sp];
+	}
+}
+
+bool RayTracer::intersect(const RTRay &ray, RTHit *hit) const {
+	RTPacket pk;
+	RTPacketHit phit;
+	clear_packet(&pk);
+	rt_packet_set(&pk, 0, ray);
+
+	intersect(pk, &phit);
+	hit->t = phit.t[0];
+	hit->u = phit.u[0];
+	hit->v = phit.v[0];
+	hit->prim = phit.prim[0];
+	hit->geom = phit.geom[0];
+	return hit->geom != -1;
+}
+
+void RayTracer::intersect(const RTPacket &pk, RTPacketHit *hit) const {
+	RTPacket tmp = pk;
+	for(int r=0; r<RT_PACKET_SIZE; r++) {
+		hit->t[r] = pk.tmax[r];
+		hit->u[r] = hit->v[r] = 0.0f;
+		hit->prim[r] = hit->geom[r] = -1;
+	}
+	trace(&tmp, hit, false);
+}
+
+bool RayTracer::occluded(const RTRay &ray) const {
+	RTPacket pk;
+	clear_packet(&pk);
+	rt_packet_set(&pk, 0, ray);
+	return occluded(pk) != 0;
+}
+
+unsigned int RayTracer::occluded(const RTPacket &pk) const {
+	RTPacket tmp = pk;
+	trace(&tmp, 0, true);
+	return pk.mask & ~tmp.mask;
+}
+
+void RayTracer::get_surface(const RTRay &ray, const RTHit &hit, RTSurface *surf) const {
+	const RTGeom &geom = geoms[hit.geom];
+	Vector3 dir(ray.dir[0], ray.dir[1], ray.dir[2]);
+
+	surf->pos = Vector3(ray.org[0], ray.org[1], ray.org[2]) + dir * hit.t;
+	surf->mat = &geom.mat;
+	surf->tc = TexCoord(0, 0);
+
+	Vector3 face_normal;
+	if(geom.type == RT_MESH) {
+		const RTShadeTri &st = shade_tris[geom.first + hit.prim];
+		scalar_t w = 1.0 - hit.u - hit.v;
+
+		face_normal = st.face_normal;
+		surf->normal = st.normal[0] * w + st.normal[1] * hit.u + st.normal[2] * hit.v;
+		if(surf->normal.length_sq() > 1e-12) {
+			surf->normal.normalize();
+		} else {
+			surf->normal = face_normal;
+		}
+		surf->tc.u = st.tc[0].u * w + st.tc[1].u * hit.u + st.tc[2].u * hit.v;
+		surf->tc.v = st.tc[0].v * w + st.tc[1].v * hit.u + st.tc[2].v * hit.v;
+
+	} else {
+		const RTPrimitive &prim = prims[geom.first];
+		Vector3 a(prim.a[0], prim.a[1], prim.a[2]);
+
+		if(geom.type == RT_SPHERE) {
+			face_normal = (surf->pos - a) / prim.b[0];
+			surf->tc.u = atan2(face_normal.z, face_normal.x) / two_pi + 0.5;
+			surf->tc.v = acos(std::max((scalar_t)-1.0, std::min(face_normal.y, (scalar_t)1.0))) / pi;
+
+		} else if(geom.type == RT_PLANE) {
+			face_normal = a;
+			Vector3 ref = fabs(a.y) < 0.9 ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+			Vector3 tang = cross_product(ref, a).normalized();
+			surf->tc.u = dot_product(surf->pos, tang);
+			surf->tc.v = dot_product(surf->pos, cross_product(a, tang));
+
+		} else {
+			Vector3 b(prim.b[0], prim.b[1], prim.b[2]);
+			Vector3 half = (b - a) * 0.5;
+			Vector3 rel = surf->pos - (a + half);
+			scalar_t dist[3];
+			for(int i=0; i<3; i++) {
+				dist[i] = half[i] > 0.0 ? fabs(rel[i] / half[i]) : 0.0;
+			}
+			int axis = dist[0] > dist[1] ? (dist[0] > dist[2] ? 0 : 2) : (dist[1] > dist[2] ? 1 : 2);
+			face_normal = Vector3(0, 0, 0);
+			face_normal[axis] = rel[axis] < 0.0 ? -1.0 : 1.0;
+		}
+		surf->normal = face_normal;
+	}
+
+	// everything is two sided
+	if(dot_product(face_normal, dir) > 0.0) {
+		surf->normal = -surf->normal;
+	}
+}
+
+///////////// shading /////////////
+
+static Color sample_texture(const PixelBuffer *tex, const TexCoord &tc) {
+	scalar_t u = tc.u - floor(tc.u);
+	scalar_t v = tc.v - floor(tc.v);
+
+	// rows from the top down, v = 0 is the bottom as with the engine textures
+	int x = std::min((int)(u * tex->width), (int)tex->width - 1);
+	int y = std::min((int)((1.0 - v) * tex->height), (int)tex->height - 1);
+	return unpack_color32(tex->buffer[y * tex->width + x]);
+}
+
+void RayTracer::shade(const RTPacket &pk, int depth, Color *col, RTStats *st) const {
+	RTPacketHit hit;
+	intersect(pk, &hit);
+
+	RTSurface surf[RT_PACKET_SIZE];
+	Vector3 view[RT_PACKET_SIZE];
+	Color diffuse[RT_PACKET_SIZE];
+	unsigned int hit_mask = 0;
+
+	for(int r=0; r<RT_PACKET_SIZE; r++) {
+		if(!(pk.mask & (1 << r))) continue;
+		if(hit.geom[r] == -1) {
+			col[r] = background;
+			continue;
+		}
+
+		RTRay ray;
+		ray.org[0] = pk.ox[r]; ray.org[1] = pk.oy[r]; ray.org[2] = pk.oz[r];
+		ray.dir[0] = pk.dx[r]; ray.dir[1] = pk.dy[r]; ray.dir[2] = pk.dz[r];
+		RTHit h = {hit.t[r], hit.u[r], hit.v[r], hit.prim[r], hit.geom[r]};
+		get_surface(ray, h, surf + r);
+
+		view[r] = Vector3(ray.dir[0], ray.dir[1], ray.dir[2]).normalized();
+		diffuse[r] = surf[r].mat->diffuse;
+		if(surf[r].mat->texture) {
+			diffuse[r] *= sample_texture(surf[r].mat->texture, surf[r].tc);
+		}
+		col[r] = ambient * diffuse[r];
+		hit_mask |= 1 << r;
+	}
+	if(!hit_mask) return;
+
+	// one packet of shadow rays per light, from all the lit points
+	for(size_t i=0; i<lights.size(); i++) {
+		const RTLight &lt = lights[i];
+		RTPacket spk;
+		Vector3 ldir[RT_PACKET_SIZE];
+		scalar_t ndotl[RT_PACKET_SIZE];
+		clear_packet(&spk);
+
+		for(int r=0; r<RT_PACKET_SIZE; r++) {
+			if(!(hit_mask & (1 << r))) continue;
+
+			Vector3 l = lt.directional ? lt.pos : lt.pos - surf[r].pos;
+			scalar_t dist = l.length();
+			if(dist <= 0.0) continue;
+			ldir[r] = l / dist;
+
+			ndotl[r] = dot_product(surf[r].normal, ldir[r]);
+			if(ndotl[r] <= 0.0) continue;
+
+			scalar_t offs = ray_offset(surf[r].pos);
+			RTRay sray;
+			set3(sray.org, surf[r].pos + surf[r].normal * offs);
+			set3(sray.dir, ldir[r]);
+			sray.tmin = 0.0f;
+			sray.tmax = lt.directional ? NO_HIT_T : dist - offs;
+			rt_packet_set(&spk, r, sray);
+		}
+		if(!spk.mask) continue;
+
+		st->shadow_rays += bit_count(spk.mask);
+		unsigned int lit = spk.mask & ~occluded(spk);
+
+		for(int r=0; r<RT_PACKET_SIZE; r++) {
+			if(!(lit & (1 << r))) continue;
+			const RTMaterial *mat = surf[r].mat;
+
+			col[r] += lt.color * diffuse[r] * ndotl[r];
+
+			Vector3 half = (ldir[r] - view[r]).normalized();
+			scalar_t ndoth = dot_product(surf[r].normal, half);
+			if(ndoth > 0.0) {
+				col[r] += lt.color * mat->specular * pow(ndoth, mat->specular_power);
+			}
+		}
+	}
+
+	if(depth >= max_depth) return;
+
+	RTPacket rpk;
+	clear_packet(&rpk);
+	for(int r=0; r<RT_PACKET_SIZE; r++) {
+		if(!(hit_mask & (1 << r)) || surf[r].mat->reflectivity <= 0.0) continue;
+
+		const Vector3 &n = surf[r].normal;
+		RTRay rray;
+		set3(rray.org, surf[r].pos + n * ray_offset(surf[r].pos));
+		set3(rray.dir, view[r] - n * (2.0 * dot_product(view[r], n)));
+		rray.tmin = 0.0f;
+		rray.tmax = NO_HIT_T;
+		rt_packet_set(&rpk, r, rray);
+	}
+	if(!rpk.mask) return;
+
+	st->reflection_rays += bit_count(rpk.mask);
+
+	Color rcol[RT_PACKET_SIZE];
+	shade(rpk, depth + 1, rcol, st);
+
+	for(int r=0; r<RT_PACKET_SIZE; r++) {
+		if(!(rpk.mask & (1 << r))) continue;
+		scalar_t refl = surf[r].mat->reflectivity;
+		col[r] = col[r] * (1.0 - refl) + rcol[r] * refl;
+	}
+}
+
+///////////// rendering /////////////
+
+struct RenderWork {
+	const RayTracer *rt;
+	PixelBuffer *pbuf;
+	Matrix4x4 inv_view_proj;
+	Vector3 eye;
+	int xtiles;
+	std::vector<RTStats> stats;
+};
+
+static inline Pixel pack_pixel(const Color &col) {
+	int r = (int)(std::min(std::max(col.r, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+	int g = (int)(std::min(std::max(col.g, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+	int b = (int)(std::min(std::max(col.b, (scalar_t)0.0), (scalar_t)1.0) * 255.0 + 0.5);
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+void rt_tile_work(int idx, void *cls) {
+	RenderWork *work = (RenderWork*)cls;
+	PixelBuffer *pbuf = work->pbuf;
+	const Matrix4x4 &m = work->inv_view_proj;
+	RTStats *st = &work->stats[idx];
+
+	int width = (int)pbuf->width, height = (int)pbuf->height;
+	int x0 = (idx % work->xtiles) * RT_TILE_SIZE;
+	int y0 = (idx / work->xtiles) * RT_TILE_SIZE;
+	int x1 = std::min(x0 + RT_TILE_SIZE, width);
+	int y1 = std::min(y0 + RT_TILE_SIZE, height);
+
+	for(int by=y0; by<y1; by+=BLOCK_HEIGHT) {
+		for(int bx=x0; bx<x1; bx+=4) {
+			RTPacket pk;
+			clear_packet(&pk);
+
+			for(int r=0; r<RT_PACKET_SIZE; r++) {
+				int x = bx + (r & 3), y = by + r / 4;
+				if(x >= x1 || y >= y1) continue;
+
+				// through the far plane, rows from the top down
+				scalar_t nx = (x + 0.5) / width * 2.0 - 1.0;
+				scalar_t ny = 1.0 - (y + 0.5) / height * 2.0;
+				scalar_t px = m[0][0] * nx + m[0][1] * ny + m[0][2] + m[0][3];
+				scalar_t py = m[1][0] * nx + m[1][1] * ny + m[1][2] + m[1][3];
+				scalar_t pz = m[2][0] * nx + m[2][1] * ny + m[2][2] + m[2][3];
+				scalar_t pw = m[3][0] * nx + m[3][1] * ny + m[3][2] + m[3][3];
+
+				RTRay ray;
+				set3(ray.org, work->eye);
+				set3(ray.dir, (Vector3(px, py, pz) / pw - work->eye).normalized());
+				ray.tmin = 0.0f;
+				ray.tmax = NO_HIT_T;
+				rt_packet_set(&pk, r, ray);
+			}
+
+			Color col[RT_PACKET_SIZE];
+			work->rt->shade(pk, 0, col, st);
+			st->primary_rays += bit_count(pk.mask);
+			st->packets++;
+
+			for(int r=0; r<RT_PACKET_SIZE; r++) {
+				if(pk.mask & (1 << r)) {
+					pbuf->buffer[(by + r / 4) * width + bx + (r & 3)] = pack_pixel(col[r]);
+				}
+			}
+		}
+	}
+}
+
+void RayTracer::render(PixelBuffer *pbuf, const Matrix4x4 &view, const Matrix4x4 &proj) {
+	PROF_SCOPE("RayTracer::render");
+	if(need_build) build();
+
+	RenderWork work;
+	work.rt = this;
+	work.pbuf = pbuf;
+	work.inv_view_proj = (proj * view).inverse();
+	work.eye = Vector3(0, 0, 0).transformed(view.inverse());
+	work.xtiles = ((int)pbuf->width + RT_TILE_SIZE - 1) / RT_TILE_SIZE;
+
+	int ytiles = ((int)pbuf->height + RT_TILE_SIZE - 1) / RT_TILE_SIZE;
+	int tile_count = work.xtiles * ytiles;
+
+	RTStats zero;
+	memset(&zero, 0, sizeof zero);
+	work.stats.resize(tile_count, zero);
+
+	thr_parallel_for(tile_count, rt_tile_work, &work);
+
+	for(int i=0; i<tile_count; i++) {
+		stats.primary_rays += work.stats[i].primary_rays;
+		stats.shadow_rays += work.stats[i].shadow_rays;
+		stats.reflection_rays += work.stats[i].reflection_rays;
+		stats.packets += work.stats[i].packets;
+	}
+}
+
+const RTStats *RayTracer::get_stats() const {
+	return &stats;
+}
+
+void RayTracer::reset_stats() {
+	memset(&stats, 0, sizeof stats);
+}
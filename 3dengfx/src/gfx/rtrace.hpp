@@ -0,0 +1,202 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* CPU ray tracer, for stills and baking
+ *
+ * RayTracer holds a static scene of triangle meshes (in a BVH built over
+ * their triangles) and analytic spheres, planes and boxes. Rays are plain
+ * structs without the IOR stack of Ray, and are traced in packets of
+ * RT_PACKET_SIZE, 4 of them at a time with SSE when available, so
+ * coherent rays share the node visits. render() shades a whole image with
+ * shadow and reflection rays, in tiles rendered in parallel.
+ */
+
+#ifndef _RTRACE_HPP_
+#define _RTRACE_HPP_
+
+#include <vector>
+#include "n3dmath2/n3dmath2.hpp"
+#include "gfx/3dgeom.hpp"
+#include "gfx/bvol.hpp"
+#include "gfx/color.hpp"
+#include "gfx/pbuffer.hpp"
+
+#define RT_PACKET_SIZE		8		// rays per packet, a multiple of 4
+#define RT_TILE_SIZE		16
+
+// a ray, hits are searched in [tmin, tmax)
+struct RTRay {
+	float org[3], dir[3];
+	float tmin, tmax;
+};
+
+struct RTHit {
+	float t;
+	float u, v;		// barycentric coordinates of the hit, for triangles
+	int prim;		// triangle of the geometry, or -1 for analytic primitives
+	int geom;		// geometry id, -1 for no hit
+};
+
+// a packet of rays, laid out for SIMD
+struct RTPacket {
+	float ox[RT_PACKET_SIZE], oy[RT_PACKET_SIZE], oz[RT_PACKET_SIZE];
+	float dx[RT_PACKET_SIZE], dy[RT_PACKET_SIZE], dz[RT_PACKET_SIZE];
+	float tmin[RT_PACKET_SIZE], tmax[RT_PACKET_SIZE];
+	unsigned int mask;		// bit i is set for the rays in use
+};
+
+struct RTPacketHit {
+	float t[RT_PACKET_SIZE];
+	float u[RT_PACKET_SIZE], v[RT_PACKET_SIZE];
+	int prim[RT_PACKET_SIZE];
+	int geom[RT_PACKET_SIZE];
+};
+
+struct RTMaterial {
+	Color diffuse, specular;
+	scalar_t specular_power;
+	scalar_t reflectivity;
+	const PixelBuffer *texture;		// modulates the diffuse color, or 0
+
+	RTMaterial(const Color &diffuse = Color(1.0f, 1.0f, 1.0f));
+};
+
+struct RTLight {
+	Vector3 pos;		// direction towards the light, for directional lights
+	Color color;
+	bool directional;
+};
+
+// the shading attributes of a hit point
+struct RTSurface {
+	Vector3 pos;
+	Vector3 normal;		// interpolated, facing the ray
+	TexCoord tc;
+	const RTMaterial *mat;
+};
+
+struct RTStats {
+	unsigned long primary_rays;
+	unsigned long shadow_rays;
+	unsigned long reflection_rays;
+	unsigned long packets;
+};
+
+enum RTGeomType {RT_MESH, RT_SPHERE, RT_PLANE, RT_BOX};
+
+struct RTGeom {
+	RTGeomType type;
+	RTMaterial mat;
+	int first;		// first shading triangle for meshes, or the primitive
+};
+
+struct RTNode {
+	float bmin[3], bmax[3];
+	int first;		// first child (the second is first + 1), or first triangle for leaves
+	unsigned short count;	// number of triangles for leaves, 0 for inner nodes
+	unsigned short axis;	// split axis, to visit the nearest child first
+};
+
+// ready for the intersection test, the edges from the first vertex
+struct RTTriangle {
+	float v0[3], e1[3], e2[3];
+	int geom, prim;
+};
+
+struct RTShadeTri {
+	Vector3 face_normal;
+	Vector3 normal[3];
+	TexCoord tc[3];
+};
+
+// spheres: center and radius, planes: normal and distance, boxes: min and max
+struct RTPrimitive {
+	float a[3], b[3];
+	int geom;
+};
+
+class RayTracer {
+private:
+	std::vector<RTGeom> geoms;
+	std::vector<RTTriangle> tris;		// in the order the BVH leaves reference them
+	std::vector<RTShadeTri> shade_tris;
+	std::vector<RTPrimitive> prims;
+	std::vector<RTNode> nodes;
+	std::vector<RTLight> lights;
+	Color ambient, background;
+	int max_depth;
+	bool need_build;
+
+	RTStats stats;
+
+	void build_node(int node, int first, int count, std::vector<Vector3> &centers);
+	void trace_prims(RTPacket *pk, RTPacketHit *hit, bool any) const;
+	void trace(RTPacket *pk, RTPacketHit *hit, bool any) const;
+	void shade(const RTPacket &pk, int depth, Color *col, RTStats *st) const;
+
+	friend void rt_tile_work(int idx, void *cls);
+
+public:
+	RayTracer();
+	~RayTracer();
+
+	void clear();
+
+	// geometry, the functions return the geometry id
+	int add_mesh(const TriMesh *mesh, const Matrix4x4 &xform = Matrix4x4::identity_matrix,
+			const RTMaterial &mat = RTMaterial());
+	// spheres and planes, or -1 for other surfaces
+	int add_surface(const Surface *surf, const RTMaterial &mat = RTMaterial());
+	int add_box(const AABox &box, const RTMaterial &mat = RTMaterial());
+	int get_geom_count() const;
+	RTMaterial *get_material(int geom);
+
+	void add_light(const RTLight &light);
+	void set_ambient_light(const Color &col);
+	void set_background(const Color &col);
+	void set_max_depth(int depth);		// reflection bounces
+
+	// builds the BVH, needed after adding meshes. render() calls it if necessary
+	void build();
+	int get_node_count() const;
+
+	// nearest hits, the hit arrays get geom = -1 for the misses
+	bool intersect(const RTRay &ray, RTHit *hit) const;
+	void intersect(const RTPacket &pk, RTPacketHit *hit) const;
+	// any hits, for shadow rays. The packet version returns the occluded rays mask
+	bool occluded(const RTRay &ray) const;
+	unsigned int occluded(const RTPacket &pk) const;
+
+	void get_surface(const RTRay &ray, const RTHit &hit, RTSurface *surf) const;
+
+	/* renders the image seen through the given view and projection matrices
+	 * (as set for the camera), rows from the top down. Shading is Blinn-Phong
+	 * with shadows from every light, and reflections up to max_depth.
+	 */
+	void render(PixelBuffer *pbuf, const Matrix4x4 &view, const Matrix4x4 &proj);
+
+	const RTStats *get_stats() const;
+	void reset_stats();
+};
+
+RTRay rt_ray(const Ray &ray, float tmax = 1e30f);
+void rt_packet_set(RTPacket *pk, int idx, const RTRay &ray);
+
+#endif	// _RTRACE_HPP_
@@ -0,0 +1,619 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* mesh simplification by quadric error edge collapses */
+
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <algorithm>
+#include "simplify.hpp"
+#include "common/threads.h"
+#include "common/profile.h"
+
+// node flags
+enum {
+	NODE_BOUNDARY	= 1,
+	NODE_LOCKED		= 2,	// on non-manifold edges
+	NODE_DEAD		= 4
+};
+
+SimplifyParams::SimplifyParams() {
+	normal_weight = 0.01;
+	tc_weight = 0.1;
+	boundary_weight = 10.0;
+	max_error = 0.0;
+}
+
+// the sum of the squared distances from weighted planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double weight;
+};
+
+static inline void quadric_add_plane(Quadric *q, double a, double b, double c, double d, double w) {
+	q->a2 += w * a * a;
+	q->ab += w * a * b;
+	q->ac += w * a * c;
+	q->ad += w * a * d;
+	q->b2 += w * b * b;
+	q->bc += w * b * c;
+	q->bd += w * b * d;
+	q->c2 += w * c * c;
+	q->cd += w * c * d;
+	q->d2 += w * d * d;
+	q->weight += w;
+}
+
+static inline void quadric_add(Quadric *q, const Quadric &q2) {
+	q->a2 += q2.a2;
+	q->ab += q2.ab;
+	q->ac += q2.ac;
+	q->ad += q2.ad;
+	q->b2 += q2.b2;
+	q->bc += q2.bc;
+	q->bd += q2.bd;
+	q->c2 += q2.c2;
+	q->cd += q2.cd;
+	q->d2 += q2.d2;
+	q->weight += q2.weight;
+}
+
+static inline double quadric_eval(const Quadric &q, const Vector3 &v) {
+	double x = v.x, y = v.y, z = v.z;
+	double res = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2 +
+		2.0 * (q.ab * x * y + q.ac * x * z + q.ad * x + q.bc * y * z + q.bd * y + q.cd * z);
+	return res > 0.0 ? res : 0.0;
+}
+
+struct CollapseEntry {
+	double cost;
+	int node, target;
+	unsigned int stamp;		// the entry is stale if the node's stamp changed since
+
+	bool operator <(const CollapseEntry &e) const {
+		return cost > e.cost;	// cheapest on the top of the priority queue
+	}
+};
+
+// the output of one level
+struct LodData {
+	std::vector<Vertex> verts;
+	std::vector<Triangle> tris;
+};
+
+class Simplifier {
+private:
+	std::vector<Vertex> verts;
+	std::vector<Triangle> src_tris;
+
+	// vertices with the same position are welded into nodes
+	std::vector<Vector3> pos;		// per node, scaled to the unit cube
+	std::vector<int> vnode;			// node of each vertex
+	std::vector<int> node_first;	// the vertices of node i are node_verts[node_first[i]] up to node_first[i + 1]
+	std::vector<Index> node_verts;
+	std::vector<Quadric> quad;
+	std::vector<std::vector<int> > ntris;	// triangles around each node, some may be dead
+	std::vector<unsigned char> flags;
+	std::vector<unsigned int> stamps;
+
+	std::vector<Index> tris;		// current vertices of each triangle
+	std::vector<int> tri_src;		// original triangle
+	std::vector<char> alive;
+	std::vector<double> tri_area;
+	unsigned long tri_count;
+
+	std::priority_queue<CollapseEntry> heap;
+	scalar_t nweight, tweight;
+	double max_error;
+
+	// temporaries
+	std::vector<int> nbr_u, nbr_v, ring;
+	std::vector<std::pair<double, int> > cand;
+	std::vector<std::pair<int, Index> > moved;
+
+	bool contains(int tri, int node) const;
+	int corner(int tri, int node) const;
+	void neighbors(int node, std::vector<int> *nbr);
+	double attr_dist(Index a, Index b) const;
+	Index match_vertex(Index vidx, int node, double *dist) const;
+	bool evaluate(int u, int v, const std::vector<int> &unbr, double bound, double *cost);
+	void update(int node);
+	void collapse(int u, int v);
+
+public:
+	Simplifier(const TriMesh *mesh, const SimplifyParams &params);
+
+	unsigned long get_triangle_count() const;
+	void run(unsigned long target_tris);
+	void get_data(LodData *data) const;
+};
+
+static bool pos_less(const std::pair<Vector3, int> &a, const std::pair<Vector3, int> &b) {
+	if(a.first.x != b.first.x) return a.first.x < b.first.x;
+	if(a.first.y != b.first.y) return a.first.y < b.first.y;
+	return a.first.z < b.first.z;
+}
+
+Simplifier::Simplifier(const TriMesh *mesh, const SimplifyParams &params) {
+	const Vertex *varr = mesh->get_vertex_array()->get_data();
+	unsigned long vcount = mesh->get_vertex_array()->get_count();
+	const Triangle *tarr = mesh->get_triangle_array()->get_data();
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	verts.assign(varr, varr + vcount);
+	src_tris.assign(tarr, tarr + tcount);
+	nweight = params.normal_weight;
+	tweight = params.tc_weight;
+	max_error = params.max_error;
+	tri_count = 0;
+	if(!vcount) return;
+
+	// scale to the unit cube, so that the errors don't depend on the mesh size
+	Vector3 vmin = varr[0].pos, vmax = varr[0].pos;
+	for(unsigned long i=1; i<vcount; i++) {
+		vmin.x = std::min(vmin.x, varr[i].pos.x);
+		vmin.y = std::min(vmin.y, varr[i].pos.y);
+		vmin.z = std::min(vmin.z, varr[i].pos.z);
+		vmax.x = std::max(vmax.x, varr[i].pos.x);
+		vmax.y = std::max(vmax.y, varr[i].pos.y);
+		vmax.z = std::max(vmax.z, varr[i].pos.z);
+	}
+	Vector3 ext = vmax - vmin;
+	scalar_t size = std::max(ext.x, std::max(ext.y, ext.z));
+	scalar_t scale = size > 0.0 ? 1.0 / size : 1.0;
+
+	// weld
+	std::vector<std::pair<Vector3, int> > order(vcount);
+	for(unsigned long i=0; i<vcount; i++) {
+		order[i] = std::make_pair(varr[i].pos, (int)i);
+	}
+	std::sort(order.begin(), order.end(), pos_less);
+
+	vnode.resize(vcount);
+	node_verts.resize(vcount);
+	for(unsigned long i=0; i<vcount; i++) {
+		if(!i || pos_less(order[i - 1], order[i])) {
+			pos.push_back((order[i].first - vmin) * scale);
+			node_first.push_back((int)i);
+		}
+		vnode[order[i].second] = (int)pos.size() - 1;
+		node_verts[i] = order[i].second;
+	}
+	node_first.push_back((int)vcount);
+
+	int node_count = (int)pos.size();
+	Quadric zero;
+	memset(&zero, 0, sizeof zero);
+	quad.resize(node_count, zero);
+	ntris.resize(node_count);
+	flags.resize(node_count, 0);
+	stamps.resize(node_count, 0);
+
+	// triangles and their planes, the degenerate ones are dropped
+	std::vector<Vector3> tri_normal;
+	for(unsigned long i=0; i<tcount; i++) {
+		const Index *vidx = tarr[i].vertices;
+		int n0 = vnode[vidx[0]], n1 = vnode[vidx[1]], n2 = vnode[vidx[2]];
+		if(n0 == n1 || n1 == n2 || n2 == n0) continue;
+
+		Vector3 n = cross_product(pos[n1] - pos[n0], pos[n2] - pos[n0]);
+		double len = n.length();
+		if(len > 0.0) n /= len;
+
+		int tidx = (int)tri_src.size();
+		for(int j=0; j<3; j++) {
+			tris.push_back(vidx[j]);
+			ntris[vnode[vidx[j]]].push_back(tidx);
+			if(len > 0.0) {
+				quadric_add_plane(&quad[vnode[vidx[j]]], n.x, n.y, n.z, -dot_product(n, pos[n0]), len * 0.5);
+			}
+		}
+		tri_src.push_back((int)i);
+		tri_normal.push_back(n);
+		tri_area.push_back(len * 0.5);
+	}
+	tri_count = tri_src.size();
+	alive.resize(tri_count, 1);
+
+	// edges with one triangle are on the boundary, with more than two they're non-manifold
+	std::vector<std::pair<std::pair<int, int>, int> > edges;
+	edges.reserve(tri_count * 3);
+	for(unsigned long i=0; i<tri_count; i++) {
+		for(int j=0; j<3; j++) {
+			int a = vnode[tris[i * 3 + j]], b = vnode[tris[i * 3 + (j + 1) % 3]];
+			edges.push_back(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), (int)i));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	for(size_t i=0; i<edges.size(); ) {
+		size_t end = i + 1;
+		while(end < edges.size() && edges[end].first == edges[i].first) end++;
+
+		int a = edges[i].first.first, b = edges[i].first.second;
+		if(end - i == 1) {
+			// keep the boundary in place with a plane through it, perpendicular to the triangle
+			Vector3 edir = pos[b] - pos[a];
+			Vector3 bn = cross_product(edir, tri_normal[edges[i].second]);
+			double len = bn.length();
+			if(len > 0.0) {
+				bn /= len;
+				double w = params.boundary_weight * edir.length_sq();
+				double d = -dot_product(bn, pos[a]);
+				quadric_add_plane(&quad[a], bn.x, bn.y, bn.z, d, w);
+				quadric_add_plane(&quad[b], bn.x, bn.y, bn.z, d, w);
+			}
+			flags[a] |= NODE_BOUNDARY;
+			flags[b] |= NODE_BOUNDARY;
+		} else if(end - i > 2) {
+			flags[a] |= NODE_LOCKED;
+			flags[b] |= NODE_LOCKED;
+		}
+		i = end;
+	}
+
+	for(int i=0; i<node_count; i++) {
+		update(i);
+	}
+}
+
+unsigned long Simplifier::get_triangle_count() const {
+	return tri_count;
+}
+
+inline bool Simplifier::contains(int tri, int node) const {
+	const Index *vidx = &tris[tri * 3];
+	return vnode[vidx[0]] == node || vnode[vidx[1]] == node || vnode[vidx[2]] == node;
+}
+
+inline int Simplifier::corner(int tri, int node) const {
+	const Index *vidx = &tris[tri * 3];
+	if(vnode[vidx[0]] == node) return 0;
+	return vnode[vidx[1]] == node ? 1 : 2;
+}
+
+// the nodes around a node, sorted. Also drops the dead triangles from its list
+void Simplifier::neighbors(int node, std::vector<int> *nbr) {
+	std::vector<int> &tlist = ntris[node];
+	nbr->clear();
+
+	size_t count = 0;
+	for(size_t i=0; i<tlist.size(); i++) {
+		int t = tlist[i];
+		if(!alive[t]) continue;
+		tlist[count++] = t;
+
+		for(int j=0; j<3; j++) {
+			int n = vnode[tris[t * 3 + j]];
+			if(n != node) nbr->push_back(n);
+		}
+	}
+	tlist.resize(count);
+
+	std::sort(nbr->begin(), nbr->end());
+	nbr->erase(std::unique(nbr->begin(), nbr->end()), nbr->end());
+}
+
+inline double Simplifier::attr_dist(Index a, Index b) const {
+	const Vertex &va = verts[a], &vb = verts[b];
+	double tdist = 0.0;
+	for(int i=0; i<2; i++) {
+		double du = va.tex[i].u - vb.tex[i].u;
+		double dv = va.tex[i].v - vb.tex[i].v;
+		tdist += du * du + dv * dv;
+	}
+	return nweight * (va.normal - vb.normal).length_sq() + tweight * tdist;
+}
+
+/* match_vertex
+ * the vertex of the node with the attributes closest to the given one, to
+ * take its place in the triangles moving to that node. The triangles only
+ * ever get vertices the node already has, so any of them will do, even if
+ * it's not used any more.
+ */
+Index Simplifier::match_vertex(Index vidx, int node, double *dist) const {
+	const Index *vlist = &node_verts[node_first[node]];
+	int count = node_first[node + 1] - node_first[node];
+
+	Index best = vlist[0];
+	double best_dist = attr_dist(vidx, best);
+	for(int i=1; i<count; i++) {
+		double d = attr_dist(vidx, vlist[i]);
+		if(d < best_dist) {
+			best = vlist[i];
+			best_dist = d;
+		}
+	}
+	*dist = best_dist;
+	return best;
+}
+
+/* evaluate - cost of moving node u onto node v
+ * unbr are the neighbours of u. Returns false if the collapse would change
+ * the topology, move the open boundaries, or flip any of the remaining
+ * triangles, or if it costs more than bound (when not negative). The cheap
+ * tests go first, the cost only grows after the quadrics.
+ */
+bool Simplifier::evaluate(int u, int v, const std::vector<int> &unbr, double bound, double *cost) {
+	if(flags[u] & (NODE_LOCKED | NODE_DEAD)) return false;
+
+	double c = quadric_eval(quad[u], pos[v]) + quadric_eval(quad[v], pos[v]);
+	if(bound >= 0.0 && c > bound) return false;
+
+	int shared = 0;
+	const std::vector<int> &tlist = ntris[u];
+	for(size_t i=0; i<tlist.size(); i++) {
+		if(contains(tlist[i], v)) shared++;
+	}
+	if(!shared) return false;
+
+	// boundary nodes can only slide along their boundary edges
+	if((flags[u] & NODE_BOUNDARY) && (!(flags[v] & NODE_BOUNDARY) || shared != 1)) {
+		return false;
+	}
+
+	Index last_vidx = 0;
+	double last_dist = -1.0;
+
+	for(size_t i=0; i<tlist.size(); i++) {
+		int t = tlist[i];
+		if(contains(t, v)) continue;
+
+		int k = corner(t, u);
+		const Vector3 &p1 = pos[vnode[tris[t * 3 + (k + 1) % 3]]];
+		const Vector3 &p2 = pos[vnode[tris[t * 3 + (k + 2) % 3]]];
+		Vector3 old_n = cross_product(p1 - pos[u], p2 - pos[u]);
+		Vector3 new_n = cross_product(p1 - pos[v], p2 - pos[v]);
+		if(dot_product(old_n, new_n) <= 0.0) return false;
+
+		// most triangles around a node share the same vertex
+		if(last_dist < 0.0 || tris[t * 3 + k] != last_vidx) {
+			last_vidx = tris[t * 3 + k];
+			match_vertex(last_vidx, v, &last_dist);
+		}
+		c += last_dist * tri_area[t];
+		if(bound >= 0.0 && c > bound) return false;
+	}
+
+	double weight = quad[u].weight + quad[v].weight;
+	if(max_error > 0.0 && weight > 0.0 && c / weight > max_error * max_error) {
+		return false;
+	}
+
+	// the nodes connected to both must be the ones across the triangles of the edge
+	neighbors(v, &nbr_v);
+
+	int common = 0;
+	size_t i = 0, j = 0;
+	while(i < unbr.size() && j < nbr_v.size()) {
+		if(unbr[i] < nbr_v[j]) {
+			i++;
+		} else if(nbr_v[j] < unbr[i]) {
+			j++;
+		} else {
+			common++;
+			i++;
+			j++;
+		}
+	}
+	if(common != shared) return false;
+
+	*cost = c;
+	return true;
+}
+
+// finds the cheapest collapse of the node, and puts it in the heap
+void Simplifier::update(int node) {
+	if(flags[node] & (NODE_LOCKED | NODE_DEAD)) return;
+	stamps[node]++;
+
+	neighbors(node, &nbr_u);
+
+	// the quadric error is a lower bound of the cost, try them in that order
+	cand.clear();
+	for(size_t i=0; i<nbr_u.size(); i++) {
+		int v = nbr_u[i];
+		cand.push_back(std::make_pair(quadric_eval(quad[node], pos[v]) + quadric_eval(quad[v], pos[v]), v));
+	}
+	std::sort(cand.begin(), cand.end());
+
+	CollapseEntry best;
+	best.target = -1;
+	best.cost = -1.0;
+	for(size_t i=0; i<cand.size(); i++) {
+		if(best.target != -1 && cand[i].first >= best.cost) break;
+
+		double cost;
+		if(evaluate(node, cand[i].second, nbr_u, best.cost, &cost)) {
+			best.cost = cost;
+			best.target = cand[i].second;
+		}
+	}
+
+	if(best.target != -1) {
+		best.node = node;
+		best.stamp = stamps[node];
+		heap.push(best);
+	}
+}
+
+void Simplifier::collapse(int u, int v) {
+	std::vector<int> tlist;
+	tlist.swap(ntris[u]);
+
+	// pick the vertices the moving corners get before removing any triangle
+	moved.clear();
+	for(size_t i=0; i<tlist.size(); i++) {
+		int t = tlist[i];
+		if(!alive[t] || contains(t, v)) continue;
+
+		int k = corner(t, u);
+		double dist;
+		moved.push_back(std::make_pair(t * 3 + k, match_vertex(tris[t * 3 + k], v, &dist)));
+	}
+
+	for(size_t i=0; i<tlist.size(); i++) {
+		int t = tlist[i];
+		if(alive[t] && contains(t, v)) {
+			alive[t] = 0;
+			tri_count--;
+		}
+	}
+
+	for(size_t i=0; i<moved.size(); i++) {
+		tris[moved[i].first] = moved[i].second;
+		ntris[v].push_back(moved[i].first / 3);
+	}
+
+	quadric_add(&quad[v], quad[u]);
+	flags[u] |= NODE_DEAD;
+
+	// the collapses around v cost differently now
+	neighbors(v, &ring);
+	update(v);
+	for(size_t i=0; i<ring.size(); i++) {
+		update(ring[i]);
+	}
+}
+
+void Simplifier::run(unsigned long target_tris) {
+	while(tri_count > target_tris && !heap.empty()) {
+		CollapseEntry e = heap.top();
+		heap.pop();
+
+		if((flags[e.node] & NODE_DEAD) || (flags[e.target] & NODE_DEAD) || e.stamp != stamps[e.node]) {
+			continue;
+		}
+
+		// things may have changed around the target, check again
+		double cost;
+		neighbors(e.node, &nbr_u);
+		if(!evaluate(e.node, e.target, nbr_u, -1.0, &cost) || cost > e.cost * 1.0001 + 1e-12) {
+			update(e.node);
+			continue;
+		}
+
+		collapse(e.node, e.target);
+	}
+}
+
+void Simplifier::get_data(LodData *data) const {
+	std::vector<int> remap(verts.size(), -1);
+	data->verts.clear();
+	data->tris.clear();
+
+	for(size_t i=0; i<tri_src.size(); i++) {
+		if(!alive[i]) continue;
+
+		Triangle tri = src_tris[tri_src[i]];
+		for(int j=0; j<3; j++) {
+			Index vidx = tris[i * 3 + j];
+			if(remap[vidx] == -1) {
+				remap[vidx] = (int)data->verts.size();
+				data->verts.push_back(verts[vidx]);
+			}
+			tri.vertices[j] = (Index)remap[vidx];
+		}
+		data->tris.push_back(tri);
+	}
+
+	for(size_t i=0; i<data->tris.size(); i++) {
+		data->tris[i].calculate_normal(&data->verts[0], true);
+	}
+}
+
+static void set_mesh_data(TriMesh *mesh, const LodData &data) {
+	mesh->set_data(data.verts.empty() ? 0 : &data.verts[0], data.verts.size(),
+			data.tris.empty() ? 0 : &data.tris[0], data.tris.size());
+}
+
+static void build_chain(const TriMesh *mesh, LodData *lods, const scalar_t *ratios, int count,
+		const SimplifyParams &params) {
+	Simplifier simp(mesh, params);
+	unsigned long tcount = mesh->get_triangle_array()->get_count();
+
+	for(int i=0; i<count; i++) {
+		simp.run((unsigned long)(tcount * ratios[i]));
+		simp.get_data(lods + i);
+	}
+}
+
+unsigned long simplify_mesh(const TriMesh *mesh, TriMesh *dest, unsigned long target_tris,
+		const SimplifyParams &params) {
+	PROF_SCOPE("simplify_mesh");
+
+	Simplifier simp(mesh, params);
+	simp.run(target_tris);
+
+	LodData data;
+	simp.get_data(&data);
+	set_mesh_data(dest, data);
+	return simp.get_triangle_count();
+}
+
+void create_lod_chain(const TriMesh *mesh, TriMesh *lods, const scalar_t *ratios, int count,
+		const SimplifyParams &params) {
+	PROF_SCOPE("create_lod_chain");
+
+	std::vector<LodData> data(count);
+	build_chain(mesh, &data[0], ratios, count, params);
+	for(int i=0; i<count; i++) {
+		set_mesh_data(lods + i, data[i]);
+	}
+}
+
+struct ChainWork {
+	const TriMesh * const *meshes;
+	std::vector<LodData> data;		// count levels per mesh
+	const scalar_t *ratios;
+	int count;
+	const SimplifyParams *params;
+};
+
+static void chain_work(int idx, void *cls) {
+	ChainWork *work = (ChainWork*)cls;
+	build_chain(work->meshes[idx], &work->data[idx * work->count], work->ratios, work->count, *work->params);
+}
+
+/* create_lod_chains
+ * the workers only fill plain arrays, the meshes are set afterwards from
+ * this thread, since copies of TriMesh objects share their arrays.
+ */
+void create_lod_chains(const TriMesh * const *meshes, int mesh_count, std::vector<TriMesh> *lods,
+		const scalar_t *ratios, int count, const SimplifyParams &params) {
+	PROF_SCOPE("create_lod_chains");
+
+	ChainWork work;
+	work.meshes = meshes;
+	work.data.resize(mesh_count * count);
+	work.ratios = ratios;
+	work.count = count;
+	work.params = &params;
+
+	thr_parallel_for(mesh_count, chain_work, &work);
+
+	for(int i=0; i<mesh_count; i++) {
+		lods[i].resize(count);
+		for(int j=0; j<count; j++) {
+			set_mesh_data(&lods[i][j], work.data[i * count + j]);
+		}
+	}
+}
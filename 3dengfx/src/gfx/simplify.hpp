@@ -0,0 +1,65 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* mesh simplification by quadric error edge collapses
+ *
+ * Vertices with the same position are welded for the topology, so the
+ * seams of the normals and texture coordinates don't open up. Each collapse
+ * moves a vertex onto one of its neighbours (half edge collapse), picked from
+ * a heap by the quadric error of the planes around them, plus the difference
+ * of the normals and texture coordinates the triangles around it end up
+ * with. Open boundaries are kept in place by planes perpendicular to them,
+ * and collapses that would flip triangles or make the mesh non-manifold are
+ * never done. The vertices keep their attributes, the output vertices are a
+ * subset of the input ones.
+ */
+
+#ifndef _SIMPLIFY_HPP_
+#define _SIMPLIFY_HPP_
+
+#include <vector>
+#include "gfx/3dgeom.hpp"
+
+struct SimplifyParams {
+	scalar_t normal_weight;		// cost of changing the normals, relative to the geometric error
+	scalar_t tc_weight;			// and the texture coordinates
+	scalar_t boundary_weight;	// of moving the open boundaries
+	scalar_t max_error;			// stop at this error (relative to the mesh size), 0 for no limit
+
+	SimplifyParams();
+};
+
+/* simplifies the mesh down to target_tris triangles or less, if possible,
+ * and returns the number of triangles left.
+ */
+unsigned long simplify_mesh(const TriMesh *mesh, TriMesh *dest, unsigned long target_tris,
+		const SimplifyParams &params = SimplifyParams());
+
+/* creates an LOD chain in one simplification pass. Level i gets ratios[i]
+ * of the triangles of the mesh, the ratios must be decreasing.
+ */
+void create_lod_chain(const TriMesh *mesh, TriMesh *lods, const scalar_t *ratios, int count,
+		const SimplifyParams &params = SimplifyParams());
+
+// the LOD chains of many meshes, built in parallel. lods[i] gets the chain of meshes[i]
+void create_lod_chains(const TriMesh * const *meshes, int mesh_count, std::vector<TriMesh> *lods,
+		const scalar_t *ratios, int count, const SimplifyParams &params = SimplifyParams());
+
+#endif	// _SIMPLIFY_HPP_
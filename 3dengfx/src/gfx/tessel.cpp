@@ -0,0 +1,714 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* adaptive tessellation of bicubic bezier patches */
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <algorithm>
+#include "tessel.hpp"
+#include "common/threads.h"
+#include "common/profile.h"
+
+using std::min;
+using std::max;
+
+TessParams::TessParams() {
+	max_error = 0.01;
+	min_level = 1;
+	max_level = 32;
+	use_view = false;
+	pixels_per_unit = 1.0;
+}
+
+TessParams uniform_tess_params(int level) {
+	TessParams params;
+	params.min_level = params.max_level = level;
+	return params;
+}
+
+// the bernstein basis of a cubic and its derivative at t
+static inline void bernstein(scalar_t t, scalar_t *b, scalar_t *db) {
+	scalar_t omt = 1.0 - t;
+	b[0] = omt * omt * omt;
+	b[1] = 3.0 * t * omt * omt;
+	b[2] = 3.0 * t * t * omt;
+	b[3] = t * t * t;
+
+	if(db) {
+		db[0] = -3.0 * omt * omt;
+		db[1] = 3.0 * omt * omt - 6.0 * t * omt;
+		db[2] = 6.0 * t * omt - 3.0 * t * t;
+		db[3] = 3.0 * t * t;
+	}
+}
+
+// the basis at the level + 1 samples i / level, 4 values for each
+static void basis_table(int level, std::vector<scalar_t> *b, std::vector<scalar_t> *db) {
+	b->resize((level + 1) * 4);
+	db->resize((level + 1) * 4);
+	for(int i=0; i<=level; i++) {
+		bernstein((scalar_t)i / (scalar_t)level, &(*b)[i * 4], &(*db)[i * 4]);
+	}
+}
+
+/* the point idx / level of a curve, this is the only place edge vertices
+ * come from, so the patches on both sides of an edge get the same ones.
+ */
+static Vector3 edge_point(const Vector3 *cp, int idx, int level) {
+	scalar_t b[4];
+	bernstein((scalar_t)idx / (scalar_t)level, b, 0);
+	return cp[0] * b[0] + cp[1] * b[1] + cp[2] * b[2] + cp[3] * b[3];
+}
+
+// the largest second derivative of a cubic bezier curve
+static scalar_t curve_curvature(const Vector3 &p0, const Vector3 &p1, const Vector3 &p2, const Vector3 &p3) {
+	return 6.0 * max((p0 - p1 * 2.0 + p2).length(), (p1 - p2 * 2.0 + p3).length());
+}
+
+static scalar_t box_dist(const Vector3 &p, const AABox &box) {
+	Vector3 d;
+	d.x = max(max(box.vmin.x - p.x, p.x - box.vmax.x), (scalar_t)0.0);
+	d.y = max(max(box.vmin.y - p.y, p.y - box.vmax.y), (scalar_t)0.0);
+	d.z = max(max(box.vmin.z - p.z, p.z - box.vmax.z), (scalar_t)0.0);
+	return d.length();
+}
+
+/* the segments for a curvature bound, the error of splitting a curve into
+ * n segments is at most curv / (8 n^2), half the error goes to each of the
+ * two directions of a patch.
+ */
+static int calc_level(scalar_t curv, scalar_t max_error, int min_level, int max_level) {
+	int level = max_level;
+	if(max_error > 0.0) {
+		scalar_t n = ceil(sqrt(curv / (4.0 * max_error)));
+		if(n < (scalar_t)max_level) level = (int)n;
+	}
+	return max(min_level, min(level, max_level));
+}
+
+struct EdgeKey {
+	Vector3 cp[4];
+
+	bool operator <(const EdgeKey &k) const {
+		for(int i=0; i<4; i++) {
+			if(cp[i].x != k.cp[i].x) return cp[i].x < k.cp[i].x;
+			if(cp[i].y != k.cp[i].y) return cp[i].y < k.cp[i].y;
+			if(cp[i].z != k.cp[i].z) return cp[i].z < k.cp[i].z;
+		}
+		return false;
+	}
+};
+
+// the control points of each side, in the direction of increasing u or v
+static const int side_cp[4][4] = {{0, 1, 2, 3}, {3, 7, 11, 15}, {12, 13, 14, 15}, {0, 4, 8, 12}};
+
+PatchSet::PatchSet() {
+	revision = 0;
+	edge_count = 0;
+}
+
+void PatchSet::set_data(const Vector3 *cp, int cp_count, const unsigned int *patches, int patch_count) {
+	this->cp.assign(cp, cp + cp_count);
+	this->patches.assign(patches, patches + patch_count * 16);
+	revision++;
+
+	curv_u.resize(patch_count);
+	curv_v.resize(patch_count);
+	bounds.resize(patch_count);
+
+	for(int i=0; i<patch_count; i++) {
+		const unsigned int *idx = patches + i * 16;
+
+		scalar_t cu = 0.0, cv = 0.0;
+		for(int j=0; j<4; j++) {
+			cu = max(cu, curve_curvature(cp[idx[j * 4]], cp[idx[j * 4 + 1]], cp[idx[j * 4 + 2]], cp[idx[j * 4 + 3]]));
+			cv = max(cv, curve_curvature(cp[idx[j]], cp[idx[4 + j]], cp[idx[8 + j]], cp[idx[12 + j]]));
+		}
+		curv_u[i] = cu;
+		curv_v[i] = cv;
+
+		AABox box(cp[idx[0]], cp[idx[0]]);
+		for(int j=1; j<16; j++) {
+			box.add_point(cp[idx[j]]);
+		}
+		bounds[i] = box;
+	}
+
+	find_edges();
+}
+
+/* find_edges
+ * matches the sides by the positions of their control points, patches
+ * that don't share the control points themselves still share the edge.
+ */
+void PatchSet::find_edges() {
+	int patch_count = get_patch_count();
+	side_edge.resize(patch_count * 4);
+	side_reversed.resize(patch_count * 4);
+	edge_cp.clear();
+
+	std::map<EdgeKey, int> edges;
+	for(int i=0; i<patch_count; i++) {
+		for(int s=0; s<4; s++) {
+			EdgeKey key, rev;
+			for(int j=0; j<4; j++) {
+				key.cp[j] = get_control_point(i, side_cp[s][j]);
+				rev.cp[3 - j] = key.cp[j];
+			}
+
+			bool reversed = rev < key;
+			if(reversed) key = rev;
+
+			std::map<EdgeKey, int>::iterator iter = edges.find(key);
+			int edge;
+			if(iter == edges.end()) {
+				edge = (int)edges.size();
+				edges[key] = edge;
+				edge_cp.insert(edge_cp.end(), key.cp, key.cp + 4);
+			} else {
+				edge = iter->second;
+			}
+
+			side_edge[i * 4 + s] = edge;
+			side_reversed[i * 4 + s] = reversed;
+		}
+	}
+	edge_count = (int)edges.size();
+}
+
+/* calc_levels
+ * every patch gets its own grid, and every edge the finer of the grids of
+ * the patches along it.
+ */
+void PatchSet::calc_levels(const TessParams &params, PatchLevels *levels) const {
+	int patch_count = get_patch_count();
+	int min_level = max(1, min(params.min_level, TESS_MAX_LEVEL));
+	int max_level = max(min_level, min(params.max_level, TESS_MAX_LEVEL));
+
+	for(int i=0; i<patch_count; i++) {
+		scalar_t err = params.max_error;
+		if(params.use_view) {
+			scalar_t dist = max(box_dist(params.view_pos, bounds[i]), (scalar_t)small_number);
+			err *= dist / params.pixels_per_unit;
+		}
+		levels[i].u = calc_level(curv_u[i], err, min_level, max_level);
+		levels[i].v = calc_level(curv_v[i], err, min_level, max_level);
+	}
+
+	std::vector<unsigned char> edge_level(edge_count, 0);
+	for(int i=0; i<patch_count; i++) {
+		for(int s=0; s<4; s++) {
+			unsigned char lvl = (s & 1) ? levels[i].v : levels[i].u;
+			unsigned char *elvl = &edge_level[side_edge[i * 4 + s]];
+			if(lvl > *elvl) *elvl = lvl;
+		}
+	}
+
+	for(int i=0; i<patch_count; i++) {
+		for(int s=0; s<4; s++) {
+			levels[i].side[s] = edge_level[side_edge[i * 4 + s]];
+		}
+	}
+}
+
+// the grid sample positions of a patch in the space of its parameters
+struct ParamPoint {
+	scalar_t u, v;
+};
+
+// orders the vertices counterclockwise in the parameter space, like the triangles of the grid
+static inline void wind_triangle(Index a, Index *b, Index *c, const ParamPoint *uv, Index base) {
+	const ParamPoint &pa = uv[a - base], &pb = uv[*b - base], &pc = uv[*c - base];
+	scalar_t area = (pb.u - pa.u) * (pc.v - pa.v) - (pb.v - pa.v) * (pc.u - pa.u);
+	if(area < 0.0) std::swap(*b, *c);
+}
+
+static inline void add_triangle(std::vector<Triangle> *tris, Index a, Index b, Index c,
+		const ParamPoint *uv, Index base) {
+	wind_triangle(a, &b, &c, uv, base);
+	tris->push_back(Triangle(a, b, c));
+}
+
+/* false if the triangle, wound by add_triangle(), faces against the normals
+ * of its vertices, folding over the surface. Where a side of the patch
+ * collapses to a point, or the surface curls tightly, the parameters don't
+ * tell which diagonal follows the surface.
+ */
+static bool follows_surface(const std::vector<Vertex> &verts, Index a, Index b, Index c,
+		const ParamPoint *uv, Index base) {
+	wind_triangle(a, &b, &c, uv, base);
+	const Vertex &va = verts[a], &vb = verts[b], &vc = verts[c];
+	Vector3 e1 = vb.pos - va.pos, e2 = vc.pos - va.pos;
+	Vector3 n = cross_product(e1, e2);
+
+	// slivers at collapsed sides face nowhere in particular
+	if(n.length_sq() <= 1e-8 * e1.length_sq() * e2.length_sq()) return true;
+	return dot_product(n, va.normal + vb.normal + vc.normal) >= 0.0;
+}
+
+/* tessellate
+ * With the sides matching the grid the patch is a plain grid, laid out
+ * like create_bezier_patch always did, but for the quads whose diagonal
+ * folds against the surface where the other one doesn't. Otherwise the
+ * inner grid (at least 2 by 2 segments) is joined to the side vertices by
+ * a strip for each side, zipping the two rows of vertices by their
+ * parameters, unless the triangle that gives folds against the surface
+ * and the other doesn't. Where neither fits, a coarse grid or a single
+ * row of inner vertices leaving no choice, the patch is tried again with
+ * at least 3 by 3 and 4 by 4 segments, keeping the one folding least.
+ */
+void PatchSet::tessellate(int patch, const PatchLevels &levels, std::vector<Vertex> *verts, std::vector<Triangle> *tris) const {
+	size_t vcount = verts->size(), tcount = tris->size();
+
+	int best = 2, folds = tessellate(patch, levels, 2, verts, tris);
+
+	// a finer grid only where it changes anything
+	int last = best;
+	for(int min_inner=3; folds && min_inner<=4 && (levels.u < min_inner || levels.v < min_inner); min_inner++) {
+		verts->resize(vcount);
+		tris->resize(tcount);
+		int f = tessellate(patch, levels, min_inner, verts, tris);
+		last = min_inner;
+		if(f < folds) {
+			folds = f;
+			best = min_inner;
+		}
+	}
+
+	if(last != best) {
+		verts->resize(vcount);
+		tris->resize(tcount);
+		tessellate(patch, levels, best, verts, tris);
+	}
+}
+
+int PatchSet::tessellate(int patch, const PatchLevels &levels, int min_inner,
+		std::vector<Vertex> *verts, std::vector<Triangle> *tris) const {
+	const Vector3 *cpts[16];
+	for(int i=0; i<16; i++) {
+		cpts[i] = &get_control_point(patch, i);
+	}
+
+	int side[4];
+	for(int s=0; s<4; s++) side[s] = levels.side[s];
+
+	// the first try keeps the levels of a regular patch, even below 2
+	int nu = min_inner > 2 ? max((int)levels.u, min_inner) : levels.u;
+	int nv = min_inner > 2 ? max((int)levels.v, min_inner) : levels.v;
+	bool regular = side[0] == nu && side[2] == nu && side[1] == nv && side[3] == nv;
+	if(!regular) {
+		nu = max(nu, min_inner);
+		nv = max(nv, min_inner);
+	}
+
+	std::vector<scalar_t> bu, dbu, bv, dbv;
+	basis_table(nu, &bu, &dbu);
+	basis_table(nv, &bv, &dbv);
+
+	Index base = verts->size();
+	std::vector<ParamPoint> uv;
+
+	// the rows of the grid, from the columns of control points at each v
+	Vector3 col[4], dcol[4];
+	int first = regular ? 0 : 1;
+	int last_u = regular ? nu : nu - 1, last_v = regular ? nv : nv - 1;
+
+	for(int j=first; j<=last_v; j++) {
+		const scalar_t *b = &bv[j * 4], *db = &dbv[j * 4];
+		for(int k=0; k<4; k++) {
+			col[k] = *cpts[k] * b[0] + *cpts[4 + k] * b[1] + *cpts[8 + k] * b[2] + *cpts[12 + k] * b[3];
+			dcol[k] = *cpts[k] * db[0] + *cpts[4 + k] * db[1] + *cpts[8 + k] * db[2] + *cpts[12 + k] * db[3];
+		}
+
+		for(int i=first; i<=last_u; i++) {
+			const scalar_t *b = &bu[i * 4], *db = &dbu[i * 4];
+			Vector3 pos = col[0] * b[0] + col[1] * b[1] + col[2] * b[2] + col[3] * b[3];
+			Vector3 du = col[0] * db[0] + col[1] * db[1] + col[2] * db[2] + col[3] * db[3];
+			Vector3 dv = dcol[0] * b[0] + dcol[1] * b[1] + dcol[2] * b[2] + dcol[3] * b[3];
+
+			ParamPoint p = {(scalar_t)i / (scalar_t)nu, (scalar_t)j / (scalar_t)nv};
+			Vertex vert(pos, p.u, 1.0 - p.v, Color(1.0f));
+			vert.normal = cross_product(du, dv);
+			verts->push_back(vert);
+			uv.push_back(p);
+		}
+	}
+
+	/* the side vertices, either the boundary of the grid or separate rows,
+	 * and the normals where the derivatives vanish (at collapsed sides)
+	 */
+	Index side_start[4];
+	for(int s=0; s<4; s++) {
+		int edge = side_edge[patch * 4 + s];
+		bool rev = side_reversed[patch * 4 + s];
+		const Vector3 *ecp = &edge_cp[edge * 4];
+		side_start[s] = verts->size();
+
+		for(int k=0; k<=side[s]; k++) {
+			Vector3 pos = edge_point(ecp, rev ? side[s] - k : k, side[s]);
+			scalar_t t = (scalar_t)k / (scalar_t)side[s];
+			ParamPoint p;
+			p.u = (s & 1) ? (s == 1 ? 1.0 : 0.0) : t;
+			p.v = (s & 1) ? t : (s == 2 ? 1.0 : 0.0);
+
+			if(regular) {
+				int i = (int)(p.u * nu + 0.5), j = (int)(p.v * nv + 0.5);
+				(*verts)[base + j * (nu + 1) + i].pos = pos;
+			} else {
+				verts->push_back(Vertex(pos, p.u, 1.0 - p.v, Color(1.0f)));
+				uv.push_back(p);
+			}
+		}
+	}
+
+	for(size_t i=base; i<verts->size(); i++) {
+		Vertex &v = (*verts)[i];
+		if(regular || i < side_start[0]) {
+			if(v.normal.length_sq() > xsmall_number) {
+				v.normal.normalize();
+				continue;
+			}
+		}
+
+		// evaluate the derivatives a little towards the middle of the patch
+		const ParamPoint &p = uv[i - base];
+		scalar_t u = p.u + (0.5 - p.u) * 0.001, v_ = p.v + (0.5 - p.v) * 0.001;
+		scalar_t b[4], db[4];
+		bernstein(v_, b, db);
+		for(int k=0; k<4; k++) {
+			col[k] = *cpts[k] * b[0] + *cpts[4 + k] * b[1] + *cpts[8 + k] * b[2] + *cpts[12 + k] * b[3];
+			dcol[k] = *cpts[k] * db[0] + *cpts[4 + k] * db[1] + *cpts[8 + k] * db[2] + *cpts[12 + k] * db[3];
+		}
+		bernstein(u, b, db);
+		Vector3 du = col[0] * db[0] + col[1] * db[1] + col[2] * db[2] + col[3] * db[3];
+		Vector3 dv = dcol[0] * b[0] + dcol[1] * b[1] + dcol[2] * b[2] + dcol[3] * b[3];
+		v.normal = cross_product(du, dv).normalized();
+	}
+
+	int folds = 0;
+	if(regular) {
+		Index vrow = nu + 1;
+		for(int j=0; j<nv; j++) {
+			for(int i=0; i<nu; i++) {
+				Index v0 = base + j * vrow + i;
+				Index v1 = v0 + 1, v2 = v0 + vrow, v3 = v1 + vrow;
+
+				int bad = !follows_surface(*verts, v0, v1, v3, &uv[0], base) + !follows_surface(*verts, v0, v3, v2, &uv[0], base);
+
+				// the other diagonal where this one folds against the surface
+				if(bad && follows_surface(*verts, v0, v1, v2, &uv[0], base) && follows_surface(*verts, v1, v3, v2, &uv[0], base)) {
+					tris->push_back(Triangle(v0, v1, v2));
+					tris->push_back(Triangle(v1, v3, v2));
+				} else {
+					folds += bad;
+					tris->push_back(Triangle(v0, v1, v3));
+					tris->push_back(Triangle(v0, v3, v2));
+				}
+			}
+		}
+		return folds;
+	}
+
+	// the inner grid, (nu - 1) by (nv - 1) vertices
+	Index irow = nu - 1;
+	for(int j=0; j<nv - 2; j++) {
+		for(int i=0; i<nu - 2; i++) {
+			Index v0 = base + j * irow + i;
+			Index v1 = v0 + 1, v2 = v0 + irow, v3 = v1 + irow;
+			tris->push_back(Triangle(v0, v1, v3));
+			tris->push_back(Triangle(v0, v3, v2));
+		}
+	}
+
+	for(int s=0; s<4; s++) {
+		int n = (s & 1) ? nv : nu;
+		int inner = n - 1;
+
+		// the first inner vertex of the side and the step to the next
+		Index istart, istep;
+		switch(s) {
+		case 0:
+			istart = base;
+			istep = 1;
+			break;
+		case 1:
+			istart = base + nu - 2;
+			istep = irow;
+			break;
+		case 2:
+			istart = base + (nv - 2) * irow;
+			istep = 1;
+			break;
+		default:
+			istart = base;
+			istep = irow;
+			break;
+		}
+
+		int a = 0, b = 0;
+		while(a < side[s] || b < inner - 1) {
+			// advance on the row whose next vertex comes first
+			bool outer;
+			if(a == side[s]) {
+				outer = false;
+			} else if(b == inner - 1) {
+				outer = true;
+			} else {
+				outer = (a + 1) * n <= (b + 2) * side[s];
+			}
+
+			Index o = side_start[s] + a, i = istart + b * istep;
+			bool fits = outer ? follows_surface(*verts, o, o + 1, i, &uv[0], base) :
+				follows_surface(*verts, o, i + istep, i, &uv[0], base);
+			if(!fits && a < side[s] && b < inner - 1) {
+				fits = outer ? follows_surface(*verts, o, i + istep, i, &uv[0], base) :
+					follows_surface(*verts, o, o + 1, i, &uv[0], base);
+				if(fits) outer = !outer;
+			}
+			if(!fits) folds++;
+
+			if(outer) {
+				add_triangle(tris, o, o + 1, i, &uv[0], base);
+				a++;
+			} else {
+				add_triangle(tris, o, i + istep, i, &uv[0], base);
+				b++;
+			}
+		}
+	}
+	return folds;
+}
+
+// puts the patches together into the mesh
+static void join_patches(TriMesh *mesh, const std::vector<Vertex> **verts, const std::vector<Triangle> **tris, int count) {
+	unsigned long vcount = 0, tcount = 0;
+	for(int i=0; i<count; i++) {
+		vcount += verts[i]->size();
+		tcount += tris[i]->size();
+	}
+
+	Vertex *varray = new Vertex[vcount];
+	Triangle *tarray = new Triangle[tcount];
+
+	Vertex *vptr = varray;
+	Triangle *tptr = tarray;
+	Index offs = 0;
+	for(int i=0; i<count; i++) {
+		if(!verts[i]->empty()) {
+			std::copy(verts[i]->begin(), verts[i]->end(), vptr);
+			vptr += verts[i]->size();
+		}
+
+		for(size_t j=0; j<tris[i]->size(); j++) {
+			const Triangle &t = (*tris[i])[j];
+			*tptr++ = Triangle(t.vertices[0] + offs, t.vertices[1] + offs, t.vertices[2] + offs);
+		}
+		offs += verts[i]->size();
+	}
+
+	mesh->adopt_data(varray, vcount, tarray, tcount);
+}
+
+struct TessWork {
+	const PatchSet *set;
+	const PatchLevels *levels;
+	std::vector<Vertex> *verts;
+	std::vector<Triangle> *tris;
+};
+
+static void tess_work(int idx, void *cls) {
+	TessWork *w = (TessWork*)cls;
+	w->set->tessellate(idx, w->levels[idx], w->verts + idx, w->tris + idx);
+}
+
+void tessellate_patches(const PatchSet *set, const TessParams &params, TriMesh *mesh) {
+	PROF_SCOPE("tessellate_patches");
+	int count = set->get_patch_count();
+	if(!count) {
+		*mesh = TriMesh();
+		return;
+	}
+
+	std::vector<PatchLevels> levels(count);
+	set->calc_levels(params, &levels[0]);
+
+	std::vector<std::vector<Vertex> > verts(count);
+	std::vector<std::vector<Triangle> > tris(count);
+
+	TessWork work;
+	work.set = set;
+	work.levels = &levels[0];
+	work.verts = &verts[0];
+	work.tris = &tris[0];
+	thr_parallel_for(count, tess_work, &work);
+
+	std::vector<const std::vector<Vertex>*> vptr(count);
+	std::vector<const std::vector<Triangle>*> tptr(count);
+	for(int i=0; i<count; i++) {
+		vptr[i] = &verts[i];
+		tptr[i] = &tris[i];
+	}
+	join_patches(mesh, &vptr[0], &tptr[0], count);
+}
+
+
+bool PatchKey::operator ==(const PatchKey &k) const {
+	return set == k.set && revision == k.revision && patch == k.patch && levels.u == k.levels.u &&
+		levels.v == k.levels.v && !memcmp(levels.side, k.levels.side, sizeof levels.side);
+}
+
+TessCache::TessCache() {
+	frame = 0;
+	max_age = 30;
+	tessellated = 0;
+}
+
+TessCache::~TessCache() {
+	clear();
+}
+
+void TessCache::begin_frame() {
+	frame++;
+
+	unsigned long i = 0;
+	while(i < entries.size()) {
+		TessPatch *tp = entries[i];
+		if(frame - tp->last_used > max_age) {
+			patches.remove(tp->key);
+			delete tp;
+
+			entries[i] = entries.back();
+			entries.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+void TessCache::set_max_age(unsigned long frames) {
+	max_age = frames;
+}
+
+void TessCache::request(const PatchSet *set, const TessParams &params, TriMesh *mesh) {
+	int count = set->get_patch_count();
+	std::vector<PatchLevels> levels(count);
+	if(count) set->calc_levels(params, &levels[0]);
+
+	requests.push_back(Request());
+	Request &req = requests.back();
+	req.set = set;
+	req.mesh = mesh;
+	req.parts.resize(count);
+
+	for(int i=0; i<count; i++) {
+		PatchKey key;
+		key.set = set;
+		key.revision = set->get_revision();
+		key.patch = i;
+		key.levels = levels[i];
+
+		TessPatch *tp;
+		Pair<PatchKey, TessPatch*> *res = patches.find(key);
+		if(res) {
+			tp = res->val;
+		} else {
+			tp = new TessPatch;
+			tp->key = key;
+			tp->pending = true;
+			patches.insert(key, tp);
+			entries.push_back(tp);
+			pending.push_back(tp);
+		}
+		tp->last_used = frame;
+		req.parts[i] = tp;
+	}
+}
+
+void TessCache::tessellate_patch(int idx, void *cls) {
+	TessPatch *tp = ((TessCache*)cls)->pending[idx];
+	tp->key.set->tessellate(tp->key.patch, tp->key.levels, &tp->verts, &tp->tris);
+}
+
+void TessCache::update() {
+	PROF_SCOPE("TessCache::update");
+	if(!pending.empty()) {
+		thr_parallel_for((int)pending.size(), tessellate_patch, this);
+		tessellated += pending.size();
+
+		for(size_t i=0; i<pending.size(); i++) {
+			pending[i]->pending = false;
+		}
+		pending.clear();
+	}
+
+	for(size_t i=0; i<requests.size(); i++) {
+		Request &req = requests[i];
+		int count = (int)req.parts.size();
+		if(!count) {
+			*req.mesh = TriMesh();
+			continue;
+		}
+
+		std::vector<const std::vector<Vertex>*> vptr(count);
+		std::vector<const std::vector<Triangle>*> tptr(count);
+		for(int j=0; j<count; j++) {
+			vptr[j] = &req.parts[j]->verts;
+			tptr[j] = &req.parts[j]->tris;
+		}
+		join_patches(req.mesh, &vptr[0], &tptr[0], count);
+	}
+	requests.clear();
+}
+
+void TessCache::invalidate(const PatchSet *set) {
+	unsigned long i = 0;
+	while(i < entries.size()) {
+		TessPatch *tp = entries[i];
+		if(tp->key.set == set && !tp->pending) {
+			patches.remove(tp->key);
+			delete tp;
+
+			entries[i] = entries.back();
+			entries.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+void TessCache::clear() {
+	for(size_t i=0; i<entries.size(); i++) {
+		delete entries[i];
+	}
+	entries.clear();
+	pending.clear();
+	requests.clear();
+	patches.clear();
+}
+
+unsigned long TessCache::get_count() const {
+	return entries.size();
+}
+
+unsigned long TessCache::get_tessellated_count() const {
+	return tessellated;
+}
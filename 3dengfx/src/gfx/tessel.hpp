@@ -0,0 +1,195 @@
+/*
+This file is part of the graphics core library.
+
+Copyright (c) 2004, 2005, 2006 John Tsiombikas <nuclear@siggraph.org>
+
+the graphics core library is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+the graphics core library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the graphics core library; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* adaptive tessellation of bicubic bezier patches
+ *
+ * Each patch is split into a grid of u by v segments. The grid size comes
+ * from a bound on the second derivative of the patch in each direction, so
+ * that the triangles stay within max_error of the surface. That error is
+ * in the units of the control points, or in pixels for patches seen from a
+ * point. The patches are evaluated through tables of the bernstein basis
+ * for each grid size.
+ *
+ * The edges shared by two patches (the same four control points, in either
+ * order) are split at the finer of the two levels. Both patches take the
+ * edge vertices from the control points of the edge, so the vertices match
+ * exactly. A patch whose grid doesn't match its edges gets a ring of
+ * triangles joining its inner grid to the edges, so there are no cracks
+ * or T-junctions between patches of different levels.
+ *
+ * TessCache keeps the tessellated patches by (patch set, levels), and
+ * tessellates the missing ones in parallel.
+ */
+
+#ifndef _TESSEL_HPP_
+#define _TESSEL_HPP_
+
+#include <vector>
+#include "gfx/3dgeom.hpp"
+#include "gfx/bvol.hpp"
+#include "common/hashtable.hpp"
+
+#define TESS_MAX_LEVEL		255
+
+struct TessParams {
+	scalar_t max_error;		// distance of the triangles from the surface
+	int min_level, max_level;	// segments along a side of a patch
+
+	/* with use_view, max_error is in pixels for the patches seen from
+	 * view_pos (in the space of the control points). pixels_per_unit is the
+	 * size in pixels of a unit at distance 1, that is the height of the
+	 * viewport over 2 tan(fov / 2).
+	 */
+	bool use_view;
+	Vector3 view_pos;
+	scalar_t pixels_per_unit;
+
+	TessParams();
+};
+
+// a uniform tessellation of level segments along each side of every patch
+TessParams uniform_tess_params(int level);
+
+// segments of a patch in each direction, and along each side (see PatchSet)
+struct PatchLevels {
+	unsigned char u, v;
+	unsigned char side[4];
+};
+
+/* Bicubic bezier patches with shared control points, 16 indices per patch,
+ * 4 for each row along u. The sides are numbered v = 0, u = 1, v = 1, u = 0.
+ */
+class PatchSet {
+private:
+	std::vector<Vector3> cp;
+	std::vector<unsigned int> patches;
+	unsigned long revision;
+
+	// the sides shared by patches are one edge, with their control points in one order
+	std::vector<int> side_edge;
+	std::vector<bool> side_reversed;
+	std::vector<Vector3> edge_cp;
+	int edge_count;
+
+	// bounds of the second derivative of each patch along u and v, and the hull
+	std::vector<scalar_t> curv_u, curv_v;
+	std::vector<AABox> bounds;
+
+	void find_edges();
+	// returns the number of triangles folding against the surface
+	int tessellate(int patch, const PatchLevels &levels, int min_inner,
+			std::vector<Vertex> *verts, std::vector<Triangle> *tris) const;
+
+public:
+	PatchSet();
+
+	void set_data(const Vector3 *cp, int cp_count, const unsigned int *patches, int patch_count);
+
+	inline int get_patch_count() const {return (int)patches.size() / 16;}
+	inline const Vector3 &get_control_point(int patch, int i) const {return cp[patches[patch * 16 + i]];}
+	inline unsigned long get_revision() const {return revision;}
+	inline int get_edge_count() const {return edge_count;}
+
+	// the levels of all the patches for this error
+	void calc_levels(const TessParams &params, PatchLevels *levels) const;
+
+	// appends one patch to the arrays, the indices count from the start of verts
+	void tessellate(int patch, const PatchLevels &levels, std::vector<Vertex> *verts, std::vector<Triangle> *tris) const;
+};
+
+// all the patches into one mesh, in parallel
+void tessellate_patches(const PatchSet *set, const TessParams &params, TriMesh *mesh);
+
+struct PatchKey {
+	const PatchSet *set;
+	unsigned long revision;
+	int patch;
+	PatchLevels levels;
+
+	bool operator ==(const PatchKey &k) const;
+};
+
+template <>
+struct HashTraits<PatchKey> {
+	static uint32_t hash(const PatchKey &key) {
+		const PatchLevels &lv = key.levels;
+		uint32_t sides = lv.side[0] | (lv.side[1] << 8) | (lv.side[2] << 16) | ((uint32_t)lv.side[3] << 24);
+
+		uint32_t h = HashTraits<const PatchSet*>::hash(key.set) ^ int_hash((uint32_t)key.revision);
+		h = int_hash(h ^ (uint32_t)key.patch);
+		h = int_hash(h ^ (lv.u | (lv.v << 8)));
+		return int_hash(h ^ sides);
+	}
+};
+
+struct TessPatch {
+	PatchKey key;
+	std::vector<Vertex> verts;
+	std::vector<Triangle> tris;
+	unsigned long last_used;
+	bool pending;
+};
+
+/* Keeps the tessellated patches by their set and levels. Call request() for
+ * every patch set to draw, then update() to tessellate the patches missing
+ * from the cache in parallel, and put the meshes of all the requests
+ * together. Patches unused for max_age frames are dropped by begin_frame().
+ */
+class TessCache {
+private:
+	struct Request {
+		const PatchSet *set;
+		TriMesh *mesh;
+		std::vector<TessPatch*> parts;
+	};
+
+	HashTable<PatchKey, TessPatch*> patches;
+	std::vector<TessPatch*> entries;
+	std::vector<TessPatch*> pending;
+	std::vector<Request> requests;
+	unsigned long frame;
+	unsigned long max_age;
+	unsigned long tessellated;
+
+	static void tessellate_patch(int idx, void *cls);
+
+	TessCache(const TessCache &tc);
+	TessCache &operator =(const TessCache &tc);
+
+public:
+	TessCache();
+	~TessCache();
+
+	void begin_frame();
+	void set_max_age(unsigned long frames);
+
+	// the mesh is filled in by update()
+	void request(const PatchSet *set, const TessParams &params, TriMesh *mesh);
+	void update();
+
+	// forget every patch of the set
+	void invalidate(const PatchSet *set);
+	void clear();
+
+	unsigned long get_count() const;
+	unsigned long get_tessellated_count() const;	// patches tessellated so far
+};
+
+#endif	// _TESSEL_HPP_
@@ -22,6 +22,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include <cmath>
 #include "n3dmath2_mat.hpp"
 
+#if defined(__SSE__) && defined(SINGLE_PRECISION_MATH)
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
 using namespace std;
 
 // ----------- Matrix3x3 --------------
@@ -332,8 +337,6 @@ Matrix4x4::Matrix4x4(	scalar_t m11, scalar_t m12, scalar_t m13, scalar_t m14,
 	m[2][0] = m31; m[2][1] = m32; m[2][2] = m33; m[2][3] = m34;
 	m[3][0] = m41; m[3][1] = m42; m[3][2] = m43; m[3][3] = m44;
 	//memcpy(m, &m11, 16 * sizeof(scalar_t));	// args are adjacent in the stack
-	
-	glmatrix = 0;
 }
 
 Matrix4x4::Matrix4x4(const Matrix3x3 &mat3x3) {
@@ -343,12 +346,37 @@ Matrix4x4::Matrix4x4(const Matrix3x3 &mat3x3) {
 			m[i][j] = mat3x3[i][j];
 		}
 	}
-
-	glmatrix = 0;
 }
 
-Matrix4x4::~Matrix4x4() {
-	if(glmatrix) delete [] glmatrix;
+/* The SSE kernels use unaligned loads and stores; they cost nothing extra on
+ * aligned data, and matrices allocated on the heap as part of other objects
+ * are not guaranteed to be 16 byte aligned everywhere.
+ */
+
+/* mul4x4
+ * res = a * b, res may be the same as a.
+ */
+static inline void mul4x4(scalar_t (*res)[4], const scalar_t (*a)[4], const scalar_t (*b)[4]) {
+#ifdef USE_SSE
+	__m128 b0 = _mm_loadu_ps(b[0]);
+	__m128 b1 = _mm_loadu_ps(b[1]);
+	__m128 b2 = _mm_loadu_ps(b[2]);
+	__m128 b3 = _mm_loadu_ps(b[3]);
+
+	for(int i=0; i<4; i++) {
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i][0]), b0), _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+		r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i][2]), b2), _mm_mul_ps(_mm_set1_ps(a[i][3]), b3)));
+		_mm_storeu_ps(res[i], r);
+	}
+#else
+	scalar_t tmp[4][4];
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			tmp[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+		}
+	}
+	memcpy(res, tmp, 16 * sizeof(scalar_t));
+#endif	// USE_SSE
 }
 
 Matrix4x4 operator +(const Matrix4x4 &m1, const Matrix4x4 &m2) {
@@ -375,13 +403,7 @@ Matrix4x4 operator -(const Matrix4x4 &m1, const Matrix4x4 &m2) {
 
 Matrix4x4 operator *(const Matrix4x4 &m1, const Matrix4x4 &m2) {
 	Matrix4x4 res;
-	
-	for(int i=0; i<4; i++) {
-		for(int j=0; j<4; j++) {
-			res.m[i][j] = m1.m[i][0] * m2.m[0][j] + m1.m[i][1] * m2.m[1][j] + m1.m[i][2] * m2.m[2][j] + m1.m[i][3] * m2.m[3][j];
-		}
-	}
-
+	mul4x4(res.m, m1.m, m2.m);
 	return res;
 }
 
@@ -404,15 +426,7 @@ void operator -=(Matrix4x4 &m1, const Matrix4x4 &m2) {
 }
 
 void operator *=(Matrix4x4 &m1, const Matrix4x4 &m2) {
-	Matrix4x4 res;
-	
-	for(int i=0; i<4; i++) {
-		for(int j=0; j<4; j++) {
-			res.m[i][j] = m1.m[i][0] * m2.m[0][j] + m1.m[i][1] * m2.m[1][j] + m1.m[i][2] * m2.m[2][j] + m1.m[i][3] * m2.m[3][j];
-		}
-	}
-
-	memcpy(m1.m, res.m, 16 * sizeof(scalar_t));
+	mul4x4(m1.m, m1.m, m2.m);
 }
 
 Matrix4x4 operator *(const Matrix4x4 &mat, scalar_t scalar) {
@@ -532,6 +546,44 @@ void Matrix4x4::set_rotation(const Vector3 &axis, scalar_t angle) {
 	m[2][2] = nzsq + (1-nzsq) * cosa;
 }
 
+void Matrix4x4::rotate(const Quaternion &quat) {
+	Matrix4x4 rot;
+	rot.set_rotation(quat);
+	*this *= rot;
+}
+
+/* set_rotation
+ * same matrix as Quaternion::get_rotation_matrix(), without going
+ * through a Matrix3x3 and with the common products computed once.
+ */
+void Matrix4x4::set_rotation(const Quaternion &quat) {
+	scalar_t x2 = quat.v.x + quat.v.x;
+	scalar_t y2 = quat.v.y + quat.v.y;
+	scalar_t z2 = quat.v.z + quat.v.z;
+
+	scalar_t xx = quat.v.x * x2, yy = quat.v.y * y2, zz = quat.v.z * z2;
+	scalar_t xy = quat.v.x * y2, yz = quat.v.y * z2, zx = quat.v.z * x2;
+	scalar_t sx = quat.s * x2, sy = quat.s * y2, sz = quat.s * z2;
+
+	m[0][0] = 1.0 - yy - zz;
+	m[0][1] = xy + sz;
+	m[0][2] = zx - sy;
+	m[0][3] = 0.0;
+
+	m[1][0] = xy - sz;
+	m[1][1] = 1.0 - xx - zz;
+	m[1][2] = yz + sx;
+	m[1][3] = 0.0;
+
+	m[2][0] = zx + sy;
+	m[2][1] = yz - sx;
+	m[2][2] = 1.0 - xx - yy;
+	m[2][3] = 0.0;
+
+	m[3][0] = m[3][1] = m[3][2] = 0.0;
+	m[3][3] = 1.0;
+}
+
 void Matrix4x4::scale(const Vector4 &scale_vec) {
 	Matrix4x4 smat(	scale_vec.x, 0, 0, 0,
 					0, scale_vec.y, 0, 0,
@@ -570,21 +622,30 @@ Vector4 Matrix4x4::get_row_vector(unsigned int row_index) const {
 }
 
 void Matrix4x4::transpose() {
-	Matrix4x4 tmp = *this;
+#ifdef USE_SSE
+	__m128 r0 = _mm_loadu_ps(m[0]);
+	__m128 r1 = _mm_loadu_ps(m[1]);
+	__m128 r2 = _mm_loadu_ps(m[2]);
+	__m128 r3 = _mm_loadu_ps(m[3]);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(m[0], r0);
+	_mm_storeu_ps(m[1], r1);
+	_mm_storeu_ps(m[2], r2);
+	_mm_storeu_ps(m[3], r3);
+#else
 	for(int i=0; i<4; i++) {
-		for(int j=0; j<4; j++) {
-			m[i][j] = tmp[j][i];
+		for(int j=0; j<i; j++) {
+			scalar_t tmp = m[i][j];
+			m[i][j] = m[j][i];
+			m[j][i] = tmp;
 		}
 	}
+#endif	// USE_SSE
 }
 
 Matrix4x4 Matrix4x4::transposed() const {
-	Matrix4x4 res;
-	for(int i=0; i<4; i++) {
-		for(int j=0; j<4; j++) {
-			res[i][j] = m[j][i];
-		}
-	}
+	Matrix4x4 res = *this;
+	res.transpose();
 	return res;
 }
 
@@ -678,17 +739,274 @@ Matrix4x4 Matrix4x4::adjoint() const {
 	return coef;
 }
 
+#ifdef USE_SSE
+#define SHUF(a, b, x, y, z, w)	_mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define SWZ(a, x, y, z, w)		SHUF(a, a, x, y, z, w)
+
+// 2x2 matrices, stored row major in the 4 lanes of a register
+static inline __m128 mat2_mul(__m128 a, __m128 b) {
+	return _mm_add_ps(_mm_mul_ps(a, SWZ(b, 0, 3, 0, 3)), _mm_mul_ps(SWZ(a, 1, 0, 3, 2), SWZ(b, 2, 1, 2, 1)));
+}
+
+// adj(a) * b
+static inline __m128 mat2_adj_mul(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(SWZ(a, 3, 3, 0, 0), b), _mm_mul_ps(SWZ(a, 1, 1, 2, 2), SWZ(b, 2, 3, 0, 1)));
+}
+
+// a * adj(b)
+static inline __m128 mat2_mul_adj(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(a, SWZ(b, 3, 0, 3, 0)), _mm_mul_ps(SWZ(a, 1, 0, 3, 2), SWZ(b, 2, 1, 2, 1)));
+}
+#endif	// USE_SSE
+
+/* inverse
+ * The SSE version inverts the matrix blockwise, as four 2x2 matrices,
+ * the scalar one expands the determinant and the cofactors in terms
+ * of the 2x2 sub-determinants of the top and bottom row pairs.
+ * Either way it's a lot less work than adjoint() / determinant().
+ */
 Matrix4x4 Matrix4x4::inverse() const {
+	Matrix4x4 res;
+
+#ifdef USE_SSE
+	__m128 r0 = _mm_loadu_ps(m[0]);
+	__m128 r1 = _mm_loadu_ps(m[1]);
+	__m128 r2 = _mm_loadu_ps(m[2]);
+	__m128 r3 = _mm_loadu_ps(m[3]);
+
+	// the 2x2 sub-matrices | A B |
+	//                      | C D |
+	__m128 a = _mm_movelh_ps(r0, r1);
+	__m128 b = _mm_movehl_ps(r1, r0);
+	__m128 c = _mm_movelh_ps(r2, r3);
+	__m128 d = _mm_movehl_ps(r3, r2);
+
+	// their determinants (|A|, |B|, |C|, |D|)
+	__m128 det_sub = _mm_sub_ps(_mm_mul_ps(SHUF(r0, r2, 0, 2, 0, 2), SHUF(r1, r3, 1, 3, 1, 3)),
+			_mm_mul_ps(SHUF(r0, r2, 1, 3, 1, 3), SHUF(r1, r3, 0, 2, 0, 2)));
+	__m128 det_a = SWZ(det_sub, 0, 0, 0, 0);
+	__m128 det_b = SWZ(det_sub, 1, 1, 1, 1);
+	__m128 det_c = SWZ(det_sub, 2, 2, 2, 2);
+	__m128 det_d = SWZ(det_sub, 3, 3, 3, 3);
+
+	__m128 dc = mat2_adj_mul(d, c);
+	__m128 ab = mat2_adj_mul(a, b);
+
+	// adjugates of the blocks of the inverse | X Y |
+	//                                        | Z W |
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), mat2_mul(b, dc));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), mat2_mul(c, ab));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mat2_mul_adj(d, ab));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mat2_mul_adj(a, dc));
+
+	// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+	__m128 tr = _mm_mul_ps(ab, SWZ(dc, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, _mm_movehl_ps(tr, tr));
+	tr = _mm_add_ss(tr, SWZ(tr, 1, 1, 1, 1));
+	tr = SWZ(tr, 0, 0, 0, 0);
+
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+
+	x = _mm_mul_ps(x, inv_det);
+	y = _mm_mul_ps(y, inv_det);
+	z = _mm_mul_ps(z, inv_det);
+	w = _mm_mul_ps(w, inv_det);
+
+	// undo the adjugates while putting the blocks back together
+	_mm_storeu_ps(res.m[0], SHUF(x, y, 3, 1, 3, 1));
+	_mm_storeu_ps(res.m[1], SHUF(x, y, 2, 0, 2, 0));
+	_mm_storeu_ps(res.m[2], SHUF(z, w, 3, 1, 3, 1));
+	_mm_storeu_ps(res.m[3], SHUF(z, w, 2, 0, 2, 0));
+#else
+	scalar_t s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1];
+	scalar_t s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2];
+	scalar_t s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3];
+	scalar_t s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+	scalar_t s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3];
+	scalar_t s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+
+	scalar_t c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3];
+	scalar_t c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3];
+	scalar_t c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2];
+	scalar_t c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3];
+	scalar_t c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2];
+	scalar_t c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+
+	scalar_t inv_det = 1.0 / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+	res.m[0][0] = ( m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3) * inv_det;
+	res.m[0][1] = (-m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3) * inv_det;
+	res.m[0][2] = ( m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3) * inv_det;
+	res.m[0][3] = (-m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3) * inv_det;
+
+	res.m[1][0] = (-m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1) * inv_det;
+	res.m[1][1] = ( m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1) * inv_det;
+	res.m[1][2] = (-m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1) * inv_det;
+	res.m[1][3] = ( m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1) * inv_det;
+
+	res.m[2][0] = ( m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0) * inv_det;
+	res.m[2][1] = (-m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0) * inv_det;
+	res.m[2][2] = ( m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0) * inv_det;
+	res.m[2][3] = (-m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0) * inv_det;
+
+	res.m[3][0] = (-m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0) * inv_det;
+	res.m[3][1] = ( m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0) * inv_det;
+	res.m[3][2] = (-m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0) * inv_det;
+	res.m[3][3] = ( m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0) * inv_det;
+#endif	// USE_SSE
+
+	return res;
+}
+
+#ifdef USE_SSE
+// cross product of the xyz parts, w ends up 0
+static inline __m128 cross3(__m128 a, __m128 b) {
+	return _mm_sub_ps(_mm_mul_ps(SWZ(a, 1, 2, 0, 3), SWZ(b, 2, 0, 1, 3)),
+			_mm_mul_ps(SWZ(a, 2, 0, 1, 3), SWZ(b, 1, 2, 0, 3)));
+}
+#endif	// USE_SSE
+
+/* inverse_affine
+ * inverts the upper 3x3 part through its cofactors (so scaling and
+ * shearing are fine), and applies it to the negated translation.
+ */
+Matrix4x4 Matrix4x4::inverse_affine() const {
+	Matrix4x4 res;
 
-	Matrix4x4 AdjMat = adjoint();
+#ifdef USE_SSE
+	__m128 r0 = _mm_loadu_ps(m[0]);
+	__m128 r1 = _mm_loadu_ps(m[1]);
+	__m128 r2 = _mm_loadu_ps(m[2]);
+
+	// the columns of the inverse 3x3 part, times the determinant
+	__m128 c0 = cross3(r1, r2);
+	__m128 c1 = cross3(r2, r0);
+	__m128 c2 = cross3(r0, r1);
+
+	__m128 det = _mm_mul_ps(r0, c0);
+	det = _mm_add_ps(det, _mm_movehl_ps(det, det));
+	det = _mm_add_ss(det, SWZ(det, 1, 1, 1, 1));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), SWZ(det, 0, 0, 0, 0));
+
+	c0 = _mm_mul_ps(c0, inv_det);
+	c1 = _mm_mul_ps(c1, inv_det);
+	c2 = _mm_mul_ps(c2, inv_det);
+
+	__m128 t = _mm_add_ps(_mm_mul_ps(SWZ(r0, 3, 3, 3, 3), c0), _mm_mul_ps(SWZ(r1, 3, 3, 3, 3), c1));
+	t = _mm_add_ps(t, _mm_mul_ps(SWZ(r2, 3, 3, 3, 3), c2));
+	t = _mm_sub_ps(_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), t);
+
+	_MM_TRANSPOSE4_PS(c0, c1, c2, t);
+	_mm_storeu_ps(res.m[0], c0);
+	_mm_storeu_ps(res.m[1], c1);
+	_mm_storeu_ps(res.m[2], c2);
+	_mm_storeu_ps(res.m[3], t);
+#else
+	scalar_t c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	scalar_t c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	scalar_t c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+
+	scalar_t inv_det = 1.0 / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+	res.m[0][0] = c00 * inv_det;
+	res.m[1][0] = c01 * inv_det;
+	res.m[2][0] = c02 * inv_det;
+
+	res.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+	res.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+	res.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+
+	res.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+	res.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+	res.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
 
-	return AdjMat * (1.0f / determinant());
+	for(int i=0; i<3; i++) {
+		res.m[i][3] = -(res.m[i][0] * m[0][3] + res.m[i][1] * m[1][3] + res.m[i][2] * m[2][3]);
+	}
+	res.m[3][0] = res.m[3][1] = res.m[3][2] = 0.0;
+	res.m[3][3] = 1.0;
+#endif	// USE_SSE
+
+	return res;
 }
 
 const scalar_t *Matrix4x4::opengl_matrix() const {
 	return (const scalar_t*)m;
 }
 
+
+#ifdef USE_SSE
+// loads the columns of the matrix
+static inline void load_columns(const Matrix4x4 &mat, __m128 *col) {
+	col[0] = _mm_loadu_ps(mat[0]);
+	col[1] = _mm_loadu_ps(mat[1]);
+	col[2] = _mm_loadu_ps(mat[2]);
+	col[3] = _mm_loadu_ps(mat[3]);
+	_MM_TRANSPOSE4_PS(col[0], col[1], col[2], col[3]);
+}
+
+static inline void store_vec3(Vector3 *v, __m128 r) {
+	_mm_storel_pi((__m64*)&v->x, r);
+	_mm_store_ss(&v->z, _mm_movehl_ps(r, r));
+}
+#endif	// USE_SSE
+
+void transform_points(Vector3 *dest, const Vector3 *src, int count, const Matrix4x4 &mat) {
+#ifdef USE_SSE
+	__m128 col[4];
+	load_columns(mat, col);
+
+	for(int i=0; i<count; i++) {
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&src[i].x), col[0]), _mm_mul_ps(_mm_load1_ps(&src[i].y), col[1]));
+		r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&src[i].z), col[2]), col[3]));
+		store_vec3(dest + i, r);
+	}
+#else
+	for(int i=0; i<count; i++) {
+		dest[i] = src[i].transformed(mat);
+	}
+#endif	// USE_SSE
+}
+
+void transform_vectors(Vector3 *dest, const Vector3 *src, int count, const Matrix4x4 &mat) {
+#ifdef USE_SSE
+	__m128 col[4];
+	load_columns(mat, col);
+
+	for(int i=0; i<count; i++) {
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&src[i].x), col[0]), _mm_mul_ps(_mm_load1_ps(&src[i].y), col[1]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_load1_ps(&src[i].z), col[2]));
+		store_vec3(dest + i, r);
+	}
+#else
+	for(int i=0; i<count; i++) {
+		const Vector3 &v = src[i];
+		scalar_t x = mat[0][0] * v.x + mat[0][1] * v.y + mat[0][2] * v.z;
+		scalar_t y = mat[1][0] * v.x + mat[1][1] * v.y + mat[1][2] * v.z;
+		scalar_t z = mat[2][0] * v.x + mat[2][1] * v.y + mat[2][2] * v.z;
+		dest[i] = Vector3(x, y, z);
+	}
+#endif	// USE_SSE
+}
+
+void transform_points(Vector4 *dest, const Vector4 *src, int count, const Matrix4x4 &mat) {
+#ifdef USE_SSE
+	__m128 col[4];
+	load_columns(mat, col);
+
+	for(int i=0; i<count; i++) {
+		__m128 r = _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&src[i].x), col[0]), _mm_mul_ps(_mm_load1_ps(&src[i].y), col[1]));
+		r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(_mm_load1_ps(&src[i].z), col[2]), _mm_mul_ps(_mm_load1_ps(&src[i].w), col[3])));
+		_mm_storeu_ps(&dest[i].x, r);
+	}
+#else
+	for(int i=0; i<count; i++) {
+		dest[i] = src[i].transformed(mat);
+	}
+#endif	// USE_SSE
+}
+
 ostream &operator <<(ostream &out, const Matrix4x4 &mat) {
 	for(int i=0; i<4; i++) {
 		char str[100];
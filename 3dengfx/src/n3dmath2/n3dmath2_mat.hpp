@@ -84,10 +84,19 @@ public:
 };
 
 
+/* Matrix4x4 is plain data (no destructor or hidden pointers), so it can be
+ * copied with memcpy and kept in arrays. The elements are 16 byte aligned
+ * so that each row can be loaded into an SSE register.
+ */
+#ifdef __GNUC__
+#define MAT_ALIGN	__attribute__ ((aligned(16)))
+#else
+#define MAT_ALIGN
+#endif
+
 class Matrix4x4 {
 private:
-	scalar_t m[4][4];
-	mutable float *glmatrix;
+	scalar_t m[4][4] MAT_ALIGN;
 public:
 	
 	static Matrix4x4 identity_matrix;
@@ -99,7 +108,6 @@ public:
 				scalar_t m41, scalar_t m42, scalar_t m43, scalar_t m44);
 	
 	Matrix4x4(const Matrix3x3 &mat3x3);
-	~Matrix4x4();
 	
 	// binary operations matrix (op) matrix
 	friend Matrix4x4 operator +(const Matrix4x4 &m1, const Matrix4x4 &m2);
@@ -128,6 +136,8 @@ public:
 	void rotate(const Vector3 &axis, scalar_t angle);	// 3d axis/angle rotation
 	void set_rotation(const Vector3 &euler_angles);
 	void set_rotation(const Vector3 &axis, scalar_t angle);
+	void rotate(const Quaternion &quat);
+	void set_rotation(const Quaternion &quat);
 	
 	void scale(const Vector4 &scale_vec);
 	void set_scaling(const Vector4 &scale_vec);
@@ -142,12 +152,21 @@ public:
 	scalar_t determinant() const;
 	Matrix4x4 adjoint() const;
 	Matrix4x4 inverse() const;
+	// faster inverse, for matrices with a last row of (0, 0, 0, 1)
+	Matrix4x4 inverse_affine() const;
 	
 	const scalar_t *opengl_matrix() const;
 		
 	friend std::ostream &operator <<(std::ostream &out, const Matrix4x4 &mat);
 };
 
+/* transform arrays of points (w = 1) and direction vectors (w = 0).
+ * dest may be the same as src.
+ */
+void transform_points(Vector3 *dest, const Vector3 *src, int count, const Matrix4x4 &mat);
+void transform_vectors(Vector3 *dest, const Vector3 *src, int count, const Matrix4x4 &mat);
+void transform_points(Vector4 *dest, const Vector4 *src, int count, const Matrix4x4 &mat);
+
 #include "n3dmath2_mat.inl"
 
 #endif	// _N3DMATH2_MAT_HPP_
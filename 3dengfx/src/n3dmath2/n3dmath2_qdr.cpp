@@ -256,3 +256,31 @@ bool check_tri_ray_intersection(const Vector3 &v0, const Vector3 &v1, const Vect
 
 	return false;
 }
+
+/* find_tri_ray_intersection
+ * Moller-Trumbore, returns the parametric distance of the intersection
+ * along the ray (in units of ray.dir) in t.
+ */
+bool find_tri_ray_intersection(const Vector3 &v0, const Vector3 &v1, const Vector3 &v2, const Ray &ray, scalar_t *t) {
+	Vector3 e1 = v1 - v0;
+	Vector3 e2 = v2 - v0;
+	Vector3 pvec = cross_product(ray.dir, e2);
+
+	scalar_t det = dot_product(e1, pvec);
+	if(fabs(det) < xsmall_number) return false;
+	scalar_t inv_det = 1.0 / det;
+
+	Vector3 tvec = ray.origin - v0;
+	scalar_t u = dot_product(tvec, pvec) * inv_det;
+	if(u < 0.0 || u > 1.0) return false;
+
+	Vector3 qvec = cross_product(tvec, e1);
+	scalar_t v = dot_product(ray.dir, qvec) * inv_det;
+	if(v < 0.0 || u + v > 1.0) return false;
+
+	scalar_t tres = dot_product(e2, qvec) * inv_det;
+	if(tres < error_margin) return false;
+
+	*t = tres;
+	return true;
+}
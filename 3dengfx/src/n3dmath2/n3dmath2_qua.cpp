@@ -26,6 +26,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "n3dmath2.hpp"
 
+#if defined(__SSE__) && defined(SINGLE_PRECISION_MATH)
+#include <xmmintrin.h>
+#define USE_SSE
+#endif
+
 Quaternion::Quaternion() {
 	s = 1.0;
 	v.x = v.y = v.z = 0.0;
@@ -170,8 +175,183 @@ Quaternion slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t) {
 		return Quaternion(q2.s * coef1 + q1.s * coef2, q2.v * coef1 + q1.v * coef2).normalized();
 	}
 }
-	
 
+/* exact_slerp
+ * falls back to linear interpolation when q1 and q2 are too close for
+ * sin(angle) to be usable.
+ */
+Quaternion exact_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t) {
+	scalar_t dot = q1.s * q2.s + dot_product(q1.v, q2.v);
+	scalar_t sign = 1.0;
+
+	if(dot < 0.0) {
+		dot = -dot;
+		sign = -1.0;
+	}
+
+	scalar_t coef1, coef2;
+	if(1.0 - dot < xsmall_number) {
+		coef1 = 1.0 - t;
+		coef2 = t;
+	} else {
+		scalar_t angle = acos(dot);
+		scalar_t inv_sin = 1.0 / sin(angle);
+		coef1 = sin((1.0 - t) * angle) * inv_sin;
+		coef2 = sin(t * angle) * inv_sin;
+	}
+	coef2 *= sign;
+
+	return Quaternion(q1.s * coef1 + q2.s * coef2, q1.v * coef1 + q2.v * coef2).normalized();
+}
+
+/* the correction of t for fast_slerp, a function of the cosine of the angle
+ * between the quaternions, fitted to minimize the error against exact_slerp.
+ * (from "Approximating slerp", Arseny Kapoulkine 2015)
+ */
+static inline scalar_t fast_slerp_t(scalar_t d, scalar_t t) {
+	scalar_t ca = 1.0904 + d * (-3.2452 + d * (3.55645 - d * 1.43519));
+	scalar_t cb = 0.848013 + d * (-1.06021 + d * 0.215638);
+	scalar_t k = ca * (t - 0.5) * (t - 0.5) + cb;
+	return t + t * (t - 0.5) * (t - 1.0) * k;
+}
+
+Quaternion fast_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t) {
+	scalar_t dot = q1.s * q2.s + dot_product(q1.v, q2.v);
+
+	scalar_t ot = fast_slerp_t(fabs(dot), t);
+	scalar_t coef1 = 1.0 - ot;
+	scalar_t coef2 = dot < 0.0 ? -ot : ot;
+
+	Quaternion res(q1.s * coef1 + q2.s * coef2, q1.v * coef1 + q2.v * coef2);
+	scalar_t inv_len = 1.0 / sqrt(res.length_sq());
+	res.s *= inv_len;
+	res.v *= inv_len;
+	return res;
+}
+
+#ifdef USE_SSE
+// loads 4 quaternions as (s, x, y, z) vectors
+static inline void load_quat4(const Quaternion *q, __m128 *s, __m128 *x, __m128 *y, __m128 *z) {
+	*s = _mm_loadu_ps(&q[0].s);
+	*x = _mm_loadu_ps(&q[1].s);
+	*y = _mm_loadu_ps(&q[2].s);
+	*z = _mm_loadu_ps(&q[3].s);
+	_MM_TRANSPOSE4_PS(*s, *x, *y, *z);
+}
+
+static inline void store_quat4(Quaternion *q, __m128 s, __m128 x, __m128 y, __m128 z) {
+	_MM_TRANSPOSE4_PS(s, x, y, z);
+	_mm_storeu_ps(&q[0].s, s);
+	_mm_storeu_ps(&q[1].s, x);
+	_mm_storeu_ps(&q[2].s, y);
+	_mm_storeu_ps(&q[3].s, z);
+}
+#endif	// USE_SSE
+
+void fast_slerp(Quaternion *dest, const Quaternion *q1, const Quaternion *q2, const scalar_t *t, int count) {
+	int i = 0;
+
+#ifdef USE_SSE
+	__m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 one = _mm_set1_ps(1.0f);
+
+	for(; i<count-3; i+=4) {
+		__m128 s1, x1, y1, z1, s2, x2, y2, z2;
+		load_quat4(q1 + i, &s1, &x1, &y1, &z1);
+		load_quat4(q2 + i, &s2, &x2, &y2, &z2);
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s1, s2), _mm_mul_ps(x1, x2)),
+				_mm_add_ps(_mm_mul_ps(y1, y2), _mm_mul_ps(z1, z2)));
+		__m128 sign = _mm_and_ps(dot, sign_mask);
+		__m128 d = _mm_andnot_ps(sign_mask, dot);
+
+		// see fast_slerp_t
+		__m128 tt = _mm_loadu_ps(t + i);
+		__m128 ca = _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)));
+		ca = _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, ca));
+		ca = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, ca));
+		__m128 cb = _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)));
+		cb = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, cb));
+
+		__m128 th = _mm_sub_ps(tt, half);
+		__m128 k = _mm_add_ps(_mm_mul_ps(ca, _mm_mul_ps(th, th)), cb);
+		__m128 ot = _mm_add_ps(tt, _mm_mul_ps(_mm_mul_ps(tt, th), _mm_mul_ps(_mm_sub_ps(tt, one), k)));
+
+		__m128 c1 = _mm_sub_ps(one, ot);
+		__m128 c2 = _mm_xor_ps(ot, sign);
+
+		__m128 s = _mm_add_ps(_mm_mul_ps(s1, c1), _mm_mul_ps(s2, c2));
+		__m128 x = _mm_add_ps(_mm_mul_ps(x1, c1), _mm_mul_ps(x2, c2));
+		__m128 y = _mm_add_ps(_mm_mul_ps(y1, c1), _mm_mul_ps(y2, c2));
+		__m128 z = _mm_add_ps(_mm_mul_ps(z1, c1), _mm_mul_ps(z2, c2));
+
+		__m128 len_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(x, x)),
+				_mm_add_ps(_mm_mul_ps(y, y), _mm_mul_ps(z, z)));
+		__m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(len_sq));
+
+		store_quat4(dest + i, _mm_mul_ps(s, inv_len), _mm_mul_ps(x, inv_len),
+				_mm_mul_ps(y, inv_len), _mm_mul_ps(z, inv_len));
+	}
+#endif	// USE_SSE
+
+	for(; i<count; i++) {
+		dest[i] = fast_slerp(q1[i], q2[i], t[i]);
+	}
+}
+
+void get_rotation_matrices(Matrix4x4 *dest, const Quaternion *quats, int count) {
+	int i = 0;
+
+#ifdef USE_SSE
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+
+	for(; i<count-3; i+=4) {
+		__m128 s, x, y, z;
+		load_quat4(quats + i, &s, &x, &y, &z);
+
+		__m128 x2 = _mm_add_ps(x, x);
+		__m128 y2 = _mm_add_ps(y, y);
+		__m128 z2 = _mm_add_ps(z, z);
+
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), yz = _mm_mul_ps(y, z2), zx = _mm_mul_ps(z, x2);
+		__m128 sx = _mm_mul_ps(s, x2), sy = _mm_mul_ps(s, y2), sz = _mm_mul_ps(s, z2);
+
+		// same layout as Matrix4x4::set_rotation(const Quaternion&)
+		__m128 r0[4], r1[4], r2[4];
+		r0[0] = _mm_sub_ps(_mm_sub_ps(one, yy), zz);
+		r0[1] = _mm_add_ps(xy, sz);
+		r0[2] = _mm_sub_ps(zx, sy);
+		r0[3] = zero;
+		r1[0] = _mm_sub_ps(xy, sz);
+		r1[1] = _mm_sub_ps(_mm_sub_ps(one, xx), zz);
+		r1[2] = _mm_add_ps(yz, sx);
+		r1[3] = zero;
+		r2[0] = _mm_add_ps(zx, sy);
+		r2[1] = _mm_sub_ps(yz, sx);
+		r2[2] = _mm_sub_ps(_mm_sub_ps(one, xx), yy);
+		r2[3] = zero;
+
+		_MM_TRANSPOSE4_PS(r0[0], r0[1], r0[2], r0[3]);
+		_MM_TRANSPOSE4_PS(r1[0], r1[1], r1[2], r1[3]);
+		_MM_TRANSPOSE4_PS(r2[0], r2[1], r2[2], r2[3]);
+
+		for(int j=0; j<4; j++) {
+			Matrix4x4 &mat = dest[i + j];
+			_mm_storeu_ps(mat[0], r0[j]);
+			_mm_storeu_ps(mat[1], r1[j]);
+			_mm_storeu_ps(mat[2], r2[j]);
+			_mm_storeu_ps(mat[3], _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f));
+		}
+	}
+#endif	// USE_SSE
+
+	for(; i<count; i++) {
+		dest[i].set_rotation(quats[i]);
+	}
+}
 
 std::ostream &operator <<(std::ostream &out, const Quaternion &q) {
 	out << "(" << q.s << ", " << q.v << ")";
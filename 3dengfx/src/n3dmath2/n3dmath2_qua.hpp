@@ -72,9 +72,33 @@ public:
 	Matrix3x3 get_rotation_matrix() const;
 	
 	friend Quaternion slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
+	friend Quaternion exact_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
+	friend Quaternion fast_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
 	
 	friend std::ostream &operator <<(std::ostream &out, const Quaternion &q);
 };
 
+Quaternion slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
+
+/* exact_slerp
+ * spherical interpolation at constant angular velocity along the shorter
+ * arc. slerp() is kept as it was for the existing animations, it is neither.
+ */
+Quaternion exact_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
+
+/* fast_slerp
+ * normalized linear interpolation, with the interpolation parameter corrected
+ * to approximate the constant angular velocity of exact_slerp. For unit
+ * quaternions the result is within 0.05 degrees of exact_slerp(), without
+ * any trig functions.
+ */
+Quaternion fast_slerp(const Quaternion &q1, const Quaternion &q2, scalar_t t);
+
+/* array versions of fast_slerp() and get_rotation_matrix(), dest may be the
+ * same as q1 or q2.
+ */
+void fast_slerp(Quaternion *dest, const Quaternion *q1, const Quaternion *q2, const scalar_t *t, int count);
+void get_rotation_matrices(Matrix4x4 *dest, const Quaternion *quats, int count);
+
 
 #endif	// _N3DMATH2_QUA_HPP_